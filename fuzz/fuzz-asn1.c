@@ -58,8 +58,8 @@ int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size)
         bytes[i] = feeder_next_byte();
     }
 
-    ret = feeder_next_byte() % 4;
-    /* fuzz either ptls_asn1_validation or ptls_asn1_get_expected_type_and_length */
+    ret = feeder_next_byte() % 5;
+    /* fuzz either ptls_asn1_validation, ptls_asn1_get_expected_type_and_length, the PEM loaders, or the DER cursor */
     if (ret == 0) {
         ptls_asn1_validation(bytes, bytes_max, &ctx);
     } else if (ret == 1) {
@@ -68,6 +68,17 @@ int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size)
         expected_type = feeder_next_byte();
         ptls_asn1_get_expected_type_and_length(bytes, bytes_max, byte_index, expected_type, &length, &indefinite_length, &last_byte,
                 &decode_error, &ctx);
+    } else if (ret == 4) {
+        ptls_asn1_x509_t x509;
+        if (ptls_asn1_x509_decode(&x509, ptls_iovec_init(bytes, bytes_max)) == 0) {
+            ptls_asn1_der_cursor_t san;
+            ptls_iovec_t name;
+            uint64_t unixtime;
+            ptls_asn1_der_decode_time(&unixtime, x509.not_after.tag, x509.not_after.value);
+            ptls_asn1_der_init(&san, x509.subject_alt_name);
+            while (ptls_asn1_x509_next_dns_name(&san, &name) == 0 && name.base != NULL)
+                ;
+        }
     } else if (ret == 2 || ret == 3) {
         ptls_context_t ctx = {};
         char fname[] = "/tmp/XXXXXXXX";
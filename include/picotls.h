@@ -84,6 +84,12 @@ extern "C" {
 #define PTLS_CHACHA20POLY1305_IV_SIZE 12
 #define PTLS_CHACHA20POLY1305_TAG_SIZE 16
 
+#define PTLS_AEGIS128L_KEY_SIZE 16
+#define PTLS_AEGIS128L_IV_SIZE 16
+#define PTLS_AEGIS256_KEY_SIZE 32
+#define PTLS_AEGIS256_IV_SIZE 32
+#define PTLS_AEGIS_TAG_SIZE 16
+
 #define PTLS_BLOWFISH_KEY_SIZE 16
 #define PTLS_BLOWFISH_BLOCK_SIZE 8
 
@@ -93,14 +99,24 @@ extern "C" {
 #define PTLS_SHA384_BLOCK_SIZE 128
 #define PTLS_SHA384_DIGEST_SIZE 48
 
-#define PTLS_MAX_SECRET_SIZE 32
-#define PTLS_MAX_IV_SIZE 16
+/* the integrity-only cipher suites use keys and IVs as long as the digest (i.e., up to 48 bytes for SHA-384) */
+#define PTLS_MAX_SECRET_SIZE 48
+#define PTLS_MAX_IV_SIZE 48
 #define PTLS_MAX_DIGEST_SIZE 64
 
 /* cipher-suites */
 #define PTLS_CIPHER_SUITE_AES_128_GCM_SHA256 0x1301
 #define PTLS_CIPHER_SUITE_AES_256_GCM_SHA384 0x1302
 #define PTLS_CIPHER_SUITE_CHACHA20_POLY1305_SHA256 0x1303
+/* AEGIS (draft-irtf-cfrg-aegis-aead) using codepoints of the private-use range; SHA-384 is used in place of SHA-512 */
+#define PTLS_CIPHER_SUITE_AEGIS_128L_SHA256 0xff07
+#define PTLS_CIPHER_SUITE_AEGIS_256_SHA384 0xff06
+/* integrity-only cipher suites (RFC 9150); they provide no confidentiality and are never enabled by default */
+#define PTLS_CIPHER_SUITE_SHA256_SHA256 0xc0b4
+#define PTLS_CIPHER_SUITE_SHA384_SHA384 0xc0b5
+/* integrity-only cipher suites using AES-GMAC, in the private-use range */
+#define PTLS_CIPHER_SUITE_AES_128_GMAC_SHA256 0xff08
+#define PTLS_CIPHER_SUITE_AES_256_GMAC_SHA384 0xff09
 
 /* negotiated_groups */
 #define PTLS_GROUP_SECP256R1 23
@@ -108,6 +124,7 @@ extern "C" {
 #define PTLS_GROUP_SECP521R1 25
 #define PTLS_GROUP_X25519 29
 #define PTLS_GROUP_X448 30
+#define PTLS_GROUP_X25519MLKEM768 4588
 
 /* signature algorithms */
 #define PTLS_SIGNATURE_RSA_PKCS1_SHA1 0x0201
@@ -119,11 +136,22 @@ extern "C" {
 #define PTLS_SIGNATURE_RSA_PSS_RSAE_SHA384 0x0805
 #define PTLS_SIGNATURE_RSA_PSS_RSAE_SHA512 0x0806
 
-/* ESNI */
-#define PTLS_ESNI_VERSION_DRAFT03 0xff02
-
-#define PTLS_ESNI_RESPONSE_TYPE_ACCEPT 0
-#define PTLS_ESNI_RESPONSE_TYPE_RETRY_REQUEST 1
+/* HPKE (RFC 9180) */
+#define PTLS_HPKE_MODE_BASE 0
+#define PTLS_HPKE_KEM_P256_SHA256 16
+#define PTLS_HPKE_KEM_X25519_SHA256 32
+#define PTLS_HPKE_HKDF_SHA256 1
+#define PTLS_HPKE_HKDF_SHA384 2
+#define PTLS_HPKE_HKDF_SHA512 3
+#define PTLS_HPKE_AEAD_AES_128_GCM 1
+#define PTLS_HPKE_AEAD_AES_256_GCM 2
+#define PTLS_HPKE_AEAD_CHACHA20POLY1305 3
+
+/* ECH */
+#define PTLS_ECH_CONFIG_VERSION 0xfe0d
+#define PTLS_ECH_CLIENT_HELLO_TYPE_OUTER 0
+#define PTLS_ECH_CLIENT_HELLO_TYPE_INNER 1
+#define PTLS_ECH_CONFIRM_LENGTH 8
 
 /* error classes and macros */
 #define PTLS_ERROR_CLASS_SELF_ALERT 0
@@ -145,6 +173,7 @@ extern "C" {
 #define PTLS_ALERT_CLOSE_NOTIFY 0
 #define PTLS_ALERT_UNEXPECTED_MESSAGE 10
 #define PTLS_ALERT_BAD_RECORD_MAC 20
+#define PTLS_ALERT_RECORD_OVERFLOW 22
 #define PTLS_ALERT_HANDSHAKE_FAILURE 40
 #define PTLS_ALERT_BAD_CERTIFICATE 42
 #define PTLS_ALERT_CERTIFICATE_REVOKED 44
@@ -158,9 +187,11 @@ extern "C" {
 #define PTLS_ALERT_INTERNAL_ERROR 80
 #define PTLS_ALERT_USER_CANCELED 90
 #define PTLS_ALERT_MISSING_EXTENSION 109
+#define PTLS_ALERT_UNSUPPORTED_EXTENSION 110
 #define PTLS_ALERT_UNRECOGNIZED_NAME 112
 #define PTLS_ALERT_CERTIFICATE_REQUIRED 116
 #define PTLS_ALERT_NO_APPLICATION_PROTOCOL 120
+#define PTLS_ALERT_ECH_REQUIRED 121
 
 /* internal errors */
 #define PTLS_ERROR_NO_MEMORY (PTLS_ERROR_CLASS_INTERNAL + 1)
@@ -171,9 +202,11 @@ extern "C" {
 #define PTLS_ERROR_STATELESS_RETRY (PTLS_ERROR_CLASS_INTERNAL + 6)
 #define PTLS_ERROR_NOT_AVAILABLE (PTLS_ERROR_CLASS_INTERNAL + 7)
 #define PTLS_ERROR_COMPRESSION_FAILURE (PTLS_ERROR_CLASS_INTERNAL + 8)
-#define PTLS_ERROR_ESNI_RETRY (PTLS_ERROR_CLASS_INTERNAL + 8)
 #define PTLS_ERROR_REJECT_EARLY_DATA (PTLS_ERROR_CLASS_INTERNAL + 9)
 #define PTLS_ERROR_DELEGATE (PTLS_ERROR_CLASS_INTERNAL + 10)
+#define PTLS_ERROR_INVALID_OCSP_RESPONSE (PTLS_ERROR_CLASS_INTERNAL + 11)
+#define PTLS_ERROR_ASYNC_OPERATION (PTLS_ERROR_CLASS_INTERNAL + 12)
+#define PTLS_ERROR_SKIP_TICKET (PTLS_ERROR_CLASS_INTERNAL + 13)
 
 #define PTLS_ERROR_INCORRECT_BASE64 (PTLS_ERROR_CLASS_INTERNAL + 50)
 #define PTLS_ERROR_PEM_LABEL_NOT_FOUND (PTLS_ERROR_CLASS_INTERNAL + 51)
@@ -237,6 +270,12 @@ typedef struct st_ptls_buffer_t {
     size_t capacity;
     size_t off;
     int is_allocated;
+    /**
+     * Set by the owner of the buffer after calling `ptls_buffer_init`, if the buffer only carries data that is not secret (e.g.,
+     * records being sent or received, or the application data that the application already holds). Memory of such buffers is
+     * not zero-cleared when being released.
+     */
+    int is_nonsensitive;
 } ptls_buffer_t;
 
 /**
@@ -325,6 +364,17 @@ typedef struct st_ptls_aead_context_t {
                        const void *aad, size_t aadlen, ptls_aead_supplementary_encryption_t *supp);
     size_t (*do_decrypt)(struct st_ptls_aead_context_t *ctx, void *output, const void *input, size_t inlen, uint64_t seq,
                          const void *aad, size_t aadlen);
+    /**
+     * Optional callback used for recycling the context while retaining the resources that it has allocated (see
+     * `ptls_aead_free`). When `key` is NULL, the callback clears the key material as the context is being pooled. Otherwise, the
+     * context is reinitialized using the given key and IV; upon failure, the context is disposed by calling `dispose_crypto`.
+     */
+    int (*do_recycle)(struct st_ptls_aead_context_t *ctx, int is_enc, const void *key, const void *iv);
+    /**
+     * Optional callback returning the number of bytes that the context has allocated in addition to
+     * `ptls_aead_algorithm_t::context_size`. Used for bounding the memory retained by the AEAD context pool.
+     */
+    size_t (*do_get_memory_size)(struct st_ptls_aead_context_t *ctx);
 } ptls_aead_context_t;
 
 /**
@@ -430,6 +480,40 @@ typedef const struct st_ptls_cipher_suite_t {
     ptls_hash_algorithm_t *hash;
 } ptls_cipher_suite_t;
 
+/**
+ * a set of cipher suites provided by one crypto backend, used as the input of ptls_calibrate_cipher_suites
+ */
+typedef struct st_ptls_cipher_suite_backend_t {
+    /**
+     * name of the backend (e.g., "openssl"), used for identifying the selected implementations
+     */
+    const char *name;
+    /**
+     * NULL-terminated list of cipher suites
+     */
+    ptls_cipher_suite_t **cipher_suites;
+} ptls_cipher_suite_backend_t;
+
+/**
+ * a cipher suite composed by ptls_calibrate_cipher_suites
+ */
+typedef struct st_ptls_calibrated_cipher_suite_t {
+    /**
+     * the composed cipher suite, that can be added to ptls_context_t::cipher_suites
+     */
+    struct st_ptls_cipher_suite_t suite;
+    /**
+     * name of the backend that provides the AEAD, and the time (in nanoseconds) it spends to seal and open one full-sized record
+     */
+    const char *aead_backend;
+    uint64_t aead_nsec;
+    /**
+     * name of the backend that provides the hash, and the time (in nanoseconds) it spends to digest one full-sized record
+     */
+    const char *hash_backend;
+    uint64_t hash_nsec;
+} ptls_calibrated_cipher_suite_t;
+
 struct st_ptls_traffic_protection_t;
 
 typedef struct st_ptls_message_emitter_t {
@@ -441,39 +525,56 @@ typedef struct st_ptls_message_emitter_t {
 } ptls_message_emitter_t;
 
 /**
- * holds ESNIKeys and the private key (instantiated by ptls_esni_parse, freed using ptls_esni_dispose)
+ * a KEM of HPKE; only DHKEM is supported, which is built on top of a key exchange algorithm and the hash function used by HKDF
  */
-typedef struct st_ptls_esni_context_t {
-    ptls_key_exchange_context_t **key_exchanges;
-    struct {
-        ptls_cipher_suite_t *cipher_suite;
-        uint8_t record_digest[PTLS_MAX_DIGEST_SIZE];
-    } * cipher_suites;
-    uint16_t padded_length;
-    uint64_t not_before;
-    uint64_t not_after;
-    uint16_t version;
-} ptls_esni_context_t;
+typedef const struct st_ptls_hpke_kem_t {
+    uint16_t id;
+    ptls_key_exchange_algorithm_t *keyex;
+    ptls_hash_algorithm_t *hash;
+} ptls_hpke_kem_t;
+
+typedef struct st_ptls_hpke_cipher_suite_id_t {
+    uint16_t kdf;
+    uint16_t aead;
+} ptls_hpke_cipher_suite_id_t;
 
 /**
- * holds the ESNI secret, as exchanged during the handshake
+ * a pair of KDF and AEAD of HPKE
  */
+typedef const struct st_ptls_hpke_cipher_suite_t {
+    ptls_hpke_cipher_suite_id_t id;
+    const char *name; /* in form of "<kdf>/<aead>" using the names of the IANA HPKE registry */
+    ptls_hash_algorithm_t *hash;
+    ptls_aead_algorithm_t *aead;
+} ptls_hpke_cipher_suite_t;
 
-#define PTLS_ESNI_NONCE_SIZE 16
+#define PTLS_HPKE_MAX_KEY_SCHEDULE_CONTEXT_SIZE (1 + 2 * PTLS_MAX_DIGEST_SIZE)
+#define PTLS_HPKE_KEY_SCHEDULE_CONTEXT_SIZE(cipher) (1 + 2 * (cipher)->hash->digest_size)
 
-typedef struct st_ptls_esni_secret_t {
-    ptls_iovec_t secret;
-    uint8_t nonce[PTLS_ESNI_NONCE_SIZE];
-    uint8_t esni_contents_hash[PTLS_MAX_DIGEST_SIZE];
+/**
+ * An ECHConfig being served, along with the private key (instantiated by ptls_ech_init_server_config, freed using
+ * ptls_ech_dispose_server_config). The KEM private key is decoded and the HPKE key schedule context is calculated for each cipher
+ * suite when the object is instantiated, so that the per-handshake cost of decrypting ClientHelloInner becomes one ECDH and the
+ * derivation of the AEAD key.
+ */
+typedef struct st_ptls_ech_server_config_t {
+    uint8_t config_id;
+    ptls_hpke_kem_t *kem;
+    /**
+     * the private key (owned by the object)
+     */
+    ptls_key_exchange_context_t *keyex;
+    /**
+     * ECHConfig (owned by the object)
+     */
+    ptls_iovec_t config;
+    uint8_t max_name_length;
     struct {
-        ptls_key_exchange_algorithm_t *key_share;
-        ptls_cipher_suite_t *cipher;
-        ptls_iovec_t pubkey;
-        uint8_t record_digest[PTLS_MAX_DIGEST_SIZE];
-        uint16_t padded_length;
-    } client;
-    uint16_t version;
-} ptls_esni_secret_t;
+        ptls_hpke_cipher_suite_t *cipher;
+        uint8_t key_schedule_context[PTLS_HPKE_MAX_KEY_SCHEDULE_CONTEXT_SIZE];
+    } * ciphers;
+    size_t num_ciphers;
+} ptls_ech_server_config_t;
 
 #define PTLS_CALLBACK_TYPE0(ret, name)                                                                                             \
     typedef struct st_ptls_##name##_t {                                                                                            \
@@ -517,9 +618,9 @@ typedef struct st_ptls_on_client_hello_parameters_t {
         size_t count;
     } cipher_suites;
     /**
-     * if ESNI was used
+     * if ECH was accepted; `server_name` and other values are those of ClientHelloInner
      */
-    unsigned esni : 1;
+    unsigned ech : 1;
     /**
      * set to 1 if ClientHello is too old (or too new) to be handled by picotls
      */
@@ -557,9 +658,13 @@ PTLS_CALLBACK_TYPE(int, verify_certificate, ptls_t *tls,
                    ptls_iovec_t *certs, size_t num_certs);
 /**
  * Encrypt-and-signs (or verify-and-decrypts) a ticket (server-only).
- * When used for encryption (i.e., is_encrypt being set), the function should return 0 if successful, or else a non-zero value.
+ * When used for encryption (i.e., is_encrypt being set), the function should return 0 if successful, PTLS_ERROR_SKIP_TICKET if
+ * a ticket cannot be issued at the moment (e.g., no key is available), in which case the handshake proceeds without sending
+ * NewSessionTicket, or else a non-zero value.
  * When used for decryption, the function should return 0 (successful), PTLS_ERROR_REJECT_EARLY_DATA (successful, but 0-RTT is
  * forbidden), or any other value to indicate failure.
+ * In either case, the function can instead return PTLS_ERROR_ASYNC_OPERATION after starting the operation (e.g., sending a request
+ * to a key service), in which case the result is to be supplied by calling `ptls_set_ticket_result`. See the function for details.
  */
 PTLS_CALLBACK_TYPE(int, encrypt_ticket, ptls_t *tls, int is_encrypt, ptls_buffer_t *dst, ptls_iovec_t src);
 /**
@@ -586,6 +691,10 @@ PTLS_CALLBACK_TYPE(int, update_traffic_key, ptls_t *tls, int is_enc, size_t epoc
  * callback for every extension detected during decoding
  */
 PTLS_CALLBACK_TYPE(int, on_extension, ptls_t *tls, uint8_t hstype, uint16_t exttype, ptls_iovec_t extdata);
+/**
+ * runs `job(job_data, index)` for every `index` in [0, num_jobs), possibly concurrently, returning after all of them have completed
+ */
+PTLS_CALLBACK_TYPE(void, run_parallel, void (*job)(void *job_data, size_t index), void *job_data, size_t num_jobs);
 /**
  *
  */
@@ -600,11 +709,6 @@ typedef struct st_ptls_decompress_certificate_t {
     int (*cb)(struct st_ptls_decompress_certificate_t *self, ptls_t *tls, uint16_t algorithm, ptls_iovec_t output,
               ptls_iovec_t input);
 } ptls_decompress_certificate_t;
-/**
- * provides access to the ESNI shared secret (Zx).  API is subject to change.
- */
-PTLS_CALLBACK_TYPE(int, update_esni_key, ptls_t *tls, ptls_iovec_t secret, ptls_hash_algorithm_t *hash,
-                   const void *hashed_esni_contents);
 
 /**
  * the configuration
@@ -634,9 +738,30 @@ struct st_ptls_context_t {
         size_t count;
     } certificates;
     /**
-     * list of ESNI data terminated by NULL
+     * Encrypted Client Hello
      */
-    ptls_esni_context_t **esni;
+    struct {
+        struct {
+            /**
+             * list of HPKE cipher suites that the client is willing to use, terminated by NULL
+             */
+            ptls_hpke_cipher_suite_t **ciphers;
+            /**
+             * list of HPKE KEMs that the client is willing to use, terminated by NULL
+             */
+            ptls_hpke_kem_t **kems;
+        } client;
+        struct {
+            /**
+             * list of ECH configurations being served, terminated by NULL
+             */
+            ptls_ech_server_config_t **configs;
+            /**
+             * ECHConfigList to be sent as retry_configs when ECH is rejected
+             */
+            ptls_iovec_t retry_configs;
+        } server;
+    } ech;
     /**
      *
      */
@@ -665,6 +790,13 @@ struct st_ptls_context_t {
      * maximum size of the message buffer (default: 0 = unlimited = 3 + 2^24 bytes)
      */
     size_t max_buffer_size;
+    /**
+     * if non-zero, the record_size_limit extension (RFC 8449) is used to ask the peer to send records no larger than the specified
+     * size, so that the receive buffer of each connection can be kept small (e.g., 2048 bytes). The value is the maximum size of
+     * TLSInnerPlaintext (i.e. payload + content type) and must be between 64 and 16385. Regardless of the value, limits advertised
+     * by the peer are honored. The extension is not used when `update_traffic_key` is set.
+     */
+    uint16_t record_size_limit;
     /**
      * the field is obsolete; should be set to NULL for QUIC draft-17.  Note also that even though everybody did, it was incorrect
      * to set the value to "quic " in the earlier versions of the draft.
@@ -692,6 +824,12 @@ struct st_ptls_context_t {
      * if set, EOED will not be emitted or accepted
      */
     unsigned omit_end_of_early_data : 1;
+    /**
+     * if set, the server encodes the sessions being encrypted into tickets using a compact format, that keeps the issue time in
+     * seconds and stores long server names and ALPN identifiers as truncated digests. Tickets in both formats are accepted
+     * regardless of the value.
+     */
+    unsigned use_compact_session_ticket : 1;
     /**
      *
      */
@@ -716,10 +854,6 @@ struct st_ptls_context_t {
      *
      */
     ptls_decompress_certificate_t *decompress_certificate;
-    /**
-     *
-     */
-    ptls_update_esni_key_t *update_esni_key;
     /**
      *
      */
@@ -776,9 +910,19 @@ typedef struct st_ptls_handshake_properties_t {
              */
             unsigned negotiate_before_key_exchange : 1;
             /**
-             * ESNIKeys (the value of the TXT record, after being base64-"decoded")
+             * Encrypted Client Hello
              */
-            ptls_iovec_t esni_keys;
+            struct {
+                /**
+                 * ECHConfigList to be used; ECH is offered if the list contains a configuration that the client supports
+                 */
+                ptls_iovec_t configs;
+                /**
+                 * if non-NULL, the ECHConfigList sent by the server when rejecting ECH is returned through this pointer (the
+                 * memory is allocated using malloc and is owned by the caller)
+                 */
+                ptls_iovec_t *retry_configs;
+            } ech;
         } client;
         struct {
             /**
@@ -1097,6 +1241,26 @@ int ptls_handshake_is_complete(ptls_t *tls);
  * returns if a PSK (or PSK-DHE) handshake was performed
  */
 int ptls_is_psk_handshake(ptls_t *tls);
+/**
+ * Supplies the result of the ticket encryption or decryption for which the `encrypt_ticket` callback has returned
+ * PTLS_ERROR_ASYNC_OPERATION. `status` and `output` are what the callback would have returned and appended to `dst`. The function
+ * must be called on the thread that owns the connection, after the call to `ptls_handshake` (or to `ptls_server_handle_message`)
+ * that has invoked the callback returns.
+ *
+ * When decrypting, `ptls_handshake` returns PTLS_ERROR_ASYNC_OPERATION after consuming the input up to the end of ClientHello, and
+ * keeps returning that value without consuming input until the result is supplied. Then, calling `ptls_handshake` again resumes
+ * the processing of ClientHello, followed by the rest of the input being given, if any. When using `ptls_server_handle_message` or
+ * `ptls_handle_message_per_epoch`, the processing is resumed by calling the function without input.
+ *
+ * When encrypting, the handshake proceeds without NewSessionTicket. Once the handshake is complete, the ticket is sent by the
+ * first call to `ptls_send` (or `ptls_send_parallel`) made after the result is supplied; `ptls_send` can be called with `inlen`
+ * being zero, for the sole purpose of sending the ticket. If `status` is non-zero, the ticket is not sent. Tickets are not sent
+ * when using the handshake API that does not use the record layer (i.e., `ptls_server_handle_message` and
+ * `ptls_handle_message_per_epoch`).
+ *
+ * Returns PTLS_ERROR_NOT_AVAILABLE if there is no operation waiting for the result.
+ */
+int ptls_set_ticket_result(ptls_t *tls, int status, ptls_iovec_t output);
 /**
  * returns a pointer to user data pointer (client is reponsible for freeing the associated data prior to calling ptls_free)
  */
@@ -1126,10 +1290,34 @@ int ptls_receive(ptls_t *tls, ptls_buffer_t *plaintextbuf, const void *input, si
  * encrypts given buffer into multiple TLS records
  */
 int ptls_send(ptls_t *tls, ptls_buffer_t *sendbuf, const void *input, size_t inlen);
+/**
+ * Same as `ptls_send`, but the sequence numbers of all the records are reserved upfront, and the records are encrypted
+ * concurrently, `PTLS_PARALLEL_RECORDS_PER_JOB` records per job, using `run_parallel`. The output is identical to that of
+ * `ptls_send`.
+ */
+int ptls_send_parallel(ptls_t *tls, ptls_buffer_t *sendbuf, const void *input, size_t inlen, ptls_run_parallel_t *run_parallel);
+/**
+ * Decrypts the complete application data records found at the head of the input concurrently using `run_parallel`, appending the
+ * plaintext to `plaintextbuf` in order. Other records (as well as the partial record at the tail) are processed by `ptls_receive`.
+ * Unlike `ptls_receive`, the function returns after consuming all the input, unless an error occurs.
+ */
+int ptls_receive_parallel(ptls_t *tls, ptls_buffer_t *plaintextbuf, const void *input, size_t *len,
+                          ptls_run_parallel_t *run_parallel);
 /**
  * updates the send traffic key (as well as asks the peer to update)
  */
 int ptls_update_key(ptls_t *tls, int request_update);
+#ifndef _WINDOWS
+/**
+ * Creates a pool of `num_threads` threads that can be used as the `run_parallel` callback. The thread invoking the callback also
+ * runs the jobs, therefore a pool with `num_threads` threads utilizes up to `num_threads + 1` cores. Returns NULL on failure.
+ */
+ptls_run_parallel_t *ptls_thread_pool_new(size_t num_threads);
+/**
+ * stops the threads and destroys the pool
+ */
+void ptls_thread_pool_free(ptls_run_parallel_t *pool);
+#endif
 /**
  * Returns if the context is a server context.
  */
@@ -1208,9 +1396,23 @@ ptls_aead_context_t *ptls_aead_new(ptls_aead_algorithm_t *aead, ptls_hash_algori
  */
 ptls_aead_context_t *ptls_aead_new_direct(ptls_aead_algorithm_t *aead, int is_enc, const void *key, const void *iv);
 /**
- * destroys an AEAD cipher context
+ * destroys an AEAD cipher context. When `ptls_aead_pool_max_bytes` is set, contexts being destroyed are retained in a per-thread
+ * pool, so that they can be reused by `ptls_aead_new_direct` (and therefore by the handshake) for the same algorithm. Contexts
+ * that provide `do_recycle` retain their internal resources (e.g., the grown GHASH table of fusion or the `EVP_CIPHER_CTX` of
+ * OpenSSL) and only have the keys cleared; others are disposed but keep the allocation of the context.
  */
 void ptls_aead_free(ptls_aead_context_t *ctx);
+/**
+ * Maximum number of bytes that the AEAD context pool of each thread retains, counted as `context_size` plus what
+ * `do_get_memory_size` reports (default: 0, i.e. the pool is disabled). At most `PTLS_AEAD_POOL_SIZE` contexts are retained. The
+ * pool is not released when a thread exits; applications enabling the pool must call `ptls_aead_pool_clear` before terminating
+ * threads that have freed AEAD contexts.
+ */
+extern size_t ptls_aead_pool_max_bytes;
+/**
+ * releases the contexts retained in the AEAD context pool of the calling thread
+ */
+void ptls_aead_pool_clear(void);
 /**
  *
  */
@@ -1238,6 +1440,32 @@ static size_t ptls_aead_encrypt_final(ptls_aead_context_t *ctx, void *output);
  */
 static size_t ptls_aead_decrypt(ptls_aead_context_t *ctx, void *output, const void *input, size_t inlen, uint64_t seq,
                                 const void *aad, size_t aadlen);
+/**
+ * Context of the integrity-only AEADs of RFC 9150, which emit the plaintext as-is followed by HMAC(key, nonce || aad || plaintext).
+ * Crypto backends define such an AEAD by setting `context_size` to the size of this struct and calling
+ * `ptls_integrity_only_aead_setup_crypto` from `setup_crypto`, passing their own implementation of the hash function.
+ */
+typedef struct st_ptls_integrity_only_aead_context_t {
+    ptls_aead_context_t super;
+    ptls_hash_context_t *hmac;
+    uint8_t static_iv[PTLS_MAX_DIGEST_SIZE];
+} ptls_integrity_only_aead_context_t;
+/**
+ * sets up an integrity-only AEAD context; key size, IV size, and tag size of the AEAD must be equal to the digest size of `hash`
+ */
+int ptls_integrity_only_aead_setup_crypto(ptls_aead_context_t *ctx, const void *key, const void *iv, ptls_hash_algorithm_t *hash);
+/**
+ * Runs a short benchmark of the AEAD and hash implementations that the backends provide for each cipher suite, and composes each
+ * cipher suite from the fastest ones. Implementations are checked against those of the first backend providing the same cipher
+ * suite, and the ones that fail to interoperate are never selected. The cipher suites are returned in the order they first appear
+ * in `backends`. The function takes some milliseconds per implementation, and is expected to be called once at startup.
+ * @param results      array receiving the composed cipher suites
+ * @param max_results  number of entries available in `results`
+ * @param backends     list of backends, terminated by an entry with `name` set to NULL
+ * @return number of cipher suites being composed
+ */
+size_t ptls_calibrate_cipher_suites(ptls_calibrated_cipher_suite_t *results, size_t max_results,
+                                    const ptls_cipher_suite_backend_t *backends);
 /**
  * Return the current read epoch.
  */
@@ -1265,6 +1493,22 @@ int ptls_client_handle_message(ptls_t *tls, ptls_buffer_t *sendbuf, size_t epoch
                                size_t inlen, ptls_handshake_properties_t *properties);
 int ptls_server_handle_message(ptls_t *tls, ptls_buffer_t *sendbuf, size_t epoch_offsets[5], size_t in_epoch, const void *input,
                                size_t inlen, ptls_handshake_properties_t *properties);
+/**
+ * Same as `ptls_handle_message`, except that the handshake messages are appended directly to the buffer of the epoch that they
+ * belong to, rather than to one buffer that the caller has to split using `epoch_offsets`. QUIC stacks can pass the send buffers
+ * of their per-epoch CRYPTO streams, so that the messages are written once, to where they are retransmitted from.
+ * @param tls         the TLS context
+ * @param sendbufs    buffers corresponding to the four epochs (initial, 0-RTT, handshake, 1-RTT). The 0-RTT buffer receives
+ *                    EndOfEarlyData only, and only when `omit_end_of_early_data` is not set. The same buffer may be specified for
+ *                    more than one epoch.
+ * @param in_epoch    epoch of the input
+ * @param input       input bytes (must be NULL when starting the handshake on the client side)
+ * @param inlen       length of the input
+ * @param properties  properties specific to the running handshake
+ * @return same as `ptls_handshake`
+ */
+int ptls_handle_message_per_epoch(ptls_t *tls, ptls_buffer_t *sendbufs[4], size_t in_epoch, const void *input, size_t inlen,
+                                  ptls_handshake_properties_t *properties);
 /**
  * internal
  */
@@ -1286,6 +1530,18 @@ extern void (*volatile ptls_clear_memory)(void *p, size_t len);
  * constant-time memcmp
  */
 extern int (*volatile ptls_mem_equal)(const void *x, const void *y, size_t len);
+/**
+ * Generates random bytes using a per-thread buffered generator built on top of the given ChaCha20 implementation. The generator
+ * rekeys itself using the keystream each time the buffer is refilled, and bytes are erased as they are returned, so that output
+ * that has been returned cannot be recovered from the state of the generator. The key is seeded by calling `seed`, then reseeded
+ * once `ptls_chacha20_random_reseed_interval` bytes have been generated, as well as in the child process after fork. Backends
+ * provide instances that can be used as `ptls_context_t::random_bytes` (e.g., `ptls_openssl_chacha20_random_bytes`).
+ */
+void ptls_chacha20_random_bytes(ptls_cipher_algorithm_t *chacha20, void (*seed)(void *buf, size_t len), void *buf, size_t len);
+/**
+ * number of bytes that `ptls_chacha20_random_bytes` generates on each thread before reseeding (default: 1MB)
+ */
+extern size_t ptls_chacha20_random_reseed_interval;
 /**
  *
  */
@@ -1300,18 +1556,52 @@ int ptls_server_name_is_ipaddr(const char *name);
  */
 int ptls_load_certificates(ptls_context_t *ctx, char const *cert_pem_file);
 /**
- *
+ * Sets up the HPKE context of the sender (base mode). Upon success, `enc` contains the encapsulated key (allocated by malloc) and
+ * `ctx` contains the AEAD context for sealing, with the sequence number being the HPKE sequence number.
+ */
+int ptls_hpke_setup_base_s(ptls_hpke_kem_t *kem, ptls_hpke_cipher_suite_t *cipher, ptls_iovec_t *enc, ptls_aead_context_t **ctx,
+                           ptls_iovec_t pk_r, ptls_iovec_t info);
+/**
+ * Sets up the HPKE context of the recipient (base mode). `keyex` is the private key of the recipient; it is not released.
  */
-int ptls_esni_init_context(ptls_context_t *ctx, ptls_esni_context_t *esni, ptls_iovec_t esni_keys,
-                           ptls_key_exchange_context_t **key_exchanges);
+int ptls_hpke_setup_base_r(ptls_hpke_kem_t *kem, ptls_hpke_cipher_suite_t *cipher, ptls_key_exchange_context_t *keyex,
+                           ptls_aead_context_t **ctx, ptls_iovec_t enc, ptls_iovec_t info);
 /**
+ * Calculates the key schedule context of HPKE (base mode), which depends only on the suite and `info`. The size of the output is
+ * PTLS_HPKE_KEY_SCHEDULE_CONTEXT_SIZE(cipher).
+ */
+int ptls_hpke_key_schedule_context(ptls_hpke_kem_t *kem, ptls_hpke_cipher_suite_t *cipher, uint8_t *ks_context, ptls_iovec_t info);
+/**
+ * Variant of ptls_hpke_setup_base_r that uses the key schedule context calculated by ptls_hpke_key_schedule_context.
+ */
+int ptls_hpke_setup_base_r_precomputed(ptls_hpke_kem_t *kem, ptls_hpke_cipher_suite_t *cipher, ptls_key_exchange_context_t *keyex,
+                                       ptls_aead_context_t **ctx, ptls_iovec_t enc, ptls_iovec_t ks_context);
+/**
+ * Instantiates a server-side ECH configuration. `ech_config` is a single ECHConfig and `keyex` is the corresponding private key.
+ * Upon success, the ownership of `keyex` is transferred to `config`. `kems` and `ciphers` are the lists of algorithms that the
+ * server supports, terminated by NULL; cipher suites not found in `ciphers` are ignored.
  *
+ * The following are deferred to follow-up changes and are not implemented yet:
+ * - GREASE ECH; a client without an ECHConfig sends no encrypted_client_hello extension.
+ * - ech_outer_extensions compression on the client side; the server accepts compressed ClientHelloInner, but the client always
+ *   sends the inner extensions in full.
+ * - ECH combined with stateless (cookie-based) HelloRetryRequest; when `retry_uses_cookie` is set, the server ignores the
+ *   encrypted_client_hello extension and proceeds with ClientHelloOuter, as the HPKE context cannot be carried in the cookie. ECH
+ *   with a stateful HelloRetryRequest is supported.
+ * - A per-config cache of HPKE AEAD contexts. The AEAD key depends on the `enc` being sent by each client, so only the key schedule
+ *   context is precalculated per cipher suite (see ptls_ech_server_config_t); the AEAD context is derived for every handshake.
+ */
+int ptls_ech_init_server_config(ptls_ech_server_config_t *config, ptls_iovec_t ech_config, ptls_key_exchange_context_t *keyex,
+                                ptls_hpke_kem_t **kems, ptls_hpke_cipher_suite_t **ciphers);
+/**
+ * Releases the resources held by a configuration instantiated by ptls_ech_init_server_config, including the private key.
  */
-void ptls_esni_dispose_context(ptls_esni_context_t *esni);
+void ptls_ech_dispose_server_config(ptls_ech_server_config_t *config);
 /**
- * Obtain the ESNI secrets negotiated during the handshake.
+ * Returns a boolean indicating if ECH has been accepted. When returning true, the arguments (if non-NULL) are set to the values
+ * negotiated.
  */
-ptls_esni_secret_t *ptls_get_esni_secret(ptls_t *ctx);
+int ptls_is_ech_handshake(ptls_t *tls, uint8_t *config_id, ptls_hpke_kem_t **kem, ptls_hpke_cipher_suite_t **cipher);
 /**
  *
  */
@@ -1354,6 +1644,7 @@ inline void ptls_buffer_init(ptls_buffer_t *buf, void *smallbuf, size_t smallbuf
     buf->off = 0;
     buf->capacity = smallbuf_size;
     buf->is_allocated = 0;
+    buf->is_nonsensitive = 0;
 }
 
 inline void ptls_buffer_dispose(ptls_buffer_t *buf)
@@ -61,4 +61,118 @@ size_t ptls_asn1_validation_recursive(const uint8_t *bytes, size_t bytes_max, in
 
 int ptls_asn1_validation(const uint8_t *bytes, size_t length, ptls_minicrypto_log_ctx_t *log_ctx);
 
+/*
+ * Non-allocating DER decoder.
+ *
+ * The cursor API below walks DER-encoded data in place; all values returned are `ptls_iovec_t`s pointing into the buffer being
+ * decoded. Only the low-tag-number form (i.e. single-octet identifiers) and definite lengths are accepted, which is all that DER
+ * encoded X.509 certificates use.
+ */
+
+#define PTLS_ASN1_TAG_BOOLEAN 0x01
+#define PTLS_ASN1_TAG_INTEGER 0x02
+#define PTLS_ASN1_TAG_BIT_STRING 0x03
+#define PTLS_ASN1_TAG_OCTET_STRING 0x04
+#define PTLS_ASN1_TAG_NULL 0x05
+#define PTLS_ASN1_TAG_OBJECT_IDENTIFIER 0x06
+#define PTLS_ASN1_TAG_UTF8_STRING 0x0c
+#define PTLS_ASN1_TAG_PRINTABLE_STRING 0x13
+#define PTLS_ASN1_TAG_IA5_STRING 0x16
+#define PTLS_ASN1_TAG_UTC_TIME 0x17
+#define PTLS_ASN1_TAG_GENERALIZED_TIME 0x18
+#define PTLS_ASN1_TAG_SEQUENCE 0x30
+#define PTLS_ASN1_TAG_SET 0x31
+#define PTLS_ASN1_TAG_CONTEXT(n) (0x80 | (n))
+#define PTLS_ASN1_TAG_CONTEXT_CONSTRUCTED(n) (0xa0 | (n))
+
+typedef struct st_ptls_asn1_der_cursor_t {
+    const uint8_t *src;
+    const uint8_t *end;
+} ptls_asn1_der_cursor_t;
+
+/**
+ * initializes the cursor to point to the beginning of given DER-encoded data
+ */
+static void ptls_asn1_der_init(ptls_asn1_der_cursor_t *cur, ptls_iovec_t der);
+/**
+ * returns if the cursor has reached the end
+ */
+static int ptls_asn1_der_is_empty(ptls_asn1_der_cursor_t *cur);
+/**
+ * returns the tag of the next element, or -1 if the cursor has reached the end
+ */
+static int ptls_asn1_der_peek_tag(ptls_asn1_der_cursor_t *cur);
+/**
+ * reads the next element, returning its tag and value (i.e. the contents octets), and advances the cursor past the element.
+ * `element`, if not NULL, is set to the entire encoding of the element, including the identifier and length octets.
+ */
+int ptls_asn1_der_read(ptls_asn1_der_cursor_t *cur, uint8_t *tag, ptls_iovec_t *value, ptls_iovec_t *element);
+/**
+ * reads the next element, failing with PTLS_ERROR_INCORRECT_ASN1_SYNTAX if its tag is not the one being expected
+ */
+int ptls_asn1_der_read_expected(ptls_asn1_der_cursor_t *cur, uint8_t expected_tag, ptls_iovec_t *value);
+/**
+ * reads the next element if its tag matches the one being expected; otherwise, sets `value` to {NULL, 0} and returns zero
+ */
+int ptls_asn1_der_read_optional(ptls_asn1_der_cursor_t *cur, uint8_t expected_tag, ptls_iovec_t *value);
+/**
+ * sets up `inner` to point to the value of the next element (e.g., a SEQUENCE), and advances `cur` past the element
+ */
+int ptls_asn1_der_enter(ptls_asn1_der_cursor_t *cur, uint8_t expected_tag, ptls_asn1_der_cursor_t *inner);
+/**
+ * skips the next element
+ */
+int ptls_asn1_der_skip(ptls_asn1_der_cursor_t *cur, uint8_t expected_tag);
+/**
+ * converts the value of an UTCTime or a GeneralizedTime to seconds since epoch. Only the forms allowed by DER (i.e. those with
+ * seconds and with the "Z" suffix) are accepted.
+ */
+int ptls_asn1_der_decode_time(uint64_t *unixtime, uint8_t tag, ptls_iovec_t value);
+
+/**
+ * Fields of an X.509 certificate, extracted in place. `issuer`, `subject` and `subject_public_key_info` cover the entire DER
+ * encoding of the respective elements (so that they can be hashed or compared as-is). `subject_alt_name` is the value of the
+ * GeneralNames SEQUENCE of the subjectAltName extension, or {NULL, 0} if the extension is absent.
+ */
+typedef struct st_ptls_asn1_x509_t {
+    ptls_iovec_t tbs_certificate;
+    ptls_iovec_t serial_number;
+    ptls_iovec_t issuer;
+    ptls_iovec_t subject;
+    struct {
+        uint8_t tag;
+        ptls_iovec_t value;
+    } not_before, not_after;
+    ptls_iovec_t subject_public_key_info;
+    ptls_iovec_t subject_alt_name;
+} ptls_asn1_x509_t;
+
+/**
+ * decodes a DER-encoded X.509 certificate without allocating memory; the signature is not verified
+ */
+int ptls_asn1_x509_decode(ptls_asn1_x509_t *x509, ptls_iovec_t der);
+/**
+ * reads the next dNSName in the subjectAltName extension, skipping other types of GeneralName. The cursor should be initialized
+ * using `ptls_asn1_x509_t::subject_alt_name`. Upon reaching the end, returns zero with `name->base` set to NULL.
+ */
+int ptls_asn1_x509_next_dns_name(ptls_asn1_der_cursor_t *san, ptls_iovec_t *name);
+
+/* inline functions */
+
+inline void ptls_asn1_der_init(ptls_asn1_der_cursor_t *cur, ptls_iovec_t der)
+{
+    cur->src = der.base;
+    cur->end = der.base + der.len;
+}
+
+inline int ptls_asn1_der_is_empty(ptls_asn1_der_cursor_t *cur)
+{
+    return cur->src == cur->end;
+}
+
+inline int ptls_asn1_der_peek_tag(ptls_asn1_der_cursor_t *cur)
+{
+    return cur->src != cur->end ? *cur->src : -1;
+}
+
 #endif
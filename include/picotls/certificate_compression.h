@@ -28,27 +28,113 @@ extern "C" {
 
 #include "picotls.h"
 
-#define PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_GZIP 1
+#define PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_ZLIB 1
+#define PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_GZIP PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_ZLIB
 #define PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_BROTLI 2
+#define PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_ZSTD 3
 
+#define PTLS_CERTIFICATE_COMPRESSION_MAX_ALGORITHMS 3
+/**
+ * Codepoints in this range are reserved for experimental use (RFC 8879); they are used for identifying compression using a shared
+ * dictionary, so that peers that do not share the dictionary never agree on using it.
+ */
+#define PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_EXPERIMENTAL_MIN 16384
+
+/**
+ * A dictionary shared between the endpoints, to be used for compressing certificate chains that share common intermediates.
+ */
+typedef struct st_ptls_certificate_compression_dictionary_t {
+    /**
+     * the codepoint sent on the wire; should be within the experimental range and unique to the dictionary
+     */
+    uint16_t algo;
+    /**
+     * the underlying compression algorithm; either PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_ZLIB or
+     * PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_ZSTD
+     */
+    uint16_t base_algo;
+    /**
+     * the dictionary (a zlib preset dictionary or a zstd dictionary, depending on `base_algo`)
+     */
+    ptls_iovec_t bytes;
+} ptls_certificate_compression_dictionary_t;
+
+#ifdef _WINDOWS
+/* suppress warning C4201: nonstandard extension used: nameless struct/union */
+#pragma warning(push)
+#pragma warning(disable : 4201)
+#endif
+/**
+ * Certificate emitter that sends precompressed Certificate messages. Prior to the support for multiple algorithms, the structure
+ * held one message as `algo`, `with_ocsp_status`, and `without_ocsp_status`. These fields are retained as aliases of
+ * `compressed[0]`, so that applications reading them continue to compile and work. The size of the structure has changed, hence
+ * applications need to be rebuilt.
+ */
 typedef struct st_ptls_emit_compressed_certificate_t {
     ptls_emit_certificate_t super;
-    uint16_t algo;
-    struct st_ptls_compressed_certificate_entry_t {
-        uint32_t uncompressed_length;
-        ptls_iovec_t bytes;
-    } with_ocsp_status, without_ocsp_status;
+    union {
+        /**
+         * precompressed Certificate messages, one for each algorithm being supported, in the order of preference
+         */
+        struct st_ptls_compressed_certificate_t {
+            uint16_t algo;
+            struct st_ptls_compressed_certificate_entry_t {
+                uint32_t uncompressed_length;
+                ptls_iovec_t bytes;
+            } with_ocsp_status, without_ocsp_status;
+        } compressed[PTLS_CERTIFICATE_COMPRESSION_MAX_ALGORITHMS + 1];
+        /**
+         * the first entry of `compressed` (deprecated)
+         */
+        struct {
+            uint16_t algo;
+            struct st_ptls_compressed_certificate_entry_t with_ocsp_status, without_ocsp_status;
+        };
+    };
+    size_t num_compressed;
 } ptls_emit_compressed_certificate_t;
+#ifdef _WINDOWS
+#pragma warning(pop)
+#endif
+
+/**
+ * decompressor that recognizes a shared dictionary in addition to the algorithms supported by `ptls_decompress_certificate`
+ */
+typedef struct st_ptls_decompress_certificate_with_dictionary_t {
+    ptls_decompress_certificate_t super;
+    uint16_t algorithms[PTLS_CERTIFICATE_COMPRESSION_MAX_ALGORITHMS + 2];
+    const ptls_certificate_compression_dictionary_t *dictionary;
+} ptls_decompress_certificate_with_dictionary_t;
 
 extern ptls_decompress_certificate_t ptls_decompress_certificate;
 
 /**
- * initializes a certificate emitter that precompresses a certificate chain (and ocsp status)
+ * initializes a certificate emitter that precompresses a certificate chain (and ocsp status), using each of the compression
+ * algorithms enabled at build time. When emitting, the smallest message among the ones compressed using the algorithms offered by
+ * the client is sent.
  */
 int ptls_init_compressed_certificate(ptls_emit_compressed_certificate_t *ecc, ptls_iovec_t *certificates, size_t num_certificates,
                                      ptls_iovec_t ocsp_status);
 /**
- *
+ * same as `ptls_init_compressed_certificate`, but in addition, builds a message compressed using the given dictionary. The message
+ * is sent only to clients that advertise `dictionary->algo`. The dictionary is not retained after the call.
+ */
+int ptls_init_compressed_certificate_with_dictionary(ptls_emit_compressed_certificate_t *ecc, ptls_iovec_t *certificates,
+                                                     size_t num_certificates, ptls_iovec_t ocsp_status,
+                                                     const ptls_certificate_compression_dictionary_t *dictionary);
+/**
+ * initializes a decompressor that uses the given dictionary. The dictionary is referred to until the decompressor is discarded.
+ */
+int ptls_init_decompress_certificate_with_dictionary(ptls_decompress_certificate_with_dictionary_t *self,
+                                                     const ptls_certificate_compression_dictionary_t *dictionary);
+/**
+ * compresses a Certificate message using the given algorithm. Returns PTLS_ERROR_COMPRESSION_FAILURE if the algorithm is not
+ * available or if the message cannot be compressed to less than `output->len` bytes. `dictionary` is optional.
+ */
+int ptls_compress_certificate_message(ptls_iovec_t *output, uint16_t algo,
+                                      const ptls_certificate_compression_dictionary_t *dictionary, ptls_iovec_t input);
+/**
+ * releases the resources allocated by `ptls_init_compressed_certificate`
  */
 void ptls_dispose_compressed_certificate(ptls_emit_compressed_certificate_t *ecc);
 
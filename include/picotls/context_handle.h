@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#ifndef picotls_context_handle_h
+#define picotls_context_handle_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "picotls.h"
+
+/**
+ * A handle that points to the current version of a context, allowing the application to replace the context (e.g., to rotate
+ * certificates or keys) while handshakes are in progress. Connections keep using the context they have been created with; the
+ * versions being replaced are released once no connection uses them.
+ *
+ * New connections are to be created between `ptls_context_handle_enter` and `ptls_context_handle_leave`:
+ *
+ *   ptls_context_t *ctx = ptls_context_handle_enter(&handle);
+ *   ptls_t *tls = ptls_new(ctx, 1);
+ *   ptls_context_handle_leave(&handle);
+ *
+ * The connections using each version are counted through the `update_open_count` callback of the context, using counters
+ * owned by each thread. Therefore, the threads creating connections do not take locks nor perform atomic read-modify-write
+ * operations. Reclamation is epoch-based; the thread replacing the context checks that no thread is still within the section it
+ * has entered before the replacement, then sums the counters.
+ *
+ * `ptls_context_handle_swap` and `ptls_context_handle_reclaim` are serialized by a mutex, that is also taken when a thread uses the
+ * handle for the first time and when it exits.
+ */
+typedef struct st_ptls_context_handle_t {
+    /**
+     * called when a context is no longer used, i.e. when a context that has been replaced is no longer used by any connection, or
+     * when the handle is disposed; called by the thread calling `ptls_context_handle_swap`, `ptls_context_handle_reclaim`, or
+     * `ptls_context_handle_dispose`
+     */
+    void (*on_dispose)(struct st_ptls_context_handle_t *self, ptls_context_t *ctx);
+    struct st_ptls_context_handle_state_t *_state;
+} ptls_context_handle_t;
+
+/**
+ * Initializes the handle to point to `ctx`. `max_threads` is the maximum number of threads using the handle at the same time;
+ * `ptls_context_handle_enter` fails in threads exceeding the limit. The handle takes the ownership of `ctx`; its
+ * `update_open_count` callback is replaced, the original one being called from the callback installed.
+ */
+int ptls_context_handle_init(ptls_context_handle_t *self, size_t max_threads, ptls_context_t *ctx,
+                             void (*on_dispose)(ptls_context_handle_t *self, ptls_context_t *ctx));
+/**
+ * Disposes the handle along with all the contexts. Must be called after all the connections using the contexts are freed.
+ */
+void ptls_context_handle_dispose(ptls_context_handle_t *self);
+/**
+ * Returns the current context. The context can be used for creating connections (or for calling `ptls_set_context`) until
+ * `ptls_context_handle_leave` is called. Returns NULL if the number of threads exceeds `max_threads`.
+ */
+ptls_context_t *ptls_context_handle_enter(ptls_context_handle_t *self);
+/**
+ * Leaves the section entered by `ptls_context_handle_enter`. Must be called by the thread that has entered the section. Calling
+ * this function after `ptls_context_handle_enter` has returned NULL is permitted, and does nothing.
+ */
+void ptls_context_handle_leave(ptls_context_handle_t *self);
+/**
+ * Replaces the context. The ownership of `ctx` is moved to the handle, as is the case with `ptls_context_handle_init`. Then,
+ * the contexts that are no longer used are released as `ptls_context_handle_reclaim` does.
+ */
+int ptls_context_handle_swap(ptls_context_handle_t *self, ptls_context_t *ctx);
+/**
+ * Releases the contexts that have been replaced and are no longer used. Returns the number of the contexts that have been replaced
+ * but are still being used.
+ */
+size_t ptls_context_handle_reclaim(ptls_context_handle_t *self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -71,6 +71,15 @@ void ptls_fusion_aesgcm_free(ptls_fusion_aesgcm_context_t *ctx);
  */
 void ptls_fusion_aesgcm_encrypt(ptls_fusion_aesgcm_context_t *ctx, void *output, const void *input, size_t inlen, __m128i ctr,
                                 const void *aad, size_t aadlen, ptls_aead_supplementary_encryption_t *supp);
+/**
+ * Same as ptls_fusion_aesgcm_encrypt, except that the payload being encrypted is the concatenation of `input` and `trailer`. This
+ * allows the caller to append a few bytes (e.g., the inner content type of TLS 1.3) without copying the entire payload first.
+ * @param trailer     bytes to be appended to the payload
+ * @param trailerlen  size of the trailer; must not exceed 16
+ */
+void ptls_fusion_aesgcm_encrypt_with_trailer(ptls_fusion_aesgcm_context_t *ctx, void *output, const void *input, size_t inlen,
+                                             const void *trailer, size_t trailerlen, __m128i ctr, const void *aad, size_t aadlen,
+                                             ptls_aead_supplementary_encryption_t *supp);
 /**
  * Decrypts an AEAD block, an in parallel, optionally encrypts one block using AES-ECB. Returns if decryption was successful.
  * @param iv       initialization vector of 12 bytes
@@ -86,6 +95,35 @@ int ptls_fusion_aesgcm_decrypt(ptls_fusion_aesgcm_context_t *ctx, void *output,
 
 extern ptls_cipher_algorithm_t ptls_fusion_aes128ctr, ptls_fusion_aes256ctr;
 extern ptls_aead_algorithm_t ptls_fusion_aes128gcm, ptls_fusion_aes256gcm;
+/**
+ * AEGIS-128L and AEGIS-256 using AES-NI (see lib/aegis-common.h)
+ */
+extern ptls_aead_algorithm_t ptls_fusion_aegis128l, ptls_fusion_aegis256;
+/**
+ * Integrity-only AEADs that emit the plaintext followed by the AES-GCM tag calculated as if the plaintext were the ciphertext (i.e.
+ * AES-GMAC). They are used by the private-use cipher suites PTLS_CIPHER_SUITE_AES_128_GMAC_SHA256 and
+ * PTLS_CIPHER_SUITE_AES_256_GMAC_SHA384, which provide no confidentiality.
+ */
+extern ptls_aead_algorithm_t ptls_fusion_aes128gmac, ptls_fusion_aes256gmac;
+
+/**
+ * The `do_encrypt` callback of the AEAD contexts being created by ptls_fusion_aes128gcm and ptls_fusion_aes256gcm. Exposed so that
+ * the record layer can call it directly when built with PTLS_RECORD_AEAD_FUSION.
+ */
+void ptls_fusion_aesgcm_aead_encrypt(ptls_aead_context_t *ctx, void *output, const void *input, size_t inlen, uint64_t seq,
+                                     const void *aad, size_t aadlen, ptls_aead_supplementary_encryption_t *supp);
+/**
+ * Encrypts the concatenation of `input` and `trailer` (up to 16 bytes) using the AEAD context, without copying the payload. Used by
+ * the record layer for appending the inner content type when built with PTLS_RECORD_AEAD_FUSION.
+ */
+void ptls_fusion_aesgcm_aead_encrypt_with_trailer(ptls_aead_context_t *ctx, void *output, const void *input, size_t inlen,
+                                                  const void *trailer, size_t trailerlen, uint64_t seq, const void *aad,
+                                                  size_t aadlen);
+/**
+ * The `do_decrypt` callback of the AEAD contexts being created by ptls_fusion_aes128gcm and ptls_fusion_aes256gcm.
+ */
+size_t ptls_fusion_aesgcm_aead_decrypt(ptls_aead_context_t *ctx, void *output, const void *input, size_t inlen, uint64_t seq,
+                                       const void *aad, size_t aadlen);
 
 /**
  * Returns a boolean indicating if fusion can be used.
@@ -38,11 +38,19 @@ typedef struct st_ptls_minicrypto_secp256r1sha256_sign_certificate_t {
 } ptls_minicrypto_secp256r1sha256_sign_certificate_t;
 
 void ptls_minicrypto_random_bytes(void *buf, size_t len);
+/**
+ * per-thread ChaCha20-based generator (see `ptls_chacha20_random_bytes`) seeded directly from the entropy source of the OS
+ */
+void ptls_minicrypto_chacha20_random_bytes(void *buf, size_t len);
 
 int ptls_minicrypto_init_secp256r1sha256_sign_certificate(ptls_minicrypto_secp256r1sha256_sign_certificate_t *self,
                                                           ptls_iovec_t key);
 
 extern ptls_key_exchange_algorithm_t ptls_minicrypto_secp256r1, ptls_minicrypto_x25519;
+/**
+ * Hybrid of X25519 and ML-KEM-768. Not included in ptls_minicrypto_key_exchanges, as the key share of the client is 1,216 bytes.
+ */
+extern ptls_key_exchange_algorithm_t ptls_minicrypto_x25519mlkem768;
 extern ptls_key_exchange_algorithm_t *ptls_minicrypto_key_exchanges[];
 extern ptls_cipher_algorithm_t ptls_minicrypto_aes128ecb, ptls_minicrypto_aes256ecb, ptls_minicrypto_aes128ctr,
     ptls_minicrypto_aes256ctr, ptls_minicrypto_chacha20;
@@ -50,6 +58,23 @@ extern ptls_aead_algorithm_t ptls_minicrypto_aes128gcm, ptls_minicrypto_aes256gc
 extern ptls_hash_algorithm_t ptls_minicrypto_sha256, ptls_minicrypto_sha384;
 extern ptls_cipher_suite_t ptls_minicrypto_aes128gcmsha256, ptls_minicrypto_aes256gcmsha384, ptls_minicrypto_chacha20poly1305sha256;
 extern ptls_cipher_suite_t *ptls_minicrypto_cipher_suites[];
+/**
+ * AEGIS-128L and AEGIS-256. The cipher suites use private-use codepoints, and therefore are not included in
+ * ptls_minicrypto_cipher_suites.
+ */
+extern ptls_aead_algorithm_t ptls_minicrypto_aegis128l, ptls_minicrypto_aegis256;
+extern ptls_cipher_suite_t ptls_minicrypto_aegis128lsha256, ptls_minicrypto_aegis256sha384;
+/**
+ * Integrity-only cipher suites (RFC 9150). They are not included in ptls_minicrypto_cipher_suites, as they provide no
+ * confidentiality.
+ */
+extern ptls_aead_algorithm_t ptls_minicrypto_integrity_sha256, ptls_minicrypto_integrity_sha384;
+extern ptls_cipher_suite_t ptls_minicrypto_sha256sha256, ptls_minicrypto_sha384sha384;
+extern ptls_hpke_kem_t ptls_minicrypto_hpke_kem_p256sha256, ptls_minicrypto_hpke_kem_x25519sha256;
+extern ptls_hpke_kem_t *ptls_minicrypto_hpke_kems[];
+extern ptls_hpke_cipher_suite_t ptls_minicrypto_hpke_aes128gcmsha256, ptls_minicrypto_hpke_aes256gcmsha384,
+    ptls_minicrypto_hpke_chacha20poly1305sha256;
+extern ptls_hpke_cipher_suite_t *ptls_minicrypto_hpke_cipher_suites[];
 
 typedef struct st_ptls_asn1_pkcs8_private_key_t {
     ptls_iovec_t vec;
@@ -55,6 +55,10 @@ extern ptls_key_exchange_algorithm_t ptls_openssl_secp521r1;
 #define PTLS_OPENSSL_HAS_X25519 1  /* deprecated; use HAVE_ */
 extern ptls_key_exchange_algorithm_t ptls_openssl_x25519;
 #endif
+#if PTLS_OPENSSL_HAVE_X25519 && OPENSSL_VERSION_NUMBER >= 0x30500000L && !defined(OPENSSL_NO_ML_KEM)
+#define PTLS_OPENSSL_HAVE_X25519MLKEM768 1
+extern ptls_key_exchange_algorithm_t ptls_openssl_x25519mlkem768;
+#endif
 #ifndef OPENSSL_NO_BF
 #define PTLS_OPENSSL_HAVE_BF 1
 #endif
@@ -72,6 +76,14 @@ extern ptls_hash_algorithm_t ptls_openssl_sha384;
 extern ptls_cipher_suite_t ptls_openssl_aes128gcmsha256;
 extern ptls_cipher_suite_t ptls_openssl_aes256gcmsha384;
 extern ptls_cipher_suite_t *ptls_openssl_cipher_suites[];
+/**
+ * Integrity-only cipher suites (RFC 9150). They are not included in ptls_openssl_cipher_suites; applications that want to use them
+ * on trusted links have to list them explicitly in ptls_context_t::cipher_suites.
+ */
+extern ptls_aead_algorithm_t ptls_openssl_integrity_sha256;
+extern ptls_aead_algorithm_t ptls_openssl_integrity_sha384;
+extern ptls_cipher_suite_t ptls_openssl_sha256sha256;
+extern ptls_cipher_suite_t ptls_openssl_sha384sha384;
 
 #if defined(PTLS_OPENSSL_HAVE_CHACHA20_POLY1305)
 extern ptls_cipher_algorithm_t ptls_openssl_chacha20;
@@ -83,7 +95,26 @@ extern ptls_cipher_suite_t ptls_openssl_chacha20poly1305sha256;
 extern ptls_cipher_algorithm_t ptls_openssl_bfecb;
 #endif
 
+extern ptls_hpke_kem_t ptls_openssl_hpke_kem_p256sha256;
+#if PTLS_OPENSSL_HAVE_X25519
+extern ptls_hpke_kem_t ptls_openssl_hpke_kem_x25519sha256;
+#endif
+extern ptls_hpke_kem_t *ptls_openssl_hpke_kems[];
+extern ptls_hpke_cipher_suite_t ptls_openssl_hpke_aes128gcmsha256;
+extern ptls_hpke_cipher_suite_t ptls_openssl_hpke_aes256gcmsha384;
+#if PTLS_OPENSSL_HAVE_CHACHA20_POLY1305
+extern ptls_hpke_cipher_suite_t ptls_openssl_hpke_chacha20poly1305sha256;
+#endif
+extern ptls_hpke_cipher_suite_t *ptls_openssl_hpke_cipher_suites[];
+
 void ptls_openssl_random_bytes(void *buf, size_t len);
+#if PTLS_OPENSSL_HAVE_CHACHA20_POLY1305
+/**
+ * per-thread ChaCha20-based generator (see `ptls_chacha20_random_bytes`) seeded by `ptls_openssl_random_bytes`, that avoids the
+ * locks RAND_bytes might take
+ */
+void ptls_openssl_chacha20_random_bytes(void *buf, size_t len);
+#endif
 /**
  * constructs a key exchange context. pkey's reference count is incremented.
  */
@@ -102,6 +133,11 @@ typedef struct st_ptls_openssl_sign_certificate_t {
 
 int ptls_openssl_init_sign_certificate(ptls_openssl_sign_certificate_t *self, EVP_PKEY *key);
 void ptls_openssl_dispose_sign_certificate(ptls_openssl_sign_certificate_t *self);
+/**
+ * Initializes a signer using a copy of the private key of `src`. Unlike `ptls_openssl_init_sign_certificate`, the key object is
+ * not shared, hence threads using different clones do not write to the reference counter nor to the other state of one key.
+ */
+int ptls_openssl_clone_sign_certificate(ptls_openssl_sign_certificate_t *self, ptls_openssl_sign_certificate_t *src);
 int ptls_openssl_load_certificates(ptls_context_t *ctx, X509 *cert, STACK_OF(X509) * chain);
 
 typedef struct st_ptls_openssl_verify_certificate_t {
@@ -112,6 +148,106 @@ typedef struct st_ptls_openssl_verify_certificate_t {
 int ptls_openssl_init_verify_certificate(ptls_openssl_verify_certificate_t *self, X509_STORE *store);
 void ptls_openssl_dispose_verify_certificate(ptls_openssl_verify_certificate_t *self);
 X509_STORE *ptls_openssl_create_default_certificate_store(void);
+/**
+ * Initializes a verifier using a new certificate store, to which copies of the certificates and CRLs loaded into the store of `src`
+ * are added, along with its verification parameters and callback. Lookup methods are not copied; therefore, certificates that
+ * the store of `src` would load on demand (e.g., from the directory added by `ptls_openssl_create_default_certificate_store`)
+ * are not available to the clone.
+ */
+int ptls_openssl_clone_verify_certificate(ptls_openssl_verify_certificate_t *self, ptls_openssl_verify_certificate_t *src);
+
+/**
+ * A copy of a context to be used by one worker thread (or by the threads running on one NUMA node), so that the handshakes being
+ * run on different cores do not modify the same objects.
+ */
+typedef struct st_ptls_openssl_context_replica_t {
+    ptls_context_t ctx;
+    ptls_openssl_sign_certificate_t sign_certificate;
+    ptls_openssl_verify_certificate_t verify_certificate;
+} ptls_openssl_context_replica_t;
+
+/**
+ * Initializes `self->ctx` as a copy of `src`. When the signer of `src` is the one provided by this backend, it is replaced by a
+ * clone (see `ptls_openssl_clone_sign_certificate`). When the verifier of `src` is the one provided by this backend, the replica
+ * uses a verifier that refers to the same certificate store, or to a clone of the store if `clone_verifier` is set (see
+ * `ptls_openssl_clone_verify_certificate`). Cloning is to be requested only when the trust anchors are loaded into the store, as
+ * the clone does not have the lookup methods of the original. Other callbacks are shared with `src`; applications can replace
+ * them (e.g., `update_open_count`) after calling this function. Note that `ptls_ticket_key_file_t` already keeps its state per
+ * thread and therefore can be shared.
+ */
+int ptls_openssl_init_context_replica(ptls_openssl_context_replica_t *self, const ptls_context_t *src, int clone_verifier);
+/**
+ * Disposes the objects that have been cloned by `ptls_openssl_init_context_replica`.
+ */
+void ptls_openssl_dispose_context_replica(ptls_openssl_context_replica_t *self);
+
+#if !defined(OPENSSL_NO_OCSP) && !defined(_WINDOWS)
+#define PTLS_OPENSSL_HAVE_OCSP_STAPLER 1
+/**
+ * obtains a DER-encoded OCSPResponse for `cert` issued by `issuer`; the response is to be returned using memory allocated by malloc
+ */
+PTLS_CALLBACK_TYPE(int, openssl_fetch_ocsp_response, ptls_iovec_t *resp, X509 *cert, X509 *issuer);
+
+/**
+ * fetcher that reads the OCSP response from a file, e.g., one maintained by a cron job that queries the responder
+ */
+typedef struct st_ptls_openssl_ocsp_response_file_t {
+    ptls_openssl_fetch_ocsp_response_t super;
+    const char *path;
+} ptls_openssl_ocsp_response_file_t;
+
+/**
+ * Certificate emitter that staples OCSP responses. Each response being obtained by the fetcher is validated once (the signature by
+ * the issuer or its delegate, the status of the certificate being "good", and the validity period), then cached as part of a
+ * pre-encoded Certificate message. The cached message is replaced atomically when a new response is obtained, which happens when
+ * half of the remaining validity period has elapsed. Responses lacking nextUpdate are rejected.
+ */
+typedef struct st_ptls_openssl_ocsp_stapler_t {
+    ptls_emit_certificate_t super;
+    ptls_openssl_fetch_ocsp_response_t *fetch;
+    /**
+     * clock being used for determining the validity of the responses (default: ptls_get_time)
+     */
+    ptls_get_time_t *get_time;
+    /**
+     * interval before retrying after a failure to obtain a valid response, in milliseconds (default: 60 seconds)
+     */
+    uint64_t retry_interval;
+    /**
+     * optional emitter (e.g., `ptls_emit_compressed_certificate_t` initialized without the status) to which the stapler delegates
+     * when the client offers certificate compression and no response is being stapled; stapled responses are always sent
+     * uncompressed
+     */
+    ptls_emit_certificate_t *compressed;
+    struct st_ptls_openssl_ocsp_stapler_state_t *_state;
+} ptls_openssl_ocsp_stapler_t;
+
+/**
+ * the callback function of `ptls_openssl_ocsp_response_file_t`
+ */
+int ptls_openssl_read_ocsp_response_file(ptls_openssl_fetch_ocsp_response_t *self, ptls_iovec_t *resp, X509 *cert, X509 *issuer);
+/**
+ * Initializes the stapler. `certificates` is the DER-encoded chain being sent, the first being the end-entity certificate and the
+ * second being its issuer; it is referred to until the stapler is disposed. A response is not obtained until
+ * `ptls_openssl_refresh_ocsp_stapler` or `ptls_openssl_start_ocsp_stapler` is called; until then, Certificate messages are sent
+ * without the status.
+ */
+int ptls_openssl_init_ocsp_stapler(ptls_openssl_ocsp_stapler_t *self, ptls_iovec_t *certificates, size_t num_certificates,
+                                   ptls_openssl_fetch_ocsp_response_t *fetch);
+/**
+ * obtains and validates a response, then replaces the cached Certificate message. Upon failure, the previous response is retained
+ * until it expires.
+ */
+int ptls_openssl_refresh_ocsp_stapler(ptls_openssl_ocsp_stapler_t *self);
+/**
+ * spawns a thread that calls `ptls_openssl_refresh_ocsp_stapler` as the responses near expiration
+ */
+int ptls_openssl_start_ocsp_stapler(ptls_openssl_ocsp_stapler_t *self);
+/**
+ * stops the thread (if any) and releases the resources
+ */
+void ptls_openssl_dispose_ocsp_stapler(ptls_openssl_ocsp_stapler_t *self);
+#endif
 
 int ptls_openssl_encrypt_ticket(ptls_buffer_t *dst, ptls_iovec_t src,
                                 int (*cb)(unsigned char *, unsigned char *, EVP_CIPHER_CTX *, HMAC_CTX *, int));
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#ifndef picotls_session_cache_h
+#define picotls_session_cache_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "picotls.h"
+
+/**
+ * size of the session ID being sent to the client as the ticket
+ */
+#define PTLS_SESSION_CACHE_ID_SIZE 16
+/**
+ * number of sessions that can be stored in each bucket
+ */
+#define PTLS_SESSION_CACHE_WAYS 4
+
+/**
+ * Stateful resumption backed by a fixed-size hash table in shared memory, so that the workers of a pre-forking server see the
+ * sessions stored by each other. The ticket being sent to the client is a random session ID, that refers to the session stored in
+ * the table.
+ *
+ * Each bucket is protected by a seqlock; readers retry when they observe a concurrent update, and writers that find the bucket
+ * being updated by someone else do not wait but give up storing the session (the client then receives a ticket that will not
+ * resolve). No lock is shared between the processes, therefore a process dying while updating a bucket leaves that bucket
+ * unusable until the table is recreated.
+ */
+typedef struct st_ptls_session_cache_t {
+    ptls_encrypt_ticket_t super;
+    struct st_ptls_session_cache_header_t *_shm;
+    size_t _shm_size;
+} ptls_session_cache_t;
+
+/**
+ * Maps the session cache stored in the file referred to by `fd` (e.g., a file being opened or one created by memfd_create). If the
+ * file is empty, it is extended and initialized to hold `num_buckets * PTLS_SESSION_CACHE_WAYS` sessions, each up to
+ * `max_session_size` bytes. Otherwise, the table found in the file is used, after checking that it has been built using the same
+ * parameters. The table is to be initialized before other processes start using it; a pre-forking server would call this function
+ * before forking the workers. `fd` can be closed once the function returns.
+ *
+ * WARNING: the file holds the resumption secrets in clear, and the pages being shared through MAP_SHARED are written back to the
+ * backing file. The file must therefore reside on tmpfs (or be created by memfd_create) so that the secrets never reach persistent
+ * storage, and be readable and writable only by the server (i.e., mode 0600).
+ */
+int ptls_session_cache_init(ptls_session_cache_t *self, int fd, size_t num_buckets, size_t max_session_size);
+/**
+ * Unmaps the session cache. The sessions stored in the file are retained.
+ */
+void ptls_session_cache_dispose(ptls_session_cache_t *self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
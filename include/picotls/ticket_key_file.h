@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#ifndef picotls_ticket_key_file_h
+#define picotls_ticket_key_file_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "picotls.h"
+
+#define PTLS_TICKET_KEY_NAME_SIZE 16
+#define PTLS_TICKET_KEY_SECRET_SIZE PTLS_MAX_DIGEST_SIZE
+/**
+ * maximum number of keys that a key file can hold
+ */
+#define PTLS_TICKET_KEY_FILE_MAX_KEYS 16
+
+/**
+ * A ticket key, as stored in the key file. Times are in milliseconds since epoch, as returned by `ptls_get_time`.
+ */
+typedef struct st_ptls_ticket_key_t {
+    /**
+     * identifies the key; sent in clear as the first bytes of the ticket
+     */
+    uint8_t name[PTLS_TICKET_KEY_NAME_SIZE];
+    /**
+     * the key is used for encrypting tickets starting from this time; among the keys being eligible, the one with the largest
+     * `not_before` is used
+     */
+    uint64_t not_before;
+    /**
+     * the key is neither used for encrypting nor for decrypting tickets once this time is reached
+     */
+    uint64_t not_after;
+    /**
+     * the first `hash->digest_size` bytes are used as the traffic secret from which the AEAD key and IV are derived
+     */
+    uint8_t secret[PTLS_TICKET_KEY_SECRET_SIZE];
+} ptls_ticket_key_t;
+
+/**
+ * Stateless ticket encryption using keys that an external rotator writes to a file shared by all the workers. The file consists of
+ * a header of 64 bytes, that starts with an 8-byte magic ("ptlstkf1") followed by the 8-byte generation counter and the 4-byte
+ * number of keys, followed by PTLS_TICKET_KEY_FILE_MAX_KEYS instances of `ptls_ticket_key_t`. All integers are in host byte order.
+ *
+ * The rotator updates the file in place using `ptls_ticket_key_file_update`, which increments the generation counter before and
+ * after writing the keys. Each thread using the encrypter keeps its own copy of the keys along with the AEAD contexts being set up,
+ * and reloads them only when it observes a new generation. The handshake path therefore does not take any lock.
+ *
+ * To keep resumption working across rotations of a fleet, a new key should be added well before its `not_before`, so that every
+ * host can decrypt the tickets encrypted using that key before any host starts issuing them, and the retiring key should be kept
+ * until the tickets it has encrypted expire.
+ *
+ * A ticket is the key name, followed by an 8-byte nonce and the AEAD-protected session.
+ */
+typedef struct st_ptls_ticket_key_file_t {
+    ptls_encrypt_ticket_t super;
+    ptls_cipher_suite_t *cipher_suite;
+    struct st_ptls_ticket_key_file_state_t *_state;
+} ptls_ticket_key_file_t;
+
+/**
+ * Maps the key file referred to by `fd`, that would be read by the workers using the AEAD algorithm and hash function of
+ * `cipher_suite`. If the file is empty, it is initialized to contain no keys. While no key is eligible for encryption (i.e., before
+ * the rotator adds one, or after all the keys reach `not_after`), handshakes complete without NewSessionTicket being sent. `fd`
+ * can be closed once the function returns.
+ *
+ * WARNING: the file holds the ticket keys in clear, and is mapped using MAP_SHARED. It must reside on tmpfs so that the keys never
+ * reach persistent storage, and be readable and writable only by the server and the rotator (i.e., mode 0600).
+ */
+int ptls_ticket_key_file_init(ptls_ticket_key_file_t *self, int fd, ptls_cipher_suite_t *cipher_suite);
+/**
+ * Releases the resources, including the AEAD contexts being cached by each thread. Must be called after the threads stop using the
+ * encrypter.
+ */
+void ptls_ticket_key_file_dispose(ptls_ticket_key_file_t *self);
+/**
+ * Replaces the keys stored in the key file referred to by `fd`. This function is to be used by the rotator; there can be only one
+ * rotator updating the file at a time.
+ */
+int ptls_ticket_key_file_update(int fd, const ptls_ticket_key_t *keys, size_t num_keys);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,399 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+/*
+ * AEGIS-128L and AEGIS-256 (draft-irtf-cfrg-aegis-aead), with 128-bit tags.
+ *
+ * The file is included by each backend after defining the type `aegis_block_t` that holds 128 bits, and the following operations:
+ *   aegis_load(const uint8_t *p), aegis_store(uint8_t *p, aegis_block_t b), aegis_xor(a, b), aegis_and(a, b), and
+ *   aegis_round(in, rk) that returns MixColumns(ShiftRows(SubBytes(in))) ^ rk (i.e. one AES encryption round).
+ */
+#include <stdint.h>
+#include <string.h>
+#include "picotls.h"
+
+static const uint8_t aegis_c0[16] = {0x00, 0x01, 0x01, 0x02, 0x03, 0x05, 0x08, 0x0d,
+                                     0x15, 0x22, 0x37, 0x59, 0x90, 0xe9, 0x79, 0x62};
+static const uint8_t aegis_c1[16] = {0xdb, 0x3d, 0x18, 0x55, 0x6d, 0xc2, 0x2f, 0xf1,
+                                     0x20, 0x11, 0x31, 0x42, 0x73, 0xb5, 0x28, 0xdd};
+
+static inline aegis_block_t aegis_length_block(uint64_t adlen, uint64_t msglen)
+{
+    uint8_t bytes[16];
+    int i;
+
+    adlen *= 8;
+    msglen *= 8;
+    for (i = 0; i < 8; ++i) {
+        bytes[i] = (uint8_t)(adlen >> (i * 8));
+        bytes[i + 8] = (uint8_t)(msglen >> (i * 8));
+    }
+    return aegis_load(bytes);
+}
+
+struct aegis128l_state {
+    aegis_block_t s[8];
+};
+
+static inline void aegis128l_update(struct aegis128l_state *st, aegis_block_t m0, aegis_block_t m1)
+{
+    aegis_block_t s7 = st->s[7];
+
+    st->s[7] = aegis_round(st->s[6], st->s[7]);
+    st->s[6] = aegis_round(st->s[5], st->s[6]);
+    st->s[5] = aegis_round(st->s[4], st->s[5]);
+    st->s[4] = aegis_round(st->s[3], aegis_xor(st->s[4], m1));
+    st->s[3] = aegis_round(st->s[2], st->s[3]);
+    st->s[2] = aegis_round(st->s[1], st->s[2]);
+    st->s[1] = aegis_round(st->s[0], st->s[1]);
+    st->s[0] = aegis_round(s7, aegis_xor(st->s[0], m0));
+}
+
+static inline void aegis128l_init(struct aegis128l_state *st, const uint8_t *key, const uint8_t *nonce)
+{
+    aegis_block_t k = aegis_load(key), n = aegis_load(nonce), c0 = aegis_load(aegis_c0), c1 = aegis_load(aegis_c1);
+    int i;
+
+    st->s[0] = aegis_xor(k, n);
+    st->s[1] = c1;
+    st->s[2] = c0;
+    st->s[3] = c1;
+    st->s[4] = aegis_xor(k, n);
+    st->s[5] = aegis_xor(k, c0);
+    st->s[6] = aegis_xor(k, c1);
+    st->s[7] = aegis_xor(k, c0);
+    for (i = 0; i < 10; ++i)
+        aegis128l_update(st, n, k);
+}
+
+static inline void aegis128l_absorb(struct aegis128l_state *st, const uint8_t *ad, size_t adlen)
+{
+    for (; adlen >= 32; ad += 32, adlen -= 32)
+        aegis128l_update(st, aegis_load(ad), aegis_load(ad + 16));
+    if (adlen != 0) {
+        uint8_t buf[32] = {0};
+        memcpy(buf, ad, adlen);
+        aegis128l_update(st, aegis_load(buf), aegis_load(buf + 16));
+    }
+}
+
+static inline void aegis128l_enc(struct aegis128l_state *st, uint8_t *dst, const uint8_t *src)
+{
+    aegis_block_t z0 = aegis_xor(aegis_xor(st->s[6], st->s[1]), aegis_and(st->s[2], st->s[3])),
+                  z1 = aegis_xor(aegis_xor(st->s[2], st->s[5]), aegis_and(st->s[6], st->s[7])), t0 = aegis_load(src),
+                  t1 = aegis_load(src + 16);
+
+    aegis_store(dst, aegis_xor(t0, z0));
+    aegis_store(dst + 16, aegis_xor(t1, z1));
+    aegis128l_update(st, t0, t1);
+}
+
+/**
+ * decrypts `len` bytes of ciphertext (at most 32; shorter only for the last block)
+ */
+static inline void aegis128l_dec(struct aegis128l_state *st, uint8_t *dst, const uint8_t *src, size_t len)
+{
+    aegis_block_t z0 = aegis_xor(aegis_xor(st->s[6], st->s[1]), aegis_and(st->s[2], st->s[3])),
+                  z1 = aegis_xor(aegis_xor(st->s[2], st->s[5]), aegis_and(st->s[6], st->s[7])), t0, t1;
+
+    if (PTLS_LIKELY(len == 32)) {
+        t0 = aegis_xor(aegis_load(src), z0);
+        t1 = aegis_xor(aegis_load(src + 16), z1);
+        aegis_store(dst, t0);
+        aegis_store(dst + 16, t1);
+    } else {
+        uint8_t buf[32] = {0};
+        memcpy(buf, src, len);
+        aegis_store(buf, aegis_xor(aegis_load(buf), z0));
+        aegis_store(buf + 16, aegis_xor(aegis_load(buf + 16), z1));
+        memcpy(dst, buf, len);
+        memset(buf + len, 0, sizeof(buf) - len);
+        t0 = aegis_load(buf);
+        t1 = aegis_load(buf + 16);
+        ptls_clear_memory(buf, sizeof(buf));
+    }
+    aegis128l_update(st, t0, t1);
+}
+
+static inline void aegis128l_finalize(struct aegis128l_state *st, uint64_t adlen, uint64_t msglen, uint8_t *tag)
+{
+    aegis_block_t t = aegis_xor(st->s[2], aegis_length_block(adlen, msglen));
+    int i;
+
+    for (i = 0; i < 7; ++i)
+        aegis128l_update(st, t, t);
+    t = aegis_xor(aegis_xor(aegis_xor(st->s[0], st->s[1]), aegis_xor(st->s[2], st->s[3])),
+                  aegis_xor(aegis_xor(st->s[4], st->s[5]), st->s[6]));
+    aegis_store(tag, t);
+}
+
+struct aegis256_state {
+    aegis_block_t s[6];
+};
+
+static inline void aegis256_update(struct aegis256_state *st, aegis_block_t m)
+{
+    aegis_block_t s5 = st->s[5];
+
+    st->s[5] = aegis_round(st->s[4], st->s[5]);
+    st->s[4] = aegis_round(st->s[3], st->s[4]);
+    st->s[3] = aegis_round(st->s[2], st->s[3]);
+    st->s[2] = aegis_round(st->s[1], st->s[2]);
+    st->s[1] = aegis_round(st->s[0], st->s[1]);
+    st->s[0] = aegis_round(s5, aegis_xor(st->s[0], m));
+}
+
+static inline void aegis256_init(struct aegis256_state *st, const uint8_t *key, const uint8_t *nonce)
+{
+    aegis_block_t k0 = aegis_load(key), k1 = aegis_load(key + 16), n0 = aegis_load(nonce), n1 = aegis_load(nonce + 16),
+                  c0 = aegis_load(aegis_c0), c1 = aegis_load(aegis_c1), k0n0 = aegis_xor(k0, n0), k1n1 = aegis_xor(k1, n1);
+    int i;
+
+    st->s[0] = k0n0;
+    st->s[1] = k1n1;
+    st->s[2] = c1;
+    st->s[3] = c0;
+    st->s[4] = aegis_xor(k0, c0);
+    st->s[5] = aegis_xor(k1, c1);
+    for (i = 0; i < 4; ++i) {
+        aegis256_update(st, k0);
+        aegis256_update(st, k1);
+        aegis256_update(st, k0n0);
+        aegis256_update(st, k1n1);
+    }
+}
+
+static inline void aegis256_absorb(struct aegis256_state *st, const uint8_t *ad, size_t adlen)
+{
+    for (; adlen >= 16; ad += 16, adlen -= 16)
+        aegis256_update(st, aegis_load(ad));
+    if (adlen != 0) {
+        uint8_t buf[16] = {0};
+        memcpy(buf, ad, adlen);
+        aegis256_update(st, aegis_load(buf));
+    }
+}
+
+static inline void aegis256_enc(struct aegis256_state *st, uint8_t *dst, const uint8_t *src)
+{
+    aegis_block_t z = aegis_xor(aegis_xor(aegis_xor(st->s[1], st->s[4]), st->s[5]), aegis_and(st->s[2], st->s[3])),
+                  t = aegis_load(src);
+
+    aegis_store(dst, aegis_xor(t, z));
+    aegis256_update(st, t);
+}
+
+/**
+ * decrypts `len` bytes of ciphertext (at most 16; shorter only for the last block)
+ */
+static inline void aegis256_dec(struct aegis256_state *st, uint8_t *dst, const uint8_t *src, size_t len)
+{
+    aegis_block_t z = aegis_xor(aegis_xor(aegis_xor(st->s[1], st->s[4]), st->s[5]), aegis_and(st->s[2], st->s[3])), t;
+
+    if (PTLS_LIKELY(len == 16)) {
+        t = aegis_xor(aegis_load(src), z);
+        aegis_store(dst, t);
+    } else {
+        uint8_t buf[16] = {0};
+        memcpy(buf, src, len);
+        aegis_store(buf, aegis_xor(aegis_load(buf), z));
+        memcpy(dst, buf, len);
+        memset(buf + len, 0, sizeof(buf) - len);
+        t = aegis_load(buf);
+        ptls_clear_memory(buf, sizeof(buf));
+    }
+    aegis256_update(st, t);
+}
+
+static inline void aegis256_finalize(struct aegis256_state *st, uint64_t adlen, uint64_t msglen, uint8_t *tag)
+{
+    aegis_block_t t = aegis_xor(st->s[3], aegis_length_block(adlen, msglen));
+    int i;
+
+    for (i = 0; i < 7; ++i)
+        aegis256_update(st, t);
+    t = aegis_xor(aegis_xor(aegis_xor(st->s[0], st->s[1]), aegis_xor(st->s[2], st->s[3])), aegis_xor(st->s[4], st->s[5]));
+    aegis_store(tag, t);
+}
+
+/*
+ * AEAD contexts. As the ciphers process the input in blocks, the streaming interface retains the trailing partial block of each
+ * call to do_encrypt_update, and the remainder is emitted by do_encrypt_final.
+ */
+
+#define AEGIS_DEFINE_AEAD(name, rate, key_size, iv_size)                                                                           \
+    struct name##_context_t {                                                                                                      \
+        ptls_aead_context_t super;                                                                                                 \
+        struct name##_state state;                                                                                                 \
+        uint8_t key[key_size];                                                                                                     \
+        uint8_t static_iv[iv_size];                                                                                                \
+        uint64_t adlen;                                                                                                            \
+        uint64_t msglen;                                                                                                           \
+        uint8_t partial[rate];                                                                                                     \
+        size_t partial_len;                                                                                                        \
+    };                                                                                                                             \
+                                                                                                                                   \
+    static void name##_dispose_crypto(ptls_aead_context_t *_ctx)                                                                   \
+    {                                                                                                                              \
+        struct name##_context_t *ctx = (struct name##_context_t *)_ctx;                                                            \
+        /* clear all memory except super */                                                                                        \
+        ptls_clear_memory((uint8_t *)ctx + sizeof(ctx->super), sizeof(*ctx) - sizeof(ctx->super));                                \
+    }                                                                                                                              \
+                                                                                                                                   \
+    static void name##_begin(struct name##_context_t *ctx, uint64_t seq, const void *aad, size_t aadlen)                           \
+    {                                                                                                                              \
+        uint8_t nonce[iv_size];                                                                                                    \
+        ptls_aead__build_iv(ctx->super.algo, nonce, ctx->static_iv, seq);                                                          \
+        name##_init(&ctx->state, ctx->key, nonce);                                                                                 \
+        name##_absorb(&ctx->state, aad, aadlen);                                                                                   \
+        ctx->adlen = aadlen;                                                                                                       \
+        ctx->msglen = 0;                                                                                                           \
+        ctx->partial_len = 0;                                                                                                      \
+    }                                                                                                                              \
+                                                                                                                                   \
+    static void name##_encrypt_init(ptls_aead_context_t *_ctx, uint64_t seq, const void *aad, size_t aadlen)                       \
+    {                                                                                                                              \
+        name##_begin((struct name##_context_t *)_ctx, seq, aad, aadlen);                                                           \
+    }                                                                                                                              \
+                                                                                                                                   \
+    static size_t name##_encrypt_update(ptls_aead_context_t *_ctx, void *_output, const void *_input, size_t inlen)                \
+    {                                                                                                                              \
+        struct name##_context_t *ctx = (struct name##_context_t *)_ctx;                                                            \
+        uint8_t *output = _output;                                                                                                 \
+        const uint8_t *input = _input;                                                                                             \
+        size_t off = 0;                                                                                                            \
+                                                                                                                                   \
+        ctx->msglen += inlen;                                                                                                      \
+        if (ctx->partial_len != 0) {                                                                                               \
+            size_t n = rate - ctx->partial_len;                                                                                    \
+            if (n > inlen)                                                                                                         \
+                n = inlen;                                                                                                         \
+            memcpy(ctx->partial + ctx->partial_len, input, n);                                                                     \
+            ctx->partial_len += n;                                                                                                 \
+            input += n;                                                                                                            \
+            inlen -= n;                                                                                                            \
+            if (ctx->partial_len < rate)                                                                                           \
+                return 0;                                                                                                          \
+            name##_enc(&ctx->state, output, ctx->partial);                                                                         \
+            off = rate;                                                                                                            \
+            ctx->partial_len = 0;                                                                                                  \
+        }                                                                                                                          \
+        for (; inlen >= rate; input += rate, inlen -= rate, off += rate)                                                           \
+            name##_enc(&ctx->state, output + off, input);                                                                          \
+        if (inlen != 0) {                                                                                                          \
+            memcpy(ctx->partial, input, inlen);                                                                                    \
+            ctx->partial_len = inlen;                                                                                              \
+        }                                                                                                                          \
+                                                                                                                                   \
+        return off;                                                                                                                \
+    }                                                                                                                              \
+                                                                                                                                   \
+    static size_t name##_encrypt_final(ptls_aead_context_t *_ctx, void *_output)                                                   \
+    {                                                                                                                              \
+        struct name##_context_t *ctx = (struct name##_context_t *)_ctx;                                                            \
+        uint8_t *output = _output;                                                                                                 \
+        size_t off = 0;                                                                                                            \
+                                                                                                                                   \
+        if (ctx->partial_len != 0) {                                                                                               \
+            uint8_t buf[rate];                                                                                                     \
+            memset(ctx->partial + ctx->partial_len, 0, rate - ctx->partial_len);                                                   \
+            name##_enc(&ctx->state, buf, ctx->partial);                                                                            \
+            memcpy(output, buf, ctx->partial_len);                                                                                 \
+            off = ctx->partial_len;                                                                                                \
+            ptls_clear_memory(ctx->partial, ctx->partial_len);                                                                     \
+            ctx->partial_len = 0;                                                                                                  \
+        }                                                                                                                          \
+        name##_finalize(&ctx->state, ctx->adlen, ctx->msglen, output + off);                                                       \
+                                                                                                                                   \
+        return off + PTLS_AEGIS_TAG_SIZE;                                                                                          \
+    }                                                                                                                              \
+                                                                                                                                   \
+    static void name##_encrypt(ptls_aead_context_t *_ctx, void *output, const void *input, size_t inlen, uint64_t seq,             \
+                               const void *aad, size_t aadlen, ptls_aead_supplementary_encryption_t *supp)                         \
+    {                                                                                                                              \
+        /* ptls_aead__do_encrypt cannot be used, as it assumes that do_encrypt_update emits all the input */                       \
+        size_t off;                                                                                                                \
+                                                                                                                                   \
+        name##_encrypt_init(_ctx, seq, aad, aadlen);                                                                               \
+        off = name##_encrypt_update(_ctx, output, input, inlen);                                                                   \
+        name##_encrypt_final(_ctx, (uint8_t *)output + off);                                                                       \
+                                                                                                                                   \
+        if (supp != NULL) {                                                                                                        \
+            ptls_cipher_init(supp->ctx, supp->input);                                                                              \
+            memset(supp->output, 0, sizeof(supp->output));                                                                         \
+            ptls_cipher_encrypt(supp->ctx, supp->output, supp->output, sizeof(supp->output));                                      \
+        }                                                                                                                          \
+    }                                                                                                                              \
+                                                                                                                                   \
+    static size_t name##_decrypt(ptls_aead_context_t *_ctx, void *_output, const void *_input, size_t inlen, uint64_t seq,         \
+                                 const void *aad, size_t aadlen)                                                                   \
+    {                                                                                                                              \
+        struct name##_context_t *ctx = (struct name##_context_t *)_ctx;                                                            \
+        uint8_t *output = _output, tag[PTLS_AEGIS_TAG_SIZE];                                                                       \
+        const uint8_t *input = _input;                                                                                             \
+        size_t enclen, off;                                                                                                        \
+                                                                                                                                   \
+        if (inlen < PTLS_AEGIS_TAG_SIZE)                                                                                           \
+            return SIZE_MAX;                                                                                                       \
+        enclen = inlen - PTLS_AEGIS_TAG_SIZE;                                                                                      \
+                                                                                                                                   \
+        name##_begin(ctx, seq, aad, aadlen);                                                                                       \
+        for (off = 0; enclen - off >= rate; off += rate)                                                                           \
+            name##_dec(&ctx->state, output + off, input + off, rate);                                                              \
+        if (off != enclen)                                                                                                         \
+            name##_dec(&ctx->state, output + off, input + off, enclen - off);                                                      \
+        name##_finalize(&ctx->state, aadlen, enclen, tag);                                                                         \
+                                                                                                                                   \
+        if (!ptls_mem_equal(tag, input + enclen, PTLS_AEGIS_TAG_SIZE)) {                                                           \
+            ptls_clear_memory(output, enclen);                                                                                     \
+            return SIZE_MAX;                                                                                                       \
+        }                                                                                                                          \
+        return enclen;                                                                                                             \
+    }                                                                                                                              \
+                                                                                                                                   \
+    static int name##_setup_crypto(ptls_aead_context_t *_ctx, int is_enc, const void *key, const void *iv)                         \
+    {                                                                                                                              \
+        struct name##_context_t *ctx = (struct name##_context_t *)_ctx;                                                            \
+                                                                                                                                   \
+        ctx->super.dispose_crypto = name##_dispose_crypto;                                                                         \
+        if (is_enc) {                                                                                                              \
+            ctx->super.do_encrypt_init = name##_encrypt_init;                                                                      \
+            ctx->super.do_encrypt_update = name##_encrypt_update;                                                                  \
+            ctx->super.do_encrypt_final = name##_encrypt_final;                                                                    \
+            ctx->super.do_encrypt = name##_encrypt;                                                                                \
+            ctx->super.do_decrypt = NULL;                                                                                          \
+        } else {                                                                                                                   \
+            ctx->super.do_encrypt_init = NULL;                                                                                     \
+            ctx->super.do_encrypt_update = NULL;                                                                                   \
+            ctx->super.do_encrypt_final = NULL;                                                                                    \
+            ctx->super.do_decrypt = name##_decrypt;                                                                                \
+        }                                                                                                                          \
+                                                                                                                                   \
+        memcpy(ctx->key, key, key_size);                                                                                           \
+        memcpy(ctx->static_iv, iv, iv_size);                                                                                       \
+        ctx->partial_len = 0;                                                                                                      \
+        return 0;                                                                                                                  \
+    }
+
+AEGIS_DEFINE_AEAD(aegis128l, 32, PTLS_AEGIS128L_KEY_SIZE, PTLS_AEGIS128L_IV_SIZE)
+AEGIS_DEFINE_AEAD(aegis256, 16, PTLS_AEGIS256_KEY_SIZE, PTLS_AEGIS256_IV_SIZE)
+
+#undef AEGIS_DEFINE_AEAD
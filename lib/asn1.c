@@ -295,3 +295,260 @@ int ptls_asn1_validation(const uint8_t *bytes, size_t length, ptls_minicrypto_lo
 
     return decode_error;
 }
+
+int ptls_asn1_der_read(ptls_asn1_der_cursor_t *cur, uint8_t *tag, ptls_iovec_t *value, ptls_iovec_t *element)
+{
+    const uint8_t *src = cur->src;
+    size_t length;
+
+    if (src == cur->end)
+        return PTLS_ERROR_BER_ELEMENT_TOO_SHORT;
+
+    /* identifier octet; DER-encoded certificates never use the high-tag-number form */
+    if ((*src & 0x1f) == 0x1f)
+        return PTLS_ERROR_BER_MALFORMED_TYPE;
+    *tag = *src++;
+
+    /* length octets */
+    if (src == cur->end)
+        return PTLS_ERROR_BER_ELEMENT_TOO_SHORT;
+    if ((*src & 0x80) == 0) {
+        length = *src++;
+    } else {
+        size_t length_of_length = *src++ & 0x7f;
+        if (length_of_length == 0)
+            return PTLS_ERROR_DER_INDEFINITE_LENGTH;
+        if (length_of_length > sizeof(uint32_t) || (size_t)(cur->end - src) < length_of_length)
+            return PTLS_ERROR_BER_MALFORMED_LENGTH;
+        length = 0;
+        do {
+            length = (length << 8) | *src++;
+        } while (--length_of_length != 0);
+    }
+    if ((size_t)(cur->end - src) < length)
+        return PTLS_ERROR_BER_EXCESSIVE_LENGTH;
+
+    *value = ptls_iovec_init(src, length);
+    if (element != NULL)
+        *element = ptls_iovec_init(cur->src, src + length - cur->src);
+    cur->src = src + length;
+
+    return 0;
+}
+
+int ptls_asn1_der_read_expected(ptls_asn1_der_cursor_t *cur, uint8_t expected_tag, ptls_iovec_t *value)
+{
+    ptls_asn1_der_cursor_t saved = *cur;
+    uint8_t tag;
+    int ret;
+
+    if ((ret = ptls_asn1_der_read(cur, &tag, value, NULL)) != 0)
+        return ret;
+    if (tag != expected_tag) {
+        *cur = saved;
+        return PTLS_ERROR_INCORRECT_ASN1_SYNTAX;
+    }
+
+    return 0;
+}
+
+int ptls_asn1_der_read_optional(ptls_asn1_der_cursor_t *cur, uint8_t expected_tag, ptls_iovec_t *value)
+{
+    if (ptls_asn1_der_peek_tag(cur) != expected_tag) {
+        *value = ptls_iovec_init(NULL, 0);
+        return 0;
+    }
+    return ptls_asn1_der_read_expected(cur, expected_tag, value);
+}
+
+int ptls_asn1_der_enter(ptls_asn1_der_cursor_t *cur, uint8_t expected_tag, ptls_asn1_der_cursor_t *inner)
+{
+    ptls_iovec_t value;
+    int ret;
+
+    if ((ret = ptls_asn1_der_read_expected(cur, expected_tag, &value)) != 0)
+        return ret;
+    ptls_asn1_der_init(inner, value);
+
+    return 0;
+}
+
+int ptls_asn1_der_skip(ptls_asn1_der_cursor_t *cur, uint8_t expected_tag)
+{
+    ptls_iovec_t value;
+    return ptls_asn1_der_read_expected(cur, expected_tag, &value);
+}
+
+static int decode_time_digits(const uint8_t **src, size_t ndigits, unsigned *value)
+{
+    *value = 0;
+    do {
+        if (!('0' <= **src && **src <= '9'))
+            return PTLS_ERROR_INCORRECT_ASN1_SYNTAX;
+        *value = *value * 10 + (*(*src)++ - '0');
+    } while (--ndigits != 0);
+    return 0;
+}
+
+int ptls_asn1_der_decode_time(uint64_t *unixtime, uint8_t tag, ptls_iovec_t value)
+{
+    static const uint8_t days_in_month[] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    const uint8_t *src = value.base;
+    unsigned year, month, day, hour, min, sec;
+    int ret;
+
+    switch (tag) {
+    case PTLS_ASN1_TAG_UTC_TIME: /* YYMMDDHHMMSSZ */
+        if (value.len != 13)
+            return PTLS_ERROR_INCORRECT_ASN1_SYNTAX;
+        if ((ret = decode_time_digits(&src, 2, &year)) != 0)
+            return ret;
+        year += year < 50 ? 2000 : 1900;
+        break;
+    case PTLS_ASN1_TAG_GENERALIZED_TIME: /* YYYYMMDDHHMMSSZ */
+        if (value.len != 15)
+            return PTLS_ERROR_INCORRECT_ASN1_SYNTAX;
+        if ((ret = decode_time_digits(&src, 4, &year)) != 0)
+            return ret;
+        break;
+    default:
+        return PTLS_ERROR_INCORRECT_ASN1_SYNTAX;
+    }
+    if ((ret = decode_time_digits(&src, 2, &month)) != 0 || (ret = decode_time_digits(&src, 2, &day)) != 0 ||
+        (ret = decode_time_digits(&src, 2, &hour)) != 0 || (ret = decode_time_digits(&src, 2, &min)) != 0 ||
+        (ret = decode_time_digits(&src, 2, &sec)) != 0)
+        return ret;
+    if (*src != 'Z')
+        return PTLS_ERROR_INCORRECT_ASN1_SYNTAX;
+    if (year < 1970 || month < 1 || month > 12 || day < 1 || day > days_in_month[month - 1] || hour > 23 || min > 59 || sec > 60)
+        return PTLS_ERROR_INCORRECT_ASN1_SYNTAX;
+    if (month == 2 && day == 29 && !((year % 4 == 0 && year % 100 != 0) || year % 400 == 0))
+        return PTLS_ERROR_INCORRECT_ASN1_SYNTAX;
+
+    { /* days since epoch, using the algorithm of days_from_civil (http://howardhinnant.github.io/date_algorithms.html) */
+        unsigned y = year - (month <= 2), era = y / 400, yoe = y - era * 400;
+        unsigned doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+        unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        uint64_t days = (uint64_t)era * 146097 + doe - 719468;
+        *unixtime = ((days * 24 + hour) * 60 + min) * 60 + sec;
+    }
+
+    return 0;
+}
+
+static int decode_validity_time(ptls_asn1_der_cursor_t *cur, uint8_t *tag, ptls_iovec_t *value)
+{
+    int ret;
+
+    if ((ret = ptls_asn1_der_read(cur, tag, value, NULL)) != 0)
+        return ret;
+    if (!(*tag == PTLS_ASN1_TAG_UTC_TIME || *tag == PTLS_ASN1_TAG_GENERALIZED_TIME))
+        return PTLS_ERROR_INCORRECT_ASN1_SYNTAX;
+
+    return 0;
+}
+
+static int decode_x509_extensions(ptls_asn1_x509_t *x509, ptls_asn1_der_cursor_t *exts)
+{
+    static const uint8_t oid_subject_alt_name[] = {0x55, 0x1d, 0x11}; /* 2.5.29.17 */
+    int ret;
+
+    while (!ptls_asn1_der_is_empty(exts)) {
+        ptls_asn1_der_cursor_t ext, san;
+        ptls_iovec_t oid, value;
+        if ((ret = ptls_asn1_der_enter(exts, PTLS_ASN1_TAG_SEQUENCE, &ext)) != 0 ||
+            (ret = ptls_asn1_der_read_expected(&ext, PTLS_ASN1_TAG_OBJECT_IDENTIFIER, &oid)) != 0 ||
+            (ret = ptls_asn1_der_read_optional(&ext, PTLS_ASN1_TAG_BOOLEAN, &value)) != 0 ||
+            (ret = ptls_asn1_der_read_expected(&ext, PTLS_ASN1_TAG_OCTET_STRING, &value)) != 0)
+            return ret;
+        if (!ptls_asn1_der_is_empty(&ext))
+            return PTLS_ERROR_INCORRECT_ASN1_SYNTAX;
+        if (oid.len == sizeof(oid_subject_alt_name) && memcmp(oid.base, oid_subject_alt_name, oid.len) == 0) {
+            ptls_asn1_der_init(&san, value);
+            if ((ret = ptls_asn1_der_read_expected(&san, PTLS_ASN1_TAG_SEQUENCE, &x509->subject_alt_name)) != 0)
+                return ret;
+        }
+    }
+
+    return 0;
+}
+
+int ptls_asn1_x509_decode(ptls_asn1_x509_t *x509, ptls_iovec_t der)
+{
+    ptls_asn1_der_cursor_t cur, cert, tbs, validity, exts;
+    ptls_iovec_t value;
+    uint8_t tag;
+    int ret;
+
+    *x509 = (ptls_asn1_x509_t){{NULL}};
+
+    /* Certificate ::= SEQUENCE { tbsCertificate, signatureAlgorithm, signatureValue } */
+    ptls_asn1_der_init(&cur, der);
+    if ((ret = ptls_asn1_der_enter(&cur, PTLS_ASN1_TAG_SEQUENCE, &cert)) != 0)
+        return ret;
+    if (!ptls_asn1_der_is_empty(&cur))
+        return PTLS_ERROR_BER_ELEMENT_TOO_SHORT;
+    if ((ret = ptls_asn1_der_read(&cert, &tag, &value, &x509->tbs_certificate)) != 0)
+        return ret;
+    if (tag != PTLS_ASN1_TAG_SEQUENCE)
+        return PTLS_ERROR_INCORRECT_ASN1_SYNTAX;
+    ptls_asn1_der_init(&tbs, value);
+
+    /* version, serialNumber, signature, issuer */
+    if ((ret = ptls_asn1_der_read_optional(&tbs, PTLS_ASN1_TAG_CONTEXT_CONSTRUCTED(0), &value)) != 0 ||
+        (ret = ptls_asn1_der_read_expected(&tbs, PTLS_ASN1_TAG_INTEGER, &x509->serial_number)) != 0 ||
+        (ret = ptls_asn1_der_skip(&tbs, PTLS_ASN1_TAG_SEQUENCE)) != 0 ||
+        (ret = ptls_asn1_der_read(&tbs, &tag, &value, &x509->issuer)) != 0)
+        return ret;
+    if (tag != PTLS_ASN1_TAG_SEQUENCE)
+        return PTLS_ERROR_INCORRECT_ASN1_SYNTAX;
+
+    /* validity */
+    if ((ret = ptls_asn1_der_enter(&tbs, PTLS_ASN1_TAG_SEQUENCE, &validity)) != 0 ||
+        (ret = decode_validity_time(&validity, &x509->not_before.tag, &x509->not_before.value)) != 0 ||
+        (ret = decode_validity_time(&validity, &x509->not_after.tag, &x509->not_after.value)) != 0)
+        return ret;
+    if (!ptls_asn1_der_is_empty(&validity))
+        return PTLS_ERROR_INCORRECT_ASN1_SYNTAX;
+
+    /* subject, subjectPublicKeyInfo */
+    if ((ret = ptls_asn1_der_read(&tbs, &tag, &value, &x509->subject)) != 0)
+        return ret;
+    if (tag != PTLS_ASN1_TAG_SEQUENCE)
+        return PTLS_ERROR_INCORRECT_ASN1_SYNTAX;
+    if ((ret = ptls_asn1_der_read(&tbs, &tag, &value, &x509->subject_public_key_info)) != 0)
+        return ret;
+    if (tag != PTLS_ASN1_TAG_SEQUENCE)
+        return PTLS_ERROR_INCORRECT_ASN1_SYNTAX;
+
+    /* issuerUniqueID, subjectUniqueID, extensions */
+    if ((ret = ptls_asn1_der_read_optional(&tbs, PTLS_ASN1_TAG_CONTEXT(1), &value)) != 0 ||
+        (ret = ptls_asn1_der_read_optional(&tbs, PTLS_ASN1_TAG_CONTEXT(2), &value)) != 0)
+        return ret;
+    if (ptls_asn1_der_peek_tag(&tbs) == PTLS_ASN1_TAG_CONTEXT_CONSTRUCTED(3)) {
+        if ((ret = ptls_asn1_der_enter(&tbs, PTLS_ASN1_TAG_CONTEXT_CONSTRUCTED(3), &exts)) != 0 ||
+            (ret = ptls_asn1_der_enter(&exts, PTLS_ASN1_TAG_SEQUENCE, &exts)) != 0 ||
+            (ret = decode_x509_extensions(x509, &exts)) != 0)
+            return ret;
+    }
+    if (!ptls_asn1_der_is_empty(&tbs))
+        return PTLS_ERROR_INCORRECT_ASN1_SYNTAX;
+
+    return 0;
+}
+
+int ptls_asn1_x509_next_dns_name(ptls_asn1_der_cursor_t *san, ptls_iovec_t *name)
+{
+    uint8_t tag;
+    int ret;
+
+    while (!ptls_asn1_der_is_empty(san)) {
+        if ((ret = ptls_asn1_der_read(san, &tag, name, NULL)) != 0)
+            return ret;
+        if (tag == PTLS_ASN1_TAG_CONTEXT(2)) /* dNSName [2] IA5String */
+            return 0;
+    }
+
+    *name = ptls_iovec_init(NULL, 0);
+    return 0;
+}
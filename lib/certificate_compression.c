@@ -21,20 +21,122 @@
  */
 #include <assert.h>
 #include <stdlib.h>
+#if PICOTLS_USE_BROTLI
 #include "brotli/decode.h"
 #include "brotli/encode.h"
+#endif
+#if PICOTLS_USE_ZLIB
+#include <zlib.h>
+#endif
+#if PICOTLS_USE_ZSTD
+#include <zstd.h>
+#endif
 #include "picotls/certificate_compression.h"
 
-static inline int decompress_certificate(ptls_decompress_certificate_t *self, ptls_t *tls, uint16_t algorithm, ptls_iovec_t output,
-                                         ptls_iovec_t input)
+#if PICOTLS_USE_BROTLI
+static int brotli_decompress(ptls_iovec_t output, size_t *decoded_size, ptls_iovec_t input)
 {
-    if (algorithm != PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_BROTLI)
-        goto Fail;
+    BrotliDecoderState *state;
+    const uint8_t *next_in = input.base;
+    uint8_t *next_out = output.base;
+    size_t avail_in = input.len, avail_out = output.len;
+    BrotliDecoderResult result;
+
+    if ((state = BrotliDecoderCreateInstance(NULL, NULL, NULL)) == NULL)
+        return PTLS_ERROR_NO_MEMORY;
+    result = BrotliDecoderDecompressStream(state, &avail_in, &next_in, &avail_out, &next_out, NULL);
+    BrotliDecoderDestroyInstance(state);
+    *decoded_size = output.len - avail_out;
+
+    /* reject trailing garbage, which `BrotliDecoderDecompress` ignores */
+    return result == BROTLI_DECODER_RESULT_SUCCESS && avail_in == 0 ? 0 : PTLS_ALERT_BAD_CERTIFICATE;
+}
+#endif
+
+#if PICOTLS_USE_ZLIB
+/**
+ * decompresses a zlib stream; `dictionary` is used if the stream requires a preset dictionary
+ */
+static int zlib_decompress(ptls_iovec_t output, size_t *decoded_size, ptls_iovec_t input, ptls_iovec_t dictionary)
+{
+    z_stream zs = {NULL};
+    int zret;
+
+    if (inflateInit(&zs) != Z_OK)
+        return PTLS_ERROR_NO_MEMORY;
+    zs.next_in = input.base;
+    zs.avail_in = (uInt)input.len;
+    zs.next_out = output.base;
+    zs.avail_out = (uInt)output.len;
+    if ((zret = inflate(&zs, Z_FINISH)) == Z_NEED_DICT) {
+        if (dictionary.len == 0 || inflateSetDictionary(&zs, dictionary.base, (uInt)dictionary.len) != Z_OK)
+            goto Exit;
+        zret = inflate(&zs, Z_FINISH);
+    }
+    *decoded_size = zs.total_out;
+
+Exit:
+    inflateEnd(&zs);
+    return zret == Z_STREAM_END && zs.avail_in == 0 ? 0 : PTLS_ALERT_BAD_CERTIFICATE;
+}
+#endif
 
+static int do_decompress(uint16_t algorithm, const ptls_certificate_compression_dictionary_t *dictionary, ptls_iovec_t output,
+                         ptls_iovec_t input)
+{
     size_t decoded_size = output.len;
-    if (BrotliDecoderDecompress(input.len, input.base, &decoded_size, output.base) != BROTLI_DECODER_RESULT_SUCCESS)
+
+    if (dictionary != NULL && algorithm == dictionary->algo) {
+        switch (dictionary->base_algo) {
+#if PICOTLS_USE_ZLIB
+        case PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_ZLIB:
+            if (zlib_decompress(output, &decoded_size, input, dictionary->bytes) != 0)
+                goto Fail;
+            break;
+#endif
+#if PICOTLS_USE_ZSTD
+        case PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_ZSTD: {
+            ZSTD_DCtx *dctx;
+            if ((dctx = ZSTD_createDCtx()) == NULL)
+                goto Fail;
+            decoded_size = ZSTD_decompress_usingDict(dctx, output.base, output.len, input.base, input.len, dictionary->bytes.base,
+                                                     dictionary->bytes.len);
+            ZSTD_freeDCtx(dctx);
+            if (ZSTD_isError(decoded_size))
+                goto Fail;
+        } break;
+#endif
+        default:
+            goto Fail;
+        }
+        goto Decoded;
+    }
+
+    switch (algorithm) {
+#if PICOTLS_USE_BROTLI
+    case PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_BROTLI:
+        if (brotli_decompress(output, &decoded_size, input) != 0)
+            goto Fail;
+        break;
+#endif
+#if PICOTLS_USE_ZLIB
+    case PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_ZLIB:
+        if (zlib_decompress(output, &decoded_size, input, ptls_iovec_init(NULL, 0)) != 0)
+            goto Fail;
+        break;
+#endif
+#if PICOTLS_USE_ZSTD
+    case PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_ZSTD:
+        decoded_size = ZSTD_decompress(output.base, output.len, input.base, input.len);
+        if (ZSTD_isError(decoded_size))
+            goto Fail;
+        break;
+#endif
+    default:
         goto Fail;
+    }
 
+Decoded:
     if (decoded_size != output.len)
         goto Fail;
 
@@ -43,7 +145,30 @@ Fail:
     return PTLS_ALERT_BAD_CERTIFICATE;
 }
 
-static const uint16_t algorithms[] = {PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_BROTLI, UINT16_MAX};
+static int decompress_certificate(ptls_decompress_certificate_t *self, ptls_t *tls, uint16_t algorithm, ptls_iovec_t output,
+                                  ptls_iovec_t input)
+{
+    return do_decompress(algorithm, NULL, output, input);
+}
+
+static int decompress_certificate_with_dictionary(ptls_decompress_certificate_t *_self, ptls_t *tls, uint16_t algorithm,
+                                                  ptls_iovec_t output, ptls_iovec_t input)
+{
+    ptls_decompress_certificate_with_dictionary_t *self = (void *)_self;
+    return do_decompress(algorithm, self->dictionary, output, input);
+}
+
+static const uint16_t algorithms[] = {
+#if PICOTLS_USE_BROTLI
+    PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_BROTLI,
+#endif
+#if PICOTLS_USE_ZSTD
+    PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_ZSTD,
+#endif
+#if PICOTLS_USE_ZLIB
+    PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_ZLIB,
+#endif
+    UINT16_MAX};
 
 ptls_decompress_certificate_t ptls_decompress_certificate = {algorithms, decompress_certificate};
 
@@ -52,26 +177,35 @@ static int emit_compressed_certificate(ptls_emit_certificate_t *_self, ptls_t *t
                                        const uint16_t *compress_algos, size_t num_compress_algos)
 {
     ptls_emit_compressed_certificate_t *self = (void *)_self;
-    struct st_ptls_compressed_certificate_entry_t *entry;
+    struct st_ptls_compressed_certificate_t *compressed = NULL;
+    struct st_ptls_compressed_certificate_entry_t *entry = NULL;
     int ret;
 
     assert(context.len == 0 || !"precompressed mode can only be used for server certificates");
 
-    for (size_t i = 0; i != num_compress_algos; ++i) {
-        if (compress_algos[i] == PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_BROTLI)
-            goto FoundBrotli;
+    /* among the algorithms offered by the client, pick the one that yields the smallest message */
+    for (size_t i = 0; i != self->num_compressed; ++i) {
+        struct st_ptls_compressed_certificate_entry_t *candidate = &self->compressed[i].without_ocsp_status;
+        if (push_status_request && self->compressed[i].with_ocsp_status.uncompressed_length != 0)
+            candidate = &self->compressed[i].with_ocsp_status;
+        if (entry != NULL && entry->bytes.len <= candidate->bytes.len)
+            continue;
+        for (size_t j = 0; j != num_compress_algos; ++j) {
+            if (compress_algos[j] == self->compressed[i].algo) {
+                compressed = self->compressed + i;
+                entry = candidate;
+                break;
+            }
+        }
+    }
+    if (entry == NULL) {
+        /* no common algorithm, delegate to the core */
+        ret = PTLS_ERROR_DELEGATE;
+        goto Exit;
     }
-    /* brotli not found, delegate to the core */
-    ret = PTLS_ERROR_DELEGATE;
-    goto Exit;
-
-FoundBrotli:
-    entry = &self->without_ocsp_status;
-    if (push_status_request && self->with_ocsp_status.uncompressed_length != 0)
-        entry = &self->with_ocsp_status;
 
     ptls_push_message(emitter, key_sched, PTLS_HANDSHAKE_TYPE_COMPRESSED_CERTIFICATE, {
-        ptls_buffer_push16(emitter->buf, PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_BROTLI);
+        ptls_buffer_push16(emitter->buf, compressed->algo);
         ptls_buffer_push24(emitter->buf, entry->uncompressed_length);
         ptls_buffer_push_block(emitter->buf, 3, { ptls_buffer_pushv(emitter->buf, entry->bytes.base, entry->bytes.len); });
     });
@@ -82,7 +216,99 @@ Exit:
     return ret;
 }
 
-static int build_compressed(struct st_ptls_compressed_certificate_entry_t *entry, ptls_iovec_t *certificates,
+#if PICOTLS_USE_ZLIB
+static int zlib_compress_with_dictionary(ptls_iovec_t *output, ptls_iovec_t input, ptls_iovec_t dictionary)
+{
+    z_stream zs = {NULL};
+    int ret;
+
+    if (deflateInit(&zs, Z_BEST_COMPRESSION) != Z_OK)
+        return PTLS_ERROR_NO_MEMORY;
+    if (deflateSetDictionary(&zs, dictionary.base, (uInt)dictionary.len) != Z_OK) {
+        ret = PTLS_ERROR_COMPRESSION_FAILURE;
+        goto Exit;
+    }
+    zs.next_in = input.base;
+    zs.avail_in = (uInt)input.len;
+    zs.next_out = output->base;
+    zs.avail_out = (uInt)output->len;
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+        ret = PTLS_ERROR_COMPRESSION_FAILURE;
+        goto Exit;
+    }
+    output->len = zs.total_out;
+    ret = 0;
+
+Exit:
+    deflateEnd(&zs);
+    return ret;
+}
+#endif
+
+int ptls_compress_certificate_message(ptls_iovec_t *output, uint16_t algo,
+                                      const ptls_certificate_compression_dictionary_t *dictionary, ptls_iovec_t input)
+{
+    if (dictionary != NULL) {
+        if (algo != dictionary->algo)
+            return PTLS_ERROR_COMPRESSION_FAILURE;
+        switch (dictionary->base_algo) {
+#if PICOTLS_USE_ZLIB
+        case PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_ZLIB:
+            return zlib_compress_with_dictionary(output, input, dictionary->bytes);
+#endif
+#if PICOTLS_USE_ZSTD
+        case PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_ZSTD: {
+            ZSTD_CCtx *cctx;
+            size_t zstd_size;
+            if ((cctx = ZSTD_createCCtx()) == NULL)
+                return PTLS_ERROR_NO_MEMORY;
+            zstd_size = ZSTD_compress_usingDict(cctx, output->base, output->len, input.base, input.len, dictionary->bytes.base,
+                                                dictionary->bytes.len, ZSTD_maxCLevel());
+            ZSTD_freeCCtx(cctx);
+            if (ZSTD_isError(zstd_size))
+                return PTLS_ERROR_COMPRESSION_FAILURE;
+            output->len = zstd_size;
+            return 0;
+        }
+#endif
+        default:
+            return PTLS_ERROR_COMPRESSION_FAILURE;
+        }
+    }
+
+    switch (algo) {
+#if PICOTLS_USE_BROTLI
+    case PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_BROTLI:
+        if (BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC, input.len, input.base, &output->len,
+                                  output->base) != BROTLI_TRUE)
+            return PTLS_ERROR_COMPRESSION_FAILURE;
+        break;
+#endif
+#if PICOTLS_USE_ZLIB
+    case PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_ZLIB: {
+        uLongf zlib_size = (uLongf)output->len;
+        if (compress2(output->base, &zlib_size, input.base, (uLong)input.len, Z_BEST_COMPRESSION) != Z_OK)
+            return PTLS_ERROR_COMPRESSION_FAILURE;
+        output->len = zlib_size;
+    } break;
+#endif
+#if PICOTLS_USE_ZSTD
+    case PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_ZSTD: {
+        size_t zstd_size = ZSTD_compress(output->base, output->len, input.base, input.len, ZSTD_maxCLevel());
+        if (ZSTD_isError(zstd_size))
+            return PTLS_ERROR_COMPRESSION_FAILURE;
+        output->len = zstd_size;
+    } break;
+#endif
+    default:
+        return PTLS_ERROR_COMPRESSION_FAILURE;
+    }
+
+    return 0;
+}
+
+static int build_compressed(struct st_ptls_compressed_certificate_entry_t *entry, uint16_t algo,
+                            const ptls_certificate_compression_dictionary_t *dictionary, ptls_iovec_t *certificates,
                             size_t num_certificates, ptls_iovec_t ocsp_status)
 {
     ptls_buffer_t uncompressed;
@@ -102,11 +328,9 @@ static int build_compressed(struct st_ptls_compressed_certificate_entry_t *entry
         ret = PTLS_ERROR_NO_MEMORY;
         goto Exit;
     }
-    if (BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC, uncompressed.off, uncompressed.base,
-                              &entry->bytes.len, entry->bytes.base) != BROTLI_TRUE) {
-        ret = PTLS_ERROR_COMPRESSION_FAILURE;
+    if ((ret = ptls_compress_certificate_message(&entry->bytes, algo, dictionary,
+                                                 ptls_iovec_init(uncompressed.base, uncompressed.off))) != 0)
         goto Exit;
-    }
 
     ret = 0;
 
@@ -119,20 +343,58 @@ Exit:
     return ret;
 }
 
-int ptls_init_compressed_certificate(ptls_emit_compressed_certificate_t *self, ptls_iovec_t *certificates, size_t num_certificates,
-                                     ptls_iovec_t ocsp_status)
+static int add_compressed(ptls_emit_compressed_certificate_t *self, uint16_t algo,
+                          const ptls_certificate_compression_dictionary_t *dictionary, ptls_iovec_t *certificates,
+                          size_t num_certificates, ptls_iovec_t ocsp_status)
 {
+    struct st_ptls_compressed_certificate_t *compressed = self->compressed + self->num_compressed;
     int ret;
 
-    *self = (ptls_emit_compressed_certificate_t){{emit_compressed_certificate}, PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_BROTLI};
+    assert(self->num_compressed < PTLS_ELEMENTSOF(self->compressed));
 
-    /* build entries */
-    if ((ret = build_compressed(&self->without_ocsp_status, certificates, num_certificates, ptls_iovec_init(NULL, 0))) != 0)
+    compressed->algo = algo;
+    if ((ret = build_compressed(&compressed->without_ocsp_status, algo, dictionary, certificates, num_certificates,
+                                ptls_iovec_init(NULL, 0))) != 0)
         goto Exit;
     if (ocsp_status.len != 0) {
-        if ((ret = build_compressed(&self->with_ocsp_status, certificates, num_certificates, ocsp_status)) != 0)
+        if ((ret = build_compressed(&compressed->with_ocsp_status, algo, dictionary, certificates, num_certificates,
+                                    ocsp_status)) != 0)
             goto Exit;
     }
+    ++self->num_compressed;
+    ret = 0;
+
+Exit:
+    if (ret != 0) {
+        free(compressed->without_ocsp_status.bytes.base);
+        *compressed = (struct st_ptls_compressed_certificate_t){0};
+    }
+    return ret;
+}
+
+int ptls_init_compressed_certificate_with_dictionary(ptls_emit_compressed_certificate_t *self, ptls_iovec_t *certificates,
+                                                     size_t num_certificates, ptls_iovec_t ocsp_status,
+                                                     const ptls_certificate_compression_dictionary_t *dictionary)
+{
+    int ret;
+
+    *self = (ptls_emit_compressed_certificate_t){{emit_compressed_certificate}};
+
+    /* build entries for each algorithm; an algorithm is skipped if it fails to shrink the message */
+    if (dictionary != NULL) {
+        if ((ret = add_compressed(self, dictionary->algo, dictionary, certificates, num_certificates, ocsp_status)) != 0 &&
+            ret != PTLS_ERROR_COMPRESSION_FAILURE)
+            goto Exit;
+    }
+    for (const uint16_t *algo = algorithms; *algo != UINT16_MAX; ++algo) {
+        if ((ret = add_compressed(self, *algo, NULL, certificates, num_certificates, ocsp_status)) != 0 &&
+            ret != PTLS_ERROR_COMPRESSION_FAILURE)
+            goto Exit;
+    }
+    if (self->num_compressed == 0) {
+        ret = PTLS_ERROR_COMPRESSION_FAILURE;
+        goto Exit;
+    }
 
     ret = 0;
 
@@ -142,8 +404,44 @@ Exit:
     return ret;
 }
 
+int ptls_init_compressed_certificate(ptls_emit_compressed_certificate_t *self, ptls_iovec_t *certificates, size_t num_certificates,
+                                     ptls_iovec_t ocsp_status)
+{
+    return ptls_init_compressed_certificate_with_dictionary(self, certificates, num_certificates, ocsp_status, NULL);
+}
+
+int ptls_init_decompress_certificate_with_dictionary(ptls_decompress_certificate_with_dictionary_t *self,
+                                                     const ptls_certificate_compression_dictionary_t *dictionary)
+{
+    size_t i;
+
+    switch (dictionary->base_algo) {
+#if PICOTLS_USE_ZLIB
+    case PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_ZLIB:
+#endif
+#if PICOTLS_USE_ZSTD
+    case PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_ZSTD:
+#endif
+        break;
+    default:
+        return PTLS_ERROR_NOT_AVAILABLE;
+    }
+
+    *self = (ptls_decompress_certificate_with_dictionary_t){{self->algorithms, decompress_certificate_with_dictionary}};
+    self->dictionary = dictionary;
+    self->algorithms[0] = dictionary->algo;
+    for (i = 0; algorithms[i] != UINT16_MAX; ++i)
+        self->algorithms[i + 1] = algorithms[i];
+    self->algorithms[i + 1] = UINT16_MAX;
+
+    return 0;
+}
+
 void ptls_dispose_compressed_certificate(ptls_emit_compressed_certificate_t *self)
 {
-    free(self->with_ocsp_status.bytes.base);
-    free(self->without_ocsp_status.bytes.base);
+    for (size_t i = 0; i != self->num_compressed; ++i) {
+        free(self->compressed[i].with_ocsp_status.bytes.base);
+        free(self->compressed[i].without_ocsp_status.bytes.base);
+    }
+    self->num_compressed = 0;
 }
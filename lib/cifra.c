@@ -25,3 +25,55 @@
 
 ptls_cipher_suite_t *ptls_minicrypto_cipher_suites[] = {&ptls_minicrypto_aes256gcmsha384, &ptls_minicrypto_aes128gcmsha256,
                                                         &ptls_minicrypto_chacha20poly1305sha256, NULL};
+
+static int integrity_sha256_setup_crypto(ptls_aead_context_t *ctx, int is_enc, const void *key, const void *iv)
+{
+    return ptls_integrity_only_aead_setup_crypto(ctx, key, iv, &ptls_minicrypto_sha256);
+}
+
+static int integrity_sha384_setup_crypto(ptls_aead_context_t *ctx, int is_enc, const void *key, const void *iv)
+{
+    return ptls_integrity_only_aead_setup_crypto(ctx, key, iv, &ptls_minicrypto_sha384);
+}
+
+ptls_aead_algorithm_t ptls_minicrypto_integrity_sha256 = {"HMAC-SHA256",
+                                                          NULL,
+                                                          NULL,
+                                                          PTLS_SHA256_DIGEST_SIZE,
+                                                          PTLS_SHA256_DIGEST_SIZE,
+                                                          PTLS_SHA256_DIGEST_SIZE,
+                                                          sizeof(ptls_integrity_only_aead_context_t),
+                                                          integrity_sha256_setup_crypto};
+ptls_aead_algorithm_t ptls_minicrypto_integrity_sha384 = {"HMAC-SHA384",
+                                                          NULL,
+                                                          NULL,
+                                                          PTLS_SHA384_DIGEST_SIZE,
+                                                          PTLS_SHA384_DIGEST_SIZE,
+                                                          PTLS_SHA384_DIGEST_SIZE,
+                                                          sizeof(ptls_integrity_only_aead_context_t),
+                                                          integrity_sha384_setup_crypto};
+ptls_cipher_suite_t ptls_minicrypto_sha256sha256 = {PTLS_CIPHER_SUITE_SHA256_SHA256, &ptls_minicrypto_integrity_sha256,
+                                                    &ptls_minicrypto_sha256};
+ptls_cipher_suite_t ptls_minicrypto_sha384sha384 = {PTLS_CIPHER_SUITE_SHA384_SHA384, &ptls_minicrypto_integrity_sha384,
+                                                    &ptls_minicrypto_sha384};
+
+ptls_hpke_kem_t ptls_minicrypto_hpke_kem_p256sha256 = {PTLS_HPKE_KEM_P256_SHA256, &ptls_minicrypto_secp256r1,
+                                                       &ptls_minicrypto_sha256};
+ptls_hpke_kem_t ptls_minicrypto_hpke_kem_x25519sha256 = {PTLS_HPKE_KEM_X25519_SHA256, &ptls_minicrypto_x25519,
+                                                         &ptls_minicrypto_sha256};
+ptls_hpke_kem_t *ptls_minicrypto_hpke_kems[] = {&ptls_minicrypto_hpke_kem_x25519sha256, &ptls_minicrypto_hpke_kem_p256sha256, NULL};
+ptls_hpke_cipher_suite_t ptls_minicrypto_hpke_aes128gcmsha256 = {{PTLS_HPKE_HKDF_SHA256, PTLS_HPKE_AEAD_AES_128_GCM},
+                                                                 "HKDF-SHA256/AES-128-GCM",
+                                                                 &ptls_minicrypto_sha256,
+                                                                 &ptls_minicrypto_aes128gcm};
+ptls_hpke_cipher_suite_t ptls_minicrypto_hpke_aes256gcmsha384 = {{PTLS_HPKE_HKDF_SHA384, PTLS_HPKE_AEAD_AES_256_GCM},
+                                                                 "HKDF-SHA384/AES-256-GCM",
+                                                                 &ptls_minicrypto_sha384,
+                                                                 &ptls_minicrypto_aes256gcm};
+ptls_hpke_cipher_suite_t ptls_minicrypto_hpke_chacha20poly1305sha256 = {{PTLS_HPKE_HKDF_SHA256, PTLS_HPKE_AEAD_CHACHA20POLY1305},
+                                                                        "HKDF-SHA256/ChaCha20Poly1305",
+                                                                        &ptls_minicrypto_sha256,
+                                                                        &ptls_minicrypto_chacha20poly1305};
+ptls_hpke_cipher_suite_t *ptls_minicrypto_hpke_cipher_suites[] = {&ptls_minicrypto_hpke_aes128gcmsha256,
+                                                                   &ptls_minicrypto_hpke_aes256gcmsha384,
+                                                                   &ptls_minicrypto_hpke_chacha20poly1305sha256, NULL};
@@ -27,6 +27,14 @@
 #include "picotls.h"
 #include "picotls/minicrypto.h"
 
+/**
+ * SHA-256 and SHA-384 on top of the cifra contexts, accelerated when the CPU supports it (see sha2.c)
+ */
+void ptls_minicrypto__sha256_update(cf_sha256_context *ctx, const void *src, size_t len);
+void ptls_minicrypto__sha256_final(cf_sha256_context *ctx, uint8_t *md);
+void ptls_minicrypto__sha384_update(cf_sha512_context *ctx, const void *src, size_t len);
+void ptls_minicrypto__sha384_final(cf_sha512_context *ctx, uint8_t *md);
+
 struct aesecb_context_t {
     ptls_cipher_context_t super;
     cf_aes_context aes;
@@ -36,7 +36,7 @@ static int aead_aes128gcm_setup_crypto(ptls_aead_context_t *ctx, int is_enc, con
     return aead_aesgcm_setup_crypto(ctx, is_enc, key, iv);
 }
 
-ptls_define_hash(sha256, cf_sha256_context, cf_sha256_init, cf_sha256_update, cf_sha256_digest_final);
+ptls_define_hash(sha256, cf_sha256_context, cf_sha256_init, ptls_minicrypto__sha256_update, ptls_minicrypto__sha256_final);
 
 ptls_hash_algorithm_t ptls_minicrypto_sha256 = {PTLS_SHA256_BLOCK_SIZE, PTLS_SHA256_DIGEST_SIZE, sha256_create,
                                                 PTLS_ZERO_DIGEST_SHA256};
@@ -36,7 +36,7 @@ static int aead_aes256gcm_setup_crypto(ptls_aead_context_t *ctx, int is_enc, con
     return aead_aesgcm_setup_crypto(ctx, is_enc, key, iv);
 }
 
-ptls_define_hash(sha384, cf_sha512_context, cf_sha384_init, cf_sha384_update, cf_sha384_digest_final);
+ptls_define_hash(sha384, cf_sha512_context, cf_sha384_init, ptls_minicrypto__sha384_update, ptls_minicrypto__sha384_final);
 
 ptls_hash_algorithm_t ptls_minicrypto_sha384 = {PTLS_SHA384_BLOCK_SIZE, PTLS_SHA384_DIGEST_SIZE, sha384_create,
                                                 PTLS_ZERO_DIGEST_SHA384};
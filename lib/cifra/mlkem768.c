@@ -0,0 +1,1084 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+/*
+ * ML-KEM-768 (FIPS 203), and the X25519MLKEM768 hybrid key exchange (draft-kwiatkowski-tls-ecdhe-mlkem).
+ *
+ * The polynomial arithmetic follows the structure of the CRYSTALS-Kyber reference implementation (coefficients are int16_t,
+ * twiddle factors are kept in the Montgomery domain). On x86_64, NTT, inverse NTT and the multiplication in the NTT domain are
+ * dispatched at runtime to AVX2 kernels that produce bit-identical results.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define MLKEM_HAVE_AVX2 1
+#endif
+#include "curve25519.h"
+#include "picotls.h"
+#include "picotls/minicrypto.h"
+
+#define MLKEM_N 256
+#define MLKEM_Q 3329
+#define MLKEM_QINV -3327 /* q^-1 mod 2^16 */
+#define MLKEM_K 3
+#define MLKEM_SYMBYTES 32
+#define MLKEM_POLYBYTES 384
+#define MLKEM_POLYVECBYTES (MLKEM_K * MLKEM_POLYBYTES)
+#define MLKEM_POLYCOMPRESSEDBYTES 128                  /* d_v = 4 */
+#define MLKEM_POLYVECCOMPRESSEDBYTES (MLKEM_K * 320) /* d_u = 10 */
+#define MLKEM_INDCPA_SECRETKEYBYTES MLKEM_POLYVECBYTES
+#define MLKEM768_PUBLIC_KEY_SIZE (MLKEM_POLYVECBYTES + MLKEM_SYMBYTES)
+#define MLKEM768_SECRET_KEY_SIZE (MLKEM_INDCPA_SECRETKEYBYTES + MLKEM768_PUBLIC_KEY_SIZE + 2 * MLKEM_SYMBYTES)
+#define MLKEM768_CIPHERTEXT_SIZE (MLKEM_POLYVECCOMPRESSEDBYTES + MLKEM_POLYCOMPRESSEDBYTES)
+#define MLKEM768_SHARED_SECRET_SIZE 32
+
+#define X25519_KEY_SIZE 32
+
+typedef struct st_mlkem_poly_t {
+    int16_t coeffs[MLKEM_N];
+} mlkem_poly_t;
+
+typedef struct st_mlkem_polyvec_t {
+    mlkem_poly_t vec[MLKEM_K];
+} mlkem_polyvec_t;
+
+/**
+ * Keccak sponge, used for SHA3-256, SHA3-512, SHAKE128 and SHAKE256
+ */
+struct st_mlkem_keccak_t {
+    uint64_t s[25];
+    size_t rate;
+    size_t pos;
+};
+
+#define MLKEM_SHA3_256_RATE 136
+#define MLKEM_SHA3_512_RATE 72
+#define MLKEM_SHAKE128_RATE 168
+#define MLKEM_SHAKE256_RATE 136
+
+#define ROL64(x, n) (((x) << (n)) | ((x) >> (64 - (n))))
+
+static void mlkem_keccakf(uint64_t st[25])
+{
+    static const uint64_t rc[24] = {0x0000000000000001, 0x0000000000008082, 0x800000000000808a, 0x8000000080008000,
+                                    0x000000000000808b, 0x0000000080000001, 0x8000000080008081, 0x8000000000008009,
+                                    0x000000000000008a, 0x0000000000000088, 0x0000000080008009, 0x000000008000000a,
+                                    0x000000008000808b, 0x800000000000008b, 0x8000000000008089, 0x8000000000008003,
+                                    0x8000000000008002, 0x8000000000000080, 0x000000000000800a, 0x800000008000000a,
+                                    0x8000000080008081, 0x8000000000008080, 0x0000000080000001, 0x8000000080008008};
+    static const uint8_t rotc[24] = {1, 3, 6, 10, 15, 21, 28, 36, 45, 55, 2, 14, 27, 41, 56, 8, 25, 43, 62, 18, 39, 61, 20, 44};
+    static const uint8_t piln[24] = {10, 7, 11, 17, 18, 3, 5, 16, 8, 21, 24, 4, 15, 23, 19, 13, 12, 2, 20, 14, 22, 9, 6, 1};
+    uint64_t bc[5], t;
+    int round, i, j;
+
+    for (round = 0; round < 24; ++round) {
+        /* theta */
+        for (i = 0; i < 5; ++i)
+            bc[i] = st[i] ^ st[i + 5] ^ st[i + 10] ^ st[i + 15] ^ st[i + 20];
+        for (i = 0; i < 5; ++i) {
+            t = bc[(i + 4) % 5] ^ ROL64(bc[(i + 1) % 5], 1);
+            for (j = 0; j < 25; j += 5)
+                st[j + i] ^= t;
+        }
+        /* rho and pi */
+        t = st[1];
+        for (i = 0; i < 24; ++i) {
+            j = piln[i];
+            bc[0] = st[j];
+            st[j] = ROL64(t, rotc[i]);
+            t = bc[0];
+        }
+        /* chi */
+        for (j = 0; j < 25; j += 5) {
+            for (i = 0; i < 5; ++i)
+                bc[i] = st[j + i];
+            for (i = 0; i < 5; ++i)
+                st[j + i] ^= (~bc[(i + 1) % 5]) & bc[(i + 2) % 5];
+        }
+        /* iota */
+        st[0] ^= rc[round];
+    }
+}
+
+#undef ROL64
+
+static void mlkem_keccak_init(struct st_mlkem_keccak_t *ctx, size_t rate)
+{
+    memset(ctx->s, 0, sizeof(ctx->s));
+    ctx->rate = rate;
+    ctx->pos = 0;
+}
+
+static void mlkem_keccak_absorb(struct st_mlkem_keccak_t *ctx, const void *_input, size_t len)
+{
+    const uint8_t *input = _input;
+
+    for (; len != 0; --len) {
+        ctx->s[ctx->pos / 8] ^= (uint64_t)*input++ << (8 * (ctx->pos % 8));
+        if (++ctx->pos == ctx->rate) {
+            mlkem_keccakf(ctx->s);
+            ctx->pos = 0;
+        }
+    }
+}
+
+/**
+ * applies the padding; `ds` is the domain separation byte (0x06 for SHA3, 0x1f for SHAKE)
+ */
+static void mlkem_keccak_finalize(struct st_mlkem_keccak_t *ctx, uint8_t ds)
+{
+    ctx->s[ctx->pos / 8] ^= (uint64_t)ds << (8 * (ctx->pos % 8));
+    ctx->s[(ctx->rate - 1) / 8] ^= (uint64_t)0x80 << (8 * ((ctx->rate - 1) % 8));
+    mlkem_keccakf(ctx->s);
+    ctx->pos = 0;
+}
+
+static void mlkem_keccak_squeeze(struct st_mlkem_keccak_t *ctx, void *_output, size_t len)
+{
+    uint8_t *output = _output;
+
+    for (; len != 0; --len) {
+        if (ctx->pos == ctx->rate) {
+            mlkem_keccakf(ctx->s);
+            ctx->pos = 0;
+        }
+        *output++ = (uint8_t)(ctx->s[ctx->pos / 8] >> (8 * (ctx->pos % 8)));
+        ++ctx->pos;
+    }
+}
+
+static void mlkem_hash_h(uint8_t *output, const void *input, size_t len)
+{
+    struct st_mlkem_keccak_t ctx;
+
+    mlkem_keccak_init(&ctx, MLKEM_SHA3_256_RATE);
+    mlkem_keccak_absorb(&ctx, input, len);
+    mlkem_keccak_finalize(&ctx, 0x06);
+    mlkem_keccak_squeeze(&ctx, output, 32);
+}
+
+static void mlkem_hash_g(uint8_t *output, const void *input1, size_t len1, const void *input2, size_t len2)
+{
+    struct st_mlkem_keccak_t ctx;
+
+    mlkem_keccak_init(&ctx, MLKEM_SHA3_512_RATE);
+    mlkem_keccak_absorb(&ctx, input1, len1);
+    mlkem_keccak_absorb(&ctx, input2, len2);
+    mlkem_keccak_finalize(&ctx, 0x06);
+    mlkem_keccak_squeeze(&ctx, output, 64);
+}
+
+static void mlkem_shake256(uint8_t *output, size_t outlen, const void *input1, size_t len1, const void *input2, size_t len2)
+{
+    struct st_mlkem_keccak_t ctx;
+
+    mlkem_keccak_init(&ctx, MLKEM_SHAKE256_RATE);
+    mlkem_keccak_absorb(&ctx, input1, len1);
+    mlkem_keccak_absorb(&ctx, input2, len2);
+    mlkem_keccak_finalize(&ctx, 0x1f);
+    mlkem_keccak_squeeze(&ctx, output, outlen);
+}
+
+
+static const int16_t mlkem_zetas[128] = {
+    -1044, -758, -359, -1517, 1493, 1422, 287, 202, -171, 622, 1577, 182, 962, -1202, -1474, 1468,
+    573, -1325, 264, 383, -829, 1458, -1602, -130, -681, 1017, 732, 608, -1542, 411, -205, -1571,
+    1223, 652, -552, 1015, -1293, 1491, -282, -1544, 516, -8, -320, -666, -1618, -1162, 126, 1469,
+    -853, -90, -271, 830, 107, -1421, -247, -951, -398, 961, -1508, -725, 448, -1065, 677, -1275,
+    -1103, 430, 555, 843, -1251, 871, 1550, 105, 422, 587, 177, -235, -291, -460, 1574, 1653,
+    -246, 778, 1159, -147, -777, 1483, -602, 1119, -1590, 644, -872, 349, 418, 329, -156, -75,
+    817, 1097, 603, 610, 1322, -1285, -1465, 384, -1215, -136, 1218, -1335, -874, 220, -1187, -1659,
+    -1185, -1530, -1278, 794, -1510, -854, -870, 478, -108, -308, 996, 991, 958, -1460, 1522, 1628};
+
+static inline int16_t mlkem_montgomery_reduce(int32_t a)
+{
+    int16_t t = (int16_t)((int16_t)a * MLKEM_QINV);
+    return (int16_t)((a - (int32_t)t * MLKEM_Q) >> 16);
+}
+
+static inline int16_t mlkem_fqmul(int16_t a, int16_t b)
+{
+    return mlkem_montgomery_reduce((int32_t)a * b);
+}
+
+/**
+ * returns a value congruent to `a` in the range of [-(q-1)/2, (q-1)/2]; rounds in the same way as the AVX2 kernel
+ */
+static inline int16_t mlkem_barrett_reduce(int16_t a)
+{
+    int16_t t = (int16_t)(((((int32_t)a * 20159) >> 16) + 512) >> 10);
+    return a - t * MLKEM_Q;
+}
+
+static void mlkem_ntt_portable(int16_t r[MLKEM_N])
+{
+    size_t len, start, j, k = 1;
+
+    for (len = 128; len >= 2; len >>= 1) {
+        for (start = 0; start < MLKEM_N; start = j + len) {
+            int16_t zeta = mlkem_zetas[k++];
+            for (j = start; j < start + len; ++j) {
+                int16_t t = mlkem_fqmul(zeta, r[j + len]);
+                r[j + len] = r[j] - t;
+                r[j] = r[j] + t;
+            }
+        }
+    }
+}
+
+static void mlkem_invntt_portable(int16_t r[MLKEM_N])
+{
+    const int16_t f = 1441; /* mont^2 / 128 */
+    size_t len, start, j, k = 127;
+
+    for (len = 2; len <= 128; len <<= 1) {
+        for (start = 0; start < MLKEM_N; start = j + len) {
+            int16_t zeta = mlkem_zetas[k--];
+            for (j = start; j < start + len; ++j) {
+                int16_t t = r[j];
+                r[j] = mlkem_barrett_reduce(t + r[j + len]);
+                r[j + len] = mlkem_fqmul(zeta, r[j + len] - t);
+            }
+        }
+    }
+    for (j = 0; j < MLKEM_N; ++j)
+        r[j] = mlkem_fqmul(r[j], f);
+}
+
+static void mlkem_basemul_portable(int16_t r[MLKEM_N], const int16_t a[MLKEM_N], const int16_t b[MLKEM_N])
+{
+    size_t i;
+
+    for (i = 0; i < MLKEM_N / 2; ++i) {
+        int16_t zeta = (i % 2) == 0 ? mlkem_zetas[64 + i / 2] : -mlkem_zetas[64 + i / 2];
+        int16_t a0 = a[2 * i], a1 = a[2 * i + 1], b0 = b[2 * i], b1 = b[2 * i + 1];
+        r[2 * i] = mlkem_fqmul(mlkem_fqmul(a1, b1), zeta) + mlkem_fqmul(a0, b0);
+        r[2 * i + 1] = mlkem_fqmul(a0, b1) + mlkem_fqmul(a1, b0);
+    }
+}
+
+
+#if MLKEM_HAVE_AVX2
+
+static const int16_t mlkem_avx2_zetas_fwd[384] = {
+    573, 573, 573, 573, 573, 573, 573, 573, -1325, -1325, -1325, -1325, -1325, -1325, -1325, -1325,
+    264, 264, 264, 264, 264, 264, 264, 264, 383, 383, 383, 383, 383, 383, 383, 383,
+    -829, -829, -829, -829, -829, -829, -829, -829, 1458, 1458, 1458, 1458, 1458, 1458, 1458, 1458,
+    -1602, -1602, -1602, -1602, -1602, -1602, -1602, -1602, -130, -130, -130, -130, -130, -130, -130, -130,
+    -681, -681, -681, -681, -681, -681, -681, -681, 1017, 1017, 1017, 1017, 1017, 1017, 1017, 1017,
+    732, 732, 732, 732, 732, 732, 732, 732, 608, 608, 608, 608, 608, 608, 608, 608,
+    -1542, -1542, -1542, -1542, -1542, -1542, -1542, -1542, 411, 411, 411, 411, 411, 411, 411, 411,
+    -205, -205, -205, -205, -205, -205, -205, -205, -1571, -1571, -1571, -1571, -1571, -1571, -1571, -1571,
+    1223, 1223, 1223, 1223, -552, -552, -552, -552, 652, 652, 652, 652, 1015, 1015, 1015, 1015,
+    -1293, -1293, -1293, -1293, -282, -282, -282, -282, 1491, 1491, 1491, 1491, -1544, -1544, -1544, -1544,
+    516, 516, 516, 516, -320, -320, -320, -320, -8, -8, -8, -8, -666, -666, -666, -666,
+    -1618, -1618, -1618, -1618, 126, 126, 126, 126, -1162, -1162, -1162, -1162, 1469, 1469, 1469, 1469,
+    -853, -853, -853, -853, -271, -271, -271, -271, -90, -90, -90, -90, 830, 830, 830, 830,
+    107, 107, 107, 107, -247, -247, -247, -247, -1421, -1421, -1421, -1421, -951, -951, -951, -951,
+    -398, -398, -398, -398, -1508, -1508, -1508, -1508, 961, 961, 961, 961, -725, -725, -725, -725,
+    448, 448, 448, 448, 677, 677, 677, 677, -1065, -1065, -1065, -1065, -1275, -1275, -1275, -1275,
+    -1103, -1103, 430, 430, -1251, -1251, 871, 871, 555, 555, 843, 843, 1550, 1550, 105, 105,
+    422, 422, 587, 587, -291, -291, -460, -460, 177, 177, -235, -235, 1574, 1574, 1653, 1653,
+    -246, -246, 778, 778, -777, -777, 1483, 1483, 1159, 1159, -147, -147, -602, -602, 1119, 1119,
+    -1590, -1590, 644, 644, 418, 418, 329, 329, -872, -872, 349, 349, -156, -156, -75, -75,
+    817, 817, 1097, 1097, 1322, 1322, -1285, -1285, 603, 603, 610, 610, -1465, -1465, 384, 384,
+    -1215, -1215, -136, -136, -874, -874, 220, 220, 1218, 1218, -1335, -1335, -1187, -1187, -1659, -1659,
+    -1185, -1185, -1530, -1530, -1510, -1510, -854, -854, -1278, -1278, 794, 794, -870, -870, 478, 478,
+    -108, -108, -308, -308, 958, 958, -1460, -1460, 996, 996, 991, 991, 1522, 1522, 1628, 1628};
+static const int16_t mlkem_avx2_zetas_inv[384] = {
+    1628, 1628, 1522, 1522, 991, 991, 996, 996, -1460, -1460, 958, 958, -308, -308, -108, -108,
+    478, 478, -870, -870, 794, 794, -1278, -1278, -854, -854, -1510, -1510, -1530, -1530, -1185, -1185,
+    -1659, -1659, -1187, -1187, -1335, -1335, 1218, 1218, 220, 220, -874, -874, -136, -136, -1215, -1215,
+    384, 384, -1465, -1465, 610, 610, 603, 603, -1285, -1285, 1322, 1322, 1097, 1097, 817, 817,
+    -75, -75, -156, -156, 349, 349, -872, -872, 329, 329, 418, 418, 644, 644, -1590, -1590,
+    1119, 1119, -602, -602, -147, -147, 1159, 1159, 1483, 1483, -777, -777, 778, 778, -246, -246,
+    1653, 1653, 1574, 1574, -235, -235, 177, 177, -460, -460, -291, -291, 587, 587, 422, 422,
+    105, 105, 1550, 1550, 843, 843, 555, 555, 871, 871, -1251, -1251, 430, 430, -1103, -1103,
+    -1275, -1275, -1275, -1275, -1065, -1065, -1065, -1065, 677, 677, 677, 677, 448, 448, 448, 448,
+    -725, -725, -725, -725, 961, 961, 961, 961, -1508, -1508, -1508, -1508, -398, -398, -398, -398,
+    -951, -951, -951, -951, -1421, -1421, -1421, -1421, -247, -247, -247, -247, 107, 107, 107, 107,
+    830, 830, 830, 830, -90, -90, -90, -90, -271, -271, -271, -271, -853, -853, -853, -853,
+    1469, 1469, 1469, 1469, -1162, -1162, -1162, -1162, 126, 126, 126, 126, -1618, -1618, -1618, -1618,
+    -666, -666, -666, -666, -8, -8, -8, -8, -320, -320, -320, -320, 516, 516, 516, 516,
+    -1544, -1544, -1544, -1544, 1491, 1491, 1491, 1491, -282, -282, -282, -282, -1293, -1293, -1293, -1293,
+    1015, 1015, 1015, 1015, 652, 652, 652, 652, -552, -552, -552, -552, 1223, 1223, 1223, 1223,
+    -1571, -1571, -1571, -1571, -1571, -1571, -1571, -1571, -205, -205, -205, -205, -205, -205, -205, -205,
+    411, 411, 411, 411, 411, 411, 411, 411, -1542, -1542, -1542, -1542, -1542, -1542, -1542, -1542,
+    608, 608, 608, 608, 608, 608, 608, 608, 732, 732, 732, 732, 732, 732, 732, 732,
+    1017, 1017, 1017, 1017, 1017, 1017, 1017, 1017, -681, -681, -681, -681, -681, -681, -681, -681,
+    -130, -130, -130, -130, -130, -130, -130, -130, -1602, -1602, -1602, -1602, -1602, -1602, -1602, -1602,
+    1458, 1458, 1458, 1458, 1458, 1458, 1458, 1458, -829, -829, -829, -829, -829, -829, -829, -829,
+    383, 383, 383, 383, 383, 383, 383, 383, 264, 264, 264, 264, 264, 264, 264, 264,
+    -1325, -1325, -1325, -1325, -1325, -1325, -1325, -1325, 573, 573, 573, 573, 573, 573, 573, 573};
+static const int16_t mlkem_avx2_zetas_basemul[256] = {
+    -1103, -1103, 1103, 1103, 430, 430, -430, -430, 555, 555, -555, -555, 843, 843, -843, -843,
+    -1251, -1251, 1251, 1251, 871, 871, -871, -871, 1550, 1550, -1550, -1550, 105, 105, -105, -105,
+    422, 422, -422, -422, 587, 587, -587, -587, 177, 177, -177, -177, -235, -235, 235, 235,
+    -291, -291, 291, 291, -460, -460, 460, 460, 1574, 1574, -1574, -1574, 1653, 1653, -1653, -1653,
+    -246, -246, 246, 246, 778, 778, -778, -778, 1159, 1159, -1159, -1159, -147, -147, 147, 147,
+    -777, -777, 777, 777, 1483, 1483, -1483, -1483, -602, -602, 602, 602, 1119, 1119, -1119, -1119,
+    -1590, -1590, 1590, 1590, 644, 644, -644, -644, -872, -872, 872, 872, 349, 349, -349, -349,
+    418, 418, -418, -418, 329, 329, -329, -329, -156, -156, 156, 156, -75, -75, 75, 75,
+    817, 817, -817, -817, 1097, 1097, -1097, -1097, 603, 603, -603, -603, 610, 610, -610, -610,
+    1322, 1322, -1322, -1322, -1285, -1285, 1285, 1285, -1465, -1465, 1465, 1465, 384, 384, -384, -384,
+    -1215, -1215, 1215, 1215, -136, -136, 136, 136, 1218, 1218, -1218, -1218, -1335, -1335, 1335, 1335,
+    -874, -874, 874, 874, 220, 220, -220, -220, -1187, -1187, 1187, 1187, -1659, -1659, 1659, 1659,
+    -1185, -1185, 1185, 1185, -1530, -1530, 1530, 1530, -1278, -1278, 1278, 1278, 794, 794, -794, -794,
+    -1510, -1510, 1510, 1510, -854, -854, 854, 854, -870, -870, 870, 870, 478, 478, -478, -478,
+    -108, -108, 108, 108, -308, -308, 308, 308, 996, 996, -996, -996, 991, 991, -991, -991,
+    958, 958, -958, -958, -1460, -1460, 1460, 1460, 1522, 1522, -1522, -1522, 1628, 1628, -1628, -1628};
+
+#define MLKEM_AVX2 __attribute__((target("avx2")))
+
+/**
+ * set to non-zero to use the portable code regardless of what the CPU supports (used by the tests)
+ */
+static int mlkem_avx2_disabled;
+
+static int mlkem_use_avx2(void)
+{
+    return !mlkem_avx2_disabled && __builtin_cpu_supports("avx2");
+}
+
+MLKEM_AVX2 static inline __m256i mlkem_avx2_fqmul(__m256i a, __m256i b)
+{
+    __m256i lo = _mm256_mullo_epi16(_mm256_mullo_epi16(a, b), _mm256_set1_epi16(MLKEM_QINV)), hi = _mm256_mulhi_epi16(a, b);
+    return _mm256_sub_epi16(hi, _mm256_mulhi_epi16(lo, _mm256_set1_epi16(MLKEM_Q)));
+}
+
+MLKEM_AVX2 static inline __m256i mlkem_avx2_barrett_reduce(__m256i a)
+{
+    __m256i t = _mm256_mulhi_epi16(a, _mm256_set1_epi16(20159));
+    t = _mm256_mulhrs_epi16(t, _mm256_set1_epi16(1 << 5));
+    return _mm256_sub_epi16(a, _mm256_mullo_epi16(t, _mm256_set1_epi16(MLKEM_Q)));
+}
+
+/**
+ * swaps adjacent coefficients
+ */
+MLKEM_AVX2 static inline __m256i mlkem_avx2_swap_pairs(__m256i a)
+{
+    return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(a, 0xb1), 0xb1);
+}
+
+/* The last three layers of the (inverse) NTT operate on butterflies whose both ends reside in the same 256-bit register. A pair of
+ * registers (x, y) is rearranged so that `a` contains the first elements of the butterflies and `b` the second; the twiddle
+ * factors in mlkem_avx2_zetas_fwd / mlkem_avx2_zetas_inv are laid out accordingly. SPLIT8 and SPLIT4 are their own inverses, while
+ * SPLIT2 is reverted by MERGE2. */
+#define MLKEM_AVX2_SPLIT8(a, b, x, y)                                                                                              \
+    do {                                                                                                                           \
+        a = _mm256_permute2x128_si256(x, y, 0x20);                                                                                 \
+        b = _mm256_permute2x128_si256(x, y, 0x31);                                                                                 \
+    } while (0)
+#define MLKEM_AVX2_SPLIT4(a, b, x, y)                                                                                              \
+    do {                                                                                                                           \
+        a = _mm256_unpacklo_epi64(x, y);                                                                                           \
+        b = _mm256_unpackhi_epi64(x, y);                                                                                           \
+    } while (0)
+#define MLKEM_AVX2_SPLIT2(a, b, x, y)                                                                                              \
+    do {                                                                                                                           \
+        __m256i x_ = _mm256_shuffle_epi32(x, 0xd8), y_ = _mm256_shuffle_epi32(y, 0xd8);                                           \
+        a = _mm256_unpacklo_epi64(x_, y_);                                                                                         \
+        b = _mm256_unpackhi_epi64(x_, y_);                                                                                         \
+    } while (0)
+#define MLKEM_AVX2_MERGE2(x, y, a, b)                                                                                              \
+    do {                                                                                                                           \
+        x = _mm256_shuffle_epi32(_mm256_unpacklo_epi64(a, b), 0xd8);                                                              \
+        y = _mm256_shuffle_epi32(_mm256_unpackhi_epi64(a, b), 0xd8);                                                              \
+    } while (0)
+
+MLKEM_AVX2 static inline void mlkem_avx2_ct_butterfly(__m256i *a, __m256i *b, __m256i zeta)
+{
+    __m256i t = mlkem_avx2_fqmul(zeta, *b);
+    *b = _mm256_sub_epi16(*a, t);
+    *a = _mm256_add_epi16(*a, t);
+}
+
+MLKEM_AVX2 static inline void mlkem_avx2_gs_butterfly(__m256i *a, __m256i *b, __m256i zeta)
+{
+    __m256i t = *a;
+    *a = mlkem_avx2_barrett_reduce(_mm256_add_epi16(t, *b));
+    *b = mlkem_avx2_fqmul(zeta, _mm256_sub_epi16(*b, t));
+}
+
+MLKEM_AVX2 static void mlkem_ntt_avx2(int16_t r[MLKEM_N])
+{
+    size_t len, start, j, k = 1;
+
+    for (len = 128; len >= 16; len >>= 1) {
+        for (start = 0; start < MLKEM_N; start += 2 * len) {
+            __m256i zeta = _mm256_set1_epi16(mlkem_zetas[k++]);
+            for (j = start; j < start + len; j += 16) {
+                __m256i a = _mm256_loadu_si256((void *)(r + j)), b = _mm256_loadu_si256((void *)(r + j + len));
+                mlkem_avx2_ct_butterfly(&a, &b, zeta);
+                _mm256_storeu_si256((void *)(r + j), a);
+                _mm256_storeu_si256((void *)(r + j + len), b);
+            }
+        }
+    }
+
+    for (j = 0; j < MLKEM_N; j += 32) {
+        const int16_t *zetas = mlkem_avx2_zetas_fwd + j / 2;
+        __m256i x = _mm256_loadu_si256((void *)(r + j)), y = _mm256_loadu_si256((void *)(r + j + 16)), a, b;
+        MLKEM_AVX2_SPLIT8(a, b, x, y);
+        mlkem_avx2_ct_butterfly(&a, &b, _mm256_loadu_si256((void *)zetas));
+        MLKEM_AVX2_SPLIT8(x, y, a, b);
+        MLKEM_AVX2_SPLIT4(a, b, x, y);
+        mlkem_avx2_ct_butterfly(&a, &b, _mm256_loadu_si256((void *)(zetas + 128)));
+        MLKEM_AVX2_SPLIT4(x, y, a, b);
+        MLKEM_AVX2_SPLIT2(a, b, x, y);
+        mlkem_avx2_ct_butterfly(&a, &b, _mm256_loadu_si256((void *)(zetas + 256)));
+        MLKEM_AVX2_MERGE2(x, y, a, b);
+        _mm256_storeu_si256((void *)(r + j), x);
+        _mm256_storeu_si256((void *)(r + j + 16), y);
+    }
+}
+
+MLKEM_AVX2 static void mlkem_invntt_avx2(int16_t r[MLKEM_N])
+{
+    size_t len, start, j, k = 15;
+
+    for (j = 0; j < MLKEM_N; j += 32) {
+        const int16_t *zetas = mlkem_avx2_zetas_inv + j / 2;
+        __m256i x = _mm256_loadu_si256((void *)(r + j)), y = _mm256_loadu_si256((void *)(r + j + 16)), a, b;
+        MLKEM_AVX2_SPLIT2(a, b, x, y);
+        mlkem_avx2_gs_butterfly(&a, &b, _mm256_loadu_si256((void *)zetas));
+        MLKEM_AVX2_MERGE2(x, y, a, b);
+        MLKEM_AVX2_SPLIT4(a, b, x, y);
+        mlkem_avx2_gs_butterfly(&a, &b, _mm256_loadu_si256((void *)(zetas + 128)));
+        MLKEM_AVX2_SPLIT4(x, y, a, b);
+        MLKEM_AVX2_SPLIT8(a, b, x, y);
+        mlkem_avx2_gs_butterfly(&a, &b, _mm256_loadu_si256((void *)(zetas + 256)));
+        MLKEM_AVX2_SPLIT8(x, y, a, b);
+        _mm256_storeu_si256((void *)(r + j), x);
+        _mm256_storeu_si256((void *)(r + j + 16), y);
+    }
+
+    for (len = 16; len <= 128; len <<= 1) {
+        for (start = 0; start < MLKEM_N; start += 2 * len) {
+            __m256i zeta = _mm256_set1_epi16(mlkem_zetas[k--]);
+            for (j = start; j < start + len; j += 16) {
+                __m256i a = _mm256_loadu_si256((void *)(r + j)), b = _mm256_loadu_si256((void *)(r + j + len));
+                mlkem_avx2_gs_butterfly(&a, &b, zeta);
+                _mm256_storeu_si256((void *)(r + j), a);
+                _mm256_storeu_si256((void *)(r + j + len), b);
+            }
+        }
+    }
+
+    for (j = 0; j < MLKEM_N; j += 16) {
+        __m256i a = _mm256_loadu_si256((void *)(r + j));
+        _mm256_storeu_si256((void *)(r + j), mlkem_avx2_fqmul(a, _mm256_set1_epi16(1441)));
+    }
+}
+
+MLKEM_AVX2 static void mlkem_basemul_avx2(int16_t r[MLKEM_N], const int16_t a[MLKEM_N], const int16_t b[MLKEM_N])
+{
+    size_t i;
+
+    for (i = 0; i < MLKEM_N; i += 16) {
+        __m256i va = _mm256_loadu_si256((void *)(a + i)), vb = _mm256_loadu_si256((void *)(b + i)),
+                zeta = _mm256_loadu_si256((void *)(mlkem_avx2_zetas_basemul + i));
+        /* p = (a0b0, a1b1), c = (a0b1, a1b0) */
+        __m256i p = mlkem_avx2_fqmul(va, vb), c = mlkem_avx2_fqmul(va, mlkem_avx2_swap_pairs(vb));
+        __m256i r0 = _mm256_add_epi16(mlkem_avx2_fqmul(mlkem_avx2_swap_pairs(p), zeta), p),
+                r1 = _mm256_add_epi16(c, mlkem_avx2_swap_pairs(c));
+        _mm256_storeu_si256((void *)(r + i), _mm256_blend_epi16(r0, r1, 0xaa));
+    }
+}
+
+#undef MLKEM_AVX2_SPLIT8
+#undef MLKEM_AVX2_SPLIT4
+#undef MLKEM_AVX2_SPLIT2
+#undef MLKEM_AVX2_MERGE2
+
+#endif
+
+static void mlkem_poly_ntt(mlkem_poly_t *r);
+static void mlkem_poly_invntt_tomont(mlkem_poly_t *r);
+static void mlkem_poly_basemul_montgomery(mlkem_poly_t *r, const mlkem_poly_t *a, const mlkem_poly_t *b);
+
+static void mlkem_poly_reduce(mlkem_poly_t *r)
+{
+    size_t i;
+
+    for (i = 0; i < MLKEM_N; ++i)
+        r->coeffs[i] = mlkem_barrett_reduce(r->coeffs[i]);
+}
+
+static void mlkem_poly_ntt(mlkem_poly_t *r)
+{
+#if MLKEM_HAVE_AVX2
+    if (mlkem_use_avx2()) {
+        mlkem_ntt_avx2(r->coeffs);
+    } else
+#endif
+    {
+        mlkem_ntt_portable(r->coeffs);
+    }
+    mlkem_poly_reduce(r);
+}
+
+static void mlkem_poly_invntt_tomont(mlkem_poly_t *r)
+{
+#if MLKEM_HAVE_AVX2
+    if (mlkem_use_avx2()) {
+        mlkem_invntt_avx2(r->coeffs);
+        return;
+    }
+#endif
+    mlkem_invntt_portable(r->coeffs);
+}
+
+static void mlkem_poly_basemul_montgomery(mlkem_poly_t *r, const mlkem_poly_t *a, const mlkem_poly_t *b)
+{
+#if MLKEM_HAVE_AVX2
+    if (mlkem_use_avx2()) {
+        mlkem_basemul_avx2(r->coeffs, a->coeffs, b->coeffs);
+        return;
+    }
+#endif
+    mlkem_basemul_portable(r->coeffs, a->coeffs, b->coeffs);
+}
+
+static void mlkem_poly_tomont(mlkem_poly_t *r)
+{
+    const int16_t f = 1353; /* mont^2 mod q */
+    size_t i;
+
+    for (i = 0; i < MLKEM_N; ++i)
+        r->coeffs[i] = mlkem_montgomery_reduce((int32_t)r->coeffs[i] * f);
+}
+
+static void mlkem_poly_add(mlkem_poly_t *r, const mlkem_poly_t *a, const mlkem_poly_t *b)
+{
+    size_t i;
+
+    for (i = 0; i < MLKEM_N; ++i)
+        r->coeffs[i] = a->coeffs[i] + b->coeffs[i];
+}
+
+static void mlkem_poly_sub(mlkem_poly_t *r, const mlkem_poly_t *a, const mlkem_poly_t *b)
+{
+    size_t i;
+
+    for (i = 0; i < MLKEM_N; ++i)
+        r->coeffs[i] = a->coeffs[i] - b->coeffs[i];
+}
+
+/**
+ * r = sum(a[i] * b[i]), in the NTT domain
+ */
+static void mlkem_polyvec_basemul_acc_montgomery(mlkem_poly_t *r, const mlkem_polyvec_t *a, const mlkem_polyvec_t *b)
+{
+    mlkem_poly_t t;
+    size_t i;
+
+    mlkem_poly_basemul_montgomery(r, &a->vec[0], &b->vec[0]);
+    for (i = 1; i < MLKEM_K; ++i) {
+        mlkem_poly_basemul_montgomery(&t, &a->vec[i], &b->vec[i]);
+        mlkem_poly_add(r, r, &t);
+    }
+    mlkem_poly_reduce(r);
+}
+
+static void mlkem_poly_tobytes(uint8_t r[MLKEM_POLYBYTES], const mlkem_poly_t *a)
+{
+    size_t i;
+
+    for (i = 0; i < MLKEM_N / 2; ++i) {
+        /* map to [0, q) */
+        uint16_t t0 = a->coeffs[2 * i], t1 = a->coeffs[2 * i + 1];
+        t0 += ((int16_t)t0 >> 15) & MLKEM_Q;
+        t1 += ((int16_t)t1 >> 15) & MLKEM_Q;
+        r[3 * i] = (uint8_t)t0;
+        r[3 * i + 1] = (uint8_t)((t0 >> 8) | (t1 << 4));
+        r[3 * i + 2] = (uint8_t)(t1 >> 4);
+    }
+}
+
+/**
+ * decodes 12-bit coefficients; returns if all the coefficients are smaller than q (i.e. the modulus check of FIPS 203)
+ */
+static int mlkem_poly_frombytes(mlkem_poly_t *r, const uint8_t a[MLKEM_POLYBYTES])
+{
+    uint16_t ok = 0xffff;
+    size_t i;
+
+    for (i = 0; i < MLKEM_N / 2; ++i) {
+        r->coeffs[2 * i] = ((a[3 * i] >> 0) | ((uint16_t)a[3 * i + 1] << 8)) & 0xfff;
+        r->coeffs[2 * i + 1] = ((a[3 * i + 1] >> 4) | ((uint16_t)a[3 * i + 2] << 4)) & 0xfff;
+        ok &= (uint16_t)((r->coeffs[2 * i] - MLKEM_Q) & (r->coeffs[2 * i + 1] - MLKEM_Q)) >> 15;
+    }
+    return ok & 1;
+}
+
+static void mlkem_poly_compress(uint8_t r[MLKEM_POLYCOMPRESSEDBYTES], const mlkem_poly_t *a)
+{
+    uint8_t t[8];
+    size_t i, j;
+
+    for (i = 0; i < MLKEM_N / 8; ++i) {
+        for (j = 0; j < 8; ++j) {
+            int16_t u = a->coeffs[8 * i + j];
+            uint32_t d;
+            u += (u >> 15) & MLKEM_Q;
+            /* round(u * 16 / q) without a division */
+            d = ((((uint32_t)u << 4) + 1665) * 80635) >> 28;
+            t[j] = d & 0xf;
+        }
+        r[4 * i] = t[0] | (t[1] << 4);
+        r[4 * i + 1] = t[2] | (t[3] << 4);
+        r[4 * i + 2] = t[4] | (t[5] << 4);
+        r[4 * i + 3] = t[6] | (t[7] << 4);
+    }
+}
+
+static void mlkem_poly_decompress(mlkem_poly_t *r, const uint8_t a[MLKEM_POLYCOMPRESSEDBYTES])
+{
+    size_t i;
+
+    for (i = 0; i < MLKEM_N / 2; ++i) {
+        r->coeffs[2 * i] = (((uint16_t)(a[i] & 15) * MLKEM_Q) + 8) >> 4;
+        r->coeffs[2 * i + 1] = (((uint16_t)(a[i] >> 4) * MLKEM_Q) + 8) >> 4;
+    }
+}
+
+static void mlkem_polyvec_compress(uint8_t r[MLKEM_POLYVECCOMPRESSEDBYTES], const mlkem_polyvec_t *a)
+{
+    uint16_t t[4];
+    size_t i, j, k;
+
+    for (i = 0; i < MLKEM_K; ++i) {
+        for (j = 0; j < MLKEM_N / 4; ++j) {
+            for (k = 0; k < 4; ++k) {
+                int16_t u = a->vec[i].coeffs[4 * j + k];
+                uint64_t d;
+                u += (u >> 15) & MLKEM_Q;
+                /* round(u * 1024 / q) without a division */
+                d = ((((uint64_t)u << 10) + 1665) * 1290167) >> 32;
+                t[k] = d & 0x3ff;
+            }
+            r[0] = (uint8_t)t[0];
+            r[1] = (uint8_t)((t[0] >> 8) | (t[1] << 2));
+            r[2] = (uint8_t)((t[1] >> 6) | (t[2] << 4));
+            r[3] = (uint8_t)((t[2] >> 4) | (t[3] << 6));
+            r[4] = (uint8_t)(t[3] >> 2);
+            r += 5;
+        }
+    }
+}
+
+static void mlkem_polyvec_decompress(mlkem_polyvec_t *r, const uint8_t a[MLKEM_POLYVECCOMPRESSEDBYTES])
+{
+    uint16_t t[4];
+    size_t i, j, k;
+
+    for (i = 0; i < MLKEM_K; ++i) {
+        for (j = 0; j < MLKEM_N / 4; ++j) {
+            t[0] = (a[0] >> 0) | ((uint16_t)a[1] << 8);
+            t[1] = (a[1] >> 2) | ((uint16_t)a[2] << 6);
+            t[2] = (a[2] >> 4) | ((uint16_t)a[3] << 4);
+            t[3] = (a[3] >> 6) | ((uint16_t)a[4] << 2);
+            a += 5;
+            for (k = 0; k < 4; ++k)
+                r->vec[i].coeffs[4 * j + k] = ((uint32_t)(t[k] & 0x3ff) * MLKEM_Q + 512) >> 10;
+        }
+    }
+}
+
+static void mlkem_poly_frommsg(mlkem_poly_t *r, const uint8_t msg[MLKEM_SYMBYTES])
+{
+    size_t i, j;
+
+    for (i = 0; i < MLKEM_N / 8; ++i) {
+        for (j = 0; j < 8; ++j) {
+            int16_t mask = -(int16_t)((msg[i] >> j) & 1);
+            r->coeffs[8 * i + j] = mask & ((MLKEM_Q + 1) / 2);
+        }
+    }
+}
+
+static void mlkem_poly_tomsg(uint8_t msg[MLKEM_SYMBYTES], const mlkem_poly_t *a)
+{
+    size_t i, j;
+
+    for (i = 0; i < MLKEM_N / 8; ++i) {
+        msg[i] = 0;
+        for (j = 0; j < 8; ++j) {
+            int16_t u = a->coeffs[8 * i + j];
+            uint32_t t;
+            u += (u >> 15) & MLKEM_Q;
+            /* round(u * 2 / q) mod 2 without a division */
+            t = ((((uint32_t)u << 1) + 1665) * 80635) >> 28;
+            msg[i] |= (t & 1) << j;
+        }
+    }
+}
+
+/**
+ * samples a polynomial from the centered binomial distribution with eta = 2, using SHAKE256(seed || nonce) as the PRF
+ */
+static void mlkem_poly_getnoise(mlkem_poly_t *r, const uint8_t seed[MLKEM_SYMBYTES], uint8_t nonce)
+{
+    uint8_t buf[2 * MLKEM_N / 4];
+    size_t i, j;
+
+    mlkem_shake256(buf, sizeof(buf), seed, MLKEM_SYMBYTES, &nonce, 1);
+    for (i = 0; i < MLKEM_N / 8; ++i) {
+        uint32_t t = buf[4 * i] | ((uint32_t)buf[4 * i + 1] << 8) | ((uint32_t)buf[4 * i + 2] << 16) |
+                     ((uint32_t)buf[4 * i + 3] << 24),
+                 d = (t & 0x55555555) + ((t >> 1) & 0x55555555);
+        for (j = 0; j < 8; ++j) {
+            int16_t a = (d >> (4 * j)) & 3, b = (d >> (4 * j + 2)) & 3;
+            r->coeffs[8 * i + j] = a - b;
+        }
+    }
+    ptls_clear_memory(buf, sizeof(buf));
+}
+
+/**
+ * generates the matrix A (or its transpose) from the seed, using rejection sampling on the output of SHAKE128
+ */
+static void mlkem_gen_matrix(mlkem_polyvec_t a[MLKEM_K], const uint8_t seed[MLKEM_SYMBYTES], int transposed)
+{
+    size_t i, j;
+
+    for (i = 0; i < MLKEM_K; ++i) {
+        for (j = 0; j < MLKEM_K; ++j) {
+            struct st_mlkem_keccak_t xof;
+            uint8_t ij[2] = {transposed ? i : j, transposed ? j : i}, buf[MLKEM_SHAKE128_RATE];
+            int16_t *coeffs = a[i].vec[j].coeffs;
+            size_t ctr = 0, pos;
+
+            mlkem_keccak_init(&xof, MLKEM_SHAKE128_RATE);
+            mlkem_keccak_absorb(&xof, seed, MLKEM_SYMBYTES);
+            mlkem_keccak_absorb(&xof, ij, sizeof(ij));
+            mlkem_keccak_finalize(&xof, 0x1f);
+            while (ctr < MLKEM_N) {
+                mlkem_keccak_squeeze(&xof, buf, sizeof(buf));
+                for (pos = 0; pos + 3 <= sizeof(buf) && ctr < MLKEM_N; pos += 3) {
+                    uint16_t d1 = (buf[pos] | ((uint16_t)buf[pos + 1] << 8)) & 0xfff,
+                             d2 = (buf[pos + 1] >> 4) | ((uint16_t)buf[pos + 2] << 4);
+                    if (d1 < MLKEM_Q)
+                        coeffs[ctr++] = d1;
+                    if (d2 < MLKEM_Q && ctr < MLKEM_N)
+                        coeffs[ctr++] = d2;
+                }
+            }
+        }
+    }
+}
+
+
+static void mlkem_indcpa_keypair(uint8_t pk[MLKEM768_PUBLIC_KEY_SIZE], uint8_t sk[MLKEM_INDCPA_SECRETKEYBYTES],
+                                 const uint8_t d[MLKEM_SYMBYTES])
+{
+    static const uint8_t k = MLKEM_K;
+    uint8_t buf[2 * MLKEM_SYMBYTES];
+    const uint8_t *publicseed = buf, *noiseseed = buf + MLKEM_SYMBYTES;
+    mlkem_polyvec_t a[MLKEM_K], e, pkpv, skpv;
+    uint8_t nonce = 0;
+    size_t i;
+
+    mlkem_hash_g(buf, d, MLKEM_SYMBYTES, &k, 1);
+    mlkem_gen_matrix(a, publicseed, 0);
+
+    for (i = 0; i < MLKEM_K; ++i)
+        mlkem_poly_getnoise(&skpv.vec[i], noiseseed, nonce++);
+    for (i = 0; i < MLKEM_K; ++i)
+        mlkem_poly_getnoise(&e.vec[i], noiseseed, nonce++);
+    for (i = 0; i < MLKEM_K; ++i) {
+        mlkem_poly_ntt(&skpv.vec[i]);
+        mlkem_poly_ntt(&e.vec[i]);
+    }
+
+    for (i = 0; i < MLKEM_K; ++i) {
+        mlkem_polyvec_basemul_acc_montgomery(&pkpv.vec[i], &a[i], &skpv);
+        mlkem_poly_tomont(&pkpv.vec[i]);
+        mlkem_poly_add(&pkpv.vec[i], &pkpv.vec[i], &e.vec[i]);
+        mlkem_poly_reduce(&pkpv.vec[i]);
+    }
+
+    for (i = 0; i < MLKEM_K; ++i) {
+        mlkem_poly_tobytes(sk + i * MLKEM_POLYBYTES, &skpv.vec[i]);
+        mlkem_poly_tobytes(pk + i * MLKEM_POLYBYTES, &pkpv.vec[i]);
+    }
+    memcpy(pk + MLKEM_POLYVECBYTES, publicseed, MLKEM_SYMBYTES);
+
+    ptls_clear_memory(buf, sizeof(buf));
+    ptls_clear_memory(&skpv, sizeof(skpv));
+    ptls_clear_memory(&e, sizeof(e));
+}
+
+/**
+ * Encrypts `m` using the coins. The public key is assumed to have passed the modulus check.
+ */
+static void mlkem_indcpa_enc(uint8_t c[MLKEM768_CIPHERTEXT_SIZE], const uint8_t m[MLKEM_SYMBYTES],
+                             const uint8_t pk[MLKEM768_PUBLIC_KEY_SIZE], const uint8_t coins[MLKEM_SYMBYTES])
+{
+    mlkem_polyvec_t at[MLKEM_K], pkpv, sp, ep, b;
+    mlkem_poly_t v, k, epp;
+    uint8_t nonce = 0;
+    size_t i;
+
+    for (i = 0; i < MLKEM_K; ++i)
+        mlkem_poly_frombytes(&pkpv.vec[i], pk + i * MLKEM_POLYBYTES);
+    mlkem_poly_frommsg(&k, m);
+    mlkem_gen_matrix(at, pk + MLKEM_POLYVECBYTES, 1);
+
+    for (i = 0; i < MLKEM_K; ++i)
+        mlkem_poly_getnoise(&sp.vec[i], coins, nonce++);
+    for (i = 0; i < MLKEM_K; ++i)
+        mlkem_poly_getnoise(&ep.vec[i], coins, nonce++);
+    mlkem_poly_getnoise(&epp, coins, nonce++);
+
+    for (i = 0; i < MLKEM_K; ++i)
+        mlkem_poly_ntt(&sp.vec[i]);
+    for (i = 0; i < MLKEM_K; ++i)
+        mlkem_polyvec_basemul_acc_montgomery(&b.vec[i], &at[i], &sp);
+    mlkem_polyvec_basemul_acc_montgomery(&v, &pkpv, &sp);
+
+    for (i = 0; i < MLKEM_K; ++i) {
+        mlkem_poly_invntt_tomont(&b.vec[i]);
+        mlkem_poly_add(&b.vec[i], &b.vec[i], &ep.vec[i]);
+        mlkem_poly_reduce(&b.vec[i]);
+    }
+    mlkem_poly_invntt_tomont(&v);
+    mlkem_poly_add(&v, &v, &epp);
+    mlkem_poly_add(&v, &v, &k);
+    mlkem_poly_reduce(&v);
+
+    mlkem_polyvec_compress(c, &b);
+    mlkem_poly_compress(c + MLKEM_POLYVECCOMPRESSEDBYTES, &v);
+
+    ptls_clear_memory(&sp, sizeof(sp));
+    ptls_clear_memory(&ep, sizeof(ep));
+    ptls_clear_memory(&epp, sizeof(epp));
+    ptls_clear_memory(&k, sizeof(k));
+}
+
+static void mlkem_indcpa_dec(uint8_t m[MLKEM_SYMBYTES], const uint8_t c[MLKEM768_CIPHERTEXT_SIZE],
+                             const uint8_t sk[MLKEM_INDCPA_SECRETKEYBYTES])
+{
+    mlkem_polyvec_t b, skpv;
+    mlkem_poly_t v, mp;
+    size_t i;
+
+    mlkem_polyvec_decompress(&b, c);
+    mlkem_poly_decompress(&v, c + MLKEM_POLYVECCOMPRESSEDBYTES);
+    for (i = 0; i < MLKEM_K; ++i)
+        mlkem_poly_frombytes(&skpv.vec[i], sk + i * MLKEM_POLYBYTES);
+
+    for (i = 0; i < MLKEM_K; ++i)
+        mlkem_poly_ntt(&b.vec[i]);
+    mlkem_polyvec_basemul_acc_montgomery(&mp, &skpv, &b);
+    mlkem_poly_invntt_tomont(&mp);
+
+    mlkem_poly_sub(&mp, &v, &mp);
+    mlkem_poly_reduce(&mp);
+    mlkem_poly_tomsg(m, &mp);
+
+    ptls_clear_memory(&skpv, sizeof(skpv));
+    ptls_clear_memory(&mp, sizeof(mp));
+}
+
+/**
+ * ML-KEM.KeyGen_internal; `seed` is d || z
+ */
+static void mlkem768_keypair(uint8_t pk[MLKEM768_PUBLIC_KEY_SIZE], uint8_t sk[MLKEM768_SECRET_KEY_SIZE],
+                             const uint8_t seed[2 * MLKEM_SYMBYTES])
+{
+    mlkem_indcpa_keypair(pk, sk, seed);
+    memcpy(sk + MLKEM_INDCPA_SECRETKEYBYTES, pk, MLKEM768_PUBLIC_KEY_SIZE);
+    mlkem_hash_h(sk + MLKEM768_SECRET_KEY_SIZE - 2 * MLKEM_SYMBYTES, pk, MLKEM768_PUBLIC_KEY_SIZE);
+    memcpy(sk + MLKEM768_SECRET_KEY_SIZE - MLKEM_SYMBYTES, seed + MLKEM_SYMBYTES, MLKEM_SYMBYTES);
+}
+
+/**
+ * ML-KEM.Encaps_internal. Returns zero if the public key fails the modulus check.
+ */
+static int mlkem768_encaps(uint8_t ct[MLKEM768_CIPHERTEXT_SIZE], uint8_t ss[MLKEM768_SHARED_SECRET_SIZE],
+                           const uint8_t pk[MLKEM768_PUBLIC_KEY_SIZE], const uint8_t m[MLKEM_SYMBYTES])
+{
+    uint8_t buf[2 * MLKEM_SYMBYTES], kr[2 * MLKEM_SYMBYTES];
+    mlkem_poly_t t;
+    size_t i;
+
+    for (i = 0; i < MLKEM_K; ++i)
+        if (!mlkem_poly_frombytes(&t, pk + i * MLKEM_POLYBYTES))
+            return 0;
+
+    memcpy(buf, m, MLKEM_SYMBYTES);
+    mlkem_hash_h(buf + MLKEM_SYMBYTES, pk, MLKEM768_PUBLIC_KEY_SIZE);
+    mlkem_hash_g(kr, buf, sizeof(buf), NULL, 0);
+    mlkem_indcpa_enc(ct, buf, pk, kr + MLKEM_SYMBYTES);
+    memcpy(ss, kr, MLKEM768_SHARED_SECRET_SIZE);
+
+    ptls_clear_memory(buf, sizeof(buf));
+    ptls_clear_memory(kr, sizeof(kr));
+    return 1;
+}
+
+/**
+ * ML-KEM.Decaps_internal, with implicit rejection
+ */
+static void mlkem768_decaps(uint8_t ss[MLKEM768_SHARED_SECRET_SIZE], const uint8_t ct[MLKEM768_CIPHERTEXT_SIZE],
+                            const uint8_t sk[MLKEM768_SECRET_KEY_SIZE])
+{
+    const uint8_t *pk = sk + MLKEM_INDCPA_SECRETKEYBYTES;
+    uint8_t buf[2 * MLKEM_SYMBYTES], kr[2 * MLKEM_SYMBYTES], cmp[MLKEM768_CIPHERTEXT_SIZE], diff = 0, mask;
+    size_t i;
+
+    mlkem_indcpa_dec(buf, ct, sk);
+    memcpy(buf + MLKEM_SYMBYTES, sk + MLKEM768_SECRET_KEY_SIZE - 2 * MLKEM_SYMBYTES, MLKEM_SYMBYTES);
+    mlkem_hash_g(kr, buf, sizeof(buf), NULL, 0);
+    mlkem_indcpa_enc(cmp, buf, pk, kr + MLKEM_SYMBYTES);
+
+    /* K_bar = J(z || c), selected in constant time if the re-encryption does not match */
+    mlkem_shake256(ss, MLKEM768_SHARED_SECRET_SIZE, sk + MLKEM768_SECRET_KEY_SIZE - MLKEM_SYMBYTES, MLKEM_SYMBYTES, ct,
+                   MLKEM768_CIPHERTEXT_SIZE);
+    for (i = 0; i < MLKEM768_CIPHERTEXT_SIZE; ++i)
+        diff |= ct[i] ^ cmp[i];
+    mask = (uint8_t)(((uint16_t)diff - 1) >> 8); /* 0xff if the ciphertexts are identical */
+    for (i = 0; i < MLKEM768_SHARED_SECRET_SIZE; ++i)
+        ss[i] ^= mask & (ss[i] ^ kr[i]);
+
+    ptls_clear_memory(buf, sizeof(buf));
+    ptls_clear_memory(kr, sizeof(kr));
+}
+
+#define X25519MLKEM768_CLIENT_SHARE_SIZE (MLKEM768_PUBLIC_KEY_SIZE + X25519_KEY_SIZE)
+#define X25519MLKEM768_SERVER_SHARE_SIZE (MLKEM768_CIPHERTEXT_SIZE + X25519_KEY_SIZE)
+#define X25519MLKEM768_SECRET_SIZE (MLKEM768_SHARED_SECRET_SIZE + X25519_KEY_SIZE)
+
+struct st_x25519mlkem768_key_exchange_t {
+    ptls_key_exchange_context_t super;
+    uint8_t mlkem_sk[MLKEM768_SECRET_KEY_SIZE];
+    uint8_t x25519_priv[X25519_KEY_SIZE];
+    /**
+     * ML-KEM-768 encapsulation key || X25519 public key
+     */
+    uint8_t pub[X25519MLKEM768_CLIENT_SHARE_SIZE];
+};
+
+static int x25519mlkem768_on_exchange(ptls_key_exchange_context_t **_ctx, int release, ptls_iovec_t *secret, ptls_iovec_t peerkey)
+{
+    struct st_x25519mlkem768_key_exchange_t *ctx = (struct st_x25519mlkem768_key_exchange_t *)*_ctx;
+    int ret;
+
+    if (secret == NULL) {
+        ret = 0;
+        goto Exit;
+    }
+
+    if (peerkey.len != X25519MLKEM768_SERVER_SHARE_SIZE) {
+        ret = PTLS_ALERT_DECRYPT_ERROR;
+        goto Exit;
+    }
+    if ((secret->base = malloc(X25519MLKEM768_SECRET_SIZE)) == NULL) {
+        ret = PTLS_ERROR_NO_MEMORY;
+        goto Exit;
+    }
+    mlkem768_decaps(secret->base, peerkey.base, ctx->mlkem_sk);
+    cf_curve25519_mul(secret->base + MLKEM768_SHARED_SECRET_SIZE, ctx->x25519_priv, peerkey.base + MLKEM768_CIPHERTEXT_SIZE);
+    secret->len = X25519MLKEM768_SECRET_SIZE;
+    ret = 0;
+
+Exit:
+    if (release) {
+        ptls_clear_memory(ctx->mlkem_sk, sizeof(ctx->mlkem_sk));
+        ptls_clear_memory(ctx->x25519_priv, sizeof(ctx->x25519_priv));
+        free(ctx);
+        *_ctx = NULL;
+    }
+    return ret;
+}
+
+static int x25519mlkem768_create_key_exchange(ptls_key_exchange_algorithm_t *algo, ptls_key_exchange_context_t **_ctx)
+{
+    struct st_x25519mlkem768_key_exchange_t *ctx;
+    uint8_t seed[2 * MLKEM_SYMBYTES];
+
+    if ((ctx = (struct st_x25519mlkem768_key_exchange_t *)malloc(sizeof(*ctx))) == NULL)
+        return PTLS_ERROR_NO_MEMORY;
+    ctx->super = (ptls_key_exchange_context_t){algo, {ctx->pub, sizeof(ctx->pub)}, x25519mlkem768_on_exchange};
+
+    ptls_minicrypto_random_bytes(seed, sizeof(seed));
+    mlkem768_keypair(ctx->pub, ctx->mlkem_sk, seed);
+    ptls_clear_memory(seed, sizeof(seed));
+    ptls_minicrypto_random_bytes(ctx->x25519_priv, sizeof(ctx->x25519_priv));
+    cf_curve25519_mul_base(ctx->pub + MLKEM768_PUBLIC_KEY_SIZE, ctx->x25519_priv);
+
+    *_ctx = &ctx->super;
+    return 0;
+}
+
+static int x25519mlkem768_key_exchange(ptls_key_exchange_algorithm_t *algo, ptls_iovec_t *pubkey, ptls_iovec_t *secret,
+                                       ptls_iovec_t peerkey)
+{
+    uint8_t m[MLKEM_SYMBYTES], x25519_priv[X25519_KEY_SIZE], *pub = NULL;
+    int ret;
+
+    *secret = ptls_iovec_init(NULL, 0);
+
+    if (peerkey.len != X25519MLKEM768_CLIENT_SHARE_SIZE) {
+        ret = PTLS_ALERT_DECRYPT_ERROR;
+        goto Exit;
+    }
+    if ((pub = malloc(X25519MLKEM768_SERVER_SHARE_SIZE)) == NULL || (secret->base = malloc(X25519MLKEM768_SECRET_SIZE)) == NULL) {
+        ret = PTLS_ERROR_NO_MEMORY;
+        goto Exit;
+    }
+
+    /* ML-KEM-768 */
+    ptls_minicrypto_random_bytes(m, sizeof(m));
+    if (!mlkem768_encaps(pub, secret->base, peerkey.base, m)) {
+        ret = PTLS_ALERT_ILLEGAL_PARAMETER;
+        goto Exit;
+    }
+    /* X25519 */
+    ptls_minicrypto_random_bytes(x25519_priv, sizeof(x25519_priv));
+    cf_curve25519_mul_base(pub + MLKEM768_CIPHERTEXT_SIZE, x25519_priv);
+    cf_curve25519_mul(secret->base + MLKEM768_SHARED_SECRET_SIZE, x25519_priv, peerkey.base + MLKEM768_PUBLIC_KEY_SIZE);
+
+    *pubkey = ptls_iovec_init(pub, X25519MLKEM768_SERVER_SHARE_SIZE);
+    secret->len = X25519MLKEM768_SECRET_SIZE;
+    ret = 0;
+
+Exit:
+    ptls_clear_memory(m, sizeof(m));
+    ptls_clear_memory(x25519_priv, sizeof(x25519_priv));
+    if (ret != 0) {
+        free(pub);
+        if (secret->base != NULL) {
+            ptls_clear_memory(secret->base, X25519MLKEM768_SECRET_SIZE);
+            free(secret->base);
+            *secret = ptls_iovec_init(NULL, 0);
+        }
+    }
+    return ret;
+}
+
+ptls_key_exchange_algorithm_t ptls_minicrypto_x25519mlkem768 = {PTLS_GROUP_X25519MLKEM768, x25519mlkem768_create_key_exchange,
+                                                                x25519mlkem768_key_exchange};
@@ -82,10 +82,30 @@ static void read_entropy(uint8_t *entropy, size_t size)
 }
 #endif
 #else
+#if defined(__linux__) && defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 25))
+#include <sys/random.h>
+#define HAVE_GETRANDOM 1
+#endif
 static void read_entropy(uint8_t *entropy, size_t size)
 {
     int fd;
 
+#ifdef HAVE_GETRANDOM
+    /* getrandom does not require a file descriptor and blocks only until the pool has been initialized */
+    while (size != 0) {
+        ssize_t rret;
+        if ((rret = getrandom(entropy, size, 0)) == -1) {
+            if (errno == EINTR)
+                continue;
+            break; /* fall back to /dev/urandom (e.g., ENOSYS) */
+        }
+        entropy += rret;
+        size -= rret;
+    }
+    if (size == 0)
+        return;
+#endif
+
     if ((fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC)) == -1) {
         if ((fd = open("/dev/random", O_RDONLY | O_CLOEXEC)) == -1) {
             perror("ptls_minicrypto_random_bytes: could not open neither /dev/random or /dev/urandom");
@@ -120,3 +140,13 @@ void ptls_minicrypto_random_bytes(void *buf, size_t len)
     }
     cf_hash_drbg_sha256_gen(&ctx, buf, len);
 }
+
+static void seed_chacha20_random(void *buf, size_t len)
+{
+    read_entropy(buf, len);
+}
+
+void ptls_minicrypto_chacha20_random_bytes(void *buf, size_t len)
+{
+    ptls_chacha20_random_bytes(&ptls_minicrypto_chacha20, seed_chacha20_random, buf, len);
+}
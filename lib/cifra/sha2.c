@@ -0,0 +1,352 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * SHA-256 and SHA-384 used by the minicrypto backend.
+ *
+ * The contexts are those of cifra, and cifra is used as-is unless the CPU provides something better. On x86_64, SHA-256 is
+ * dispatched at runtime to the SHA extensions (SHA-NI), and SHA-384 to an implementation that calculates the message schedule
+ * using AVX2 (and rotates using BMI2). Both update `blocks`, `partial`, and `npartial` the same way cifra does, so the two can be
+ * used interchangeably.
+ */
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA2_HAVE_X86 1
+#endif
+#include "sha2.h"
+#include "picotls.h"
+
+#if SHA2_HAVE_X86
+
+#define SHA2_SHANI __attribute__((target("sha,sse4.1,ssse3")))
+#define SHA2_AVX2 __attribute__((target("avx2,bmi2")))
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01,
+    0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116, 0x1e376c08,
+    0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static const uint64_t sha512_k[80] = {
+    UINT64_C(0x428a2f98d728ae22), UINT64_C(0x7137449123ef65cd), UINT64_C(0xb5c0fbcfec4d3b2f), UINT64_C(0xe9b5dba58189dbbc),
+    UINT64_C(0x3956c25bf348b538), UINT64_C(0x59f111f1b605d019), UINT64_C(0x923f82a4af194f9b), UINT64_C(0xab1c5ed5da6d8118),
+    UINT64_C(0xd807aa98a3030242), UINT64_C(0x12835b0145706fbe), UINT64_C(0x243185be4ee4b28c), UINT64_C(0x550c7dc3d5ffb4e2),
+    UINT64_C(0x72be5d74f27b896f), UINT64_C(0x80deb1fe3b1696b1), UINT64_C(0x9bdc06a725c71235), UINT64_C(0xc19bf174cf692694),
+    UINT64_C(0xe49b69c19ef14ad2), UINT64_C(0xefbe4786384f25e3), UINT64_C(0x0fc19dc68b8cd5b5), UINT64_C(0x240ca1cc77ac9c65),
+    UINT64_C(0x2de92c6f592b0275), UINT64_C(0x4a7484aa6ea6e483), UINT64_C(0x5cb0a9dcbd41fbd4), UINT64_C(0x76f988da831153b5),
+    UINT64_C(0x983e5152ee66dfab), UINT64_C(0xa831c66d2db43210), UINT64_C(0xb00327c898fb213f), UINT64_C(0xbf597fc7beef0ee4),
+    UINT64_C(0xc6e00bf33da88fc2), UINT64_C(0xd5a79147930aa725), UINT64_C(0x06ca6351e003826f), UINT64_C(0x142929670a0e6e70),
+    UINT64_C(0x27b70a8546d22ffc), UINT64_C(0x2e1b21385c26c926), UINT64_C(0x4d2c6dfc5ac42aed), UINT64_C(0x53380d139d95b3df),
+    UINT64_C(0x650a73548baf63de), UINT64_C(0x766a0abb3c77b2a8), UINT64_C(0x81c2c92e47edaee6), UINT64_C(0x92722c851482353b),
+    UINT64_C(0xa2bfe8a14cf10364), UINT64_C(0xa81a664bbc423001), UINT64_C(0xc24b8b70d0f89791), UINT64_C(0xc76c51a30654be30),
+    UINT64_C(0xd192e819d6ef5218), UINT64_C(0xd69906245565a910), UINT64_C(0xf40e35855771202a), UINT64_C(0x106aa07032bbd1b8),
+    UINT64_C(0x19a4c116b8d2d0c8), UINT64_C(0x1e376c085141ab53), UINT64_C(0x2748774cdf8eeb99), UINT64_C(0x34b0bcb5e19b48a8),
+    UINT64_C(0x391c0cb3c5c95a63), UINT64_C(0x4ed8aa4ae3418acb), UINT64_C(0x5b9cca4f7763e373), UINT64_C(0x682e6ff3d6b2b8a3),
+    UINT64_C(0x748f82ee5defb2fc), UINT64_C(0x78a5636f43172f60), UINT64_C(0x84c87814a1f0ab72), UINT64_C(0x8cc702081a6439ec),
+    UINT64_C(0x90befffa23631e28), UINT64_C(0xa4506cebde82bde9), UINT64_C(0xbef9a3f7b2c67915), UINT64_C(0xc67178f2e372532b),
+    UINT64_C(0xca273eceea26619c), UINT64_C(0xd186b8c721c0c207), UINT64_C(0xeada7dd6cde0eb1e), UINT64_C(0xf57d4f7fee6ed178),
+    UINT64_C(0x06f067aa72176fba), UINT64_C(0x0a637dc5a2c898a6), UINT64_C(0x113f9804bef90dae), UINT64_C(0x1b710b35131c471b),
+    UINT64_C(0x28db77f523047d84), UINT64_C(0x32caab7b40c72493), UINT64_C(0x3c9ebe0a15c9bebc), UINT64_C(0x431d67c49c100d4c),
+    UINT64_C(0x4cc5d4becb3e42b6), UINT64_C(0x597f299cfc657e2a), UINT64_C(0x5fcb6fab3ad6faec), UINT64_C(0x6c44198c4a475817)};
+
+/**
+ * set to non-zero to use cifra regardless of what the CPU supports (used by the tests)
+ */
+static int sha2_accel_disabled;
+
+static int sha256_use_shani(void)
+{
+    static int supported = -1;
+
+    if (sha2_accel_disabled)
+        return 0;
+    if (supported == -1) {
+        unsigned eax, ebx, ecx, edx;
+        supported = __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_SHA) != 0 &&
+                    __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("ssse3");
+    }
+    return supported;
+}
+
+static int sha512_use_avx2(void)
+{
+    return !sha2_accel_disabled && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2");
+}
+
+/**
+ * Processes `nblocks` 64-byte blocks using SHA-NI. The structure follows the one described in the Intel white paper: the state
+ * is kept as ABEF / CDGH, and the message schedule for round group `i` is completed by msg1 three groups ahead and msg2 one group
+ * ahead.
+ */
+SHA2_SHANI static void sha256_blocks_shani(uint32_t H[8], const uint8_t *src, size_t nblocks)
+{
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i state0, state1, tmp;
+
+    tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)H), 0xb1);  /* CDAB */
+    state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(H + 4)), 0x1b); /* EFGH */
+    state0 = _mm_alignr_epi8(tmp, state1, 8);                             /* ABEF */
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);                          /* CDGH */
+
+#define ROUNDS4(i)                                                                                                                 \
+    do {                                                                                                                           \
+        if (i < 4)                                                                                                                 \
+            w[i % 4] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i * 16)), bswap);                                  \
+        msg = _mm_add_epi32(w[i % 4], _mm_loadu_si128((const __m128i *)(sha256_k + i * 4)));                                       \
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);                                                                       \
+        if (3 <= i && i < 15)                                                                                                      \
+            w[(i + 1) % 4] = _mm_sha256msg2_epu32(_mm_add_epi32(w[(i + 1) % 4], _mm_alignr_epi8(w[i % 4], w[(i + 3) % 4], 4)),     \
+                                                  w[i % 4]);                                                                       \
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));                                             \
+        if (1 <= i && i < 13)                                                                                                      \
+            w[(i + 3) % 4] = _mm_sha256msg1_epu32(w[(i + 3) % 4], w[i % 4]);                                                       \
+    } while (0)
+
+    for (; nblocks != 0; --nblocks, src += 64) {
+        __m128i abef = state0, cdgh = state1, w[4], msg;
+        ROUNDS4(0);
+        ROUNDS4(1);
+        ROUNDS4(2);
+        ROUNDS4(3);
+        ROUNDS4(4);
+        ROUNDS4(5);
+        ROUNDS4(6);
+        ROUNDS4(7);
+        ROUNDS4(8);
+        ROUNDS4(9);
+        ROUNDS4(10);
+        ROUNDS4(11);
+        ROUNDS4(12);
+        ROUNDS4(13);
+        ROUNDS4(14);
+        ROUNDS4(15);
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+#undef ROUNDS4
+
+    tmp = _mm_shuffle_epi32(state0, 0x1b);       /* FEBA */
+    state1 = _mm_shuffle_epi32(state1, 0xb1);    /* DCHG */
+    state0 = _mm_blend_epi16(tmp, state1, 0xf0); /* DCBA */
+    state1 = _mm_alignr_epi8(state1, tmp, 8);    /* HGFE */
+    _mm_storeu_si128((__m128i *)H, state0);
+    _mm_storeu_si128((__m128i *)(H + 4), state1);
+}
+
+SHA2_AVX2 static inline __m256i sha512_avx2_ror(__m256i x, int n)
+{
+    return _mm256_or_si256(_mm256_srli_epi64(x, n), _mm256_slli_epi64(x, 64 - n));
+}
+
+SHA2_AVX2 static inline __m128i sha512_avx2_ssig1(__m128i x)
+{
+    __m128i r = _mm_xor_si128(_mm_srli_epi64(x, 19), _mm_slli_epi64(x, 64 - 19));
+    r = _mm_xor_si128(r, _mm_or_si128(_mm_srli_epi64(x, 61), _mm_slli_epi64(x, 64 - 61)));
+    return _mm_xor_si128(r, _mm_srli_epi64(x, 6));
+}
+
+#define SHA512_ROTR(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+
+/**
+ * Processes `nblocks` 128-byte blocks. The message schedule is expanded four words at a time using AVX2; sigma0 is applied to all
+ * four lanes at once, while sigma1 is applied to two lanes at a time, as W[t+2] and W[t+3] depend on W[t] and W[t+1]. The round
+ * constants are added while still in vector registers. The rounds are scalar, as they are inherently serial.
+ */
+SHA2_AVX2 static void sha512_blocks_avx2(uint64_t H[8], const uint8_t *src, size_t nblocks)
+{
+    const __m256i bswap = _mm256_set_epi64x(0x08090a0b0c0d0e0fULL, 0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL,
+                                            0x0001020304050607ULL);
+    uint64_t W[80], WK[80]; /* the message schedule, and the schedule with the round constants added */
+
+    for (; nblocks != 0; --nblocks, src += 128) {
+        uint64_t a = H[0], b = H[1], c = H[2], d = H[3], e = H[4], f = H[5], g = H[6], h = H[7];
+        size_t t;
+
+        for (t = 0; t < 16; t += 4) {
+            __m256i w = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(src + t * 8)), bswap);
+            _mm256_storeu_si256((__m256i *)(W + t), w);
+            _mm256_storeu_si256((__m256i *)(WK + t), _mm256_add_epi64(w, _mm256_loadu_si256((const __m256i *)(sha512_k + t))));
+        }
+        for (t = 16; t < 80; t += 4) {
+            __m256i w15 = _mm256_loadu_si256((const __m256i *)(W + t - 15)), s;
+            __m128i lo, hi;
+            s = _mm256_xor_si256(sha512_avx2_ror(w15, 1), sha512_avx2_ror(w15, 8));
+            s = _mm256_xor_si256(s, _mm256_srli_epi64(w15, 7));
+            s = _mm256_add_epi64(s, _mm256_loadu_si256((const __m256i *)(W + t - 16)));
+            s = _mm256_add_epi64(s, _mm256_loadu_si256((const __m256i *)(W + t - 7)));
+            lo = _mm_add_epi64(_mm256_castsi256_si128(s), sha512_avx2_ssig1(_mm_loadu_si128((const __m128i *)(W + t - 2))));
+            hi = _mm_add_epi64(_mm256_extracti128_si256(s, 1), sha512_avx2_ssig1(lo));
+            s = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+            _mm256_storeu_si256((__m256i *)(W + t), s);
+            _mm256_storeu_si256((__m256i *)(WK + t), _mm256_add_epi64(s, _mm256_loadu_si256((const __m256i *)(sha512_k + t))));
+        }
+
+#define ROUND(a, b, c, d, e, f, g, h, i)                                                                                           \
+    do {                                                                                                                           \
+        uint64_t t1 = h + (SHA512_ROTR(e, 14) ^ SHA512_ROTR(e, 18) ^ SHA512_ROTR(e, 41)) + (g ^ (e & (f ^ g))) + WK[i];            \
+        d += t1;                                                                                                                   \
+        h = t1 + (SHA512_ROTR(a, 28) ^ SHA512_ROTR(a, 34) ^ SHA512_ROTR(a, 39)) + ((a & b) | (c & (a | b)));                      \
+    } while (0)
+        for (t = 0; t < 80; t += 8) {
+            ROUND(a, b, c, d, e, f, g, h, t);
+            ROUND(h, a, b, c, d, e, f, g, t + 1);
+            ROUND(g, h, a, b, c, d, e, f, t + 2);
+            ROUND(f, g, h, a, b, c, d, e, t + 3);
+            ROUND(e, f, g, h, a, b, c, d, t + 4);
+            ROUND(d, e, f, g, h, a, b, c, t + 5);
+            ROUND(c, d, e, f, g, h, a, b, t + 6);
+            ROUND(b, c, d, e, f, g, h, a, t + 7);
+        }
+#undef ROUND
+
+        H[0] += a;
+        H[1] += b;
+        H[2] += c;
+        H[3] += d;
+        H[4] += e;
+        H[5] += f;
+        H[6] += g;
+        H[7] += h;
+    }
+
+    ptls_clear_memory(W, sizeof(W));
+    ptls_clear_memory(WK, sizeof(WK));
+}
+
+#undef SHA512_ROTR
+
+/**
+ * Feeds `src` into the context, calling `blocks_cb` for each run of complete blocks. The context fields are used the same way
+ * as cifra does.
+ */
+#define SHA2_ACCUMULATE(ctx, block_size, blocks_cb, src, len)                                                                      \
+    do {                                                                                                                           \
+        const uint8_t *_src = (src);                                                                                               \
+        size_t _len = (len), _n;                                                                                                   \
+        if ((ctx)->npartial != 0) {                                                                                                \
+            if ((_n = (block_size) - (ctx)->npartial) > _len)                                                                      \
+                _n = _len;                                                                                                         \
+            memcpy((ctx)->partial + (ctx)->npartial, _src, _n);                                                                    \
+            (ctx)->npartial += _n;                                                                                                 \
+            _src += _n;                                                                                                            \
+            _len -= _n;                                                                                                            \
+            if ((ctx)->npartial != (block_size))                                                                                   \
+                break;                                                                                                             \
+            blocks_cb((ctx)->H, (ctx)->partial, 1);                                                                                \
+            ++(ctx)->blocks;                                                                                                       \
+            (ctx)->npartial = 0;                                                                                                   \
+        }                                                                                                                          \
+        if ((_n = _len / (block_size)) != 0) {                                                                                     \
+            blocks_cb((ctx)->H, _src, _n);                                                                                         \
+            (ctx)->blocks += (uint32_t)_n;                                                                                         \
+            _src += _n * (block_size);                                                                                             \
+            _len -= _n * (block_size);                                                                                             \
+        }                                                                                                                          \
+        memcpy((ctx)->partial, _src, _len);                                                                                        \
+        (ctx)->npartial = _len;                                                                                                    \
+    } while (0)
+
+/**
+ * Appends the padding and the message length in bits (big endian, using `len_size` bytes) to the partial block, processing it.
+ */
+#define SHA2_PAD(ctx, block_size, len_size, blocks_cb)                                                                             \
+    do {                                                                                                                           \
+        uint64_t _bits = ((uint64_t)(ctx)->blocks * (block_size) + (ctx)->npartial) * 8;                                           \
+        size_t _i;                                                                                                                 \
+        (ctx)->partial[(ctx)->npartial++] = 0x80;                                                                                  \
+        if ((ctx)->npartial > (block_size) - (len_size)) {                                                                         \
+            memset((ctx)->partial + (ctx)->npartial, 0, (block_size) - (ctx)->npartial);                                           \
+            blocks_cb((ctx)->H, (ctx)->partial, 1);                                                                                \
+            (ctx)->npartial = 0;                                                                                                   \
+        }                                                                                                                          \
+        memset((ctx)->partial + (ctx)->npartial, 0, (block_size) - (ctx)->npartial);                                               \
+        for (_i = 0; _i < 8; ++_i)                                                                                                 \
+            (ctx)->partial[(block_size)-1 - _i] = (uint8_t)(_bits >> (_i * 8));                                                    \
+        blocks_cb((ctx)->H, (ctx)->partial, 1);                                                                                    \
+    } while (0)
+
+#endif
+
+void ptls_minicrypto__sha256_update(cf_sha256_context *ctx, const void *src, size_t len)
+{
+#if SHA2_HAVE_X86
+    if (sha256_use_shani()) {
+        SHA2_ACCUMULATE(ctx, CF_SHA256_BLOCKSZ, sha256_blocks_shani, src, len);
+        return;
+    }
+#endif
+    cf_sha256_update(ctx, src, len);
+}
+
+void ptls_minicrypto__sha256_final(cf_sha256_context *ctx, uint8_t *md)
+{
+#if SHA2_HAVE_X86
+    if (sha256_use_shani()) {
+        size_t i;
+        SHA2_PAD(ctx, CF_SHA256_BLOCKSZ, 8, sha256_blocks_shani);
+        for (i = 0; i < 8; ++i) {
+            md[i * 4] = (uint8_t)(ctx->H[i] >> 24);
+            md[i * 4 + 1] = (uint8_t)(ctx->H[i] >> 16);
+            md[i * 4 + 2] = (uint8_t)(ctx->H[i] >> 8);
+            md[i * 4 + 3] = (uint8_t)ctx->H[i];
+        }
+        ptls_clear_memory(ctx, sizeof(*ctx));
+        return;
+    }
+#endif
+    cf_sha256_digest_final(ctx, md);
+}
+
+void ptls_minicrypto__sha384_update(cf_sha512_context *ctx, const void *src, size_t len)
+{
+#if SHA2_HAVE_X86
+    if (sha512_use_avx2()) {
+        SHA2_ACCUMULATE(ctx, CF_SHA512_BLOCKSZ, sha512_blocks_avx2, src, len);
+        return;
+    }
+#endif
+    cf_sha384_update(ctx, src, len);
+}
+
+void ptls_minicrypto__sha384_final(cf_sha512_context *ctx, uint8_t *md)
+{
+#if SHA2_HAVE_X86
+    if (sha512_use_avx2()) {
+        size_t i, j;
+        /* the upper half of the 128-bit length is always zero, as the block counter is 32 bits */
+        SHA2_PAD(ctx, CF_SHA512_BLOCKSZ, 16, sha512_blocks_avx2);
+        for (i = 0; i < CF_SHA384_HASHSZ / 8; ++i)
+            for (j = 0; j < 8; ++j)
+                md[i * 8 + j] = (uint8_t)(ctx->H[i] >> (56 - j * 8));
+        ptls_clear_memory(ctx, sizeof(*ctx));
+        return;
+    }
+#endif
+    cf_sha384_digest_final(ctx, md);
+}
@@ -0,0 +1,323 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "picotls/context_handle.h"
+
+#define CONTEXT_HANDLE_CACHELINE_SIZE 64
+
+/**
+ * state of each thread using the handle; padded so that each thread writes to its own cache line
+ */
+struct st_context_handle_thread_t {
+    struct st_ptls_context_handle_state_t *state;
+    /**
+     * epoch observed upon entering the section, or zero if not within the section
+     */
+    uint64_t active_epoch;
+    /**
+     * if the slot is owned by a thread (guarded by the mutex)
+     */
+    int in_use;
+    uint8_t _padding[CONTEXT_HANDLE_CACHELINE_SIZE - sizeof(void *) - sizeof(uint64_t) - sizeof(int)];
+};
+
+/**
+ * number of connections opened minus the number of connections closed by the thread, using the version
+ */
+struct st_context_handle_count_t {
+    int64_t value;
+    uint8_t _padding[CONTEXT_HANDLE_CACHELINE_SIZE - sizeof(int64_t)];
+};
+
+struct st_context_handle_version_t {
+    /**
+     * installed as the `update_open_count` callback of the context
+     */
+    ptls_update_open_count_t super;
+    struct st_ptls_context_handle_state_t *state;
+    ptls_context_t *ctx;
+    ptls_update_open_count_t *orig_update_open_count;
+    /**
+     * epoch at which the version has been replaced; threads that have entered the section at a later epoch never see the version
+     */
+    uint64_t retired_at;
+    struct st_context_handle_version_t *next;
+    /**
+     * one counter per thread slot, followed by one shared by the threads that failed to obtain a slot, which is updated atomically
+     */
+    struct st_context_handle_count_t counts[1];
+};
+
+struct st_ptls_context_handle_state_t {
+    struct st_context_handle_version_t *current;
+    uint64_t epoch;
+    pthread_key_t thread_key;
+    pthread_mutex_t mutex;
+    /**
+     * list of the versions being replaced but that might still be in use
+     */
+    struct st_context_handle_version_t *retired;
+    size_t max_threads;
+    struct st_context_handle_thread_t *threads;
+};
+
+static void on_thread_exit(void *_thread)
+{
+    struct st_context_handle_thread_t *thread = _thread;
+
+    pthread_mutex_lock(&thread->state->mutex);
+    thread->in_use = 0;
+    pthread_mutex_unlock(&thread->state->mutex);
+}
+
+/**
+ * returns the slot of the calling thread, or NULL if all the slots are in use
+ */
+static struct st_context_handle_thread_t *get_thread(struct st_ptls_context_handle_state_t *state)
+{
+    struct st_context_handle_thread_t *thread;
+    size_t i;
+
+    if ((thread = pthread_getspecific(state->thread_key)) != NULL)
+        return thread;
+
+    pthread_mutex_lock(&state->mutex);
+    for (i = 0; i != state->max_threads; ++i) {
+        if (!state->threads[i].in_use) {
+            thread = state->threads + i;
+            thread->in_use = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&state->mutex);
+
+    if (thread != NULL && pthread_setspecific(state->thread_key, thread) != 0) {
+        on_thread_exit(thread);
+        thread = NULL;
+    }
+    return thread;
+}
+
+static void update_open_count(ptls_update_open_count_t *_self, ssize_t delta)
+{
+    struct st_context_handle_version_t *self = (void *)_self;
+    struct st_context_handle_thread_t *thread;
+
+    /* call the original callback first, as the version might be released as soon as the count drops to zero */
+    if (self->orig_update_open_count != NULL)
+        self->orig_update_open_count->cb(self->orig_update_open_count, delta);
+
+    if ((thread = get_thread(self->state)) != NULL) {
+        int64_t *count = &self->counts[thread - self->state->threads].value;
+        __atomic_store_n(count, __atomic_load_n(count, __ATOMIC_RELAXED) + delta, __ATOMIC_RELEASE);
+    } else {
+        __atomic_fetch_add(&self->counts[self->state->max_threads].value, delta, __ATOMIC_RELEASE);
+    }
+}
+
+static struct st_context_handle_version_t *new_version(struct st_ptls_context_handle_state_t *state, ptls_context_t *ctx)
+{
+    struct st_context_handle_version_t *version;
+    size_t size = offsetof(struct st_context_handle_version_t, counts) + sizeof(version->counts[0]) * (state->max_threads + 1);
+
+    if ((version = calloc(1, size)) == NULL)
+        return NULL;
+    version->super.cb = update_open_count;
+    version->state = state;
+    version->ctx = ctx;
+    version->orig_update_open_count = ctx->update_open_count;
+    ctx->update_open_count = &version->super;
+
+    return version;
+}
+
+static void dispose_version(ptls_context_handle_t *self, struct st_context_handle_version_t *version)
+{
+    version->ctx->update_open_count = version->orig_update_open_count;
+    if (self->on_dispose != NULL)
+        self->on_dispose(self, version->ctx);
+    free(version);
+}
+
+/**
+ * Moves the versions that are no longer used from the retired list to `*released`. Must be called while holding the mutex.
+ */
+static size_t collect_unused(struct st_ptls_context_handle_state_t *state, struct st_context_handle_version_t **released)
+{
+    struct st_context_handle_version_t **slot;
+    uint64_t min_active_epoch = UINT64_MAX;
+    size_t i, num_in_use = 0;
+
+    /* pairs with the fence in `ptls_context_handle_enter`; either we see the thread being active, or the thread sees the new
+     * version */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (i = 0; i != state->max_threads; ++i) {
+        uint64_t epoch = __atomic_load_n(&state->threads[i].active_epoch, __ATOMIC_ACQUIRE);
+        if (epoch != 0 && epoch < min_active_epoch)
+            min_active_epoch = epoch;
+    }
+
+    for (slot = &state->retired; *slot != NULL;) {
+        struct st_context_handle_version_t *version = *slot;
+        int64_t count = 0;
+        if (version->retired_at < min_active_epoch) {
+            /* No thread can obtain the version any longer, therefore the counters can only decrease. Hence the sum is never
+             * smaller than the actual number of connections, even though the counters are not read at once. */
+            for (i = 0; i <= state->max_threads; ++i)
+                count += __atomic_load_n(&version->counts[i].value, __ATOMIC_ACQUIRE);
+        } else {
+            count = 1;
+        }
+        if (count == 0) {
+            *slot = version->next;
+            version->next = *released;
+            *released = version;
+        } else {
+            ++num_in_use;
+            slot = &version->next;
+        }
+    }
+
+    return num_in_use;
+}
+
+static void dispose_released(ptls_context_handle_t *self, struct st_context_handle_version_t *released)
+{
+    while (released != NULL) {
+        struct st_context_handle_version_t *version = released;
+        released = version->next;
+        dispose_version(self, version);
+    }
+}
+
+int ptls_context_handle_init(ptls_context_handle_t *self, size_t max_threads, ptls_context_t *ctx,
+                             void (*on_dispose)(ptls_context_handle_t *self, ptls_context_t *ctx))
+{
+    struct st_ptls_context_handle_state_t *state;
+    size_t i;
+
+    if (max_threads == 0)
+        return PTLS_ERROR_LIBRARY;
+    if ((state = malloc(sizeof(*state))) == NULL)
+        return PTLS_ERROR_NO_MEMORY;
+    *state = (struct st_ptls_context_handle_state_t){NULL, 1, .max_threads = max_threads};
+    if ((state->threads = calloc(max_threads, sizeof(state->threads[0]))) == NULL) {
+        free(state);
+        return PTLS_ERROR_NO_MEMORY;
+    }
+    for (i = 0; i != max_threads; ++i)
+        state->threads[i].state = state;
+    if (pthread_key_create(&state->thread_key, on_thread_exit) != 0) {
+        free(state->threads);
+        free(state);
+        return PTLS_ERROR_LIBRARY;
+    }
+    pthread_mutex_init(&state->mutex, NULL);
+    if ((state->current = new_version(state, ctx)) == NULL) {
+        pthread_mutex_destroy(&state->mutex);
+        pthread_key_delete(state->thread_key);
+        free(state->threads);
+        free(state);
+        return PTLS_ERROR_NO_MEMORY;
+    }
+
+    *self = (ptls_context_handle_t){on_dispose, state};
+    return 0;
+}
+
+void ptls_context_handle_dispose(ptls_context_handle_t *self)
+{
+    struct st_ptls_context_handle_state_t *state = self->_state;
+
+    if (state == NULL)
+        return;
+
+    pthread_key_delete(state->thread_key);
+    dispose_released(self, state->retired);
+    dispose_version(self, state->current);
+    pthread_mutex_destroy(&state->mutex);
+    free(state->threads);
+    free(state);
+    self->_state = NULL;
+}
+
+ptls_context_t *ptls_context_handle_enter(ptls_context_handle_t *self)
+{
+    struct st_ptls_context_handle_state_t *state = self->_state;
+    struct st_context_handle_thread_t *thread;
+
+    if ((thread = get_thread(state)) == NULL)
+        return NULL;
+
+    __atomic_store_n(&thread->active_epoch, __atomic_load_n(&state->epoch, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(&state->current, __ATOMIC_ACQUIRE)->ctx;
+}
+
+void ptls_context_handle_leave(ptls_context_handle_t *self)
+{
+    struct st_context_handle_thread_t *thread = pthread_getspecific(self->_state->thread_key);
+
+    /* the thread has failed to enter */
+    if (thread == NULL)
+        return;
+
+    __atomic_store_n(&thread->active_epoch, 0, __ATOMIC_RELEASE);
+}
+
+int ptls_context_handle_swap(ptls_context_handle_t *self, ptls_context_t *ctx)
+{
+    struct st_ptls_context_handle_state_t *state = self->_state;
+    struct st_context_handle_version_t *version, *old, *released = NULL;
+
+    if ((version = new_version(state, ctx)) == NULL)
+        return PTLS_ERROR_NO_MEMORY;
+
+    pthread_mutex_lock(&state->mutex);
+    old = state->current;
+    __atomic_store_n(&state->current, version, __ATOMIC_SEQ_CST);
+    old->retired_at = __atomic_fetch_add(&state->epoch, 1, __ATOMIC_SEQ_CST);
+    old->next = state->retired;
+    state->retired = old;
+    collect_unused(state, &released);
+    pthread_mutex_unlock(&state->mutex);
+
+    dispose_released(self, released);
+    return 0;
+}
+
+size_t ptls_context_handle_reclaim(ptls_context_handle_t *self)
+{
+    struct st_ptls_context_handle_state_t *state = self->_state;
+    struct st_context_handle_version_t *released = NULL;
+    size_t num_in_use;
+
+    pthread_mutex_lock(&state->mutex);
+    num_in_use = collect_unused(state, &released);
+    pthread_mutex_unlock(&state->mutex);
+
+    dispose_released(self, released);
+    return num_in_use;
+}
@@ -71,6 +71,20 @@ struct aesgcm_context {
      * retains the static IV in the upper 96 bits (in little endian)
      */
     __m128i static_iv;
+    /**
+     * state of the streaming interface; the payload is encrypted and fed into GHASH as it is supplied, with the bytes of the
+     * last partial block being retained until the block is completed or do_encrypt_final is called
+     */
+    struct {
+        __m128i ctr;
+        __m128i ek0;
+        __m128i ghash;
+        __m128i bits;
+        uint8_t partial[16];
+        size_t partial_len;
+        uint64_t aadlen;
+        uint64_t textlen;
+    } stream;
 };
 
 static const uint64_t poly_[2] __attribute__((aligned(16))) = {1, 0xc200000000000000};
@@ -228,8 +242,13 @@ static inline void storen(void *_p, size_t l, __m128i v)
         p[i] = buf[i];
 }
 
-void ptls_fusion_aesgcm_encrypt(ptls_fusion_aesgcm_context_t *ctx, void *output, const void *input, size_t inlen, __m128i ctr,
-                                const void *_aad, size_t aadlen, ptls_aead_supplementary_encryption_t *supp)
+/**
+ * Encrypts `inlen` bytes starting at `input`. If `tail_at` is non-NULL, it must point to a 96-byte boundary of `input`, and the
+ * payload from that point on is read from `tail` instead.
+ */
+static inline void aesgcm_encrypt(ptls_fusion_aesgcm_context_t *ctx, void *output, const void *input, size_t inlen,
+                                  const void *tail_at, const void *tail, __m128i ctr, const void *_aad, size_t aadlen,
+                                  ptls_aead_supplementary_encryption_t *supp)
 {
 /* init the bits (we can always run in full), but use the last slot for calculating ek0, if possible */
 #define AESECB6_INIT()                                                                                                             \
@@ -353,6 +372,8 @@ MainLoop:
         AESECB6_FINAL(i);
 
         /* apply the bit stream to src and write to dest */
+        if (PTLS_UNLIKELY((const void *)src == tail_at && tail_at != NULL))
+            src = tail;
         if (PTLS_LIKELY(srclen >= 6 * 16)) {
 #define APPLY(i) _mm_storeu_si128(dst + i, _mm_xor_si128(_mm_loadu_si128(src + i), bits##i))
             APPLY(0);
@@ -486,6 +507,39 @@ Finish:
 #undef STATE_SUPP_IN_PROCESS
 }
 
+void ptls_fusion_aesgcm_encrypt(ptls_fusion_aesgcm_context_t *ctx, void *output, const void *input, size_t inlen, __m128i ctr,
+                                const void *aad, size_t aadlen, ptls_aead_supplementary_encryption_t *supp)
+{
+    aesgcm_encrypt(ctx, output, input, inlen, NULL, NULL, ctr, aad, aadlen, supp);
+}
+
+void ptls_fusion_aesgcm_encrypt_with_trailer(ptls_fusion_aesgcm_context_t *ctx, void *output, const void *input, size_t inlen,
+                                             const void *trailer, size_t trailerlen, __m128i ctr, const void *aad, size_t aadlen,
+                                             ptls_aead_supplementary_encryption_t *supp)
+{
+    /* Only the bytes following the last 96-byte boundary that lies within `input` are gathered (along with the trailer) into a
+     * buffer; the rest of the payload is read in place. The buffer has 16 bytes of slack, as `loadn` may read a full block. */
+    uint8_t tail[6 * 16 + 16 + 16];
+    size_t len = inlen + trailerlen, tailoff;
+
+    assert(trailerlen <= 16);
+
+    if (trailerlen == 0) {
+        aesgcm_encrypt(ctx, output, input, inlen, NULL, NULL, ctr, aad, aadlen, supp);
+        return;
+    }
+
+    tailoff = (len - 1) / 96 * 96;
+    if (tailoff > inlen)
+        tailoff -= 96;
+    memcpy(tail, (const uint8_t *)input + tailoff, inlen - tailoff);
+    memcpy(tail + inlen - tailoff, trailer, trailerlen);
+
+    aesgcm_encrypt(ctx, output, input, len, (const uint8_t *)input + tailoff, tail, ctr, aad, aadlen, supp);
+
+    ptls_clear_memory(tail, len - tailoff);
+}
+
 int ptls_fusion_aesgcm_decrypt(ptls_fusion_aesgcm_context_t *ctx, void *output, const void *input, size_t inlen, __m128i ctr,
                                const void *_aad, size_t aadlen, const void *tag)
 {
@@ -764,24 +818,31 @@ static void setup_one_ghash_entry(ptls_fusion_aesgcm_context_t *ctx)
     ++ctx->ghash_cnt;
 }
 
-ptls_fusion_aesgcm_context_t *ptls_fusion_aesgcm_new(const void *key, size_t key_size, size_t capacity)
+/**
+ * (re)initializes the key schedule and fills `ghash_cnt` entries of the GHASH table, which must have been allocated
+ */
+static void aesgcm_setup_keys(ptls_fusion_aesgcm_context_t *ctx, const void *key, size_t key_size, size_t ghash_cnt)
 {
-    ptls_fusion_aesgcm_context_t *ctx;
-    size_t ghash_cnt = aesgcm_calc_ghash_cnt(capacity);
-
-    if ((ctx = malloc(sizeof(*ctx) + sizeof(ctx->ghash[0]) * ghash_cnt)) == NULL)
-        return NULL;
-
     ptls_fusion_aesecb_init(&ctx->ecb, 1, key, key_size);
 
-    ctx->capacity = capacity;
-
     ctx->ghash[0].H = aesecb_encrypt(&ctx->ecb, _mm_setzero_si128());
     ctx->ghash[0].H = _mm_shuffle_epi8(ctx->ghash[0].H, bswap8);
     ctx->ghash[0].H = transformH(ctx->ghash[0].H);
     ctx->ghash_cnt = 0;
     while (ctx->ghash_cnt < ghash_cnt)
         setup_one_ghash_entry(ctx);
+}
+
+ptls_fusion_aesgcm_context_t *ptls_fusion_aesgcm_new(const void *key, size_t key_size, size_t capacity)
+{
+    ptls_fusion_aesgcm_context_t *ctx;
+    size_t ghash_cnt = aesgcm_calc_ghash_cnt(capacity);
+
+    if ((ctx = malloc(sizeof(*ctx) + sizeof(ctx->ghash[0]) * ghash_cnt)) == NULL)
+        return NULL;
+
+    ctx->capacity = capacity;
+    aesgcm_setup_keys(ctx, key, key_size, ghash_cnt);
 
     return ctx;
 }
@@ -797,7 +858,7 @@ ptls_fusion_aesgcm_context_t *ptls_fusion_aesgcm_set_capacity(ptls_fusion_aesgcm
         return NULL;
 
     ctx->capacity = capacity;
-    while (ghash_cnt < ctx->ghash_cnt)
+    while (ctx->ghash_cnt < ghash_cnt)
         setup_one_ghash_entry(ctx);
 
     return ctx;
@@ -870,34 +931,157 @@ static void aesgcm_dispose_crypto(ptls_aead_context_t *_ctx)
     ptls_fusion_aesgcm_free(ctx->aesgcm);
 }
 
+static inline __m128i calc_counter(struct aesgcm_context *ctx, uint64_t seq)
+{
+    __m128i ctr = _mm_setzero_si128();
+    ctr = _mm_insert_epi64(ctr, seq, 0);
+    ctr = _mm_slli_si128(ctr, 4);
+    ctr = _mm_xor_si128(ctx->static_iv, ctr);
+    return ctr;
+}
+
+/**
+ * Updates the running GHASH value `Y` using the given blocks. Up to as many blocks as there are precomputed powers of H are
+ * multiplied at once, and the result is reduced only once for each such run.
+ */
+static __m128i aesgcm_stream_ghash(ptls_fusion_aesgcm_context_t *ctx, __m128i Y, const void *_src, size_t nblocks)
+{
+    const __m128i *src = _src;
+
+    while (nblocks != 0) {
+        size_t n = nblocks < ctx->ghash_cnt ? nblocks : ctx->ghash_cnt;
+        struct ptls_fusion_aesgcm_ghash_precompute *ghash_precompute = ctx->ghash + n;
+        struct ptls_fusion_gfmul_state gstate = {};
+        gfmul_onestep(&gstate, _mm_xor_si128(_mm_loadu_si128(src++), Y), --ghash_precompute);
+        for (size_t i = 1; i < n; ++i)
+            gfmul_onestep(&gstate, _mm_loadu_si128(src++), --ghash_precompute);
+        Y = gfmul_final(&gstate, _mm_setzero_si128());
+        nblocks -= n;
+    }
+
+    return Y;
+}
+
+/**
+ * Applies AES-CTR to the given blocks, encrypting six blocks in parallel.
+ */
+static void aesgcm_stream_ctr(struct aesgcm_context *ctx, void *_dst, const void *_src, size_t nblocks)
+{
+    ptls_fusion_aesecb_context_t *ecb = &ctx->aesgcm->ecb;
+    __m128i *dst = _dst;
+    const __m128i *src = _src;
+
+    while (nblocks != 0) {
+        __m128i bits[6];
+        size_t n = nblocks < 6 ? nblocks : 6, i, r;
+        for (i = 0; i < n; ++i) {
+            ctx->stream.ctr = _mm_add_epi64(ctx->stream.ctr, one8);
+            bits[i] = _mm_xor_si128(_mm_shuffle_epi8(ctx->stream.ctr, bswap8), ecb->keys[0]);
+        }
+        for (r = 1; r < ecb->rounds; ++r)
+            for (i = 0; i < n; ++i)
+                bits[i] = _mm_aesenc_si128(bits[i], ecb->keys[r]);
+        for (i = 0; i < n; ++i)
+            _mm_storeu_si128(dst + i, _mm_xor_si128(_mm_loadu_si128(src + i), _mm_aesenclast_si128(bits[i], ecb->keys[r])));
+        dst += n;
+        src += n;
+        nblocks -= n;
+    }
+}
+
 static void aead_do_encrypt_init(ptls_aead_context_t *_ctx, uint64_t seq, const void *aad, size_t aadlen)
 {
-    assert(!"FIXME");
+    struct aesgcm_context *ctx = (void *)_ctx;
+
+    ctx->stream.ctr = _mm_insert_epi32(calc_counter(ctx, seq), 1, 0);
+    ctx->stream.ek0 = aesecb_encrypt(&ctx->aesgcm->ecb, _mm_shuffle_epi8(ctx->stream.ctr, bswap8));
+    ctx->stream.ghash = aesgcm_stream_ghash(ctx->aesgcm, _mm_setzero_si128(), aad, aadlen / 16);
+    if (aadlen % 16 != 0) {
+        uint8_t last[16] = {0};
+        memcpy(last, (const uint8_t *)aad + aadlen / 16 * 16, aadlen % 16);
+        ctx->stream.ghash = aesgcm_stream_ghash(ctx->aesgcm, ctx->stream.ghash, last, 1);
+    }
+    ctx->stream.partial_len = 0;
+    ctx->stream.aadlen = aadlen;
+    ctx->stream.textlen = 0;
 }
 
-static size_t aead_do_encrypt_update(ptls_aead_context_t *_ctx, void *output, const void *input, size_t inlen)
+/**
+ * Emits the payload as it is being supplied. If `encrypt` is zero, the payload is authenticated but not encrypted (i.e., AES-GMAC).
+ */
+static size_t aesgcm_stream_update(struct aesgcm_context *ctx, uint8_t *output, const uint8_t *input, size_t inlen, int encrypt)
+{
+    size_t off = 0, nblocks;
+
+    ctx->stream.textlen += inlen;
+
+    /* complete the partial block */
+    if (ctx->stream.partial_len != 0) {
+        for (; ctx->stream.partial_len < 16 && off < inlen; ++off, ++ctx->stream.partial_len)
+            ctx->stream.partial[ctx->stream.partial_len] = output[off] =
+                input[off] ^ ((uint8_t *)&ctx->stream.bits)[ctx->stream.partial_len];
+        if (ctx->stream.partial_len < 16)
+            return inlen;
+        ctx->stream.ghash = aesgcm_stream_ghash(ctx->aesgcm, ctx->stream.ghash, ctx->stream.partial, 1);
+        ctx->stream.partial_len = 0;
+    }
+
+    /* full blocks */
+    if ((nblocks = (inlen - off) / 16) != 0) {
+        if (encrypt) {
+            aesgcm_stream_ctr(ctx, output + off, input + off, nblocks);
+        } else if (output != input) {
+            memmove(output + off, input + off, nblocks * 16);
+        }
+        ctx->stream.ghash = aesgcm_stream_ghash(ctx->aesgcm, ctx->stream.ghash, output + off, nblocks);
+        off += nblocks * 16;
+    }
+
+    /* start a partial block using the remaining bytes */
+    if (off < inlen) {
+        if (encrypt) {
+            ctx->stream.ctr = _mm_add_epi64(ctx->stream.ctr, one8);
+            ctx->stream.bits = aesecb_encrypt(&ctx->aesgcm->ecb, _mm_shuffle_epi8(ctx->stream.ctr, bswap8));
+        } else {
+            ctx->stream.bits = _mm_setzero_si128();
+        }
+        for (; off < inlen; ++off, ++ctx->stream.partial_len)
+            ctx->stream.partial[ctx->stream.partial_len] = output[off] =
+                input[off] ^ ((uint8_t *)&ctx->stream.bits)[ctx->stream.partial_len];
+    }
+
+    return inlen;
+}
+
+static size_t aesgcm_stream_final(struct aesgcm_context *ctx, void *output)
 {
-    assert(!"FIXME");
-    return SIZE_MAX;
+    if (ctx->stream.partial_len != 0) {
+        memset(ctx->stream.partial + ctx->stream.partial_len, 0, sizeof(ctx->stream.partial) - ctx->stream.partial_len);
+        ctx->stream.ghash = aesgcm_stream_ghash(ctx->aesgcm, ctx->stream.ghash, ctx->stream.partial, 1);
+    }
+    __m128i ac = _mm_shuffle_epi8(_mm_set_epi64x(ctx->stream.aadlen * 8, ctx->stream.textlen * 8), bswap8);
+    struct ptls_fusion_gfmul_state gstate = {};
+    gfmul_onestep(&gstate, _mm_xor_si128(ac, ctx->stream.ghash), ctx->aesgcm->ghash);
+    _mm_storeu_si128(output, gfmul_final(&gstate, ctx->stream.ek0));
+
+    ctx->stream.bits = _mm_setzero_si128();
+    ptls_clear_memory(ctx->stream.partial, sizeof(ctx->stream.partial));
+
+    return PTLS_AESGCM_TAG_SIZE;
 }
 
-static size_t aead_do_encrypt_final(ptls_aead_context_t *_ctx, void *_output)
+static size_t aead_do_encrypt_update(ptls_aead_context_t *_ctx, void *output, const void *input, size_t inlen)
 {
-    assert(!"FIXME");
-    return SIZE_MAX;
+    return aesgcm_stream_update((struct aesgcm_context *)_ctx, output, input, inlen, 1);
 }
 
-static inline __m128i calc_counter(struct aesgcm_context *ctx, uint64_t seq)
+static size_t aead_do_encrypt_final(ptls_aead_context_t *_ctx, void *output)
 {
-    __m128i ctr = _mm_setzero_si128();
-    ctr = _mm_insert_epi64(ctr, seq, 0);
-    ctr = _mm_slli_si128(ctr, 4);
-    ctr = _mm_xor_si128(ctx->static_iv, ctr);
-    return ctr;
+    return aesgcm_stream_final((struct aesgcm_context *)_ctx, output);
 }
 
-void aead_do_encrypt(struct st_ptls_aead_context_t *_ctx, void *output, const void *input, size_t inlen, uint64_t seq,
-                     const void *aad, size_t aadlen, ptls_aead_supplementary_encryption_t *supp)
+void ptls_fusion_aesgcm_aead_encrypt(ptls_aead_context_t *_ctx, void *output, const void *input, size_t inlen, uint64_t seq,
+                                     const void *aad, size_t aadlen, ptls_aead_supplementary_encryption_t *supp)
 {
     struct aesgcm_context *ctx = (void *)_ctx;
 
@@ -906,8 +1090,20 @@ void aead_do_encrypt(struct st_ptls_aead_context_t *_ctx, void *output, const vo
     ptls_fusion_aesgcm_encrypt(ctx->aesgcm, output, input, inlen, calc_counter(ctx, seq), aad, aadlen, supp);
 }
 
-static size_t aead_do_decrypt(ptls_aead_context_t *_ctx, void *output, const void *input, size_t inlen, uint64_t seq,
-                              const void *aad, size_t aadlen)
+void ptls_fusion_aesgcm_aead_encrypt_with_trailer(ptls_aead_context_t *_ctx, void *output, const void *input, size_t inlen,
+                                                  const void *trailer, size_t trailerlen, uint64_t seq, const void *aad,
+                                                  size_t aadlen)
+{
+    struct aesgcm_context *ctx = (void *)_ctx;
+
+    if (inlen + trailerlen + aadlen > ctx->aesgcm->capacity)
+        ctx->aesgcm = ptls_fusion_aesgcm_set_capacity(ctx->aesgcm, inlen + trailerlen + aadlen);
+    ptls_fusion_aesgcm_encrypt_with_trailer(ctx->aesgcm, output, input, inlen, trailer, trailerlen, calc_counter(ctx, seq), aad,
+                                            aadlen, NULL);
+}
+
+size_t ptls_fusion_aesgcm_aead_decrypt(ptls_aead_context_t *_ctx, void *output, const void *input, size_t inlen, uint64_t seq,
+                                       const void *aad, size_t aadlen)
 {
     struct aesgcm_context *ctx = (void *)_ctx;
 
@@ -923,6 +1119,33 @@ static size_t aead_do_decrypt(ptls_aead_context_t *_ctx, void *output, const voi
     return enclen;
 }
 
+static int aesgcm_do_recycle(ptls_aead_context_t *_ctx, int is_enc, const void *key, const void *iv)
+{
+    struct aesgcm_context *ctx = (struct aesgcm_context *)_ctx;
+
+    /* the GHASH table retains the size it has grown to; only the key-dependent values are cleared or recalculated, and the
+     * streaming state is discarded */
+    if (key == NULL) {
+        ctx->static_iv = _mm_setzero_si128();
+        ptls_clear_memory(ctx->aesgcm->ghash, sizeof(ctx->aesgcm->ghash[0]) * ctx->aesgcm->ghash_cnt);
+        ptls_fusion_aesecb_dispose(&ctx->aesgcm->ecb);
+        ptls_clear_memory(&ctx->stream, sizeof(ctx->stream));
+        return 0;
+    }
+
+    ctx->static_iv = loadn(iv, PTLS_AESGCM_IV_SIZE);
+    ctx->static_iv = _mm_shuffle_epi8(ctx->static_iv, bswap8);
+    aesgcm_setup_keys(ctx->aesgcm, key, ctx->super.algo->key_size, ctx->aesgcm->ghash_cnt);
+
+    return 0;
+}
+
+static size_t aesgcm_do_get_memory_size(ptls_aead_context_t *_ctx)
+{
+    struct aesgcm_context *ctx = (struct aesgcm_context *)_ctx;
+    return sizeof(*ctx->aesgcm) + sizeof(ctx->aesgcm->ghash[0]) * ctx->aesgcm->ghash_cnt;
+}
+
 static int aesgcm_setup(ptls_aead_context_t *_ctx, int is_enc, const void *key, const void *iv, size_t key_size)
 {
     struct aesgcm_context *ctx = (struct aesgcm_context *)_ctx;
@@ -936,8 +1159,10 @@ static int aesgcm_setup(ptls_aead_context_t *_ctx, int is_enc, const void *key,
     ctx->super.do_encrypt_init = aead_do_encrypt_init;
     ctx->super.do_encrypt_update = aead_do_encrypt_update;
     ctx->super.do_encrypt_final = aead_do_encrypt_final;
-    ctx->super.do_encrypt = aead_do_encrypt;
-    ctx->super.do_decrypt = aead_do_decrypt;
+    ctx->super.do_encrypt = ptls_fusion_aesgcm_aead_encrypt;
+    ctx->super.do_decrypt = ptls_fusion_aesgcm_aead_decrypt;
+    ctx->super.do_recycle = aesgcm_do_recycle;
+    ctx->super.do_get_memory_size = aesgcm_do_get_memory_size;
 
     ctx->aesgcm = ptls_fusion_aesgcm_new(key, key_size, 1500 /* assume ordinary packet size */);
 
@@ -954,6 +1179,102 @@ static int aes256gcm_setup(ptls_aead_context_t *ctx, int is_enc, const void *key
     return aesgcm_setup(ctx, is_enc, key, iv, PTLS_AES256_KEY_SIZE);
 }
 
+/**
+ * Calculates the AES-GMAC tag of the integrity-only AEAD, which is the AES-GCM tag that would be obtained if `input` were the
+ * ciphertext. As the payload is not encrypted, the cost is that of GHASH alone.
+ */
+static __m128i aesgmac_calc_tag(ptls_fusion_aesgcm_context_t *ctx, const void *input, size_t inlen, __m128i ctr, const void *aad,
+                                size_t aadlen)
+{
+    struct ptls_fusion_gfmul_state gstate = {};
+    __m128i ac = _mm_shuffle_epi8(_mm_set_epi32(0, (int)aadlen * 8, 0, (int)inlen * 8), bswap8);
+    struct ptls_fusion_aesgcm_ghash_precompute *ghash_precompute = ctx->ghash + (aadlen + 15) / 16 + (inlen + 15) / 16 + 1;
+    const __m128i *src;
+
+    /* ek0 is calculated first so that AES runs in parallel to GHASH */
+    ctr = _mm_add_epi64(ctr, one8);
+    __m128i ek0 = aesecb_encrypt(&ctx->ecb, _mm_shuffle_epi8(ctr, bswap8));
+
+    for (src = aad; aadlen >= 16; aadlen -= 16)
+        gfmul_onestep(&gstate, _mm_loadu_si128(src++), --ghash_precompute);
+    if (aadlen != 0)
+        gfmul_onestep(&gstate, loadn(src, aadlen), --ghash_precompute);
+    for (src = input; inlen >= 16; inlen -= 16)
+        gfmul_onestep(&gstate, _mm_loadu_si128(src++), --ghash_precompute);
+    if (inlen != 0)
+        gfmul_onestep(&gstate, loadn(src, inlen), --ghash_precompute);
+    gfmul_onestep(&gstate, ac, --ghash_precompute);
+
+    return gfmul_final(&gstate, ek0);
+}
+
+static void aesgmac_do_encrypt(ptls_aead_context_t *_ctx, void *output, const void *input, size_t inlen, uint64_t seq,
+                               const void *aad, size_t aadlen, ptls_aead_supplementary_encryption_t *supp)
+{
+    struct aesgcm_context *ctx = (void *)_ctx;
+
+    if (inlen + aadlen > ctx->aesgcm->capacity)
+        ctx->aesgcm = ptls_fusion_aesgcm_set_capacity(ctx->aesgcm, inlen + aadlen);
+    __m128i tag = aesgmac_calc_tag(ctx->aesgcm, input, inlen, calc_counter(ctx, seq), aad, aadlen);
+    if (output != input)
+        memmove(output, input, inlen);
+    _mm_storeu_si128((__m128i *)((uint8_t *)output + inlen), tag);
+
+    if (supp != NULL) {
+        ptls_cipher_init(supp->ctx, supp->input);
+        memset(supp->output, 0, sizeof(supp->output));
+        ptls_cipher_encrypt(supp->ctx, supp->output, supp->output, sizeof(supp->output));
+    }
+}
+
+static size_t aesgmac_do_encrypt_update(ptls_aead_context_t *_ctx, void *output, const void *input, size_t inlen)
+{
+    return aesgcm_stream_update((struct aesgcm_context *)_ctx, output, input, inlen, 0);
+}
+
+static size_t aesgmac_do_decrypt(ptls_aead_context_t *_ctx, void *output, const void *input, size_t inlen, uint64_t seq,
+                                 const void *aad, size_t aadlen)
+{
+    struct aesgcm_context *ctx = (void *)_ctx;
+
+    if (inlen < 16)
+        return SIZE_MAX;
+
+    size_t textlen = inlen - 16;
+    if (textlen + aadlen > ctx->aesgcm->capacity)
+        ctx->aesgcm = ptls_fusion_aesgcm_set_capacity(ctx->aesgcm, textlen + aadlen);
+    __m128i tag = aesgmac_calc_tag(ctx->aesgcm, input, textlen, calc_counter(ctx, seq), aad, aadlen);
+    if (!ptls_mem_equal(&tag, (const uint8_t *)input + textlen, 16))
+        return SIZE_MAX;
+    if (output != input)
+        memmove(output, input, textlen);
+    return textlen;
+}
+
+static int aesgmac_setup(ptls_aead_context_t *_ctx, int is_enc, const void *key, const void *iv, size_t key_size)
+{
+    struct aesgcm_context *ctx = (struct aesgcm_context *)_ctx;
+    int ret;
+
+    if ((ret = aesgcm_setup(&ctx->super, is_enc, key, iv, key_size)) != 0)
+        return ret;
+    ctx->super.do_encrypt_update = aesgmac_do_encrypt_update;
+    ctx->super.do_encrypt = aesgmac_do_encrypt;
+    ctx->super.do_decrypt = aesgmac_do_decrypt;
+
+    return 0;
+}
+
+static int aes128gmac_setup(ptls_aead_context_t *ctx, int is_enc, const void *key, const void *iv)
+{
+    return aesgmac_setup(ctx, is_enc, key, iv, PTLS_AES128_KEY_SIZE);
+}
+
+static int aes256gmac_setup(ptls_aead_context_t *ctx, int is_enc, const void *key, const void *iv)
+{
+    return aesgmac_setup(ctx, is_enc, key, iv, PTLS_AES256_KEY_SIZE);
+}
+
 ptls_cipher_algorithm_t ptls_fusion_aes128ctr = {"AES128-CTR",
                                                  PTLS_AES128_KEY_SIZE,
                                                  1, // block size
@@ -982,6 +1303,47 @@ ptls_aead_algorithm_t ptls_fusion_aes256gcm = {"AES256-GCM",
                                                PTLS_AESGCM_TAG_SIZE,
                                                sizeof(struct aesgcm_context),
                                                aes256gcm_setup};
+ptls_aead_algorithm_t ptls_fusion_aes128gmac = {"AES128-GMAC",
+                                                &ptls_fusion_aes128ctr,
+                                                NULL,
+                                                PTLS_AES128_KEY_SIZE,
+                                                PTLS_AESGCM_IV_SIZE,
+                                                PTLS_AESGCM_TAG_SIZE,
+                                                sizeof(struct aesgcm_context),
+                                                aes128gmac_setup};
+ptls_aead_algorithm_t ptls_fusion_aes256gmac = {"AES256-GMAC",
+                                                &ptls_fusion_aes256ctr,
+                                                NULL,
+                                                PTLS_AES256_KEY_SIZE,
+                                                PTLS_AESGCM_IV_SIZE,
+                                                PTLS_AESGCM_TAG_SIZE,
+                                                sizeof(struct aesgcm_context),
+                                                aes256gmac_setup};
+
+#define aegis_block_t __m128i
+#define aegis_load(p) _mm_loadu_si128((const __m128i *)(p))
+#define aegis_store(p, v) _mm_storeu_si128((__m128i *)(p), (v))
+#define aegis_xor _mm_xor_si128
+#define aegis_and _mm_and_si128
+#define aegis_round _mm_aesenc_si128
+#include "aegis-common.h"
+
+ptls_aead_algorithm_t ptls_fusion_aegis128l = {"AEGIS-128L",
+                                               &ptls_fusion_aes128ctr,
+                                               NULL,
+                                               PTLS_AEGIS128L_KEY_SIZE,
+                                               PTLS_AEGIS128L_IV_SIZE,
+                                               PTLS_AEGIS_TAG_SIZE,
+                                               sizeof(struct aegis128l_context_t),
+                                               aegis128l_setup_crypto};
+ptls_aead_algorithm_t ptls_fusion_aegis256 = {"AEGIS-256",
+                                              &ptls_fusion_aes256ctr,
+                                              NULL,
+                                              PTLS_AEGIS256_KEY_SIZE,
+                                              PTLS_AEGIS256_IV_SIZE,
+                                              PTLS_AEGIS_TAG_SIZE,
+                                              sizeof(struct aegis256_context_t),
+                                              aegis256_setup_crypto};
 
 int ptls_fusion_is_supported_by_cpu(void)
 {
@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+/*
+ * HPKE (RFC 9180), base mode with DHKEM. Only the single-shot setup functions are provided; the resulting AEAD context is used
+ * for sealing and opening, with the sequence number being passed as the nonce counter.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "picotls.h"
+
+#define HPKE_V1_LABEL "HPKE-v1"
+
+static void build_kem_suite_id(uint8_t *suite_id, ptls_hpke_kem_t *kem)
+{
+    memcpy(suite_id, "KEM", 3);
+    suite_id[3] = (uint8_t)(kem->id >> 8);
+    suite_id[4] = (uint8_t)kem->id;
+}
+
+static void build_hpke_suite_id(uint8_t *suite_id, ptls_hpke_kem_t *kem, ptls_hpke_cipher_suite_t *cipher)
+{
+    memcpy(suite_id, "HPKE", 4);
+    suite_id[4] = (uint8_t)(kem->id >> 8);
+    suite_id[5] = (uint8_t)kem->id;
+    suite_id[6] = (uint8_t)(cipher->id.kdf >> 8);
+    suite_id[7] = (uint8_t)cipher->id.kdf;
+    suite_id[8] = (uint8_t)(cipher->id.aead >> 8);
+    suite_id[9] = (uint8_t)cipher->id.aead;
+}
+
+static int labeled_extract(ptls_hash_algorithm_t *hash, ptls_iovec_t suite_id, void *secret, ptls_iovec_t salt, const char *label,
+                           ptls_iovec_t ikm)
+{
+    ptls_buffer_t labeled_ikm;
+    uint8_t smallbuf[64];
+    int ret;
+
+    ptls_buffer_init(&labeled_ikm, smallbuf, sizeof(smallbuf));
+    ptls_buffer_pushv(&labeled_ikm, HPKE_V1_LABEL, sizeof(HPKE_V1_LABEL) - 1);
+    ptls_buffer_pushv(&labeled_ikm, suite_id.base, suite_id.len);
+    ptls_buffer_pushv(&labeled_ikm, label, strlen(label));
+    ptls_buffer_pushv(&labeled_ikm, ikm.base, ikm.len);
+
+    ret = ptls_hkdf_extract(hash, secret, salt, ptls_iovec_init(labeled_ikm.base, labeled_ikm.off));
+
+Exit:
+    ptls_buffer_dispose(&labeled_ikm);
+    return ret;
+}
+
+static int labeled_expand(ptls_hash_algorithm_t *hash, ptls_iovec_t suite_id, void *output, size_t outlen, ptls_iovec_t prk,
+                          const char *label, ptls_iovec_t info)
+{
+    ptls_buffer_t labeled_info;
+    uint8_t smallbuf[256];
+    int ret;
+
+    assert(outlen < UINT16_MAX);
+
+    ptls_buffer_init(&labeled_info, smallbuf, sizeof(smallbuf));
+    ptls_buffer_push16(&labeled_info, (uint16_t)outlen);
+    ptls_buffer_pushv(&labeled_info, HPKE_V1_LABEL, sizeof(HPKE_V1_LABEL) - 1);
+    ptls_buffer_pushv(&labeled_info, suite_id.base, suite_id.len);
+    ptls_buffer_pushv(&labeled_info, label, strlen(label));
+    ptls_buffer_pushv(&labeled_info, info.base, info.len);
+
+    ret = ptls_hkdf_expand(hash, output, outlen, prk, ptls_iovec_init(labeled_info.base, labeled_info.off));
+
+Exit:
+    ptls_buffer_dispose(&labeled_info);
+    return ret;
+}
+
+/**
+ * ExtractAndExpand of DHKEM; the length of `shared_secret` is the digest size of the KEM hash (Nsecret)
+ */
+static int dh_derive(ptls_hpke_kem_t *kem, void *shared_secret, ptls_iovec_t dh, ptls_iovec_t enc, ptls_iovec_t pk_r)
+{
+    uint8_t suite_id[5], eae_prk[PTLS_MAX_DIGEST_SIZE], *kem_context;
+    int ret;
+
+    build_kem_suite_id(suite_id, kem);
+
+    if ((kem_context = malloc(enc.len + pk_r.len)) == NULL) {
+        ret = PTLS_ERROR_NO_MEMORY;
+        goto Exit;
+    }
+    memcpy(kem_context, enc.base, enc.len);
+    memcpy(kem_context + enc.len, pk_r.base, pk_r.len);
+
+    if ((ret = labeled_extract(kem->hash, ptls_iovec_init(suite_id, sizeof(suite_id)), eae_prk, ptls_iovec_init(NULL, 0),
+                               "eae_prk", dh)) != 0)
+        goto Exit;
+    if ((ret = labeled_expand(kem->hash, ptls_iovec_init(suite_id, sizeof(suite_id)), shared_secret, kem->hash->digest_size,
+                              ptls_iovec_init(eae_prk, kem->hash->digest_size), "shared_secret",
+                              ptls_iovec_init(kem_context, enc.len + pk_r.len))) != 0)
+        goto Exit;
+
+Exit:
+    free(kem_context);
+    ptls_clear_memory(eae_prk, sizeof(eae_prk));
+    return ret;
+}
+
+static int key_schedule(ptls_hpke_kem_t *kem, ptls_hpke_cipher_suite_t *cipher, ptls_aead_context_t **ctx, int is_enc,
+                        const void *shared_secret, ptls_iovec_t ks_context)
+{
+    uint8_t suite_id[10], secret[PTLS_MAX_DIGEST_SIZE], key[PTLS_MAX_SECRET_SIZE], base_nonce[PTLS_MAX_IV_SIZE];
+    int ret;
+
+    build_hpke_suite_id(suite_id, kem, cipher);
+    *ctx = NULL;
+
+    if ((ret = labeled_extract(cipher->hash, ptls_iovec_init(suite_id, sizeof(suite_id)), secret,
+                               ptls_iovec_init(shared_secret, kem->hash->digest_size), "secret", ptls_iovec_init(NULL, 0))) != 0)
+        goto Exit;
+    if ((ret = labeled_expand(cipher->hash, ptls_iovec_init(suite_id, sizeof(suite_id)), key, cipher->aead->key_size,
+                              ptls_iovec_init(secret, cipher->hash->digest_size), "key", ks_context)) != 0)
+        goto Exit;
+    if ((ret = labeled_expand(cipher->hash, ptls_iovec_init(suite_id, sizeof(suite_id)), base_nonce, cipher->aead->iv_size,
+                              ptls_iovec_init(secret, cipher->hash->digest_size), "base_nonce", ks_context)) != 0)
+        goto Exit;
+
+    if ((*ctx = ptls_aead_new_direct(cipher->aead, is_enc, key, base_nonce)) == NULL) {
+        ret = PTLS_ERROR_NO_MEMORY;
+        goto Exit;
+    }
+
+Exit:
+    ptls_clear_memory(secret, sizeof(secret));
+    ptls_clear_memory(key, sizeof(key));
+    ptls_clear_memory(base_nonce, sizeof(base_nonce));
+    return ret;
+}
+
+int ptls_hpke_key_schedule_context(ptls_hpke_kem_t *kem, ptls_hpke_cipher_suite_t *cipher, uint8_t *ks_context, ptls_iovec_t info)
+{
+    uint8_t suite_id[10];
+    int ret;
+
+    build_hpke_suite_id(suite_id, kem, cipher);
+
+    ks_context[0] = PTLS_HPKE_MODE_BASE;
+    if ((ret = labeled_extract(cipher->hash, ptls_iovec_init(suite_id, sizeof(suite_id)), ks_context + 1, ptls_iovec_init(NULL, 0),
+                               "psk_id_hash", ptls_iovec_init(NULL, 0))) != 0)
+        return ret;
+    if ((ret = labeled_extract(cipher->hash, ptls_iovec_init(suite_id, sizeof(suite_id)),
+                               ks_context + 1 + cipher->hash->digest_size, ptls_iovec_init(NULL, 0), "info_hash", info)) != 0)
+        return ret;
+
+    return 0;
+}
+
+int ptls_hpke_setup_base_s(ptls_hpke_kem_t *kem, ptls_hpke_cipher_suite_t *cipher, ptls_iovec_t *enc, ptls_aead_context_t **ctx,
+                           ptls_iovec_t pk_r, ptls_iovec_t info)
+{
+    ptls_iovec_t dh = {NULL};
+    uint8_t shared_secret[PTLS_MAX_DIGEST_SIZE], ks_context[PTLS_HPKE_MAX_KEY_SCHEDULE_CONTEXT_SIZE];
+    int ret;
+
+    *enc = (ptls_iovec_t){NULL};
+
+    if ((ret = kem->keyex->exchange(kem->keyex, enc, &dh, pk_r)) != 0)
+        goto Exit;
+    if ((ret = dh_derive(kem, shared_secret, dh, *enc, pk_r)) != 0)
+        goto Exit;
+    if ((ret = ptls_hpke_key_schedule_context(kem, cipher, ks_context, info)) != 0)
+        goto Exit;
+    if ((ret = key_schedule(kem, cipher, ctx, 1, shared_secret,
+                            ptls_iovec_init(ks_context, PTLS_HPKE_KEY_SCHEDULE_CONTEXT_SIZE(cipher)))) != 0)
+        goto Exit;
+
+Exit:
+    if (dh.base != NULL) {
+        ptls_clear_memory(dh.base, dh.len);
+        free(dh.base);
+    }
+    if (ret != 0) {
+        free(enc->base);
+        *enc = (ptls_iovec_t){NULL};
+    }
+    ptls_clear_memory(shared_secret, sizeof(shared_secret));
+    return ret;
+}
+
+int ptls_hpke_setup_base_r_precomputed(ptls_hpke_kem_t *kem, ptls_hpke_cipher_suite_t *cipher, ptls_key_exchange_context_t *keyex,
+                                       ptls_aead_context_t **ctx, ptls_iovec_t enc, ptls_iovec_t ks_context)
+{
+    ptls_iovec_t dh = {NULL};
+    uint8_t shared_secret[PTLS_MAX_DIGEST_SIZE];
+    int ret;
+
+    if ((ret = keyex->on_exchange(&keyex, 0, &dh, enc)) != 0)
+        goto Exit;
+    if ((ret = dh_derive(kem, shared_secret, dh, enc, keyex->pubkey)) != 0)
+        goto Exit;
+    if ((ret = key_schedule(kem, cipher, ctx, 0, shared_secret, ks_context)) != 0)
+        goto Exit;
+
+Exit:
+    if (dh.base != NULL) {
+        ptls_clear_memory(dh.base, dh.len);
+        free(dh.base);
+    }
+    ptls_clear_memory(shared_secret, sizeof(shared_secret));
+    return ret;
+}
+
+int ptls_hpke_setup_base_r(ptls_hpke_kem_t *kem, ptls_hpke_cipher_suite_t *cipher, ptls_key_exchange_context_t *keyex,
+                           ptls_aead_context_t **ctx, ptls_iovec_t enc, ptls_iovec_t info)
+{
+    uint8_t ks_context[PTLS_HPKE_MAX_KEY_SCHEDULE_CONTEXT_SIZE];
+    int ret;
+
+    if ((ret = ptls_hpke_key_schedule_context(kem, cipher, ks_context, info)) != 0)
+        return ret;
+    return ptls_hpke_setup_base_r_precomputed(kem, cipher, keyex, ctx, enc,
+                                              ptls_iovec_init(ks_context, PTLS_HPKE_KEY_SCHEDULE_CONTEXT_SIZE(cipher)));
+}
@@ -23,6 +23,7 @@
 #ifdef _WINDOWS
 #include "wincompat.h"
 #else
+#include <pthread.h>
 #include <unistd.h>
 #endif
 #include <assert.h>
@@ -36,6 +37,9 @@
 #include <openssl/err.h>
 #include <openssl/evp.h>
 #include <openssl/objects.h>
+#ifndef OPENSSL_NO_OCSP
+#include <openssl/ocsp.h>
+#endif
 #include <openssl/rand.h>
 #include <openssl/rsa.h>
 #include <openssl/x509.h>
@@ -64,6 +68,14 @@
 
 #define EVP_PKEY_up_ref(p) CRYPTO_add(&(p)->references, 1, CRYPTO_LOCK_EVP_PKEY)
 #define X509_STORE_up_ref(p) CRYPTO_add(&(p)->references, 1, CRYPTO_LOCK_X509_STORE)
+#define X509_STORE_lock(p) CRYPTO_w_lock(CRYPTO_LOCK_X509_STORE)
+#define X509_STORE_unlock(p) CRYPTO_w_unlock(CRYPTO_LOCK_X509_STORE)
+#define X509_STORE_get0_objects(p) ((p)->objs)
+#define X509_STORE_get0_param(p) ((p)->param)
+#define X509_STORE_get_verify_cb(p) ((p)->verify_cb)
+#define X509_OBJECT_get_type(p) ((p)->type)
+#define X509_OBJECT_get0_X509(p) ((p)->data.x509)
+#define X509_OBJECT_get0_X509_CRL(p) ((p)->data.crl)
 
 static HMAC_CTX *HMAC_CTX_new(void)
 {
@@ -97,6 +109,13 @@ void ptls_openssl_random_bytes(void *buf, size_t len)
     }
 }
 
+#if PTLS_OPENSSL_HAVE_CHACHA20_POLY1305
+void ptls_openssl_chacha20_random_bytes(void *buf, size_t len)
+{
+    ptls_chacha20_random_bytes(&ptls_openssl_chacha20, ptls_openssl_random_bytes, buf, len);
+}
+#endif
+
 static EC_KEY *ecdh_gerenate_key(EC_GROUP *group)
 {
     EC_KEY *key;
@@ -560,6 +579,194 @@ Exit:
 
 #endif
 
+#if PTLS_OPENSSL_HAVE_X25519MLKEM768
+
+/* X25519MLKEM768 (draft-kwiatkowski-tls-ecdhe-mlkem); the key shares and the shared secret are the concatenation of the ML-KEM-768
+ * part and the X25519 part, in that order. ML-KEM-768 is provided by OpenSSL 3.5 and above. */
+#define MLKEM768_PUBLIC_KEY_SIZE 1184
+#define MLKEM768_CIPHERTEXT_SIZE 1088
+#define MLKEM768_SHARED_SECRET_SIZE 32
+#define X25519_KEY_SIZE 32
+
+struct st_x25519mlkem768_context_t {
+    ptls_key_exchange_context_t super;
+    EVP_PKEY *mlkem;
+    ptls_key_exchange_context_t *x25519;
+    uint8_t pubkey[MLKEM768_PUBLIC_KEY_SIZE + X25519_KEY_SIZE];
+};
+
+static void x25519mlkem768_free(struct st_x25519mlkem768_context_t *ctx)
+{
+    if (ctx->mlkem != NULL)
+        EVP_PKEY_free(ctx->mlkem);
+    if (ctx->x25519 != NULL)
+        ctx->x25519->on_exchange(&ctx->x25519, 1, NULL, ptls_iovec_init(NULL, 0));
+    free(ctx);
+}
+
+static int x25519mlkem768_on_exchange(ptls_key_exchange_context_t **_ctx, int release, ptls_iovec_t *secret, ptls_iovec_t peerkey)
+{
+    struct st_x25519mlkem768_context_t *ctx = (void *)*_ctx;
+    EVP_PKEY_CTX *evpctx = NULL;
+    ptls_iovec_t x25519_secret = {NULL};
+    size_t mlkem_secret_len = MLKEM768_SHARED_SECRET_SIZE;
+    int ret;
+
+    if (secret == NULL) {
+        ret = 0;
+        goto Exit;
+    }
+
+    secret->base = NULL;
+
+    if (peerkey.len != MLKEM768_CIPHERTEXT_SIZE + X25519_KEY_SIZE) {
+        ret = PTLS_ALERT_DECRYPT_ERROR;
+        goto Exit;
+    }
+    if ((secret->base = malloc(MLKEM768_SHARED_SECRET_SIZE + X25519_KEY_SIZE)) == NULL) {
+        ret = PTLS_ERROR_NO_MEMORY;
+        goto Exit;
+    }
+
+    /* ML-KEM-768 */
+    if ((evpctx = EVP_PKEY_CTX_new_from_pkey(NULL, ctx->mlkem, NULL)) == NULL) {
+        ret = PTLS_ERROR_NO_MEMORY;
+        goto Exit;
+    }
+    if (EVP_PKEY_decapsulate_init(evpctx, NULL) <= 0 ||
+        EVP_PKEY_decapsulate(evpctx, secret->base, &mlkem_secret_len, peerkey.base, MLKEM768_CIPHERTEXT_SIZE) <= 0 ||
+        mlkem_secret_len != MLKEM768_SHARED_SECRET_SIZE) {
+        ret = PTLS_ERROR_LIBRARY;
+        goto Exit;
+    }
+
+    /* X25519 */
+    if ((ret = ctx->x25519->on_exchange(&ctx->x25519, 1, &x25519_secret,
+                                        ptls_iovec_init(peerkey.base + MLKEM768_CIPHERTEXT_SIZE, X25519_KEY_SIZE))) != 0)
+        goto Exit;
+    memcpy(secret->base + MLKEM768_SHARED_SECRET_SIZE, x25519_secret.base, X25519_KEY_SIZE);
+    secret->len = MLKEM768_SHARED_SECRET_SIZE + X25519_KEY_SIZE;
+
+    ret = 0;
+Exit:
+    if (evpctx != NULL)
+        EVP_PKEY_CTX_free(evpctx);
+    if (x25519_secret.base != NULL) {
+        ptls_clear_memory(x25519_secret.base, x25519_secret.len);
+        free(x25519_secret.base);
+    }
+    if (secret != NULL && ret != 0)
+        free(secret->base);
+    if (release) {
+        x25519mlkem768_free(ctx);
+        *_ctx = NULL;
+    }
+    return ret;
+}
+
+static int x25519mlkem768_create(ptls_key_exchange_algorithm_t *algo, ptls_key_exchange_context_t **_ctx)
+{
+    struct st_x25519mlkem768_context_t *ctx = NULL;
+    size_t pubkeylen = MLKEM768_PUBLIC_KEY_SIZE;
+    int ret;
+
+    if ((ctx = malloc(sizeof(*ctx))) == NULL) {
+        ret = PTLS_ERROR_NO_MEMORY;
+        goto Exit;
+    }
+    *ctx = (struct st_x25519mlkem768_context_t){{algo, {ctx->pubkey, sizeof(ctx->pubkey)}, x25519mlkem768_on_exchange}};
+
+    if ((ctx->mlkem = EVP_PKEY_Q_keygen(NULL, NULL, "ML-KEM-768")) == NULL ||
+        EVP_PKEY_get_raw_public_key(ctx->mlkem, ctx->pubkey, &pubkeylen) <= 0 || pubkeylen != MLKEM768_PUBLIC_KEY_SIZE) {
+        ret = PTLS_ERROR_LIBRARY;
+        goto Exit;
+    }
+    if ((ret = evp_keyex_create(&ptls_openssl_x25519, &ctx->x25519)) != 0)
+        goto Exit;
+    memcpy(ctx->pubkey + MLKEM768_PUBLIC_KEY_SIZE, ctx->x25519->pubkey.base, X25519_KEY_SIZE);
+
+    *_ctx = &ctx->super;
+    ret = 0;
+Exit:
+    if (ret != 0 && ctx != NULL)
+        x25519mlkem768_free(ctx);
+    return ret;
+}
+
+static int x25519mlkem768_exchange(ptls_key_exchange_algorithm_t *algo, ptls_iovec_t *outpubkey, ptls_iovec_t *secret,
+                                   ptls_iovec_t peerkey)
+{
+    EVP_PKEY *peer = NULL;
+    EVP_PKEY_CTX *evpctx = NULL;
+    ptls_iovec_t x25519_pubkey = {NULL}, x25519_secret = {NULL};
+    size_t ctlen = MLKEM768_CIPHERTEXT_SIZE, sslen = MLKEM768_SHARED_SECRET_SIZE;
+    int ret;
+
+    outpubkey->base = NULL;
+    secret->base = NULL;
+
+    if (peerkey.len != MLKEM768_PUBLIC_KEY_SIZE + X25519_KEY_SIZE) {
+        ret = PTLS_ALERT_DECRYPT_ERROR;
+        goto Exit;
+    }
+    if ((outpubkey->base = malloc(MLKEM768_CIPHERTEXT_SIZE + X25519_KEY_SIZE)) == NULL ||
+        (secret->base = malloc(MLKEM768_SHARED_SECRET_SIZE + X25519_KEY_SIZE)) == NULL) {
+        ret = PTLS_ERROR_NO_MEMORY;
+        goto Exit;
+    }
+
+    /* ML-KEM-768; the modulus check of the encapsulation key is performed by OpenSSL when the key is imported */
+    if ((peer = EVP_PKEY_new_raw_public_key_ex(NULL, "ML-KEM-768", NULL, peerkey.base, MLKEM768_PUBLIC_KEY_SIZE)) == NULL) {
+        ret = PTLS_ALERT_ILLEGAL_PARAMETER;
+        goto Exit;
+    }
+    if ((evpctx = EVP_PKEY_CTX_new_from_pkey(NULL, peer, NULL)) == NULL) {
+        ret = PTLS_ERROR_NO_MEMORY;
+        goto Exit;
+    }
+    if (EVP_PKEY_encapsulate_init(evpctx, NULL) <= 0 ||
+        EVP_PKEY_encapsulate(evpctx, outpubkey->base, &ctlen, secret->base, &sslen) <= 0 || ctlen != MLKEM768_CIPHERTEXT_SIZE ||
+        sslen != MLKEM768_SHARED_SECRET_SIZE) {
+        ret = PTLS_ERROR_LIBRARY;
+        goto Exit;
+    }
+
+    /* X25519 */
+    if ((ret = evp_keyex_exchange(&ptls_openssl_x25519, &x25519_pubkey, &x25519_secret,
+                                  ptls_iovec_init(peerkey.base + MLKEM768_PUBLIC_KEY_SIZE, X25519_KEY_SIZE))) != 0)
+        goto Exit;
+    memcpy(outpubkey->base + MLKEM768_CIPHERTEXT_SIZE, x25519_pubkey.base, X25519_KEY_SIZE);
+    memcpy(secret->base + MLKEM768_SHARED_SECRET_SIZE, x25519_secret.base, X25519_KEY_SIZE);
+    outpubkey->len = MLKEM768_CIPHERTEXT_SIZE + X25519_KEY_SIZE;
+    secret->len = MLKEM768_SHARED_SECRET_SIZE + X25519_KEY_SIZE;
+
+    ret = 0;
+Exit:
+    if (evpctx != NULL)
+        EVP_PKEY_CTX_free(evpctx);
+    if (peer != NULL)
+        EVP_PKEY_free(peer);
+    free(x25519_pubkey.base);
+    if (x25519_secret.base != NULL) {
+        ptls_clear_memory(x25519_secret.base, x25519_secret.len);
+        free(x25519_secret.base);
+    }
+    if (ret != 0) {
+        free(outpubkey->base);
+        outpubkey->base = NULL;
+        free(secret->base);
+        secret->base = NULL;
+    }
+    return ret;
+}
+
+#undef MLKEM768_PUBLIC_KEY_SIZE
+#undef MLKEM768_CIPHERTEXT_SIZE
+#undef MLKEM768_SHARED_SECRET_SIZE
+#undef X25519_KEY_SIZE
+
+#endif
+
 int ptls_openssl_create_key_exchange(ptls_key_exchange_context_t **ctx, EVP_PKEY *pkey)
 {
     int ret, id;
@@ -854,16 +1061,8 @@ static size_t aead_do_decrypt(ptls_aead_context_t *_ctx, void *_output, const vo
     return off;
 }
 
-static int aead_setup_crypto(ptls_aead_context_t *_ctx, int is_enc, const void *key, const void *iv, const EVP_CIPHER *cipher)
+static void aead_set_callbacks(struct aead_crypto_context_t *ctx, int is_enc)
 {
-    struct aead_crypto_context_t *ctx = (struct aead_crypto_context_t *)_ctx;
-    int ret;
-
-    memcpy(ctx->static_iv, iv, ctx->super.algo->iv_size);
-    if (key == NULL)
-        return 0;
-
-    ctx->super.dispose_crypto = aead_dispose_crypto;
     if (is_enc) {
         ctx->super.do_encrypt_init = aead_do_encrypt_init;
         ctx->super.do_encrypt_update = aead_do_encrypt_update;
@@ -874,8 +1073,46 @@ static int aead_setup_crypto(ptls_aead_context_t *_ctx, int is_enc, const void *
         ctx->super.do_encrypt_init = NULL;
         ctx->super.do_encrypt_update = NULL;
         ctx->super.do_encrypt_final = NULL;
+        ctx->super.do_encrypt = NULL;
         ctx->super.do_decrypt = aead_do_decrypt;
     }
+}
+
+static int aead_do_recycle(ptls_aead_context_t *_ctx, int is_enc, const void *key, const void *iv)
+{
+    static const uint8_t zero_key[PTLS_MAX_SECRET_SIZE] = {0};
+    struct aead_crypto_context_t *ctx = (struct aead_crypto_context_t *)_ctx;
+
+    /* when the context is being pooled, overwrite the key schedule, retaining the EVP_CIPHER_CTX */
+    if (key == NULL) {
+        ptls_clear_memory(ctx->static_iv, sizeof(ctx->static_iv));
+        EVP_CipherInit_ex(ctx->evp_ctx, NULL, NULL, zero_key, NULL, 1);
+        return 0;
+    }
+
+    memcpy(ctx->static_iv, iv, ctx->super.algo->iv_size);
+    aead_set_callbacks(ctx, is_enc);
+    if (!EVP_CipherInit_ex(ctx->evp_ctx, NULL, NULL, key, NULL, is_enc) ||
+        !EVP_CIPHER_CTX_ctrl(ctx->evp_ctx, EVP_CTRL_GCM_SET_IVLEN, (int)ctx->super.algo->iv_size, NULL)) {
+        aead_dispose_crypto(&ctx->super);
+        return PTLS_ERROR_LIBRARY;
+    }
+
+    return 0;
+}
+
+static int aead_setup_crypto(ptls_aead_context_t *_ctx, int is_enc, const void *key, const void *iv, const EVP_CIPHER *cipher)
+{
+    struct aead_crypto_context_t *ctx = (struct aead_crypto_context_t *)_ctx;
+    int ret;
+
+    memcpy(ctx->static_iv, iv, ctx->super.algo->iv_size);
+    if (key == NULL)
+        return 0;
+
+    ctx->super.dispose_crypto = aead_dispose_crypto;
+    ctx->super.do_recycle = aead_do_recycle;
+    aead_set_callbacks(ctx, is_enc);
     ctx->evp_ctx = NULL;
 
     if ((ctx->evp_ctx = EVP_CIPHER_CTX_new()) == NULL) {
@@ -1061,6 +1298,42 @@ void ptls_openssl_dispose_sign_certificate(ptls_openssl_sign_certificate_t *self
     EVP_PKEY_free(self->key);
 }
 
+/**
+ * creates a copy of the private key that does not share any state with the original, by serializing and parsing the key
+ */
+static EVP_PKEY *dup_private_key(EVP_PKEY *src)
+{
+    unsigned char *der = NULL;
+    const unsigned char *p;
+    EVP_PKEY *key = NULL;
+    int len;
+
+    if ((len = i2d_PrivateKey(src, &der)) <= 0)
+        goto Exit;
+    p = der;
+    key = d2i_PrivateKey(EVP_PKEY_id(src), NULL, &p, len);
+
+Exit:
+    if (der != NULL) {
+        OPENSSL_cleanse(der, len);
+        OPENSSL_free(der);
+    }
+    return key;
+}
+
+int ptls_openssl_clone_sign_certificate(ptls_openssl_sign_certificate_t *self, ptls_openssl_sign_certificate_t *src)
+{
+    EVP_PKEY *key;
+    int ret;
+
+    if ((key = dup_private_key(src->key)) == NULL)
+        return PTLS_ERROR_LIBRARY;
+    ret = ptls_openssl_init_sign_certificate(self, key);
+    EVP_PKEY_free(key);
+
+    return ret;
+}
+
 static int serialize_cert(X509 *cert, ptls_iovec_t *dst)
 {
     int len = i2d_X509(cert, NULL);
@@ -1263,6 +1536,125 @@ void ptls_openssl_dispose_verify_certificate(ptls_openssl_verify_certificate_t *
     X509_STORE_free(self->cert_store);
 }
 
+/**
+ * Creates a certificate store containing copies of the certificates and CRLs found in `src`, along with its verification
+ * parameters. The objects are collected while holding the lock of `src`, then added after releasing the lock, as OpenSSL 1.0.2 uses
+ * one global lock for all the stores.
+ */
+static X509_STORE *clone_certificate_store(X509_STORE *src)
+{
+    STACK_OF(X509_OBJECT) *objs;
+    STACK_OF(X509) *certs = NULL;
+    STACK_OF(X509_CRL) *crls = NULL;
+    X509_STORE *store = NULL;
+    int i, ok = 0;
+
+    if ((certs = sk_X509_new_null()) == NULL || (crls = sk_X509_CRL_new_null()) == NULL)
+        goto Exit;
+
+    X509_STORE_lock(src);
+    objs = X509_STORE_get0_objects(src);
+    for (i = 0; i < sk_X509_OBJECT_num(objs); ++i) {
+        X509_OBJECT *obj = sk_X509_OBJECT_value(objs, i);
+        X509 *cert;
+        X509_CRL *crl;
+        switch (X509_OBJECT_get_type(obj)) {
+        case X509_LU_X509:
+            if ((cert = X509_dup(X509_OBJECT_get0_X509(obj))) == NULL || !sk_X509_push(certs, cert)) {
+                X509_free(cert);
+                X509_STORE_unlock(src);
+                goto Exit;
+            }
+            break;
+        case X509_LU_CRL:
+            if ((crl = X509_CRL_dup(X509_OBJECT_get0_X509_CRL(obj))) == NULL || !sk_X509_CRL_push(crls, crl)) {
+                X509_CRL_free(crl);
+                X509_STORE_unlock(src);
+                goto Exit;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    X509_STORE_unlock(src);
+
+    if ((store = X509_STORE_new()) == NULL)
+        goto Exit;
+    if (X509_STORE_set1_param(store, X509_STORE_get0_param(src)) != 1)
+        goto Exit;
+    for (i = 0; i < sk_X509_num(certs); ++i)
+        if (X509_STORE_add_cert(store, sk_X509_value(certs, i)) != 1)
+            goto Exit;
+    for (i = 0; i < sk_X509_CRL_num(crls); ++i)
+        if (X509_STORE_add_crl(store, sk_X509_CRL_value(crls, i)) != 1)
+            goto Exit;
+    X509_STORE_set_verify_cb(store, X509_STORE_get_verify_cb(src));
+    ok = 1;
+
+Exit:
+    if (certs != NULL)
+        sk_X509_pop_free(certs, X509_free);
+    if (crls != NULL)
+        sk_X509_CRL_pop_free(crls, X509_CRL_free);
+    if (!ok && store != NULL) {
+        X509_STORE_free(store);
+        store = NULL;
+    }
+    return store;
+}
+
+int ptls_openssl_clone_verify_certificate(ptls_openssl_verify_certificate_t *self, ptls_openssl_verify_certificate_t *src)
+{
+    X509_STORE *store;
+    int ret;
+
+    if ((store = clone_certificate_store(src->cert_store)) == NULL)
+        return PTLS_ERROR_LIBRARY;
+    ret = ptls_openssl_init_verify_certificate(self, store);
+    X509_STORE_free(store);
+
+    return ret;
+}
+
+int ptls_openssl_init_context_replica(ptls_openssl_context_replica_t *self, const ptls_context_t *src, int clone_verifier)
+{
+    int ret;
+
+    *self = (ptls_openssl_context_replica_t){*src};
+
+    if (src->sign_certificate != NULL && src->sign_certificate->cb == sign_certificate) {
+        if ((ret = ptls_openssl_clone_sign_certificate(&self->sign_certificate, (void *)src->sign_certificate)) != 0)
+            goto Exit;
+        self->ctx.sign_certificate = &self->sign_certificate.super;
+    }
+    if (src->verify_certificate != NULL && src->verify_certificate->cb == verify_cert) {
+        ptls_openssl_verify_certificate_t *src_verifier = (void *)src->verify_certificate;
+        if ((ret = clone_verifier ? ptls_openssl_clone_verify_certificate(&self->verify_certificate, src_verifier)
+                                  : ptls_openssl_init_verify_certificate(&self->verify_certificate, src_verifier->cert_store)) != 0)
+            goto Exit;
+        self->ctx.verify_certificate = &self->verify_certificate.super;
+    }
+    ret = 0;
+
+Exit:
+    if (ret != 0)
+        ptls_openssl_dispose_context_replica(self);
+    return ret;
+}
+
+void ptls_openssl_dispose_context_replica(ptls_openssl_context_replica_t *self)
+{
+    if (self->ctx.sign_certificate == &self->sign_certificate.super) {
+        ptls_openssl_dispose_sign_certificate(&self->sign_certificate);
+        self->ctx.sign_certificate = NULL;
+    }
+    if (self->ctx.verify_certificate == &self->verify_certificate.super) {
+        ptls_openssl_dispose_verify_certificate(&self->verify_certificate);
+        self->ctx.verify_certificate = NULL;
+    }
+}
+
 X509_STORE *ptls_openssl_create_default_certificate_store(void)
 {
     X509_STORE *store;
@@ -1284,6 +1676,390 @@ Error:
     return NULL;
 }
 
+#if PTLS_OPENSSL_HAVE_OCSP_STAPLER
+
+#define OCSP_STAPLER_DEFAULT_RETRY_INTERVAL 60000
+/**
+ * permitted clock skew for thisUpdate, in milliseconds
+ */
+#define OCSP_STAPLER_MAX_CLOCK_SKEW 300000
+
+/**
+ * pre-encoded Certificate message carrying an OCSP response; shared between the handshakes being in flight
+ */
+struct st_ptls_openssl_ocsp_staple_t {
+    size_t refcnt;
+    uint64_t expires_at;
+    ptls_iovec_t message;
+};
+
+struct st_ptls_openssl_ocsp_stapler_state_t {
+    X509 *cert;
+    X509 *issuer;
+    ptls_iovec_t *certificates;
+    size_t num_certificates;
+    /**
+     * Certificate message sent when the client does not request the status or when no valid response is available
+     */
+    ptls_buffer_t without_status;
+    /**
+     * protects the fields below
+     */
+    pthread_mutex_t mutex;
+    struct st_ptls_openssl_ocsp_staple_t *staple;
+    uint64_t next_refresh_at;
+    /**
+     * signalled to stop the refresh thread
+     */
+    pthread_cond_t cond;
+    pthread_t thread;
+    unsigned thread_running : 1;
+    unsigned stopping : 1;
+};
+
+static void release_ocsp_staple(struct st_ptls_openssl_ocsp_stapler_state_t *state, struct st_ptls_openssl_ocsp_staple_t *staple)
+{
+    int do_free;
+
+    pthread_mutex_lock(&state->mutex);
+    do_free = --staple->refcnt == 0;
+    pthread_mutex_unlock(&state->mutex);
+
+    if (do_free)
+        free(staple);
+}
+
+static int emit_stapled_certificate(ptls_emit_certificate_t *_self, ptls_t *tls, ptls_message_emitter_t *emitter,
+                                    ptls_key_schedule_t *key_sched, ptls_iovec_t context, int push_status_request,
+                                    const uint16_t *compress_algos, size_t num_compress_algos)
+{
+    ptls_openssl_ocsp_stapler_t *self = (void *)_self;
+    struct st_ptls_openssl_ocsp_stapler_state_t *state = self->_state;
+    struct st_ptls_openssl_ocsp_staple_t *staple = NULL;
+    ptls_iovec_t message;
+    int ret;
+
+    /* the cached messages are built for the server's certificate chain that uses an empty context */
+    if (context.len != 0)
+        return PTLS_ERROR_DELEGATE;
+
+    if (push_status_request) {
+        uint64_t now = self->get_time->cb(self->get_time);
+        pthread_mutex_lock(&state->mutex);
+        if (state->staple != NULL && now < state->staple->expires_at) {
+            staple = state->staple;
+            ++staple->refcnt;
+        }
+        pthread_mutex_unlock(&state->mutex);
+    }
+
+    /* when there is nothing to staple, let the compressed emitter handle the clients that offer compression */
+    if (staple == NULL && num_compress_algos != 0 && self->compressed != NULL) {
+        if ((ret = self->compressed->cb(self->compressed, tls, emitter, key_sched, context, 0, compress_algos,
+                                        num_compress_algos)) != PTLS_ERROR_DELEGATE)
+            goto Exit;
+    }
+
+    message = staple != NULL ? staple->message : ptls_iovec_init(state->without_status.base, state->without_status.off);
+
+    ptls_push_message(emitter, key_sched, PTLS_HANDSHAKE_TYPE_CERTIFICATE,
+                      { ptls_buffer_pushv(emitter->buf, message.base, message.len); });
+
+    ret = 0;
+Exit:
+    if (staple != NULL)
+        release_ocsp_staple(state, staple);
+    return ret;
+}
+
+static int asn1_time_to_msec(uint64_t *msec, const ASN1_GENERALIZEDTIME *t)
+{
+    ASN1_TIME *epoch;
+    int days, secs, ok;
+
+    if ((epoch = ASN1_TIME_set(NULL, 0)) == NULL)
+        return 0;
+    ok = ASN1_TIME_diff(&days, &secs, epoch, t);
+    ASN1_TIME_free(epoch);
+    if (!ok || days < 0 || secs < 0)
+        return 0;
+
+    *msec = ((uint64_t)days * 86400 + secs) * 1000;
+    return 1;
+}
+
+/**
+ * validates the response and returns its expiration time (i.e., nextUpdate)
+ */
+static int validate_ocsp_response(struct st_ptls_openssl_ocsp_stapler_state_t *state, ptls_iovec_t resp, uint64_t now,
+                                  uint64_t *expires_at)
+{
+    const unsigned char *src = resp.base;
+    OCSP_RESPONSE *ocsp = NULL;
+    OCSP_BASICRESP *basic = NULL;
+    OCSP_CERTID *id = NULL;
+    STACK_OF(X509) *issuers = NULL;
+    X509_STORE *store = NULL;
+    ASN1_GENERALIZEDTIME *revoked_at, *this_update, *next_update;
+    int status, reason, ret;
+    uint64_t this_update_msec;
+
+    if ((ocsp = d2i_OCSP_RESPONSE(NULL, &src, (long)resp.len)) == NULL || src != resp.base + resp.len ||
+        OCSP_response_status(ocsp) != OCSP_RESPONSE_STATUS_SUCCESSFUL || (basic = OCSP_response_get1_basic(ocsp)) == NULL) {
+        ret = PTLS_ERROR_INVALID_OCSP_RESPONSE;
+        goto Exit;
+    }
+
+    /* the response is signed either by the issuer or by a responder certified by the issuer */
+    if ((store = X509_STORE_new()) == NULL || (issuers = sk_X509_new_null()) == NULL) {
+        ret = PTLS_ERROR_NO_MEMORY;
+        goto Exit;
+    }
+    if (!X509_STORE_add_cert(store, state->issuer) || !sk_X509_push(issuers, state->issuer)) {
+        ret = PTLS_ERROR_LIBRARY;
+        goto Exit;
+    }
+    X509_STORE_set_flags(store, X509_V_FLAG_PARTIAL_CHAIN);
+    if (OCSP_basic_verify(basic, issuers, store, 0) <= 0) {
+        ret = PTLS_ERROR_INVALID_OCSP_RESPONSE;
+        goto Exit;
+    }
+
+    /* check the status and the validity period */
+    if ((id = OCSP_cert_to_id(NULL, state->cert, state->issuer)) == NULL) {
+        ret = PTLS_ERROR_LIBRARY;
+        goto Exit;
+    }
+    if (!OCSP_resp_find_status(basic, id, &status, &reason, &revoked_at, &this_update, &next_update) ||
+        status != V_OCSP_CERTSTATUS_GOOD || next_update == NULL || !asn1_time_to_msec(&this_update_msec, this_update) ||
+        !asn1_time_to_msec(expires_at, next_update) || this_update_msec > now + OCSP_STAPLER_MAX_CLOCK_SKEW ||
+        *expires_at <= now) {
+        ret = PTLS_ERROR_INVALID_OCSP_RESPONSE;
+        goto Exit;
+    }
+
+    ret = 0;
+
+Exit:
+    if (id != NULL)
+        OCSP_CERTID_free(id);
+    if (issuers != NULL)
+        sk_X509_free(issuers);
+    if (store != NULL)
+        X509_STORE_free(store);
+    if (basic != NULL)
+        OCSP_BASICRESP_free(basic);
+    if (ocsp != NULL)
+        OCSP_RESPONSE_free(ocsp);
+    return ret;
+}
+
+int ptls_openssl_read_ocsp_response_file(ptls_openssl_fetch_ocsp_response_t *_self, ptls_iovec_t *resp, X509 *cert, X509 *issuer)
+{
+    ptls_openssl_ocsp_response_file_t *self = (void *)_self;
+    FILE *fp;
+    ptls_buffer_t buf;
+    int ret;
+
+    ptls_buffer_init(&buf, "", 0);
+
+    if ((fp = fopen(self->path, "rb")) == NULL) {
+        ret = PTLS_ERROR_NOT_AVAILABLE;
+        goto Exit;
+    }
+    while (1) {
+        size_t rret;
+        if ((ret = ptls_buffer_reserve(&buf, 4096)) != 0)
+            goto Exit;
+        if ((rret = fread(buf.base + buf.off, 1, buf.capacity - buf.off, fp)) == 0)
+            break;
+        buf.off += rret;
+    }
+    if (ferror(fp) || buf.off == 0) {
+        ret = PTLS_ERROR_NOT_AVAILABLE;
+        goto Exit;
+    }
+
+    /* hand over the buffer to the caller */
+    *resp = ptls_iovec_init(buf.base, buf.off);
+    ptls_buffer_init(&buf, "", 0);
+    ret = 0;
+
+Exit:
+    if (fp != NULL)
+        fclose(fp);
+    ptls_buffer_dispose(&buf);
+    return ret;
+}
+
+int ptls_openssl_refresh_ocsp_stapler(ptls_openssl_ocsp_stapler_t *self)
+{
+    struct st_ptls_openssl_ocsp_stapler_state_t *state = self->_state;
+    struct st_ptls_openssl_ocsp_staple_t *staple = NULL, *old = NULL;
+    ptls_iovec_t resp = {NULL};
+    ptls_buffer_t buf;
+    uint64_t now, expires_at, next_refresh_at;
+    int ret;
+
+    ptls_buffer_init(&buf, "", 0);
+
+    if ((ret = self->fetch->cb(self->fetch, &resp, state->cert, state->issuer)) != 0)
+        goto Exit;
+    now = self->get_time->cb(self->get_time);
+    if ((ret = validate_ocsp_response(state, resp, now, &expires_at)) != 0)
+        goto Exit;
+
+    /* build the Certificate message */
+    if ((ret = ptls_build_certificate_message(&buf, ptls_iovec_init(NULL, 0), state->certificates, state->num_certificates,
+                                              resp)) != 0)
+        goto Exit;
+    if ((staple = malloc(sizeof(*staple) + buf.off)) == NULL) {
+        ret = PTLS_ERROR_NO_MEMORY;
+        goto Exit;
+    }
+    *staple = (struct st_ptls_openssl_ocsp_staple_t){1, expires_at, ptls_iovec_init(staple + 1, buf.off)};
+    memcpy(staple->message.base, buf.base, buf.off);
+
+    /* schedule next refresh at the midpoint of the remaining validity period */
+    next_refresh_at = now + (expires_at - now) / 2;
+    if (next_refresh_at < now + self->retry_interval)
+        next_refresh_at = now + self->retry_interval;
+
+    /* swap */
+    pthread_mutex_lock(&state->mutex);
+    old = state->staple;
+    state->staple = staple;
+    state->next_refresh_at = next_refresh_at;
+    pthread_mutex_unlock(&state->mutex);
+    if (old != NULL)
+        release_ocsp_staple(state, old);
+
+    ret = 0;
+
+Exit:
+    if (ret != 0) {
+        pthread_mutex_lock(&state->mutex);
+        state->next_refresh_at = self->get_time->cb(self->get_time) + self->retry_interval;
+        pthread_mutex_unlock(&state->mutex);
+    }
+    ptls_buffer_dispose(&buf);
+    free(resp.base);
+    return ret;
+}
+
+static void *ocsp_stapler_thread_main(void *_self)
+{
+    ptls_openssl_ocsp_stapler_t *self = _self;
+    struct st_ptls_openssl_ocsp_stapler_state_t *state = self->_state;
+
+    pthread_mutex_lock(&state->mutex);
+    while (!state->stopping) {
+        uint64_t now = self->get_time->cb(self->get_time);
+        if (now < state->next_refresh_at) {
+            uint64_t wait_msec = state->next_refresh_at - now;
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += (time_t)(wait_msec / 1000);
+            deadline.tv_nsec += (long)(wait_msec % 1000) * 1000000;
+            if (deadline.tv_nsec >= 1000000000) {
+                ++deadline.tv_sec;
+                deadline.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&state->cond, &state->mutex, &deadline);
+            continue;
+        }
+        pthread_mutex_unlock(&state->mutex);
+        ptls_openssl_refresh_ocsp_stapler(self);
+        pthread_mutex_lock(&state->mutex);
+    }
+    pthread_mutex_unlock(&state->mutex);
+
+    return NULL;
+}
+
+int ptls_openssl_init_ocsp_stapler(ptls_openssl_ocsp_stapler_t *self, ptls_iovec_t *certificates, size_t num_certificates,
+                                   ptls_openssl_fetch_ocsp_response_t *fetch)
+{
+    struct st_ptls_openssl_ocsp_stapler_state_t *state;
+    const unsigned char *src;
+    int ret;
+
+    *self = (ptls_openssl_ocsp_stapler_t){{emit_stapled_certificate}, fetch, &ptls_get_time, OCSP_STAPLER_DEFAULT_RETRY_INTERVAL};
+
+    if (num_certificates < 2)
+        return PTLS_ERROR_INCOMPATIBLE_KEY;
+    if ((state = malloc(sizeof(*state))) == NULL)
+        return PTLS_ERROR_NO_MEMORY;
+    *state = (struct st_ptls_openssl_ocsp_stapler_state_t){.certificates = certificates, .num_certificates = num_certificates};
+    ptls_buffer_init(&state->without_status, "", 0);
+    pthread_mutex_init(&state->mutex, NULL);
+    pthread_cond_init(&state->cond, NULL);
+    self->_state = state;
+
+    src = certificates[0].base;
+    if ((state->cert = d2i_X509(NULL, &src, (long)certificates[0].len)) == NULL) {
+        ret = PTLS_ERROR_INCORRECT_ASN1_SYNTAX;
+        goto Exit;
+    }
+    src = certificates[1].base;
+    if ((state->issuer = d2i_X509(NULL, &src, (long)certificates[1].len)) == NULL) {
+        ret = PTLS_ERROR_INCORRECT_ASN1_SYNTAX;
+        goto Exit;
+    }
+    if ((ret = ptls_build_certificate_message(&state->without_status, ptls_iovec_init(NULL, 0), certificates, num_certificates,
+                                              ptls_iovec_init(NULL, 0))) != 0)
+        goto Exit;
+
+    ret = 0;
+
+Exit:
+    if (ret != 0)
+        ptls_openssl_dispose_ocsp_stapler(self);
+    return ret;
+}
+
+int ptls_openssl_start_ocsp_stapler(ptls_openssl_ocsp_stapler_t *self)
+{
+    struct st_ptls_openssl_ocsp_stapler_state_t *state = self->_state;
+
+    assert(!state->thread_running);
+
+    if (pthread_create(&state->thread, NULL, ocsp_stapler_thread_main, self) != 0)
+        return PTLS_ERROR_LIBRARY;
+    state->thread_running = 1;
+
+    return 0;
+}
+
+void ptls_openssl_dispose_ocsp_stapler(ptls_openssl_ocsp_stapler_t *self)
+{
+    struct st_ptls_openssl_ocsp_stapler_state_t *state = self->_state;
+
+    if (state == NULL)
+        return;
+
+    if (state->thread_running) {
+        pthread_mutex_lock(&state->mutex);
+        state->stopping = 1;
+        pthread_cond_signal(&state->cond);
+        pthread_mutex_unlock(&state->mutex);
+        pthread_join(state->thread, NULL);
+    }
+    if (state->staple != NULL)
+        release_ocsp_staple(state, state->staple);
+    if (state->cert != NULL)
+        X509_free(state->cert);
+    if (state->issuer != NULL)
+        X509_free(state->issuer);
+    ptls_buffer_dispose(&state->without_status);
+    pthread_cond_destroy(&state->cond);
+    pthread_mutex_destroy(&state->mutex);
+    free(state);
+    self->_state = NULL;
+}
+
+#endif
+
 #define TICKET_LABEL_SIZE 16
 #define TICKET_IV_SIZE EVP_MAX_IV_LENGTH
 
@@ -1430,6 +2206,10 @@ ptls_key_exchange_algorithm_t ptls_openssl_secp521r1 = {PTLS_GROUP_SECP521R1, x9
 #if PTLS_OPENSSL_HAVE_X25519
 ptls_key_exchange_algorithm_t ptls_openssl_x25519 = {PTLS_GROUP_X25519, evp_keyex_create, evp_keyex_exchange, NID_X25519};
 #endif
+#if PTLS_OPENSSL_HAVE_X25519MLKEM768
+ptls_key_exchange_algorithm_t ptls_openssl_x25519mlkem768 = {PTLS_GROUP_X25519MLKEM768, x25519mlkem768_create,
+                                                             x25519mlkem768_exchange};
+#endif
 ptls_key_exchange_algorithm_t *ptls_openssl_key_exchanges[] = {&ptls_openssl_secp256r1, NULL};
 ptls_cipher_algorithm_t ptls_openssl_aes128ecb = {
     "AES128-ECB",          PTLS_AES128_KEY_SIZE, PTLS_AES_BLOCK_SIZE, 0 /* iv size */, sizeof(struct cipher_context_t),
@@ -1481,12 +2261,68 @@ ptls_aead_algorithm_t ptls_openssl_chacha20poly1305 = {"CHACHA20-POLY1305",
 ptls_cipher_suite_t ptls_openssl_chacha20poly1305sha256 = {PTLS_CIPHER_SUITE_CHACHA20_POLY1305_SHA256,
                                                            &ptls_openssl_chacha20poly1305, &ptls_openssl_sha256};
 #endif
+static int integrity_sha256_setup_crypto(ptls_aead_context_t *ctx, int is_enc, const void *key, const void *iv)
+{
+    return ptls_integrity_only_aead_setup_crypto(ctx, key, iv, &ptls_openssl_sha256);
+}
+
+static int integrity_sha384_setup_crypto(ptls_aead_context_t *ctx, int is_enc, const void *key, const void *iv)
+{
+    return ptls_integrity_only_aead_setup_crypto(ctx, key, iv, &ptls_openssl_sha384);
+}
+
+ptls_aead_algorithm_t ptls_openssl_integrity_sha256 = {"HMAC-SHA256",
+                                                       NULL,
+                                                       NULL,
+                                                       PTLS_SHA256_DIGEST_SIZE,
+                                                       PTLS_SHA256_DIGEST_SIZE,
+                                                       PTLS_SHA256_DIGEST_SIZE,
+                                                       sizeof(ptls_integrity_only_aead_context_t),
+                                                       integrity_sha256_setup_crypto};
+ptls_aead_algorithm_t ptls_openssl_integrity_sha384 = {"HMAC-SHA384",
+                                                       NULL,
+                                                       NULL,
+                                                       PTLS_SHA384_DIGEST_SIZE,
+                                                       PTLS_SHA384_DIGEST_SIZE,
+                                                       PTLS_SHA384_DIGEST_SIZE,
+                                                       sizeof(ptls_integrity_only_aead_context_t),
+                                                       integrity_sha384_setup_crypto};
+ptls_cipher_suite_t ptls_openssl_sha256sha256 = {PTLS_CIPHER_SUITE_SHA256_SHA256, &ptls_openssl_integrity_sha256,
+                                                 &ptls_openssl_sha256};
+ptls_cipher_suite_t ptls_openssl_sha384sha384 = {PTLS_CIPHER_SUITE_SHA384_SHA384, &ptls_openssl_integrity_sha384,
+                                                 &ptls_openssl_sha384};
 ptls_cipher_suite_t *ptls_openssl_cipher_suites[] = {&ptls_openssl_aes256gcmsha384, &ptls_openssl_aes128gcmsha256,
 #if PTLS_OPENSSL_HAVE_CHACHA20_POLY1305
                                                      &ptls_openssl_chacha20poly1305sha256,
 #endif
                                                      NULL};
 
+ptls_hpke_kem_t ptls_openssl_hpke_kem_p256sha256 = {PTLS_HPKE_KEM_P256_SHA256, &ptls_openssl_secp256r1, &ptls_openssl_sha256};
+#if PTLS_OPENSSL_HAVE_X25519
+ptls_hpke_kem_t ptls_openssl_hpke_kem_x25519sha256 = {PTLS_HPKE_KEM_X25519_SHA256, &ptls_openssl_x25519, &ptls_openssl_sha256};
+#endif
+ptls_hpke_kem_t *ptls_openssl_hpke_kems[] = {
+#if PTLS_OPENSSL_HAVE_X25519
+    &ptls_openssl_hpke_kem_x25519sha256,
+#endif
+    &ptls_openssl_hpke_kem_p256sha256, NULL};
+ptls_hpke_cipher_suite_t ptls_openssl_hpke_aes128gcmsha256 = {
+    {PTLS_HPKE_HKDF_SHA256, PTLS_HPKE_AEAD_AES_128_GCM}, "HKDF-SHA256/AES-128-GCM", &ptls_openssl_sha256, &ptls_openssl_aes128gcm};
+ptls_hpke_cipher_suite_t ptls_openssl_hpke_aes256gcmsha384 = {
+    {PTLS_HPKE_HKDF_SHA384, PTLS_HPKE_AEAD_AES_256_GCM}, "HKDF-SHA384/AES-256-GCM", &ptls_openssl_sha384, &ptls_openssl_aes256gcm};
+#if PTLS_OPENSSL_HAVE_CHACHA20_POLY1305
+ptls_hpke_cipher_suite_t ptls_openssl_hpke_chacha20poly1305sha256 = {{PTLS_HPKE_HKDF_SHA256, PTLS_HPKE_AEAD_CHACHA20POLY1305},
+                                                                     "HKDF-SHA256/ChaCha20Poly1305",
+                                                                     &ptls_openssl_sha256,
+                                                                     &ptls_openssl_chacha20poly1305};
+#endif
+ptls_hpke_cipher_suite_t *ptls_openssl_hpke_cipher_suites[] = {&ptls_openssl_hpke_aes128gcmsha256,
+                                                               &ptls_openssl_hpke_aes256gcmsha384,
+#if PTLS_OPENSSL_HAVE_CHACHA20_POLY1305
+                                                               &ptls_openssl_hpke_chacha20poly1305sha256,
+#endif
+                                                               NULL};
+
 #if PTLS_OPENSSL_HAVE_BF
 ptls_cipher_algorithm_t ptls_openssl_bfecb = {"BF-ECB",        PTLS_BLOWFISH_KEY_SIZE,          PTLS_BLOWFISH_BLOCK_SIZE,
                                               0 /* iv size */, sizeof(struct cipher_context_t), bfecb_setup_crypto};
@@ -28,12 +28,16 @@
 #include "wincompat.h"
 #else
 #include <arpa/inet.h>
+#include <pthread.h>
 #include <sys/time.h>
 #endif
 #include "picotls.h"
 #if PICOTLS_USE_DTRACE
 #include "picotls-probes.h"
 #endif
+#if PTLS_RECORD_AEAD_FUSION
+#include "picotls/fusion.h"
+#endif
 
 #define PTLS_MAX_PLAINTEXT_RECORD_SIZE 16384
 #define PTLS_MAX_ENCRYPTED_RECORD_SIZE (16384 + 256)
@@ -57,13 +61,15 @@
 #define PTLS_EXTENSION_TYPE_SIGNATURE_ALGORITHMS 13
 #define PTLS_EXTENSION_TYPE_ALPN 16
 #define PTLS_EXTENSION_TYPE_COMPRESS_CERTIFICATE 27
+#define PTLS_EXTENSION_TYPE_RECORD_SIZE_LIMIT 28
 #define PTLS_EXTENSION_TYPE_PRE_SHARED_KEY 41
 #define PTLS_EXTENSION_TYPE_EARLY_DATA 42
 #define PTLS_EXTENSION_TYPE_SUPPORTED_VERSIONS 43
 #define PTLS_EXTENSION_TYPE_COOKIE 44
 #define PTLS_EXTENSION_TYPE_PSK_KEY_EXCHANGE_MODES 45
 #define PTLS_EXTENSION_TYPE_KEY_SHARE 51
-#define PTLS_EXTENSION_TYPE_ENCRYPTED_SERVER_NAME 0xffce
+#define PTLS_EXTENSION_TYPE_ECH_OUTER_EXTENSIONS 0xfd00
+#define PTLS_EXTENSION_TYPE_ENCRYPTED_CLIENT_HELLO 0xfe0d
 
 #define PTLS_PROTOCOL_VERSION_TLS13_FINAL 0x0304
 #define PTLS_PROTOCOL_VERSION_TLS13_DRAFT26 0x7f1a
@@ -79,9 +85,31 @@
 
 #define PTLS_EARLY_DATA_MAX_DELAY 10000 /* max. RTT (in msec) to permit early data */
 
+#define PTLS_ECH_INFO_PREFIX "tls ech"
+#define PTLS_ECH_CONFIRMATION_SERVER_HELLO "ech accept confirmation"
+#define PTLS_ECH_CONFIRMATION_HRR "hrr ech accept confirmation"
+
+/**
+ * Deployments that pin the record protection to one AEAD implementation can have the record layer specialized for it at compile
+ * time; records protected by that AEAD are encrypted and decrypted by a direct one-shot call with the tag size known as a constant,
+ * instead of going through the function pointers of ptls_aead_context_t. Other AEADs continue to use the generic path.
+ */
+#if PTLS_RECORD_AEAD_FUSION
+#define RECORD_AEAD_IS_SPECIALIZED(aead) ((aead)->algo == &ptls_fusion_aes128gcm || (aead)->algo == &ptls_fusion_aes256gcm)
+#define RECORD_AEAD_TAG_SIZE PTLS_AESGCM_TAG_SIZE
+#define RECORD_AEAD_ENCRYPT_WITH_TRAILER ptls_fusion_aesgcm_aead_encrypt_with_trailer
+#define RECORD_AEAD_DECRYPT ptls_fusion_aesgcm_aead_decrypt
+#endif
+
 #ifndef PTLS_MAX_EARLY_DATA_SKIP_SIZE
 #define PTLS_MAX_EARLY_DATA_SKIP_SIZE 65536
 #endif
+#ifndef PTLS_AEAD_POOL_SIZE
+#define PTLS_AEAD_POOL_SIZE 8
+#endif
+#ifndef PTLS_PARALLEL_RECORDS_PER_JOB
+#define PTLS_PARALLEL_RECORDS_PER_JOB 16
+#endif
 #if defined(PTLS_DEBUG) && PTLS_DEBUG
 #define PTLS_DEBUGF(...) fprintf(stderr, __VA_ARGS__)
 #else
@@ -127,6 +155,20 @@ struct st_ptls_traffic_protection_t {
     /* the following fields are not used if the key_change callback is set */
     ptls_aead_context_t *aead;
     uint64_t seq;
+    /**
+     * value of the record_size_limit extension (RFC 8449) applied to the records; for the sending side, it is the limit
+     * advertised by the peer, for the receiving side, the limit that we advertised. Zero if the extension was not negotiated.
+     */
+    uint16_t record_size_limit;
+    /**
+     * handshake record being filled by the record message emitter, to be encrypted when the key is changed or when the handshake
+     * function returns; consecutive handshake messages are thereby coalesced into as few records as possible. `buf` is NULL if
+     * there is no such record.
+     */
+    struct {
+        ptls_buffer_t *buf;
+        size_t rec_start;
+    } open_record;
 };
 
 struct st_ptls_record_message_emitter_t {
@@ -214,9 +256,25 @@ struct st_ptls_t {
      */
     uint8_t client_random[PTLS_HELLO_RANDOM_SIZE];
     /**
-     * esni
+     * Encrypted Client Hello
      */
-    ptls_esni_secret_t *esni;
+    struct st_ptls_ech_t {
+        ptls_hpke_kem_t *kem;
+        ptls_hpke_cipher_suite_t *cipher;
+        /**
+         * the HPKE context, retained until the (second) ClientHello is sent or received
+         */
+        ptls_aead_context_t *aead;
+        uint8_t config_id;
+        uint8_t inner_client_random[PTLS_HELLO_RANDOM_SIZE];
+        unsigned offered : 1;
+        unsigned accepted : 1;
+        struct {
+            ptls_iovec_t enc;
+            uint8_t max_name_length;
+            char *public_name;
+        } client;
+    } ech;
     /**
      * exporter master secret (either 0rtt or 1rtt)
      */
@@ -249,6 +307,10 @@ struct st_ptls_t {
         struct {
             uint8_t pending_traffic_secret[PTLS_MAX_DIGEST_SIZE];
             uint32_t early_data_skipped_bytes; /* if not UINT32_MAX, the server is skipping early data */
+            /**
+             * ticket encryption or decryption being run asynchronously, if any
+             */
+            struct st_ptls_async_ticket_t *async_ticket;
         } server;
     };
     /**
@@ -300,12 +362,12 @@ struct st_ptls_client_hello_t {
     struct st_ptls_signature_algorithms_t signature_algorithms;
     ptls_iovec_t server_name;
     struct {
-        ptls_cipher_suite_t *cipher; /* selected cipher-suite, or NULL if esni extension is not used */
-        ptls_key_exchange_algorithm_t *key_share;
-        ptls_iovec_t peer_key;
-        const uint8_t *record_digest;
-        ptls_iovec_t encrypted_sni;
-    } esni;
+        ptls_iovec_t payload; /* payload.base is non-NULL if the extension was found */
+        uint8_t type;
+        uint8_t config_id;
+        ptls_hpke_cipher_suite_id_t cipher_suite;
+        ptls_iovec_t enc;
+    } ech;
     struct {
         ptls_iovec_t list[16];
         size_t count;
@@ -336,6 +398,7 @@ struct st_ptls_client_hello_t {
         unsigned is_last_extension : 1;
     } psk;
     ptls_raw_extension_t unknown_extensions[MAX_UNKNOWN_EXTENSIONS + 1];
+    uint16_t record_size_limit;
     unsigned status_request : 1;
 };
 
@@ -348,6 +411,7 @@ struct st_ptls_server_hello_t {
         struct {
             uint16_t selected_group;
             ptls_iovec_t cookie;
+            const uint8_t *ech;
         } retry_request;
     };
 };
@@ -356,10 +420,17 @@ struct st_ptls_key_schedule_t {
     unsigned generation; /* early secret (1), hanshake secret (2), master secret (3) */
     const char *hkdf_label_prefix;
     uint8_t secret[PTLS_MAX_DIGEST_SIZE];
+    /**
+     * snapshot of the transcript hash (of `hashes[0].ctx`), memoized so that the secrets and the verify_data derived at the same
+     * point of the handshake share one hash finalization; invalidated by `key_schedule_transcript_changed` whenever the transcript
+     * is updated
+     */
+    uint8_t transcript_digest[PTLS_MAX_DIGEST_SIZE];
+    unsigned transcript_digest_is_valid : 1;
     size_t num_hashes;
     struct {
         ptls_hash_algorithm_t *algo;
-        ptls_hash_context_t *ctx;
+        ptls_hash_context_t *ctx, *ctx_outer;
     } hashes[1];
 };
 
@@ -462,6 +533,10 @@ static inline void init_extension_bitmap(struct st_ptls_extension_bitmap_t *bitm
         ALLOW(CLIENT_HELLO);
         ALLOW(SERVER_HELLO);
     });
+    EXT(RECORD_SIZE_LIMIT, {
+        ALLOW(CLIENT_HELLO);
+        ALLOW(ENCRYPTED_EXTENSIONS);
+    });
 
 #undef ALLOW
 #undef EXT
@@ -498,7 +573,8 @@ static uint64_t ntoh64(const uint8_t *src)
 
 void ptls_buffer__release_memory(ptls_buffer_t *buf)
 {
-    ptls_clear_memory(buf->base, buf->off);
+    if (!buf->is_nonsensitive)
+        ptls_clear_memory(buf->base, buf->off);
     if (buf->is_allocated)
         free(buf->base);
 }
@@ -631,6 +707,14 @@ static size_t aead_encrypt(struct st_ptls_traffic_protection_t *ctx, void *outpu
     uint8_t aad[5];
     size_t off = 0;
 
+#ifdef RECORD_AEAD_TAG_SIZE
+    if (PTLS_LIKELY(RECORD_AEAD_IS_SPECIALIZED(ctx->aead))) {
+        build_aad(aad, inlen + 1 + RECORD_AEAD_TAG_SIZE);
+        RECORD_AEAD_ENCRYPT_WITH_TRAILER(ctx->aead, output, input, inlen, &content_type, 1, ctx->seq++, aad, sizeof(aad));
+        return inlen + 1 + RECORD_AEAD_TAG_SIZE;
+    }
+#endif
+
     build_aad(aad, inlen + 1 + ctx->aead->algo->tag_size);
     ptls_aead_encrypt_init(ctx->aead, ctx->seq++, aad, sizeof(aad));
     off += ptls_aead_encrypt_update(ctx->aead, ((uint8_t *)output) + off, input, inlen);
@@ -645,6 +729,14 @@ static int aead_decrypt(struct st_ptls_traffic_protection_t *ctx, void *output,
     uint8_t aad[5];
 
     build_aad(aad, inlen);
+#ifdef RECORD_AEAD_TAG_SIZE
+    if (PTLS_LIKELY(RECORD_AEAD_IS_SPECIALIZED(ctx->aead))) {
+        if ((*outlen = RECORD_AEAD_DECRYPT(ctx->aead, output, input, inlen, ctx->seq, aad, sizeof(aad))) == SIZE_MAX)
+            return PTLS_ALERT_BAD_RECORD_MAC;
+        ++ctx->seq;
+        return 0;
+    }
+#endif
     if ((*outlen = ptls_aead_decrypt(ctx->aead, output, input, inlen, ctx->seq, aad, sizeof(aad))) == SIZE_MAX)
         return PTLS_ALERT_BAD_RECORD_MAC;
     ++ctx->seq;
@@ -659,15 +751,24 @@ static int aead_decrypt(struct st_ptls_traffic_protection_t *ctx, void *output,
         ptls_buffer_push_block((buf), 2, block);                                                                                   \
     } while (0)
 
+/**
+ * returns the maximum number of bytes that can be carried by one record being sent, honoring the peer's record_size_limit
+ */
+static size_t max_plaintext_record_size(struct st_ptls_traffic_protection_t *enc)
+{
+    return enc->record_size_limit != 0 ? enc->record_size_limit - 1 : PTLS_MAX_PLAINTEXT_RECORD_SIZE;
+}
+
 static int buffer_push_encrypted_records(ptls_buffer_t *buf, uint8_t type, const uint8_t *src, size_t len,
                                          struct st_ptls_traffic_protection_t *enc)
 {
+    size_t max_chunk_size = max_plaintext_record_size(enc);
     int ret = 0;
 
     while (len != 0) {
         size_t chunk_size = len;
-        if (chunk_size > PTLS_MAX_PLAINTEXT_RECORD_SIZE)
-            chunk_size = PTLS_MAX_PLAINTEXT_RECORD_SIZE;
+        if (chunk_size > max_chunk_size)
+            chunk_size = max_chunk_size;
         buffer_push_record(buf, PTLS_CONTENT_TYPE_APPDATA, {
             if ((ret = ptls_buffer_reserve(buf, chunk_size + enc->aead->algo->tag_size + 1)) != 0)
                 goto Exit;
@@ -688,7 +789,7 @@ static int buffer_encrypt_record(ptls_buffer_t *buf, size_t rec_start, struct st
     int ret;
 
     /* fast path: do in-place encryption if only one record needs to be emitted */
-    if (bodylen <= PTLS_MAX_PLAINTEXT_RECORD_SIZE) {
+    if (bodylen <= max_plaintext_record_size(enc)) {
         size_t overhead = 1 + enc->aead->algo->tag_size;
         if ((ret = ptls_buffer_reserve(buf, overhead)) != 0)
             return ret;
@@ -707,7 +808,8 @@ static int buffer_encrypt_record(ptls_buffer_t *buf, size_t rec_start, struct st
         goto Exit;
     }
     memcpy(tmpbuf, buf->base + rec_start + 5, bodylen);
-    ptls_clear_memory(buf->base + rec_start, bodylen + 5);
+    if (!buf->is_nonsensitive)
+        ptls_clear_memory(buf->base + rec_start, bodylen + 5);
     buf->off = rec_start;
 
     /* push encrypted records */
@@ -721,11 +823,33 @@ Exit:
     return ret;
 }
 
+static int flush_open_record(struct st_ptls_traffic_protection_t *enc)
+{
+    ptls_buffer_t *buf = enc->open_record.buf;
+
+    if (buf == NULL)
+        return 0;
+    enc->open_record.buf = NULL;
+    return buffer_encrypt_record(buf, enc->open_record.rec_start, enc);
+}
+
+static void discard_open_record(struct st_ptls_traffic_protection_t *enc)
+{
+    enc->open_record.buf = NULL;
+}
+
 static int begin_record_message(ptls_message_emitter_t *_self)
 {
     struct st_ptls_record_message_emitter_t *self = (void *)_self;
     int ret;
 
+    /* append to the record being open, if any */
+    if (self->super.enc->open_record.buf != NULL) {
+        assert(self->super.enc->open_record.buf == self->super.buf);
+        self->rec_start = self->super.enc->open_record.rec_start;
+        return 0;
+    }
+
     self->rec_start = self->super.buf->off;
     ptls_buffer_push(self->super.buf, PTLS_CONTENT_TYPE_HANDSHAKE, PTLS_RECORD_VERSION_MAJOR, PTLS_RECORD_VERSION_MINOR, 0, 0);
     ret = 0;
@@ -739,7 +863,10 @@ static int commit_record_message(ptls_message_emitter_t *_self)
     int ret;
 
     if (self->super.enc->aead != NULL) {
-        ret = buffer_encrypt_record(self->super.buf, self->rec_start, self->super.enc);
+        /* keep the record open for the messages that follow; it is split into records of maximum size when being encrypted */
+        self->super.enc->open_record.buf = self->super.buf;
+        self->super.enc->open_record.rec_start = self->rec_start;
+        ret = 0;
     } else {
         /* TODO allow CH,SH,HRR above 16KB */
         size_t sz = self->super.buf->off - self->rec_start - 5;
@@ -852,13 +979,20 @@ static void key_schedule_free(ptls_key_schedule_t *sched)
 {
     size_t i;
     ptls_clear_memory(sched->secret, sizeof(sched->secret));
-    for (i = 0; i != sched->num_hashes; ++i)
+    for (i = 0; i != sched->num_hashes; ++i) {
         sched->hashes[i].ctx->final(sched->hashes[i].ctx, NULL, PTLS_HASH_FINAL_MODE_FREE);
+        if (sched->hashes[i].ctx_outer != NULL)
+            sched->hashes[i].ctx_outer->final(sched->hashes[i].ctx_outer, NULL, PTLS_HASH_FINAL_MODE_FREE);
+    }
     free(sched);
 }
 
+/**
+ * Creates a key schedule. If `use_outer` is set, the transcript of ClientHelloOuter is tracked alongside that of ClientHelloInner,
+ * until the client learns if ECH has been accepted.
+ */
 static ptls_key_schedule_t *key_schedule_new(ptls_cipher_suite_t *preferred, ptls_cipher_suite_t **offered,
-                                             const char *hkdf_label_prefix)
+                                             const char *hkdf_label_prefix, int use_outer)
 {
 #define FOREACH_HASH(block)                                                                                                        \
     do {                                                                                                                           \
@@ -896,9 +1030,17 @@ static ptls_key_schedule_t *key_schedule_new(ptls_cipher_suite_t *preferred, ptl
 
     /* setup the hash algos and contexts */
     FOREACH_HASH({
-        sched->hashes[sched->num_hashes].algo = cs->hash;
-        if ((sched->hashes[sched->num_hashes].ctx = cs->hash->create()) == NULL)
+        ptls_hash_context_t *ctx;
+        ptls_hash_context_t *ctx_outer = NULL;
+        if ((ctx = cs->hash->create()) == NULL)
+            goto Fail;
+        if (use_outer && (ctx_outer = cs->hash->create()) == NULL) {
+            ctx->final(ctx, NULL, PTLS_HASH_FINAL_MODE_FREE);
             goto Fail;
+        }
+        sched->hashes[sched->num_hashes].algo = cs->hash;
+        sched->hashes[sched->num_hashes].ctx = ctx;
+        sched->hashes[sched->num_hashes].ctx_outer = ctx_outer;
         ++sched->num_hashes;
     });
 
@@ -931,6 +1073,23 @@ static int key_schedule_extract(ptls_key_schedule_t *sched, ptls_iovec_t ikm)
     return ret;
 }
 
+static void key_schedule_transcript_changed(ptls_key_schedule_t *sched)
+{
+    sched->transcript_digest_is_valid = 0;
+}
+
+/**
+ * Returns the snapshot of the transcript hash, calculating it only when the transcript has changed since the last call.
+ */
+static const uint8_t *key_schedule_transcript_digest(ptls_key_schedule_t *sched)
+{
+    if (!sched->transcript_digest_is_valid) {
+        sched->hashes[0].ctx->final(sched->hashes[0].ctx, sched->transcript_digest, PTLS_HASH_FINAL_MODE_SNAPSHOT);
+        sched->transcript_digest_is_valid = 1;
+    }
+    return sched->transcript_digest;
+}
+
 static int key_schedule_select_one(ptls_key_schedule_t *sched, ptls_cipher_suite_t *cs, int reset)
 {
     size_t found_slot = SIZE_MAX, i;
@@ -945,10 +1104,13 @@ static int key_schedule_select_one(ptls_key_schedule_t *sched, ptls_cipher_suite
             found_slot = i;
         } else {
             sched->hashes[i].ctx->final(sched->hashes[i].ctx, NULL, PTLS_HASH_FINAL_MODE_FREE);
+            if (sched->hashes[i].ctx_outer != NULL)
+                sched->hashes[i].ctx_outer->final(sched->hashes[i].ctx_outer, NULL, PTLS_HASH_FINAL_MODE_FREE);
         }
     }
     if (found_slot != 0) {
         sched->hashes[0] = sched->hashes[found_slot];
+        key_schedule_transcript_changed(sched);
         reset = 1;
     }
     sched->num_hashes = 1;
@@ -971,8 +1133,51 @@ void ptls__key_schedule_update_hash(ptls_key_schedule_t *sched, const uint8_t *m
     size_t i;
 
     PTLS_DEBUGF("%s:%zu\n", __FUNCTION__, msglen);
-    for (i = 0; i != sched->num_hashes; ++i)
+    key_schedule_transcript_changed(sched);
+    for (i = 0; i != sched->num_hashes; ++i) {
         sched->hashes[i].ctx->update(sched->hashes[i].ctx, msg, msglen);
+        if (sched->hashes[i].ctx_outer != NULL)
+            sched->hashes[i].ctx_outer->update(sched->hashes[i].ctx_outer, msg, msglen);
+    }
+}
+
+/**
+ * updates only one of the two transcripts being tracked while sending ClientHelloInner and ClientHelloOuter
+ */
+static void key_schedule_update_ech_hash(ptls_key_schedule_t *sched, const uint8_t *msg, size_t msglen, int outer)
+{
+    size_t i;
+
+    PTLS_DEBUGF("%s:%zu,%d\n", __FUNCTION__, msglen, outer);
+    if (!outer)
+        key_schedule_transcript_changed(sched);
+    for (i = 0; i != sched->num_hashes; ++i) {
+        ptls_hash_context_t *ctx = outer ? sched->hashes[i].ctx_outer : sched->hashes[i].ctx;
+        ctx->update(ctx, msg, msglen);
+    }
+}
+
+/**
+ * Settles the transcript once the client learns if ECH has been accepted; the transcript of ClientHelloOuter replaces that of
+ * ClientHelloInner if `use_outer` is set.
+ */
+static void key_schedule_select_transcript(ptls_key_schedule_t *sched, int use_outer)
+{
+    size_t i;
+
+    if (use_outer)
+        key_schedule_transcript_changed(sched);
+    for (i = 0; i != sched->num_hashes; ++i) {
+        if (sched->hashes[i].ctx_outer == NULL)
+            continue;
+        if (use_outer) {
+            sched->hashes[i].ctx->final(sched->hashes[i].ctx, NULL, PTLS_HASH_FINAL_MODE_FREE);
+            sched->hashes[i].ctx = sched->hashes[i].ctx_outer;
+        } else {
+            sched->hashes[i].ctx_outer->final(sched->hashes[i].ctx_outer, NULL, PTLS_HASH_FINAL_MODE_FREE);
+        }
+        sched->hashes[i].ctx_outer = NULL;
+    }
 }
 
 static void key_schedule_update_ch1hash_prefix(ptls_key_schedule_t *sched)
@@ -984,16 +1189,62 @@ static void key_schedule_update_ch1hash_prefix(ptls_key_schedule_t *sched)
 static void key_schedule_extract_ch1hash(ptls_key_schedule_t *sched, uint8_t *hash)
 {
     sched->hashes[0].ctx->final(sched->hashes[0].ctx, hash, PTLS_HASH_FINAL_MODE_RESET);
+    key_schedule_transcript_changed(sched);
 }
 
 static void key_schedule_transform_post_ch1hash(ptls_key_schedule_t *sched)
 {
-    uint8_t ch1hash[PTLS_MAX_DIGEST_SIZE];
+    size_t digest_size = sched->hashes[0].algo->digest_size;
+    ptls_hash_context_t *hashes[] = {sched->hashes[0].ctx, sched->hashes[0].ctx_outer, NULL}, **hash;
+    uint8_t prefix[4] = {PTLS_HANDSHAKE_TYPE_MESSAGE_HASH, 0, 0, (uint8_t)digest_size}, ch1hash[PTLS_MAX_DIGEST_SIZE];
+
+    assert(sched->num_hashes == 1);
+
+    key_schedule_transcript_changed(sched);
+
+    /* transform each of the transcripts being tracked (i.e., the inner and the outer, if ECH is in flight) */
+    for (hash = hashes; *hash != NULL; ++hash) {
+        (*hash)->final(*hash, ch1hash, PTLS_HASH_FINAL_MODE_RESET);
+        (*hash)->update(*hash, prefix, sizeof(prefix));
+        (*hash)->update(*hash, ch1hash, digest_size);
+    }
+}
+
+/**
+ * Calculates the confirmation of ECH acceptance. The transcript is that being tracked by `sched`, followed by `message` with the
+ * PTLS_ECH_CONFIRM_LENGTH bytes at `confirm_off` replaced by zeros. `output` may point to those bytes.
+ */
+static int ech_calc_confirmation(ptls_key_schedule_t *sched, void *output, const uint8_t *inner_random, const char *label,
+                                 ptls_iovec_t message, size_t confirm_off)
+{
+    ptls_hash_context_t *hash;
+    uint8_t secret[PTLS_MAX_DIGEST_SIZE], transcript_hash[PTLS_MAX_DIGEST_SIZE];
+    int ret;
 
-    key_schedule_extract_ch1hash(sched, ch1hash);
+    assert(confirm_off + PTLS_ECH_CONFIRM_LENGTH <= message.len);
+
+    /* calc transcript hash, zeroing the confirmation */
+    if ((hash = sched->hashes[0].ctx->clone_(sched->hashes[0].ctx)) == NULL)
+        return PTLS_ERROR_NO_MEMORY;
+    hash->update(hash, message.base, confirm_off);
+    hash->update(hash, zeroes_of_max_digest_size, PTLS_ECH_CONFIRM_LENGTH);
+    hash->update(hash, message.base + confirm_off + PTLS_ECH_CONFIRM_LENGTH,
+                 message.len - confirm_off - PTLS_ECH_CONFIRM_LENGTH);
+    hash->final(hash, transcript_hash, PTLS_HASH_FINAL_MODE_FREE);
+
+    /* HKDF-Expand-Label(HKDF-Extract(0, ClientHelloInner.random), label, transcript_hash, 8) */
+    if ((ret = ptls_hkdf_extract(sched->hashes[0].algo, secret, ptls_iovec_init(NULL, 0),
+                                 ptls_iovec_init(inner_random, PTLS_HELLO_RANDOM_SIZE))) != 0)
+        goto Exit;
+    if ((ret = hkdf_expand_label(sched->hashes[0].algo, output, PTLS_ECH_CONFIRM_LENGTH,
+                                 ptls_iovec_init(secret, sched->hashes[0].algo->digest_size), label,
+                                 ptls_iovec_init(transcript_hash, sched->hashes[0].algo->digest_size), sched->hkdf_label_prefix)) !=
+        0)
+        goto Exit;
 
-    key_schedule_update_ch1hash_prefix(sched);
-    ptls__key_schedule_update_hash(sched, ch1hash, sched->hashes[0].algo->digest_size);
+Exit:
+    ptls_clear_memory(secret, sizeof(secret));
+    return ret;
 }
 
 static int derive_secret_with_hash(ptls_key_schedule_t *sched, void *secret, const char *label, const uint8_t *hash)
@@ -1008,12 +1259,7 @@ static int derive_secret_with_hash(ptls_key_schedule_t *sched, void *secret, con
 
 static int derive_secret(ptls_key_schedule_t *sched, void *secret, const char *label)
 {
-    uint8_t hash_value[PTLS_MAX_DIGEST_SIZE];
-
-    sched->hashes[0].ctx->final(sched->hashes[0].ctx, hash_value, PTLS_HASH_FINAL_MODE_SNAPSHOT);
-    int ret = derive_secret_with_hash(sched, secret, label, hash_value);
-    ptls_clear_memory(hash_value, sizeof(hash_value));
-    return ret;
+    return derive_secret_with_hash(sched, secret, label, key_schedule_transcript_digest(sched));
 }
 
 static int derive_secret_with_empty_digest(ptls_key_schedule_t *sched, void *secret, const char *label)
@@ -1191,9 +1437,13 @@ static int setup_traffic_protection(ptls_t *tls, int is_enc, const char *secret_
         {NULL, "CLIENT_EARLY_TRAFFIC_SECRET", "CLIENT_HANDSHAKE_TRAFFIC_SECRET", "CLIENT_TRAFFIC_SECRET_0"},
         {NULL, NULL, "SERVER_HANDSHAKE_TRAFFIC_SECRET", "SERVER_TRAFFIC_SECRET_0"}};
     struct st_ptls_traffic_protection_t *ctx = is_enc ? &tls->traffic_protection.enc : &tls->traffic_protection.dec;
+    int ret;
+
+    /* messages being coalesced are sent using the current key */
+    if (is_enc && (ret = flush_open_record(ctx)) != 0)
+        return ret;
 
     if (secret_label != NULL) {
-        int ret;
         if ((ret = derive_secret(tls->key_schedule, ctx->secret, secret_label)) != 0)
             return ret;
     }
@@ -1244,6 +1494,56 @@ static inline void log_client_random(ptls_t *tls)
 
 #define SESSION_IDENTIFIER_MAGIC "ptls0001" /* the number should be changed upon incompatible format change */
 #define SESSION_IDENTIFIER_MAGIC_SIZE (sizeof(SESSION_IDENTIFIER_MAGIC) - 1)
+/**
+ * The compact format starts with this version byte instead of the magic. It stores the issue time in seconds and the server name
+ * and ALPN as-is only if they are short, or else as truncated digests (see `push_compact_session_identifier_name`).
+ */
+#define SESSION_IDENTIFIER_COMPACT_VERSION 1
+#define SESSION_IDENTIFIER_COMPACT_DIGEST_SIZE 8
+#define SESSION_IDENTIFIER_COMPACT_IS_DIGEST 0x80
+
+/**
+ * server name or ALPN being stored in a session identifier
+ */
+struct st_session_identifier_name_t {
+    ptls_iovec_t value;
+    /**
+     * if `value` is the first SESSION_IDENTIFIER_COMPACT_DIGEST_SIZE bytes of the digest rather than the name itself
+     */
+    unsigned is_digest : 1;
+};
+
+struct st_session_identifier_t {
+    uint64_t issued_at;
+    ptls_iovec_t psk;
+    uint32_t ticket_age_add;
+    uint16_t key_exchange_id;
+    uint16_t csid;
+    struct st_session_identifier_name_t server_name;
+    struct st_session_identifier_name_t negotiated_protocol;
+};
+
+static int push_compact_session_identifier_name(ptls_buffer_t *buf, ptls_hash_algorithm_t *hash, const char *name)
+{
+    size_t len = name != NULL ? strlen(name) : 0;
+    int ret;
+
+    if (len <= SESSION_IDENTIFIER_COMPACT_DIGEST_SIZE) {
+        ptls_buffer_push(buf, (uint8_t)len);
+        if (len != 0)
+            ptls_buffer_pushv(buf, name, len);
+    } else {
+        uint8_t digest[PTLS_MAX_DIGEST_SIZE];
+        if ((ret = ptls_calc_hash(hash, digest, name, len)) != 0)
+            goto Exit;
+        ptls_buffer_push(buf, SESSION_IDENTIFIER_COMPACT_IS_DIGEST | SESSION_IDENTIFIER_COMPACT_DIGEST_SIZE);
+        ptls_buffer_pushv(buf, digest, SESSION_IDENTIFIER_COMPACT_DIGEST_SIZE);
+    }
+    ret = 0;
+
+Exit:
+    return ret;
+}
 
 static int encode_session_identifier(ptls_context_t *ctx, ptls_buffer_t *buf, uint32_t ticket_age_add, ptls_iovec_t ticket_nonce,
                                      ptls_key_schedule_t *sched, const char *server_name, uint16_t key_exchange_id, uint16_t csid,
@@ -1253,11 +1553,19 @@ static int encode_session_identifier(ptls_context_t *ctx, ptls_buffer_t *buf, ui
 
     ptls_buffer_push_block(buf, 2, {
         /* format id */
-        ptls_buffer_pushv(buf, SESSION_IDENTIFIER_MAGIC, SESSION_IDENTIFIER_MAGIC_SIZE);
+        if (ctx->use_compact_session_ticket) {
+            ptls_buffer_push(buf, SESSION_IDENTIFIER_COMPACT_VERSION);
+        } else {
+            ptls_buffer_pushv(buf, SESSION_IDENTIFIER_MAGIC, SESSION_IDENTIFIER_MAGIC_SIZE);
+        }
         /* date */
-        ptls_buffer_push64(buf, ctx->get_time->cb(ctx->get_time));
+        if (ctx->use_compact_session_ticket) {
+            ptls_buffer_push32(buf, (uint32_t)(ctx->get_time->cb(ctx->get_time) / 1000));
+        } else {
+            ptls_buffer_push64(buf, ctx->get_time->cb(ctx->get_time));
+        }
         /* resumption master secret */
-        ptls_buffer_push_block(buf, 2, {
+        ptls_buffer_push_block(buf, ctx->use_compact_session_ticket ? 1 : 2, {
             if ((ret = ptls_buffer_reserve(buf, sched->hashes[0].algo->digest_size)) != 0)
                 goto Exit;
             if ((ret = derive_resumption_secret(sched, buf->base + buf->off, ticket_nonce)) != 0)
@@ -1270,55 +1578,99 @@ static int encode_session_identifier(ptls_context_t *ctx, ptls_buffer_t *buf, ui
         ptls_buffer_push16(buf, csid);
         /* ticket_age_add */
         ptls_buffer_push32(buf, ticket_age_add);
-        /* server-name */
-        ptls_buffer_push_block(buf, 2, {
-            if (server_name != NULL)
-                ptls_buffer_pushv(buf, server_name, strlen(server_name));
-        });
-        /* alpn */
-        ptls_buffer_push_block(buf, 1, {
-            if (negotiated_protocol != NULL)
-                ptls_buffer_pushv(buf, negotiated_protocol, strlen(negotiated_protocol));
-        });
+        if (ctx->use_compact_session_ticket) {
+            /* server-name and alpn */
+            if ((ret = push_compact_session_identifier_name(buf, sched->hashes[0].algo, server_name)) != 0)
+                goto Exit;
+            if ((ret = push_compact_session_identifier_name(buf, sched->hashes[0].algo, negotiated_protocol)) != 0)
+                goto Exit;
+        } else {
+            /* server-name */
+            ptls_buffer_push_block(buf, 2, {
+                if (server_name != NULL)
+                    ptls_buffer_pushv(buf, server_name, strlen(server_name));
+            });
+            /* alpn */
+            ptls_buffer_push_block(buf, 1, {
+                if (negotiated_protocol != NULL)
+                    ptls_buffer_pushv(buf, negotiated_protocol, strlen(negotiated_protocol));
+            });
+        }
     });
 
 Exit:
     return ret;
 }
 
-int decode_session_identifier(uint64_t *issued_at, ptls_iovec_t *psk, uint32_t *ticket_age_add, ptls_iovec_t *server_name,
-                              uint16_t *key_exchange_id, uint16_t *csid, ptls_iovec_t *negotiated_protocol, const uint8_t *src,
-                              const uint8_t *const end)
+static int decode_compact_session_identifier_name(struct st_session_identifier_name_t *name, const uint8_t **src,
+                                                  const uint8_t *const end)
+{
+    size_t len;
+
+    if (*src == end)
+        return PTLS_ALERT_DECODE_ERROR;
+    name->is_digest = (**src & SESSION_IDENTIFIER_COMPACT_IS_DIGEST) != 0;
+    len = **src & ~SESSION_IDENTIFIER_COMPACT_IS_DIGEST;
+    ++*src;
+    if (len > SESSION_IDENTIFIER_COMPACT_DIGEST_SIZE || (name->is_digest && len != SESSION_IDENTIFIER_COMPACT_DIGEST_SIZE) ||
+        end - *src < len)
+        return PTLS_ALERT_DECODE_ERROR;
+    name->value = ptls_iovec_init(*src, len);
+    *src += len;
+
+    return 0;
+}
+
+static int decode_session_identifier(struct st_session_identifier_t *id, const uint8_t *src, const uint8_t *const end)
 {
     int ret = 0;
 
     ptls_decode_block(src, end, 2, {
-        if (end - src < SESSION_IDENTIFIER_MAGIC_SIZE ||
-            memcmp(src, SESSION_IDENTIFIER_MAGIC, SESSION_IDENTIFIER_MAGIC_SIZE) != 0) {
+        uint32_t issued_at_sec;
+        int is_compact;
+        if (end - src >= 1 && *src == SESSION_IDENTIFIER_COMPACT_VERSION) {
+            is_compact = 1;
+            ++src;
+            if ((ret = ptls_decode32(&issued_at_sec, &src, end)) != 0)
+                goto Exit;
+            id->issued_at = (uint64_t)issued_at_sec * 1000;
+        } else if (end - src >= SESSION_IDENTIFIER_MAGIC_SIZE &&
+                   memcmp(src, SESSION_IDENTIFIER_MAGIC, SESSION_IDENTIFIER_MAGIC_SIZE) == 0) {
+            is_compact = 0;
+            src += SESSION_IDENTIFIER_MAGIC_SIZE;
+            if ((ret = ptls_decode64(&id->issued_at, &src, end)) != 0)
+                goto Exit;
+        } else {
             ret = PTLS_ALERT_DECODE_ERROR;
             goto Exit;
         }
-        src += SESSION_IDENTIFIER_MAGIC_SIZE;
-        if ((ret = ptls_decode64(issued_at, &src, end)) != 0)
-            goto Exit;
-        ptls_decode_open_block(src, end, 2, {
-            *psk = ptls_iovec_init(src, end - src);
+        ptls_decode_open_block(src, end, is_compact ? 1 : 2, {
+            id->psk = ptls_iovec_init(src, end - src);
             src = end;
         });
-        if ((ret = ptls_decode16(key_exchange_id, &src, end)) != 0)
+        if ((ret = ptls_decode16(&id->key_exchange_id, &src, end)) != 0)
             goto Exit;
-        if ((ret = ptls_decode16(csid, &src, end)) != 0)
+        if ((ret = ptls_decode16(&id->csid, &src, end)) != 0)
             goto Exit;
-        if ((ret = ptls_decode32(ticket_age_add, &src, end)) != 0)
+        if ((ret = ptls_decode32(&id->ticket_age_add, &src, end)) != 0)
             goto Exit;
-        ptls_decode_open_block(src, end, 2, {
-            *server_name = ptls_iovec_init(src, end - src);
-            src = end;
-        });
-        ptls_decode_open_block(src, end, 1, {
-            *negotiated_protocol = ptls_iovec_init(src, end - src);
-            src = end;
-        });
+        if (is_compact) {
+            if ((ret = decode_compact_session_identifier_name(&id->server_name, &src, end)) != 0)
+                goto Exit;
+            if ((ret = decode_compact_session_identifier_name(&id->negotiated_protocol, &src, end)) != 0)
+                goto Exit;
+        } else {
+            id->server_name.is_digest = 0;
+            ptls_decode_open_block(src, end, 2, {
+                id->server_name.value = ptls_iovec_init(src, end - src);
+                src = end;
+            });
+            id->negotiated_protocol.is_digest = 0;
+            ptls_decode_open_block(src, end, 1, {
+                id->negotiated_protocol.value = ptls_iovec_init(src, end - src);
+                src = end;
+            });
+        }
     });
 
 Exit:
@@ -1333,7 +1685,7 @@ static size_t build_certificate_verify_signdata(uint8_t *data, ptls_key_schedule
     datalen += 64;
     memcpy(data + datalen, context_string, strlen(context_string) + 1);
     datalen += strlen(context_string) + 1;
-    sched->hashes[0].ctx->final(sched->hashes[0].ctx, data + datalen, PTLS_HASH_FINAL_MODE_SNAPSHOT);
+    memcpy(data + datalen, key_schedule_transcript_digest(sched), sched->hashes[0].algo->digest_size);
     datalen += sched->hashes[0].algo->digest_size;
     assert(datalen <= PTLS_MAX_CERTIFICATE_VERIFY_SIGNDATA_SIZE);
 
@@ -1355,10 +1707,11 @@ static int calc_verify_data(void *output, ptls_key_schedule_t *sched, const void
         return PTLS_ERROR_NO_MEMORY;
     }
 
-    sched->hashes[0].ctx->final(sched->hashes[0].ctx, digest, PTLS_HASH_FINAL_MODE_SNAPSHOT);
-    PTLS_DEBUGF("%s: %02x%02x,%02x%02x\n", __FUNCTION__, ((uint8_t *)secret)[0], ((uint8_t *)secret)[1], digest[0], digest[1]);
-    hmac->update(hmac, digest, sched->hashes[0].algo->digest_size);
     ptls_clear_memory(digest, sizeof(digest));
+    const uint8_t *transcript_digest = key_schedule_transcript_digest(sched);
+    PTLS_DEBUGF("%s: %02x%02x,%02x%02x\n", __FUNCTION__, ((uint8_t *)secret)[0], ((uint8_t *)secret)[1], transcript_digest[0],
+                transcript_digest[1]);
+    hmac->update(hmac, transcript_digest, sched->hashes[0].algo->digest_size);
     hmac->final(hmac, output, PTLS_HASH_FINAL_MODE_FREE);
 
     return 0;
@@ -1403,17 +1756,89 @@ Exit:
     return ret;
 }
 
+/**
+ * state of the ticket encryption or decryption for which the callback has returned PTLS_ERROR_ASYNC_OPERATION
+ */
+struct st_ptls_async_ticket_t {
+    unsigned is_encrypt : 1;
+    /**
+     * if the result has been supplied by `ptls_set_ticket_result`
+     */
+    unsigned is_complete : 1;
+    int status;
+    ptls_buffer_t output;
+    /**
+     * when decrypting, the ClientHello being processed and the index of the PSK identity being decrypted
+     */
+    ptls_buffer_t client_hello;
+    size_t psk_index;
+    /**
+     * when encrypting, ticket_age_add of the ticket being issued
+     */
+    uint32_t ticket_age_add;
+};
+
+static struct st_ptls_async_ticket_t *new_async_ticket(ptls_t *tls, int is_encrypt)
+{
+    struct st_ptls_async_ticket_t *async;
+
+    assert(tls->is_server && tls->server.async_ticket == NULL);
+
+    if ((async = malloc(sizeof(*async))) == NULL)
+        return NULL;
+    *async = (struct st_ptls_async_ticket_t){is_encrypt};
+    ptls_buffer_init(&async->output, "", 0);
+    ptls_buffer_init(&async->client_hello, "", 0);
+
+    tls->server.async_ticket = async;
+    return async;
+}
+
+static void free_async_ticket(ptls_t *tls)
+{
+    struct st_ptls_async_ticket_t *async = tls->server.async_ticket;
+
+    ptls_buffer_dispose(&async->output);
+    ptls_buffer_dispose(&async->client_hello);
+    free(async);
+    tls->server.async_ticket = NULL;
+}
+
+static int push_new_session_ticket(ptls_t *tls, ptls_message_emitter_t *emitter, uint32_t ticket_age_add, ptls_iovec_t ticket)
+{
+    int ret;
+
+    ptls_push_message(emitter, NULL, PTLS_HANDSHAKE_TYPE_NEW_SESSION_TICKET, {
+        ptls_buffer_push32(emitter->buf, tls->ctx->ticket_lifetime);
+        ptls_buffer_push32(emitter->buf, ticket_age_add);
+        ptls_buffer_push_block(emitter->buf, 1, {});
+        ptls_buffer_push_block(emitter->buf, 2, { ptls_buffer_pushv(emitter->buf, ticket.base, ticket.len); });
+        ptls_buffer_push_block(emitter->buf, 2, {
+            if (tls->ctx->max_early_data_size != 0)
+                buffer_push_extension(emitter->buf, PTLS_EXTENSION_TYPE_EARLY_DATA,
+                                      { ptls_buffer_push32(emitter->buf, tls->ctx->max_early_data_size); });
+        });
+    });
+
+Exit:
+    return ret;
+}
+
 static int send_session_ticket(ptls_t *tls, ptls_message_emitter_t *emitter)
 {
     ptls_hash_context_t *msghash_backup = tls->key_schedule->hashes[0].ctx->clone_(tls->key_schedule->hashes[0].ctx);
-    ptls_buffer_t session_id;
+    ptls_buffer_t session_id, ticket;
     char session_id_smallbuf[128];
+    uint8_t ticket_smallbuf[256];
     uint32_t ticket_age_add;
     int ret = 0;
 
     assert(tls->ctx->ticket_lifetime != 0);
     assert(tls->ctx->encrypt_ticket != NULL);
 
+    ptls_buffer_init(&session_id, session_id_smallbuf, sizeof(session_id_smallbuf));
+    ptls_buffer_init(&ticket, ticket_smallbuf, sizeof(ticket_smallbuf));
+
     { /* calculate verify-data that will be sent by the client */
         size_t orig_off = emitter->buf->off;
         if (tls->pending_handshake_secret != NULL && !tls->ctx->omit_end_of_early_data) {
@@ -1436,36 +1861,64 @@ static int send_session_ticket(ptls_t *tls, ptls_message_emitter_t *emitter)
     tls->ctx->random_bytes(&ticket_age_add, sizeof(ticket_age_add));
 
     /* build the raw nsk */
-    ptls_buffer_init(&session_id, session_id_smallbuf, sizeof(session_id_smallbuf));
     ret = encode_session_identifier(tls->ctx, &session_id, ticket_age_add, ptls_iovec_init(NULL, 0), tls->key_schedule,
                                     tls->server_name, tls->key_share->id, tls->cipher_suite->id, tls->negotiated_protocol);
     if (ret != 0)
         goto Exit;
 
-    /* encrypt and send */
-    ptls_push_message(emitter, tls->key_schedule, PTLS_HANDSHAKE_TYPE_NEW_SESSION_TICKET, {
-        ptls_buffer_push32(emitter->buf, tls->ctx->ticket_lifetime);
-        ptls_buffer_push32(emitter->buf, ticket_age_add);
-        ptls_buffer_push_block(emitter->buf, 1, {});
-        ptls_buffer_push_block(emitter->buf, 2, {
-            if ((ret = tls->ctx->encrypt_ticket->cb(tls->ctx->encrypt_ticket, tls, 1, emitter->buf,
-                                                    ptls_iovec_init(session_id.base, session_id.off))) != 0)
+    /* encrypt; if the encryption is run asynchronously, the ticket is sent when the result becomes available */
+    if ((ret = tls->ctx->encrypt_ticket->cb(tls->ctx->encrypt_ticket, tls, 1, &ticket,
+                                            ptls_iovec_init(session_id.base, session_id.off))) != 0) {
+        if (ret == PTLS_ERROR_ASYNC_OPERATION) {
+            struct st_ptls_async_ticket_t *async;
+            if ((async = new_async_ticket(tls, 1)) == NULL) {
+                ret = PTLS_ERROR_NO_MEMORY;
                 goto Exit;
-        });
-        ptls_buffer_push_block(emitter->buf, 2, {
-            if (tls->ctx->max_early_data_size != 0)
-                buffer_push_extension(emitter->buf, PTLS_EXTENSION_TYPE_EARLY_DATA,
-                                      { ptls_buffer_push32(emitter->buf, tls->ctx->max_early_data_size); });
-        });
-    });
+            }
+            async->ticket_age_add = ticket_age_add;
+            ret = 0;
+        } else if (ret == PTLS_ERROR_SKIP_TICKET) {
+            ret = 0;
+        }
+        goto Exit;
+    }
+
+    /* send */
+    if ((ret = push_new_session_ticket(tls, emitter, ticket_age_add, ptls_iovec_init(ticket.base, ticket.off))) != 0)
+        goto Exit;
 
 Exit:
     ptls_buffer_dispose(&session_id);
+    ptls_buffer_dispose(&ticket);
 
     /* restore handshake state */
     tls->key_schedule->hashes[0].ctx->final(tls->key_schedule->hashes[0].ctx, NULL, PTLS_HASH_FINAL_MODE_FREE);
     tls->key_schedule->hashes[0].ctx = msghash_backup;
+    key_schedule_transcript_changed(tls->key_schedule);
+
+    return ret;
+}
+
+/**
+ * sends the ticket being encrypted asynchronously, if the result is available
+ */
+static int send_pending_session_ticket(ptls_t *tls, ptls_message_emitter_t *emitter)
+{
+    struct st_ptls_async_ticket_t *async;
+    int ret;
+
+    if (!(tls->is_server && (async = tls->server.async_ticket) != NULL && async->is_encrypt && async->is_complete))
+        return 0;
+
+    /* if the encryption has failed, the ticket is not sent; it is too late to fail the handshake */
+    ret = 0;
+    if (async->status == 0) {
+        ptls_iovec_t ticket = ptls_iovec_init(async->output.base, async->output.off);
+        ret = push_new_session_ticket(tls, emitter, async->ticket_age_add, ticket);
+    }
 
+    /* the entry is released even if the ticket could not be pushed, as the result cannot be supplied again */
+    free_async_ticket(tls);
     return ret;
 }
 
@@ -1486,6 +1939,8 @@ static int push_change_cipher_spec(ptls_t *tls, ptls_message_emitter_t *emitter)
     }
 
     /* emit CCS */
+    if ((ret = flush_open_record(emitter->enc)) != 0)
+        goto Exit;
     buffer_push_record(emitter->buf, PTLS_CONTENT_TYPE_CHANGE_CIPHER_SPEC, { ptls_buffer_push(emitter->buf, 1); });
 
     tls->send_change_cipher_spec = 0;
@@ -1544,21 +1999,6 @@ Exit:
     return ret;
 }
 
-static ptls_hash_context_t *create_sha256_context(ptls_context_t *ctx)
-{
-    ptls_cipher_suite_t **cs;
-
-    for (cs = ctx->cipher_suites; *cs != NULL; ++cs) {
-        switch ((*cs)->id) {
-        case PTLS_CIPHER_SUITE_AES_128_GCM_SHA256:
-        case PTLS_CIPHER_SUITE_CHACHA20_POLY1305_SHA256:
-            return (*cs)->hash->create();
-        }
-    }
-
-    return NULL;
-}
-
 static int select_cipher(ptls_cipher_suite_t **selected, ptls_cipher_suite_t **candidates, const uint8_t *src,
                          const uint8_t *const end)
 {
@@ -1660,267 +2100,395 @@ Exit:
     return ret;
 }
 
-static int parse_esni_keys(ptls_context_t *ctx, uint16_t *esni_version, ptls_key_exchange_algorithm_t **selected_key_share,
-                           ptls_cipher_suite_t **selected_cipher, ptls_iovec_t *peer_key, uint16_t *padded_length,
-                           char **published_sni, ptls_iovec_t input)
+struct st_decoded_ech_config_t {
+    uint8_t id;
+    ptls_hpke_kem_t *kem; /* NULL if the config cannot be used */
+    ptls_iovec_t public_key;
+    ptls_iovec_t cipher_suites; /* list of HpkeSymmetricCipherSuite */
+    uint8_t max_name_length;
+    ptls_iovec_t public_name;
+    ptls_iovec_t bytes; /* the entire ECHConfig */
+};
+
+/**
+ * Decodes one ECHConfig. Configs of unknown versions, those using unsupported KEMs, and those carrying mandatory extensions are
+ * skipped, by returning success while setting `decoded->kem` to NULL.
+ */
+static int decode_one_ech_config(ptls_hpke_kem_t **kems, struct st_decoded_ech_config_t *decoded, const uint8_t **_src,
+                                 const uint8_t *const end)
 {
-    const uint8_t *src = input.base, *const end = input.base + input.len;
+    const uint8_t *src = *_src;
     uint16_t version;
-    uint64_t not_before, not_after, now;
-    int ret = 0;
+    int ret;
 
-    /* version */
-    if ((ret = ptls_decode16(&version, &src, end)) != 0)
-        goto Exit;
-    if (version != PTLS_ESNI_VERSION_DRAFT03) {
-        ret = PTLS_ALERT_DECODE_ERROR;
-        goto Exit;
-    }
+    *decoded = (struct st_decoded_ech_config_t){0};
 
-    { /* verify checksum */
-        ptls_hash_context_t *hctx;
-        uint8_t digest[PTLS_SHA256_DIGEST_SIZE];
-        if (end - src < 4) {
-            ret = PTLS_ALERT_DECODE_ERROR;
-            goto Exit;
-        }
-        if ((hctx = create_sha256_context(ctx)) == NULL) {
-            ret = PTLS_ERROR_LIBRARY;
-            goto Exit;
-        }
-        hctx->update(hctx, input.base, src - input.base);
-        hctx->update(hctx, "\0\0\0\0", 4);
-        hctx->update(hctx, src + 4, end - (src + 4));
-        hctx->final(hctx, digest, PTLS_HASH_FINAL_MODE_FREE);
-        if (memcmp(src, digest, 4) != 0) {
-            ret = PTLS_ALERT_DECODE_ERROR;
-            goto Exit;
-        }
-        src += 4;
-    }
-    *esni_version = version;
-    /* published sni */
-    ptls_decode_open_block(src, end, 2, {
-        size_t len = end - src;
-        *published_sni = malloc(len + 1);
-        if (*published_sni == NULL) {
-            ret = PTLS_ERROR_NO_MEMORY;
-            goto Exit;
-        }
-        if (len > 0) {
-            memcpy(*published_sni, src, len);
-        }
-        (*published_sni)[len] = 0;
-        src = end;
-    });
-    /* key-shares */
-    ptls_decode_open_block(src, end, 2, {
-        if ((ret = select_key_share(selected_key_share, peer_key, ctx->key_exchanges, &src, end, 0)) != 0)
-            goto Exit;
-    });
-    /* cipher-suite */
-    ptls_decode_open_block(src, end, 2, {
-        if ((ret = select_cipher(selected_cipher, ctx->cipher_suites, src, end)) != 0)
-            goto Exit;
-        src = end;
-    });
-    /* padded-length */
-    if ((ret = ptls_decode16(padded_length, &src, end)) != 0)
-        goto Exit;
-    if (padded_length == 0)
-        goto Exit;
-    /* not-before, not_after */
-    if ((ret = ptls_decode64(&not_before, &src, end)) != 0 || (ret = ptls_decode64(&not_after, &src, end)) != 0)
+    if ((ret = ptls_decode16(&version, &src, end)) != 0)
         goto Exit;
-    /* extensions */
     ptls_decode_block(src, end, 2, {
-        while (src != end) {
-            uint16_t id;
-            if ((ret = ptls_decode16(&id, &src, end)) != 0)
+        if (version == PTLS_ECH_CONFIG_VERSION) {
+            uint16_t kem_id;
+            ptls_hpke_kem_t **kem;
+            if (src == end) {
+                ret = PTLS_ALERT_DECODE_ERROR;
+                goto Exit;
+            }
+            decoded->id = *src++;
+            if ((ret = ptls_decode16(&kem_id, &src, end)) != 0)
+                goto Exit;
+            for (kem = kems; *kem != NULL && (*kem)->id != kem_id; ++kem)
+                ;
+            decoded->kem = *kem;
+            ptls_decode_open_block(src, end, 2, {
+                if (src == end) {
+                    ret = PTLS_ALERT_DECODE_ERROR;
+                    goto Exit;
+                }
+                decoded->public_key = ptls_iovec_init(src, end - src);
+                src = end;
+            });
+            ptls_decode_open_block(src, end, 2, {
+                if (src == end || (end - src) % 4 != 0) {
+                    ret = PTLS_ALERT_DECODE_ERROR;
+                    goto Exit;
+                }
+                decoded->cipher_suites = ptls_iovec_init(src, end - src);
+                src = end;
+            });
+            if (src == end) {
+                ret = PTLS_ALERT_DECODE_ERROR;
                 goto Exit;
-            ptls_decode_open_block(src, end, 2, { src = end; });
+            }
+            decoded->max_name_length = *src++;
+            ptls_decode_open_block(src, end, 1, {
+                if (src == end) {
+                    ret = PTLS_ALERT_DECODE_ERROR;
+                    goto Exit;
+                }
+                decoded->public_name = ptls_iovec_init(src, end - src);
+                src = end;
+            });
+            ptls_decode_open_block(src, end, 2, {
+                while (src != end) {
+                    uint16_t exttype;
+                    if ((ret = ptls_decode16(&exttype, &src, end)) != 0)
+                        goto Exit;
+                    /* we do not know of any extension; the config cannot be used if any of them is mandatory */
+                    if ((exttype & 0x8000) != 0)
+                        decoded->kem = NULL;
+                    ptls_decode_open_block(src, end, 2, { src = end; });
+                }
+            });
+        } else {
+            decoded->kem = NULL;
+            src = end;
         }
     });
-
-    /* check validity period */
-    now = ctx->get_time->cb(ctx->get_time);
-    if (!(not_before * 1000 <= now && now <= not_after * 1000)) {
-        ret = PTLS_ALERT_DECODE_ERROR;
-        goto Exit;
-    }
-
+    decoded->bytes = ptls_iovec_init(*_src, src - *_src);
+    *_src = src;
     ret = 0;
+
 Exit:
     return ret;
 }
 
-static int create_esni_aead(ptls_aead_context_t **aead_ctx, int is_enc, ptls_cipher_suite_t *cipher, ptls_iovec_t ecdh_secret,
-                            const uint8_t *esni_contents_hash)
+static ptls_hpke_cipher_suite_t *select_ech_cipher(ptls_hpke_cipher_suite_t **candidates, ptls_iovec_t cipher_suites)
 {
-    uint8_t aead_secret[PTLS_MAX_DIGEST_SIZE];
-    int ret;
-
-    if ((ret = ptls_hkdf_extract(cipher->hash, aead_secret, ptls_iovec_init(NULL, 0), ecdh_secret)) != 0)
-        goto Exit;
-    if ((*aead_ctx = new_aead(cipher->aead, cipher->hash, is_enc, aead_secret,
-                              ptls_iovec_init(esni_contents_hash, cipher->hash->digest_size), "tls13 esni ")) == NULL) {
-        ret = PTLS_ERROR_NO_MEMORY;
-        goto Exit;
+    for (; *candidates != NULL; ++candidates) {
+        const uint8_t *src;
+        for (src = cipher_suites.base; src != cipher_suites.base + cipher_suites.len; src += 4)
+            if (ntoh16(src) == (*candidates)->id.kdf && ntoh16(src + 2) == (*candidates)->id.aead)
+                return *candidates;
     }
+    return NULL;
+}
 
-    ret = 0;
-Exit:
-    ptls_clear_memory(aead_secret, sizeof(aead_secret));
-    return ret;
+static void clear_ech(struct st_ptls_ech_t *ech, int is_server)
+{
+    if (ech->aead != NULL) {
+        ptls_aead_free(ech->aead);
+        ech->aead = NULL;
+    }
+    ptls_clear_memory(ech->inner_client_random, PTLS_HELLO_RANDOM_SIZE);
+    if (!is_server) {
+        free(ech->client.enc.base);
+        ech->client.enc = ptls_iovec_init(NULL, 0);
+        if (ech->client.public_name != NULL) {
+            free(ech->client.public_name);
+            ech->client.public_name = NULL;
+        }
+    }
 }
 
-static int build_esni_contents_hash(ptls_hash_algorithm_t *hash, uint8_t *digest, const uint8_t *record_digest, uint16_t group,
-                                    ptls_iovec_t pubkey, const uint8_t *client_random)
+/**
+ * Selects the first ECHConfig that can be used and sets up the HPKE context for sending ClientHelloInner. `ech->offered` is left
+ * unset if none of the configs can be used.
+ */
+static int client_setup_ech(struct st_ptls_ech_t *ech, ptls_context_t *ctx, ptls_iovec_t config_list)
 {
-    ptls_buffer_t buf;
-    uint8_t smallbuf[256];
+    struct st_decoded_ech_config_t decoded;
+    ptls_hpke_cipher_suite_t *cipher = NULL;
+    ptls_buffer_t infobuf;
     int ret;
 
-    /* build ESNIContents */
-    ptls_buffer_init(&buf, smallbuf, sizeof(smallbuf));
-    ptls_buffer_push_block(&buf, 2, { ptls_buffer_pushv(&buf, record_digest, hash->digest_size); });
-    if ((ret = push_key_share_entry(&buf, group, pubkey)) != 0)
+    ptls_buffer_init(&infobuf, "", 0);
+
+    { /* find the first ECHConfig that can be used */
+        const uint8_t *src = config_list.base, *const end = src + config_list.len;
+        ptls_decode_block(src, end, 2, {
+            do {
+                if ((ret = decode_one_ech_config(ctx->ech.client.kems, &decoded, &src, end)) != 0)
+                    goto Exit;
+                if (decoded.kem != NULL && (cipher = select_ech_cipher(ctx->ech.client.ciphers, decoded.cipher_suites)) != NULL)
+                    src = end;
+            } while (src != end);
+        });
+    }
+    if (cipher == NULL) {
+        ret = 0;
         goto Exit;
-    ptls_buffer_pushv(&buf, client_random, PTLS_HELLO_RANDOM_SIZE);
+    }
 
-    /* calculate digest */
-    if ((ret = ptls_calc_hash(hash, digest, buf.base, buf.off)) != 0)
+    /* setup the HPKE context; info is "tls ech" || 0x00 || ECHConfig */
+    ptls_buffer_pushv(&infobuf, PTLS_ECH_INFO_PREFIX, sizeof(PTLS_ECH_INFO_PREFIX));
+    ptls_buffer_pushv(&infobuf, decoded.bytes.base, decoded.bytes.len);
+    if ((ret = ptls_hpke_setup_base_s(decoded.kem, cipher, &ech->client.enc, &ech->aead, decoded.public_key,
+                                      ptls_iovec_init(infobuf.base, infobuf.off))) != 0)
         goto Exit;
 
+    /* retain the other properties */
+    if ((ech->client.public_name = malloc(decoded.public_name.len + 1)) == NULL) {
+        ret = PTLS_ERROR_NO_MEMORY;
+        goto Exit;
+    }
+    memcpy(ech->client.public_name, decoded.public_name.base, decoded.public_name.len);
+    ech->client.public_name[decoded.public_name.len] = '\0';
+    ech->client.max_name_length = decoded.max_name_length;
+    ech->kem = decoded.kem;
+    ech->cipher = cipher;
+    ech->config_id = decoded.id;
+    ctx->random_bytes(ech->inner_client_random, PTLS_HELLO_RANDOM_SIZE);
+    ech->offered = 1;
     ret = 0;
+
 Exit:
-    ptls_buffer_dispose(&buf);
+    if (ret != 0)
+        clear_ech(ech, 0);
+    ptls_buffer_dispose(&infobuf);
     return ret;
 }
 
-static void free_esni_secret(ptls_esni_secret_t **esni, int is_server)
-{
-    assert(*esni != NULL);
-    if ((*esni)->secret.base != NULL) {
-        ptls_clear_memory((*esni)->secret.base, (*esni)->secret.len);
-        free((*esni)->secret.base);
-    }
-    if (!is_server)
-        free((*esni)->client.pubkey.base);
-    ptls_clear_memory((*esni), sizeof(**esni));
-    free(*esni);
-    *esni = NULL;
-}
+enum encode_client_hello_mode { ENCODE_CH_MODE_DEFAULT, ENCODE_CH_MODE_INNER, ENCODE_CH_MODE_OUTER };
 
-static int client_setup_esni(ptls_context_t *ctx, ptls_esni_secret_t **esni, ptls_iovec_t esni_keys, char **published_sni,
-                             const uint8_t *client_random)
+/**
+ * Encodes the body of a ClientHello. When building ClientHelloOuter, the space for the encrypted ClientHelloInner is filled with
+ * zeros and its offset is returned through `ech_payload_off`, and the PSK binder is filled with random bytes. Otherwise, the PSK
+ * binder (if any) is left to be filled by the caller.
+ */
+static int encode_client_hello(ptls_t *tls, ptls_buffer_t *sendbuf, enum encode_client_hello_mode mode, int is_second_flight,
+                               ptls_handshake_properties_t *properties, const uint8_t *client_random, const char *sni_name,
+                               size_t ech_payload_size, size_t *ech_payload_off, ptls_iovec_t psk_identity,
+                               uint32_t obfuscated_ticket_age, size_t psk_binder_size, ptls_iovec_t *cookie)
 {
-    ptls_iovec_t peer_key;
     int ret;
 
-    if ((*esni = malloc(sizeof(**esni))) == NULL)
-        return PTLS_ERROR_NO_MEMORY;
-    memset(*esni, 0, sizeof(**esni));
-
-    /* parse ESNI_Keys (and return success while keeping *esni NULL) */
-    if (parse_esni_keys(ctx, &(*esni)->version, &(*esni)->client.key_share, &(*esni)->client.cipher, &peer_key,
-                        &(*esni)->client.padded_length, published_sni, esni_keys) != 0) {
-        free(*esni);
-        *esni = NULL;
-        return 0;
-    }
-
-    ctx->random_bytes((*esni)->nonce, sizeof((*esni)->nonce));
-
-    /* calc record digest */
-    if ((ret = ptls_calc_hash((*esni)->client.cipher->hash, (*esni)->client.record_digest, esni_keys.base, esni_keys.len)) != 0)
-        goto Exit;
-    /* derive ECDH secret */
-    if ((ret = (*esni)->client.key_share->exchange((*esni)->client.key_share, &(*esni)->client.pubkey, &(*esni)->secret,
-                                                   peer_key)) != 0)
-        goto Exit;
-    /* calc H(ESNIContents) */
-    if ((ret = build_esni_contents_hash((*esni)->client.cipher->hash, (*esni)->esni_contents_hash, (*esni)->client.record_digest,
-                                        (*esni)->client.key_share->id, (*esni)->client.pubkey, client_random)) != 0)
-        goto Exit;
+    /* legacy_version */
+    ptls_buffer_push16(sendbuf, 0x0303);
+    /* random_bytes */
+    ptls_buffer_pushv(sendbuf, client_random, PTLS_HELLO_RANDOM_SIZE);
+    /* lecagy_session_id */
+    ptls_buffer_push_block(
+        sendbuf, 1, { ptls_buffer_pushv(sendbuf, tls->client.legacy_session_id.base, tls->client.legacy_session_id.len); });
+    /* cipher_suites */
+    ptls_buffer_push_block(sendbuf, 2, {
+        ptls_cipher_suite_t **cs = tls->ctx->cipher_suites;
+        for (; *cs != NULL; ++cs)
+            ptls_buffer_push16(sendbuf, (*cs)->id);
+    });
+    /* legacy_compression_methods */
+    ptls_buffer_push_block(sendbuf, 1, { ptls_buffer_push(sendbuf, 0); });
+    /* extensions */
+    ptls_buffer_push_block(sendbuf, 2, {
+        buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_KEY_SHARE, {
+            ptls_buffer_push_block(sendbuf, 2, {
+                if (tls->client.key_share_ctx != NULL) {
+                    if ((ret = push_key_share_entry(sendbuf, tls->key_share->id, tls->client.key_share_ctx->pubkey)) != 0)
+                        goto Exit;
+                }
+            });
+        });
+        if (sni_name != NULL) {
+            buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_SERVER_NAME, {
+                if ((ret = emit_server_name_extension(sendbuf, sni_name)) != 0)
+                    goto Exit;
+            });
+        }
+        switch (mode) {
+        case ENCODE_CH_MODE_INNER:
+            buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_ENCRYPTED_CLIENT_HELLO,
+                                  { ptls_buffer_push(sendbuf, PTLS_ECH_CLIENT_HELLO_TYPE_INNER); });
+            break;
+        case ENCODE_CH_MODE_OUTER:
+            buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_ENCRYPTED_CLIENT_HELLO, {
+                ptls_buffer_push(sendbuf, PTLS_ECH_CLIENT_HELLO_TYPE_OUTER);
+                ptls_buffer_push16(sendbuf, tls->ech.cipher->id.kdf);
+                ptls_buffer_push16(sendbuf, tls->ech.cipher->id.aead);
+                ptls_buffer_push(sendbuf, tls->ech.config_id);
+                /* enc is sent only in the first ClientHello */
+                ptls_buffer_push_block(sendbuf, 2, {
+                    if (!is_second_flight)
+                        ptls_buffer_pushv(sendbuf, tls->ech.client.enc.base, tls->ech.client.enc.len);
+                });
+                ptls_buffer_push_block(sendbuf, 2, {
+                    if ((ret = ptls_buffer_reserve(sendbuf, ech_payload_size)) != 0)
+                        goto Exit;
+                    memset(sendbuf->base + sendbuf->off, 0, ech_payload_size);
+                    *ech_payload_off = sendbuf->off;
+                    sendbuf->off += ech_payload_size;
+                });
+            });
+            break;
+        default:
+            break;
+        }
+        if (properties != NULL && properties->client.negotiated_protocols.count != 0) {
+            buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_ALPN, {
+                ptls_buffer_push_block(sendbuf, 2, {
+                    size_t i;
+                    for (i = 0; i != properties->client.negotiated_protocols.count; ++i) {
+                        ptls_buffer_push_block(sendbuf, 1, {
+                            ptls_iovec_t p = properties->client.negotiated_protocols.list[i];
+                            ptls_buffer_pushv(sendbuf, p.base, p.len);
+                        });
+                    }
+                });
+            });
+        }
+        if (tls->ctx->record_size_limit != 0 && tls->ctx->update_traffic_key == NULL)
+            buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_RECORD_SIZE_LIMIT,
+                                  { ptls_buffer_push16(sendbuf, tls->ctx->record_size_limit); });
+        if (tls->ctx->decompress_certificate != NULL) {
+            buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_COMPRESS_CERTIFICATE, {
+                ptls_buffer_push_block(sendbuf, 1, {
+                    const uint16_t *algo = tls->ctx->decompress_certificate->supported_algorithms;
+                    assert(*algo != UINT16_MAX);
+                    for (; *algo != UINT16_MAX; ++algo)
+                        ptls_buffer_push16(sendbuf, *algo);
+                });
+            });
+        }
+        buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_SUPPORTED_VERSIONS, {
+            ptls_buffer_push_block(sendbuf, 1, {
+                size_t i;
+                for (i = 0; i != PTLS_ELEMENTSOF(supported_versions); ++i)
+                    ptls_buffer_push16(sendbuf, supported_versions[i]);
+            });
+        });
+        buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_SIGNATURE_ALGORITHMS, {
+            if ((ret = push_signature_algorithms(sendbuf)) != 0)
+                goto Exit;
+        });
+        buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_SUPPORTED_GROUPS, {
+            ptls_key_exchange_algorithm_t **algo = tls->ctx->key_exchanges;
+            ptls_buffer_push_block(sendbuf, 2, {
+                for (; *algo != NULL; ++algo)
+                    ptls_buffer_push16(sendbuf, (*algo)->id);
+            });
+        });
+        if (cookie != NULL && cookie->base != NULL) {
+            buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_COOKIE, {
+                ptls_buffer_push_block(sendbuf, 2, { ptls_buffer_pushv(sendbuf, cookie->base, cookie->len); });
+            });
+        }
+        if ((ret = push_additional_extensions(properties, sendbuf)) != 0)
+            goto Exit;
+        if (tls->ctx->save_ticket != NULL || psk_identity.base != NULL) {
+            buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_PSK_KEY_EXCHANGE_MODES, {
+                ptls_buffer_push_block(sendbuf, 1, {
+                    if (!tls->ctx->require_dhe_on_psk)
+                        ptls_buffer_push(sendbuf, PTLS_PSK_KE_MODE_PSK);
+                    ptls_buffer_push(sendbuf, PTLS_PSK_KE_MODE_PSK_DHE);
+                });
+            });
+        }
+        if (psk_identity.base != NULL) {
+            if (tls->client.using_early_data && !is_second_flight)
+                buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_EARLY_DATA, {});
+            /* pre-shared key "MUST be the last extension in the ClientHello" (draft-17 section 4.2.6) */
+            buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_PRE_SHARED_KEY, {
+                ptls_buffer_push_block(sendbuf, 2, {
+                    ptls_buffer_push_block(sendbuf, 2, { ptls_buffer_pushv(sendbuf, psk_identity.base, psk_identity.len); });
+                    ptls_buffer_push32(sendbuf, obfuscated_ticket_age);
+                });
+                /* allocate space for PSK binder. the space is filled by the caller, unless this is ClientHelloOuter */
+                ptls_buffer_push_block(sendbuf, 2, {
+                    ptls_buffer_push_block(sendbuf, 1, {
+                        if ((ret = ptls_buffer_reserve(sendbuf, psk_binder_size)) != 0)
+                            goto Exit;
+                        if (mode == ENCODE_CH_MODE_OUTER)
+                            tls->ctx->random_bytes(sendbuf->base + sendbuf->off, psk_binder_size);
+                        sendbuf->off += psk_binder_size;
+                    });
+                });
+            });
+        }
+    });
 
     ret = 0;
 Exit:
-    if (ret != 0)
-        free_esni_secret(esni, 0);
     return ret;
 }
 
-static int emit_esni_extension(ptls_esni_secret_t *esni, ptls_buffer_t *buf, ptls_iovec_t esni_keys, const char *server_name,
-                               size_t key_share_ch_off, size_t key_share_ch_len)
+/**
+ * Updates the transcript (the inner one if ECH is in flight) with the given ClientHello, filling in the PSK binder HMAC if
+ * necessary.
+ */
+static int client_hello_update_hash_with_binder(ptls_t *tls, uint8_t *msg, size_t msglen, int has_binder)
 {
-    ptls_aead_context_t *aead = NULL;
+    uint8_t binder_key[PTLS_MAX_DIGEST_SIZE];
     int ret;
 
-    if ((ret = create_esni_aead(&aead, 1, esni->client.cipher, esni->secret, esni->esni_contents_hash)) != 0)
-        goto Exit;
-
-    /* cipher-suite id */
-    ptls_buffer_push16(buf, esni->client.cipher->id);
-    /* key-share */
-    if ((ret = push_key_share_entry(buf, esni->client.key_share->id, esni->client.pubkey)) != 0)
-        goto Exit;
-    /* record-digest */
-    ptls_buffer_push_block(buf, 2, { ptls_buffer_pushv(buf, esni->client.record_digest, esni->client.cipher->hash->digest_size); });
-    /* encrypted sni */
-    ptls_buffer_push_block(buf, 2, {
-        size_t start_off = buf->off;
-        /* nonce */
-        ptls_buffer_pushv(buf, esni->nonce, PTLS_ESNI_NONCE_SIZE);
-        /* emit server-name extension */
-        if ((ret = emit_server_name_extension(buf, server_name)) != 0)
+    if (has_binder) {
+        size_t psk_binder_off = msglen - (3 + tls->key_schedule->hashes[0].algo->digest_size);
+        if ((ret = derive_secret_with_empty_digest(tls->key_schedule, binder_key, "res binder")) != 0)
             goto Exit;
-        /* pad */
-        if (buf->off - start_off < (size_t)(esni->client.padded_length + PTLS_ESNI_NONCE_SIZE)) {
-            size_t bytes_to_pad = esni->client.padded_length + PTLS_ESNI_NONCE_SIZE - (buf->off - start_off);
-            if ((ret = ptls_buffer_reserve(buf, bytes_to_pad)) != 0)
-                goto Exit;
-            memset(buf->base + buf->off, 0, bytes_to_pad);
-            buf->off += bytes_to_pad;
-        }
-        /* encrypt */
-        if ((ret = ptls_buffer_reserve(buf, aead->algo->tag_size)) != 0)
+        key_schedule_update_ech_hash(tls->key_schedule, msg, psk_binder_off, 0);
+        if ((ret = calc_verify_data(msg + psk_binder_off + 3, tls->key_schedule, binder_key)) != 0)
             goto Exit;
-        ptls_aead_encrypt(aead, buf->base + start_off, buf->base + start_off, buf->off - start_off, 0, buf->base + key_share_ch_off,
-                          key_share_ch_len);
-        buf->off += aead->algo->tag_size;
-    });
-
+        key_schedule_update_ech_hash(tls->key_schedule, msg + psk_binder_off, msglen - psk_binder_off, 0);
+    } else {
+        key_schedule_update_ech_hash(tls->key_schedule, msg, msglen, 0);
+    }
     ret = 0;
+
 Exit:
-    if (aead != NULL)
-        ptls_aead_free(aead);
+    ptls_clear_memory(binder_key, sizeof(binder_key));
     return ret;
 }
 
 static int send_client_hello(ptls_t *tls, ptls_message_emitter_t *emitter, ptls_handshake_properties_t *properties,
                              ptls_iovec_t *cookie)
 {
-    ptls_iovec_t resumption_secret = {NULL}, resumption_ticket;
-    char *published_sni = NULL;
+    ptls_iovec_t resumption_secret = {NULL}, resumption_ticket = {NULL};
+    const char *sni_name = NULL;
     uint32_t obfuscated_ticket_age = 0;
-    size_t msghash_off;
-    uint8_t binder_key[PTLS_MAX_DIGEST_SIZE];
-    int ret, is_second_flight = tls->key_schedule != NULL,
-             send_sni = tls->server_name != NULL && !ptls_server_name_is_ipaddr(tls->server_name);
+    size_t msghash_off, psk_binder_size = 0;
+    ptls_buffer_t inner, encoded_inner;
+    uint8_t *grease_identity = NULL;
+    int ret, is_second_flight = tls->key_schedule != NULL;
+
+    ptls_buffer_init(&inner, "", 0);
+    ptls_buffer_init(&encoded_inner, "", 0);
+
+    if (tls->server_name != NULL && !ptls_server_name_is_ipaddr(tls->server_name))
+        sni_name = tls->server_name;
 
     if (properties != NULL) {
-        /* try to use ESNI */
-        if (!is_second_flight && send_sni && properties->client.esni_keys.base != NULL) {
-            if ((ret = client_setup_esni(tls->ctx, &tls->esni, properties->client.esni_keys, &published_sni, tls->client_random)) !=
-                0) {
+        /* try to use ECH (the HPKE context is retained when sending the second ClientHello) */
+        if (!is_second_flight && properties->client.ech.configs.base != NULL && tls->ctx->ech.client.ciphers != NULL &&
+            tls->ctx->ech.client.kems != NULL) {
+            if ((ret = client_setup_ech(&tls->ech, tls->ctx, properties->client.ech.configs)) != 0)
                 goto Exit;
-            }
-            if (tls->ctx->update_esni_key != NULL) {
-                if ((ret = tls->ctx->update_esni_key->cb(tls->ctx->update_esni_key, tls, tls->esni->secret,
-                                                         tls->esni->client.cipher->hash, tls->esni->esni_contents_hash)) != 0)
-                    goto Exit;
-            }
         }
         /* setup resumption-related data. If successful, resumption_secret becomes a non-zero value. */
         if (properties->client.session_ticket.base != NULL) {
@@ -1941,6 +2509,7 @@ static int send_client_hello(ptls_t *tls, ptls_message_emitter_t *emitter, ptls_
                 }
             } else {
                 resumption_secret = ptls_iovec_init(NULL, 0);
+                resumption_ticket = ptls_iovec_init(NULL, 0);
             }
         }
         if (tls->client.using_early_data) {
@@ -1957,158 +2526,94 @@ static int send_client_hello(ptls_t *tls, ptls_message_emitter_t *emitter, ptls_
         tls->key_share = tls->ctx->key_exchanges[0];
 
     if (!is_second_flight) {
-        tls->key_schedule = key_schedule_new(tls->cipher_suite, tls->ctx->cipher_suites, tls->ctx->hkdf_label_prefix__obsolete);
+        tls->key_schedule = key_schedule_new(tls->cipher_suite, tls->ctx->cipher_suites, tls->ctx->hkdf_label_prefix__obsolete,
+                                             tls->ech.aead != NULL);
         if ((ret = key_schedule_extract(tls->key_schedule, resumption_secret)) != 0)
             goto Exit;
     }
+    if (resumption_secret.base != NULL)
+        psk_binder_size = tls->key_schedule->hashes[0].algo->digest_size;
 
-    msghash_off = emitter->buf->off + emitter->record_header_length;
-    ptls_push_message(emitter, NULL, PTLS_HANDSHAKE_TYPE_CLIENT_HELLO, {
-        ptls_buffer_t *sendbuf = emitter->buf;
-        /* legacy_version */
-        ptls_buffer_push16(sendbuf, 0x0303);
-        /* random_bytes */
-        ptls_buffer_pushv(sendbuf, tls->client_random, sizeof(tls->client_random));
-        /* lecagy_session_id */
-        ptls_buffer_push_block(
-            sendbuf, 1, { ptls_buffer_pushv(sendbuf, tls->client.legacy_session_id.base, tls->client.legacy_session_id.len); });
-        /* cipher_suites */
-        ptls_buffer_push_block(sendbuf, 2, {
-            ptls_cipher_suite_t **cs = tls->ctx->cipher_suites;
-            for (; *cs != NULL; ++cs)
-                ptls_buffer_push16(sendbuf, (*cs)->id);
+    /* create the key share, being shared between ClientHelloInner and ClientHelloOuter */
+    if (tls->key_share != NULL) {
+        if ((ret = tls->key_share->create(tls->key_share, &tls->client.key_share_ctx)) != 0)
+            goto Exit;
+    }
+
+    if (tls->ech.aead != NULL) {
+        /* build ClientHelloInner, and update the inner transcript */
+        ptls_buffer_push_message_body(&inner, NULL, PTLS_HANDSHAKE_TYPE_CLIENT_HELLO, {
+            if ((ret = encode_client_hello(tls, &inner, ENCODE_CH_MODE_INNER, is_second_flight, properties,
+                                           tls->ech.inner_client_random, sni_name, 0, NULL, resumption_ticket,
+                                           obfuscated_ticket_age, psk_binder_size, cookie)) != 0)
+                goto Exit;
         });
-        /* legacy_compression_methods */
-        ptls_buffer_push_block(sendbuf, 1, { ptls_buffer_push(sendbuf, 0); });
-        /* extensions */
-        ptls_buffer_push_block(sendbuf, 2, {
-            struct {
-                size_t off;
-                size_t len;
-            } key_share_client_hello;
-            buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_KEY_SHARE, {
-                key_share_client_hello.off = sendbuf->off;
-                ptls_buffer_push_block(sendbuf, 2, {
-                    if (tls->key_share != NULL) {
-                        if ((ret = tls->key_share->create(tls->key_share, &tls->client.key_share_ctx)) != 0)
-                            goto Exit;
-                        if ((ret = push_key_share_entry(sendbuf, tls->key_share->id, tls->client.key_share_ctx->pubkey)) != 0)
-                            goto Exit;
-                    }
-                });
-                key_share_client_hello.len = sendbuf->off - key_share_client_hello.off;
-            });
-            if (send_sni) {
-                if (tls->esni != NULL) {
-                    if (published_sni != NULL) {
-                        buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_SERVER_NAME, {
-                            if ((ret = emit_server_name_extension(sendbuf, published_sni)) != 0)
-                                goto Exit;
-                        });
-                    }
-                    buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_ENCRYPTED_SERVER_NAME, {
-                        if ((ret = emit_esni_extension(tls->esni, sendbuf, properties->client.esni_keys, tls->server_name,
-                                                       key_share_client_hello.off, key_share_client_hello.len)) != 0)
-                            goto Exit;
-                    });
-                } else {
-                    buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_SERVER_NAME, {
-                        if ((ret = emit_server_name_extension(sendbuf, tls->server_name)) != 0)
-                            goto Exit;
-                    });
-                }
-            }
-            if (properties != NULL && properties->client.negotiated_protocols.count != 0) {
-                buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_ALPN, {
-                    ptls_buffer_push_block(sendbuf, 2, {
-                        size_t i;
-                        for (i = 0; i != properties->client.negotiated_protocols.count; ++i) {
-                            ptls_buffer_push_block(sendbuf, 1, {
-                                ptls_iovec_t p = properties->client.negotiated_protocols.list[i];
-                                ptls_buffer_pushv(sendbuf, p.base, p.len);
-                            });
-                        }
-                    });
-                });
-            }
-            if (tls->ctx->decompress_certificate != NULL) {
-                buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_COMPRESS_CERTIFICATE, {
-                    ptls_buffer_push_block(sendbuf, 1, {
-                        const uint16_t *algo = tls->ctx->decompress_certificate->supported_algorithms;
-                        assert(*algo != UINT16_MAX);
-                        for (; *algo != UINT16_MAX; ++algo)
-                            ptls_buffer_push16(sendbuf, *algo);
-                    });
-                });
+        if ((ret = client_hello_update_hash_with_binder(tls, inner.base, inner.off, resumption_secret.base != NULL)) != 0)
+            goto Exit;
+        /* build EncodedClientHelloInner; legacy_session_id is omitted, and padding is applied as suggested by RFC 9849 */
+        size_t sid_end = PTLS_HANDSHAKE_HEADER_SIZE + 2 + PTLS_HELLO_RANDOM_SIZE + 1 + tls->client.legacy_session_id.len,
+               padding_len;
+        ptls_buffer_pushv(&encoded_inner, inner.base + PTLS_HANDSHAKE_HEADER_SIZE, 2 + PTLS_HELLO_RANDOM_SIZE);
+        ptls_buffer_push(&encoded_inner, 0);
+        ptls_buffer_pushv(&encoded_inner, inner.base + sid_end, inner.off - sid_end);
+        if (sni_name != NULL) {
+            size_t sni_len = strlen(sni_name);
+            padding_len = sni_len < tls->ech.client.max_name_length ? tls->ech.client.max_name_length - sni_len : 0;
+        } else {
+            padding_len = 9 + tls->ech.client.max_name_length;
+        }
+        padding_len += 31 - ((encoded_inner.off + padding_len - 1) % 32);
+        if ((ret = ptls_buffer_reserve(&encoded_inner, padding_len)) != 0)
+            goto Exit;
+        memset(encoded_inner.base + encoded_inner.off, 0, padding_len);
+        encoded_inner.off += padding_len;
+        /* build ClientHelloOuter, using random values for the PSK being offered */
+        uint32_t grease_ticket_age = 0;
+        size_t ech_payload_off = 0;
+        if (resumption_ticket.base != NULL) {
+            if ((grease_identity = malloc(resumption_ticket.len)) == NULL) {
+                ret = PTLS_ERROR_NO_MEMORY;
+                goto Exit;
             }
-            buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_SUPPORTED_VERSIONS, {
-                ptls_buffer_push_block(sendbuf, 1, {
-                    size_t i;
-                    for (i = 0; i != PTLS_ELEMENTSOF(supported_versions); ++i)
-                        ptls_buffer_push16(sendbuf, supported_versions[i]);
-                });
-            });
-            buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_SIGNATURE_ALGORITHMS, {
-                if ((ret = push_signature_algorithms(sendbuf)) != 0)
-                    goto Exit;
-            });
-            buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_SUPPORTED_GROUPS, {
-                ptls_key_exchange_algorithm_t **algo = tls->ctx->key_exchanges;
-                ptls_buffer_push_block(sendbuf, 2, {
-                    for (; *algo != NULL; ++algo)
-                        ptls_buffer_push16(sendbuf, (*algo)->id);
-                });
-            });
-            if (cookie != NULL && cookie->base != NULL) {
-                buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_COOKIE, {
-                    ptls_buffer_push_block(sendbuf, 2, { ptls_buffer_pushv(sendbuf, cookie->base, cookie->len); });
-                });
-            }
-            if ((ret = push_additional_extensions(properties, sendbuf)) != 0)
+            tls->ctx->random_bytes(grease_identity, resumption_ticket.len);
+            tls->ctx->random_bytes(&grease_ticket_age, sizeof(grease_ticket_age));
+        }
+        msghash_off = emitter->buf->off + emitter->record_header_length;
+        ptls_push_message(emitter, NULL, PTLS_HANDSHAKE_TYPE_CLIENT_HELLO, {
+            ptls_iovec_t grease_ticket = ptls_iovec_init(grease_identity, grease_identity != NULL ? resumption_ticket.len : 0);
+            if ((ret = encode_client_hello(tls, emitter->buf, ENCODE_CH_MODE_OUTER, is_second_flight, properties,
+                                           tls->client_random, tls->ech.client.public_name,
+                                           encoded_inner.off + tls->ech.aead->algo->tag_size, &ech_payload_off, grease_ticket,
+                                           grease_ticket_age, psk_binder_size, cookie)) != 0)
                 goto Exit;
-            if (tls->ctx->save_ticket != NULL || resumption_secret.base != NULL) {
-                buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_PSK_KEY_EXCHANGE_MODES, {
-                    ptls_buffer_push_block(sendbuf, 1, {
-                        if (!tls->ctx->require_dhe_on_psk)
-                            ptls_buffer_push(sendbuf, PTLS_PSK_KE_MODE_PSK);
-                        ptls_buffer_push(sendbuf, PTLS_PSK_KE_MODE_PSK_DHE);
-                    });
-                });
-            }
-            if (resumption_secret.base != NULL) {
-                if (tls->client.using_early_data && !is_second_flight)
-                    buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_EARLY_DATA, {});
-                /* pre-shared key "MUST be the last extension in the ClientHello" (draft-17 section 4.2.6) */
-                buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_PRE_SHARED_KEY, {
-                    ptls_buffer_push_block(sendbuf, 2, {
-                        ptls_buffer_push_block(sendbuf, 2,
-                                               { ptls_buffer_pushv(sendbuf, resumption_ticket.base, resumption_ticket.len); });
-                        ptls_buffer_push32(sendbuf, obfuscated_ticket_age);
-                    });
-                    /* allocate space for PSK binder. the space is filled at the bottom of the function */
-                    ptls_buffer_push_block(sendbuf, 2, {
-                        ptls_buffer_push_block(sendbuf, 1, {
-                            if ((ret = ptls_buffer_reserve(sendbuf, tls->key_schedule->hashes[0].algo->digest_size)) != 0)
-                                goto Exit;
-                            sendbuf->off += tls->key_schedule->hashes[0].algo->digest_size;
-                        });
-                    });
-                });
-            }
         });
-    });
-
-    /* update the message hash, filling in the PSK binder HMAC if necessary */
-    if (resumption_secret.base != NULL) {
-        size_t psk_binder_off = emitter->buf->off - (3 + tls->key_schedule->hashes[0].algo->digest_size);
-        if ((ret = derive_secret_with_empty_digest(tls->key_schedule, binder_key, "res binder")) != 0)
+        /* encrypt EncodedClientHelloInner, using ClientHelloOuter with the payload zeroed as AAD */
+        uint8_t *outer_body = emitter->buf->base + msghash_off + PTLS_HANDSHAKE_HEADER_SIZE;
+        size_t outer_body_len = emitter->buf->off - (msghash_off + PTLS_HANDSHAKE_HEADER_SIZE);
+        inner.off = 0;
+        if ((ret = ptls_buffer_reserve(&inner, encoded_inner.off + tls->ech.aead->algo->tag_size)) != 0)
             goto Exit;
-        ptls__key_schedule_update_hash(tls->key_schedule, emitter->buf->base + msghash_off, psk_binder_off - msghash_off);
-        msghash_off = psk_binder_off;
-        if ((ret = calc_verify_data(emitter->buf->base + psk_binder_off + 3, tls->key_schedule, binder_key)) != 0)
+        ptls_aead_encrypt(tls->ech.aead, inner.base, encoded_inner.base, encoded_inner.off, is_second_flight, outer_body,
+                          outer_body_len);
+        memcpy(emitter->buf->base + ech_payload_off, inner.base, encoded_inner.off + tls->ech.aead->algo->tag_size);
+        key_schedule_update_ech_hash(tls->key_schedule, emitter->buf->base + msghash_off, emitter->buf->off - msghash_off, 1);
+        /* the HPKE context is no longer needed once the second ClientHello is sent */
+        if (is_second_flight) {
+            ptls_aead_free(tls->ech.aead);
+            tls->ech.aead = NULL;
+        }
+    } else {
+        msghash_off = emitter->buf->off + emitter->record_header_length;
+        ptls_push_message(emitter, NULL, PTLS_HANDSHAKE_TYPE_CLIENT_HELLO, {
+            if ((ret = encode_client_hello(tls, emitter->buf, ENCODE_CH_MODE_DEFAULT, is_second_flight, properties,
+                                           tls->client_random, sni_name, 0, NULL, resumption_ticket, obfuscated_ticket_age,
+                                           psk_binder_size, cookie)) != 0)
+                goto Exit;
+        });
+        if ((ret = client_hello_update_hash_with_binder(tls, emitter->buf->base + msghash_off, emitter->buf->off - msghash_off,
+                                                        resumption_secret.base != NULL)) != 0)
             goto Exit;
     }
-    ptls__key_schedule_update_hash(tls->key_schedule, emitter->buf->base + msghash_off, emitter->buf->off - msghash_off);
 
     if (tls->client.using_early_data) {
         assert(!is_second_flight);
@@ -2125,10 +2630,9 @@ static int send_client_hello(ptls_t *tls, ptls_message_emitter_t *emitter, ptls_
     ret = PTLS_ERROR_IN_PROGRESS;
 
 Exit:
-    if (published_sni != NULL) {
-        free(published_sni);
-    }
-    ptls_clear_memory(binder_key, sizeof(binder_key));
+    free(grease_identity);
+    ptls_buffer_dispose(&inner);
+    ptls_buffer_dispose(&encoded_inner);
     return ret;
 }
 
@@ -2244,6 +2748,19 @@ static int decode_server_hello(ptls_t *tls, struct st_ptls_server_hello_t *sh, c
                     goto Exit;
             }
             break;
+        case PTLS_EXTENSION_TYPE_ENCRYPTED_CLIENT_HELLO:
+            /* only HRR carries the confirmation; it is verified by handle_hello_retry_request */
+            if (!(sh->is_retry_request && tls->ech.offered)) {
+                ret = PTLS_ALERT_UNSUPPORTED_EXTENSION;
+                goto Exit;
+            }
+            if (end - src != PTLS_ECH_CONFIRM_LENGTH) {
+                ret = PTLS_ALERT_DECODE_ERROR;
+                goto Exit;
+            }
+            sh->retry_request.ech = src;
+            src = end;
+            break;
         default:
             src = end;
             break;
@@ -2316,6 +2833,18 @@ static int handle_hello_retry_request(ptls_t *tls, ptls_message_emitter_t *emitt
     }
 
     key_schedule_transform_post_ch1hash(tls->key_schedule);
+    if (sh->retry_request.ech != NULL) {
+        /* the server has accepted ECH, if the confirmation calculated using the inner transcript matches */
+        uint8_t confirm[PTLS_ECH_CONFIRM_LENGTH];
+        if ((ret = ech_calc_confirmation(tls->key_schedule, confirm, tls->ech.inner_client_random, PTLS_ECH_CONFIRMATION_HRR,
+                                         message, sh->retry_request.ech - message.base)) != 0)
+            goto Exit;
+        if (!ptls_mem_equal(confirm, sh->retry_request.ech, PTLS_ECH_CONFIRM_LENGTH)) {
+            ret = PTLS_ALERT_ILLEGAL_PARAMETER;
+            goto Exit;
+        }
+        tls->ech.accepted = 1;
+    }
     ptls__key_schedule_update_hash(tls->key_schedule, message.base, message.len);
     ret = send_client_hello(tls, emitter, properties, &sh->retry_request.cookie);
 
@@ -2353,6 +2882,38 @@ static int client_handle_hello(ptls_t *tls, ptls_message_emitter_t *emitter, ptl
             goto Exit;
     }
 
+    if (tls->ech.offered) {
+        /* check the confirmation embedded in ServerHello.random to see if ECH has been accepted, then settle the transcript */
+        uint8_t confirm[PTLS_ECH_CONFIRM_LENGTH];
+        size_t confirm_off = PTLS_HANDSHAKE_HEADER_SIZE + 2 + PTLS_HELLO_RANDOM_SIZE - PTLS_ECH_CONFIRM_LENGTH;
+        if ((ret = ech_calc_confirmation(tls->key_schedule, confirm, tls->ech.inner_client_random,
+                                         PTLS_ECH_CONFIRMATION_SERVER_HELLO, message, confirm_off)) != 0)
+            goto Exit;
+        if (ptls_mem_equal(confirm, message.base + confirm_off, PTLS_ECH_CONFIRM_LENGTH)) {
+            if (tls->state == PTLS_STATE_CLIENT_EXPECT_SECOND_SERVER_HELLO && !tls->ech.accepted) {
+                ret = PTLS_ALERT_ILLEGAL_PARAMETER;
+                goto Exit;
+            }
+            tls->ech.accepted = 1;
+            key_schedule_select_transcript(tls->key_schedule, 0);
+        } else {
+            /* the server cannot switch its decision after HRR, nor resume a session using ClientHelloOuter */
+            if (tls->ech.accepted || tls->is_psk_handshake) {
+                ret = PTLS_ALERT_ILLEGAL_PARAMETER;
+                goto Exit;
+            }
+            key_schedule_select_transcript(tls->key_schedule, 1);
+            /* from now on, the server is authenticated using the public name */
+            free(tls->server_name);
+            tls->server_name = tls->ech.client.public_name;
+            tls->ech.client.public_name = NULL;
+        }
+        if (tls->ech.aead != NULL) {
+            ptls_aead_free(tls->ech.aead);
+            tls->ech.aead = NULL;
+        }
+    }
+
     ptls__key_schedule_update_hash(tls->key_schedule, message.base, message.len);
 
     if ((ret = key_schedule_extract(tls->key_schedule, ecdh_secret)) != 0)
@@ -2414,9 +2975,26 @@ static int report_unknown_extensions(ptls_t *tls, ptls_handshake_properties_t *p
     }
 }
 
+static int decode_record_size_limit(uint16_t *limit, const uint8_t *src, const uint8_t *const end)
+{
+    int ret;
+
+    if ((ret = ptls_decode16(limit, &src, end)) != 0)
+        return ret;
+    if (src != end)
+        return PTLS_ALERT_DECODE_ERROR;
+    /* RFC 8449 section 4: values less than 64 are illegal, values larger than the protocol limit are capped */
+    if (*limit < 64)
+        return PTLS_ALERT_ILLEGAL_PARAMETER;
+    if (*limit > PTLS_MAX_PLAINTEXT_RECORD_SIZE + 1)
+        *limit = PTLS_MAX_PLAINTEXT_RECORD_SIZE + 1;
+
+    return 0;
+}
+
 static int client_handle_encrypted_extensions(ptls_t *tls, ptls_iovec_t message, ptls_handshake_properties_t *properties)
 {
-    const uint8_t *src = message.base + PTLS_HANDSHAKE_HEADER_SIZE, *const end = message.base + message.len, *esni_nonce = NULL;
+    const uint8_t *src = message.base + PTLS_HANDSHAKE_HEADER_SIZE, *const end = message.base + message.len;
     uint16_t type;
     ptls_raw_extension_t unknown_extensions[MAX_UNKNOWN_EXTENSIONS + 1];
     int ret, skip_early_data = 1;
@@ -2439,19 +3017,29 @@ static int client_handle_encrypted_extensions(ptls_t *tls, ptls_iovec_t message,
                 goto Exit;
             }
             break;
-        case PTLS_EXTENSION_TYPE_ENCRYPTED_SERVER_NAME:
-            if (*src == PTLS_ESNI_RESPONSE_TYPE_ACCEPT) {
-                if (end - src != PTLS_ESNI_NONCE_SIZE + 1) {
-                    ret = PTLS_ALERT_ILLEGAL_PARAMETER;
+        case PTLS_EXTENSION_TYPE_ENCRYPTED_CLIENT_HELLO: {
+            /* retry_configs are sent only when ECH is rejected */
+            const uint8_t *retry_configs = src;
+            if (!(tls->ech.offered && !tls->ech.accepted)) {
+                ret = PTLS_ALERT_UNSUPPORTED_EXTENSION;
+                goto Exit;
+            }
+            ptls_decode_block(src, end, 2, {
+                if (src == end) {
+                    ret = PTLS_ALERT_DECODE_ERROR;
                     goto Exit;
                 }
-                esni_nonce = src + 1;
-            } else {
-                /* TODO: provide API to parse the RETRY REQUEST response */
-                ret = PTLS_ERROR_ESNI_RETRY;
-                goto Exit;
+                src = end;
+            });
+            if (properties != NULL && properties->client.ech.retry_configs != NULL) {
+                if ((properties->client.ech.retry_configs->base = malloc(end - retry_configs)) == NULL) {
+                    ret = PTLS_ERROR_NO_MEMORY;
+                    goto Exit;
+                }
+                memcpy(properties->client.ech.retry_configs->base, retry_configs, end - retry_configs);
+                properties->client.ech.retry_configs->len = end - retry_configs;
             }
-            break;
+        } break;
         case PTLS_EXTENSION_TYPE_ALPN:
             ptls_decode_block(src, end, 2, {
                 ptls_decode_open_block(src, end, 1, {
@@ -2476,6 +3064,15 @@ static int client_handle_encrypted_extensions(ptls_t *tls, ptls_iovec_t message,
             }
             skip_early_data = 0;
             break;
+        case PTLS_EXTENSION_TYPE_RECORD_SIZE_LIMIT:
+            if (!(tls->ctx->record_size_limit != 0 && tls->ctx->update_traffic_key == NULL)) {
+                ret = PTLS_ALERT_UNSUPPORTED_EXTENSION;
+                goto Exit;
+            }
+            if ((ret = decode_record_size_limit(&tls->traffic_protection.enc.record_size_limit, src, end)) != 0)
+                goto Exit;
+            tls->traffic_protection.dec.record_size_limit = tls->ctx->record_size_limit;
+            break;
         default:
             handle_unknown_extension(tls, properties, type, src, end, unknown_extensions);
             break;
@@ -2483,19 +3080,6 @@ static int client_handle_encrypted_extensions(ptls_t *tls, ptls_iovec_t message,
         src = end;
     });
 
-    if (tls->esni != NULL) {
-        if (esni_nonce == NULL || !ptls_mem_equal(esni_nonce, tls->esni->nonce, PTLS_ESNI_NONCE_SIZE)) {
-            ret = PTLS_ALERT_ILLEGAL_PARAMETER;
-            goto Exit;
-        }
-        free_esni_secret(&tls->esni, 0);
-    } else {
-        if (esni_nonce != NULL) {
-            ret = PTLS_ALERT_ILLEGAL_PARAMETER;
-            goto Exit;
-        }
-    }
-
     if (tls->client.using_early_data) {
         if (skip_early_data)
             tls->client.using_early_data = 0;
@@ -2882,6 +3466,11 @@ static int client_handle_finished(ptls_t *tls, ptls_message_emitter_t *emitter,
 
     if ((ret = verify_finished(tls, message)) != 0)
         goto Exit;
+    /* the server has been authenticated using the public name; abort the handshake so that the application could retry */
+    if (tls->ech.offered && !tls->ech.accepted) {
+        ret = PTLS_ALERT_ECH_REQUIRED;
+        goto Exit;
+    }
     ptls__key_schedule_update_hash(tls->key_schedule, message.base, message.len);
 
     /* update traffic keys by using messages upto ServerFinished, but commission them after sending ClientFinished */
@@ -3010,110 +3599,6 @@ Exit:
     return ret;
 }
 
-static int client_hello_decrypt_esni(ptls_context_t *ctx, ptls_iovec_t *server_name, ptls_esni_secret_t **secret,
-                                     struct st_ptls_client_hello_t *ch)
-{
-    ptls_esni_context_t **esni;
-    ptls_key_exchange_context_t **key_share_ctx;
-    uint8_t *decrypted = NULL;
-    ptls_aead_context_t *aead = NULL;
-    int ret;
-
-    /* allocate secret */
-    assert(*secret == NULL);
-    if ((*secret = malloc(sizeof(**secret))) == NULL)
-        return PTLS_ERROR_NO_MEMORY;
-    memset(*secret, 0, sizeof(**secret));
-
-    /* find the matching esni structure */
-    for (esni = ctx->esni; *esni != NULL; ++esni) {
-        size_t i;
-        for (i = 0; (*esni)->cipher_suites[i].cipher_suite != NULL; ++i)
-            if ((*esni)->cipher_suites[i].cipher_suite->id == ch->esni.cipher->id)
-                break;
-        if ((*esni)->cipher_suites[i].cipher_suite == NULL) {
-            ret = PTLS_ALERT_ILLEGAL_PARAMETER;
-            goto Exit;
-        }
-        if (memcmp((*esni)->cipher_suites[i].record_digest, ch->esni.record_digest, ch->esni.cipher->hash->digest_size) == 0) {
-            (*secret)->version = (*esni)->version;
-            break;
-        }
-    }
-    if (*esni == NULL) {
-        ret = PTLS_ALERT_ILLEGAL_PARAMETER;
-        goto Exit;
-    }
-
-    /* find the matching private key for ESNI decryption */
-    for (key_share_ctx = (*esni)->key_exchanges; *key_share_ctx != NULL; ++key_share_ctx)
-        if ((*key_share_ctx)->algo->id == ch->esni.key_share->id)
-            break;
-    if (*key_share_ctx == NULL) {
-        ret = PTLS_ALERT_ILLEGAL_PARAMETER;
-        goto Exit;
-    }
-
-    /* calculate ESNIContents */
-    if ((ret = build_esni_contents_hash(ch->esni.cipher->hash, (*secret)->esni_contents_hash, ch->esni.record_digest,
-                                        ch->esni.key_share->id, ch->esni.peer_key, ch->random_bytes)) != 0)
-        goto Exit;
-    /* derive the shared secret */
-    if ((ret = (*key_share_ctx)->on_exchange(key_share_ctx, 0, &(*secret)->secret, ch->esni.peer_key)) != 0)
-        goto Exit;
-    /* decrypt */
-    if (ch->esni.encrypted_sni.len - ch->esni.cipher->aead->tag_size != (*esni)->padded_length + PTLS_ESNI_NONCE_SIZE) {
-        ret = PTLS_ALERT_ILLEGAL_PARAMETER;
-        goto Exit;
-    }
-    if ((decrypted = malloc((*esni)->padded_length + PTLS_ESNI_NONCE_SIZE)) == NULL) {
-        ret = PTLS_ERROR_NO_MEMORY;
-        goto Exit;
-    }
-    if ((ret = create_esni_aead(&aead, 0, ch->esni.cipher, (*secret)->secret, (*secret)->esni_contents_hash)) != 0)
-        goto Exit;
-    if (ptls_aead_decrypt(aead, decrypted, ch->esni.encrypted_sni.base, ch->esni.encrypted_sni.len, 0, ch->key_shares.base,
-                          ch->key_shares.len) != (*esni)->padded_length + PTLS_ESNI_NONCE_SIZE) {
-        ret = PTLS_ALERT_DECRYPT_ERROR;
-        goto Exit;
-    }
-    ptls_aead_free(aead);
-    aead = NULL;
-
-    { /* decode sni */
-        const uint8_t *src = decrypted, *const end = src + (*esni)->padded_length;
-        ptls_iovec_t found_name;
-        if (end - src < PTLS_ESNI_NONCE_SIZE) {
-            ret = PTLS_ALERT_ILLEGAL_PARAMETER;
-            goto Exit;
-        }
-        memcpy((*secret)->nonce, src, PTLS_ESNI_NONCE_SIZE);
-        src += PTLS_ESNI_NONCE_SIZE;
-        if ((ret = client_hello_decode_server_name(&found_name, &src, end)) != 0)
-            goto Exit;
-        for (; src != end; ++src) {
-            if (*src != '\0') {
-                ret = PTLS_ALERT_ILLEGAL_PARAMETER;
-                goto Exit;
-            }
-        }
-        /* if successful, reuse memory allocated for padded_server_name for storing the found name (freed by the caller) */
-        memmove(decrypted, found_name.base, found_name.len);
-        *server_name = ptls_iovec_init(decrypted, found_name.len);
-        decrypted = NULL;
-    }
-
-    ret = 0;
-Exit:
-    if (decrypted != NULL)
-        free(decrypted);
-    if (aead != NULL)
-        ptls_aead_free(aead);
-    if (ret != 0 && *secret != NULL)
-        free_esni_secret(secret, 1);
-    return ret;
-}
-
 static int select_negotiated_group(ptls_key_exchange_algorithm_t **selected, ptls_key_exchange_algorithm_t **candidates,
                                    const uint8_t *src, const uint8_t *const end)
 {
@@ -3215,47 +3700,51 @@ static int decode_client_hello(ptls_t *tls, struct st_ptls_client_hello_t *ch, c
                 goto Exit;
             }
             break;
-        case PTLS_EXTENSION_TYPE_ENCRYPTED_SERVER_NAME: {
-            ptls_cipher_suite_t **cipher;
-            if (ch->esni.cipher != NULL) {
+        case PTLS_EXTENSION_TYPE_ENCRYPTED_CLIENT_HELLO:
+            /* the extension type is beyond the range of the bitmap used by decode_extensions for detecting duplicates */
+            if (ch->ech.payload.base != NULL) {
                 ret = PTLS_ALERT_ILLEGAL_PARAMETER;
                 goto Exit;
             }
-            { /* cipher-suite */
-                uint16_t csid;
-                if ((ret = ptls_decode16(&csid, &src, end)) != 0)
-                    goto Exit;
-                for (cipher = tls->ctx->cipher_suites; *cipher != NULL; ++cipher)
-                    if ((*cipher)->id == csid)
-                        break;
-                if (*cipher == NULL) {
-                    ret = PTLS_ALERT_ILLEGAL_PARAMETER;
-                    goto Exit;
-                }
-            }
-            /* key-share (including peer-key) */
-            if ((ret = select_key_share(&ch->esni.key_share, &ch->esni.peer_key, tls->ctx->key_exchanges, &src, end, 1)) != 0)
+            if (src == end) {
+                ret = PTLS_ALERT_DECODE_ERROR;
                 goto Exit;
-            ptls_decode_open_block(src, end, 2, {
-                size_t len = end - src;
-                if (len != (*cipher)->hash->digest_size) {
-                    ret = PTLS_ALERT_ILLEGAL_PARAMETER;
+            }
+            switch (ch->ech.type = *src++) {
+            case PTLS_ECH_CLIENT_HELLO_TYPE_OUTER:
+                if ((ret = ptls_decode16(&ch->ech.cipher_suite.kdf, &src, end)) != 0 ||
+                    (ret = ptls_decode16(&ch->ech.cipher_suite.aead, &src, end)) != 0)
+                    goto Exit;
+                if (src == end) {
+                    ret = PTLS_ALERT_DECODE_ERROR;
                     goto Exit;
                 }
-                ch->esni.record_digest = src;
-                src += len;
-            });
-            ptls_decode_block(src, end, 2, {
-                size_t len = end - src;
-                if (len < (*cipher)->aead->tag_size) {
-                    ret = PTLS_ALERT_ILLEGAL_PARAMETER;
+                ch->ech.config_id = *src++;
+                ptls_decode_open_block(src, end, 2, {
+                    ch->ech.enc = ptls_iovec_init(src, end - src);
+                    src = end;
+                });
+                ptls_decode_open_block(src, end, 2, {
+                    if (src == end) {
+                        ret = PTLS_ALERT_DECODE_ERROR;
+                        goto Exit;
+                    }
+                    ch->ech.payload = ptls_iovec_init(src, end - src);
+                    src = end;
+                });
+                break;
+            case PTLS_ECH_CLIENT_HELLO_TYPE_INNER:
+                if (src != end) {
+                    ret = PTLS_ALERT_DECODE_ERROR;
                     goto Exit;
                 }
-                ch->esni.encrypted_sni = ptls_iovec_init(src, len);
-                src += len;
-            });
-            ch->esni.cipher = *cipher; /* set only after successful parsing */
-        } break;
+                ch->ech.payload = ptls_iovec_init(src, 0);
+                break;
+            default:
+                ret = PTLS_ALERT_ILLEGAL_PARAMETER;
+                goto Exit;
+            }
+            break;
         case PTLS_EXTENSION_TYPE_ALPN:
             ptls_decode_block(src, end, 2, {
                 do {
@@ -3400,6 +3889,10 @@ static int decode_client_hello(ptls_t *tls, struct st_ptls_client_hello_t *ch, c
         case PTLS_EXTENSION_TYPE_STATUS_REQUEST:
             ch->status_request = 1;
             break;
+        case PTLS_EXTENSION_TYPE_RECORD_SIZE_LIMIT:
+            if ((ret = decode_record_size_limit(&ch->record_size_limit, src, end)) != 0)
+                goto Exit;
+            break;
         default:
             handle_unknown_extension(tls, properties, exttype, src, end, ch->unknown_extensions);
             break;
@@ -3417,55 +3910,90 @@ static int vec_is_string(ptls_iovec_t x, const char *y)
     return strncmp((const char *)x.base, y, x.len) == 0 && y[x.len] == '\0';
 }
 
+/**
+ * returns if the server name or ALPN being stored in a session identifier is `name`
+ */
+static int session_identifier_name_is(struct st_session_identifier_name_t *stored, ptls_hash_algorithm_t *hash, const char *name)
+{
+    uint8_t digest[PTLS_MAX_DIGEST_SIZE];
+    size_t len;
+
+    if (!stored->is_digest)
+        return vec_is_string(stored->value, name);
+
+    /* names up to SESSION_IDENTIFIER_COMPACT_DIGEST_SIZE bytes are stored as-is */
+    if ((len = strlen(name)) <= SESSION_IDENTIFIER_COMPACT_DIGEST_SIZE)
+        return 0;
+    if (ptls_calc_hash(hash, digest, name, len) != 0)
+        return 0;
+    return memcmp(stored->value.base, digest, SESSION_IDENTIFIER_COMPACT_DIGEST_SIZE) == 0;
+}
+
 static int try_psk_handshake(ptls_t *tls, size_t *psk_index, int *accept_early_data, struct st_ptls_client_hello_t *ch,
                              ptls_iovec_t ch_trunc)
 {
     ptls_buffer_t decbuf;
-    ptls_iovec_t ticket_psk, ticket_server_name, ticket_negotiated_protocol;
-    uint64_t issue_at, now = tls->ctx->get_time->cb(tls->ctx->get_time);
-    uint32_t age_add;
-    uint16_t ticket_key_exchange_id, ticket_csid;
+    struct st_session_identifier_t ticket;
+    struct st_ptls_async_ticket_t *async = tls->server.async_ticket;
+    uint64_t now = tls->ctx->get_time->cb(tls->ctx->get_time);
     uint8_t decbuf_small[256], binder_key[PTLS_MAX_DIGEST_SIZE], verify_data[PTLS_MAX_DIGEST_SIZE];
     int ret;
 
     ptls_buffer_init(&decbuf, decbuf_small, sizeof(decbuf_small));
 
-    for (*psk_index = 0; *psk_index < ch->psk.identities.count; ++*psk_index) {
+    /* when resuming, the identities preceding the one that has been decrypted asynchronously have already been rejected */
+    for (*psk_index = async != NULL ? async->psk_index : 0; *psk_index < ch->psk.identities.count; ++*psk_index) {
         struct st_ptls_client_hello_psk_t *identity = ch->psk.identities.list + *psk_index;
         /* decrypt and decode */
-        int can_accept_early_data = 1;
+        int can_accept_early_data = 1, decrypt_ret;
         decbuf.off = 0;
-        switch (tls->ctx->encrypt_ticket->cb(tls->ctx->encrypt_ticket, tls, 0, &decbuf, identity->identity)) {
+        if (async != NULL) {
+            assert(!async->is_encrypt && async->is_complete);
+            if ((decrypt_ret = async->status) == 0 || decrypt_ret == PTLS_ERROR_REJECT_EARLY_DATA)
+                ptls_buffer_pushv(&decbuf, async->output.base, async->output.off);
+            free_async_ticket(tls);
+            async = NULL;
+        } else {
+            decrypt_ret = tls->ctx->encrypt_ticket->cb(tls->ctx->encrypt_ticket, tls, 0, &decbuf, identity->identity);
+        }
+        switch (decrypt_ret) {
         case 0: /* decrypted */
             break;
         case PTLS_ERROR_REJECT_EARLY_DATA: /* decrypted, but early data is rejected */
             can_accept_early_data = 0;
             break;
+        case PTLS_ERROR_ASYNC_OPERATION: /* the result will be supplied by `ptls_set_ticket_result` */
+            if ((async = new_async_ticket(tls, 0)) == NULL) {
+                ret = PTLS_ERROR_NO_MEMORY;
+                goto Exit;
+            }
+            async->psk_index = *psk_index;
+            ret = PTLS_ERROR_ASYNC_OPERATION;
+            goto Exit;
         default: /* decryption failure */
             continue;
         }
-        if (decode_session_identifier(&issue_at, &ticket_psk, &age_add, &ticket_server_name, &ticket_key_exchange_id, &ticket_csid,
-                                      &ticket_negotiated_protocol, decbuf.base, decbuf.base + decbuf.off) != 0)
+        if (decode_session_identifier(&ticket, decbuf.base, decbuf.base + decbuf.off) != 0)
             continue;
         /* check age */
-        if (now < issue_at)
+        if (now < ticket.issued_at)
             continue;
-        if (now - issue_at > (uint64_t)tls->ctx->ticket_lifetime * 1000)
+        if (now - ticket.issued_at > (uint64_t)tls->ctx->ticket_lifetime * 1000)
             continue;
         *accept_early_data = 0;
         if (ch->psk.early_data_indication && can_accept_early_data) {
             /* accept early-data if abs(diff) between the reported age and the actual age is within += 10 seconds */
-            int64_t delta = (now - issue_at) - (identity->obfuscated_ticket_age - age_add);
+            int64_t delta = (now - ticket.issued_at) - (identity->obfuscated_ticket_age - ticket.ticket_age_add);
             if (delta < 0)
                 delta = -delta;
             if (delta <= PTLS_EARLY_DATA_MAX_DELAY)
                 *accept_early_data = 1;
         }
         /* check server-name */
-        if (ticket_server_name.len != 0) {
+        if (ticket.server_name.value.len != 0) {
             if (tls->server_name == NULL)
                 continue;
-            if (!vec_is_string(ticket_server_name, tls->server_name))
+            if (!session_identifier_name_is(&ticket.server_name, tls->key_schedule->hashes[0].algo, tls->server_name))
                 continue;
         } else {
             if (tls->server_name != NULL)
@@ -3473,24 +4001,25 @@ static int try_psk_handshake(ptls_t *tls, size_t *psk_index, int *accept_early_d
         }
         { /* check key-exchange */
             ptls_key_exchange_algorithm_t **a;
-            for (a = tls->ctx->key_exchanges; *a != NULL && (*a)->id != ticket_key_exchange_id; ++a)
+            for (a = tls->ctx->key_exchanges; *a != NULL && (*a)->id != ticket.key_exchange_id; ++a)
                 ;
             if (*a == NULL)
                 continue;
             tls->key_share = *a;
         }
         /* check cipher-suite */
-        if (ticket_csid != tls->cipher_suite->id)
+        if (ticket.csid != tls->cipher_suite->id)
             continue;
         /* check negotiated-protocol */
-        if (ticket_negotiated_protocol.len != 0) {
+        if (ticket.negotiated_protocol.value.len != 0) {
             if (tls->negotiated_protocol == NULL)
                 continue;
-            if (!vec_is_string(ticket_negotiated_protocol, tls->negotiated_protocol))
+            if (!session_identifier_name_is(&ticket.negotiated_protocol, tls->key_schedule->hashes[0].algo,
+                                            tls->negotiated_protocol))
                 continue;
         }
         /* check the length of the decrypted psk and the PSK binder */
-        if (ticket_psk.len != tls->key_schedule->hashes[0].algo->digest_size)
+        if (ticket.psk.len != tls->key_schedule->hashes[0].algo->digest_size)
             continue;
         if (ch->psk.identities.list[*psk_index].binder.len != tls->key_schedule->hashes[0].algo->digest_size)
             continue;
@@ -3507,9 +4036,9 @@ static int try_psk_handshake(ptls_t *tls, size_t *psk_index, int *accept_early_d
     goto Exit;
 
 Found:
-    if ((ret = key_schedule_extract(tls->key_schedule, ticket_psk)) != 0)
+    if ((ret = key_schedule_extract(tls->key_schedule, ticket.psk)) != 0)
         goto Exit;
-    if ((ret = derive_secret(tls->key_schedule, binder_key, "res binder")) != 0)
+    if ((ret = derive_secret_with_empty_digest(tls->key_schedule, binder_key, "res binder")) != 0)
         goto Exit;
     ptls__key_schedule_update_hash(tls->key_schedule, ch_trunc.base, ch_trunc.len);
     if ((ret = calc_verify_data(verify_data, tls->key_schedule, binder_key)) != 0)
@@ -3567,59 +4096,306 @@ static int calc_cookie_signature(ptls_t *tls, ptls_handshake_properties_t *prope
     return 0;
 }
 
-static int server_handle_hello(ptls_t *tls, ptls_message_emitter_t *emitter, ptls_iovec_t message,
-                               ptls_handshake_properties_t *properties)
+/**
+ * Finds the next extension of given type in the extensions block of ClientHelloOuter, advancing `*src`. The block is known to be
+ * well-formed, as it has already been decoded.
+ */
+static int ech_find_outer_extension(ptls_iovec_t *found, uint16_t type, const uint8_t **src, const uint8_t *const end)
 {
-#define EMIT_SERVER_HELLO(sched, fill_rand, extensions)                                                                            \
-    ptls_push_message(emitter, (sched), PTLS_HANDSHAKE_TYPE_SERVER_HELLO, {                                                        \
-        ptls_buffer_push16(emitter->buf, 0x0303 /* legacy version */);                                                             \
-        if ((ret = ptls_buffer_reserve(emitter->buf, PTLS_HELLO_RANDOM_SIZE)) != 0)                                                \
-            goto Exit;                                                                                                             \
-        do {                                                                                                                       \
-            fill_rand                                                                                                              \
-        } while (0);                                                                                                               \
-        emitter->buf->off += PTLS_HELLO_RANDOM_SIZE;                                                                               \
-        ptls_buffer_push_block(emitter->buf, 1,                                                                                    \
-                               { ptls_buffer_pushv(emitter->buf, ch.legacy_session_id.base, ch.legacy_session_id.len); });         \
-        ptls_buffer_push16(emitter->buf, tls->cipher_suite->id);                                                                   \
-        ptls_buffer_push(emitter->buf, 0);                                                                                         \
-        ptls_buffer_push_block(emitter->buf, 2, {                                                                                  \
-            buffer_push_extension(emitter->buf, PTLS_EXTENSION_TYPE_SUPPORTED_VERSIONS,                                            \
-                                  { ptls_buffer_push16(emitter->buf, ch.selected_version); });                                     \
-            do {                                                                                                                   \
-                extensions                                                                                                         \
-            } while (0);                                                                                                           \
-        });                                                                                                                        \
-    });
+    while (*src != end) {
+        const uint8_t *start = *src;
+        uint16_t exttype = ntoh16(*src);
+        *src += 4 + ntoh16(*src + 2);
+        if (exttype == type) {
+            *found = ptls_iovec_init(start, *src - start);
+            return 0;
+        }
+    }
+    return PTLS_ALERT_ILLEGAL_PARAMETER;
+}
 
-#define EMIT_HELLO_RETRY_REQUEST(sched, negotiated_group, additional_extensions)                                                   \
-    EMIT_SERVER_HELLO((sched), { memcpy(emitter->buf->base + emitter->buf->off, hello_retry_random, PTLS_HELLO_RANDOM_SIZE); },    \
-                      {                                                                                                            \
-                          ptls_key_exchange_algorithm_t *_negotiated_group = (negotiated_group);                                   \
-                          if (_negotiated_group != NULL) {                                                                         \
-                              buffer_push_extension(emitter->buf, PTLS_EXTENSION_TYPE_KEY_SHARE,                                   \
-                                                    { ptls_buffer_push16(emitter->buf, _negotiated_group->id); });                 \
-                          }                                                                                                        \
-                          do {                                                                                                     \
-                              additional_extensions                                                                                \
-                          } while (0);                                                                                             \
-                      })
-    struct st_ptls_client_hello_t ch = {0, NULL,   {NULL}, {NULL},     0,     {NULL}, {NULL},   {NULL}, {{0}},
-                                        {NULL}, {NULL}, {{{NULL}}}, {{0}}, {{0}},  {{NULL}}, {NULL}, {{UINT16_MAX}}};
-    struct {
-        ptls_key_exchange_algorithm_t *algorithm;
-        ptls_iovec_t peer_key;
-    } key_share = {NULL};
-    enum { HANDSHAKE_MODE_FULL, HANDSHAKE_MODE_PSK, HANDSHAKE_MODE_PSK_DHE } mode;
-    size_t psk_index = SIZE_MAX;
-    ptls_iovec_t pubkey = {0}, ecdh_secret = {0};
-    int accept_early_data = 0, is_second_flight = tls->state == PTLS_STATE_SERVER_EXPECT_SECOND_CLIENT_HELLO, ret;
+/**
+ * Rebuilds ClientHelloInner from EncodedClientHelloInner, by restoring legacy_session_id and expanding ech_outer_extensions.
+ */
+static int ech_decode_encoded_inner(ptls_buffer_t *buf, const uint8_t *src, const uint8_t *const end,
+                                    struct st_ptls_client_hello_t *outer, ptls_iovec_t outer_message)
+{
+    const uint8_t *outer_ext, *const outer_ext_end = outer_message.base + outer_message.len;
+    int ret;
+
+    /* locate the extensions block of ClientHelloOuter */
+    outer_ext = outer->compression_methods.ids + outer->compression_methods.count + 2;
+
+    ptls_buffer_push_message_body(buf, NULL, PTLS_HANDSHAKE_TYPE_CLIENT_HELLO, {
+        /* legacy_version, random */
+        if (end - src < 2 + PTLS_HELLO_RANDOM_SIZE) {
+            ret = PTLS_ALERT_DECODE_ERROR;
+            goto Exit;
+        }
+        ptls_buffer_pushv(buf, src, 2 + PTLS_HELLO_RANDOM_SIZE);
+        src += 2 + PTLS_HELLO_RANDOM_SIZE;
+        /* legacy_session_id is omitted by the client and is copied from ClientHelloOuter */
+        ptls_decode_open_block(src, end, 1, {
+            if (src != end) {
+                ret = PTLS_ALERT_ILLEGAL_PARAMETER;
+                goto Exit;
+            }
+        });
+        ptls_buffer_push_block(buf, 1, { ptls_buffer_pushv(buf, outer->legacy_session_id.base, outer->legacy_session_id.len); });
+        /* cipher_suites, legacy_compression_methods */
+        ptls_decode_open_block(src, end, 2, {
+            ptls_buffer_push_block(buf, 2, { ptls_buffer_pushv(buf, src, end - src); });
+            src = end;
+        });
+        ptls_decode_open_block(src, end, 1, {
+            ptls_buffer_push_block(buf, 1, { ptls_buffer_pushv(buf, src, end - src); });
+            src = end;
+        });
+        /* extensions */
+        ptls_buffer_push_block(buf, 2, {
+            ptls_decode_open_block(src, end, 2, {
+                while (src != end) {
+                    uint16_t exttype;
+                    if ((ret = ptls_decode16(&exttype, &src, end)) != 0)
+                        goto Exit;
+                    if (exttype == PTLS_EXTENSION_TYPE_ECH_OUTER_EXTENSIONS) {
+                        /* copy the referenced extensions from ClientHelloOuter, in the order they appear */
+                        ptls_decode_open_block(src, end, 2, {
+                            ptls_decode_open_block(src, end, 1, {
+                                if (src == end) {
+                                    ret = PTLS_ALERT_DECODE_ERROR;
+                                    goto Exit;
+                                }
+                                do {
+                                    uint16_t reftype;
+                                    ptls_iovec_t found;
+                                    if ((ret = ptls_decode16(&reftype, &src, end)) != 0)
+                                        goto Exit;
+                                    if (reftype == PTLS_EXTENSION_TYPE_ENCRYPTED_CLIENT_HELLO) {
+                                        ret = PTLS_ALERT_ILLEGAL_PARAMETER;
+                                        goto Exit;
+                                    }
+                                    if ((ret = ech_find_outer_extension(&found, reftype, &outer_ext, outer_ext_end)) != 0)
+                                        goto Exit;
+                                    ptls_buffer_pushv(buf, found.base, found.len);
+                                } while (src != end);
+                            });
+                        });
+                    } else {
+                        ptls_buffer_push16(buf, exttype);
+                        ptls_decode_open_block(src, end, 2, {
+                            ptls_buffer_push_block(buf, 2, { ptls_buffer_pushv(buf, src, end - src); });
+                            src = end;
+                        });
+                    }
+                }
+            });
+        });
+        /* padding */
+        for (; src != end; ++src) {
+            if (*src != 0) {
+                ret = PTLS_ALERT_ILLEGAL_PARAMETER;
+                goto Exit;
+            }
+        }
+    });
+
+    ret = 0;
+Exit:
+    return ret;
+}
+
+/**
+ * Handles the ECH extension of ClientHelloOuter. If ClientHelloInner is successfully decrypted, `ch` and `message` are replaced by
+ * those of ClientHelloInner, the latter being built in `inner_buf`. Failure to decrypt the first ClientHello is not an error; the
+ * server continues the handshake using ClientHelloOuter, and sends retry_configs.
+ */
+static int server_handle_ech(ptls_t *tls, struct st_ptls_client_hello_t *ch, ptls_iovec_t *message, ptls_buffer_t *inner_buf,
+                             int is_second_flight, ptls_handshake_properties_t *properties)
+{
+    ptls_buffer_t aad, encoded_inner;
+    size_t payload_off, decrypted_len;
+    int ret;
+
+    ptls_buffer_init(&aad, "", 0);
+    ptls_buffer_init(&encoded_inner, "", 0);
+
+    if (!is_second_flight) {
+        ptls_ech_server_config_t **config;
+        size_t i;
+        if (ch->ech.payload.base == NULL) {
+            ret = 0;
+            goto Exit;
+        }
+        if (ch->ech.type != PTLS_ECH_CLIENT_HELLO_TYPE_OUTER) {
+            ret = PTLS_ALERT_ILLEGAL_PARAMETER;
+            goto Exit;
+        }
+        tls->ech.offered = 1;
+        /* look up the config and the cipher, then setup the HPKE context; the config id is merely a hint, but we do not try
+         * trial decryption */
+        for (config = tls->ctx->ech.server.configs; *config != NULL; ++config)
+            if ((*config)->config_id == ch->ech.config_id)
+                break;
+        if (*config == NULL) {
+            ret = 0;
+            goto Exit;
+        }
+        for (i = 0; i != (*config)->num_ciphers; ++i)
+            if ((*config)->ciphers[i].cipher->id.kdf == ch->ech.cipher_suite.kdf &&
+                (*config)->ciphers[i].cipher->id.aead == ch->ech.cipher_suite.aead)
+                break;
+        if (i == (*config)->num_ciphers) {
+            ret = 0;
+            goto Exit;
+        }
+        if ((ret = ptls_hpke_setup_base_r_precomputed(
+                 (*config)->kem, (*config)->ciphers[i].cipher, (*config)->keyex, &tls->ech.aead, ch->ech.enc,
+                 ptls_iovec_init((*config)->ciphers[i].key_schedule_context,
+                                 PTLS_HPKE_KEY_SCHEDULE_CONTEXT_SIZE((*config)->ciphers[i].cipher)))) != 0) {
+            if (ret != PTLS_ERROR_NO_MEMORY)
+                ret = 0;
+            goto Exit;
+        }
+        tls->ech.kem = (*config)->kem;
+        tls->ech.cipher = (*config)->ciphers[i].cipher;
+        tls->ech.config_id = (*config)->config_id;
+    } else {
+        /* the second ClientHello is decrypted only if the first one was; the HPKE context is reused */
+        if (!tls->ech.accepted) {
+            ret = 0;
+            goto Exit;
+        }
+        if (ch->ech.payload.base == NULL) {
+            ret = PTLS_ALERT_MISSING_EXTENSION;
+            goto Exit;
+        }
+        if (!(ch->ech.type == PTLS_ECH_CLIENT_HELLO_TYPE_OUTER && ch->ech.config_id == tls->ech.config_id &&
+              ch->ech.cipher_suite.kdf == tls->ech.cipher->id.kdf && ch->ech.cipher_suite.aead == tls->ech.cipher->id.aead &&
+              ch->ech.enc.len == 0)) {
+            ret = PTLS_ALERT_ILLEGAL_PARAMETER;
+            goto Exit;
+        }
+        if (!ptls_mem_equal(tls->client_random, ch->random_bytes, PTLS_HELLO_RANDOM_SIZE)) {
+            ret = PTLS_ALERT_HANDSHAKE_FAILURE;
+            goto Exit;
+        }
+    }
+
+    /* decrypt, using ClientHelloOuter with the payload zeroed as AAD */
+    ptls_buffer_pushv(&aad, message->base + PTLS_HANDSHAKE_HEADER_SIZE, message->len - PTLS_HANDSHAKE_HEADER_SIZE);
+    payload_off = ch->ech.payload.base - (message->base + PTLS_HANDSHAKE_HEADER_SIZE);
+    memset(aad.base + payload_off, 0, ch->ech.payload.len);
+    if ((ret = ptls_buffer_reserve(&encoded_inner, ch->ech.payload.len)) != 0)
+        goto Exit;
+    if ((decrypted_len = ptls_aead_decrypt(tls->ech.aead, encoded_inner.base, ch->ech.payload.base, ch->ech.payload.len,
+                                           is_second_flight, aad.base, aad.off)) == SIZE_MAX) {
+        if (is_second_flight) {
+            ret = PTLS_ALERT_DECRYPT_ERROR;
+        } else {
+            ptls_aead_free(tls->ech.aead);
+            tls->ech.aead = NULL;
+            ret = 0;
+        }
+        goto Exit;
+    }
+
+    /* rebuild ClientHelloInner and decode it */
+    if ((ret = ech_decode_encoded_inner(inner_buf, encoded_inner.base, encoded_inner.base + decrypted_len, ch, *message)) != 0)
+        goto Exit;
+    if (!is_second_flight)
+        memcpy(tls->client_random, ch->random_bytes, PTLS_HELLO_RANDOM_SIZE);
+    *ch = (struct st_ptls_client_hello_t){.unknown_extensions = {{UINT16_MAX}}};
+    if ((ret = decode_client_hello(tls, ch, inner_buf->base + PTLS_HANDSHAKE_HEADER_SIZE, inner_buf->base + inner_buf->off,
+                                   properties)) != 0)
+        goto Exit;
+    if (!(ch->ech.payload.base != NULL && ch->ech.type == PTLS_ECH_CLIENT_HELLO_TYPE_INNER)) {
+        ret = PTLS_ALERT_ILLEGAL_PARAMETER;
+        goto Exit;
+    }
+    *message = ptls_iovec_init(inner_buf->base, inner_buf->off);
+    tls->ech.accepted = 1;
+    ret = 0;
+
+Exit:
+    ptls_buffer_dispose(&aad);
+    ptls_buffer_dispose(&encoded_inner);
+    return ret;
+}
+
+static int server_handle_hello(ptls_t *tls, ptls_message_emitter_t *emitter, ptls_iovec_t message,
+                               ptls_handshake_properties_t *properties)
+{
+#define EMIT_SERVER_HELLO(sched, fill_rand, extensions)                                                                            \
+    ptls_push_message(emitter, (sched), PTLS_HANDSHAKE_TYPE_SERVER_HELLO, {                                                        \
+        ptls_buffer_push16(emitter->buf, 0x0303 /* legacy version */);                                                             \
+        if ((ret = ptls_buffer_reserve(emitter->buf, PTLS_HELLO_RANDOM_SIZE)) != 0)                                                \
+            goto Exit;                                                                                                             \
+        do {                                                                                                                       \
+            fill_rand                                                                                                              \
+        } while (0);                                                                                                               \
+        emitter->buf->off += PTLS_HELLO_RANDOM_SIZE;                                                                               \
+        ptls_buffer_push_block(emitter->buf, 1,                                                                                    \
+                               { ptls_buffer_pushv(emitter->buf, ch.legacy_session_id.base, ch.legacy_session_id.len); });         \
+        ptls_buffer_push16(emitter->buf, tls->cipher_suite->id);                                                                   \
+        ptls_buffer_push(emitter->buf, 0);                                                                                         \
+        ptls_buffer_push_block(emitter->buf, 2, {                                                                                  \
+            buffer_push_extension(emitter->buf, PTLS_EXTENSION_TYPE_SUPPORTED_VERSIONS,                                            \
+                                  { ptls_buffer_push16(emitter->buf, ch.selected_version); });                                     \
+            do {                                                                                                                   \
+                extensions                                                                                                         \
+            } while (0);                                                                                                           \
+        });                                                                                                                        \
+    });
+
+#define EMIT_HELLO_RETRY_REQUEST(sched, negotiated_group, additional_extensions)                                                   \
+    EMIT_SERVER_HELLO((sched), { memcpy(emitter->buf->base + emitter->buf->off, hello_retry_random, PTLS_HELLO_RANDOM_SIZE); },    \
+                      {                                                                                                            \
+                          ptls_key_exchange_algorithm_t *_negotiated_group = (negotiated_group);                                   \
+                          if (_negotiated_group != NULL) {                                                                         \
+                              buffer_push_extension(emitter->buf, PTLS_EXTENSION_TYPE_KEY_SHARE,                                   \
+                                                    { ptls_buffer_push16(emitter->buf, _negotiated_group->id); });                 \
+                          }                                                                                                        \
+                          do {                                                                                                     \
+                              additional_extensions                                                                                \
+                          } while (0);                                                                                             \
+                      })
+    struct st_ptls_client_hello_t ch = {0,      NULL,     {NULL},     {NULL}, 0,     {NULL},   {NULL}, {NULL},
+                                        {{0}},  {NULL},   {{NULL}},   {{{NULL}}}, {{0}}, {{0}}, {{NULL}}, {NULL},
+                                        {{UINT16_MAX}}};
+    struct {
+        ptls_key_exchange_algorithm_t *algorithm;
+        ptls_iovec_t peer_key;
+    } key_share = {NULL};
+    enum { HANDSHAKE_MODE_FULL, HANDSHAKE_MODE_PSK, HANDSHAKE_MODE_PSK_DHE } mode;
+    size_t psk_index = SIZE_MAX;
+    ptls_iovec_t pubkey = {0}, ecdh_secret = {0};
+    ptls_buffer_t ech_inner;
+    int accept_early_data = 0, is_second_flight = tls->state == PTLS_STATE_SERVER_EXPECT_SECOND_CLIENT_HELLO,
+        is_resuming = tls->server.async_ticket != NULL, ret;
+
+    ptls_buffer_init(&ech_inner, "", 0);
+
+    /* When resuming after the ticket has been decrypted asynchronously, the ClientHello saved when the decryption started (i.e.,
+     * ClientHelloInner if ECH has been accepted) is processed again, skipping the steps that have side effects. */
+    if (is_resuming) {
+        ech_inner = tls->server.async_ticket->client_hello;
+        ptls_buffer_init(&tls->server.async_ticket->client_hello, "", 0);
+        message = ptls_iovec_init(ech_inner.base, ech_inner.off);
+    }
 
     /* decode ClientHello */
     if ((ret = decode_client_hello(tls, &ch, message.base + PTLS_HANDSHAKE_HEADER_SIZE, message.base + message.len, properties)) !=
         0)
         goto Exit;
 
+    /* switch to ClientHelloInner if ECH is accepted (ECH is not supported when using stateless retry, as the HPKE context cannot be
+     * retained) */
+    if (!is_resuming && tls->ctx->ech.server.configs != NULL && !(properties != NULL && properties->server.retry_uses_cookie)) {
+        if ((ret = server_handle_ech(tls, &ch, &message, &ech_inner, is_second_flight, properties)) != 0)
+            goto Exit;
+    }
+
     /* bail out if CH cannot be handled as TLS 1.3, providing the application the raw CH and SNI, to help them fallback */
     if (!is_supported_version(ch.selected_version)) {
         if (!is_second_flight && tls->ctx->on_client_hello != NULL) {
@@ -3648,13 +4424,6 @@ static int server_handle_hello(ptls_t *tls, ptls_message_emitter_t *emitter, ptl
         ret = PTLS_ALERT_ILLEGAL_PARAMETER;
         goto Exit;
     }
-    /* esni */
-    if (ch.esni.cipher != NULL) {
-        if (ch.key_shares.base == NULL) {
-            ret = PTLS_ALERT_ILLEGAL_PARAMETER;
-            goto Exit;
-        }
-    }
     /* pre-shared key */
     if (ch.psk.hash_end != NULL) {
         /* PSK must be the last extension */
@@ -3672,42 +4441,29 @@ static int server_handle_hello(ptls_t *tls, ptls_message_emitter_t *emitter, ptl
     if (tls->ctx->require_dhe_on_psk)
         ch.psk.ke_modes &= ~(1u << PTLS_PSK_KE_MODE_PSK);
 
-    /* handle client_random, legacy_session_id, SNI, ESNI */
-    if (!is_second_flight) {
-        memcpy(tls->client_random, ch.random_bytes, sizeof(tls->client_random));
+    /* handle client_random, legacy_session_id, SNI */
+    if (is_resuming) {
+        /* handled when the ClientHello was processed for the first time */
+    } else if (!is_second_flight) {
+        if (tls->ech.accepted) {
+            memcpy(tls->ech.inner_client_random, ch.random_bytes, PTLS_HELLO_RANDOM_SIZE);
+        } else {
+            memcpy(tls->client_random, ch.random_bytes, sizeof(tls->client_random));
+        }
         log_client_random(tls);
         if (ch.legacy_session_id.len != 0)
             tls->send_change_cipher_spec = 1;
-        ptls_iovec_t server_name = {NULL};
-        int is_esni = 0;
-        if (ch.esni.cipher != NULL && tls->ctx->esni != NULL) {
-            if ((ret = client_hello_decrypt_esni(tls->ctx, &server_name, &tls->esni, &ch)) != 0)
-                goto Exit;
-            if (tls->ctx->update_esni_key != NULL) {
-                if ((ret = tls->ctx->update_esni_key->cb(tls->ctx->update_esni_key, tls, tls->esni->secret, ch.esni.cipher->hash,
-                                                         tls->esni->esni_contents_hash)) != 0)
-                    goto Exit;
-            }
-            is_esni = 1;
-        } else if (ch.server_name.base != NULL) {
-            server_name = ch.server_name;
-        }
         if (tls->ctx->on_client_hello != NULL) {
-            ptls_on_client_hello_parameters_t params = {server_name,
+            ptls_on_client_hello_parameters_t params = {ch.server_name,
                                                         message,
                                                         {ch.alpn.list, ch.alpn.count},
                                                         {ch.signature_algorithms.list, ch.signature_algorithms.count},
                                                         {ch.cert_compression_algos.list, ch.cert_compression_algos.count},
                                                         {ch.client_ciphers.list, ch.client_ciphers.count},
-                                                        is_esni};
-            ret = tls->ctx->on_client_hello->cb(tls->ctx->on_client_hello, tls, &params);
-        } else {
-            ret = 0;
+                                                        tls->ech.accepted};
+            if ((ret = tls->ctx->on_client_hello->cb(tls->ctx->on_client_hello, tls, &params)) != 0)
+                goto Exit;
         }
-        if (is_esni)
-            free(server_name.base);
-        if (ret != 0)
-            goto Exit;
     } else {
         if (ch.psk.early_data_indication) {
             ret = PTLS_ALERT_DECODE_ERROR;
@@ -3715,7 +4471,8 @@ static int server_handle_hello(ptls_t *tls, ptls_message_emitter_t *emitter, ptl
         }
         /* the following check is necessary so that we would be able to track the connection in SSLKEYLOGFILE, even though it
          * might not be for the safety of the protocol */
-        if (!ptls_mem_equal(tls->client_random, ch.random_bytes, sizeof(tls->client_random))) {
+        if (!ptls_mem_equal(tls->ech.accepted ? tls->ech.inner_client_random : tls->client_random, ch.random_bytes,
+                            PTLS_HELLO_RANDOM_SIZE)) {
             ret = PTLS_ALERT_HANDSHAKE_FAILURE;
             goto Exit;
         }
@@ -3735,9 +4492,9 @@ static int server_handle_hello(ptls_t *tls, ptls_message_emitter_t *emitter, ptl
         if ((ret = select_cipher(&cs, tls->ctx->cipher_suites, ch.cipher_suites.base,
                                  ch.cipher_suites.base + ch.cipher_suites.len)) != 0)
             goto Exit;
-        if (!is_second_flight) {
+        if (!is_second_flight && !is_resuming) {
             tls->cipher_suite = cs;
-            tls->key_schedule = key_schedule_new(cs, NULL, tls->ctx->hkdf_label_prefix__obsolete);
+            tls->key_schedule = key_schedule_new(cs, NULL, tls->ctx->hkdf_label_prefix__obsolete, 0);
         } else {
             if (tls->cipher_suite != cs) {
                 ret = PTLS_ALERT_HANDSHAKE_FAILURE;
@@ -3755,7 +4512,7 @@ static int server_handle_hello(ptls_t *tls, ptls_message_emitter_t *emitter, ptl
         });
     }
 
-    if (!is_second_flight) {
+    if (!is_second_flight && !is_resuming) {
         if (ch.cookie.all.len != 0 && key_share.algorithm != NULL) {
 
             /* use cookie to check the integrity of the handshake, and update the context */
@@ -3837,7 +4594,26 @@ static int server_handle_hello(ptls_t *tls, ptls_message_emitter_t *emitter, ptl
                 /* invoking stateful retry; roll the key schedule and emit HRR */
                 key_schedule_transform_post_ch1hash(tls->key_schedule);
                 key_schedule_extract(tls->key_schedule, ptls_iovec_init(NULL, 0));
-                EMIT_HELLO_RETRY_REQUEST(tls->key_schedule, key_share.algorithm != NULL ? NULL : negotiated_group, {});
+                if (tls->ech.accepted) {
+                    /* emit HRR carrying the confirmation of ECH acceptance, then update the transcript */
+                    size_t hrr_start = emitter->buf->off + emitter->record_header_length, confirm_off = 0;
+                    EMIT_HELLO_RETRY_REQUEST(NULL, key_share.algorithm != NULL ? NULL : negotiated_group, {
+                        buffer_push_extension(emitter->buf, PTLS_EXTENSION_TYPE_ENCRYPTED_CLIENT_HELLO, {
+                            if ((ret = ptls_buffer_reserve(emitter->buf, PTLS_ECH_CONFIRM_LENGTH)) != 0)
+                                goto Exit;
+                            memset(emitter->buf->base + emitter->buf->off, 0, PTLS_ECH_CONFIRM_LENGTH);
+                            confirm_off = emitter->buf->off - hrr_start;
+                            emitter->buf->off += PTLS_ECH_CONFIRM_LENGTH;
+                        });
+                    });
+                    ptls_iovec_t hrr = ptls_iovec_init(emitter->buf->base + hrr_start, emitter->buf->off - hrr_start);
+                    if ((ret = ech_calc_confirmation(tls->key_schedule, hrr.base + confirm_off, tls->ech.inner_client_random,
+                                                     PTLS_ECH_CONFIRMATION_HRR, hrr, confirm_off)) != 0)
+                        goto Exit;
+                    ptls__key_schedule_update_hash(tls->key_schedule, hrr.base, hrr.len);
+                } else {
+                    EMIT_HELLO_RETRY_REQUEST(tls->key_schedule, key_share.algorithm != NULL ? NULL : negotiated_group, {});
+                }
                 if ((ret = push_change_cipher_spec(tls, emitter)) != 0)
                     goto Exit;
                 tls->state = PTLS_STATE_SERVER_EXPECT_SECOND_CLIENT_HELLO;
@@ -3850,7 +4626,7 @@ static int server_handle_hello(ptls_t *tls, ptls_message_emitter_t *emitter, ptl
     }
 
     /* handle unknown extensions */
-    if ((ret = report_unknown_extensions(tls, properties, ch.unknown_extensions)) != 0)
+    if (!is_resuming && (ret = report_unknown_extensions(tls, properties, ch.unknown_extensions)) != 0)
         goto Exit;
 
     /* try psk handshake */
@@ -3859,6 +4635,14 @@ static int server_handle_hello(ptls_t *tls, ptls_message_emitter_t *emitter, ptl
         tls->ctx->encrypt_ticket != NULL && !tls->ctx->require_client_authentication) {
         if ((ret = try_psk_handshake(tls, &psk_index, &accept_early_data, &ch,
                                      ptls_iovec_init(message.base, ch.psk.hash_end - message.base))) != 0) {
+            /* save ClientHello, to be processed again once the ticket is decrypted */
+            if (ret == PTLS_ERROR_ASYNC_OPERATION) {
+                int save_ret;
+                if ((save_ret = ptls_buffer__do_pushv(&tls->server.async_ticket->client_hello, message.base, message.len)) != 0) {
+                    free_async_ticket(tls);
+                    ret = save_ret;
+                }
+            }
             goto Exit;
         }
     }
@@ -3916,9 +4700,15 @@ static int server_handle_hello(ptls_t *tls, ptls_message_emitter_t *emitter, ptl
         tls->key_share = key_share.algorithm;
     }
 
-    /* send ServerHello */
-    EMIT_SERVER_HELLO(tls->key_schedule,
-                      { tls->ctx->random_bytes(emitter->buf->base + emitter->buf->off, PTLS_HELLO_RANDOM_SIZE); },
+    /* send ServerHello; when ECH is accepted, the transcript is updated after embedding the confirmation */
+    size_t sh_start = emitter->buf->off + emitter->record_header_length;
+    EMIT_SERVER_HELLO(tls->ech.accepted ? NULL : tls->key_schedule,
+                      {
+                          tls->ctx->random_bytes(emitter->buf->base + emitter->buf->off, PTLS_HELLO_RANDOM_SIZE);
+                          if (tls->ech.accepted)
+                              memset(emitter->buf->base + emitter->buf->off + PTLS_HELLO_RANDOM_SIZE - PTLS_ECH_CONFIRM_LENGTH, 0,
+                                     PTLS_ECH_CONFIRM_LENGTH);
+                      },
                       {
                           ptls_buffer_t *sendbuf = emitter->buf;
                           if (mode != HANDSHAKE_MODE_PSK) {
@@ -3932,6 +4722,18 @@ static int server_handle_hello(ptls_t *tls, ptls_message_emitter_t *emitter, ptl
                                                     { ptls_buffer_push16(sendbuf, (uint16_t)psk_index); });
                           }
                       });
+    if (tls->ech.accepted) {
+        ptls_iovec_t sh = ptls_iovec_init(emitter->buf->base + sh_start, emitter->buf->off - sh_start);
+        size_t confirm_off = PTLS_HANDSHAKE_HEADER_SIZE + 2 + PTLS_HELLO_RANDOM_SIZE - PTLS_ECH_CONFIRM_LENGTH;
+        if ((ret = ech_calc_confirmation(tls->key_schedule, sh.base + confirm_off, tls->ech.inner_client_random,
+                                         PTLS_ECH_CONFIRMATION_SERVER_HELLO, sh, confirm_off)) != 0)
+            goto Exit;
+        ptls__key_schedule_update_hash(tls->key_schedule, sh.base, sh.len);
+    }
+    if (tls->ech.aead != NULL) {
+        ptls_aead_free(tls->ech.aead);
+        tls->ech.aead = NULL;
+    }
     if ((ret = push_change_cipher_spec(tls, emitter)) != 0)
         goto Exit;
 
@@ -3952,21 +4754,21 @@ static int server_handle_hello(ptls_t *tls, ptls_message_emitter_t *emitter, ptl
         if (ch.psk.early_data_indication)
             tls->server.early_data_skipped_bytes = 0;
     }
+    if (ch.record_size_limit != 0 && tls->ctx->update_traffic_key == NULL) {
+        tls->traffic_protection.enc.record_size_limit = ch.record_size_limit;
+        tls->traffic_protection.dec.record_size_limit = tls->ctx->record_size_limit;
+    }
 
     /* send EncryptedExtensions */
     ptls_push_message(emitter, tls->key_schedule, PTLS_HANDSHAKE_TYPE_ENCRYPTED_EXTENSIONS, {
         ptls_buffer_t *sendbuf = emitter->buf;
         ptls_buffer_push_block(sendbuf, 2, {
-            if (tls->esni != NULL) {
-                /* the extension is sent even if the application does not handle server name, because otherwise the handshake
-                 * would fail (FIXME ch.esni.nonce will be zero on HRR) */
-                buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_ENCRYPTED_SERVER_NAME, {
-                    uint8_t response_type = PTLS_ESNI_RESPONSE_TYPE_ACCEPT;
-                    ptls_buffer_pushv(sendbuf, &response_type, 1);
-                    ptls_buffer_pushv(sendbuf, tls->esni->nonce, PTLS_ESNI_NONCE_SIZE);
+            if (tls->ech.offered && !tls->ech.accepted && tls->ctx->ech.server.retry_configs.base != NULL) {
+                buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_ENCRYPTED_CLIENT_HELLO, {
+                    ptls_buffer_pushv(sendbuf, tls->ctx->ech.server.retry_configs.base, tls->ctx->ech.server.retry_configs.len);
                 });
-                free_esni_secret(&tls->esni, 1);
-            } else if (tls->server_name != NULL) {
+            }
+            if (tls->server_name != NULL) {
                 /* In this event, the server SHALL include an extension of type "server_name" in the (extended) server hello.
                  * The "extension_data" field of this extension SHALL be empty. (RFC 6066 section 3) */
                 buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_SERVER_NAME, {});
@@ -3982,6 +4784,11 @@ static int server_handle_hello(ptls_t *tls, ptls_message_emitter_t *emitter, ptl
             }
             if (tls->pending_handshake_secret != NULL)
                 buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_EARLY_DATA, {});
+            if (ch.record_size_limit != 0 && tls->ctx->update_traffic_key == NULL) {
+                uint16_t limit =
+                    tls->ctx->record_size_limit != 0 ? tls->ctx->record_size_limit : PTLS_MAX_PLAINTEXT_RECORD_SIZE + 1;
+                buffer_push_extension(sendbuf, PTLS_EXTENSION_TYPE_RECORD_SIZE_LIMIT, { ptls_buffer_push16(sendbuf, limit); });
+            }
             if ((ret = push_additional_extensions(properties, sendbuf)) != 0)
                 goto Exit;
         });
@@ -4064,6 +4871,7 @@ Exit:
         ptls_clear_memory(ecdh_secret.base, ecdh_secret.len);
         free(ecdh_secret.base);
     }
+    ptls_buffer_dispose(&ech_inner);
     return ret;
 
 #undef EMIT_SERVER_HELLO
@@ -4143,15 +4951,37 @@ static int handle_key_update(ptls_t *tls, ptls_message_emitter_t *emitter, ptls_
     return 0;
 }
 
-static int parse_record_header(struct st_ptls_record_t *rec, const uint8_t *src)
+/**
+ * returns the maximum size of the encrypted records being accepted; when record_size_limit has been advertised, the limit applies
+ * to the records protected by the handshake and application traffic keys, but not to 0-RTT data that the client sends before
+ * learning the limit
+ */
+static size_t max_encrypted_record_size(ptls_t *tls)
+{
+    struct st_ptls_traffic_protection_t *dec = &tls->traffic_protection.dec;
+
+    if (dec->record_size_limit == 0 || dec->aead == NULL)
+        return PTLS_MAX_ENCRYPTED_RECORD_SIZE;
+    if (tls->is_server &&
+        (tls->state == PTLS_STATE_SERVER_EXPECT_END_OF_EARLY_DATA || tls->server.early_data_skipped_bytes != UINT32_MAX))
+        return PTLS_MAX_ENCRYPTED_RECORD_SIZE;
+    return dec->record_size_limit + dec->aead->algo->tag_size;
+}
+
+static int parse_record_header(ptls_t *tls, struct st_ptls_record_t *rec, const uint8_t *src)
 {
     rec->type = src[0];
     rec->version = ntoh16(src + 1);
     rec->length = ntoh16(src + 3);
 
-    if (rec->length >
-        (size_t)(rec->type == PTLS_CONTENT_TYPE_APPDATA ? PTLS_MAX_ENCRYPTED_RECORD_SIZE : PTLS_MAX_PLAINTEXT_RECORD_SIZE))
-        return PTLS_ALERT_DECODE_ERROR;
+    if (rec->type == PTLS_CONTENT_TYPE_APPDATA) {
+        size_t max_size = max_encrypted_record_size(tls);
+        if (rec->length > max_size)
+            return max_size < PTLS_MAX_ENCRYPTED_RECORD_SIZE ? PTLS_ALERT_RECORD_OVERFLOW : PTLS_ALERT_DECODE_ERROR;
+    } else {
+        if (rec->length > PTLS_MAX_PLAINTEXT_RECORD_SIZE)
+            return PTLS_ALERT_DECODE_ERROR;
+    }
 
     return 0;
 }
@@ -4162,7 +4992,7 @@ static int parse_record(ptls_t *tls, struct st_ptls_record_t *rec, const uint8_t
 
     if (tls->recvbuf.rec.base == NULL && *len >= 5) {
         /* fast path */
-        if ((ret = parse_record_header(rec, src)) != 0)
+        if ((ret = parse_record_header(tls, rec, src)) != 0)
             return ret;
         if (5 + rec->length <= *len) {
             rec->fragment = src + 5;
@@ -4177,6 +5007,7 @@ static int parse_record(ptls_t *tls, struct st_ptls_record_t *rec, const uint8_t
 
     if (tls->recvbuf.rec.base == NULL) {
         ptls_buffer_init(&tls->recvbuf.rec, "", 0);
+        tls->recvbuf.rec.is_nonsensitive = 1; /* only carries records as they appear on the wire */
         if ((ret = ptls_buffer_reserve(&tls->recvbuf.rec, 5)) != 0)
             return ret;
     }
@@ -4187,7 +5018,7 @@ static int parse_record(ptls_t *tls, struct st_ptls_record_t *rec, const uint8_t
             return PTLS_ERROR_IN_PROGRESS;
         tls->recvbuf.rec.base[tls->recvbuf.rec.off++] = *src++;
     }
-    if ((ret = parse_record_header(rec, tls->recvbuf.rec.base)) != 0)
+    if ((ret = parse_record_header(tls, rec, tls->recvbuf.rec.base)) != 0)
         return ret;
 
     /* fill the fragment */
@@ -4272,8 +5103,7 @@ void ptls_free(ptls_t *tls)
     ptls_buffer_dispose(&tls->recvbuf.mess);
     free_exporter_master_secret(tls, 1);
     free_exporter_master_secret(tls, 0);
-    if (tls->esni != NULL)
-        free_esni_secret(&tls->esni, tls->is_server);
+    clear_ech(&tls->ech, tls->is_server);
     if (tls->key_schedule != NULL)
         key_schedule_free(tls->key_schedule);
     if (tls->traffic_protection.dec.aead != NULL)
@@ -4283,7 +5113,8 @@ void ptls_free(ptls_t *tls)
     free(tls->server_name);
     free(tls->negotiated_protocol);
     if (tls->is_server) {
-        /* nothing to do */
+        if (tls->server.async_ticket != NULL)
+            free_async_ticket(tls);
     } else {
         if (tls->client.key_share_ctx != NULL)
             tls->client.key_share_ctx->on_exchange(&tls->client.key_share_ctx, 1, NULL, ptls_iovec_init(NULL, 0));
@@ -4382,6 +5213,24 @@ int ptls_is_psk_handshake(ptls_t *tls)
     return tls->is_psk_handshake;
 }
 
+int ptls_set_ticket_result(ptls_t *tls, int status, ptls_iovec_t output)
+{
+    struct st_ptls_async_ticket_t *async;
+    int ret;
+
+    if (!(tls->is_server && (async = tls->server.async_ticket) != NULL && !async->is_complete))
+        return PTLS_ERROR_NOT_AVAILABLE;
+
+    if (status == 0 || (!async->is_encrypt && status == PTLS_ERROR_REJECT_EARLY_DATA)) {
+        if ((ret = ptls_buffer__do_pushv(&async->output, output.base, output.len)) != 0)
+            return ret;
+    }
+    async->status = status;
+    async->is_complete = 1;
+
+    return 0;
+}
+
 void **ptls_get_data_ptr(ptls_t *tls)
 {
     return &tls->data_ptr;
@@ -4724,6 +5573,22 @@ static void init_record_message_emitter(ptls_t *tls, struct st_ptls_record_messa
         {sendbuf, &tls->traffic_protection.enc, 5, begin_record_message, commit_record_message}};
 }
 
+/**
+ * Resumes the processing of ClientHello that has been suspended while decrypting a ticket asynchronously. Returns
+ * PTLS_ERROR_IN_PROGRESS if there is no such ClientHello.
+ */
+static int resume_client_hello(ptls_t *tls, ptls_message_emitter_t *emitter, ptls_handshake_properties_t *properties)
+{
+    struct st_ptls_async_ticket_t *async;
+
+    if (!(tls->is_server && (async = tls->server.async_ticket) != NULL && !async->is_encrypt))
+        return PTLS_ERROR_IN_PROGRESS;
+    if (!async->is_complete)
+        return PTLS_ERROR_ASYNC_OPERATION;
+
+    return server_handle_hello(tls, emitter, ptls_iovec_init(async->client_hello.base, async->client_hello.off), properties);
+}
+
 int ptls_handshake(ptls_t *tls, ptls_buffer_t *_sendbuf, const void *input, size_t *inlen, ptls_handshake_properties_t *properties)
 {
     struct st_ptls_record_message_emitter_t emitter;
@@ -4739,7 +5604,11 @@ int ptls_handshake(ptls_t *tls, ptls_buffer_t *_sendbuf, const void *input, size
     case PTLS_STATE_CLIENT_HANDSHAKE_START: {
         assert(input == NULL || *inlen == 0);
         assert(tls->ctx->key_exchanges[0] != NULL);
-        return send_client_hello(tls, &emitter.super, properties, NULL);
+        if ((ret = send_client_hello(tls, &emitter.super, properties, NULL)) == 0)
+            ret = flush_open_record(emitter.super.enc);
+        if (ret != 0)
+            discard_open_record(emitter.super.enc);
+        return ret;
     }
     default:
         break;
@@ -4752,7 +5621,7 @@ int ptls_handshake(ptls_t *tls, ptls_buffer_t *_sendbuf, const void *input, size
     ptls_buffer_init(&decryptbuf, decryptbuf_small, sizeof(decryptbuf_small));
 
     /* perform handhake until completion or until all the input has been swallowed */
-    ret = PTLS_ERROR_IN_PROGRESS;
+    ret = resume_client_hello(tls, &emitter.super, properties);
     while (ret == PTLS_ERROR_IN_PROGRESS && src != src_end) {
         size_t consumed = src_end - src;
         ret = handle_input(tls, &emitter.super, &decryptbuf, src, &consumed, properties);
@@ -4763,12 +5632,23 @@ int ptls_handshake(ptls_t *tls, ptls_buffer_t *_sendbuf, const void *input, size
     ptls_buffer_dispose(&decryptbuf);
 
     switch (ret) {
+    case PTLS_ERROR_ASYNC_OPERATION:
+        /* nothing has been emitted while processing ClientHello */
+        break;
     case 0:
     case PTLS_ERROR_IN_PROGRESS:
-    case PTLS_ERROR_STATELESS_RETRY:
-        break;
+    case PTLS_ERROR_STATELESS_RETRY: {
+        /* encrypt the handshake messages being coalesced, along with the ticket that has become available */
+        int flush_ret;
+        if ((flush_ret = send_pending_session_ticket(tls, &emitter.super)) == 0 &&
+            (flush_ret = flush_open_record(emitter.super.enc)) == 0)
+            break;
+        ret = flush_ret;
+    }
+    /* fall through */
     default:
         /* flush partially written response */
+        discard_open_record(emitter.super.enc);
         ptls_clear_memory(emitter.super.buf->base + sendbuf_orig_off, emitter.super.buf->off - sendbuf_orig_off);
         emitter.super.buf->off = sendbuf_orig_off;
         /* send alert immediately */
@@ -4834,12 +5714,14 @@ static int update_send_key(ptls_t *tls, ptls_buffer_t *_sendbuf, int request_upd
     ret = 0;
 
 Exit:
-    if (ret != 0)
+    if (ret != 0) {
+        discard_open_record(emitter.super.enc);
         emitter.super.buf->off = sendbuf_orig_off;
+    }
     return ret;
 }
 
-int ptls_send(ptls_t *tls, ptls_buffer_t *sendbuf, const void *input, size_t inlen)
+static int send_key_update_if_needed(ptls_t *tls, ptls_buffer_t *sendbuf)
 {
     assert(tls->traffic_protection.enc.aead != NULL);
 
@@ -4857,43 +5739,439 @@ int ptls_send(ptls_t *tls, ptls_buffer_t *sendbuf, const void *input, size_t inl
         tls->key_update_send_request = 0;
     }
 
-    return buffer_push_encrypted_records(sendbuf, PTLS_CONTENT_TYPE_APPDATA, input, inlen, &tls->traffic_protection.enc);
-}
-
-int ptls_update_key(ptls_t *tls, int request_update)
-{
-    assert(tls->ctx->update_traffic_key == NULL);
-    tls->needs_key_update = 1;
-    tls->key_update_send_request = request_update;
     return 0;
 }
 
-size_t ptls_get_record_overhead(ptls_t *tls)
+static int flush_pending_session_ticket(ptls_t *tls, ptls_buffer_t *_sendbuf)
 {
-    return 6 + tls->traffic_protection.enc.aead->algo->tag_size;
-}
+    struct st_ptls_record_message_emitter_t emitter;
+    int ret;
 
-int ptls_send_alert(ptls_t *tls, ptls_buffer_t *sendbuf, uint8_t level, uint8_t description)
-{
-    size_t rec_start = sendbuf->off;
-    int ret = 0;
+    init_record_message_emitter(tls, &emitter, _sendbuf);
+    size_t sendbuf_orig_off = emitter.super.buf->off;
 
-    buffer_push_record(sendbuf, PTLS_CONTENT_TYPE_ALERT, { ptls_buffer_push(sendbuf, level, description); });
-    /* encrypt the alert if we have the encryption keys, unless when it is the early data key */
-    if (tls->traffic_protection.enc.aead != NULL && !(tls->state <= PTLS_STATE_CLIENT_EXPECT_FINISHED)) {
-        if ((ret = buffer_encrypt_record(sendbuf, rec_start, &tls->traffic_protection.enc)) != 0)
-            goto Exit;
+    if ((ret = send_pending_session_ticket(tls, &emitter.super)) == 0)
+        ret = flush_open_record(emitter.super.enc);
+    if (ret != 0) {
+        discard_open_record(emitter.super.enc);
+        emitter.super.buf->off = sendbuf_orig_off;
     }
-
-Exit:
     return ret;
 }
 
-int ptls_export_secret(ptls_t *tls, void *output, size_t outlen, const char *label, ptls_iovec_t context_value, int is_early)
+int ptls_send(ptls_t *tls, ptls_buffer_t *sendbuf, const void *input, size_t inlen)
 {
-    ptls_hash_algorithm_t *algo = tls->key_schedule->hashes[0].algo;
-    uint8_t *master_secret = is_early ? tls->exporter_master_secret.early : tls->exporter_master_secret.one_rtt,
-            derived_secret[PTLS_MAX_DIGEST_SIZE], context_value_hash[PTLS_MAX_DIGEST_SIZE];
+    int ret;
+
+    if (tls->is_server && tls->server.async_ticket != NULL && (ret = flush_pending_session_ticket(tls, sendbuf)) != 0)
+        return ret;
+    if ((ret = send_key_update_if_needed(tls, sendbuf)) != 0)
+        return ret;
+
+    return buffer_push_encrypted_records(sendbuf, PTLS_CONTENT_TYPE_APPDATA, input, inlen, &tls->traffic_protection.enc);
+}
+
+/**
+ * State shared by the jobs of `ptls_send_parallel` and `ptls_receive_parallel`. Each job instantiates its own AEAD context from
+ * `key` and `iv`, as AEAD contexts cannot be used concurrently.
+ */
+struct st_ptls_parallel_records_t {
+    ptls_aead_algorithm_t *aead;
+    uint8_t key[PTLS_MAX_DIGEST_SIZE];
+    uint8_t iv[PTLS_MAX_DIGEST_SIZE];
+    /**
+     * sequence number of the first record
+     */
+    uint64_t seq;
+    size_t num_records;
+    /**
+     * used by send; maximum number of bytes carried by each record
+     */
+    size_t max_record_size;
+    const uint8_t *input;
+    size_t inlen;
+    uint8_t *output;
+    /**
+     * used by receive; offset of each record within `input` (`num_records + 1` entries), and the length of each decrypted record
+     * (SIZE_MAX if decryption failed)
+     */
+    size_t *offsets;
+    size_t *decrypted_lengths;
+    int ret;
+};
+
+static int init_parallel_records(ptls_t *tls, struct st_ptls_parallel_records_t *pr, struct st_ptls_traffic_protection_t *tp,
+                                 size_t num_records)
+{
+    int ret;
+
+    *pr = (struct st_ptls_parallel_records_t){tp->aead->algo};
+    if ((ret = get_traffic_key(tls->cipher_suite->hash, pr->key, pr->aead->key_size, 0, tp->secret, ptls_iovec_init(NULL, 0),
+                               tls->ctx->hkdf_label_prefix__obsolete)) != 0)
+        return ret;
+    if ((ret = get_traffic_key(tls->cipher_suite->hash, pr->iv, pr->aead->iv_size, 1, tp->secret, ptls_iovec_init(NULL, 0),
+                               tls->ctx->hkdf_label_prefix__obsolete)) != 0)
+        return ret;
+    pr->seq = tp->seq;
+    pr->num_records = num_records;
+
+    return 0;
+}
+
+static void dispose_parallel_records(struct st_ptls_parallel_records_t *pr)
+{
+    ptls_clear_memory(pr->key, sizeof(pr->key));
+    ptls_clear_memory(pr->iv, sizeof(pr->iv));
+}
+
+static void send_parallel_job(void *_pr, size_t index)
+{
+    struct st_ptls_parallel_records_t *pr = _pr;
+    size_t rec_index = index * PTLS_PARALLEL_RECORDS_PER_JOB, rec_end = rec_index + PTLS_PARALLEL_RECORDS_PER_JOB,
+           rec_size = 5 + pr->max_record_size + 1 + pr->aead->tag_size;
+    struct st_ptls_traffic_protection_t enc;
+
+    if ((enc.aead = ptls_aead_new_direct(pr->aead, 1, pr->key, pr->iv)) == NULL) {
+        pr->ret = PTLS_ERROR_NO_MEMORY;
+        return;
+    }
+    enc.seq = pr->seq + rec_index;
+
+    if (rec_end > pr->num_records)
+        rec_end = pr->num_records;
+    for (; rec_index < rec_end; ++rec_index) {
+        size_t src_off = rec_index * pr->max_record_size, chunk_size = pr->inlen - src_off;
+        uint8_t *dst = pr->output + rec_index * rec_size;
+        if (chunk_size > pr->max_record_size)
+            chunk_size = pr->max_record_size;
+        size_t enclen = aead_encrypt(&enc, dst + 5, pr->input + src_off, chunk_size, PTLS_CONTENT_TYPE_APPDATA);
+        dst[0] = PTLS_CONTENT_TYPE_APPDATA;
+        dst[1] = PTLS_RECORD_VERSION_MAJOR;
+        dst[2] = PTLS_RECORD_VERSION_MINOR;
+        dst[3] = (uint8_t)(enclen >> 8);
+        dst[4] = (uint8_t)enclen;
+    }
+
+    ptls_aead_free(enc.aead);
+}
+
+int ptls_send_parallel(ptls_t *tls, ptls_buffer_t *sendbuf, const void *input, size_t inlen, ptls_run_parallel_t *run_parallel)
+{
+    struct st_ptls_parallel_records_t pr;
+    size_t max_record_size = max_plaintext_record_size(&tls->traffic_protection.enc),
+           num_records = (inlen + max_record_size - 1) / max_record_size,
+           num_jobs = (num_records + PTLS_PARALLEL_RECORDS_PER_JOB - 1) / PTLS_PARALLEL_RECORDS_PER_JOB, outlen;
+    int ret;
+
+    if (num_jobs <= 1)
+        return ptls_send(tls, sendbuf, input, inlen);
+
+    if (tls->is_server && tls->server.async_ticket != NULL && (ret = flush_pending_session_ticket(tls, sendbuf)) != 0)
+        return ret;
+    if ((ret = send_key_update_if_needed(tls, sendbuf)) != 0)
+        return ret;
+    if ((ret = init_parallel_records(tls, &pr, &tls->traffic_protection.enc, num_records)) != 0)
+        goto Exit;
+    pr.max_record_size = max_record_size;
+    outlen = inlen + num_records * (5 + 1 + pr.aead->tag_size);
+    if ((ret = ptls_buffer_reserve(sendbuf, outlen)) != 0)
+        goto Exit;
+    pr.input = input;
+    pr.inlen = inlen;
+    pr.output = sendbuf->base + sendbuf->off;
+
+    run_parallel->cb(run_parallel, send_parallel_job, &pr, num_jobs);
+    if ((ret = pr.ret) != 0)
+        goto Exit;
+
+    tls->traffic_protection.enc.seq += num_records;
+    sendbuf->off += outlen;
+
+Exit:
+    dispose_parallel_records(&pr);
+    return ret;
+}
+
+static void receive_parallel_job(void *_pr, size_t index)
+{
+    struct st_ptls_parallel_records_t *pr = _pr;
+    size_t rec_index = index * PTLS_PARALLEL_RECORDS_PER_JOB, rec_end = rec_index + PTLS_PARALLEL_RECORDS_PER_JOB;
+    struct st_ptls_traffic_protection_t dec;
+
+    if ((dec.aead = ptls_aead_new_direct(pr->aead, 0, pr->key, pr->iv)) == NULL) {
+        pr->ret = PTLS_ERROR_NO_MEMORY;
+        return;
+    }
+
+    if (rec_end > pr->num_records)
+        rec_end = pr->num_records;
+    for (; rec_index < rec_end; ++rec_index) {
+        size_t off = pr->offsets[rec_index];
+        dec.seq = pr->seq + rec_index;
+        if (aead_decrypt(&dec, pr->output + off, pr->decrypted_lengths + rec_index, pr->input + off + 5,
+                         pr->offsets[rec_index + 1] - off - 5) != 0)
+            pr->decrypted_lengths[rec_index] = SIZE_MAX;
+    }
+
+    ptls_aead_free(dec.aead);
+}
+
+int ptls_receive_parallel(ptls_t *tls, ptls_buffer_t *decryptbuf, const void *_input, size_t *inlen,
+                          ptls_run_parallel_t *run_parallel)
+{
+    const uint8_t *input = (const uint8_t *)_input, *const end = input + *inlen;
+    struct st_ptls_parallel_records_t pr = {NULL};
+    size_t num_records = 0, num_jobs, i;
+    int ret = 0;
+
+    assert(tls->state >= PTLS_STATE_SERVER_EXPECT_END_OF_EARLY_DATA);
+
+    /* count the complete application data records, unless there is a partial record or a partial handshake message pending */
+    if (tls->state >= PTLS_STATE_POST_HANDSHAKE_MIN && tls->traffic_protection.dec.aead != NULL && tls->recvbuf.rec.base == NULL &&
+        tls->recvbuf.mess.base == NULL) {
+        const uint8_t *src = input;
+        size_t max_reclen = max_encrypted_record_size(tls);
+        while (end - src >= 5 && src[0] == PTLS_CONTENT_TYPE_APPDATA) {
+            size_t reclen = ntoh16(src + 3);
+            if (reclen > max_reclen || (size_t)(end - src) - 5 < reclen)
+                break;
+            src += 5 + reclen;
+            ++num_records;
+        }
+    }
+    num_jobs = (num_records + PTLS_PARALLEL_RECORDS_PER_JOB - 1) / PTLS_PARALLEL_RECORDS_PER_JOB;
+
+    if (num_jobs > 1) {
+        if ((ret = init_parallel_records(tls, &pr, &tls->traffic_protection.dec, num_records)) != 0)
+            goto Exit;
+        if ((pr.offsets = malloc(sizeof(*pr.offsets) * (num_records * 2 + 1))) == NULL) {
+            ret = PTLS_ERROR_NO_MEMORY;
+            goto Exit;
+        }
+        pr.decrypted_lengths = pr.offsets + num_records + 1;
+        pr.offsets[0] = 0;
+        for (i = 0; i < num_records; ++i)
+            pr.offsets[i + 1] = pr.offsets[i] + 5 + ntoh16(input + pr.offsets[i] + 3);
+        /* each record is decrypted at the offset it has within the input, then moved to the front */
+        if ((ret = ptls_buffer_reserve(decryptbuf, pr.offsets[num_records])) != 0)
+            goto Exit;
+        pr.input = input;
+        pr.output = decryptbuf->base + decryptbuf->off;
+
+        run_parallel->cb(run_parallel, receive_parallel_job, &pr, num_jobs);
+        if ((ret = pr.ret) != 0) {
+            ptls_clear_memory(pr.output, pr.offsets[num_records]);
+            goto Exit;
+        }
+
+        /* append the application data in order, stopping at the first record that needs to be handled by `ptls_receive` */
+        for (i = 0; i < num_records; ++i) {
+            const uint8_t *fragment = pr.output + pr.offsets[i];
+            size_t length = pr.decrypted_lengths[i];
+            if (length == SIZE_MAX)
+                break;
+            for (; length != 0; --length)
+                if (fragment[length - 1] != 0)
+                    break;
+            if (length == 0 || fragment[length - 1] != PTLS_CONTENT_TYPE_APPDATA)
+                break;
+            memmove(decryptbuf->base + decryptbuf->off, fragment, length - 1);
+            decryptbuf->off += length - 1;
+        }
+        ptls_clear_memory(decryptbuf->base + decryptbuf->off,
+                          pr.output + pr.offsets[num_records] - (decryptbuf->base + decryptbuf->off));
+        tls->traffic_protection.dec.seq += i;
+        input += pr.offsets[i];
+    }
+
+    /* process the rest (if any) one record at a time */
+    while (ret == 0 && input != end) {
+        size_t consumed = end - input;
+        ret = ptls_receive(tls, decryptbuf, input, &consumed);
+        input += consumed;
+    }
+
+Exit:
+    free(pr.offsets);
+    dispose_parallel_records(&pr);
+    *inlen -= end - input;
+    return ret;
+}
+
+#ifndef _WINDOWS
+
+struct st_ptls_thread_pool_t {
+    ptls_run_parallel_t super;
+    pthread_mutex_t mutex;
+    /**
+     * signalled when a task is posted, or when the pool is being destroyed
+     */
+    pthread_cond_t task_posted;
+    /**
+     * signalled when all the jobs of a task have completed
+     */
+    pthread_cond_t task_completed;
+    uint64_t generation;
+    int shutdown;
+    /**
+     * the task being run; `job` is NULL when idle
+     */
+    struct {
+        void (*job)(void *job_data, size_t index);
+        void *job_data;
+        size_t num_jobs;
+        size_t next;
+        size_t completed;
+    } task;
+    size_t num_threads;
+    pthread_t threads[1];
+};
+
+/**
+ * runs the jobs of the current task until none is left; called with the mutex being locked
+ */
+static void thread_pool_run_jobs(struct st_ptls_thread_pool_t *pool)
+{
+    while (pool->task.job != NULL && pool->task.next < pool->task.num_jobs) {
+        void (*job)(void *, size_t) = pool->task.job;
+        void *job_data = pool->task.job_data;
+        size_t index = pool->task.next++;
+        pthread_mutex_unlock(&pool->mutex);
+        job(job_data, index);
+        pthread_mutex_lock(&pool->mutex);
+        if (++pool->task.completed == pool->task.num_jobs)
+            pthread_cond_broadcast(&pool->task_completed);
+    }
+}
+
+static void *thread_pool_main(void *_pool)
+{
+    struct st_ptls_thread_pool_t *pool = _pool;
+    uint64_t generation = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (1) {
+        while (!pool->shutdown && pool->generation == generation)
+            pthread_cond_wait(&pool->task_posted, &pool->mutex);
+        if (pool->shutdown)
+            break;
+        generation = pool->generation;
+        thread_pool_run_jobs(pool);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    /* release the AEAD contexts recycled by the jobs that have run on this thread */
+    ptls_aead_pool_clear();
+
+    return NULL;
+}
+
+static void thread_pool_run(ptls_run_parallel_t *_self, void (*job)(void *job_data, size_t index), void *job_data, size_t num_jobs)
+{
+    struct st_ptls_thread_pool_t *pool = (void *)_self;
+
+    if (num_jobs == 0)
+        return;
+
+    pthread_mutex_lock(&pool->mutex);
+
+    /* wait for the task being run by another thread */
+    while (pool->task.job != NULL)
+        pthread_cond_wait(&pool->task_completed, &pool->mutex);
+
+    pool->task.job = job;
+    pool->task.job_data = job_data;
+    pool->task.num_jobs = num_jobs;
+    pool->task.next = 0;
+    pool->task.completed = 0;
+    ++pool->generation;
+    pthread_cond_broadcast(&pool->task_posted);
+
+    thread_pool_run_jobs(pool);
+    while (pool->task.completed != pool->task.num_jobs)
+        pthread_cond_wait(&pool->task_completed, &pool->mutex);
+    pool->task.job = NULL;
+    pthread_cond_broadcast(&pool->task_completed);
+
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+ptls_run_parallel_t *ptls_thread_pool_new(size_t num_threads)
+{
+    struct st_ptls_thread_pool_t *pool;
+
+    if ((pool = malloc(offsetof(struct st_ptls_thread_pool_t, threads) + sizeof(pool->threads[0]) * (num_threads + 1))) == NULL)
+        return NULL;
+    *pool = (struct st_ptls_thread_pool_t){{thread_pool_run}};
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->task_posted, NULL);
+    pthread_cond_init(&pool->task_completed, NULL);
+
+    for (; pool->num_threads < num_threads; ++pool->num_threads) {
+        if (pthread_create(pool->threads + pool->num_threads, NULL, thread_pool_main, pool) != 0) {
+            ptls_thread_pool_free(&pool->super);
+            return NULL;
+        }
+    }
+
+    return &pool->super;
+}
+
+void ptls_thread_pool_free(ptls_run_parallel_t *_pool)
+{
+    struct st_ptls_thread_pool_t *pool = (void *)_pool;
+    size_t i;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->task_posted);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (i = 0; i != pool->num_threads; ++i)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->task_completed);
+    pthread_cond_destroy(&pool->task_posted);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+}
+
+#endif
+
+int ptls_update_key(ptls_t *tls, int request_update)
+{
+    assert(tls->ctx->update_traffic_key == NULL);
+    tls->needs_key_update = 1;
+    tls->key_update_send_request = request_update;
+    return 0;
+}
+
+size_t ptls_get_record_overhead(ptls_t *tls)
+{
+    return 6 + tls->traffic_protection.enc.aead->algo->tag_size;
+}
+
+int ptls_send_alert(ptls_t *tls, ptls_buffer_t *sendbuf, uint8_t level, uint8_t description)
+{
+    size_t rec_start = sendbuf->off;
+    int ret = 0;
+
+    buffer_push_record(sendbuf, PTLS_CONTENT_TYPE_ALERT, { ptls_buffer_push(sendbuf, level, description); });
+    /* encrypt the alert if we have the encryption keys, unless when it is the early data key */
+    if (tls->traffic_protection.enc.aead != NULL && !(tls->state <= PTLS_STATE_CLIENT_EXPECT_FINISHED)) {
+        if ((ret = buffer_encrypt_record(sendbuf, rec_start, &tls->traffic_protection.enc)) != 0)
+            goto Exit;
+    }
+
+Exit:
+    return ret;
+}
+
+int ptls_export_secret(ptls_t *tls, void *output, size_t outlen, const char *label, ptls_iovec_t context_value, int is_early)
+{
+    ptls_hash_algorithm_t *algo = tls->key_schedule->hashes[0].algo;
+    uint8_t *master_secret = is_early ? tls->exporter_master_secret.early : tls->exporter_master_secret.one_rtt,
+            derived_secret[PTLS_MAX_DIGEST_SIZE], context_value_hash[PTLS_MAX_DIGEST_SIZE];
     int ret;
 
     if (master_secret == NULL) {
@@ -5143,11 +6421,48 @@ ptls_aead_context_t *ptls_aead_new(ptls_aead_algorithm_t *aead, ptls_hash_algori
     return new_aead(aead, hash, is_enc, secret, ptls_iovec_init(NULL, 0), label_prefix);
 }
 
+size_t ptls_aead_pool_max_bytes = 0;
+
+/**
+ * AEAD contexts being freed are retained per thread, so that the memory they have allocated (and grown) can be reused by the
+ * connections that follow
+ */
+static PTLS_THREADLOCAL struct {
+    struct {
+        ptls_aead_context_t *ctx;
+        size_t size;
+    } entries[PTLS_AEAD_POOL_SIZE + 1];
+    size_t count;
+    size_t bytes;
+} aead_pool;
+
+static ptls_aead_context_t *aead_pool_take(ptls_aead_algorithm_t *aead)
+{
+    size_t i;
+
+    for (i = aead_pool.count; i != 0; --i) {
+        ptls_aead_context_t *ctx = aead_pool.entries[i - 1].ctx;
+        if (ctx->algo == aead) {
+            aead_pool.bytes -= aead_pool.entries[i - 1].size;
+            aead_pool.entries[i - 1] = aead_pool.entries[--aead_pool.count];
+            return ctx;
+        }
+    }
+
+    return NULL;
+}
+
 ptls_aead_context_t *ptls_aead_new_direct(ptls_aead_algorithm_t *aead, int is_enc, const void *key, const void *iv)
 {
-    ptls_aead_context_t *ctx;
+    ptls_aead_context_t *ctx = NULL;
+
+    if (key != NULL && (ctx = aead_pool_take(aead)) != NULL && ctx->do_recycle != NULL) {
+        if (ctx->do_recycle(ctx, is_enc, key, iv) == 0)
+            return ctx;
+        /* upon failure, the context has been disposed by the callback; fall back to setting up the reclaimed memory */
+    }
 
-    if ((ctx = (ptls_aead_context_t *)malloc(aead->context_size)) == NULL)
+    if (ctx == NULL && (ctx = (ptls_aead_context_t *)malloc(aead->context_size)) == NULL)
         return NULL;
 
     *ctx = (ptls_aead_context_t){aead};
@@ -5162,8 +6477,39 @@ ptls_aead_context_t *ptls_aead_new_direct(ptls_aead_algorithm_t *aead, int is_en
 
 void ptls_aead_free(ptls_aead_context_t *ctx)
 {
-    ctx->dispose_crypto(ctx);
-    free(ctx);
+    size_t size = ctx->algo->context_size;
+
+    /* contexts without do_recycle retain only their own allocation */
+    if (ctx->do_recycle != NULL && ctx->do_get_memory_size != NULL)
+        size += ctx->do_get_memory_size(ctx);
+
+    if (aead_pool.count == PTLS_AEAD_POOL_SIZE || aead_pool.bytes + size > ptls_aead_pool_max_bytes) {
+        ctx->dispose_crypto(ctx);
+        free(ctx);
+        return;
+    }
+
+    if (ctx->do_recycle != NULL) {
+        ctx->do_recycle(ctx, 0, NULL, NULL);
+    } else {
+        ctx->dispose_crypto(ctx);
+        *ctx = (ptls_aead_context_t){ctx->algo};
+    }
+    aead_pool.entries[aead_pool.count].ctx = ctx;
+    aead_pool.entries[aead_pool.count].size = size;
+    ++aead_pool.count;
+    aead_pool.bytes += size;
+}
+
+void ptls_aead_pool_clear(void)
+{
+    while (aead_pool.count != 0) {
+        ptls_aead_context_t *ctx = aead_pool.entries[--aead_pool.count].ctx;
+        if (ctx->do_recycle != NULL)
+            ctx->dispose_crypto(ctx);
+        free(ctx);
+    }
+    aead_pool.bytes = 0;
 }
 
 void ptls_aead__build_iv(ptls_aead_algorithm_t *algo, uint8_t *iv, const uint8_t *static_iv, uint64_t seq)
@@ -5182,6 +6528,246 @@ void ptls_aead__build_iv(ptls_aead_algorithm_t *algo, uint8_t *iv, const uint8_t
     } while (i != 0);
 }
 
+static void integrity_only_aead_dispose_crypto(ptls_aead_context_t *_ctx)
+{
+    ptls_integrity_only_aead_context_t *ctx = (ptls_integrity_only_aead_context_t *)_ctx;
+
+    ctx->hmac->final(ctx->hmac, NULL, PTLS_HASH_FINAL_MODE_FREE);
+    ptls_clear_memory(ctx->static_iv, sizeof(ctx->static_iv));
+}
+
+static void integrity_only_aead_do_encrypt_init(ptls_aead_context_t *_ctx, uint64_t seq, const void *aad, size_t aadlen)
+{
+    ptls_integrity_only_aead_context_t *ctx = (ptls_integrity_only_aead_context_t *)_ctx;
+    uint8_t iv[PTLS_MAX_DIGEST_SIZE];
+
+    ptls_aead__build_iv(ctx->super.algo, iv, ctx->static_iv, seq);
+    ctx->hmac->update(ctx->hmac, iv, ctx->super.algo->iv_size);
+    ctx->hmac->update(ctx->hmac, aad, aadlen);
+}
+
+static size_t integrity_only_aead_do_encrypt_update(ptls_aead_context_t *_ctx, void *output, const void *input, size_t inlen)
+{
+    ptls_integrity_only_aead_context_t *ctx = (ptls_integrity_only_aead_context_t *)_ctx;
+
+    ctx->hmac->update(ctx->hmac, input, inlen);
+    if (output != input)
+        memmove(output, input, inlen);
+    return inlen;
+}
+
+static size_t integrity_only_aead_do_encrypt_final(ptls_aead_context_t *_ctx, void *output)
+{
+    ptls_integrity_only_aead_context_t *ctx = (ptls_integrity_only_aead_context_t *)_ctx;
+
+    ctx->hmac->final(ctx->hmac, output, PTLS_HASH_FINAL_MODE_RESET);
+    return ctx->super.algo->tag_size;
+}
+
+static size_t integrity_only_aead_do_decrypt(ptls_aead_context_t *_ctx, void *output, const void *input, size_t inlen, uint64_t seq,
+                                             const void *aad, size_t aadlen)
+{
+    ptls_integrity_only_aead_context_t *ctx = (ptls_integrity_only_aead_context_t *)_ctx;
+    size_t tag_size = ctx->super.algo->tag_size, textlen;
+    uint8_t tag[PTLS_MAX_DIGEST_SIZE];
+
+    if (inlen < tag_size)
+        return SIZE_MAX;
+    textlen = inlen - tag_size;
+
+    integrity_only_aead_do_encrypt_init(&ctx->super, seq, aad, aadlen);
+    ctx->hmac->update(ctx->hmac, input, textlen);
+    ctx->hmac->final(ctx->hmac, tag, PTLS_HASH_FINAL_MODE_RESET);
+    if (!ptls_mem_equal(tag, (const uint8_t *)input + textlen, tag_size))
+        return SIZE_MAX;
+
+    if (output != input)
+        memmove(output, input, textlen);
+    return textlen;
+}
+
+int ptls_integrity_only_aead_setup_crypto(ptls_aead_context_t *_ctx, const void *key, const void *iv, ptls_hash_algorithm_t *hash)
+{
+    ptls_integrity_only_aead_context_t *ctx = (ptls_integrity_only_aead_context_t *)_ctx;
+
+    assert(ctx->super.algo->key_size == hash->digest_size);
+    assert(ctx->super.algo->iv_size == hash->digest_size);
+    assert(ctx->super.algo->tag_size == hash->digest_size);
+    assert(hash->digest_size <= PTLS_MAX_SECRET_SIZE && hash->digest_size <= PTLS_MAX_IV_SIZE);
+
+    if ((ctx->hmac = ptls_hmac_create(hash, key, hash->digest_size)) == NULL)
+        return PTLS_ERROR_NO_MEMORY;
+    memcpy(ctx->static_iv, iv, hash->digest_size);
+
+    ctx->super.dispose_crypto = integrity_only_aead_dispose_crypto;
+    ctx->super.do_encrypt_init = integrity_only_aead_do_encrypt_init;
+    ctx->super.do_encrypt_update = integrity_only_aead_do_encrypt_update;
+    ctx->super.do_encrypt_final = integrity_only_aead_do_encrypt_final;
+    ctx->super.do_encrypt = ptls_aead__do_encrypt;
+    ctx->super.do_decrypt = integrity_only_aead_do_decrypt;
+
+    return 0;
+}
+
+#define CALIBRATION_RECORD_SIZE PTLS_MAX_PLAINTEXT_RECORD_SIZE
+#define CALIBRATION_USEC 2000
+
+static uint64_t calibration_now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/**
+ * seals a record using the interface that the record layer uses
+ */
+static size_t calibration_seal(ptls_aead_context_t *ctx, uint8_t *output, const uint8_t *input, uint64_t seq, const uint8_t *aad)
+{
+    size_t off;
+
+    ptls_aead_encrypt_init(ctx, seq, aad, 5);
+    off = ptls_aead_encrypt_update(ctx, output, input, CALIBRATION_RECORD_SIZE);
+    off += ptls_aead_encrypt_final(ctx, output + off);
+
+    return off;
+}
+
+/**
+ * Returns the time (in nanoseconds) that the AEAD spends to seal and open one record, or UINT64_MAX if it fails to interoperate
+ * with the reference implementation.
+ */
+static uint64_t calibrate_aead(ptls_aead_algorithm_t *aead, ptls_aead_algorithm_t *ref, const uint8_t *plaintext,
+                               uint8_t *encrypted, uint8_t *decrypted)
+{
+    const uint8_t *key = plaintext, *iv = key + PTLS_MAX_SECRET_SIZE, *aad = iv + PTLS_MAX_IV_SIZE;
+    ptls_aead_context_t *enc = NULL, *dec = NULL, *ref_enc = NULL, *ref_dec = NULL;
+    uint64_t start, elapsed, seq = 0, iterations = 0, result = UINT64_MAX;
+    size_t enclen;
+
+    /* key and IV are laid out at the head of `plaintext`, each occupying the maximum size */
+    assert(aead->key_size <= PTLS_MAX_SECRET_SIZE && aead->iv_size <= PTLS_MAX_IV_SIZE);
+
+    if ((enc = ptls_aead_new_direct(aead, 1, key, iv)) == NULL || (dec = ptls_aead_new_direct(aead, 0, key, iv)) == NULL ||
+        (ref_enc = ptls_aead_new_direct(ref, 1, key, iv)) == NULL || (ref_dec = ptls_aead_new_direct(ref, 0, key, iv)) == NULL)
+        goto Exit;
+
+    /* check interoperability in both directions */
+    enclen = calibration_seal(enc, encrypted, plaintext, seq, aad);
+    if (ptls_aead_decrypt(ref_dec, decrypted, encrypted, enclen, seq, aad, 5) != CALIBRATION_RECORD_SIZE ||
+        memcmp(decrypted, plaintext, CALIBRATION_RECORD_SIZE) != 0)
+        goto Exit;
+    ++seq;
+    enclen = calibration_seal(ref_enc, encrypted, plaintext, seq, aad);
+    if (ptls_aead_decrypt(dec, decrypted, encrypted, enclen, seq, aad, 5) != CALIBRATION_RECORD_SIZE ||
+        memcmp(decrypted, plaintext, CALIBRATION_RECORD_SIZE) != 0)
+        goto Exit;
+    ++seq;
+
+    /* measure */
+    start = calibration_now();
+    do {
+        enclen = calibration_seal(enc, encrypted, plaintext, seq, aad);
+        if (ptls_aead_decrypt(dec, decrypted, encrypted, enclen, seq, aad, 5) != CALIBRATION_RECORD_SIZE)
+            goto Exit;
+        ++seq;
+        ++iterations;
+    } while ((elapsed = calibration_now() - start) < CALIBRATION_USEC);
+    result = elapsed * 1000 / iterations;
+
+Exit:
+    if (enc != NULL)
+        ptls_aead_free(enc);
+    if (dec != NULL)
+        ptls_aead_free(dec);
+    if (ref_enc != NULL)
+        ptls_aead_free(ref_enc);
+    if (ref_dec != NULL)
+        ptls_aead_free(ref_dec);
+    return result;
+}
+
+/**
+ * Returns the time (in nanoseconds) that the hash function spends to digest one record, or UINT64_MAX if the output differs from
+ * that of the reference implementation.
+ */
+static uint64_t calibrate_hash(ptls_hash_algorithm_t *hash, ptls_hash_algorithm_t *ref, const uint8_t *input)
+{
+    uint8_t digest[PTLS_MAX_DIGEST_SIZE], ref_digest[PTLS_MAX_DIGEST_SIZE];
+    uint64_t start, elapsed, iterations = 0;
+
+    if (hash->digest_size != ref->digest_size || ptls_calc_hash(hash, digest, input, CALIBRATION_RECORD_SIZE) != 0 ||
+        ptls_calc_hash(ref, ref_digest, input, CALIBRATION_RECORD_SIZE) != 0 || memcmp(digest, ref_digest, hash->digest_size) != 0)
+        return UINT64_MAX;
+
+    start = calibration_now();
+    do {
+        if (ptls_calc_hash(hash, digest, input, CALIBRATION_RECORD_SIZE) != 0)
+            return UINT64_MAX;
+        ++iterations;
+    } while ((elapsed = calibration_now() - start) < CALIBRATION_USEC);
+
+    return elapsed * 1000 / iterations;
+}
+
+size_t ptls_calibrate_cipher_suites(ptls_calibrated_cipher_suite_t *results, size_t max_results,
+                                    const ptls_cipher_suite_backend_t *backends)
+{
+    const ptls_cipher_suite_backend_t *backend;
+    uint8_t *buf;
+    size_t num_results = 0, i;
+
+    /* plaintext (also used as key, iv and aad), ciphertext, decrypted */
+    if ((buf = malloc(CALIBRATION_RECORD_SIZE * 3 + PTLS_MAX_DIGEST_SIZE)) == NULL)
+        return 0;
+    for (i = 0; i != CALIBRATION_RECORD_SIZE; ++i)
+        buf[i] = (uint8_t)(i * 7 + 1);
+
+    for (backend = backends; backend->name != NULL; ++backend) {
+        ptls_cipher_suite_t **cs;
+        for (cs = backend->cipher_suites; *cs != NULL; ++cs) {
+            const ptls_cipher_suite_backend_t *ref_backend;
+            ptls_cipher_suite_t *ref = NULL, **ref_cs;
+            ptls_calibrated_cipher_suite_t *result;
+            uint64_t nsec;
+            /* the first implementation of the cipher suite is the reference */
+            for (ref_backend = backends; ref == NULL; ++ref_backend) {
+                for (ref_cs = ref_backend->cipher_suites; *ref_cs != NULL; ++ref_cs) {
+                    if ((*ref_cs)->id == (*cs)->id) {
+                        ref = *ref_cs;
+                        break;
+                    }
+                }
+            }
+            /* find or add the entry */
+            for (result = results; result != results + num_results; ++result)
+                if (result->suite.id == (*cs)->id)
+                    break;
+            if (result == results + num_results) {
+                if (num_results == max_results)
+                    continue;
+                *result = (ptls_calibrated_cipher_suite_t){**cs, backend->name, UINT64_MAX, backend->name, UINT64_MAX};
+                ++num_results;
+            }
+            /* adopt the implementations if they are faster */
+            if ((nsec = calibrate_aead((*cs)->aead, ref->aead, buf, buf + CALIBRATION_RECORD_SIZE,
+                                       buf + CALIBRATION_RECORD_SIZE * 2 + PTLS_MAX_DIGEST_SIZE)) < result->aead_nsec) {
+                result->suite.aead = (*cs)->aead;
+                result->aead_backend = backend->name;
+                result->aead_nsec = nsec;
+            }
+            if ((nsec = calibrate_hash((*cs)->hash, ref->hash, buf)) < result->hash_nsec) {
+                result->suite.hash = (*cs)->hash;
+                result->hash_backend = backend->name;
+                result->hash_nsec = nsec;
+            }
+        }
+    }
+
+    free(buf);
+    return num_results;
+}
+
 static void clear_memory(void *p, size_t len)
 {
     if (len != 0)
@@ -5203,6 +6789,88 @@ static int mem_equal(const void *_x, const void *_y, size_t len)
 
 int (*volatile ptls_mem_equal)(const void *x, const void *y, size_t len) = mem_equal;
 
+size_t ptls_chacha20_random_reseed_interval = 1024 * 1024;
+
+static PTLS_THREADLOCAL struct {
+    ptls_cipher_algorithm_t *algo;
+    unsigned fork_generation;
+    size_t bytes_since_seed;
+    /**
+     * number of bytes available at the tail of `buf`; the bytes that have been consumed are zero-cleared
+     */
+    size_t avail;
+    uint8_t key[PTLS_CHACHA20_KEY_SIZE];
+    uint8_t buf[2048];
+} chacha20_random;
+
+#ifndef _WINDOWS
+static volatile unsigned chacha20_random_fork_generation;
+static pthread_once_t chacha20_random_atfork_once = PTHREAD_ONCE_INIT;
+
+static void chacha20_random_on_fork_child(void)
+{
+    ++chacha20_random_fork_generation;
+}
+
+static void chacha20_random_register_atfork(void)
+{
+    pthread_atfork(NULL, NULL, chacha20_random_on_fork_child);
+}
+#endif
+
+static void chacha20_random_refill(void)
+{
+    static const uint8_t zero_iv[PTLS_CHACHA20_IV_SIZE] = {0};
+    ptls_cipher_context_t *ctx;
+
+    if ((ctx = ptls_cipher_new(chacha20_random.algo, 1, chacha20_random.key)) == NULL) {
+        fprintf(stderr, "ptls_chacha20_random_bytes: failed to instantiate the cipher\n");
+        abort();
+    }
+    ptls_cipher_init(ctx, zero_iv);
+    memset(chacha20_random.buf, 0, sizeof(chacha20_random.buf));
+    ptls_cipher_encrypt(ctx, chacha20_random.buf, chacha20_random.buf, sizeof(chacha20_random.buf));
+    ptls_cipher_free(ctx);
+
+    /* the first bytes of the keystream become the next key */
+    memcpy(chacha20_random.key, chacha20_random.buf, sizeof(chacha20_random.key));
+    ptls_clear_memory(chacha20_random.buf, sizeof(chacha20_random.key));
+    chacha20_random.avail = sizeof(chacha20_random.buf) - sizeof(chacha20_random.key);
+}
+
+void ptls_chacha20_random_bytes(ptls_cipher_algorithm_t *chacha20, void (*seed)(void *buf, size_t len), void *_buf, size_t len)
+{
+    uint8_t *buf = _buf;
+    unsigned fork_generation = 0;
+
+#ifndef _WINDOWS
+    pthread_once(&chacha20_random_atfork_once, chacha20_random_register_atfork);
+    fork_generation = chacha20_random_fork_generation;
+#endif
+
+    if (chacha20_random.algo != chacha20 || chacha20_random.fork_generation != fork_generation ||
+        chacha20_random.bytes_since_seed >= ptls_chacha20_random_reseed_interval) {
+        chacha20_random.algo = chacha20;
+        chacha20_random.fork_generation = fork_generation;
+        chacha20_random.bytes_since_seed = 0;
+        seed(chacha20_random.key, sizeof(chacha20_random.key));
+        chacha20_random_refill();
+    }
+    chacha20_random.bytes_since_seed += len;
+
+    while (len != 0) {
+        if (chacha20_random.avail == 0)
+            chacha20_random_refill();
+        uint8_t *src = chacha20_random.buf + sizeof(chacha20_random.buf) - chacha20_random.avail;
+        size_t chunk = len < chacha20_random.avail ? len : chacha20_random.avail;
+        memcpy(buf, src, chunk);
+        ptls_clear_memory(src, chunk);
+        buf += chunk;
+        len -= chunk;
+        chacha20_random.avail -= chunk;
+    }
+}
+
 static uint64_t get_time(ptls_get_time_t *self)
 {
     struct timeval tv;
@@ -5291,167 +6959,199 @@ int ptls_handle_message(ptls_t *tls, ptls_buffer_t *sendbuf, size_t epoch_offset
                           : ptls_client_handle_message(tls, sendbuf, epoch_offsets, in_epoch, input, inlen, properties);
 }
 
-int ptls_client_handle_message(ptls_t *tls, ptls_buffer_t *sendbuf, size_t epoch_offsets[5], size_t in_epoch, const void *input,
-                               size_t inlen, ptls_handshake_properties_t *properties)
+static int client_handle_message(ptls_t *tls, ptls_message_emitter_t *emitter, size_t in_epoch, const void *input, size_t inlen,
+                                 ptls_handshake_properties_t *properties)
 {
+    struct st_ptls_record_t rec = {PTLS_CONTENT_TYPE_HANDSHAKE, 0, inlen, input};
+
     assert(!tls->is_server);
 
-    struct st_ptls_raw_message_emitter_t emitter = {
-        {sendbuf, &tls->traffic_protection.enc, 0, begin_raw_message, commit_raw_message}, SIZE_MAX, epoch_offsets};
+    if (input == NULL)
+        return send_client_hello(tls, emitter, properties, NULL);
+
+    if (ptls_get_read_epoch(tls) != in_epoch)
+        return PTLS_ALERT_UNEXPECTED_MESSAGE;
+
+    return handle_handshake_record(tls, handle_client_handshake_message, emitter, &rec, properties);
+}
+
+static int server_handle_message(ptls_t *tls, ptls_message_emitter_t *emitter, size_t in_epoch, const void *input, size_t inlen,
+                                 ptls_handshake_properties_t *properties)
+{
     struct st_ptls_record_t rec = {PTLS_CONTENT_TYPE_HANDSHAKE, 0, inlen, input};
+    int ret;
 
-    if (input == NULL)
-        return send_client_hello(tls, &emitter.super, properties, NULL);
+    assert(tls->is_server);
+
+    /* resume ClientHello being suspended while decrypting a ticket; no input is given in this case */
+    if ((ret = resume_client_hello(tls, emitter, properties)) != PTLS_ERROR_IN_PROGRESS)
+        return ret;
+    assert(input);
 
     if (ptls_get_read_epoch(tls) != in_epoch)
         return PTLS_ALERT_UNEXPECTED_MESSAGE;
 
-    return handle_handshake_record(tls, handle_client_handshake_message, &emitter.super, &rec, properties);
+    return handle_handshake_record(tls, handle_server_handshake_message, emitter, &rec, properties);
 }
 
-int ptls_server_handle_message(ptls_t *tls, ptls_buffer_t *sendbuf, size_t epoch_offsets[5], size_t in_epoch, const void *input,
+int ptls_client_handle_message(ptls_t *tls, ptls_buffer_t *sendbuf, size_t epoch_offsets[5], size_t in_epoch, const void *input,
                                size_t inlen, ptls_handshake_properties_t *properties)
 {
-    assert(tls->is_server);
+    struct st_ptls_raw_message_emitter_t emitter = {
+        {sendbuf, &tls->traffic_protection.enc, 0, begin_raw_message, commit_raw_message}, SIZE_MAX, epoch_offsets};
+
+    return client_handle_message(tls, &emitter.super, in_epoch, input, inlen, properties);
+}
 
+int ptls_server_handle_message(ptls_t *tls, ptls_buffer_t *sendbuf, size_t epoch_offsets[5], size_t in_epoch, const void *input,
+                               size_t inlen, ptls_handshake_properties_t *properties)
+{
     struct st_ptls_raw_message_emitter_t emitter = {
         {sendbuf, &tls->traffic_protection.enc, 0, begin_raw_message, commit_raw_message}, SIZE_MAX, epoch_offsets};
-    struct st_ptls_record_t rec = {PTLS_CONTENT_TYPE_HANDSHAKE, 0, inlen, input};
 
-    assert(input);
+    return server_handle_message(tls, &emitter.super, in_epoch, input, inlen, properties);
+}
 
-    if (ptls_get_read_epoch(tls) != in_epoch)
-        return PTLS_ALERT_UNEXPECTED_MESSAGE;
+struct st_ptls_epoch_message_emitter_t {
+    ptls_message_emitter_t super;
+    ptls_t *tls;
+    ptls_buffer_t **sendbufs;
+};
+
+static ptls_buffer_t *select_epoch_sendbuf(struct st_ptls_epoch_message_emitter_t *self)
+{
+    size_t epoch = self->super.enc->epoch;
+
+    /* As is the case with commit_raw_message, the epoch is that of the key, except for the second ClientHello that is sent after
+     * the 0-RTT key has been installed. The epoch has to be determined before the message is built, as send_client_hello refers
+     * to the buffer before calling `begin_message`. The only message the client sends while waiting for ServerHello is
+     * ClientHello. */
+    if (epoch == 1 && !self->tls->is_server && self->tls->state == PTLS_STATE_CLIENT_EXPECT_SERVER_HELLO)
+        epoch = 0;
+
+    return self->sendbufs[epoch];
+}
+
+static int begin_epoch_message(ptls_message_emitter_t *_self)
+{
+    struct st_ptls_epoch_message_emitter_t *self = (void *)_self;
+
+    self->super.buf = select_epoch_sendbuf(self);
+    return 0;
+}
+
+static int commit_epoch_message(ptls_message_emitter_t *_self)
+{
+    return 0;
+}
+
+int ptls_handle_message_per_epoch(ptls_t *tls, ptls_buffer_t *sendbufs[4], size_t in_epoch, const void *input, size_t inlen,
+                                  ptls_handshake_properties_t *properties)
+{
+    struct st_ptls_epoch_message_emitter_t emitter = {
+        {NULL, &tls->traffic_protection.enc, 0, begin_epoch_message, commit_epoch_message}, tls, sendbufs};
+
+    emitter.super.buf = select_epoch_sendbuf(&emitter);
 
-    return handle_handshake_record(tls, handle_server_handshake_message, &emitter.super, &rec, properties);
+    return tls->is_server ? server_handle_message(tls, &emitter.super, in_epoch, input, inlen, properties)
+                          : client_handle_message(tls, &emitter.super, in_epoch, input, inlen, properties);
 }
 
-int ptls_esni_init_context(ptls_context_t *ctx, ptls_esni_context_t *esni, ptls_iovec_t esni_keys,
-                           ptls_key_exchange_context_t **key_exchanges)
+int ptls_ech_init_server_config(ptls_ech_server_config_t *config, ptls_iovec_t ech_config, ptls_key_exchange_context_t *keyex,
+                                ptls_hpke_kem_t **kems, ptls_hpke_cipher_suite_t **ciphers)
 {
-    const uint8_t *src = esni_keys.base, *const end = src + esni_keys.len;
-    size_t num_key_exchanges, num_cipher_suites = 0;
+    struct st_decoded_ech_config_t decoded;
+    const uint8_t *src = ech_config.base, *const end = src + ech_config.len, *cipher_src;
+    ptls_buffer_t infobuf;
     int ret;
 
-    for (num_key_exchanges = 0; key_exchanges[num_key_exchanges] != NULL; ++num_key_exchanges)
-        ;
+    *config = (ptls_ech_server_config_t){0};
+    ptls_buffer_init(&infobuf, "", 0);
 
-    memset(esni, 0, sizeof(*esni));
-    if ((esni->key_exchanges = malloc(sizeof(*esni->key_exchanges) * (num_key_exchanges + 1))) == NULL) {
-        ret = PTLS_ERROR_NO_MEMORY;
+    /* decode ECHConfig, and check that it matches the private key */
+    if ((ret = decode_one_ech_config(kems, &decoded, &src, end)) != 0)
         goto Exit;
-    }
-    memcpy(esni->key_exchanges, key_exchanges, sizeof(*esni->key_exchanges) * (num_key_exchanges + 1));
-
-    /* ESNIKeys */
-    if ((ret = ptls_decode16(&esni->version, &src, end)) != 0)
+    if (src != end) {
+        ret = PTLS_ALERT_DECODE_ERROR;
         goto Exit;
-    /* Skip checksum fields */
-    if (end - src < 4) {
-        ret = PTLS_ALERT_DECRYPT_ERROR;
+    }
+    if (decoded.kem == NULL || decoded.kem->keyex->id != keyex->algo->id || decoded.public_key.len != keyex->pubkey.len ||
+        memcmp(decoded.public_key.base, keyex->pubkey.base, keyex->pubkey.len) != 0) {
+        ret = PTLS_ERROR_INCOMPATIBLE_KEY;
         goto Exit;
     }
-    src += 4;
-    /* Published SNI field */
-    ptls_decode_open_block(src, end, 2, { src = end; });
 
-    /* Process the list of KeyShareEntries, verify for each of them that the ciphersuite is supported. */
-    ptls_decode_open_block(src, end, 2, {
-        do {
-            /* parse */
-            uint16_t id;
-            if ((ret = ptls_decode16(&id, &src, end)) != 0)
-                goto Exit;
-            ptls_decode_open_block(src, end, 2, { src = end; });
-            /* check that matching key-share exists */
-            ptls_key_exchange_context_t **found;
-            for (found = key_exchanges; *found != NULL; ++found)
-                if ((*found)->algo->id == id)
-                    break;
-            if (found == NULL) {
-                ret = PTLS_ERROR_INCOMPATIBLE_KEY;
-                goto Exit;
-            }
-        } while (src != end);
-    });
-    /* Process the list of cipher_suites. If they are supported, store in esni context  */
-    ptls_decode_open_block(src, end, 2, {
-        void *newp;
-        do {
-            uint16_t id;
-            if ((ret = ptls_decode16(&id, &src, end)) != 0)
-                goto Exit;
-            size_t i;
-            for (i = 0; ctx->cipher_suites[i] != NULL; ++i)
-                if (ctx->cipher_suites[i]->id == id)
-                    break;
-            if (ctx->cipher_suites[i] != NULL) {
-                if ((newp = realloc(esni->cipher_suites, sizeof(*esni->cipher_suites) * (num_cipher_suites + 1))) == NULL) {
-                    ret = PTLS_ERROR_NO_MEMORY;
-                    goto Exit;
-                }
-                esni->cipher_suites = newp;
-                esni->cipher_suites[num_cipher_suites++].cipher_suite = ctx->cipher_suites[i];
-            }
-        } while (src != end);
-        if ((newp = realloc(esni->cipher_suites, sizeof(*esni->cipher_suites) * (num_cipher_suites + 1))) == NULL) {
-            ret = PTLS_ERROR_NO_MEMORY;
-            goto Exit;
-        }
-        esni->cipher_suites = newp;
-        esni->cipher_suites[num_cipher_suites].cipher_suite = NULL;
-    });
-    /* Parse the padded length, not before, not after parameters */
-    if ((ret = ptls_decode16(&esni->padded_length, &src, end)) != 0)
-        goto Exit;
-    if ((ret = ptls_decode64(&esni->not_before, &src, end)) != 0)
+    /* precompute the key schedule context of every cipher suite being supported; info is "tls ech" || 0x00 || ECHConfig */
+    ptls_buffer_pushv(&infobuf, PTLS_ECH_INFO_PREFIX, sizeof(PTLS_ECH_INFO_PREFIX));
+    ptls_buffer_pushv(&infobuf, decoded.bytes.base, decoded.bytes.len);
+    if ((config->ciphers = malloc(sizeof(*config->ciphers) * (decoded.cipher_suites.len / 4))) == NULL) {
+        ret = PTLS_ERROR_NO_MEMORY;
         goto Exit;
-    if ((ret = ptls_decode64(&esni->not_after, &src, end)) != 0)
+    }
+    for (cipher_src = decoded.cipher_suites.base; cipher_src != decoded.cipher_suites.base + decoded.cipher_suites.len;
+         cipher_src += 4) {
+        ptls_hpke_cipher_suite_t **cipher;
+        for (cipher = ciphers; *cipher != NULL; ++cipher)
+            if ((*cipher)->id.kdf == ntoh16(cipher_src) && (*cipher)->id.aead == ntoh16(cipher_src + 2))
+                break;
+        if (*cipher == NULL)
+            continue;
+        config->ciphers[config->num_ciphers].cipher = *cipher;
+        if ((ret = ptls_hpke_key_schedule_context(decoded.kem, *cipher, config->ciphers[config->num_ciphers].key_schedule_context,
+                                                  ptls_iovec_init(infobuf.base, infobuf.off))) != 0)
+            goto Exit;
+        ++config->num_ciphers;
+    }
+    if (config->num_ciphers == 0) {
+        ret = PTLS_ERROR_INCOMPATIBLE_KEY;
         goto Exit;
-    /* Skip the extension fields */
-    ptls_decode_block(src, end, 2, {
-        while (src != end) {
-            uint16_t ext_type;
-            if ((ret = ptls_decode16(&ext_type, &src, end)) != 0)
-                goto Exit;
-            ptls_decode_open_block(src, end, 2, { src = end; });
-        }
-    });
-
-    { /* calculate digests for every cipher-suite */
-        size_t i;
-        for (i = 0; esni->cipher_suites[i].cipher_suite != NULL; ++i) {
-            if ((ret = ptls_calc_hash(esni->cipher_suites[i].cipher_suite->hash, esni->cipher_suites[i].record_digest,
-                                      esni_keys.base, esni_keys.len)) != 0)
-                goto Exit;
-        }
     }
 
+    /* retain the other properties */
+    if ((config->config.base = malloc(decoded.bytes.len)) == NULL) {
+        ret = PTLS_ERROR_NO_MEMORY;
+        goto Exit;
+    }
+    memcpy(config->config.base, decoded.bytes.base, decoded.bytes.len);
+    config->config.len = decoded.bytes.len;
+    config->config_id = decoded.id;
+    config->kem = decoded.kem;
+    config->max_name_length = decoded.max_name_length;
+    config->keyex = keyex;
     ret = 0;
+
 Exit:
-    if (ret != 0)
-        ptls_esni_dispose_context(esni);
+    if (ret != 0) {
+        free(config->ciphers);
+        *config = (ptls_ech_server_config_t){0};
+    }
+    ptls_buffer_dispose(&infobuf);
     return ret;
 }
 
-void ptls_esni_dispose_context(ptls_esni_context_t *esni)
+void ptls_ech_dispose_server_config(ptls_ech_server_config_t *config)
 {
-    size_t i;
-
-    if (esni->key_exchanges != NULL) {
-        for (i = 0; esni->key_exchanges[i] != NULL; ++i)
-            esni->key_exchanges[i]->on_exchange(esni->key_exchanges + i, 1, NULL, ptls_iovec_init(NULL, 0));
-        free(esni->key_exchanges);
+    if (config->keyex != NULL)
+        config->keyex->on_exchange(&config->keyex, 1, NULL, ptls_iovec_init(NULL, 0));
+    if (config->ciphers != NULL) {
+        ptls_clear_memory(config->ciphers, sizeof(*config->ciphers) * config->num_ciphers);
+        free(config->ciphers);
     }
-    free(esni->cipher_suites);
+    free(config->config.base);
+    *config = (ptls_ech_server_config_t){0};
 }
 
-/**
- * Obtain the ESNI secrets negotiated during the handshake.
- */
-ptls_esni_secret_t *ptls_get_esni_secret(ptls_t *ctx)
+int ptls_is_ech_handshake(ptls_t *tls, uint8_t *config_id, ptls_hpke_kem_t **kem, ptls_hpke_cipher_suite_t **cipher)
 {
-    return ctx->esni;
+    if (!tls->ech.accepted)
+        return 0;
+    if (config_id != NULL)
+        *config_id = tls->ech.config_id;
+    if (kem != NULL)
+        *kem = tls->ech.kem;
+    if (cipher != NULL)
+        *cipher = tls->ech.cipher;
+    return 1;
 }
 
 /**
@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "picotls/session_cache.h"
+
+#define SESSION_CACHE_MAGIC 0x7074736573736331 /* "ptsessc1" */
+#define SESSION_CACHE_CACHELINE_SIZE 64
+/**
+ * number of times a reader retries when it observes a concurrent update of the bucket, before giving up (i.e. reporting a miss)
+ */
+#define SESSION_CACHE_MAX_READ_ATTEMPTS 64
+
+struct st_ptls_session_cache_header_t {
+    uint64_t magic;
+    uint32_t num_buckets;
+    uint32_t max_session_size;
+};
+
+/**
+ * Each bucket starts at a cache line boundary and consists of the sequence number (odd while being updated) followed by
+ * PTLS_SESSION_CACHE_WAYS entries.
+ */
+struct st_session_cache_bucket_t {
+    uint32_t seq;
+    uint32_t _reserved;
+};
+
+struct st_session_cache_entry_t {
+    uint64_t expires_at; /* 0 if unused */
+    uint8_t id[PTLS_SESSION_CACHE_ID_SIZE];
+    uint32_t len;
+    uint32_t _reserved;
+    uint8_t data[1];
+};
+
+static size_t align_up(size_t v, size_t alignment)
+{
+    return (v + alignment - 1) / alignment * alignment;
+}
+
+static size_t entry_size(uint32_t max_session_size)
+{
+    return align_up(offsetof(struct st_session_cache_entry_t, data) + max_session_size, 8);
+}
+
+static size_t bucket_size(uint32_t max_session_size)
+{
+    return align_up(sizeof(struct st_session_cache_bucket_t) + entry_size(max_session_size) * PTLS_SESSION_CACHE_WAYS,
+                    SESSION_CACHE_CACHELINE_SIZE);
+}
+
+static size_t shm_size(uint32_t num_buckets, uint32_t max_session_size)
+{
+    return SESSION_CACHE_CACHELINE_SIZE + bucket_size(max_session_size) * num_buckets;
+}
+
+static struct st_session_cache_bucket_t *get_bucket(struct st_ptls_session_cache_header_t *shm, const uint8_t *id)
+{
+    uint64_t h;
+
+    /* the ID is random, therefore can be used as the hash value as-is */
+    memcpy(&h, id, sizeof(h));
+    return (void *)((uint8_t *)shm + SESSION_CACHE_CACHELINE_SIZE + bucket_size(shm->max_session_size) * (h % shm->num_buckets));
+}
+
+static struct st_session_cache_entry_t *get_entry(struct st_ptls_session_cache_header_t *shm,
+                                                  struct st_session_cache_bucket_t *bucket, size_t index)
+{
+    return (void *)((uint8_t *)(bucket + 1) + entry_size(shm->max_session_size) * index);
+}
+
+static uint64_t session_cache_now(ptls_t *tls)
+{
+    ptls_get_time_t *get_time = ptls_get_context(tls)->get_time;
+    return get_time->cb(get_time);
+}
+
+static void store_session(struct st_ptls_session_cache_header_t *shm, const uint8_t *id, uint64_t now, uint64_t expires_at,
+                          ptls_iovec_t session)
+{
+    struct st_session_cache_bucket_t *bucket = get_bucket(shm, id);
+    struct st_session_cache_entry_t *entry, *victim = NULL;
+    uint32_t seq = __atomic_load_n(&bucket->seq, __ATOMIC_RELAXED);
+    size_t i;
+
+    /* acquire the bucket, or give up if it is being updated */
+    if ((seq & 1) != 0 || !__atomic_compare_exchange_n(&bucket->seq, &seq, seq + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        return;
+
+    /* replace an unused or expired entry, or else the one expiring first */
+    for (i = 0; i != PTLS_SESSION_CACHE_WAYS; ++i) {
+        entry = get_entry(shm, bucket, i);
+        if (entry->expires_at <= now) {
+            victim = entry;
+            break;
+        }
+        if (victim == NULL || entry->expires_at < victim->expires_at)
+            victim = entry;
+    }
+    victim->expires_at = expires_at;
+    memcpy(victim->id, id, PTLS_SESSION_CACHE_ID_SIZE);
+    victim->len = (uint32_t)session.len;
+    memcpy(victim->data, session.base, session.len);
+
+    __atomic_store_n(&bucket->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static int lookup_session(struct st_ptls_session_cache_header_t *shm, const uint8_t *id, uint64_t now, ptls_buffer_t *dst)
+{
+    struct st_session_cache_bucket_t *bucket = get_bucket(shm, id);
+    size_t orig_off = dst->off, attempt, i;
+    int ret;
+
+    if ((ret = ptls_buffer_reserve(dst, shm->max_session_size)) != 0)
+        return ret;
+
+    for (attempt = 0; attempt != SESSION_CACHE_MAX_READ_ATTEMPTS; ++attempt) {
+        uint32_t seq = __atomic_load_n(&bucket->seq, __ATOMIC_ACQUIRE);
+        if ((seq & 1) != 0)
+            continue;
+        /* copy the entry being found, then check that the bucket has not been updated while doing so */
+        dst->off = orig_off;
+        ret = PTLS_ERROR_SESSION_NOT_FOUND;
+        for (i = 0; i != PTLS_SESSION_CACHE_WAYS; ++i) {
+            struct st_session_cache_entry_t *entry = get_entry(shm, bucket, i);
+            if (entry->expires_at > now && memcmp(entry->id, id, PTLS_SESSION_CACHE_ID_SIZE) == 0) {
+                size_t len = entry->len;
+                if (len > shm->max_session_size)
+                    len = shm->max_session_size; /* torn read, retried below */
+                memcpy(dst->base + dst->off, entry->data, len);
+                dst->off += len;
+                ret = 0;
+                break;
+            }
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&bucket->seq, __ATOMIC_RELAXED) == seq)
+            goto Exit;
+    }
+    ret = PTLS_ERROR_SESSION_NOT_FOUND;
+
+Exit:
+    if (ret != 0)
+        dst->off = orig_off;
+    return ret;
+}
+
+static int session_cache_cb(ptls_encrypt_ticket_t *_self, ptls_t *tls, int is_encrypt, ptls_buffer_t *dst, ptls_iovec_t src)
+{
+    ptls_session_cache_t *self = (void *)_self;
+    ptls_context_t *ctx = ptls_get_context(tls);
+    uint64_t now = session_cache_now(tls);
+    int ret;
+
+    if (is_encrypt) {
+        uint8_t id[PTLS_SESSION_CACHE_ID_SIZE];
+        ctx->random_bytes(id, sizeof(id));
+        /* sessions that do not fit are not stored, the client receiving a ticket that does not resolve */
+        if (src.len <= self->_shm->max_session_size)
+            store_session(self->_shm, id, now, now + (uint64_t)ctx->ticket_lifetime * 1000, src);
+        if ((ret = ptls_buffer_reserve(dst, sizeof(id))) != 0)
+            return ret;
+        memcpy(dst->base + dst->off, id, sizeof(id));
+        dst->off += sizeof(id);
+        return 0;
+    } else {
+        if (src.len != PTLS_SESSION_CACHE_ID_SIZE)
+            return PTLS_ERROR_SESSION_NOT_FOUND;
+        return lookup_session(self->_shm, src.base, now, dst);
+    }
+}
+
+int ptls_session_cache_init(ptls_session_cache_t *self, int fd, size_t num_buckets, size_t max_session_size)
+{
+    struct stat st;
+    size_t size;
+    uint64_t magic;
+    void *p;
+
+    if (num_buckets == 0 || num_buckets > UINT32_MAX || max_session_size == 0 || max_session_size > UINT16_MAX)
+        return PTLS_ERROR_LIBRARY;
+    size = shm_size((uint32_t)num_buckets, (uint32_t)max_session_size);
+
+    if (fstat(fd, &st) != 0)
+        return PTLS_ERROR_LIBRARY;
+    if (st.st_size == 0) {
+        /* build the table; ftruncate fills the file with zeros, i.e. all the buckets are empty */
+        if (ftruncate(fd, (off_t)size) != 0)
+            return PTLS_ERROR_LIBRARY;
+    } else if ((size_t)st.st_size != size) {
+        return PTLS_ERROR_INCOMPATIBLE_KEY;
+    }
+    if ((p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+        return PTLS_ERROR_LIBRARY;
+
+    *self = (ptls_session_cache_t){{session_cache_cb}, p, size};
+    if ((magic = __atomic_load_n(&self->_shm->magic, __ATOMIC_ACQUIRE)) == 0) {
+        self->_shm->num_buckets = (uint32_t)num_buckets;
+        self->_shm->max_session_size = (uint32_t)max_session_size;
+        __atomic_store_n(&self->_shm->magic, SESSION_CACHE_MAGIC, __ATOMIC_RELEASE);
+    } else if (magic != SESSION_CACHE_MAGIC || self->_shm->num_buckets != num_buckets ||
+               self->_shm->max_session_size != max_session_size) {
+        ptls_session_cache_dispose(self);
+        return PTLS_ERROR_INCOMPATIBLE_KEY;
+    }
+
+    return 0;
+}
+
+void ptls_session_cache_dispose(ptls_session_cache_t *self)
+{
+    if (self->_shm != NULL) {
+        munmap(self->_shm, self->_shm_size);
+        self->_shm = NULL;
+    }
+}
@@ -0,0 +1,397 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "picotls/ticket_key_file.h"
+
+#define TICKET_KEY_FILE_MAGIC "ptlstkf1"
+#define TICKET_NONCE_SIZE 8
+/**
+ * number of times a reader retries when it observes the rotator updating the file, before falling back to the keys it has
+ */
+#define TICKET_KEY_FILE_MAX_READ_ATTEMPTS 64
+
+struct st_ticket_key_file_t {
+    struct {
+        uint8_t magic[8];
+        uint64_t generation; /* odd while being updated */
+        uint32_t num_keys;
+        uint8_t _reserved[44];
+    } header;
+    ptls_ticket_key_t keys[PTLS_TICKET_KEY_FILE_MAX_KEYS];
+};
+
+/**
+ * copy of the keys along with the AEAD contexts, owned by each thread
+ */
+struct st_ticket_key_cache_t {
+    struct st_ptls_ticket_key_file_state_t *state;
+    struct st_ticket_key_cache_t *next;
+    uint64_t generation;
+    size_t num_keys;
+    struct st_ticket_key_cache_entry_t {
+        ptls_ticket_key_t key;
+        ptls_aead_context_t *enc, *dec;
+    } keys[PTLS_TICKET_KEY_FILE_MAX_KEYS];
+};
+
+struct st_ptls_ticket_key_file_state_t {
+    struct st_ticket_key_file_t *file;
+    pthread_key_t cache_key;
+    /**
+     * list of the caches, so that they can be released upon dispose; the mutex is taken only when a thread starts or stops using
+     * the encrypter
+     */
+    pthread_mutex_t mutex;
+    struct st_ticket_key_cache_t *caches;
+};
+
+static int map_key_file(int fd, struct st_ticket_key_file_t **file)
+{
+    static const uint8_t zeroes[sizeof((*file)->header.magic)] = {0};
+    struct stat st;
+
+    if (fstat(fd, &st) != 0)
+        return PTLS_ERROR_LIBRARY;
+    if (st.st_size == 0) {
+        if (ftruncate(fd, sizeof(**file)) != 0)
+            return PTLS_ERROR_LIBRARY;
+    } else if ((size_t)st.st_size != sizeof(**file)) {
+        return PTLS_ERROR_INCOMPATIBLE_KEY;
+    }
+    if ((*file = mmap(NULL, sizeof(**file), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+        return PTLS_ERROR_LIBRARY;
+
+    if (memcmp((*file)->header.magic, zeroes, sizeof(zeroes)) == 0) {
+        memcpy((*file)->header.magic, TICKET_KEY_FILE_MAGIC, sizeof((*file)->header.magic));
+    } else if (memcmp((*file)->header.magic, TICKET_KEY_FILE_MAGIC, sizeof((*file)->header.magic)) != 0) {
+        munmap(*file, sizeof(**file));
+        return PTLS_ERROR_INCOMPATIBLE_KEY;
+    }
+
+    return 0;
+}
+
+static int read_keys(struct st_ticket_key_file_t *file, uint64_t *generation, ptls_ticket_key_t *keys, size_t *num_keys)
+{
+    size_t attempt;
+
+    for (attempt = 0; attempt != TICKET_KEY_FILE_MAX_READ_ATTEMPTS; ++attempt) {
+        uint64_t gen = __atomic_load_n(&file->header.generation, __ATOMIC_ACQUIRE);
+        if ((gen & 1) != 0)
+            continue;
+        *num_keys = file->header.num_keys;
+        if (*num_keys > PTLS_TICKET_KEY_FILE_MAX_KEYS)
+            *num_keys = PTLS_TICKET_KEY_FILE_MAX_KEYS; /* torn read, retried below */
+        memcpy(keys, file->keys, sizeof(keys[0]) * *num_keys);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&file->header.generation, __ATOMIC_RELAXED) == gen) {
+            *generation = gen;
+            return 0;
+        }
+    }
+
+    return PTLS_ERROR_IN_PROGRESS;
+}
+
+static void clear_cache_entry(struct st_ticket_key_cache_entry_t *entry)
+{
+    if (entry->enc != NULL)
+        ptls_aead_free(entry->enc);
+    if (entry->dec != NULL)
+        ptls_aead_free(entry->dec);
+    ptls_clear_memory(entry, sizeof(*entry));
+}
+
+/**
+ * Replaces the keys being cached. AEAD contexts of the keys that remain are retained, so that a rotation only sets up the contexts
+ * of the keys being added.
+ */
+static int update_cache(struct st_ticket_key_cache_t *cache, ptls_cipher_suite_t *cs, uint64_t generation,
+                        const ptls_ticket_key_t *keys, size_t num_keys)
+{
+    struct st_ticket_key_cache_entry_t entries[PTLS_TICKET_KEY_FILE_MAX_KEYS] = {{{{0}}}};
+    size_t i, j;
+    int ret;
+
+    for (i = 0; i != num_keys; ++i) {
+        entries[i].key = keys[i];
+        for (j = 0; j != cache->num_keys; ++j) {
+            struct st_ticket_key_cache_entry_t *old = cache->keys + j;
+            if (old->enc != NULL && memcmp(old->key.name, keys[i].name, sizeof(keys[i].name)) == 0 &&
+                ptls_mem_equal(old->key.secret, keys[i].secret, cs->hash->digest_size)) {
+                entries[i].enc = old->enc;
+                entries[i].dec = old->dec;
+                old->enc = NULL;
+                old->dec = NULL;
+                break;
+            }
+        }
+        if (entries[i].enc == NULL) {
+            if ((entries[i].enc = ptls_aead_new(cs->aead, cs->hash, 1, keys[i].secret, PTLS_HKDF_EXPAND_LABEL_PREFIX)) == NULL ||
+                (entries[i].dec = ptls_aead_new(cs->aead, cs->hash, 0, keys[i].secret, PTLS_HKDF_EXPAND_LABEL_PREFIX)) == NULL) {
+                ret = PTLS_ERROR_NO_MEMORY;
+                goto Exit;
+            }
+        }
+    }
+
+    /* swap */
+    for (j = 0; j != cache->num_keys; ++j)
+        clear_cache_entry(cache->keys + j);
+    memcpy(cache->keys, entries, sizeof(entries[0]) * num_keys);
+    cache->num_keys = num_keys;
+    cache->generation = generation;
+    num_keys = 0; /* ownership has been moved */
+    ret = 0;
+
+Exit:
+    for (i = 0; i != num_keys; ++i) {
+        /* contexts being moved from the cache are given back, as the cache retains the old keys upon failure */
+        for (j = 0; j != cache->num_keys; ++j) {
+            struct st_ticket_key_cache_entry_t *old = cache->keys + j;
+            if (old->enc == NULL && memcmp(old->key.name, entries[i].key.name, sizeof(old->key.name)) == 0) {
+                old->enc = entries[i].enc;
+                old->dec = entries[i].dec;
+                entries[i].enc = NULL;
+                entries[i].dec = NULL;
+                break;
+            }
+        }
+        clear_cache_entry(entries + i);
+    }
+    ptls_clear_memory(entries, sizeof(entries));
+    return ret;
+}
+
+static void free_cache(struct st_ticket_key_cache_t *cache)
+{
+    size_t i;
+
+    for (i = 0; i != cache->num_keys; ++i)
+        clear_cache_entry(cache->keys + i);
+    free(cache);
+}
+
+static void on_thread_exit(void *_cache)
+{
+    struct st_ticket_key_cache_t *cache = _cache, **slot;
+
+    pthread_mutex_lock(&cache->state->mutex);
+    for (slot = &cache->state->caches; *slot != cache; slot = &(*slot)->next)
+        ;
+    *slot = cache->next;
+    pthread_mutex_unlock(&cache->state->mutex);
+
+    free_cache(cache);
+    ptls_aead_pool_clear();
+}
+
+/**
+ * Returns the keys of the calling thread, reloading them if the file has been updated. The fast path is an atomic load and a
+ * lookup of thread-specific data.
+ */
+static struct st_ticket_key_cache_t *get_cache(ptls_ticket_key_file_t *self)
+{
+    struct st_ptls_ticket_key_file_state_t *state = self->_state;
+    struct st_ticket_key_cache_t *cache = pthread_getspecific(state->cache_key);
+    ptls_ticket_key_t keys[PTLS_TICKET_KEY_FILE_MAX_KEYS];
+    uint64_t generation = __atomic_load_n(&state->file->header.generation, __ATOMIC_ACQUIRE);
+    size_t num_keys;
+
+    if (cache != NULL && cache->generation == generation)
+        return cache;
+
+    if (cache == NULL) {
+        if ((cache = malloc(sizeof(*cache))) == NULL)
+            return NULL;
+        *cache = (struct st_ticket_key_cache_t){state, NULL, 1 /* odd, i.e. invalid */};
+        if (pthread_setspecific(state->cache_key, cache) != 0) {
+            free(cache);
+            return NULL;
+        }
+        pthread_mutex_lock(&state->mutex);
+        cache->next = state->caches;
+        state->caches = cache;
+        pthread_mutex_unlock(&state->mutex);
+    }
+
+    /* reload; upon failure, the keys that have been loaded previously are used, and the reload is retried by the next call */
+    if (read_keys(state->file, &generation, keys, &num_keys) == 0)
+        update_cache(cache, self->cipher_suite, generation, keys, num_keys);
+    ptls_clear_memory(keys, sizeof(keys));
+
+    return cache;
+}
+
+static int encrypt_ticket(ptls_ticket_key_file_t *self, struct st_ticket_key_cache_t *cache, uint64_t now, ptls_t *tls,
+                          ptls_buffer_t *dst, ptls_iovec_t src)
+{
+    struct st_ticket_key_cache_entry_t *entry = NULL;
+    uint8_t *p;
+    uint64_t nonce;
+    size_t i;
+    int ret;
+
+    for (i = 0; i != cache->num_keys; ++i) {
+        struct st_ticket_key_cache_entry_t *e = cache->keys + i;
+        if (e->key.not_before <= now && now < e->key.not_after && (entry == NULL || entry->key.not_before < e->key.not_before))
+            entry = e;
+    }
+    if (entry == NULL)
+        return PTLS_ERROR_SKIP_TICKET;
+
+    if ((ret = ptls_buffer_reserve(dst, PTLS_TICKET_KEY_NAME_SIZE + TICKET_NONCE_SIZE + src.len +
+                                            self->cipher_suite->aead->tag_size)) != 0)
+        return ret;
+    p = dst->base + dst->off;
+    memcpy(p, entry->key.name, PTLS_TICKET_KEY_NAME_SIZE);
+    ptls_get_context(tls)->random_bytes(p + PTLS_TICKET_KEY_NAME_SIZE, TICKET_NONCE_SIZE);
+    memcpy(&nonce, p + PTLS_TICKET_KEY_NAME_SIZE, sizeof(nonce));
+    dst->off += PTLS_TICKET_KEY_NAME_SIZE + TICKET_NONCE_SIZE;
+    dst->off += ptls_aead_encrypt(entry->enc, dst->base + dst->off, src.base, src.len, nonce, p,
+                                  PTLS_TICKET_KEY_NAME_SIZE + TICKET_NONCE_SIZE);
+
+    return 0;
+}
+
+static int decrypt_ticket(ptls_ticket_key_file_t *self, struct st_ticket_key_cache_t *cache, uint64_t now, ptls_buffer_t *dst,
+                          ptls_iovec_t src)
+{
+    struct st_ticket_key_cache_entry_t *entry = NULL;
+    uint64_t nonce;
+    size_t i, ptlen;
+    int ret;
+
+    if (src.len < PTLS_TICKET_KEY_NAME_SIZE + TICKET_NONCE_SIZE + self->cipher_suite->aead->tag_size)
+        return PTLS_ALERT_DECODE_ERROR;
+    for (i = 0; i != cache->num_keys; ++i) {
+        if (memcmp(cache->keys[i].key.name, src.base, PTLS_TICKET_KEY_NAME_SIZE) == 0) {
+            entry = cache->keys + i;
+            break;
+        }
+    }
+    if (entry == NULL || now >= entry->key.not_after)
+        return PTLS_ERROR_SESSION_NOT_FOUND;
+
+    memcpy(&nonce, src.base + PTLS_TICKET_KEY_NAME_SIZE, sizeof(nonce));
+    if ((ret = ptls_buffer_reserve(dst, src.len)) != 0)
+        return ret;
+    if ((ptlen = ptls_aead_decrypt(entry->dec, dst->base + dst->off, src.base + PTLS_TICKET_KEY_NAME_SIZE + TICKET_NONCE_SIZE,
+                                   src.len - (PTLS_TICKET_KEY_NAME_SIZE + TICKET_NONCE_SIZE), nonce, src.base,
+                                   PTLS_TICKET_KEY_NAME_SIZE + TICKET_NONCE_SIZE)) == SIZE_MAX)
+        return PTLS_ALERT_DECRYPT_ERROR;
+    dst->off += ptlen;
+
+    return 0;
+}
+
+static int ticket_key_file_cb(ptls_encrypt_ticket_t *_self, ptls_t *tls, int is_encrypt, ptls_buffer_t *dst, ptls_iovec_t src)
+{
+    ptls_ticket_key_file_t *self = (void *)_self;
+    ptls_get_time_t *get_time = ptls_get_context(tls)->get_time;
+    struct st_ticket_key_cache_t *cache;
+
+    if ((cache = get_cache(self)) == NULL)
+        return PTLS_ERROR_NO_MEMORY;
+
+    if (is_encrypt) {
+        return encrypt_ticket(self, cache, get_time->cb(get_time), tls, dst, src);
+    } else {
+        return decrypt_ticket(self, cache, get_time->cb(get_time), dst, src);
+    }
+}
+
+int ptls_ticket_key_file_init(ptls_ticket_key_file_t *self, int fd, ptls_cipher_suite_t *cipher_suite)
+{
+    struct st_ptls_ticket_key_file_state_t *state;
+    int ret;
+
+    if ((state = malloc(sizeof(*state))) == NULL)
+        return PTLS_ERROR_NO_MEMORY;
+    *state = (struct st_ptls_ticket_key_file_state_t){NULL};
+    if ((ret = map_key_file(fd, &state->file)) != 0) {
+        free(state);
+        return ret;
+    }
+    if (pthread_key_create(&state->cache_key, on_thread_exit) != 0) {
+        munmap(state->file, sizeof(*state->file));
+        free(state);
+        return PTLS_ERROR_LIBRARY;
+    }
+    pthread_mutex_init(&state->mutex, NULL);
+
+    *self = (ptls_ticket_key_file_t){{ticket_key_file_cb}, cipher_suite, state};
+    return 0;
+}
+
+void ptls_ticket_key_file_dispose(ptls_ticket_key_file_t *self)
+{
+    struct st_ptls_ticket_key_file_state_t *state = self->_state;
+
+    if (state == NULL)
+        return;
+
+    pthread_key_delete(state->cache_key);
+    while (state->caches != NULL) {
+        struct st_ticket_key_cache_t *cache = state->caches;
+        state->caches = cache->next;
+        free_cache(cache);
+    }
+    pthread_mutex_destroy(&state->mutex);
+    munmap(state->file, sizeof(*state->file));
+    free(state);
+    self->_state = NULL;
+}
+
+int ptls_ticket_key_file_update(int fd, const ptls_ticket_key_t *keys, size_t num_keys)
+{
+    struct st_ticket_key_file_t *file;
+    uint64_t generation;
+    int ret;
+
+    if (num_keys > PTLS_TICKET_KEY_FILE_MAX_KEYS)
+        return PTLS_ERROR_LIBRARY;
+    if ((ret = map_key_file(fd, &file)) != 0)
+        return ret;
+
+    /* mark as being updated, write, then publish the new generation */
+    generation = __atomic_load_n(&file->header.generation, __ATOMIC_RELAXED);
+    if ((generation & 1) != 0 || !__atomic_compare_exchange_n(&file->header.generation, &generation, generation + 1, 0,
+                                                              __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        ret = PTLS_ERROR_IN_PROGRESS;
+        goto Exit;
+    }
+    file->header.num_keys = (uint32_t)num_keys;
+    memcpy(file->keys, keys, sizeof(keys[0]) * num_keys);
+    ptls_clear_memory(file->keys + num_keys, sizeof(file->keys[0]) * (PTLS_TICKET_KEY_FILE_MAX_KEYS - num_keys));
+    __atomic_store_n(&file->header.generation, generation + 2, __ATOMIC_RELEASE);
+    ret = 0;
+
+Exit:
+    munmap(file, sizeof(*file));
+    return ret;
+}
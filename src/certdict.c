@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "picotls.h"
+#include "picotls/certificate_compression.h"
+#include "picotls/pembase64.h"
+
+/**
+ * A certificate found in the sample chains, along with the number of chains it appears in.
+ */
+struct st_cert_t {
+    ptls_iovec_t der;
+    size_t count;
+};
+
+struct st_chain_t {
+    ptls_iovec_t certs[16];
+    size_t num_certs;
+};
+
+static struct st_cert_t *certs;
+static size_t num_certs;
+
+static void register_cert(ptls_iovec_t der)
+{
+    for (size_t i = 0; i != num_certs; ++i) {
+        if (certs[i].der.len == der.len && memcmp(certs[i].der.base, der.base, der.len) == 0) {
+            ++certs[i].count;
+            return;
+        }
+    }
+    if ((certs = realloc(certs, sizeof(*certs) * (num_certs + 1))) == NULL) {
+        perror("realloc");
+        exit(1);
+    }
+    certs[num_certs++] = (struct st_cert_t){der, 1};
+}
+
+static int cmp_by_count(const void *_x, const void *_y)
+{
+    const struct st_cert_t *x = _x, *y = _y;
+    if (x->count != y->count)
+        return x->count < y->count ? -1 : 1;
+    return 0;
+}
+
+/**
+ * Builds a dictionary by concatenating the certificates that are shared among the chains, the most common ones placed last; zlib
+ * and zstd use the dictionary as a prefix of the input, and zlib can refer to no more than 32KB back from the current position.
+ * Raw-content dictionaries are accepted by zstd as well as by zlib.
+ */
+static void build_dictionary(ptls_buffer_t *dict, size_t max_size)
+{
+    size_t i;
+
+    qsort(certs, num_certs, sizeof(*certs), cmp_by_count);
+    for (i = 0; i != num_certs && certs[i].count < 2; ++i)
+        ;
+    for (; i != num_certs; ++i) {
+        if (dict->off + certs[i].der.len > max_size) {
+            /* keep the most common ones */
+            size_t shift = dict->off + certs[i].der.len - max_size;
+            if (shift > dict->off)
+                continue;
+            memmove(dict->base, dict->base + shift, dict->off - shift);
+            dict->off -= shift;
+        }
+        if (ptls_buffer_reserve(dict, certs[i].der.len) != 0) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        memcpy(dict->base + dict->off, certs[i].der.base, certs[i].der.len);
+        dict->off += certs[i].der.len;
+    }
+}
+
+static size_t compressed_size(ptls_iovec_t message, uint16_t algo, const ptls_certificate_compression_dictionary_t *dictionary)
+{
+    uint8_t buf[65536];
+    ptls_iovec_t output = ptls_iovec_init(buf, sizeof(buf));
+
+    if (ptls_compress_certificate_message(&output, algo, dictionary, message) != 0)
+        return message.len;
+    return output.len;
+}
+
+static void usage(const char *cmd, int status)
+{
+    printf("picotls-certdict - builds a shared dictionary for certificate compression\n"
+           "\n"
+           "Usage: %s [options] chain-file...\n"
+           "Options:\n"
+           "  -a <algorithm>      zlib or zstd (default: zlib)\n"
+           "  -s <size>           maximum size of the dictionary (default: 32768)\n"
+           "  -o <output-file>    file to which the dictionary is written (if omitted,\n"
+           "                      only reports the effect on the sample chains)\n"
+           "  -h                  prints this help\n"
+           "\n"
+           "Each chain-file should contain a PEM-encoded certificate chain. The dictionary\n"
+           "is built from the certificates that appear in more than one chain, and the\n"
+           "size of the CompressedCertificate messages with and without the dictionary is\n"
+           "reported for each chain.\n"
+           "\n",
+           cmd);
+    exit(status);
+}
+
+int main(int argc, char **argv)
+{
+    const char *file_output = NULL;
+    ptls_certificate_compression_dictionary_t dictionary = {PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_EXPERIMENTAL_MIN,
+                                                            PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_ZLIB};
+    size_t max_size = 32768;
+    struct st_chain_t *chains;
+    size_t num_chains, total_uncompressed = 0, total_plain = 0, total_dict = 0;
+    ptls_buffer_t dict;
+    int ch;
+
+    while ((ch = getopt(argc, argv, "a:s:o:h")) != -1) {
+        switch (ch) {
+        case 'a':
+            if (strcmp(optarg, "zlib") == 0) {
+                dictionary.base_algo = PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_ZLIB;
+            } else if (strcmp(optarg, "zstd") == 0) {
+                dictionary.base_algo = PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_ZSTD;
+            } else {
+                fprintf(stderr, "unknown algorithm:%s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 's':
+            if (sscanf(optarg, "%zu", &max_size) != 1 || max_size == 0) {
+                fprintf(stderr, "invalid size:%s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'o':
+            file_output = optarg;
+            break;
+        case 'h':
+            usage(argv[0], 0);
+            break;
+        default:
+            usage(argv[0], 1);
+            break;
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc == 0)
+        usage(argv[-optind], 1);
+
+    /* load the chains */
+    num_chains = argc;
+    if ((chains = calloc(num_chains, sizeof(*chains))) == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    for (size_t i = 0; i != num_chains; ++i) {
+        if (ptls_load_pem_objects(argv[i], "CERTIFICATE", chains[i].certs, PTLS_ELEMENTSOF(chains[i].certs),
+                                  &chains[i].num_certs) != 0 ||
+            chains[i].num_certs == 0) {
+            fprintf(stderr, "failed to load certificates from file:%s\n", argv[i]);
+            exit(1);
+        }
+        for (size_t j = 0; j != chains[i].num_certs; ++j)
+            register_cert(chains[i].certs[j]);
+    }
+
+    /* build the dictionary */
+    ptls_buffer_init(&dict, "", 0);
+    build_dictionary(&dict, max_size);
+    dictionary.bytes = ptls_iovec_init(dict.base, dict.off);
+    fprintf(stderr, "dictionary: %zu bytes, built from %zu chains (%zu distinct certificates)\n", dict.off, num_chains, num_certs);
+
+    /* report the effect */
+    printf("%-40s %10s %10s %10s\n", "chain", "original", "plain", "dictionary");
+    for (size_t i = 0; i != num_chains; ++i) {
+        ptls_buffer_t message;
+        size_t plain, with_dict;
+        ptls_buffer_init(&message, "", 0);
+        if (ptls_build_certificate_message(&message, ptls_iovec_init(NULL, 0), chains[i].certs, chains[i].num_certs,
+                                           ptls_iovec_init(NULL, 0)) != 0) {
+            fprintf(stderr, "failed to build the certificate message for file:%s\n", argv[i]);
+            exit(1);
+        }
+        plain = compressed_size(ptls_iovec_init(message.base, message.off), dictionary.base_algo, NULL);
+        with_dict = dictionary.bytes.len != 0
+                        ? compressed_size(ptls_iovec_init(message.base, message.off), dictionary.algo, &dictionary)
+                        : plain;
+        printf("%-40s %10zu %10zu %10zu\n", argv[i], message.off, plain, with_dict);
+        total_uncompressed += message.off;
+        total_plain += plain;
+        total_dict += with_dict;
+        ptls_buffer_dispose(&message);
+    }
+    printf("%-40s %10zu %10zu %10zu\n", "total", total_uncompressed, total_plain, total_dict);
+    if (total_plain != 0)
+        printf("first-flight reduction by the dictionary: %ld bytes (%.1f%%)\n", (long)total_plain - (long)total_dict,
+               100.0 * ((double)total_plain - total_dict) / total_plain);
+
+    if (file_output != NULL) {
+        FILE *fo;
+        if ((fo = fopen(file_output, "wb")) == NULL) {
+            fprintf(stderr, "failed to open file:%s:%s\n", file_output, strerror(errno));
+            exit(1);
+        }
+        fwrite(dict.base, 1, dict.off, fo);
+        fclose(fo);
+    }
+
+    ptls_buffer_dispose(&dict);
+    return 0;
+}
@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2018 Fastly, Kazuho Oku
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WINDOWS
+#include "..\picotls\wincompat.h"
+#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#pragma warning(disable : 4996)
+#else
+#include <strings.h>
+#endif
+#include <openssl/err.h>
+#include <openssl/engine.h>
+#include <openssl/pem.h>
+#include "picotls.h"
+#include "picotls/openssl.h"
+
+static int emit_ech_config_list(ptls_key_exchange_context_t *keyex, ptls_hpke_kem_t *kem, ptls_hpke_cipher_suite_t **ciphers,
+                                uint8_t config_id, uint8_t max_name_length, const char *public_name, const char *file_output)
+{
+    ptls_buffer_t buf;
+    int ret;
+
+    ptls_buffer_init(&buf, "", 0);
+
+    /* ECHConfigList containing one ECHConfig */
+    ptls_buffer_push_block(&buf, 2, {
+        ptls_buffer_push16(&buf, PTLS_ECH_CONFIG_VERSION);
+        ptls_buffer_push_block(&buf, 2, {
+            ptls_buffer_push(&buf, config_id);
+            ptls_buffer_push16(&buf, kem->id);
+            ptls_buffer_push_block(&buf, 2, { ptls_buffer_pushv(&buf, keyex->pubkey.base, keyex->pubkey.len); });
+            ptls_buffer_push_block(&buf, 2, {
+                size_t i;
+                for (i = 0; ciphers[i] != NULL; ++i) {
+                    ptls_buffer_push16(&buf, ciphers[i]->id.kdf);
+                    ptls_buffer_push16(&buf, ciphers[i]->id.aead);
+                }
+            });
+            ptls_buffer_push(&buf, max_name_length);
+            ptls_buffer_push_block(&buf, 1, { ptls_buffer_pushv(&buf, public_name, strlen(public_name)); });
+            ptls_buffer_push_block(&buf, 2, {}); /* extensions */
+        });
+    });
+
+    if (file_output != NULL) {
+        FILE *fo = fopen(file_output, "wb");
+        if (fo == NULL) {
+            fprintf(stderr, "failed to open file:%s:%s\n", file_output, strerror(errno));
+            ret = PTLS_ERROR_LIBRARY;
+            goto Exit;
+        }
+        fwrite(buf.base, 1, buf.off, fo);
+        fclose(fo);
+    } else {
+        /* emit the structure to stdout */
+        fwrite(buf.base, 1, buf.off, stdout);
+        fflush(stdout);
+    }
+
+    ret = 0;
+Exit:
+    ptls_buffer_dispose(&buf);
+    return ret;
+}
+
+static void usage(const char *cmd, int status)
+{
+    printf("picotls-ech - generates an ECHConfigList\n"
+           "\n"
+           "Usage: %s [options]\n"
+           "Options:\n"
+           "  -n <public-name>    public name (mandatory)\n"
+           "  -K <key-file>       private key file (X25519 or P-256)\n"
+           "  -i <config-id>      config id (default: 0)\n"
+           "  -c <cipher-suite>   HPKE cipher-suite; HKDF-SHA256/AES-128-GCM, ... (default:\n"
+           "                      all)\n"
+           "  -m <length>         maximum length of the server names (default: 64)\n"
+           "  -o <output-file>    write output to specified file instead of stdout\n"
+           "                      (use on Windows as stdout is not binary there)\n"
+           "  -h                  prints this help\n"
+           "\n"
+           "-c can be used multiple times.\n"
+           "\n",
+           cmd);
+    exit(status);
+}
+
+int main(int argc, char **argv)
+{
+    const char *public_name = NULL, *file_output = NULL;
+    ptls_key_exchange_context_t *keyex = NULL;
+    ptls_hpke_kem_t *kem = NULL;
+    struct {
+        ptls_hpke_cipher_suite_t *elements[16];
+        size_t count;
+    } ciphers = {{NULL}, 0};
+    unsigned config_id = 0, max_name_length = 64;
+    int ch;
+
+    ERR_load_crypto_strings();
+    OpenSSL_add_all_algorithms();
+#if !defined(OPENSSL_NO_ENGINE)
+    /* Load all compiled-in ENGINEs */
+    ENGINE_load_builtin_engines();
+    ENGINE_register_all_ciphers();
+    ENGINE_register_all_digests();
+#endif
+
+    while ((ch = getopt(argc, argv, "n:K:i:c:m:o:h")) != -1) {
+        switch (ch) {
+        case 'n':
+            public_name = optarg;
+            break;
+        case 'K': {
+            FILE *fp;
+            EVP_PKEY *pkey;
+            size_t i;
+            if ((fp = fopen(optarg, "rt")) == NULL) {
+                fprintf(stderr, "failed to open file:%s:%s\n", optarg, strerror(errno));
+                exit(1);
+            }
+            if ((pkey = PEM_read_PrivateKey(fp, NULL, NULL, NULL)) == NULL) {
+                fprintf(stderr, "failed to read private key from file:%s\n", optarg);
+                exit(1);
+            }
+            fclose(fp);
+            if (keyex != NULL || ptls_openssl_create_key_exchange(&keyex, pkey) != 0) {
+                fprintf(stderr, "unknown type of private key found in file:%s\n", optarg);
+                exit(1);
+            }
+            EVP_PKEY_free(pkey);
+            for (i = 0; ptls_openssl_hpke_kems[i] != NULL; ++i)
+                if (ptls_openssl_hpke_kems[i]->keyex->id == keyex->algo->id)
+                    break;
+            if ((kem = ptls_openssl_hpke_kems[i]) == NULL) {
+                fprintf(stderr, "the type of the private key is not supported by HPKE:%s\n", optarg);
+                exit(1);
+            }
+        } break;
+        case 'i':
+            if (sscanf(optarg, "%u", &config_id) != 1 || config_id > 255) {
+                fprintf(stderr, "config-id must be an integer between 0 and 255\n");
+                exit(1);
+            }
+            break;
+        case 'c': {
+            size_t i;
+            for (i = 0; ptls_openssl_hpke_cipher_suites[i] != NULL; ++i)
+                if (strcasecmp(ptls_openssl_hpke_cipher_suites[i]->name, optarg) == 0)
+                    break;
+            if (ptls_openssl_hpke_cipher_suites[i] == NULL) {
+                fprintf(stderr, "unknown cipher-suite: %s\n", optarg);
+                exit(1);
+            }
+            if (ciphers.count == PTLS_ELEMENTSOF(ciphers.elements) - 1) {
+                fprintf(stderr, "too many cipher-suites\n");
+                exit(1);
+            }
+            ciphers.elements[ciphers.count++] = ptls_openssl_hpke_cipher_suites[i];
+        } break;
+        case 'm':
+            if (sscanf(optarg, "%u", &max_name_length) != 1 || max_name_length > 255) {
+                fprintf(stderr, "max-name-length must be an integer between 0 and 255\n");
+                exit(1);
+            }
+            break;
+        case 'o':
+            file_output = optarg;
+            break;
+        case 'h':
+            usage(argv[0], 0);
+            break;
+        default:
+            usage(argv[0], 1);
+            break;
+        }
+    }
+    if (public_name == NULL || strlen(public_name) == 0 || strlen(public_name) > 255) {
+        fprintf(stderr, "public name (-n) must be specified\n");
+        exit(1);
+    }
+    if (keyex == NULL) {
+        fprintf(stderr, "no private key specified\n");
+        exit(1);
+    }
+    if (ciphers.count == 0) {
+        size_t i;
+        for (i = 0; ptls_openssl_hpke_cipher_suites[i] != NULL; ++i)
+            ciphers.elements[ciphers.count++] = ptls_openssl_hpke_cipher_suites[i];
+    }
+
+    if (emit_ech_config_list(keyex, kem, ciphers.elements, (uint8_t)config_id, (uint8_t)max_name_length, public_name,
+                             file_output) != 0) {
+        fprintf(stderr, "failed to generate ECHConfigList\n");
+        exit(1);
+    }
+    keyex->on_exchange(&keyex, 1, NULL, ptls_iovec_init(NULL, 0));
+
+    return 0;
+}
@@ -21,8 +21,6 @@
  */
 #include <sys/types.h>
 #include <netinet/in.h>
-#include <arpa/nameser.h>
-#include <resolv.h>
 
 #include <arpa/inet.h>
 #include <assert.h>
@@ -48,7 +46,11 @@
 #endif
 #include "picotls.h"
 #include "picotls/openssl.h"
-#if PICOTLS_USE_BROTLI
+#include "picotls/minicrypto.h"
+#if PTLS_HAVE_FUSION
+#include "picotls/fusion.h"
+#endif
+#if PICOTLS_USE_CERTIFICATE_COMPRESSION
 #include "picotls/certificate_compression.h"
 #endif
 #include "util.h"
@@ -317,8 +319,6 @@ static int run_client(struct sockaddr *sa, socklen_t salen, ptls_context_t *ctx,
 {
     int fd;
 
-    hsprop->client.esni_keys = resolve_esni_keys(server_name);
-
     if ((fd = socket(sa->sa_family, SOCK_STREAM, 0)) == 1) {
         perror("socket(2) failed");
         return 1;
@@ -329,10 +329,71 @@ static int run_client(struct sockaddr *sa, socklen_t salen, ptls_context_t *ctx,
     }
 
     int ret = handle_connection(fd, ctx, server_name, input_file, hsprop, request_key_update, keep_sender_open);
-    free(hsprop->client.esni_keys.base);
+    if (hsprop->client.ech.retry_configs != NULL && hsprop->client.ech.retry_configs->base != NULL)
+        fprintf(stderr, "ECH was rejected; server sent retry_configs of %zu bytes\n", hsprop->client.ech.retry_configs->len);
     return ret;
 }
 
+static void setup_calibrated_cipher_suites(ptls_cipher_suite_t **cipher_suites)
+{
+#if PTLS_HAVE_FUSION
+    static ptls_cipher_suite_t fusion_aes128gcmsha256 = {PTLS_CIPHER_SUITE_AES_128_GCM_SHA256, &ptls_fusion_aes128gcm,
+                                                         &ptls_openssl_sha256},
+                               fusion_aes256gcmsha384 = {PTLS_CIPHER_SUITE_AES_256_GCM_SHA384, &ptls_fusion_aes256gcm,
+                                                         &ptls_openssl_sha384};
+    static ptls_cipher_suite_t *fusion_cipher_suites[] = {&fusion_aes256gcmsha384, &fusion_aes128gcmsha256, NULL};
+#endif
+    static ptls_calibrated_cipher_suite_t results[16];
+    ptls_cipher_suite_backend_t backends[4] = {{"openssl", ptls_openssl_cipher_suites},
+                                               {"minicrypto", ptls_minicrypto_cipher_suites}};
+    size_t num_results, i;
+
+#if PTLS_HAVE_FUSION
+    if (ptls_fusion_is_supported_by_cpu())
+        backends[2] = (ptls_cipher_suite_backend_t){"fusion", fusion_cipher_suites};
+#endif
+
+    num_results = ptls_calibrate_cipher_suites(results, PTLS_ELEMENTSOF(results), backends);
+    for (i = 0; i != num_results; ++i) {
+        fprintf(stderr, "cipher-suite 0x%04" PRIx16 ": %s of %s (%" PRIu64 " ns/record), hash of %s (%" PRIu64 " ns/record)\n",
+                results[i].suite.id, results[i].suite.aead->name, results[i].aead_backend, results[i].aead_nsec,
+                results[i].hash_backend, results[i].hash_nsec);
+        cipher_suites[i] = &results[i].suite;
+    }
+}
+
+/**
+ * AEGIS cipher-suites use private codepoints; the AEAD is provided by fusion when the CPU has AES-NI, otherwise by minicrypto
+ */
+static ptls_cipher_suite_t *select_aegis_cipher_suite(int is_256)
+{
+#if PTLS_HAVE_FUSION
+    static ptls_cipher_suite_t fusion_aegis128lsha256 = {PTLS_CIPHER_SUITE_AEGIS_128L_SHA256, &ptls_fusion_aegis128l,
+                                                         &ptls_openssl_sha256},
+                               fusion_aegis256sha384 = {PTLS_CIPHER_SUITE_AEGIS_256_SHA384, &ptls_fusion_aegis256,
+                                                        &ptls_openssl_sha384};
+    if (ptls_fusion_is_supported_by_cpu())
+        return is_256 ? &fusion_aegis256sha384 : &fusion_aegis128lsha256;
+#endif
+    return is_256 ? &ptls_minicrypto_aegis256sha384 : &ptls_minicrypto_aegis128lsha256;
+}
+
+/**
+ * Integrity-only cipher-suites using AES-GMAC; they use private codepoints and are available only when fusion is
+ */
+static ptls_cipher_suite_t *select_gmac_cipher_suite(int is_256)
+{
+#if PTLS_HAVE_FUSION
+    static ptls_cipher_suite_t aes128gmacsha256 = {PTLS_CIPHER_SUITE_AES_128_GMAC_SHA256, &ptls_fusion_aes128gmac,
+                                                   &ptls_openssl_sha256},
+                               aes256gmacsha384 = {PTLS_CIPHER_SUITE_AES_256_GMAC_SHA384, &ptls_fusion_aes256gmac,
+                                                   &ptls_openssl_sha384};
+    if (ptls_fusion_is_supported_by_cpu())
+        return is_256 ? &aes256gmacsha384 : &aes128gmacsha256;
+#endif
+    return NULL;
+}
+
 static void usage(const char *cmd)
 {
     printf("Usage: %s [options] host port\n"
@@ -341,7 +402,7 @@ static void usage(const char *cmd)
            "  -4                   force IPv4\n"
            "  -6                   force IPv6\n"
            "  -a                   require client authentication\n"
-           "  -b                   enable brotli compression\n"
+           "  -b                   enable certificate compression\n"
            "  -B                   benchmark mode for measuring sustained bandwidth. Run\n"
            "                       both endpoints with this option for some time, then kill\n"
            "                       the client. Server will report the ingress bandwidth.\n"
@@ -355,13 +416,20 @@ static void usage(const char *cmd)
            "  -N named-group       named group to be used (default: secp256r1)\n"
            "  -s session-file      file to read/write the session ticket\n"
            "  -S                   require public key exchange when resuming a session\n"
-           "  -E esni-file         file that stores ESNI data generated by picotls-esni\n"
+           "  -t                   use the fastest implementation of each cipher-suite, by\n"
+           "                       benchmarking the crypto backends at startup\n"
+           "  -E ech-config-file   file that stores the ECHConfigList generated by picotls-ech\n"
+           "  -K ech-key-file      private key corresponding to the ECHConfig (server-only)\n"
            "  -e                   when resuming a session, send first 8,192 bytes of input\n"
            "                       as early data\n"
            "  -u                   update the traffic key when handshake is complete\n"
            "  -v                   verify peer using the default certificates\n"
            "  -y cipher-suite      cipher-suite to be used, e.g., aes128gcmsha256 (default:\n"
-           "                       all)\n"
+           "                       all); aegis128lsha256 and aegis256sha384 are also\n"
+           "                       accepted, using private codepoints; sha256sha256 and\n"
+           "                       sha384sha384 select integrity-only cipher-suites that\n"
+           "                       do not encrypt the traffic, as do aes128gmacsha256 and\n"
+           "                       aes256gmacsha384 (private codepoints, requires fusion)\n"
            "  -h                   print this help\n"
            "\n"
            "Supported named groups: secp256r1"
@@ -389,23 +457,18 @@ int main(int argc, char **argv)
     ENGINE_register_all_digests();
 #endif
 
-    res_init();
-
     ptls_key_exchange_algorithm_t *key_exchanges[128] = {NULL};
     ptls_cipher_suite_t *cipher_suites[128] = {NULL};
     ptls_context_t ctx = {ptls_openssl_random_bytes, &ptls_get_time, key_exchanges, cipher_suites};
     ptls_handshake_properties_t hsprop = {{{{NULL}}}};
-    const char *host, *port, *input_file = NULL, *esni_file = NULL;
-    struct {
-        ptls_key_exchange_context_t *elements[16];
-        size_t count;
-    } esni_key_exchanges;
-    int is_server = 0, use_early_data = 0, request_key_update = 0, keep_sender_open = 0, ch;
+    const char *host, *port, *input_file = NULL, *ech_file = NULL;
+    ptls_key_exchange_context_t *ech_key_exchange = NULL;
+    int is_server = 0, use_early_data = 0, request_key_update = 0, keep_sender_open = 0, calibrate = 0, ch;
     struct sockaddr_storage sa;
     socklen_t salen;
     int family = 0;
 
-    while ((ch = getopt(argc, argv, "46abBC:c:i:Ik:nN:es:SE:K:l:y:vh")) != -1) {
+    while ((ch = getopt(argc, argv, "46abBC:c:i:Ik:nN:es:StE:K:l:y:vh")) != -1) {
         switch (ch) {
         case '4':
             family = AF_INET;
@@ -417,7 +480,7 @@ int main(int argc, char **argv)
             ctx.require_client_authentication = 1;
             break;
         case 'b':
-#if PICOTLS_USE_BROTLI
+#if PICOTLS_USE_CERTIFICATE_COMPRESSION
             ctx.decompress_certificate = &ptls_decompress_certificate;
 #else
             fprintf(stderr, "support for `-b` option was turned off during configuration\n");
@@ -458,21 +521,25 @@ int main(int argc, char **argv)
             ctx.require_dhe_on_psk = 1;
             break;
         case 'E':
-            esni_file = optarg;
+            ech_file = optarg;
             break;
         case 'K': {
             FILE *fp;
             EVP_PKEY *pkey;
             int ret;
             if ((fp = fopen(optarg, "rt")) == NULL) {
-                fprintf(stderr, "failed to open ESNI private key file:%s:%s\n", optarg, strerror(errno));
+                fprintf(stderr, "failed to open ECH private key file:%s:%s\n", optarg, strerror(errno));
                 return 1;
             }
             if ((pkey = PEM_read_PrivateKey(fp, NULL, NULL, NULL)) == NULL) {
                 fprintf(stderr, "failed to load private key from file:%s\n", optarg);
                 return 1;
             }
-            if ((ret = ptls_openssl_create_key_exchange(esni_key_exchanges.elements + esni_key_exchanges.count++, pkey)) != 0) {
+            if (ech_key_exchange != NULL) {
+                fprintf(stderr, "-K can only be specified once\n");
+                return 1;
+            }
+            if ((ret = ptls_openssl_create_key_exchange(&ech_key_exchange, pkey)) != 0) {
                 fprintf(stderr, "failed to load private key from file:%s:picotls-error:%d", optarg, ret);
                 return 1;
             }
@@ -500,7 +567,12 @@ int main(int argc, char **argv)
 #if PTLS_OPENSSL_HAVE_X25519
             MATCH(x25519);
 #endif
+#if PTLS_OPENSSL_HAVE_X25519MLKEM768
+            MATCH(x25519mlkem768);
+#endif
 #undef MATCH
+            if (algo == NULL && strcasecmp(optarg, "x25519mlkem768") == 0)
+                algo = &ptls_minicrypto_x25519mlkem768;
             if (algo == NULL) {
                 fprintf(stderr, "could not find key exchange: %s\n", optarg);
                 return 1;
@@ -510,6 +582,9 @@ int main(int argc, char **argv)
                 ;
             key_exchanges[i++] = algo;
         } break;
+        case 't':
+            calibrate = 1;
+            break;
         case 'u':
             request_key_update = 1;
             break;
@@ -525,7 +600,17 @@ int main(int argc, char **argv)
 #if PTLS_OPENSSL_HAVE_CHACHA20_POLY1305
             MATCH(chacha20poly1305sha256);
 #endif
+            MATCH(sha256sha256);
+            MATCH(sha384sha384);
 #undef MATCH
+            if (cipher_suites[i] == NULL && strcasecmp(optarg, "aegis128lsha256") == 0)
+                cipher_suites[i] = select_aegis_cipher_suite(0);
+            if (cipher_suites[i] == NULL && strcasecmp(optarg, "aegis256sha384") == 0)
+                cipher_suites[i] = select_aegis_cipher_suite(1);
+            if (cipher_suites[i] == NULL && strcasecmp(optarg, "aes128gmacsha256") == 0)
+                cipher_suites[i] = select_gmac_cipher_suite(0);
+            if (cipher_suites[i] == NULL && strcasecmp(optarg, "aes256gmacsha384") == 0)
+                cipher_suites[i] = select_gmac_cipher_suite(1);
             if (cipher_suites[i] == NULL) {
                 fprintf(stderr, "unknown cipher-suite: %s\n", optarg);
                 exit(1);
@@ -549,12 +634,12 @@ int main(int argc, char **argv)
             fprintf(stderr, "-c and -k options must be set\n");
             return 1;
         }
-#if PICOTLS_USE_BROTLI
+#if PICOTLS_USE_CERTIFICATE_COMPRESSION
         if (ctx.decompress_certificate != NULL) {
             static ptls_emit_compressed_certificate_t ecc;
             if (ptls_init_compressed_certificate(&ecc, ctx.certificates.list, ctx.certificates.count, ptls_iovec_init(NULL, 0)) !=
                 0) {
-                fprintf(stderr, "failed to create a brotli-compressed version of the certificate chain.\n");
+                fprintf(stderr, "failed to create a compressed version of the certificate chain.\n");
                 exit(1);
             }
             ctx.emit_certificate = &ecc.super;
@@ -571,17 +656,31 @@ int main(int argc, char **argv)
     }
     if (key_exchanges[0] == NULL)
         key_exchanges[0] = &ptls_openssl_secp256r1;
-    if (cipher_suites[0] == NULL) {
+    if (calibrate) {
+        if (cipher_suites[0] != NULL) {
+            fprintf(stderr, "-t and -y cannot be used together\n");
+            return 1;
+        }
+        setup_calibrated_cipher_suites(cipher_suites);
+    } else if (cipher_suites[0] == NULL) {
         size_t i;
         for (i = 0; ptls_openssl_cipher_suites[i] != NULL; ++i)
             cipher_suites[i] = ptls_openssl_cipher_suites[i];
     }
-    if (esni_file != NULL) {
-        if (esni_key_exchanges.count == 0) {
-            fprintf(stderr, "-E must be used together with -K\n");
-            return 1;
+    if (ech_file != NULL) {
+        if (is_server) {
+            if (ech_key_exchange == NULL) {
+                fprintf(stderr, "-E must be used together with -K on the server side\n");
+                return 1;
+            }
+            setup_ech(&ctx, ech_file, ech_key_exchange);
+        } else {
+            static ptls_iovec_t retry_configs;
+            ctx.ech.client.ciphers = ptls_openssl_hpke_cipher_suites;
+            ctx.ech.client.kems = ptls_openssl_hpke_kems;
+            hsprop.client.ech.configs = load_ech_configs(ech_file);
+            hsprop.client.ech.retry_configs = &retry_configs;
         }
-        setup_esni(&ctx, esni_file, esni_key_exchanges.elements);
     }
     if (argc != 2) {
         fprintf(stderr, "missing host and port\n");
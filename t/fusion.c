@@ -137,6 +137,111 @@ static void gcm_capacity(void)
     ptls_fusion_aesgcm_free(ctx);
 }
 
+static void gcm_grow_capacity(void)
+{
+    static uint8_t text[16384], encrypted[sizeof(text) + 16], decrypted[sizeof(text)];
+    ptls_aead_context_t *fusion = ptls_aead_new_direct(&ptls_fusion_aes128gcm, 1, zero, zero),
+                        *mc = ptls_aead_new_direct(&ptls_minicrypto_aes128gcm, 0, zero, zero);
+
+    /* the first call is beyond the initial capacity of 1500 bytes */
+    memset(text, 'a', sizeof(text));
+    ptls_aead_encrypt(fusion, encrypted, text, sizeof(text), 0, "aad", 3);
+    ok(ptls_aead_decrypt(mc, decrypted, encrypted, sizeof(encrypted), 0, "aad", 3) == sizeof(text));
+    ok(memcmp(decrypted, text, sizeof(text)) == 0);
+
+    { /* streaming encryption of a payload larger than the GHASH table, with the payload being encrypted in place */
+        size_t off = 0;
+        memcpy(decrypted, text, sizeof(text));
+        ptls_aead_encrypt_init(fusion, 1, "aad", 3);
+        for (size_t inoff = 0; inoff < sizeof(text); inoff += 1000)
+            off += ptls_aead_encrypt_update(fusion, decrypted + off, decrypted + inoff,
+                                            sizeof(text) - inoff < 1000 ? sizeof(text) - inoff : 1000);
+        ok(off == sizeof(text));
+        memcpy(encrypted, decrypted, sizeof(text));
+        off += ptls_aead_encrypt_final(fusion, encrypted + off);
+        ok(off == sizeof(encrypted));
+        ok(ptls_aead_decrypt(mc, decrypted, encrypted, sizeof(encrypted), 1, "aad", 3) == sizeof(text));
+        ok(memcmp(decrypted, text, sizeof(text)) == 0);
+    }
+
+    ptls_aead_free(fusion);
+    ptls_aead_free(mc);
+}
+
+static void gcm_trailer(void)
+{
+    static const size_t lengths[] = {0, 1, 15, 16, 17, 80, 94, 95, 96, 97, 191, 192, 193, 1500, 16384};
+    static const uint8_t trailer[16] = {0x17, 0x16, 0x15, 0x14, 0x13, 0x12, 0x11, 0x10, 0xf, 0xe, 0xd, 0xc, 0xb, 0xa, 0x9, 0x8};
+    ptls_aead_context_t *fusion = ptls_aead_new_direct(&ptls_fusion_aes128gcm, 1, zero, zero),
+                        *mc = ptls_aead_new_direct(&ptls_minicrypto_aes128gcm, 1, zero, zero);
+
+    for (size_t i = 0; i < PTLS_ELEMENTSOF(lengths); ++i) {
+        for (size_t trailerlen = 1; trailerlen <= sizeof(trailer); trailerlen += sizeof(trailer) - 1) {
+            size_t len = lengths[i];
+            uint8_t *input = malloc(len); /* exact size, so that ASan can detect overreads */
+            uint8_t *joined = malloc(len + trailerlen), *expected = malloc(len + trailerlen + 16),
+                    *actual = malloc(len + trailerlen + 16);
+            for (size_t j = 0; j < len; ++j)
+                input[j] = joined[j] = (uint8_t)j;
+            memcpy(joined + len, trailer, trailerlen);
+
+            ptls_aead_encrypt(mc, expected, joined, len + trailerlen, i, "aad", 3);
+            ptls_fusion_aesgcm_aead_encrypt_with_trailer(fusion, actual, input, len, trailer, trailerlen, i, "aad", 3);
+            ok(memcmp(expected, actual, len + trailerlen + 16) == 0);
+
+            free(input);
+            free(joined);
+            free(expected);
+            free(actual);
+        }
+    }
+
+    ptls_aead_free(fusion);
+    ptls_aead_free(mc);
+}
+
+static void gcm_recycle(void)
+{
+    static const uint8_t key[PTLS_AES128_KEY_SIZE] = {1};
+    static uint8_t text[16384], encrypted[sizeof(text) + 16], decrypted[sizeof(text)];
+    ptls_aead_context_t *fusion = ptls_aead_new_direct(&ptls_fusion_aes128gcm, 1, zero, zero), *recycled, *mc;
+    size_t grown_ghash_cnt;
+
+    ptls_aead_pool_max_bytes = 1024 * 1024;
+
+    /* grow the GHASH table, then return the context to the pool while a streaming encryption is in progress */
+    memset(text, 'a', sizeof(text));
+    ptls_aead_encrypt(fusion, encrypted, text, sizeof(text), 0, "aad", 3);
+    grown_ghash_cnt = ((struct aesgcm_context *)fusion)->aesgcm->ghash_cnt;
+    ptls_aead_encrypt_init(fusion, 1, "aad", 3);
+    ptls_aead_encrypt_update(fusion, encrypted, text, 100);
+    ptls_aead_free(fusion);
+
+    /* the recycled context uses the new key for records that are as large as the table, and retains no streaming state */
+    recycled = ptls_aead_new_direct(&ptls_fusion_aes128gcm, 1, key, zero);
+    ok(recycled == fusion);
+    ok(((struct aesgcm_context *)recycled)->stream.partial_len == 0);
+    mc = ptls_aead_new_direct(&ptls_minicrypto_aes128gcm, 0, key, zero);
+    ptls_aead_encrypt(recycled, encrypted, text, sizeof(text), 0, "aad", 3);
+    ok(ptls_aead_decrypt(mc, decrypted, encrypted, sizeof(encrypted), 0, "aad", 3) == sizeof(text));
+    ok(memcmp(decrypted, text, sizeof(text)) == 0);
+    ptls_aead_free(recycled);
+    ptls_aead_free(mc);
+    ptls_aead_pool_clear();
+
+    /* contexts exceeding the limit are released, including the GHASH table */
+    ptls_aead_pool_max_bytes = ptls_fusion_aes128gcm.context_size + 4096;
+    fusion = ptls_aead_new_direct(&ptls_fusion_aes128gcm, 1, zero, zero);
+    ptls_aead_encrypt(fusion, encrypted, text, sizeof(text), 0, "aad", 3);
+    ptls_aead_free(fusion);
+    recycled = ptls_aead_new_direct(&ptls_fusion_aes128gcm, 1, key, zero);
+    ok(((struct aesgcm_context *)recycled)->aesgcm->ghash_cnt < grown_ghash_cnt);
+    ptls_aead_free(recycled);
+    ptls_aead_pool_clear();
+
+    ptls_aead_pool_max_bytes = 0;
+}
+
 static void gcm_test_vectors(void)
 {
     static const uint8_t one[16] = {1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1};
@@ -227,6 +332,21 @@ static void test_generated(int aes256)
             ptls_aead_free(fusion);
         }
 
+        { /* the streaming interface, feeding the input in chunks, generates the same output */
+            ptls_aead_context_t *fusion =
+                ptls_aead_new_direct(aes256 ? &ptls_fusion_aes256gcm : &ptls_fusion_aes128gcm, 1, key, iv);
+            uint8_t streamed[textlen + 16];
+            size_t off = 0, inoff, chunklen = i % 40 + 1;
+            ptls_aead_encrypt_init(fusion, seq, aad, aadlen);
+            for (inoff = 0; inoff < textlen; inoff += chunklen)
+                off += ptls_aead_encrypt_update(fusion, streamed + off, text + inoff,
+                                                textlen - inoff < chunklen ? textlen - inoff : chunklen);
+            off += ptls_aead_encrypt_final(fusion, streamed + off);
+            ptls_aead_free(fusion);
+            if (off != sizeof(streamed) || memcmp(streamed, encrypted, sizeof(streamed)) != 0)
+                goto Fail;
+        }
+
         memset(decrypted, 0xcc, sizeof(decrypted));
 
         { /* check that the encrypted text can be decrypted by OpenSSL */
@@ -259,6 +379,167 @@ static void test_generated_aes256(void)
     test_generated(1);
 }
 
+static void test_aegis(ptls_aead_algorithm_t *fusion_algo, ptls_aead_algorithm_t *mc_algo)
+{
+    ptls_cipher_context_t *rand = ptls_cipher_new(&ptls_minicrypto_aes128ctr, 1, zero);
+    ptls_cipher_init(rand, zero);
+    int i;
+
+    for (i = 0; i < 1000; ++i) {
+        /* generate input using RNG */
+        uint8_t key[32], iv[32], aadlen, textlen, chunklen;
+        uint64_t seq;
+        ptls_cipher_encrypt(rand, key, zero, sizeof(key));
+        ptls_cipher_encrypt(rand, iv, zero, sizeof(iv));
+        ptls_cipher_encrypt(rand, &aadlen, zero, sizeof(aadlen));
+        ptls_cipher_encrypt(rand, &textlen, zero, sizeof(textlen));
+        ptls_cipher_encrypt(rand, &chunklen, zero, sizeof(chunklen));
+        ptls_cipher_encrypt(rand, &seq, zero, sizeof(seq));
+        uint8_t aad[aadlen], text[textlen];
+        ptls_cipher_encrypt(rand, aad, zero, sizeof(aad));
+        ptls_cipher_encrypt(rand, text, zero, sizeof(text));
+        chunklen = chunklen % 40 + 1;
+
+        uint8_t encrypted[textlen + 16], decrypted[textlen];
+        memset(encrypted, 0x55, sizeof(encrypted));
+        memset(decrypted, 0xcc, sizeof(decrypted));
+
+        { /* encrypt using fusion, feeding the input in chunks */
+            ptls_aead_context_t *fusion = ptls_aead_new_direct(fusion_algo, 1, key, iv);
+            size_t off = 0, inoff;
+            ptls_aead_encrypt_init(fusion, seq, aad, aadlen);
+            for (inoff = 0; inoff < textlen; inoff += chunklen)
+                off += ptls_aead_encrypt_update(fusion, encrypted + off, text + inoff,
+                                                textlen - inoff < chunklen ? textlen - inoff : chunklen);
+            off += ptls_aead_encrypt_final(fusion, encrypted + off);
+            ptls_aead_free(fusion);
+            if (off != sizeof(encrypted))
+                goto Fail;
+        }
+
+        { /* check that the encrypted text can be decrypted by minicrypto */
+            ptls_aead_context_t *mc = ptls_aead_new_direct(mc_algo, 0, key, iv);
+            if (ptls_aead_decrypt(mc, decrypted, encrypted, textlen + 16, seq, aad, aadlen) != textlen)
+                goto Fail;
+            if (memcmp(decrypted, text, textlen) != 0)
+                goto Fail;
+            ptls_aead_free(mc);
+        }
+
+        { /* and the other way around */
+            ptls_aead_context_t *mc = ptls_aead_new_direct(mc_algo, 1, key, iv),
+                                *fusion = ptls_aead_new_direct(fusion_algo, 0, key, iv);
+            ptls_aead_encrypt(mc, encrypted, text, textlen, seq, aad, aadlen);
+            if (ptls_aead_decrypt(fusion, decrypted, encrypted, textlen + 16, seq, aad, aadlen) != textlen)
+                goto Fail;
+            if (memcmp(decrypted, text, textlen) != 0)
+                goto Fail;
+            ptls_aead_free(mc);
+            ptls_aead_free(fusion);
+        }
+    }
+
+    ok(1);
+    ptls_cipher_free(rand);
+    return;
+
+Fail:
+    note("mismatch at index=%d", i);
+    ok(0);
+}
+
+static void test_aegis128l(void)
+{
+    test_aegis(&ptls_fusion_aegis128l, &ptls_minicrypto_aegis128l);
+}
+
+static void test_aegis256(void)
+{
+    test_aegis(&ptls_fusion_aegis256, &ptls_minicrypto_aegis256);
+}
+
+/**
+ * The GMAC tag of a payload equals the GCM tag calculated when the payload is the ciphertext; therefore, ciphertext generated by
+ * AES-GCM of minicrypto and then protected by AES-GMAC of fusion should yield exactly the output of AES-GCM.
+ */
+static void test_gmac(ptls_aead_algorithm_t *fusion_algo, ptls_aead_algorithm_t *mc_algo)
+{
+    ptls_cipher_context_t *rand = ptls_cipher_new(&ptls_minicrypto_aes128ctr, 1, zero);
+    ptls_cipher_init(rand, zero);
+    int i;
+
+    for (i = 0; i < 1000; ++i) {
+        /* generate input using RNG */
+        uint8_t key[32], iv[12], aadlen, chunklen;
+        uint16_t textlen;
+        uint64_t seq;
+        ptls_cipher_encrypt(rand, key, zero, sizeof(key));
+        ptls_cipher_encrypt(rand, iv, zero, sizeof(iv));
+        ptls_cipher_encrypt(rand, &aadlen, zero, sizeof(aadlen));
+        ptls_cipher_encrypt(rand, &textlen, zero, sizeof(textlen));
+        ptls_cipher_encrypt(rand, &chunklen, zero, sizeof(chunklen));
+        ptls_cipher_encrypt(rand, &seq, zero, sizeof(seq));
+        textlen %= 3000; /* exceeds the initial capacity of fusion */
+        uint8_t aad[aadlen], text[textlen];
+        ptls_cipher_encrypt(rand, aad, zero, sizeof(aad));
+        ptls_cipher_encrypt(rand, text, zero, sizeof(text));
+        chunklen = chunklen % 40 + 1;
+
+        uint8_t encrypted[textlen + 16], authenticated[textlen + 16], decrypted[textlen];
+        memset(authenticated, 0x55, sizeof(authenticated));
+        memset(decrypted, 0xcc, sizeof(decrypted));
+
+        { /* encrypt using AES-GCM of minicrypto */
+            ptls_aead_context_t *mc = ptls_aead_new_direct(mc_algo, 1, key, iv);
+            ptls_aead_encrypt(mc, encrypted, text, textlen, seq, aad, aadlen);
+            ptls_aead_free(mc);
+        }
+
+        { /* protect the ciphertext using fusion, feeding the input in chunks */
+            ptls_aead_context_t *fusion = ptls_aead_new_direct(fusion_algo, 1, key, iv);
+            size_t off = 0, inoff;
+            ptls_aead_encrypt_init(fusion, seq, aad, aadlen);
+            for (inoff = 0; inoff < textlen; inoff += chunklen)
+                off += ptls_aead_encrypt_update(fusion, authenticated + off, encrypted + inoff,
+                                                textlen - inoff < chunklen ? textlen - inoff : chunklen);
+            off += ptls_aead_encrypt_final(fusion, authenticated + off);
+            ptls_aead_free(fusion);
+            if (off != sizeof(authenticated) || memcmp(authenticated, encrypted, sizeof(encrypted)) != 0)
+                goto Fail;
+        }
+
+        { /* verify, then detect modification */
+            ptls_aead_context_t *fusion = ptls_aead_new_direct(fusion_algo, 0, key, iv);
+            if (ptls_aead_decrypt(fusion, decrypted, authenticated, textlen + 16, seq, aad, aadlen) != textlen)
+                goto Fail;
+            if (memcmp(decrypted, encrypted, textlen) != 0)
+                goto Fail;
+            authenticated[i % sizeof(authenticated)] ^= 0x80;
+            if (ptls_aead_decrypt(fusion, decrypted, authenticated, textlen + 16, seq, aad, aadlen) != SIZE_MAX)
+                goto Fail;
+            ptls_aead_free(fusion);
+        }
+    }
+
+    ok(1);
+    ptls_cipher_free(rand);
+    return;
+
+Fail:
+    note("mismatch at index=%d", i);
+    ok(0);
+}
+
+static void test_gmac128(void)
+{
+    test_gmac(&ptls_fusion_aes128gmac, &ptls_minicrypto_aes128gcm);
+}
+
+static void test_gmac256(void)
+{
+    test_gmac(&ptls_fusion_aes256gmac, &ptls_minicrypto_aes256gcm);
+}
+
 int main(int argc, char **argv)
 {
     if (!ptls_fusion_is_supported_by_cpu()) {
@@ -270,9 +551,16 @@ int main(int argc, char **argv)
     subtest("ecb", test_ecb);
     subtest("gcm-basic", gcm_basic);
     subtest("gcm-capacity", gcm_capacity);
+    subtest("gcm-grow-capacity", gcm_grow_capacity);
+    subtest("gcm-trailer", gcm_trailer);
+    subtest("gcm-recycle", gcm_recycle);
     subtest("gcm-test-vectors", gcm_test_vectors);
     subtest("generated-128", test_generated_aes128);
     subtest("generated-256", test_generated_aes256);
+    subtest("aegis-128l", test_aegis128l);
+    subtest("aegis-256", test_aegis256);
+    subtest("gmac-128", test_gmac128);
+    subtest("gmac-256", test_gmac256);
 
     return done_testing();
 }
@@ -28,6 +28,10 @@
 #include "../deps/picotest/picotest.h"
 #include "../lib/cifra.c"
 #include "../lib/uecc.c"
+#include "../lib/cifra/mlkem768.c"
+#include "../lib/cifra/sha2.c"
+#include "../deps/cifra/src/sha3.c"
+#include "picotls/asn1.h"
 #include "test.h"
 
 static void test_secp256r1_key_exchange(void)
@@ -40,6 +44,173 @@ static void test_x25519_key_exchange(void)
     test_key_exchange(&ptls_minicrypto_x25519, &ptls_minicrypto_x25519);
 }
 
+static void test_mlkem768_vectors(void)
+{
+    uint8_t seed[64], m[32], pk[MLKEM768_PUBLIC_KEY_SIZE], sk[MLKEM768_SECRET_KEY_SIZE], ct[MLKEM768_CIPHERTEXT_SIZE], ss[32],
+        ss2[32], hash[32];
+    char hex[65];
+    size_t i;
+
+    for (i = 0; i < sizeof(seed); ++i)
+        seed[i] = i;
+    for (i = 0; i < sizeof(m); ++i)
+        m[i] = 64 + i;
+
+    /* regression values; the relations being defined by FIPS 203 are checked by test_mlkem768_hashes */
+    mlkem768_keypair(pk, sk, seed);
+    mlkem_hash_h(hash, pk, sizeof(pk));
+    ok(strcmp(ptls_hexdump(hex, hash, sizeof(hash)), "a24e16d8f8f9383a95b77050f4d9fd2f5733eec1d63ef3c23ebf9918173669a7") == 0);
+    mlkem_hash_h(hash, sk, sizeof(sk));
+    ok(strcmp(ptls_hexdump(hex, hash, sizeof(hash)), "1149f17c3c4ac6ab1e3e2d9d8bd0171355ac0fa31bb8855c48ceade874c0864b") == 0);
+    ok(mlkem768_encaps(ct, ss, pk, m));
+    mlkem_hash_h(hash, ct, sizeof(ct));
+    ok(strcmp(ptls_hexdump(hex, hash, sizeof(hash)), "b4cfbd24cef67afd3764276c6980e0f88f8e9ca57f59b7f12fe1a9c1e72f4710") == 0);
+    ok(strcmp(ptls_hexdump(hex, ss, sizeof(ss)), "9cddd089ffe70e3996e76f7c8d06746df34d07e8657bc0fcf2bb0e1c3084aea1") == 0);
+    mlkem768_decaps(ss2, ct, sk);
+    ok(memcmp(ss, ss2, sizeof(ss)) == 0);
+
+    /* implicit rejection */
+    ct[0] ^= 1;
+    mlkem768_decaps(ss2, ct, sk);
+    ok(strcmp(ptls_hexdump(hex, ss2, sizeof(ss2)), "dcfc80c6db46ff7028e3a4398651c063ae7a42c107a6dc8cb07141861698ab92") == 0);
+
+    /* modulus check; set the first coefficient to q */
+    pk[0] = MLKEM_Q & 0xff;
+    pk[1] = (pk[1] & 0xf0) | (MLKEM_Q >> 8);
+    ok(!mlkem768_encaps(ct, ss, pk, m));
+}
+
+/**
+ * SHA3 and SHAKE256 of cifra, which share no code with the Keccak implementation of mlkem768.c
+ */
+static void cifra_sha3(uint8_t *output, size_t outlen, uint8_t domain, const void *input1, size_t len1, const void *input2,
+                       size_t len2)
+{
+    cf_sha3_context ctx;
+
+    sha3_init(&ctx, 1600 - (domain == DOMAIN_SHAKE_PAD ? 512 : outlen * 16), domain == DOMAIN_SHAKE_PAD ? 512 : outlen * 16);
+    sha3_update(&ctx, input1, len1);
+    sha3_update(&ctx, input2, len2);
+    pad(&ctx, domain, ctx.rate - ctx.npartial);
+    squeeze(&ctx, output, outlen);
+}
+
+/**
+ * Checks the relations that FIPS 203 defines between the seeds, the keys, the ciphertext, and the shared secrets, using an
+ * independent implementation of SHA3. This detects the differences from round-3 Kyber (e.g., the domain separator of G in
+ * K-PKE.KeyGen, m and the shared secret not being hashed) as well as mistakes in the layout of the decapsulation key.
+ */
+static void test_mlkem768_hashes(void)
+{
+    static const uint8_t k = MLKEM_K;
+    uint8_t seed[64], m[32], pk[MLKEM768_PUBLIC_KEY_SIZE], sk[MLKEM768_SECRET_KEY_SIZE], ct[MLKEM768_CIPHERTEXT_SIZE], ss[32],
+        ss2[32], h[32], g[64];
+    size_t i;
+
+    for (i = 0; i < sizeof(seed); ++i)
+        seed[i] = 0xa5 ^ i;
+    for (i = 0; i < sizeof(m); ++i)
+        m[i] = 0x5a ^ i;
+
+    /* ML-KEM.KeyGen_internal(d, z): (rho, sigma) = G(d || k), ek = t_hat || rho, dk = dk_pke || ek || H(ek) || z */
+    mlkem768_keypair(pk, sk, seed);
+    cifra_sha3(g, 64, DOMAIN_HASH_PAD, seed, 32, &k, 1);
+    ok(memcmp(pk + MLKEM_POLYVECBYTES, g, 32) == 0);
+    ok(memcmp(sk + MLKEM_INDCPA_SECRETKEYBYTES, pk, sizeof(pk)) == 0);
+    cifra_sha3(h, 32, DOMAIN_HASH_PAD, pk, sizeof(pk), NULL, 0);
+    ok(memcmp(sk + MLKEM_INDCPA_SECRETKEYBYTES + sizeof(pk), h, 32) == 0);
+    ok(memcmp(sk + sizeof(sk) - 32, seed + 32, 32) == 0);
+
+    /* ML-KEM.Encaps_internal(ek, m): (K, r) = G(m || H(ek)) */
+    ok(mlkem768_encaps(ct, ss, pk, m));
+    cifra_sha3(g, 64, DOMAIN_HASH_PAD, m, sizeof(m), h, sizeof(h));
+    ok(memcmp(ss, g, 32) == 0);
+    mlkem768_decaps(ss2, ct, sk);
+    ok(memcmp(ss2, ss, sizeof(ss)) == 0);
+
+    /* ML-KEM.Decaps_internal(dk, c') for a modified ciphertext returns J(z || c') */
+    for (i = 0; i < sizeof(ct); i += 97) {
+        ct[i] ^= 0x10;
+        mlkem768_decaps(ss2, ct, sk);
+        cifra_sha3(g, 32, DOMAIN_SHAKE_PAD, seed + 32, 32, ct, sizeof(ct));
+        ok(memcmp(ss2, g, 32) == 0);
+        ct[i] ^= 0x10;
+    }
+}
+
+static void test_mlkem768(void)
+{
+    subtest("vectors", test_mlkem768_vectors);
+    subtest("hashes", test_mlkem768_hashes);
+#if MLKEM_HAVE_AVX2
+    if (mlkem_use_avx2()) {
+        mlkem_avx2_disabled = 1;
+        subtest("vectors-portable", test_mlkem768_vectors);
+        mlkem_avx2_disabled = 0;
+    }
+#endif
+}
+
+static void test_x25519mlkem768_key_exchange(void)
+{
+    test_key_exchange(&ptls_minicrypto_x25519mlkem768, &ptls_minicrypto_x25519mlkem768);
+}
+
+static void test_sha2(void)
+{
+    static const size_t splits[] = {0, 1, 55, 56, 63, 64, 65, 111, 112, 127, 128, 129, 200, SIZE_MAX};
+    uint8_t input[1024], expected[CF_SHA384_HASHSZ], actual[CF_SHA384_HASHSZ];
+    cf_sha256_context ctx256;
+    cf_sha512_context ctx512;
+    size_t len, i;
+    int ok256 = 1, ok384 = 1;
+
+    for (i = 0; i < sizeof(input); ++i)
+        input[i] = (uint8_t)(i * 7 + 3);
+
+    /* compare against cifra, splitting the input at the points where the partial block wraps around */
+    for (len = 0; len <= sizeof(input); len += len < 300 ? 1 : 181) {
+        for (i = 0; i < PTLS_ELEMENTSOF(splits); ++i) {
+            size_t split = splits[i] < len ? splits[i] : len;
+            cf_sha256_init(&ctx256);
+            cf_sha256_update(&ctx256, input, len);
+            cf_sha256_digest_final(&ctx256, expected);
+            cf_sha256_init(&ctx256);
+            ptls_minicrypto__sha256_update(&ctx256, input, split);
+            ptls_minicrypto__sha256_update(&ctx256, input + split, len - split);
+            ptls_minicrypto__sha256_final(&ctx256, actual);
+            if (memcmp(expected, actual, CF_SHA256_HASHSZ) != 0)
+                ok256 = 0;
+            cf_sha384_init(&ctx512);
+            cf_sha384_update(&ctx512, input, len);
+            cf_sha384_digest_final(&ctx512, expected);
+            cf_sha384_init(&ctx512);
+            ptls_minicrypto__sha384_update(&ctx512, input, split);
+            ptls_minicrypto__sha384_update(&ctx512, input + split, len - split);
+            ptls_minicrypto__sha384_final(&ctx512, actual);
+            if (memcmp(expected, actual, CF_SHA384_HASHSZ) != 0)
+                ok384 = 0;
+        }
+    }
+    ok(ok256);
+    ok(ok384);
+
+#if SHA2_HAVE_X86
+    /* the two implementations share the context, and therefore can be switched midway */
+    cf_sha256_init(&ctx256);
+    cf_sha256_update(&ctx256, input, 1000);
+    cf_sha256_digest_final(&ctx256, expected);
+    cf_sha256_init(&ctx256);
+    ptls_minicrypto__sha256_update(&ctx256, input, 100);
+    sha2_accel_disabled = 1;
+    ptls_minicrypto__sha256_update(&ctx256, input + 100, 500);
+    sha2_accel_disabled = 0;
+    ptls_minicrypto__sha256_update(&ctx256, input + 600, 400);
+    ptls_minicrypto__sha256_final(&ctx256, actual);
+    ok(memcmp(expected, actual, CF_SHA256_HASHSZ) == 0);
+#endif
+}
+
 static void test_secp256r1_sign(void)
 {
     const char *msg = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdef";
@@ -135,6 +306,187 @@ static void test_hrr(void)
     ptls_free(server);
 }
 
+static void do_test_hybrid_handshake(ptls_key_exchange_algorithm_t **client_keyex, int expect_hrr)
+{
+    ptls_key_exchange_algorithm_t *server_keyex[] = {&ptls_minicrypto_x25519mlkem768, NULL};
+    ptls_context_t client_ctx = {ptls_minicrypto_random_bytes, &ptls_get_time, client_keyex, ptls_minicrypto_cipher_suites},
+                   server_ctx = *ctx_peer;
+    ptls_t *client, *server;
+    ptls_buffer_t cbuf, sbuf, decbuf;
+    size_t consumed;
+    int ret;
+
+    server_ctx.key_exchanges = server_keyex;
+    client = ptls_new(&client_ctx, 0);
+    server = ptls_new(&server_ctx, 1);
+    ptls_buffer_init(&cbuf, "", 0);
+    ptls_buffer_init(&sbuf, "", 0);
+    ptls_buffer_init(&decbuf, "", 0);
+
+    ret = ptls_handshake(client, &cbuf, NULL, NULL, NULL);
+    ok(ret == PTLS_ERROR_IN_PROGRESS);
+
+    if (expect_hrr) {
+        consumed = cbuf.off;
+        ret = ptls_handshake(server, &sbuf, cbuf.base, &consumed, NULL);
+        ok(ret == PTLS_ERROR_IN_PROGRESS);
+        cbuf.off = 0;
+        consumed = sbuf.off;
+        ret = ptls_handshake(client, &cbuf, sbuf.base, &consumed, NULL);
+        ok(ret == PTLS_ERROR_IN_PROGRESS);
+        sbuf.off = 0;
+    }
+
+    /* the ClientHello carries the hybrid key share */
+    ok(cbuf.off > 1216);
+
+    consumed = cbuf.off;
+    ret = ptls_handshake(server, &sbuf, cbuf.base, &consumed, NULL);
+    ok(ret == 0);
+    ok(consumed == cbuf.off);
+    cbuf.off = 0;
+
+    consumed = sbuf.off;
+    ret = ptls_handshake(client, &cbuf, sbuf.base, &consumed, NULL);
+    ok(ret == 0);
+    ok(consumed == sbuf.off);
+    sbuf.off = 0;
+
+    ret = ptls_send(client, &cbuf, "hello world", 11);
+    ok(ret == 0);
+    consumed = cbuf.off;
+    ret = ptls_receive(server, &decbuf, cbuf.base, &consumed);
+    ok(ret == 0);
+    ok(decbuf.off == 11 && memcmp(decbuf.base, "hello world", 11) == 0);
+
+    ptls_buffer_dispose(&decbuf);
+    ptls_buffer_dispose(&sbuf);
+    ptls_buffer_dispose(&cbuf);
+    ptls_free(client);
+    ptls_free(server);
+}
+
+static void test_hybrid_handshake(void)
+{
+    ptls_key_exchange_algorithm_t *hybrid_first[] = {&ptls_minicrypto_x25519mlkem768, &ptls_minicrypto_x25519, NULL},
+                                  *x25519_first[] = {&ptls_minicrypto_x25519, &ptls_minicrypto_x25519mlkem768, NULL};
+
+    do_test_hybrid_handshake(hybrid_first, 0);
+    do_test_hybrid_handshake(x25519_first, 1);
+}
+
+static void test_asn1_der(void)
+{
+    ptls_asn1_x509_t x509;
+    ptls_asn1_der_cursor_t cur;
+    ptls_iovec_t name;
+    uint64_t t;
+
+    ok(ptls_asn1_x509_decode(&x509, ptls_iovec_init(SECP256R1_CERTIFICATE, sizeof(SECP256R1_CERTIFICATE) - 1)) == 0);
+    ok(x509.serial_number.len == 1 && x509.serial_number.base[0] == 1);
+    ok(x509.issuer.len == 28 && memcmp(x509.issuer.base + 13, "picotls test ca", 15) == 0);
+    ok(x509.subject.len == 29 && memcmp(x509.subject.base + 13, "test.example.com", 16) == 0);
+    ok(x509.subject_public_key_info.len == 91);
+    ok(x509.subject_public_key_info.base[0] == 0x30 && x509.subject_public_key_info.base[1] == 0x59);
+    ok(x509.not_after.tag == PTLS_ASN1_TAG_UTC_TIME);
+    ok(ptls_asn1_der_decode_time(&t, x509.not_after.tag, x509.not_after.value) == 0);
+    ok(t == 1834723864); /* 2028-02-21 05:31:04 UTC */
+    ok(x509.subject_alt_name.base == NULL);
+
+    /* time */
+    ok(ptls_asn1_der_decode_time(&t, PTLS_ASN1_TAG_UTC_TIME, ptls_iovec_init("991231235959Z", 13)) == 0);
+    ok(t == 946684799);
+    ok(ptls_asn1_der_decode_time(&t, PTLS_ASN1_TAG_GENERALIZED_TIME, ptls_iovec_init("20500101000000Z", 15)) == 0);
+    ok(t == 2524608000);
+    ok(ptls_asn1_der_decode_time(&t, PTLS_ASN1_TAG_UTC_TIME, ptls_iovec_init("991231235959+", 13)) != 0);
+    ok(ptls_asn1_der_decode_time(&t, PTLS_ASN1_TAG_UTC_TIME, ptls_iovec_init("991331235959Z", 13)) != 0);
+    ok(ptls_asn1_der_decode_time(&t, PTLS_ASN1_TAG_UTC_TIME, ptls_iovec_init("240229000000Z", 13)) == 0);
+    ok(t == 1709164800);
+    ok(ptls_asn1_der_decode_time(&t, PTLS_ASN1_TAG_UTC_TIME, ptls_iovec_init("230229000000Z", 13)) != 0);
+    ok(ptls_asn1_der_decode_time(&t, PTLS_ASN1_TAG_GENERALIZED_TIME, ptls_iovec_init("20000229000000Z", 15)) == 0);
+    ok(ptls_asn1_der_decode_time(&t, PTLS_ASN1_TAG_GENERALIZED_TIME, ptls_iovec_init("21000229000000Z", 15)) != 0);
+
+    { /* GeneralNames with dNSName, iPAddress, dNSName */
+        static const uint8_t san[] = {0x82, 0x09, 'a', '.', 'e', 'x', 'a', 'm', 'p', 'l', 'e', 0x87, 0x04, 127, 0, 0, 1,
+                                      0x82, 0x09, 'b', '.', 'e', 'x', 'a', 'm', 'p', 'l', 'e'};
+        ptls_asn1_der_init(&cur, ptls_iovec_init(san, sizeof(san)));
+        ok(ptls_asn1_x509_next_dns_name(&cur, &name) == 0);
+        ok(name.len == 9 && memcmp(name.base, "a.example", 9) == 0);
+        ok(ptls_asn1_x509_next_dns_name(&cur, &name) == 0);
+        ok(name.len == 9 && memcmp(name.base, "b.example", 9) == 0);
+        ok(ptls_asn1_x509_next_dns_name(&cur, &name) == 0);
+        ok(name.base == NULL);
+    }
+
+    { /* malformed input */
+        static const uint8_t truncated[] = {0x30, 0x05, 0x02, 0x01}, indefinite[] = {0x30, 0x80, 0x00, 0x00},
+                             long_length[] = {0x04, 0x85, 0x01, 0x00, 0x00, 0x00, 0x00}, integer[] = {0x02, 0x01, 0x00};
+        ptls_iovec_t value;
+        uint8_t tag;
+        ptls_asn1_der_init(&cur, ptls_iovec_init(truncated, sizeof(truncated)));
+        ok(ptls_asn1_der_read(&cur, &tag, &value, NULL) == PTLS_ERROR_BER_EXCESSIVE_LENGTH);
+        ptls_asn1_der_init(&cur, ptls_iovec_init(indefinite, sizeof(indefinite)));
+        ok(ptls_asn1_der_read(&cur, &tag, &value, NULL) == PTLS_ERROR_DER_INDEFINITE_LENGTH);
+        ptls_asn1_der_init(&cur, ptls_iovec_init(long_length, sizeof(long_length)));
+        ok(ptls_asn1_der_read(&cur, &tag, &value, NULL) == PTLS_ERROR_BER_MALFORMED_LENGTH);
+        ptls_asn1_der_init(&cur, ptls_iovec_init(integer, sizeof(integer)));
+        ok(ptls_asn1_der_read_expected(&cur, PTLS_ASN1_TAG_OCTET_STRING, &value) == PTLS_ERROR_INCORRECT_ASN1_SYNTAX);
+        ok(cur.src == integer);
+        ok(ptls_asn1_x509_decode(&x509, ptls_iovec_init(SECP256R1_CERTIFICATE, sizeof(SECP256R1_CERTIFICATE) - 2)) != 0);
+    }
+}
+
+static void test_aegis_vector(ptls_aead_algorithm_t *algo, const void *ad, size_t adlen, const void *msg, size_t msglen,
+                              const char *expected)
+{
+    static const uint8_t key[32] = {0x10, 0x01}, nonce[32] = {0x10, 0x00, 0x02};
+    ptls_aead_context_t *enc = ptls_aead_new_direct(algo, 1, key, nonce), *dec = ptls_aead_new_direct(algo, 0, key, nonce);
+    uint8_t encrypted[msglen + PTLS_AEGIS_TAG_SIZE], decrypted[msglen + 1];
+    char hex[sizeof(encrypted) * 2 + 1];
+    size_t off, i;
+
+    /* one-shot */
+    ok(ptls_aead_encrypt(enc, encrypted, msg, msglen, 0, ad, adlen) == sizeof(encrypted));
+    ok(strcmp(ptls_hexdump(hex, encrypted, sizeof(encrypted)), expected) == 0);
+    ok(ptls_aead_decrypt(dec, decrypted, encrypted, sizeof(encrypted), 0, ad, adlen) == msglen);
+    ok(memcmp(decrypted, msg, msglen) == 0);
+
+    /* streaming, feeding one byte at a time */
+    memset(encrypted, 0, sizeof(encrypted));
+    ptls_aead_encrypt_init(enc, 0, ad, adlen);
+    for (off = 0, i = 0; i < msglen; ++i)
+        off += ptls_aead_encrypt_update(enc, encrypted + off, (const uint8_t *)msg + i, 1);
+    off += ptls_aead_encrypt_final(enc, encrypted + off);
+    ok(off == sizeof(encrypted));
+    ok(strcmp(ptls_hexdump(hex, encrypted, sizeof(encrypted)), expected) == 0);
+
+    /* tampered */
+    encrypted[0] ^= 1;
+    ok(ptls_aead_decrypt(dec, decrypted, encrypted, sizeof(encrypted), 0, ad, adlen) == SIZE_MAX);
+
+    ptls_aead_free(enc);
+    ptls_aead_free(dec);
+}
+
+static void test_aegis(void)
+{
+    static const uint8_t zero[16], ad[8] = {0, 1, 2, 3, 4, 5, 6, 7},
+                                   msg[32] = {0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 12, 13, 14, 15,
+                                              16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31};
+
+    /* test vectors from draft-irtf-cfrg-aegis-aead */
+    test_aegis_vector(&ptls_minicrypto_aegis128l, NULL, 0, zero, 16,
+                      "c1c0e58bd913006feba00f4b3cc3594eabe0ece80c24868a226a35d16bdae37a");
+    test_aegis_vector(&ptls_minicrypto_aegis128l, NULL, 0, NULL, 0, "c2b879a67def9d74e6c14f708bbcc9b4");
+    test_aegis_vector(&ptls_minicrypto_aegis128l, ad, sizeof(ad), msg, sizeof(msg),
+                      "79d94593d8c2119d7e8fd9b8fc77845c5c077a05b2528b6ac54b563aed8efe84cc6f3372f6aa1bb82388d695c3962d9a");
+    test_aegis_vector(&ptls_minicrypto_aegis256, NULL, 0, zero, 16,
+                      "754fc3d8c973246dcc6d741412a4b2363fe91994768b332ed7f570a19ec5896e");
+    test_aegis_vector(&ptls_minicrypto_aegis256, NULL, 0, NULL, 0, "e3def978a0f054afd1e761d7553afba3");
+    test_aegis_vector(&ptls_minicrypto_aegis256, ad, sizeof(ad), msg, sizeof(msg),
+                      "f373079ed84b2709faee373584585d60accd191db310ef5d8b11833df9dec7118d86f91ee606e9ff26a01b64ccbdd91d");
+}
+
 DEFINE_FFX_AES128_ALGORITHMS(minicrypto);
 DEFINE_FFX_CHACHA20_ALGORITHMS(minicrypto);
 
@@ -142,7 +494,12 @@ int main(int argc, char **argv)
 {
     subtest("secp256r1", test_secp256r1_key_exchange);
     subtest("x25519", test_x25519_key_exchange);
+    subtest("mlkem768", test_mlkem768);
+    subtest("sha2", test_sha2);
+    subtest("x25519mlkem768", test_x25519mlkem768_key_exchange);
     subtest("secp256r1-sign", test_secp256r1_sign);
+    subtest("asn1-der", test_asn1_der);
+    subtest("aegis", test_aegis);
 
     ptls_iovec_t cert = ptls_iovec_init(SECP256R1_CERTIFICATE, sizeof(SECP256R1_CERTIFICATE) - 1);
 
@@ -155,7 +512,7 @@ int main(int argc, char **argv)
                              ptls_minicrypto_key_exchanges,
                              ptls_minicrypto_cipher_suites,
                              {&cert, 1},
-                             NULL,
+                             {{NULL}},
                              NULL,
                              NULL,
                              &sign_certificate.super};
@@ -165,6 +522,8 @@ int main(int argc, char **argv)
 
     subtest("picotls", test_picotls);
     subtest("hrr", test_hrr);
+    subtest("hybrid-handshake", test_hybrid_handshake);
+    test_picotls_integrity_only(&ptls_minicrypto_sha256sha256, &ptls_minicrypto_sha256sha256);
 
     return done_testing();
 }
@@ -30,6 +30,9 @@
 #include <openssl/engine.h>
 #include "picotls.h"
 #include "picotls/minicrypto.h"
+#if PICOTLS_USE_CERTIFICATE_COMPRESSION
+#include "picotls/certificate_compression.h"
+#endif
 #include "../deps/picotest/picotest.h"
 #include "../lib/openssl.c"
 #include "test.h"
@@ -127,8 +130,70 @@ static void test_key_exchanges(void)
     test_key_exchange(&ptls_openssl_x25519, &ptls_minicrypto_x25519);
     test_key_exchange(&ptls_minicrypto_x25519, &ptls_openssl_x25519);
 #endif
+
+#if PTLS_OPENSSL_HAVE_X25519MLKEM768
+    test_key_exchange(&ptls_openssl_x25519mlkem768, &ptls_openssl_x25519mlkem768);
+    test_key_exchange(&ptls_openssl_x25519mlkem768, &ptls_minicrypto_x25519mlkem768);
+    test_key_exchange(&ptls_minicrypto_x25519mlkem768, &ptls_openssl_x25519mlkem768);
+#endif
+}
+
+/**
+ * Runs a handshake between a client using `client_keyex` and a server using `server_keyex` as the only key exchange, then exchanges
+ * application data.
+ */
+static void do_test_key_exchange_handshake(ptls_key_exchange_algorithm_t *client_keyex, ptls_key_exchange_algorithm_t *server_keyex)
+{
+    ptls_key_exchange_algorithm_t *client_keyexes[] = {client_keyex, NULL}, *server_keyexes[] = {server_keyex, NULL};
+    ptls_context_t client_ctx = *ctx, server_ctx = *ctx_peer;
+    ptls_t *client, *server;
+    ptls_buffer_t cbuf, sbuf, decbuf;
+    size_t consumed;
+    int ret;
+
+    client_ctx.key_exchanges = client_keyexes;
+    server_ctx.key_exchanges = server_keyexes;
+    client = ptls_new(&client_ctx, 0);
+    server = ptls_new(&server_ctx, 1);
+    ptls_buffer_init(&cbuf, "", 0);
+    ptls_buffer_init(&sbuf, "", 0);
+    ptls_buffer_init(&decbuf, "", 0);
+
+    ret = ptls_handshake(client, &cbuf, NULL, NULL, NULL);
+    ok(ret == PTLS_ERROR_IN_PROGRESS);
+    consumed = cbuf.off;
+    ret = ptls_handshake(server, &sbuf, cbuf.base, &consumed, NULL);
+    ok(ret == 0);
+    ok(consumed == cbuf.off);
+    cbuf.off = 0;
+    consumed = sbuf.off;
+    ret = ptls_handshake(client, &cbuf, sbuf.base, &consumed, NULL);
+    ok(ret == 0);
+    ok(consumed == sbuf.off);
+    sbuf.off = 0;
+
+    ret = ptls_send(client, &cbuf, "hello world", 11);
+    ok(ret == 0);
+    consumed = cbuf.off;
+    ret = ptls_receive(server, &decbuf, cbuf.base, &consumed);
+    ok(ret == 0);
+    ok(decbuf.off == 11 && memcmp(decbuf.base, "hello world", 11) == 0);
+
+    ptls_buffer_dispose(&decbuf);
+    ptls_buffer_dispose(&sbuf);
+    ptls_buffer_dispose(&cbuf);
+    ptls_free(client);
+    ptls_free(server);
 }
 
+#if PTLS_OPENSSL_HAVE_X25519MLKEM768
+static void test_x25519mlkem768_handshake(void)
+{
+    do_test_key_exchange_handshake(&ptls_minicrypto_x25519mlkem768, &ptls_openssl_x25519mlkem768);
+    do_test_key_exchange_handshake(&ptls_openssl_x25519mlkem768, &ptls_minicrypto_x25519mlkem768);
+}
+#endif
+
 static void test_rsa_sign(void)
 {
     ptls_openssl_sign_certificate_t *sc = (ptls_openssl_sign_certificate_t *)ctx->sign_certificate;
@@ -194,6 +259,78 @@ static ptls_key_exchange_context_t *key_from_pem(const char *pem)
     return ctx;
 }
 
+static void test_hpke_roundtrip(ptls_hpke_kem_t *kem, ptls_hpke_cipher_suite_t *cipher)
+{
+    ptls_key_exchange_context_t *keyex;
+    ptls_aead_context_t *sender, *recipient;
+    ptls_iovec_t enc, info = ptls_iovec_init("hello", 5);
+    uint8_t ks_context[PTLS_HPKE_MAX_KEY_SCHEDULE_CONTEXT_SIZE], ct[64], pt[64];
+    size_t i;
+    int ret;
+
+    ret = kem->keyex->create(kem->keyex, &keyex);
+    ok(ret == 0);
+    ret = ptls_hpke_setup_base_s(kem, cipher, &enc, &sender, keyex->pubkey, info);
+    ok(ret == 0);
+    ret = ptls_hpke_key_schedule_context(kem, cipher, ks_context, info);
+    ok(ret == 0);
+    ret = ptls_hpke_setup_base_r_precomputed(kem, cipher, keyex, &recipient, enc,
+                                             ptls_iovec_init(ks_context, PTLS_HPKE_KEY_SCHEDULE_CONTEXT_SIZE(cipher)));
+    ok(ret == 0);
+
+    /* the sequence number is shared by the two contexts; check that it advances in the same way */
+    for (i = 0; i < 2; ++i) {
+        size_t ctlen = ptls_aead_encrypt(sender, ct, "world", 5, i, "aad", 3);
+        ok(ctlen == 5 + cipher->aead->tag_size);
+        ok(ptls_aead_decrypt(recipient, pt, ct, ctlen, i, "aad", 3) == 5);
+        ok(memcmp(pt, "world", 5) == 0);
+    }
+
+    ptls_aead_free(sender);
+    ptls_aead_free(recipient);
+    free(enc.base);
+    keyex->on_exchange(&keyex, 1, NULL, ptls_iovec_init(NULL, 0));
+}
+
+static void test_hpke(void)
+{
+    size_t i, j;
+
+#if PTLS_OPENSSL_HAVE_X25519
+    { /* RFC 9180 A.1.1 */
+        static const uint8_t sk[] = {0x46, 0x12, 0xc5, 0x50, 0x26, 0x3f, 0xc8, 0xad, 0x58, 0x37, 0x5d, 0xf3, 0xf5, 0x57, 0xaa,
+                                     0xc5, 0x31, 0xd2, 0x68, 0x50, 0x90, 0x3e, 0x55, 0xa9, 0xf2, 0x3f, 0x21, 0xd8, 0x53, 0x4e,
+                                     0x8a, 0xc8};
+        static const char *enc = "\x37\xfd\xa3\x56\x7b\xdb\xd6\x28\xe8\x86\x68\xc3\xc8\xd7\xe9\x7d\x1d\x12\x53\xb6\xd4\xea\x6d\x44"
+                                 "\xc1\x50\xf7\x41\xf1\xbf\x44\x31",
+                          *info = "\x4f\x64\x65\x20\x6f\x6e\x20\x61\x20\x47\x72\x65\x63\x69\x61\x6e\x20\x55\x72\x6e",
+                          *ct = "\xf9\x38\x55\x8b\x5d\x72\xf1\xa2\x38\x10\xb4\xbe\x2a\xb4\xf8\x43\x31\xac\xc0\x2f\xc9\x7b\xab\xc5"
+                                "\x3a\x52\xae\x82\x18\xa3\x55\xa9\x6d\x87\x70\xac\x83\xd0\x7b\xea\x87\xe1\x3c\x51\x2a",
+                          *pt = "Beauty is truth, truth beauty";
+        EVP_PKEY *pkey = EVP_PKEY_new_raw_private_key(EVP_PKEY_X25519, NULL, sk, sizeof(sk));
+        ptls_key_exchange_context_t *keyex;
+        ptls_aead_context_t *aead;
+        uint8_t decrypted[64];
+        int ret;
+
+        ret = ptls_openssl_create_key_exchange(&keyex, pkey);
+        ok(ret == 0);
+        EVP_PKEY_free(pkey);
+        ret = ptls_hpke_setup_base_r(&ptls_openssl_hpke_kem_x25519sha256, &ptls_openssl_hpke_aes128gcmsha256, keyex, &aead,
+                                     ptls_iovec_init(enc, 32), ptls_iovec_init(info, 20));
+        ok(ret == 0);
+        ok(ptls_aead_decrypt(aead, decrypted, ct, 45, 0, "Count-0", 7) == strlen(pt));
+        ok(memcmp(decrypted, pt, strlen(pt)) == 0);
+        ptls_aead_free(aead);
+        keyex->on_exchange(&keyex, 1, NULL, ptls_iovec_init(NULL, 0));
+    }
+#endif
+
+    for (i = 0; ptls_openssl_hpke_kems[i] != NULL; ++i)
+        for (j = 0; ptls_openssl_hpke_cipher_suites[j] != NULL; ++j)
+            test_hpke_roundtrip(ptls_openssl_hpke_kems[i], ptls_openssl_hpke_cipher_suites[j]);
+}
+
 static void test_cert_verify(void)
 {
     X509 *cert = x509_from_pem(RSA_CERTIFICATE);
@@ -253,6 +390,342 @@ static int verify_cert_cb(int ok, X509_STORE_CTX *ctx)
     return 1;
 }
 
+static void test_context_replica(void)
+{
+    ptls_context_t src = *ctx;
+    ptls_openssl_context_replica_t replica;
+    ptls_openssl_sign_certificate_t *orig_signer = (void *)ctx->sign_certificate;
+    ptls_openssl_verify_certificate_t orig_verifier;
+    X509_STORE *store = X509_STORE_new();
+    X509 *ca = x509_from_pem(RSA_CERTIFICATE);
+    const char *message = "hello world";
+    ptls_buffer_t sigbuf;
+    uint8_t sigbuf_small[1024];
+
+    X509_STORE_set_verify_cb(store, verify_cert_cb);
+    X509_STORE_add_cert(store, ca);
+    ptls_openssl_init_verify_certificate(&orig_verifier, store);
+    src.verify_certificate = &orig_verifier.super;
+
+    /* by default, the verifier shares the store */
+    ok(ptls_openssl_init_context_replica(&replica, &src, 0) == 0);
+    ok(replica.ctx.verify_certificate == &replica.verify_certificate.super);
+    ok(replica.verify_certificate.cert_store == orig_verifier.cert_store);
+    ptls_openssl_dispose_context_replica(&replica);
+    ok(replica.ctx.verify_certificate == NULL);
+
+    ok(ptls_openssl_init_context_replica(&replica, &src, 1) == 0);
+    ok(replica.ctx.cipher_suites == src.cipher_suites);
+    ok(replica.ctx.get_time == src.get_time);
+
+    /* the signer uses a copy of the key */
+    ok(replica.ctx.sign_certificate == &replica.sign_certificate.super);
+    ok(replica.sign_certificate.key != orig_signer->key);
+    ok(replica.sign_certificate.schemes[0].scheme_id == orig_signer->schemes[0].scheme_id);
+    ptls_buffer_init(&sigbuf, sigbuf_small, sizeof(sigbuf_small));
+    ok(do_sign(replica.sign_certificate.key, &sigbuf, ptls_iovec_init(message, strlen(message)),
+               replica.sign_certificate.schemes[0].scheme_md) == 0);
+    EVP_PKEY_up_ref(orig_signer->key);
+    ok(verify_sign(orig_signer->key, ptls_iovec_init(message, strlen(message)), ptls_iovec_init(sigbuf.base, sigbuf.off)) == 0);
+    ptls_buffer_dispose(&sigbuf);
+
+    /* the verifier uses a copy of the store */
+    ok(replica.ctx.verify_certificate == &replica.verify_certificate.super);
+    ok(replica.verify_certificate.cert_store != orig_verifier.cert_store);
+    ok(X509_STORE_get_verify_cb(replica.verify_certificate.cert_store) == verify_cert_cb);
+    {
+        STACK_OF(X509_OBJECT) *objs = X509_STORE_get0_objects(replica.verify_certificate.cert_store);
+        X509 *copied;
+        ok(sk_X509_OBJECT_num(objs) == 1);
+        ok(X509_OBJECT_get_type(sk_X509_OBJECT_value(objs, 0)) == X509_LU_X509);
+        copied = X509_OBJECT_get0_X509(sk_X509_OBJECT_value(objs, 0));
+        ok(copied != ca);
+        ok(X509_cmp(copied, ca) == 0);
+    }
+
+    ptls_openssl_dispose_context_replica(&replica);
+    ok(replica.ctx.sign_certificate == NULL);
+    ok(replica.ctx.verify_certificate == NULL);
+    ptls_openssl_dispose_verify_certificate(&orig_verifier);
+    X509_STORE_free(store);
+    X509_free(ca);
+}
+
+static void test_calibrate_cipher_suites(void)
+{
+    /* an implementation that does not interoperate with the others must not be selected */
+    ptls_cipher_suite_t broken = {PTLS_CIPHER_SUITE_AES_128_GCM_SHA256, &ptls_minicrypto_aes256gcm, &ptls_minicrypto_sha384},
+                        *broken_suites[] = {&broken, NULL};
+    ptls_cipher_suite_backend_t backends[] = {{"openssl", ptls_openssl_cipher_suites},
+                                              {"broken", broken_suites},
+                                              {"minicrypto", ptls_minicrypto_cipher_suites},
+                                              {NULL}};
+    ptls_calibrated_cipher_suite_t results[8];
+    size_t num_results, i;
+
+    num_results = ptls_calibrate_cipher_suites(results, PTLS_ELEMENTSOF(results), backends);
+    ok(num_results >= 2);
+    ok(results[0].suite.id == ptls_openssl_cipher_suites[0]->id);
+    ok(results[1].suite.id == ptls_openssl_cipher_suites[1]->id);
+    for (i = 0; i != num_results; ++i) {
+        ok(results[i].aead_nsec != UINT64_MAX);
+        ok(results[i].hash_nsec != UINT64_MAX);
+        ok(strcmp(results[i].aead_backend, "broken") != 0);
+        ok(strcmp(results[i].hash_backend, "broken") != 0);
+    }
+
+    /* the output is truncated to the size of the array */
+    ok(ptls_calibrate_cipher_suites(results, 1, backends) == 1);
+    ok(results[0].suite.id == ptls_openssl_cipher_suites[0]->id);
+}
+
+#if PTLS_OPENSSL_HAVE_OCSP_STAPLER
+
+static X509 *issue_test_certificate(const char *cn, X509 *issuer, EVP_PKEY *key)
+{
+    X509 *cert = X509_new();
+    X509_NAME *name = X509_NAME_new();
+
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), issuer == NULL ? 1 : 2);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)cn, -1, -1, 0);
+    X509_set_subject_name(cert, name);
+    X509_set_issuer_name(cert, issuer != NULL ? X509_get_subject_name(issuer) : name);
+    X509_gmtime_adj(X509_get_notBefore(cert), -86400);
+    X509_gmtime_adj(X509_get_notAfter(cert), 86400);
+    X509_set_pubkey(cert, key);
+    if (issuer == NULL) {
+        X509_EXTENSION *ext = X509V3_EXT_conf_nid(NULL, NULL, NID_basic_constraints, "critical,CA:TRUE");
+        X509_add_ext(cert, ext, -1);
+        X509_EXTENSION_free(ext);
+    }
+    X509_sign(cert, key, EVP_sha256());
+
+    X509_NAME_free(name);
+    return cert;
+}
+
+static ptls_iovec_t build_ocsp_response(X509 *cert, X509 *issuer, EVP_PKEY *key, int status, long next_update)
+{
+    OCSP_BASICRESP *basic = OCSP_BASICRESP_new();
+    ASN1_TIME *this_update_at = X509_gmtime_adj(NULL, -3600), *next_update_at = X509_gmtime_adj(NULL, next_update);
+    OCSP_CERTID *id = OCSP_cert_to_id(NULL, cert, issuer);
+    OCSP_RESPONSE *resp;
+    unsigned char *der = NULL;
+    ptls_iovec_t ret;
+
+    OCSP_basic_add1_status(basic, id, status, status == V_OCSP_CERTSTATUS_REVOKED ? OCSP_REVOKED_STATUS_KEYCOMPROMISE : 0,
+                           status == V_OCSP_CERTSTATUS_REVOKED ? this_update_at : NULL, this_update_at, next_update_at);
+    OCSP_basic_sign(basic, issuer, key, EVP_sha256(), NULL, OCSP_NOCERTS);
+    resp = OCSP_response_create(OCSP_RESPONSE_STATUS_SUCCESSFUL, basic);
+    ret.len = i2d_OCSP_RESPONSE(resp, &der);
+    ret.base = malloc(ret.len);
+    memcpy(ret.base, der, ret.len);
+
+    OPENSSL_free(der);
+    OCSP_RESPONSE_free(resp);
+    OCSP_BASICRESP_free(basic);
+    OCSP_CERTID_free(id);
+    ASN1_TIME_free(this_update_at);
+    ASN1_TIME_free(next_update_at);
+    return ret;
+}
+
+struct test_ocsp_fetcher_t {
+    ptls_openssl_fetch_ocsp_response_t super;
+    ptls_iovec_t resp;
+    size_t num_calls;
+};
+
+static int test_fetch_ocsp_response(ptls_openssl_fetch_ocsp_response_t *_self, ptls_iovec_t *resp, X509 *cert, X509 *issuer)
+{
+    struct test_ocsp_fetcher_t *self = (void *)_self;
+
+    ++self->num_calls;
+    if (self->resp.base == NULL)
+        return PTLS_ERROR_NOT_AVAILABLE;
+    *resp = ptls_iovec_init(malloc(self->resp.len), self->resp.len);
+    memcpy(resp->base, self->resp.base, self->resp.len);
+    return 0;
+}
+
+static ptls_iovec_t received_staple;
+
+static int on_certificate_extension(ptls_on_extension_t *self, ptls_t *tls, uint8_t hstype, uint16_t exttype, ptls_iovec_t extdata)
+{
+    if (hstype == PTLS_HANDSHAKE_TYPE_CERTIFICATE && exttype == 5 /* status_request */ && extdata.len >= 4) {
+        free(received_staple.base);
+        received_staple.len = extdata.len - 4; /* status_type, length */
+        received_staple.base = malloc(received_staple.len);
+        memcpy(received_staple.base, extdata.base + 4, received_staple.len);
+    }
+    return 0;
+}
+
+/**
+ * runs a handshake and returns if the expected staple was received
+ */
+static int handshake_with_staple(ptls_context_t *server_ctx, int request_status, ptls_iovec_t expected)
+{
+    ptls_on_extension_t on_extension = {on_certificate_extension};
+    ptls_context_t client_ctx = *ctx;
+    client_ctx.on_extension = &on_extension;
+    ptls_raw_extension_t status_request[] = {{5, {(uint8_t *)"\x01\x00\x00\x00\x00", 5}}, {UINT16_MAX}};
+    ptls_handshake_properties_t client_props = {{{{NULL}}}};
+    ptls_t *client = ptls_new(&client_ctx, 0), *server = ptls_new(server_ctx, 1);
+    ptls_buffer_t cbuf, sbuf;
+    size_t consumed;
+    int ret, success = 0;
+
+    if (request_status)
+        client_props.additional_extensions = status_request;
+    free(received_staple.base);
+    received_staple = ptls_iovec_init(NULL, 0);
+    ptls_buffer_init(&cbuf, "", 0);
+    ptls_buffer_init(&sbuf, "", 0);
+
+    if ((ret = ptls_handshake(client, &cbuf, NULL, NULL, &client_props)) != PTLS_ERROR_IN_PROGRESS)
+        goto Exit;
+    consumed = cbuf.off;
+    if ((ret = ptls_handshake(server, &sbuf, cbuf.base, &consumed, NULL)) != 0)
+        goto Exit;
+    consumed = sbuf.off;
+    if ((ret = ptls_handshake(client, &cbuf, sbuf.base, &consumed, &client_props)) != 0)
+        goto Exit;
+    success = received_staple.len == expected.len &&
+              (expected.len == 0 || memcmp(received_staple.base, expected.base, expected.len) == 0);
+
+Exit:
+    ptls_buffer_dispose(&cbuf);
+    ptls_buffer_dispose(&sbuf);
+    ptls_free(client);
+    ptls_free(server);
+    return success;
+}
+
+static uint64_t test_ocsp_now;
+
+#if PICOTLS_USE_CERTIFICATE_COMPRESSION
+static size_t num_decompressed;
+
+static int counting_decompress_certificate(ptls_decompress_certificate_t *self, ptls_t *tls, uint16_t algorithm,
+                                           ptls_iovec_t output, ptls_iovec_t input)
+{
+    ++num_decompressed;
+    return ptls_decompress_certificate.cb(&ptls_decompress_certificate, tls, algorithm, output, input);
+}
+#endif
+
+static uint64_t get_test_ocsp_time(ptls_get_time_t *self)
+{
+    return test_ocsp_now;
+}
+
+static void test_ocsp_stapler(void)
+{
+    BIO *bio = BIO_new_mem_buf(RSA_PRIVATE_KEY, (int)strlen(RSA_PRIVATE_KEY));
+    EVP_PKEY *key = PEM_read_bio_PrivateKey(bio, NULL, NULL, NULL);
+    X509 *ca = issue_test_certificate("test OCSP CA", NULL, key), *leaf = issue_test_certificate("test.example.com", ca, key);
+    ptls_iovec_t chain[2] = {{NULL}}, good = build_ocsp_response(leaf, ca, key, V_OCSP_CERTSTATUS_GOOD, 3600),
+                 revoked = build_ocsp_response(leaf, ca, key, V_OCSP_CERTSTATUS_REVOKED, 3600),
+                 none = ptls_iovec_init(NULL, 0);
+    struct test_ocsp_fetcher_t fetcher = {{test_fetch_ocsp_response}};
+    ptls_get_time_t test_clock = {get_test_ocsp_time};
+    ptls_openssl_ocsp_stapler_t stapler;
+    ptls_context_t server_ctx = *ctx_peer;
+    uint64_t expires_at;
+
+    BIO_free(bio);
+    chain[0].len = i2d_X509(leaf, &chain[0].base);
+    chain[1].len = i2d_X509(ca, &chain[1].base);
+    server_ctx.certificates.list = chain;
+    server_ctx.certificates.count = 2;
+    server_ctx.emit_certificate = &stapler.super;
+
+    ok(ptls_openssl_init_ocsp_stapler(&stapler, chain, 2, &fetcher.super) == 0);
+    test_ocsp_now = ptls_get_time.cb(&ptls_get_time);
+    stapler.get_time = &test_clock;
+
+    /* no staple until a response is obtained */
+    ok(handshake_with_staple(&server_ctx, 1, none));
+    ok(ptls_openssl_refresh_ocsp_stapler(&stapler) == PTLS_ERROR_NOT_AVAILABLE);
+    ok(stapler._state->next_refresh_at == test_ocsp_now + stapler.retry_interval);
+    ok(handshake_with_staple(&server_ctx, 1, none));
+
+    /* valid response is stapled only when requested, and the refresh is scheduled before nextUpdate */
+    fetcher.resp = good;
+    ok(ptls_openssl_refresh_ocsp_stapler(&stapler) == 0);
+    expires_at = stapler._state->staple->expires_at;
+    ok(test_ocsp_now < expires_at && expires_at <= test_ocsp_now + 3600 * 1000);
+    ok(test_ocsp_now < stapler._state->next_refresh_at && stapler._state->next_refresh_at < expires_at);
+    ok(handshake_with_staple(&server_ctx, 1, good));
+    ok(handshake_with_staple(&server_ctx, 0, none));
+
+#if PICOTLS_USE_CERTIFICATE_COMPRESSION
+    { /* compression is used unless a response is being stapled */
+        ptls_emit_compressed_certificate_t ecc;
+        ptls_decompress_certificate_t counting = {ptls_decompress_certificate.supported_algorithms,
+                                                  counting_decompress_certificate},
+                                      *orig_decompress = ctx->decompress_certificate;
+        ok(ptls_init_compressed_certificate(&ecc, chain, 2, none) == 0);
+        stapler.compressed = &ecc.super;
+        ctx->decompress_certificate = &counting;
+        num_decompressed = 0;
+        ok(handshake_with_staple(&server_ctx, 1, good));
+        ok(num_decompressed == 0);
+        ok(handshake_with_staple(&server_ctx, 0, none));
+        ok(num_decompressed == 1);
+        ctx->decompress_certificate = orig_decompress;
+        stapler.compressed = NULL;
+        ptls_dispose_compressed_certificate(&ecc);
+    }
+#endif
+
+    /* invalid responses are rejected, retaining the previous one */
+    fetcher.resp = revoked;
+    ok(ptls_openssl_refresh_ocsp_stapler(&stapler) == PTLS_ERROR_INVALID_OCSP_RESPONSE);
+    good.base[good.len - 10] ^= 1;
+    fetcher.resp = good;
+    ok(ptls_openssl_refresh_ocsp_stapler(&stapler) == PTLS_ERROR_INVALID_OCSP_RESPONSE);
+    good.base[good.len - 10] ^= 1;
+    ok(handshake_with_staple(&server_ctx, 1, good));
+
+    /* expired response is not sent */
+    test_ocsp_now = expires_at;
+    ok(handshake_with_staple(&server_ctx, 1, none));
+    ok(ptls_openssl_refresh_ocsp_stapler(&stapler) == PTLS_ERROR_INVALID_OCSP_RESPONSE);
+
+    ptls_openssl_dispose_ocsp_stapler(&stapler);
+
+    { /* the refresh thread obtains the response from file */
+        char path[] = "/tmp/picotls-ocsp-XXXXXX";
+        int fd = mkstemp(path), i;
+        ok(fd != -1);
+        ok(write(fd, good.base, good.len) == (ssize_t)good.len);
+        close(fd);
+        ptls_openssl_ocsp_response_file_t file = {{ptls_openssl_read_ocsp_response_file}, path};
+        ok(ptls_openssl_init_ocsp_stapler(&stapler, chain, 2, &file.super) == 0);
+        ok(ptls_openssl_start_ocsp_stapler(&stapler) == 0);
+        for (i = 0; i < 100 && !handshake_with_staple(&server_ctx, 1, good); ++i)
+            usleep(10000);
+        ok(i < 100);
+        ptls_openssl_dispose_ocsp_stapler(&stapler);
+        unlink(path);
+    }
+
+    free(received_staple.base);
+    received_staple = ptls_iovec_init(NULL, 0);
+    free(good.base);
+    free(revoked.base);
+    OPENSSL_free(chain[0].base);
+    OPENSSL_free(chain[1].base);
+    X509_free(leaf);
+    X509_free(ca);
+    EVP_PKEY_free(key);
+}
+
+#endif
+
 DEFINE_FFX_AES128_ALGORITHMS(openssl);
 #if PTLS_OPENSSL_HAVE_CHACHA20_POLY1305
 DEFINE_FFX_CHACHA20_ALGORITHMS(openssl);
@@ -275,6 +748,7 @@ int main(int argc, char **argv)
     subtest("bf", test_bf);
 
     subtest("key-exchange", test_key_exchanges);
+    subtest("hpke", test_hpke);
 
     ptls_iovec_t cert;
     setup_certificate(&cert);
@@ -288,7 +762,7 @@ int main(int argc, char **argv)
                                   ptls_openssl_key_exchanges,
                                   ptls_openssl_cipher_suites,
                                   {&cert, 1},
-                                  NULL,
+                                  {{NULL}},
                                   NULL,
                                   NULL,
                                   &openssl_sign_certificate.super};
@@ -297,8 +771,6 @@ int main(int argc, char **argv)
     ++openssl_ctx_sha256only.cipher_suites;
     assert(openssl_ctx_sha256only.cipher_suites[0]->hash->digest_size == 32); /* sha256 */
 
-    ptls_key_exchange_context_t *esni_private_keys[2] = {key_from_pem(ESNI_SECP256R1KEY), NULL};
-
     ctx = ctx_peer = &openssl_ctx;
     verify_certificate = &openssl_verify_certificate.super;
     ADD_FFX_AES128_ALGORITHMS(openssl);
@@ -309,8 +781,18 @@ int main(int argc, char **argv)
     subtest("rsa-sign", test_rsa_sign);
     subtest("ecdsa-sign", test_ecdsa_sign);
     subtest("cert-verify", test_cert_verify);
+    subtest("calibrate-cipher-suites", test_calibrate_cipher_suites);
+    subtest("context-replica", test_context_replica);
+#if PTLS_OPENSSL_HAVE_OCSP_STAPLER
+    subtest("ocsp-stapler", test_ocsp_stapler);
+#endif
     subtest("picotls", test_picotls);
-    test_picotls_esni(esni_private_keys);
+#if PTLS_OPENSSL_HAVE_X25519MLKEM768
+    subtest("x25519mlkem768-handshake", test_x25519mlkem768_handshake);
+#endif
+    test_picotls_ech(key_from_pem(ECH_SECP256R1KEY), ptls_openssl_hpke_kems, ptls_openssl_hpke_cipher_suites);
+    test_picotls_integrity_only(&ptls_openssl_sha256sha256, &ptls_openssl_sha256sha256);
+    test_picotls_integrity_only(&ptls_openssl_sha384sha384, &ptls_openssl_sha384sha384);
 
     ctx = ctx_peer = &openssl_ctx_sha256only;
     subtest("picotls", test_picotls);
@@ -323,6 +805,16 @@ int main(int argc, char **argv)
     ctx_peer = &openssl_ctx_sha256only;
     subtest("picotls", test_picotls);
 
+    ptls_openssl_context_replica_t openssl_replica;
+    if (ptls_openssl_init_context_replica(&openssl_replica, &openssl_ctx, 0) != 0) {
+        fprintf(stderr, "failed to initialize the context replica\n");
+        return 1;
+    }
+    ctx = &openssl_replica.ctx;
+    ctx_peer = &openssl_ctx;
+    subtest("replica vs.", test_picotls);
+    ptls_openssl_dispose_context_replica(&openssl_replica);
+
     ptls_minicrypto_secp256r1sha256_sign_certificate_t minicrypto_sign_certificate;
     ptls_iovec_t minicrypto_certificate = ptls_iovec_init(SECP256R1_CERTIFICATE, sizeof(SECP256R1_CERTIFICATE) - 1);
     ptls_minicrypto_init_secp256r1sha256_sign_certificate(
@@ -332,18 +824,19 @@ int main(int argc, char **argv)
                                      ptls_minicrypto_key_exchanges,
                                      ptls_minicrypto_cipher_suites,
                                      {&minicrypto_certificate, 1},
-                                     NULL,
+                                     {{NULL}},
                                      NULL,
                                      NULL,
                                      &minicrypto_sign_certificate.super};
     ctx = &openssl_ctx;
     ctx_peer = &minicrypto_ctx;
     subtest("vs. minicrypto", test_picotls);
+    test_picotls_integrity_only(&ptls_openssl_sha384sha384, &ptls_minicrypto_sha384sha384);
 
     ctx = &minicrypto_ctx;
     ctx_peer = &openssl_ctx;
     subtest("minicrypto vs.", test_picotls);
+    test_picotls_integrity_only(&ptls_minicrypto_sha256sha256, &ptls_openssl_sha256sha256);
 
-    esni_private_keys[0]->on_exchange(esni_private_keys, 1, NULL, ptls_iovec_init(NULL, 0));
     return done_testing();
 }
@@ -21,6 +21,10 @@
  */
 #ifdef _WINDOWS
 #include "wincompat.h"
+#else
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #endif
 #include <assert.h>
 #include <string.h>
@@ -29,6 +33,14 @@
 #include "picotls/ffx.h"
 #include "picotls/minicrypto.h"
 #include "picotls/pembase64.h"
+#ifndef _WINDOWS
+#include "picotls/session_cache.h"
+#include "picotls/ticket_key_file.h"
+#include "picotls/context_handle.h"
+#endif
+#if PICOTLS_USE_CERTIFICATE_COMPRESSION
+#include "picotls/certificate_compression.h"
+#endif
 #include "../deps/picotest/picotest.h"
 #include "../lib/picotls.c"
 #include "test.h"
@@ -313,6 +325,115 @@ static void test_chacha20poly1305(void)
     }
 }
 
+static void test_aead_pool(void)
+{
+    static const uint8_t key1[PTLS_MAX_SECRET_SIZE] = {1}, key2[PTLS_MAX_SECRET_SIZE] = {2}, iv[PTLS_MAX_IV_SIZE] = {3};
+    ptls_aead_algorithm_t *aead = find_cipher(ctx, PTLS_CIPHER_SUITE_AES_128_GCM_SHA256)->aead;
+    ptls_aead_context_t *ref, *pooled, *reused;
+    uint8_t text[16384], enc[sizeof(text) + PTLS_MAX_DIGEST_SIZE], enc2[sizeof(enc)], dec[sizeof(text)];
+    size_t enclen = sizeof(text) + aead->tag_size;
+
+    /* the pool is disabled by default */
+    ptls_aead_pool_clear();
+    pooled = ptls_aead_new_direct(aead, 1, key1, iv);
+    ptls_aead_free(pooled);
+    ok(aead_pool.count == 0);
+
+    /* contexts that do not fit are released */
+    ptls_aead_pool_max_bytes = aead->context_size - 1;
+    pooled = ptls_aead_new_direct(aead, 1, key1, iv);
+    ptls_aead_free(pooled);
+    ok(aead_pool.count == 0);
+
+    ptls_aead_pool_max_bytes = 1024 * 1024;
+    memset(text, 'A', sizeof(text));
+    ref = ptls_aead_new_direct(aead, 1, key2, iv);
+    ptls_aead_encrypt(ref, enc, text, sizeof(text), 1, "aad", 3);
+
+    /* encrypt a full-sized record using a different key so that the context grows, then return it to the pool */
+    pooled = ptls_aead_new_direct(aead, 1, key1, iv);
+    ptls_aead_encrypt(pooled, enc2, text, sizeof(text), 1, "aad", 3);
+    ok(memcmp(enc, enc2, enclen) != 0);
+    ptls_aead_free(pooled);
+
+    /* the pooled context is rekeyed and reused for decryption */
+    reused = ptls_aead_new_direct(aead, 0, key2, iv);
+    ok(reused == pooled);
+    ok(ptls_aead_decrypt(reused, dec, enc, enclen, 1, "aad", 3) == sizeof(text));
+    ok(memcmp(dec, text, sizeof(text)) == 0);
+    ptls_aead_free(reused);
+
+    /* and then for encryption */
+    reused = ptls_aead_new_direct(aead, 1, key2, iv);
+    ok(reused == pooled);
+    ptls_aead_encrypt(reused, enc2, text, sizeof(text), 1, "aad", 3);
+    ok(memcmp(enc, enc2, enclen) == 0);
+    ptls_aead_free(reused);
+
+    ptls_aead_free(ref);
+    ok(aead_pool.count == 2);
+    ok(aead_pool.bytes >= 2 * aead->context_size);
+    ptls_aead_pool_clear();
+    ok(aead_pool.bytes == 0);
+    ptls_aead_pool_max_bytes = 0;
+}
+
+static size_t chacha20_random_seed_calls;
+
+static void chacha20_random_counting_seed(void *buf, size_t len)
+{
+    ++chacha20_random_seed_calls;
+    ctx->random_bytes(buf, len);
+}
+
+static void test_chacha20_random(void)
+{
+    ptls_cipher_suite_t *cs = find_cipher(ctx, PTLS_CIPHER_SUITE_CHACHA20_POLY1305_SHA256);
+    ptls_cipher_algorithm_t *chacha20;
+    size_t orig_interval = ptls_chacha20_random_reseed_interval, i;
+    uint8_t a[5000], b[sizeof(a)], zero[sizeof(a)] = {0};
+
+    if (cs == NULL)
+        return;
+    chacha20 = cs->aead->ctr_cipher;
+
+    /* consecutive calls return different bytes, also across the refills of the buffer */
+    ptls_chacha20_random_bytes(chacha20, chacha20_random_counting_seed, a, sizeof(a));
+    ptls_chacha20_random_bytes(chacha20, chacha20_random_counting_seed, b, sizeof(b));
+    ok(memcmp(a, zero, sizeof(a)) != 0);
+    ok(memcmp(a, b, sizeof(a)) != 0);
+    ok(memcmp(a, a + sizeof(chacha20_random.buf) - sizeof(chacha20_random.key), 64) != 0);
+
+    /* reseeded once the interval is reached */
+    ptls_chacha20_random_reseed_interval = 100;
+    ptls_chacha20_random_bytes(chacha20, chacha20_random_counting_seed, a, 64);
+    chacha20_random_seed_calls = 0;
+    for (i = 0; i != 10; ++i)
+        ptls_chacha20_random_bytes(chacha20, chacha20_random_counting_seed, a, 64);
+    ok(chacha20_random_seed_calls == 5);
+    ptls_chacha20_random_reseed_interval = orig_interval;
+
+#ifndef _WINDOWS
+    { /* parent and child do not share the stream after fork */
+        int fds[2];
+        pid_t pid;
+        ptls_chacha20_random_bytes(chacha20, chacha20_random_counting_seed, a, 32);
+        ok(pipe(fds) == 0);
+        if ((pid = fork()) == 0) {
+            ptls_chacha20_random_bytes(chacha20, chacha20_random_counting_seed, a, 32);
+            _exit(write(fds[1], a, 32) == 32 ? 0 : 1);
+        }
+        ok(pid > 0);
+        ptls_chacha20_random_bytes(chacha20, chacha20_random_counting_seed, b, 32);
+        ok(read(fds[0], a, 32) == 32);
+        ok(memcmp(a, b, 32) != 0);
+        waitpid(pid, NULL, 0);
+        close(fds[0]);
+        close(fds[1]);
+    }
+#endif
+}
+
 static void test_ffx(void)
 {
     static uint8_t ffx_test_source[32] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
@@ -443,6 +564,33 @@ static int test_fragmented_message_record(ptls_t *tls, struct st_ptls_message_em
     return 0;
 }
 
+static void test_buffer_nonsensitive(void)
+{
+    uint8_t smallbuf[16];
+    ptls_buffer_t buf;
+
+    /* by default, memory being released upon growth is zero-cleared */
+    ptls_buffer_init(&buf, smallbuf, sizeof(smallbuf));
+    memcpy(smallbuf, "abc", 3);
+    buf.off = 3;
+    ok(ptls_buffer_reserve(&buf, sizeof(smallbuf)) == 0);
+    ok(buf.base != smallbuf);
+    ok(memcmp(smallbuf, "\0\0\0", 3) == 0);
+    ok(memcmp(buf.base, "abc", 3) == 0);
+    ptls_buffer_dispose(&buf);
+
+    /* but not when the buffer is marked as non-sensitive */
+    ptls_buffer_init(&buf, smallbuf, sizeof(smallbuf));
+    buf.is_nonsensitive = 1;
+    memcpy(smallbuf, "abc", 3);
+    buf.off = 3;
+    ok(ptls_buffer_reserve(&buf, sizeof(smallbuf)) == 0);
+    ok(buf.base != smallbuf);
+    ok(memcmp(smallbuf, "abc", 3) == 0);
+    ok(memcmp(buf.base, "abc", 3) == 0);
+    ptls_buffer_dispose(&buf);
+}
+
 static void test_fragmented_message(void)
 {
     ptls_context_t tlsctx = {NULL};
@@ -530,7 +678,7 @@ static void test_fragmented_message(void)
 #undef SET_RECORD
 }
 
-static int was_esni;
+static int was_ech;
 
 static int save_client_hello(ptls_on_client_hello_t *self, ptls_t *tls, ptls_on_client_hello_parameters_t *params)
 {
@@ -538,8 +686,8 @@ static int save_client_hello(ptls_on_client_hello_t *self, ptls_t *tls, ptls_on_
     if (params->negotiated_protocols.count != 0)
         ptls_set_negotiated_protocol(tls, (const char *)params->negotiated_protocols.list[0].base,
                                      params->negotiated_protocols.list[0].len);
-    if (params->esni)
-        ++was_esni;
+    if (params->ech)
+        ++was_ech;
     return 0;
 }
 
@@ -594,9 +742,9 @@ static void test_handshake(ptls_iovec_t ticket, int mode, int expect_ticket, int
         ctx_peer->require_client_authentication = 1;
     }
 
-    if (ctx_peer->esni != NULL) {
-        was_esni = 0;
-        client_hs_prop.client.esni_keys = ptls_iovec_init(ESNIKEYS, sizeof(ESNIKEYS) - 1);
+    if (ctx_peer->ech.server.configs != NULL) {
+        was_ech = 0;
+        client_hs_prop.client.ech.configs = ptls_iovec_init(ECH_CONFIG_LIST, sizeof(ECH_CONFIG_LIST) - 1);
     }
 
     switch (mode) {
@@ -664,7 +812,7 @@ static void test_handshake(ptls_iovec_t ticket, int mode, int expect_ticket, int
         ok(strcmp(ptls_get_server_name(server), "test.example.com") == 0);
         ok(ptls_get_negotiated_protocol(server) != NULL);
         ok(strcmp(ptls_get_negotiated_protocol(server), "h2") == 0);
-        ok(was_esni == (ctx_peer->esni != NULL));
+        ok(was_ech == (ctx_peer->ech.server.configs != NULL));
     } else {
         ok(ptls_get_server_name(server) == NULL);
         ok(ptls_get_negotiated_protocol(server) == NULL);
@@ -696,6 +844,10 @@ static void test_handshake(ptls_iovec_t ticket, int mode, int expect_ticket, int
     ret = ptls_handshake(client, &cbuf, sbuf.base, &consumed, NULL);
     ok(ret == 0);
     ok(cbuf.off != 0);
+    if (ctx_peer->ech.server.configs != NULL) {
+        ok(ptls_is_ech_handshake(client, NULL, NULL, NULL));
+        ok(ptls_is_ech_handshake(server, NULL, NULL, NULL));
+    }
     if (check_ch) {
         ok(ptls_get_server_name(client) != NULL);
         ok(strcmp(ptls_get_server_name(client), "test.example.com") == 0);
@@ -895,6 +1047,10 @@ static int on_copy_ticket(ptls_encrypt_ticket_t *self, ptls_t *tls, int is_encry
 }
 
 static ptls_iovec_t saved_ticket = {NULL};
+/**
+ * ticket encryptor being used by the resumption tests; tickets are not encrypted if NULL
+ */
+static ptls_encrypt_ticket_t *resumption_encrypt_ticket;
 
 static int on_save_ticket(ptls_save_ticket_t *self, ptls_t *tls, ptls_iovec_t src)
 {
@@ -927,7 +1083,7 @@ static void test_resumption_impl(int different_preferred_key_share, int require_
 
     ctx_peer->ticket_lifetime = 86400;
     ctx_peer->max_early_data_size = 8192;
-    ctx_peer->encrypt_ticket = &et;
+    ctx_peer->encrypt_ticket = resumption_encrypt_ticket != NULL ? resumption_encrypt_ticket : &et;
     ctx->save_ticket = &st;
 
     sc_callcnt = 0;
@@ -994,232 +1150,939 @@ static void test_resumption_with_client_authentication(void)
     test_resumption_impl(0, 1);
 }
 
-static void test_enforce_retry(int use_cookie)
+#ifndef _WINDOWS
+
+static int session_cache_call(ptls_session_cache_t *cache, ptls_t *tls, int is_encrypt, ptls_buffer_t *dst, ptls_iovec_t src)
 {
-    ptls_t *client, *server;
-    ptls_handshake_properties_t server_hs_prop = {{{{NULL}}}};
-    ptls_buffer_t cbuf, sbuf, decbuf;
-    size_t consumed;
-    int ret;
+    dst->off = 0;
+    return cache->super.cb(&cache->super, tls, is_encrypt, dst, src);
+}
 
-    server_hs_prop.server.cookie.key = "0123456789abcdef0123456789abcdef0123456789abcdef";
-    server_hs_prop.server.cookie.additional_data = ptls_iovec_init("1.2.3.4:1234", 12);
-    server_hs_prop.server.enforce_retry = 1;
-    server_hs_prop.server.retry_uses_cookie = use_cookie;
+static void test_session_cache_basic(ptls_session_cache_t *cache, int fd)
+{
+    static const char session[] = "hello world";
+    ptls_t *tls = ptls_new(ctx_peer, 1);
+    ptls_buffer_t ticket, decbuf;
+    uint32_t ticket_lifetime_orig = ctx_peer->ticket_lifetime;
+    uint8_t large[128] = {0};
 
-    ptls_buffer_init(&cbuf, "", 0);
-    ptls_buffer_init(&sbuf, "", 0);
+    ptls_buffer_init(&ticket, "", 0);
     ptls_buffer_init(&decbuf, "", 0);
+    ctx_peer->ticket_lifetime = 86400;
 
-    client = ptls_new(ctx, 0);
-
-    ret = ptls_handshake(client, &cbuf, NULL, NULL, NULL);
-    ok(ret == PTLS_ERROR_IN_PROGRESS);
-    ok(cbuf.off != 0);
-
-    server = ptls_new(ctx, 1);
-
-    consumed = cbuf.off;
-    ret = ptls_handshake(server, &sbuf, cbuf.base, &consumed, &server_hs_prop);
-    cbuf.off = 0;
-
-    if (use_cookie) {
-        ok(ret == PTLS_ERROR_STATELESS_RETRY);
-        ptls_free(server);
-        server = ptls_new(ctx, 1);
-    } else {
-        ok(ret == PTLS_ERROR_IN_PROGRESS);
+    /* store and lookup */
+    ok(session_cache_call(cache, tls, 1, &ticket, ptls_iovec_init(session, sizeof(session))) == 0);
+    ok(ticket.off == PTLS_SESSION_CACHE_ID_SIZE);
+    ok(session_cache_call(cache, tls, 0, &decbuf, ptls_iovec_init(ticket.base, ticket.off)) == 0);
+    ok(decbuf.off == sizeof(session) && memcmp(decbuf.base, session, sizeof(session)) == 0);
+
+    /* the session is visible to another process attaching to the same file */
+    {
+        ptls_session_cache_t attached;
+        ok(ptls_session_cache_init(&attached, fd, 4, 64) == 0);
+        ok(session_cache_call(&attached, tls, 0, &decbuf, ptls_iovec_init(ticket.base, ticket.off)) == 0);
+        ok(decbuf.off == sizeof(session) && memcmp(decbuf.base, session, sizeof(session)) == 0);
+        ptls_session_cache_dispose(&attached);
+        ok(ptls_session_cache_init(&attached, fd, 8, 64) == PTLS_ERROR_INCOMPATIBLE_KEY);
     }
 
-    consumed = sbuf.off;
-    ret = ptls_handshake(client, &cbuf, sbuf.base, &consumed, NULL);
-    ok(ret == PTLS_ERROR_IN_PROGRESS);
-    ok(sbuf.off == consumed);
-    sbuf.off = 0;
+    /* unknown or malformed IDs miss */
+    ticket.base[0] ^= 1;
+    ok(session_cache_call(cache, tls, 0, &decbuf, ptls_iovec_init(ticket.base, ticket.off)) == PTLS_ERROR_SESSION_NOT_FOUND);
+    ok(decbuf.off == 0);
+    ok(session_cache_call(cache, tls, 0, &decbuf, ptls_iovec_init(ticket.base, ticket.off - 1)) ==
+       PTLS_ERROR_SESSION_NOT_FOUND);
 
-    consumed = cbuf.off;
-    ret = ptls_handshake(server, &sbuf, cbuf.base, &consumed, &server_hs_prop);
-    ok(ret == 0);
-    ok(cbuf.off == consumed);
-    cbuf.off = 0;
+    /* sessions that do not fit are not stored, but a ticket is issued */
+    ok(session_cache_call(cache, tls, 1, &ticket, ptls_iovec_init(large, sizeof(large))) == 0);
+    ok(ticket.off == PTLS_SESSION_CACHE_ID_SIZE);
+    ok(session_cache_call(cache, tls, 0, &decbuf, ptls_iovec_init(ticket.base, ticket.off)) == PTLS_ERROR_SESSION_NOT_FOUND);
 
-    consumed = sbuf.off;
-    ret = ptls_handshake(client, &cbuf, sbuf.base, &consumed, NULL);
-    ok(ret == 0);
-    ok(sbuf.off == consumed);
-    sbuf.off = 0;
+    /* expired sessions are not returned */
+    ctx_peer->ticket_lifetime = 0;
+    ok(session_cache_call(cache, tls, 1, &ticket, ptls_iovec_init(session, sizeof(session))) == 0);
+    ok(session_cache_call(cache, tls, 0, &decbuf, ptls_iovec_init(ticket.base, ticket.off)) == PTLS_ERROR_SESSION_NOT_FOUND);
 
-    ret = ptls_send(client, &cbuf, "hello world", 11);
-    ok(ret == 0);
+    ctx_peer->ticket_lifetime = ticket_lifetime_orig;
+    ptls_buffer_dispose(&ticket);
+    ptls_buffer_dispose(&decbuf);
+    ptls_free(tls);
+}
 
-    consumed = cbuf.off;
-    ret = ptls_receive(server, &decbuf, cbuf.base, &consumed);
-    ok(ret == 0);
-    ok(cbuf.off == consumed);
-    cbuf.off = 0;
+/**
+ * A child process keeps on overwriting the only bucket with sessions that consist of one byte repeated, while the parent looks up
+ * the sessions it has stored. Every hit must return a session that has not been torn.
+ */
+static void test_session_cache_concurrent(void)
+{
+    FILE *fp = tmpfile();
+    ptls_session_cache_t cache;
+    ptls_t *tls = ptls_new(ctx_peer, 1);
+    ptls_buffer_t ticket, decbuf;
+    uint8_t session[64];
+    uint32_t ticket_lifetime_orig = ctx_peer->ticket_lifetime;
+    size_t i, num_lookups = 0, num_hits = 0, num_torn = 0;
+    pid_t pid;
+
+    ok(fp != NULL);
+    ok(ptls_session_cache_init(&cache, fileno(fp), 1, sizeof(session)) == 0);
+    ptls_buffer_init(&ticket, "", 0);
+    ptls_buffer_init(&decbuf, "", 0);
+    ctx_peer->ticket_lifetime = 86400;
 
-    ok(decbuf.off == 11);
-    ok(memcmp(decbuf.base, "hello world", 11) == 0);
-    decbuf.off = 0;
+    if ((pid = fork()) == 0) {
+        for (i = 0; i != 200000; ++i) {
+            memset(session, (uint8_t)i, sizeof(session));
+            session_cache_call(&cache, tls, 1, &ticket, ptls_iovec_init(session, sizeof(session) - i % 8));
+        }
+        _exit(0);
+    }
+    ok(pid > 0);
+    memset(session, 0xff, sizeof(session));
+    do {
+        session_cache_call(&cache, tls, 1, &ticket, ptls_iovec_init(session, sizeof(session)));
+        if (session_cache_call(&cache, tls, 0, &decbuf, ptls_iovec_init(ticket.base, ticket.off)) == 0) {
+            ++num_hits;
+            if (decbuf.off != sizeof(session) || memcmp(decbuf.base, session, sizeof(session)) != 0)
+                ++num_torn;
+        }
+        ++num_lookups;
+    } while (waitpid(pid, NULL, WNOHANG) == 0);
 
-    ptls_free(client);
-    ptls_free(server);
+    ok(num_torn == 0);
+    ok(num_hits != 0);
+    note("%zu hits out of %zu lookups", num_hits, num_lookups);
 
-    ptls_buffer_dispose(&cbuf);
-    ptls_buffer_dispose(&sbuf);
+    ctx_peer->ticket_lifetime = ticket_lifetime_orig;
+    ptls_buffer_dispose(&ticket);
     ptls_buffer_dispose(&decbuf);
+    ptls_free(tls);
+    ptls_session_cache_dispose(&cache);
+    fclose(fp);
 }
 
-static void test_enforce_retry_stateful(void)
+static void test_session_cache(void)
 {
-    test_enforce_retry(0);
+    FILE *fp = tmpfile();
+    ptls_session_cache_t cache;
+
+    ok(fp != NULL);
+    ok(ptls_session_cache_init(&cache, fileno(fp), 4, 64) == 0);
+    test_session_cache_basic(&cache, fileno(fp));
+    ptls_session_cache_dispose(&cache);
+    fclose(fp);
+
+    /* resumption, using sessions being stored in a cache large enough to hold them */
+    fp = tmpfile();
+    ok(ptls_session_cache_init(&cache, fileno(fp), 16, 1024) == 0);
+    resumption_encrypt_ticket = &cache.super;
+    subtest("resumption", test_resumption);
+    resumption_encrypt_ticket = NULL;
+    ptls_session_cache_dispose(&cache);
+    fclose(fp);
+
+    subtest("concurrent", test_session_cache_concurrent);
 }
 
-static void test_enforce_retry_stateless(void)
+static ptls_ticket_key_t new_ticket_key(uint8_t name, uint64_t not_before, uint64_t not_after)
 {
-    test_enforce_retry(1);
+    ptls_ticket_key_t key = {{name}, not_before, not_after};
+    ctx_peer->random_bytes(key.secret, sizeof(key.secret));
+    return key;
 }
 
-static ptls_t *stateless_hrr_prepare(ptls_buffer_t *sbuf, ptls_handshake_properties_t *server_hs_prop)
+static int ticket_key_file_call(ptls_ticket_key_file_t *tkf, ptls_t *tls, int is_encrypt, ptls_buffer_t *dst, ptls_iovec_t src)
 {
-    ptls_t *client = ptls_new(ctx, 0), *server = ptls_new(ctx_peer, 1);
-    ptls_buffer_t cbuf;
-    size_t consumed;
+    dst->off = 0;
+    return tkf->super.cb(&tkf->super, tls, is_encrypt, dst, src);
+}
+
+struct ticket_key_file_thread_t {
+    ptls_ticket_key_file_t *tkf;
+    ptls_t *tls;
+    ptls_iovec_t ticket;
     int ret;
+};
 
-    ptls_buffer_init(&cbuf, "", 0);
-    ptls_buffer_init(sbuf, "", 0);
+static void *ticket_key_file_thread(void *_arg)
+{
+    struct ticket_key_file_thread_t *arg = _arg;
+    ptls_buffer_t decbuf;
 
-    ret = ptls_handshake(client, &cbuf, NULL, NULL, NULL);
-    ok(ret == PTLS_ERROR_IN_PROGRESS);
+    ptls_buffer_init(&decbuf, "", 0);
+    arg->ret = ticket_key_file_call(arg->tkf, arg->tls, 0, &decbuf, arg->ticket);
+    ptls_buffer_dispose(&decbuf);
+    return NULL;
+}
 
-    consumed = cbuf.off;
-    ret = ptls_handshake(server, sbuf, cbuf.base, &consumed, server_hs_prop);
-    ok(ret == PTLS_ERROR_STATELESS_RETRY);
+/**
+ * runs a full handshake using the key file, checking if a ticket is issued
+ */
+static void ticket_key_file_handshake(ptls_ticket_key_file_t *tkf, int expect_ticket)
+{
+    ptls_save_ticket_t st = {on_save_ticket};
 
-    ptls_buffer_dispose(&cbuf);
-    ptls_free(server);
+    saved_ticket = ptls_iovec_init(NULL, 0);
+    ctx_peer->ticket_lifetime = 86400;
+    ctx_peer->encrypt_ticket = &tkf->super;
+    ctx->save_ticket = &st;
 
-    return client;
+    test_handshake(ptls_iovec_init(NULL, 0), TEST_HANDSHAKE_1RTT, expect_ticket, 0, 0);
+    ok((saved_ticket.base != NULL) == expect_ticket);
+
+    free(saved_ticket.base);
+    saved_ticket = ptls_iovec_init(NULL, 0);
+    ctx_peer->ticket_lifetime = 0;
+    ctx_peer->encrypt_ticket = NULL;
+    ctx->save_ticket = NULL;
 }
 
-static void test_stateless_hrr_aad_change(void)
+static void test_ticket_key_file(void)
 {
-    ptls_t *client, *server;
-    ptls_handshake_properties_t server_hs_prop = {{{{NULL}}}};
-    ptls_buffer_t cbuf, sbuf;
-    size_t consumed;
-    int ret;
+    static const char session[] = "hello world";
+    FILE *fp = tmpfile();
+    ptls_ticket_key_file_t tkf, worker;
+    ptls_t *tls = ptls_new(ctx_peer, 1);
+    ptls_buffer_t ticket, decbuf;
+    uint64_t now = ctx_peer->get_time->cb(ctx_peer->get_time);
+    ptls_ticket_key_t keys[2];
+
+    ok(fp != NULL);
+    ok(ptls_ticket_key_file_init(&tkf, fileno(fp), ctx_peer->cipher_suites[0]) == 0);
+    ptls_buffer_init(&ticket, "", 0);
+    ptls_buffer_init(&decbuf, "", 0);
 
-    server_hs_prop.server.cookie.key = "0123456789abcdef0123456789abcdef0123456789abcdef";
-    server_hs_prop.server.cookie.additional_data = ptls_iovec_init("1.2.3.4:1234", 12);
-    server_hs_prop.server.enforce_retry = 1;
-    server_hs_prop.server.retry_uses_cookie = 1;
+    /* tickets cannot be issued until the rotator adds a key, but handshakes succeed */
+    ok(ticket_key_file_call(&tkf, tls, 1, &ticket, ptls_iovec_init(session, sizeof(session))) == PTLS_ERROR_SKIP_TICKET);
+    ticket_key_file_handshake(&tkf, 0);
+
+    keys[0] = new_ticket_key('a', now - 1000, now + 3600000);
+    ok(ptls_ticket_key_file_update(fileno(fp), keys, 1) == 0);
+    ok(ticket_key_file_call(&tkf, tls, 1, &ticket, ptls_iovec_init(session, sizeof(session))) == 0);
+    ok(ticket.base[0] == 'a');
+    ok(ticket_key_file_call(&tkf, tls, 0, &decbuf, ptls_iovec_init(ticket.base, ticket.off)) == 0);
+    ok(decbuf.off == sizeof(session) && memcmp(decbuf.base, session, sizeof(session)) == 0);
+    ticket.base[ticket.off - 1] ^= 1;
+    ok(ticket_key_file_call(&tkf, tls, 0, &decbuf, ptls_iovec_init(ticket.base, ticket.off)) == PTLS_ALERT_DECRYPT_ERROR);
+    ticket.base[ticket.off - 1] ^= 1;
+
+    /* another worker mapping the same file, as well as another thread, decrypts the ticket */
+    ok(ptls_ticket_key_file_init(&worker, fileno(fp), ctx_peer->cipher_suites[0]) == 0);
+    ok(ticket_key_file_call(&worker, tls, 0, &decbuf, ptls_iovec_init(ticket.base, ticket.off)) == 0);
+    ok(decbuf.off == sizeof(session) && memcmp(decbuf.base, session, sizeof(session)) == 0);
+    ptls_ticket_key_file_dispose(&worker);
+    {
+        struct ticket_key_file_thread_t arg = {&tkf, tls, ptls_iovec_init(ticket.base, ticket.off), -1};
+        pthread_t tid;
+        ok(pthread_create(&tid, NULL, ticket_key_file_thread, &arg) == 0);
+        pthread_join(tid, NULL);
+        ok(arg.ret == 0);
+    }
 
-    client = stateless_hrr_prepare(&sbuf, &server_hs_prop);
-    ptls_buffer_init(&cbuf, "", 0);
+    /* rotate; new tickets use the new key while the ones issued using the old key are still accepted */
+    keys[1] = new_ticket_key('b', now - 500, now + 7200000);
+    ok(ptls_ticket_key_file_update(fileno(fp), keys, 2) == 0);
+    ok(ticket_key_file_call(&tkf, tls, 0, &decbuf, ptls_iovec_init(ticket.base, ticket.off)) == 0);
+    ok(ticket_key_file_call(&tkf, tls, 1, &decbuf, ptls_iovec_init(session, sizeof(session))) == 0);
+    ok(decbuf.base[0] == 'b');
+
+    /* keys being pre-distributed are not used for encryption */
+    keys[1].not_before = now + 1000000;
+    ok(ptls_ticket_key_file_update(fileno(fp), keys, 2) == 0);
+    ok(ticket_key_file_call(&tkf, tls, 1, &decbuf, ptls_iovec_init(session, sizeof(session))) == 0);
+    ok(decbuf.base[0] == 'a');
+
+    /* tickets are rejected once the key expires */
+    keys[0].not_after = now - 1;
+    keys[1].not_before = now - 500;
+    ok(ptls_ticket_key_file_update(fileno(fp), keys, 2) == 0);
+    ok(ticket_key_file_call(&tkf, tls, 0, &decbuf, ptls_iovec_init(ticket.base, ticket.off)) == PTLS_ERROR_SESSION_NOT_FOUND);
+    ticket_key_file_handshake(&tkf, 1);
+
+    /* the same goes when the rotator stalls and all the keys expire */
+    keys[1].not_after = now - 1;
+    ok(ptls_ticket_key_file_update(fileno(fp), keys, 2) == 0);
+    ok(ticket_key_file_call(&tkf, tls, 1, &decbuf, ptls_iovec_init(session, sizeof(session))) == PTLS_ERROR_SKIP_TICKET);
+    ticket_key_file_handshake(&tkf, 0);
+    keys[1].not_after = now + 7200000;
+    ok(ptls_ticket_key_file_update(fileno(fp), keys, 2) == 0);
+
+    /* resumption */
+    resumption_encrypt_ticket = &tkf.super;
+    subtest("resumption", test_resumption);
+    resumption_encrypt_ticket = NULL;
 
-    consumed = sbuf.off;
-    ret = ptls_handshake(client, &cbuf, sbuf.base, &consumed, NULL);
-    ok(ret == PTLS_ERROR_IN_PROGRESS);
-    ok(sbuf.off == consumed);
-    sbuf.off = 0;
+    ptls_buffer_dispose(&ticket);
+    ptls_buffer_dispose(&decbuf);
+    ptls_free(tls);
+    ptls_ticket_key_file_dispose(&tkf);
+    fclose(fp);
+}
 
-    server = ptls_new(ctx_peer, 1);
-    server_hs_prop.server.cookie.additional_data = ptls_iovec_init("1.2.3.4:4321", 12);
+static size_t context_handle_num_disposed;
 
-    consumed = cbuf.off;
-    ret = ptls_handshake(server, &sbuf, cbuf.base, &consumed, &server_hs_prop);
-    ok(ret == PTLS_ALERT_HANDSHAKE_FAILURE);
+static ptls_context_t *new_handle_context(uint32_t generation)
+{
+    ptls_context_t *c = malloc(sizeof(*c));
+    assert(c != NULL);
+    *c = *ctx_peer;
+    c->ticket_lifetime = generation; /* used as a marker, cleared upon dispose */
+    return c;
+}
 
-    ptls_free(client);
-    ptls_free(server);
+static void on_context_handle_dispose(ptls_context_handle_t *self, ptls_context_t *c)
+{
+    ++context_handle_num_disposed;
+    c->ticket_lifetime = 0;
+    free(c);
+}
 
-    ptls_buffer_dispose(&cbuf);
-    ptls_buffer_dispose(&sbuf);
+static void on_context_handle_update_open_count(ptls_update_open_count_t *self, ssize_t delta)
+{
+    *(ssize_t *)(self + 1) += delta;
 }
 
-typedef uint8_t traffic_secrets_t[2 /* is_enc */][4 /* epoch */][PTLS_MAX_DIGEST_SIZE /* octets */];
+static void test_context_handle_basic(void)
+{
+    struct {
+        ptls_update_open_count_t super;
+        ssize_t count;
+    } open_count = {{on_context_handle_update_open_count}};
+    ptls_context_handle_t handle;
+    ptls_context_t *c1 = new_handle_context(1), *c2 = new_handle_context(2), *c;
+    ptls_t *tls1, *tls2;
+
+    context_handle_num_disposed = 0;
+    c2->update_open_count = &open_count.super;
+    ok(ptls_context_handle_init(&handle, 4, c1, on_context_handle_dispose) == 0);
+
+    /* connections keep using the context they have been created with */
+    ok((c = ptls_context_handle_enter(&handle)) == c1);
+    tls1 = ptls_new(c, 1);
+    ptls_context_handle_leave(&handle);
+    ok(ptls_context_handle_swap(&handle, c2) == 0);
+    ok(ptls_context_handle_reclaim(&handle) == 1);
+    ok((c = ptls_context_handle_enter(&handle)) == c2);
+    tls2 = ptls_new(c, 1);
+    ptls_context_handle_leave(&handle);
+    ok(ptls_get_context(tls1) == c1);
+    ok(ptls_get_context(tls2) == c2);
+
+    /* the original callback is still invoked */
+    ok(open_count.count == 1);
+
+    /* replaced context is released once the connection using it is freed */
+    ok(context_handle_num_disposed == 0);
+    ptls_free(tls1);
+    ok(ptls_context_handle_reclaim(&handle) == 0);
+    ok(context_handle_num_disposed == 1);
+
+    ptls_free(tls2);
+    ok(open_count.count == 0);
+    ptls_context_handle_dispose(&handle);
+    ok(context_handle_num_disposed == 2);
+}
 
-static int on_update_traffic_key(ptls_update_traffic_key_t *self, ptls_t *tls, int is_enc, size_t epoch, const void *secret)
+#define CONTEXT_HANDLE_STRESS_NUM_THREADS 4
+#define CONTEXT_HANDLE_STRESS_NUM_SWAPS 10000
+
+struct st_context_handle_stress_t {
+    ptls_context_handle_t *handle;
+    int stop;
+    size_t num_errors;
+};
+
+static void *context_handle_stress_worker(void *_arg)
 {
-    traffic_secrets_t *secrets = *ptls_get_data_ptr(tls);
-    ok(memcmp((*secrets)[is_enc][epoch], zeroes_of_max_digest_size, PTLS_MAX_DIGEST_SIZE) == 0);
+    struct st_context_handle_stress_t *arg = _arg;
+    ptls_t *conns[16] = {NULL};
+    size_t num_created = 0, i;
+
+    /* keep connections open across the swaps, freeing the oldest when creating a new one */
+    while (!__atomic_load_n(&arg->stop, __ATOMIC_RELAXED)) {
+        ptls_t **slot = conns + num_created++ % PTLS_ELEMENTSOF(conns);
+        if (*slot != NULL) {
+            if (ptls_get_context(*slot)->ticket_lifetime == 0)
+                __atomic_fetch_add(&arg->num_errors, 1, __ATOMIC_RELAXED);
+            ptls_free(*slot);
+        }
+        ptls_context_t *c = ptls_context_handle_enter(arg->handle);
+        if (c == NULL || c->ticket_lifetime == 0)
+            __atomic_fetch_add(&arg->num_errors, 1, __ATOMIC_RELAXED);
+        *slot = ptls_new(c, 1);
+        ptls_context_handle_leave(arg->handle);
+    }
 
-    size_t size = ptls_get_cipher(tls)->hash->digest_size;
-    memcpy((*secrets)[is_enc][epoch], secret, size);
-    return 0;
+    for (i = 0; i != PTLS_ELEMENTSOF(conns); ++i)
+        if (conns[i] != NULL)
+            ptls_free(conns[i]);
+    return NULL;
 }
 
-static int feed_messages(ptls_t *tls, ptls_buffer_t *outbuf, size_t *out_epoch_offsets, const uint8_t *input,
-                         const size_t *in_epoch_offsets, ptls_handshake_properties_t *props)
+static void test_context_handle_stress(void)
 {
+    ptls_context_handle_t handle;
+    struct st_context_handle_stress_t arg = {&handle};
+    pthread_t tids[CONTEXT_HANDLE_STRESS_NUM_THREADS];
     size_t i;
-    int ret = PTLS_ERROR_IN_PROGRESS;
 
-    outbuf->off = 0;
-    memset(out_epoch_offsets, 0, sizeof(*out_epoch_offsets) * 5);
+    context_handle_num_disposed = 0;
+    ok(ptls_context_handle_init(&handle, CONTEXT_HANDLE_STRESS_NUM_THREADS, new_handle_context(1), on_context_handle_dispose) ==
+       0);
+    for (i = 0; i != PTLS_ELEMENTSOF(tids); ++i)
+        pthread_create(tids + i, NULL, context_handle_stress_worker, &arg);
 
-    for (i = 0; i != 4; ++i) {
-        size_t len = in_epoch_offsets[i + 1] - in_epoch_offsets[i];
-        if (len != 0) {
-            ret = ptls_handle_message(tls, outbuf, out_epoch_offsets, i, input + in_epoch_offsets[i], len, props);
-            if (!(ret == 0 || ret == PTLS_ERROR_IN_PROGRESS))
-                break;
-        }
+    for (i = 0; i != CONTEXT_HANDLE_STRESS_NUM_SWAPS; ++i) {
+        if (ptls_context_handle_swap(&handle, new_handle_context((uint32_t)i + 2)) != 0)
+            break;
     }
+    ok(i == CONTEXT_HANDLE_STRESS_NUM_SWAPS);
+
+    __atomic_store_n(&arg.stop, 1, __ATOMIC_RELAXED);
+    for (i = 0; i != PTLS_ELEMENTSOF(tids); ++i)
+        pthread_join(tids[i], NULL);
+    ok(arg.num_errors == 0);
+
+    /* all the contexts being replaced are released once the connections are closed */
+    ok(ptls_context_handle_reclaim(&handle) == 0);
+    ok(context_handle_num_disposed == CONTEXT_HANDLE_STRESS_NUM_SWAPS);
+    ptls_context_handle_dispose(&handle);
+    ok(context_handle_num_disposed == CONTEXT_HANDLE_STRESS_NUM_SWAPS + 1);
+}
 
-    return ret;
+static void *context_handle_excess_thread(void *handle)
+{
+    ptls_context_t *c = ptls_context_handle_enter(handle);
+    /* leaving after a failed enter is a no-op */
+    ptls_context_handle_leave(handle);
+    return c;
 }
 
-static void test_handshake_api(void)
+static void test_context_handle_excess_thread(void)
 {
-    ptls_t *client, *server;
-    traffic_secrets_t client_secrets = {{{0}}}, server_secrets = {{{0}}};
-    ptls_buffer_t cbuf, sbuf;
-    size_t coffs[5] = {0}, soffs[5];
-    ptls_update_traffic_key_t update_traffic_key = {on_update_traffic_key};
-    ptls_encrypt_ticket_t encrypt_ticket = {on_copy_ticket};
-    ptls_save_ticket_t save_ticket = {on_save_ticket};
-    int ret;
+    ptls_context_handle_t handle;
+    pthread_t tid;
+    void *c;
 
-    ctx->update_traffic_key = &update_traffic_key;
-    ctx->omit_end_of_early_data = 1;
-    ctx->save_ticket = &save_ticket;
-    ctx_peer->update_traffic_key = &update_traffic_key;
-    ctx_peer->omit_end_of_early_data = 1;
-    ctx_peer->encrypt_ticket = &encrypt_ticket;
-    ctx_peer->ticket_lifetime = 86400;
-    ctx_peer->max_early_data_size = 8192;
+    ok(ptls_context_handle_init(&handle, 1, new_handle_context(1), on_context_handle_dispose) == 0);
+    ok(ptls_context_handle_enter(&handle) != NULL);
+    ptls_context_handle_leave(&handle);
 
-    saved_ticket = ptls_iovec_init(NULL, 0);
+    /* the only slot is owned by this thread, hence the other thread fails to enter */
+    pthread_create(&tid, NULL, context_handle_excess_thread, &handle);
+    pthread_join(tid, &c);
+    ok(c == NULL);
 
-    ptls_buffer_init(&cbuf, "", 0);
-    ptls_buffer_init(&sbuf, "", 0);
+    ptls_context_handle_dispose(&handle);
+}
 
-    client = ptls_new(ctx, 0);
-    *ptls_get_data_ptr(client) = &client_secrets;
-    server = ptls_new(ctx_peer, 1);
-    *ptls_get_data_ptr(server) = &server_secrets;
+static void test_context_handle(void)
+{
+    subtest("basic", test_context_handle_basic);
+    subtest("stress", test_context_handle_stress);
+    subtest("excess-thread", test_context_handle_excess_thread);
+}
 
-    /* full handshake */
-    ret = ptls_handle_message(client, &cbuf, coffs, 0, NULL, 0, NULL);
-    ok(ret == PTLS_ERROR_IN_PROGRESS);
-    ret = feed_messages(server, &sbuf, soffs, cbuf.base, coffs, NULL);
-    ok(ret == 0);
-    ok(sbuf.off != 0);
-    ok(!ptls_handshake_is_complete(server));
-    ok(memcmp(server_secrets[1][2], zeroes_of_max_digest_size, PTLS_MAX_DIGEST_SIZE) != 0);
-    ok(memcmp(server_secrets[1][3], zeroes_of_max_digest_size, PTLS_MAX_DIGEST_SIZE) != 0);
-    ok(memcmp(server_secrets[0][2], zeroes_of_max_digest_size, PTLS_MAX_DIGEST_SIZE) != 0);
-    ok(memcmp(server_secrets[0][3], zeroes_of_max_digest_size, PTLS_MAX_DIGEST_SIZE) == 0);
-    ret = feed_messages(client, &cbuf, coffs, sbuf.base, soffs, NULL);
-    ok(ret == 0);
-    ok(cbuf.off != 0);
-    ok(ptls_handshake_is_complete(client));
-    ok(memcmp(client_secrets[0][2], server_secrets[1][2], PTLS_MAX_DIGEST_SIZE) == 0);
-    ok(memcmp(client_secrets[1][2], server_secrets[0][2], PTLS_MAX_DIGEST_SIZE) == 0);
-    ok(memcmp(client_secrets[0][3], server_secrets[1][3], PTLS_MAX_DIGEST_SIZE) == 0);
+/**
+ * Ticket encryptor that forwards the requests to a mock key service through a socket and returns PTLS_ERROR_ASYNC_OPERATION. The
+ * messages exchanged are a 1-byte opcode (or status), followed by 2-byte length and the payload.
+ */
+struct st_async_ticket_service_t {
+    ptls_encrypt_ticket_t super;
+    int fd;
+    ptls_t *pending;
+    size_t num_requests;
+};
+
+static int async_ticket_write_message(int fd, uint8_t type, const uint8_t *src, size_t len)
+{
+    uint8_t hdr[3] = {type, (uint8_t)(len >> 8), (uint8_t)len};
+
+    if (write(fd, hdr, sizeof(hdr)) != sizeof(hdr) || write(fd, src, len) != len)
+        return -1;
+    return 0;
+}
+
+static int async_ticket_read_message(int fd, uint8_t *type, uint8_t *dst, size_t *len)
+{
+    uint8_t hdr[3];
+
+    if (read(fd, hdr, sizeof(hdr)) != sizeof(hdr))
+        return -1;
+    *type = hdr[0];
+    *len = (size_t)hdr[1] << 8 | hdr[2];
+    if (read(fd, dst, *len) != *len)
+        return -1;
+    return 0;
+}
+
+static int on_async_ticket(ptls_encrypt_ticket_t *_self, ptls_t *tls, int is_encrypt, ptls_buffer_t *dst, ptls_iovec_t src)
+{
+    struct st_async_ticket_service_t *self = (void *)_self;
+
+    if (self->pending != NULL || async_ticket_write_message(self->fd, is_encrypt, src.base, src.len) != 0)
+        return PTLS_ERROR_LIBRARY;
+    self->pending = tls;
+    ++self->num_requests;
+    return PTLS_ERROR_ASYNC_OPERATION;
+}
+
+/**
+ * handles one request on the key service side; tickets are the plaintext prefixed by a tag and XOR-ed
+ */
+static void serve_async_ticket_request(int fd)
+{
+    static const uint8_t tag[] = {'t', 'k', 't', '1'};
+    uint8_t buf[1024], is_encrypt, status = 0;
+    size_t len, i;
+
+    if (async_ticket_read_message(fd, &is_encrypt, buf, &len) != 0) {
+        ok(!"failed to read request");
+        return;
+    }
+    if (is_encrypt) {
+        memmove(buf + sizeof(tag), buf, len);
+        memcpy(buf, tag, sizeof(tag));
+        for (i = sizeof(tag); i < len + sizeof(tag); ++i)
+            buf[i] ^= 0x5a;
+        len += sizeof(tag);
+    } else if (len >= sizeof(tag) && memcmp(buf, tag, sizeof(tag)) == 0) {
+        for (i = sizeof(tag); i < len; ++i)
+            buf[i - sizeof(tag)] = buf[i] ^ 0x5a;
+        len -= sizeof(tag);
+    } else {
+        status = 1;
+        len = 0;
+    }
+    async_ticket_write_message(fd, status, buf, len);
+}
+
+/**
+ * reads the response and supplies the result to the connection that has issued the request
+ */
+static int complete_async_ticket_request(struct st_async_ticket_service_t *self)
+{
+    uint8_t buf[1024], status;
+    size_t len;
+    ptls_t *tls = self->pending;
+
+    self->pending = NULL;
+    if (async_ticket_read_message(self->fd, &status, buf, &len) != 0)
+        return -1;
+    return ptls_set_ticket_result(tls, status == 0 ? 0 : PTLS_ERROR_LIBRARY, ptls_iovec_init(buf, len));
+}
+
+static void run_parallel_serially(ptls_run_parallel_t *self, void (*job)(void *job_data, size_t index), void *job_data,
+                                  size_t num_jobs);
+
+static void test_async_ticket(void)
+{
+    struct st_async_ticket_service_t service = {{on_async_ticket}};
+    ptls_save_ticket_t st = {on_save_ticket};
+    ptls_t *client, *server;
+    ptls_buffer_t cbuf, sbuf, decbuf;
+    size_t consumed, ch_len, max_early_data_size = 0;
+    ptls_handshake_properties_t client_hs_prop = {{{{NULL}}}};
+    int fds[2], ret;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        ok(!"socketpair failed");
+        return;
+    }
+    service.fd = fds[0];
+    saved_ticket = ptls_iovec_init(NULL, 0);
+
+    ctx_peer->ticket_lifetime = 86400;
+    ctx_peer->max_early_data_size = 8192;
+    ctx_peer->encrypt_ticket = &service.super;
+    ctx->save_ticket = &st;
+
+    ptls_buffer_init(&cbuf, "", 0);
+    ptls_buffer_init(&sbuf, "", 0);
+    ptls_buffer_init(&decbuf, "", 0);
+
+    /* full handshake; the server flight is sent without NewSessionTicket, as the ticket is being encrypted */
+    client = ptls_new(ctx, 0);
+    server = ptls_new(ctx_peer, 1);
+    ret = ptls_handshake(client, &cbuf, NULL, NULL, NULL);
+    ok(ret == PTLS_ERROR_IN_PROGRESS);
+    consumed = cbuf.off;
+    ret = ptls_handshake(server, &sbuf, cbuf.base, &consumed, NULL);
+    ok(ret == 0);
+    ok(consumed == cbuf.off);
+    ok(service.num_requests == 1);
+    cbuf.off = 0;
+    consumed = sbuf.off;
+    ret = ptls_handshake(client, &cbuf, sbuf.base, &consumed, NULL);
+    ok(ret == 0);
+    ok(consumed == sbuf.off);
+    sbuf.off = 0;
+    consumed = cbuf.off;
+    ret = ptls_receive(server, &decbuf, cbuf.base, &consumed);
+    ok(ret == 0);
+    ok(consumed == cbuf.off);
+    cbuf.off = 0;
+    ok(saved_ticket.base == NULL);
+
+    /* nothing is sent until the result is supplied */
+    ok(ptls_send(server, &sbuf, NULL, 0) == 0);
+    ok(sbuf.off == 0);
+    serve_async_ticket_request(fds[1]);
+    ok(complete_async_ticket_request(&service) == 0);
+    ok(ptls_set_ticket_result(server, 0, ptls_iovec_init(NULL, 0)) == PTLS_ERROR_NOT_AVAILABLE);
+
+    /* the ticket is sent along with application data */
+    ok(ptls_send(server, &sbuf, "hello", 5) == 0);
+    consumed = sbuf.off;
+    ret = ptls_receive(client, &decbuf, sbuf.base, &consumed);
+    ok(ret == 0);
+    ok(consumed == sbuf.off);
+    ok(decbuf.off == 5 && memcmp(decbuf.base, "hello", 5) == 0);
+    ok(saved_ticket.base != NULL);
+    sbuf.off = 0;
+    decbuf.off = 0;
+    ptls_free(client);
+    ptls_free(server);
+
+    /* resume with 0-RTT; the server stops at ClientHello until the ticket is decrypted */
+    client_hs_prop.client.session_ticket = saved_ticket;
+    client_hs_prop.client.max_early_data_size = &max_early_data_size;
+    client = ptls_new(ctx, 0);
+    server = ptls_new(ctx_peer, 1);
+    ret = ptls_handshake(client, &cbuf, NULL, NULL, &client_hs_prop);
+    ok(ret == PTLS_ERROR_IN_PROGRESS);
+    ok(max_early_data_size == ctx_peer->max_early_data_size);
+    ch_len = cbuf.off;
+    ok(ptls_send(client, &cbuf, "early", 5) == 0);
+    consumed = cbuf.off;
+    ret = ptls_handshake(server, &sbuf, cbuf.base, &consumed, NULL);
+    ok(ret == PTLS_ERROR_ASYNC_OPERATION);
+    ok(consumed == ch_len);
+    ok(sbuf.off == 0);
+    ok(service.num_requests == 2);
+    consumed = cbuf.off - ch_len;
+    ret = ptls_handshake(server, &sbuf, cbuf.base + ch_len, &consumed, NULL);
+    ok(ret == PTLS_ERROR_ASYNC_OPERATION);
+    ok(consumed == 0);
+    ok(sbuf.off == 0);
+
+    serve_async_ticket_request(fds[1]);
+    ok(complete_async_ticket_request(&service) == 0);
+    consumed = cbuf.off - ch_len;
+    ret = ptls_handshake(server, &sbuf, cbuf.base + ch_len, &consumed, NULL);
+    ok(ret == 0);
+    ok(consumed == 0);
+    ok(sbuf.off != 0);
+    ok(ptls_is_psk_handshake(server));
+    ok(service.num_requests == 3); /* a new ticket is being encrypted */
+    consumed = cbuf.off - ch_len;
+    ret = ptls_receive(server, &decbuf, cbuf.base + ch_len, &consumed);
+    ok(ret == 0);
+    ok(consumed == cbuf.off - ch_len);
+    ok(decbuf.off == 5 && memcmp(decbuf.base, "early", 5) == 0);
+    cbuf.off = 0;
+    decbuf.off = 0;
+
+    consumed = sbuf.off;
+    ret = ptls_handshake(client, &cbuf, sbuf.base, &consumed, NULL);
+    ok(ret == 0);
+    ok(consumed == sbuf.off);
+    ok(ptls_is_psk_handshake(client));
+    consumed = cbuf.off;
+    ret = ptls_receive(server, &decbuf, cbuf.base, &consumed);
+    ok(ret == 0);
+    ok(consumed == cbuf.off);
+    ok(ptls_handshake_is_complete(server));
+
+    /* the connection is closed while the new ticket is being encrypted */
+    ptls_free(client);
+    ptls_free(server);
+
+    { /* the ticket is also sent by ptls_send_parallel */
+        ptls_run_parallel_t serial = {run_parallel_serially};
+        size_t len = 17 * 16384, off;
+        uint8_t *plaintext = malloc(len), status;
+        /* discard the result for the connection that has been closed */
+        serve_async_ticket_request(fds[1]);
+        ok(async_ticket_read_message(fds[0], &status, plaintext, &off) == 0);
+        service.pending = NULL;
+        memset(plaintext, 'A', len);
+        free(saved_ticket.base);
+        saved_ticket = ptls_iovec_init(NULL, 0);
+        cbuf.off = 0;
+        sbuf.off = 0;
+        decbuf.off = 0;
+        client = ptls_new(ctx, 0);
+        server = ptls_new(ctx_peer, 1);
+        ok(ptls_handshake(client, &cbuf, NULL, NULL, NULL) == PTLS_ERROR_IN_PROGRESS);
+        consumed = cbuf.off;
+        ok(ptls_handshake(server, &sbuf, cbuf.base, &consumed, NULL) == 0);
+        cbuf.off = 0;
+        consumed = sbuf.off;
+        ok(ptls_handshake(client, &cbuf, sbuf.base, &consumed, NULL) == 0);
+        sbuf.off = 0;
+        consumed = cbuf.off;
+        ok(ptls_receive(server, &decbuf, cbuf.base, &consumed) == 0);
+        cbuf.off = 0;
+        ok(service.num_requests == 4);
+        serve_async_ticket_request(fds[1]);
+        ok(complete_async_ticket_request(&service) == 0);
+        ok(ptls_send_parallel(server, &sbuf, plaintext, len, &serial) == 0);
+        for (off = 0; off < sbuf.off; off += consumed) {
+            consumed = sbuf.off - off;
+            if ((ret = ptls_receive(client, &decbuf, sbuf.base + off, &consumed)) != 0)
+                break;
+        }
+        ok(ret == 0);
+        ok(decbuf.off == len && memcmp(decbuf.base, plaintext, len) == 0);
+        ok(saved_ticket.base != NULL);
+        ptls_free(client);
+        ptls_free(server);
+        free(plaintext);
+    }
+
+    ptls_buffer_dispose(&cbuf);
+    ptls_buffer_dispose(&sbuf);
+    ptls_buffer_dispose(&decbuf);
+    free(saved_ticket.base);
+    saved_ticket = ptls_iovec_init(NULL, 0);
+    close(fds[0]);
+    close(fds[1]);
+
+    ctx_peer->ticket_lifetime = 0;
+    ctx_peer->max_early_data_size = 0;
+    ctx_peer->encrypt_ticket = NULL;
+    ctx->save_ticket = NULL;
+}
+
+#endif
+
+static void test_enforce_retry(int use_cookie)
+{
+    ptls_t *client, *server;
+    ptls_handshake_properties_t server_hs_prop = {{{{NULL}}}};
+    ptls_buffer_t cbuf, sbuf, decbuf;
+    size_t consumed;
+    int ret;
+
+    server_hs_prop.server.cookie.key = "0123456789abcdef0123456789abcdef0123456789abcdef";
+    server_hs_prop.server.cookie.additional_data = ptls_iovec_init("1.2.3.4:1234", 12);
+    server_hs_prop.server.enforce_retry = 1;
+    server_hs_prop.server.retry_uses_cookie = use_cookie;
+
+    ptls_buffer_init(&cbuf, "", 0);
+    ptls_buffer_init(&sbuf, "", 0);
+    ptls_buffer_init(&decbuf, "", 0);
+
+    client = ptls_new(ctx, 0);
+
+    ret = ptls_handshake(client, &cbuf, NULL, NULL, NULL);
+    ok(ret == PTLS_ERROR_IN_PROGRESS);
+    ok(cbuf.off != 0);
+
+    server = ptls_new(ctx, 1);
+
+    consumed = cbuf.off;
+    ret = ptls_handshake(server, &sbuf, cbuf.base, &consumed, &server_hs_prop);
+    cbuf.off = 0;
+
+    if (use_cookie) {
+        ok(ret == PTLS_ERROR_STATELESS_RETRY);
+        ptls_free(server);
+        server = ptls_new(ctx, 1);
+    } else {
+        ok(ret == PTLS_ERROR_IN_PROGRESS);
+    }
+
+    consumed = sbuf.off;
+    ret = ptls_handshake(client, &cbuf, sbuf.base, &consumed, NULL);
+    ok(ret == PTLS_ERROR_IN_PROGRESS);
+    ok(sbuf.off == consumed);
+    sbuf.off = 0;
+
+    consumed = cbuf.off;
+    ret = ptls_handshake(server, &sbuf, cbuf.base, &consumed, &server_hs_prop);
+    ok(ret == 0);
+    ok(cbuf.off == consumed);
+    cbuf.off = 0;
+
+    consumed = sbuf.off;
+    ret = ptls_handshake(client, &cbuf, sbuf.base, &consumed, NULL);
+    ok(ret == 0);
+    ok(sbuf.off == consumed);
+    sbuf.off = 0;
+
+    ret = ptls_send(client, &cbuf, "hello world", 11);
+    ok(ret == 0);
+
+    consumed = cbuf.off;
+    ret = ptls_receive(server, &decbuf, cbuf.base, &consumed);
+    ok(ret == 0);
+    ok(cbuf.off == consumed);
+    cbuf.off = 0;
+
+    ok(decbuf.off == 11);
+    ok(memcmp(decbuf.base, "hello world", 11) == 0);
+    decbuf.off = 0;
+
+    ptls_free(client);
+    ptls_free(server);
+
+    ptls_buffer_dispose(&cbuf);
+    ptls_buffer_dispose(&sbuf);
+    ptls_buffer_dispose(&decbuf);
+}
+
+static void test_enforce_retry_stateful(void)
+{
+    test_enforce_retry(0);
+}
+
+static void test_enforce_retry_stateless(void)
+{
+    test_enforce_retry(1);
+}
+
+static ptls_t *stateless_hrr_prepare(ptls_buffer_t *sbuf, ptls_handshake_properties_t *server_hs_prop)
+{
+    ptls_t *client = ptls_new(ctx, 0), *server = ptls_new(ctx_peer, 1);
+    ptls_buffer_t cbuf;
+    size_t consumed;
+    int ret;
+
+    ptls_buffer_init(&cbuf, "", 0);
+    ptls_buffer_init(sbuf, "", 0);
+
+    ret = ptls_handshake(client, &cbuf, NULL, NULL, NULL);
+    ok(ret == PTLS_ERROR_IN_PROGRESS);
+
+    consumed = cbuf.off;
+    ret = ptls_handshake(server, sbuf, cbuf.base, &consumed, server_hs_prop);
+    ok(ret == PTLS_ERROR_STATELESS_RETRY);
+
+    ptls_buffer_dispose(&cbuf);
+    ptls_free(server);
+
+    return client;
+}
+
+static void test_stateless_hrr_aad_change(void)
+{
+    ptls_t *client, *server;
+    ptls_handshake_properties_t server_hs_prop = {{{{NULL}}}};
+    ptls_buffer_t cbuf, sbuf;
+    size_t consumed;
+    int ret;
+
+    server_hs_prop.server.cookie.key = "0123456789abcdef0123456789abcdef0123456789abcdef";
+    server_hs_prop.server.cookie.additional_data = ptls_iovec_init("1.2.3.4:1234", 12);
+    server_hs_prop.server.enforce_retry = 1;
+    server_hs_prop.server.retry_uses_cookie = 1;
+
+    client = stateless_hrr_prepare(&sbuf, &server_hs_prop);
+    ptls_buffer_init(&cbuf, "", 0);
+
+    consumed = sbuf.off;
+    ret = ptls_handshake(client, &cbuf, sbuf.base, &consumed, NULL);
+    ok(ret == PTLS_ERROR_IN_PROGRESS);
+    ok(sbuf.off == consumed);
+    sbuf.off = 0;
+
+    server = ptls_new(ctx_peer, 1);
+    server_hs_prop.server.cookie.additional_data = ptls_iovec_init("1.2.3.4:4321", 12);
+
+    consumed = cbuf.off;
+    ret = ptls_handshake(server, &sbuf, cbuf.base, &consumed, &server_hs_prop);
+    ok(ret == PTLS_ALERT_HANDSHAKE_FAILURE);
+
+    ptls_free(client);
+    ptls_free(server);
+
+    ptls_buffer_dispose(&cbuf);
+    ptls_buffer_dispose(&sbuf);
+}
+
+typedef uint8_t traffic_secrets_t[2 /* is_enc */][4 /* epoch */][PTLS_MAX_DIGEST_SIZE /* octets */];
+
+static int on_update_traffic_key(ptls_update_traffic_key_t *self, ptls_t *tls, int is_enc, size_t epoch, const void *secret)
+{
+    traffic_secrets_t *secrets = *ptls_get_data_ptr(tls);
+    ok(memcmp((*secrets)[is_enc][epoch], zeroes_of_max_digest_size, PTLS_MAX_DIGEST_SIZE) == 0);
+
+    size_t size = ptls_get_cipher(tls)->hash->digest_size;
+    memcpy((*secrets)[is_enc][epoch], secret, size);
+    return 0;
+}
+
+static int feed_messages(ptls_t *tls, ptls_buffer_t *outbuf, size_t *out_epoch_offsets, const uint8_t *input,
+                         const size_t *in_epoch_offsets, ptls_handshake_properties_t *props)
+{
+    size_t i;
+    int ret = PTLS_ERROR_IN_PROGRESS;
+
+    outbuf->off = 0;
+    memset(out_epoch_offsets, 0, sizeof(*out_epoch_offsets) * 5);
+
+    for (i = 0; i != 4; ++i) {
+        size_t len = in_epoch_offsets[i + 1] - in_epoch_offsets[i];
+        if (len != 0) {
+            ret = ptls_handle_message(tls, outbuf, out_epoch_offsets, i, input + in_epoch_offsets[i], len, props);
+            if (!(ret == 0 || ret == PTLS_ERROR_IN_PROGRESS))
+                break;
+        }
+    }
+
+    return ret;
+}
+
+static void test_handshake_api(void)
+{
+    ptls_t *client, *server;
+    traffic_secrets_t client_secrets = {{{0}}}, server_secrets = {{{0}}};
+    ptls_buffer_t cbuf, sbuf;
+    size_t coffs[5] = {0}, soffs[5];
+    ptls_update_traffic_key_t update_traffic_key = {on_update_traffic_key};
+    ptls_encrypt_ticket_t encrypt_ticket = {on_copy_ticket};
+    ptls_save_ticket_t save_ticket = {on_save_ticket};
+    int ret;
+
+    ctx->update_traffic_key = &update_traffic_key;
+    ctx->omit_end_of_early_data = 1;
+    ctx->save_ticket = &save_ticket;
+    ctx_peer->update_traffic_key = &update_traffic_key;
+    ctx_peer->omit_end_of_early_data = 1;
+    ctx_peer->encrypt_ticket = &encrypt_ticket;
+    ctx_peer->ticket_lifetime = 86400;
+    ctx_peer->max_early_data_size = 8192;
+
+    saved_ticket = ptls_iovec_init(NULL, 0);
+
+    ptls_buffer_init(&cbuf, "", 0);
+    ptls_buffer_init(&sbuf, "", 0);
+
+    client = ptls_new(ctx, 0);
+    *ptls_get_data_ptr(client) = &client_secrets;
+    server = ptls_new(ctx_peer, 1);
+    *ptls_get_data_ptr(server) = &server_secrets;
+
+    /* full handshake */
+    ret = ptls_handle_message(client, &cbuf, coffs, 0, NULL, 0, NULL);
+    ok(ret == PTLS_ERROR_IN_PROGRESS);
+    ret = feed_messages(server, &sbuf, soffs, cbuf.base, coffs, NULL);
+    ok(ret == 0);
+    ok(sbuf.off != 0);
+    ok(!ptls_handshake_is_complete(server));
+    ok(memcmp(server_secrets[1][2], zeroes_of_max_digest_size, PTLS_MAX_DIGEST_SIZE) != 0);
+    ok(memcmp(server_secrets[1][3], zeroes_of_max_digest_size, PTLS_MAX_DIGEST_SIZE) != 0);
+    ok(memcmp(server_secrets[0][2], zeroes_of_max_digest_size, PTLS_MAX_DIGEST_SIZE) != 0);
+    ok(memcmp(server_secrets[0][3], zeroes_of_max_digest_size, PTLS_MAX_DIGEST_SIZE) == 0);
+    ret = feed_messages(client, &cbuf, coffs, sbuf.base, soffs, NULL);
+    ok(ret == 0);
+    ok(cbuf.off != 0);
+    ok(ptls_handshake_is_complete(client));
+    ok(memcmp(client_secrets[0][2], server_secrets[1][2], PTLS_MAX_DIGEST_SIZE) == 0);
+    ok(memcmp(client_secrets[1][2], server_secrets[0][2], PTLS_MAX_DIGEST_SIZE) == 0);
+    ok(memcmp(client_secrets[0][3], server_secrets[1][3], PTLS_MAX_DIGEST_SIZE) == 0);
     ok(memcmp(client_secrets[1][3], zeroes_of_max_digest_size, PTLS_MAX_DIGEST_SIZE) != 0);
     ret = feed_messages(server, &sbuf, soffs, cbuf.base, coffs, NULL);
     ok(ret == 0);
@@ -1355,73 +2218,541 @@ static void test_handshake_api(void)
     ptls_free(client);
     ptls_free(server);
 
-    cbuf.off = 0;
-    sbuf.off = 0;
+    cbuf.off = 0;
+    sbuf.off = 0;
+
+    /* shamelessly reuse this subtest for testing ordinary TLS 0-RTT with HRR rejection */
+    ctx->update_traffic_key = NULL;
+    ctx->omit_end_of_early_data = 0;
+    ctx_peer->update_traffic_key = NULL;
+    ctx_peer->omit_end_of_early_data = 0;
+    client_hs_prop = (ptls_handshake_properties_t){{{{NULL}, saved_ticket, &max_early_data_size}}};
+    server_hs_prop = (ptls_handshake_properties_t){{{{NULL}}}};
+    server_hs_prop.server.enforce_retry = 1;
+    client = ptls_new(ctx, 0);
+    server = ptls_new(ctx_peer, 1);
+    ret = ptls_handshake(client, &cbuf, NULL, NULL, &client_hs_prop); /* -> CH */
+    ok(ret == PTLS_ERROR_IN_PROGRESS);
+    ok(client_hs_prop.client.max_early_data_size != 0);
+    ok(client_hs_prop.client.early_data_acceptance == PTLS_EARLY_DATA_ACCEPTANCE_UNKNOWN);
+    ok(cbuf.off != 0);
+    ret = ptls_send(client, &cbuf, "hello world", 11); /* send 0-RTT data that'll be rejected */
+    ok(ret == 0);
+    size_t inlen = cbuf.off;
+    ret = ptls_handshake(server, &sbuf, cbuf.base, &inlen, &server_hs_prop); /* CH -> HRR */
+    ok(ret == PTLS_ERROR_IN_PROGRESS);
+    ok(cbuf.off == inlen);
+    cbuf.off = 0;
+    ok(sbuf.off != 0);
+    inlen = sbuf.off;
+    ret = ptls_handshake(client, &cbuf, sbuf.base, &inlen, &client_hs_prop); /* HRR -> CH */
+    ok(ret == PTLS_ERROR_IN_PROGRESS);
+    ok(client_hs_prop.client.early_data_acceptance == PTLS_EARLY_DATA_REJECTED);
+    ok(sbuf.off == inlen);
+    sbuf.off = 0;
+    ok(cbuf.off != 0);
+    inlen = cbuf.off;
+    ret = ptls_handshake(server, &sbuf, cbuf.base, &inlen, &server_hs_prop); /* CH -> SH..SF,NST */
+    ok(ret == 0);
+    ok(!ptls_handshake_is_complete(server));
+    ok(cbuf.off == inlen);
+    cbuf.off = 0;
+    ok(sbuf.off != 0);
+    inlen = sbuf.off;
+    ret = ptls_handshake(client, &cbuf, sbuf.base, &inlen, &client_hs_prop); /* SH..SF -> CF */
+    ok(ret == 0);
+    ok(ptls_handshake_is_complete(client));
+    ok(inlen < sbuf.off); /* ignore NST */
+    sbuf.off = 0;
+    inlen = cbuf.off;
+    ret = ptls_handshake(server, &sbuf, cbuf.base, &inlen, &server_hs_prop); /* CF -> */
+    ok(ret == 0);
+    ok(ptls_handshake_is_complete(server));
+    ok(sbuf.off == 0);
+
+    ptls_free(client);
+    ptls_free(server);
+
+    ptls_buffer_dispose(&cbuf);
+    ptls_buffer_dispose(&sbuf);
+
+    ctx->update_traffic_key = NULL;
+    ctx->omit_end_of_early_data = 0;
+    ctx->save_ticket = NULL;
+    ctx_peer->update_traffic_key = NULL;
+    ctx_peer->omit_end_of_early_data = 0;
+    ctx_peer->encrypt_ticket = NULL;
+    ctx_peer->save_ticket = NULL;
+    ctx_peer->ticket_lifetime = 0;
+    ctx_peer->max_early_data_size = 0;
+}
+
+static int feed_messages_per_epoch(ptls_t *tls, ptls_buffer_t *outbufs, ptls_buffer_t *inbufs, ptls_handshake_properties_t *props)
+{
+    ptls_buffer_t *sendbufs[4] = {outbufs, outbufs + 1, outbufs + 2, outbufs + 3};
+    size_t i;
+    int ret = PTLS_ERROR_IN_PROGRESS;
+
+    for (i = 0; i != 4; ++i)
+        outbufs[i].off = 0;
+
+    for (i = 0; i != 4; ++i) {
+        if (inbufs[i].off != 0) {
+            ret = ptls_handle_message_per_epoch(tls, sendbufs, i, inbufs[i].base, inbufs[i].off, props);
+            if (!(ret == 0 || ret == PTLS_ERROR_IN_PROGRESS))
+                break;
+        }
+    }
+
+    return ret;
+}
+
+static void test_handshake_api_per_epoch(void)
+{
+    ptls_t *client, *server;
+    ptls_buffer_t cbufs[4], sbufs[4], *csendbufs[4] = {cbufs, cbufs + 1, cbufs + 2, cbufs + 3};
+    ptls_encrypt_ticket_t encrypt_ticket = {on_copy_ticket};
+    ptls_save_ticket_t save_ticket = {on_save_ticket};
+    size_t i;
+    int ret;
+
+    ctx->omit_end_of_early_data = 1;
+    ctx->save_ticket = &save_ticket;
+    ctx_peer->omit_end_of_early_data = 1;
+    ctx_peer->encrypt_ticket = &encrypt_ticket;
+    ctx_peer->ticket_lifetime = 86400;
+    ctx_peer->max_early_data_size = 8192;
+
+    for (i = 0; i != 4; ++i) {
+        ptls_buffer_init(&cbufs[i], "", 0);
+        ptls_buffer_init(&sbufs[i], "", 0);
+    }
+    saved_ticket = ptls_iovec_init(NULL, 0);
+
+    /* full handshake; each message is written to the buffer of its epoch */
+    client = ptls_new(ctx, 0);
+    server = ptls_new(ctx_peer, 1);
+    ret = ptls_handle_message_per_epoch(client, csendbufs, 0, NULL, 0, NULL);
+    ok(ret == PTLS_ERROR_IN_PROGRESS);
+    ok(cbufs[0].off != 0 && cbufs[0].base[0] == PTLS_HANDSHAKE_TYPE_CLIENT_HELLO);
+    ok(cbufs[1].off == 0 && cbufs[2].off == 0 && cbufs[3].off == 0);
+    ret = feed_messages_per_epoch(server, sbufs, cbufs, NULL); /* CH -> SH..SF,NST */
+    ok(ret == 0);
+    ok(sbufs[0].off != 0 && sbufs[0].base[0] == PTLS_HANDSHAKE_TYPE_SERVER_HELLO);
+    ok(sbufs[1].off == 0);
+    ok(sbufs[2].off != 0 && sbufs[2].base[0] == PTLS_HANDSHAKE_TYPE_ENCRYPTED_EXTENSIONS);
+    ok(sbufs[3].off != 0 && sbufs[3].base[0] == PTLS_HANDSHAKE_TYPE_NEW_SESSION_TICKET);
+    ret = feed_messages_per_epoch(client, cbufs, sbufs, NULL); /* SH..SF,NST -> CF */
+    ok(ret == 0);
+    ok(ptls_handshake_is_complete(client));
+    ok(saved_ticket.base != NULL);
+    ok(cbufs[0].off == 0 && cbufs[1].off == 0 && cbufs[3].off == 0);
+    ok(cbufs[2].off != 0 && cbufs[2].base[0] == PTLS_HANDSHAKE_TYPE_FINISHED);
+    ret = feed_messages_per_epoch(server, sbufs, cbufs, NULL); /* CF -> */
+    ok(ret == 0);
+    ok(ptls_handshake_is_complete(server));
+    for (i = 0; i != 4; ++i)
+        ok(sbufs[i].off == 0);
+    ptls_free(client);
+    ptls_free(server);
+
+    /* the second ClientHello is sent in the initial epoch, even though the 0-RTT key has been installed */
+    size_t max_early_data_size = 0;
+    ptls_handshake_properties_t client_hs_prop = {{{{NULL}, saved_ticket, &max_early_data_size}}}, server_hs_prop = {{{{NULL}}}};
+    server_hs_prop.server.enforce_retry = 1;
+    ctx->save_ticket = NULL;
+    for (i = 0; i != 4; ++i)
+        cbufs[i].off = 0;
+    client = ptls_new(ctx, 0);
+    server = ptls_new(ctx_peer, 1);
+    ret = ptls_handle_message_per_epoch(client, csendbufs, 0, NULL, 0, &client_hs_prop); /* -> CH */
+    ok(ret == PTLS_ERROR_IN_PROGRESS);
+    ok(max_early_data_size != 0);
+    ret = feed_messages_per_epoch(server, sbufs, cbufs, &server_hs_prop); /* CH -> HRR */
+    ok(ret == PTLS_ERROR_IN_PROGRESS);
+    ok(sbufs[0].off != 0 && sbufs[1].off == 0 && sbufs[2].off == 0 && sbufs[3].off == 0);
+    ret = feed_messages_per_epoch(client, cbufs, sbufs, &client_hs_prop); /* HRR -> CH */
+    ok(ret == PTLS_ERROR_IN_PROGRESS);
+    ok(cbufs[0].off != 0 && cbufs[0].base[0] == PTLS_HANDSHAKE_TYPE_CLIENT_HELLO);
+    ok(cbufs[1].off == 0 && cbufs[2].off == 0 && cbufs[3].off == 0);
+    ret = feed_messages_per_epoch(server, sbufs, cbufs, &server_hs_prop); /* CH -> SH..SF,NST */
+    ok(ret == 0);
+    ret = feed_messages_per_epoch(client, cbufs, sbufs, &client_hs_prop); /* SH..SF,NST -> CF */
+    ok(ret == 0);
+    ok(ptls_handshake_is_complete(client));
+    ok(client_hs_prop.client.early_data_acceptance == PTLS_EARLY_DATA_REJECTED);
+    ret = feed_messages_per_epoch(server, sbufs, cbufs, &server_hs_prop); /* CF -> */
+    ok(ret == 0);
+    ok(ptls_handshake_is_complete(server));
+    ptls_free(client);
+    ptls_free(server);
+
+    for (i = 0; i != 4; ++i) {
+        ptls_buffer_dispose(&cbufs[i]);
+        ptls_buffer_dispose(&sbufs[i]);
+    }
+    free(saved_ticket.base);
+    saved_ticket = ptls_iovec_init(NULL, 0);
+
+    ctx->omit_end_of_early_data = 0;
+    ctx_peer->omit_end_of_early_data = 0;
+    ctx_peer->encrypt_ticket = NULL;
+    ctx_peer->ticket_lifetime = 0;
+    ctx_peer->max_early_data_size = 0;
+}
+
+static void run_parallel_serially(ptls_run_parallel_t *self, void (*job)(void *job_data, size_t index), void *job_data,
+                                  size_t num_jobs)
+{
+    for (size_t i = 0; i < num_jobs; ++i)
+        job(job_data, i);
+}
+
+static ptls_run_parallel_t *parallel_runner;
+
+static int receive_all(ptls_t *tls, ptls_buffer_t *decbuf, ptls_buffer_t *input)
+{
+    size_t off = 0, consumed;
+    int ret;
+
+    while (off != input->off) {
+        consumed = input->off - off;
+        if ((ret = ptls_receive(tls, decbuf, input->base + off, &consumed)) != 0)
+            return ret;
+        off += consumed;
+    }
+    return 0;
+}
+
+static void test_parallel_records_impl(void)
+{
+    size_t len = PTLS_MAX_PLAINTEXT_RECORD_SIZE * PTLS_PARALLEL_RECORDS_PER_JOB * 3 + 12345,
+           num_records = (len + PTLS_MAX_PLAINTEXT_RECORD_SIZE - 1) / PTLS_MAX_PLAINTEXT_RECORD_SIZE, consumed, i;
+    uint8_t *plaintext = malloc(len);
+    ptls_t *client, *server;
+    ptls_buffer_t cbuf, sbuf, decbuf;
+    int ret;
+
+    assert(plaintext != NULL);
+    for (i = 0; i < len; ++i)
+        plaintext[i] = (uint8_t)(i * 13 + i / 1000);
+
+    client = ptls_new(ctx, 0);
+    server = ptls_new(ctx_peer, 1);
+    ptls_buffer_init(&cbuf, "", 0);
+    ptls_buffer_init(&sbuf, "", 0);
+    ptls_buffer_init(&decbuf, "", 0);
+
+    ret = ptls_handshake(client, &cbuf, NULL, NULL, NULL);
+    ok(ret == PTLS_ERROR_IN_PROGRESS);
+    consumed = cbuf.off;
+    ret = ptls_handshake(server, &sbuf, cbuf.base, &consumed, NULL);
+    ok(ret == 0);
+    cbuf.off = 0;
+    consumed = sbuf.off;
+    ret = ptls_handshake(client, &cbuf, sbuf.base, &consumed, NULL);
+    ok(ret == 0);
+    sbuf.off = 0;
+    consumed = cbuf.off;
+    ret = ptls_handshake(server, &sbuf, cbuf.base, &consumed, NULL);
+    ok(ret == 0);
+    cbuf.off = 0;
+
+    /* records encrypted in parallel can be decrypted one by one */
+    ret = ptls_send_parallel(client, &cbuf, plaintext, len, parallel_runner);
+    ok(ret == 0);
+    ok(cbuf.off == len + num_records * ptls_get_record_overhead(client));
+    ok(receive_all(server, &decbuf, &cbuf) == 0);
+    ok(decbuf.off == len && memcmp(decbuf.base, plaintext, len) == 0);
+
+    /* and vice versa, with a partial record at the tail that gets completed by the next call */
+    cbuf.off = 0;
+    decbuf.off = 0;
+    ok(ptls_send(client, &cbuf, plaintext, len) == 0);
+    ok(ptls_send(client, &cbuf, "hello", 5) == 0);
+    consumed = cbuf.off - 3;
+    ret = ptls_receive_parallel(server, &decbuf, cbuf.base, &consumed, parallel_runner);
+    ok(ret == 0);
+    ok(consumed == cbuf.off - 3);
+    consumed = 3;
+    ret = ptls_receive_parallel(server, &decbuf, cbuf.base + cbuf.off - 3, &consumed, parallel_runner);
+    ok(ret == 0);
+    ok(consumed == 3);
+    ok(decbuf.off == len + 5 && memcmp(decbuf.base, plaintext, len) == 0 && memcmp(decbuf.base + len, "hello", 5) == 0);
+
+    /* KeyUpdate in the middle is processed in order */
+    cbuf.off = 0;
+    decbuf.off = 0;
+    ok(ptls_send_parallel(client, &cbuf, plaintext, len, parallel_runner) == 0);
+    ok(ptls_update_key(client, 0) == 0);
+    ok(ptls_send_parallel(client, &cbuf, plaintext, len, parallel_runner) == 0);
+    consumed = cbuf.off;
+    ret = ptls_receive_parallel(server, &decbuf, cbuf.base, &consumed, parallel_runner);
+    ok(ret == 0);
+    ok(consumed == cbuf.off);
+    ok(decbuf.off == len * 2 && memcmp(decbuf.base, plaintext, len) == 0 && memcmp(decbuf.base + len, plaintext, len) == 0);
+
+    /* the records preceding a corrupted one are returned along with the error */
+    cbuf.off = 0;
+    decbuf.off = 0;
+    ok(ptls_send_parallel(client, &cbuf, plaintext, len, parallel_runner) == 0);
+    cbuf.base[cbuf.off - 1] ^= 1;
+    consumed = cbuf.off;
+    ret = ptls_receive_parallel(server, &decbuf, cbuf.base, &consumed, parallel_runner);
+    ok(ret == PTLS_ALERT_BAD_RECORD_MAC);
+    ok(decbuf.off == len - 12345 && memcmp(decbuf.base, plaintext, decbuf.off) == 0);
+
+    ptls_buffer_dispose(&cbuf);
+    ptls_buffer_dispose(&sbuf);
+    ptls_buffer_dispose(&decbuf);
+    ptls_free(client);
+    ptls_free(server);
+    free(plaintext);
+}
+
+static void test_parallel_records(void)
+{
+    ptls_run_parallel_t serial = {run_parallel_serially};
+
+    parallel_runner = &serial;
+    subtest("serial", test_parallel_records_impl);
+#ifndef _WINDOWS
+    parallel_runner = ptls_thread_pool_new(3);
+    assert(parallel_runner != NULL);
+    subtest("thread-pool", test_parallel_records_impl);
+    ptls_thread_pool_free(parallel_runner);
+#endif
+    parallel_runner = NULL;
+}
+
+static void handshake_pair(ptls_t **client, ptls_t **server)
+{
+    ptls_buffer_t cbuf, sbuf;
+    size_t consumed;
+    int ret;
+
+    *client = ptls_new(ctx, 0);
+    *server = ptls_new(ctx_peer, 1);
+    ptls_buffer_init(&cbuf, "", 0);
+    ptls_buffer_init(&sbuf, "", 0);
+
+    ret = ptls_handshake(*client, &cbuf, NULL, NULL, NULL);
+    ok(ret == PTLS_ERROR_IN_PROGRESS);
+    consumed = cbuf.off;
+    ret = ptls_handshake(*server, &sbuf, cbuf.base, &consumed, NULL);
+    ok(ret == 0);
+    ok(consumed == cbuf.off);
+    cbuf.off = 0;
+    consumed = sbuf.off;
+    ret = ptls_handshake(*client, &cbuf, sbuf.base, &consumed, NULL);
+    ok(ret == 0);
+    ok(consumed == sbuf.off);
+    consumed = cbuf.off;
+    ret = ptls_handshake(*server, &sbuf, cbuf.base, &consumed, NULL);
+    ok(ret == 0);
+    ok(consumed == cbuf.off);
+
+    ptls_buffer_dispose(&cbuf);
+    ptls_buffer_dispose(&sbuf);
+}
+
+static int records_are_within(ptls_buffer_t *buf, size_t max_payload, size_t overhead)
+{
+    size_t off = 0;
+
+    while (off != buf->off) {
+        size_t reclen = ntoh16(buf->base + off + 3);
+        if (reclen > max_payload + overhead)
+            return 0;
+        off += 5 + reclen;
+    }
+    return 1;
+}
+
+static void test_record_size_limit_transfer(void)
+{
+    size_t client_limit = ctx->record_size_limit, server_limit = ctx_peer->record_size_limit, len = 20000, i;
+    uint8_t *plaintext = malloc(len);
+    ptls_t *client, *server;
+    ptls_buffer_t buf, decbuf;
+    ptls_run_parallel_t serial = {run_parallel_serially};
+
+    assert(plaintext != NULL);
+    for (i = 0; i < len; ++i)
+        plaintext[i] = (uint8_t)i;
+    ptls_buffer_init(&buf, "", 0);
+    ptls_buffer_init(&decbuf, "", 0);
+
+    handshake_pair(&client, &server);
+    ok(client->traffic_protection.enc.record_size_limit == server_limit);
+    ok(server->traffic_protection.enc.record_size_limit == client_limit);
+
+    /* records sent by each side honor the limit of the peer */
+    ok(ptls_send(server, &buf, plaintext, len) == 0);
+    ok(records_are_within(&buf, client_limit - 1, ptls_get_record_overhead(server) - 5));
+    ok(receive_all(client, &decbuf, &buf) == 0);
+    ok(decbuf.off == len && memcmp(decbuf.base, plaintext, len) == 0);
+    buf.off = 0;
+    decbuf.off = 0;
+    ok(ptls_send(client, &buf, plaintext, len) == 0);
+    ok(records_are_within(&buf, server_limit - 1, ptls_get_record_overhead(client) - 5));
+    ok(receive_all(server, &decbuf, &buf) == 0);
+    ok(decbuf.off == len && memcmp(decbuf.base, plaintext, len) == 0);
+
+    /* as do records encrypted in parallel */
+    buf.off = 0;
+    decbuf.off = 0;
+    ok(ptls_send_parallel(server, &buf, plaintext, len, &serial) == 0);
+    ok(records_are_within(&buf, client_limit - 1, ptls_get_record_overhead(server) - 5));
+    ok(receive_all(client, &decbuf, &buf) == 0);
+    ok(decbuf.off == len && memcmp(decbuf.base, plaintext, len) == 0);
+
+    /* records exceeding the limit are rejected */
+    buf.off = 0;
+    decbuf.off = 0;
+    server->traffic_protection.enc.record_size_limit = 0;
+    ok(ptls_send(server, &buf, plaintext, client_limit) == 0);
+    ok(receive_all(client, &decbuf, &buf) == PTLS_ALERT_RECORD_OVERFLOW);
+
+    ptls_buffer_dispose(&buf);
+    ptls_buffer_dispose(&decbuf);
+    ptls_free(client);
+    ptls_free(server);
+    free(plaintext);
+}
+
+/**
+ * checks that the encrypted records in `buf` carry as much as the record size limit permits, i.e. that the handshake messages
+ * have been coalesced
+ */
+static int records_are_coalesced(ptls_t *tls, ptls_buffer_t *buf, size_t *num_records)
+{
+    size_t max_payload = tls->traffic_protection.enc.record_size_limit != 0 ? tls->traffic_protection.enc.record_size_limit - 1
+                                                                             : PTLS_MAX_PLAINTEXT_RECORD_SIZE,
+           overhead = ptls_get_record_overhead(tls) - 5, payload = 0, off = 0;
+
+    *num_records = 0;
+    while (off != buf->off) {
+        size_t reclen = ntoh16(buf->base + off + 3);
+        if (buf->base[off] == PTLS_CONTENT_TYPE_APPDATA) {
+            if (reclen > max_payload + overhead)
+                return 0;
+            ++*num_records;
+            payload += reclen - overhead;
+        }
+        off += 5 + reclen;
+    }
+    return *num_records == (payload + max_payload - 1) / max_payload;
+}
 
-    /* shamelessly reuse this subtest for testing ordinary TLS 0-RTT with HRR rejection */
-    ctx->update_traffic_key = NULL;
-    ctx->omit_end_of_early_data = 0;
-    ctx_peer->update_traffic_key = NULL;
-    ctx_peer->omit_end_of_early_data = 0;
-    client_hs_prop = (ptls_handshake_properties_t){{{{NULL}, saved_ticket, &max_early_data_size}}};
-    server_hs_prop = (ptls_handshake_properties_t){{{{NULL}}}};
-    server_hs_prop.server.enforce_retry = 1;
-    client = ptls_new(ctx, 0);
-    server = ptls_new(ctx_peer, 1);
-    ret = ptls_handshake(client, &cbuf, NULL, NULL, &client_hs_prop); /* -> CH */
-    ok(ret == PTLS_ERROR_IN_PROGRESS);
-    ok(client_hs_prop.client.max_early_data_size != 0);
-    ok(client_hs_prop.client.early_data_acceptance == PTLS_EARLY_DATA_ACCEPTANCE_UNKNOWN);
-    ok(cbuf.off != 0);
-    ret = ptls_send(client, &cbuf, "hello world", 11); /* send 0-RTT data that'll be rejected */
-    ok(ret == 0);
-    size_t inlen = cbuf.off;
-    ret = ptls_handshake(server, &sbuf, cbuf.base, &inlen, &server_hs_prop); /* CH -> HRR */
-    ok(ret == PTLS_ERROR_IN_PROGRESS);
-    ok(cbuf.off == inlen);
-    cbuf.off = 0;
-    ok(sbuf.off != 0);
-    inlen = sbuf.off;
-    ret = ptls_handshake(client, &cbuf, sbuf.base, &inlen, &client_hs_prop); /* HRR -> CH */
+static void test_coalesced_records(void)
+{
+    ptls_t *client = ptls_new(ctx, 0), *server = ptls_new(ctx_peer, 1);
+    ptls_buffer_t cbuf, sbuf;
+    size_t consumed, num_records;
+    int ret;
+
+    ptls_buffer_init(&cbuf, "", 0);
+    ptls_buffer_init(&sbuf, "", 0);
+
+    ret = ptls_handshake(client, &cbuf, NULL, NULL, NULL);
     ok(ret == PTLS_ERROR_IN_PROGRESS);
-    ok(client_hs_prop.client.early_data_acceptance == PTLS_EARLY_DATA_REJECTED);
-    ok(sbuf.off == inlen);
-    sbuf.off = 0;
-    ok(cbuf.off != 0);
-    inlen = cbuf.off;
-    ret = ptls_handshake(server, &sbuf, cbuf.base, &inlen, &server_hs_prop); /* CH -> SH..SF,NST */
+    consumed = cbuf.off;
+    ret = ptls_handshake(server, &sbuf, cbuf.base, &consumed, NULL);
     ok(ret == 0);
-    ok(!ptls_handshake_is_complete(server));
-    ok(cbuf.off == inlen);
+    /* EE, Certificate, CertificateVerify, Finished */
+    ok(records_are_coalesced(server, &sbuf, &num_records));
+    if (server->traffic_protection.enc.record_size_limit == 0)
+        ok(num_records == 1);
+
     cbuf.off = 0;
-    ok(sbuf.off != 0);
-    inlen = sbuf.off;
-    ret = ptls_handshake(client, &cbuf, sbuf.base, &inlen, &client_hs_prop); /* SH..SF -> CF */
+    consumed = sbuf.off;
+    ret = ptls_handshake(client, &cbuf, sbuf.base, &consumed, NULL);
     ok(ret == 0);
-    ok(ptls_handshake_is_complete(client));
-    ok(inlen < sbuf.off); /* ignore NST */
+    ok(consumed == sbuf.off);
+    ok(records_are_coalesced(client, &cbuf, &num_records));
+    consumed = cbuf.off;
     sbuf.off = 0;
-    inlen = cbuf.off;
-    ret = ptls_handshake(server, &sbuf, cbuf.base, &inlen, &server_hs_prop); /* CF -> */
+    ret = ptls_handshake(server, &sbuf, cbuf.base, &consumed, NULL);
     ok(ret == 0);
-    ok(ptls_handshake_is_complete(server));
-    ok(sbuf.off == 0);
+    ok(consumed == cbuf.off);
 
+    ptls_buffer_dispose(&cbuf);
+    ptls_buffer_dispose(&sbuf);
     ptls_free(client);
     ptls_free(server);
+}
 
-    ptls_buffer_dispose(&cbuf);
-    ptls_buffer_dispose(&sbuf);
+static void test_compact_session_identifier(void)
+{
+    const char *server_name = "a-rather-long-host-name.example.com";
+    ptls_t *client, *server;
+    ptls_buffer_t orig, compact;
+    struct st_session_identifier_t orig_id, compact_id;
+    ptls_hash_algorithm_t *hash;
+
+    handshake_pair(&client, &server);
+    hash = server->key_schedule->hashes[0].algo;
+    ptls_buffer_init(&orig, "", 0);
+    ptls_buffer_init(&compact, "", 0);
+
+    ok(encode_session_identifier(ctx_peer, &orig, 1234, ptls_iovec_init(NULL, 0), server->key_schedule, server_name, 0x1d, 0x1301,
+                                 "h2") == 0);
+    ctx_peer->use_compact_session_ticket = 1;
+    ok(encode_session_identifier(ctx_peer, &compact, 1234, ptls_iovec_init(NULL, 0), server->key_schedule, server_name, 0x1d,
+                                 0x1301, "h2") == 0);
+    ctx_peer->use_compact_session_ticket = 0;
+    ok(compact.off < orig.off);
+
+    ok(decode_session_identifier(&orig_id, orig.base, orig.base + orig.off) == 0);
+    ok(decode_session_identifier(&compact_id, compact.base, compact.base + compact.off) == 0);
+    ok(compact_id.issued_at % 1000 == 0);
+    ok(compact_id.issued_at <= orig_id.issued_at + 1000 && orig_id.issued_at < compact_id.issued_at + 1000);
+    ok(compact_id.psk.len == hash->digest_size);
+    ok(compact_id.psk.len == orig_id.psk.len && memcmp(compact_id.psk.base, orig_id.psk.base, orig_id.psk.len) == 0);
+    ok(compact_id.ticket_age_add == 1234);
+    ok(compact_id.key_exchange_id == 0x1d);
+    ok(compact_id.csid == 0x1301);
+
+    /* long names are stored as digests, short ones as-is */
+    ok(compact_id.server_name.is_digest);
+    ok(session_identifier_name_is(&compact_id.server_name, hash, server_name));
+    ok(!session_identifier_name_is(&compact_id.server_name, hash, "another-long-host-name.example.com"));
+    ok(!session_identifier_name_is(&compact_id.server_name, hash, "short"));
+    ok(!compact_id.negotiated_protocol.is_digest);
+    ok(session_identifier_name_is(&compact_id.negotiated_protocol, hash, "h2"));
+    ok(!session_identifier_name_is(&compact_id.negotiated_protocol, hash, "h3"));
+    ok(session_identifier_name_is(&orig_id.server_name, hash, server_name));
+
+    /* truncated input is rejected */
+    ok(decode_session_identifier(&compact_id, compact.base, compact.base + compact.off - 1) != 0);
+
+    ptls_buffer_dispose(&orig);
+    ptls_buffer_dispose(&compact);
+    ptls_free(client);
+    ptls_free(server);
+}
 
-    ctx->update_traffic_key = NULL;
-    ctx->omit_end_of_early_data = 0;
-    ctx->save_ticket = NULL;
-    ctx_peer->update_traffic_key = NULL;
-    ctx_peer->omit_end_of_early_data = 0;
-    ctx_peer->encrypt_ticket = NULL;
-    ctx_peer->save_ticket = NULL;
-    ctx_peer->ticket_lifetime = 0;
-    ctx_peer->max_early_data_size = 0;
+static void test_compact_session_ticket(void)
+{
+    subtest("identifier", test_compact_session_identifier);
+
+    ctx_peer->use_compact_session_ticket = 1;
+    subtest("resumption", test_resumption);
+    ctx_peer->use_compact_session_ticket = 0;
+}
+
+static void test_record_size_limit(void)
+{
+    ctx->record_size_limit = 512;
+    ctx_peer->record_size_limit = 2048;
+
+    subtest("transfer", test_record_size_limit_transfer);
+    subtest("coalesced-records", test_coalesced_records);
+    subtest("resumption", test_resumption);
+
+    ctx->record_size_limit = 0;
+    ctx_peer->record_size_limit = 0;
 }
 
 static void test_all_handshakes(void)
@@ -1443,6 +2774,13 @@ static void test_all_handshakes(void)
     subtest("resumption", test_resumption);
     subtest("resumption-different-preferred-key-share", test_resumption_different_preferred_key_share);
     subtest("resumption-with-client-authentication", test_resumption_with_client_authentication);
+    subtest("compact-session-ticket", test_compact_session_ticket);
+#ifndef _WINDOWS
+    subtest("session-cache", test_session_cache);
+    subtest("ticket-key-file", test_ticket_key_file);
+    subtest("context-handle", test_context_handle);
+    subtest("async-ticket", test_async_ticket);
+#endif
 
     subtest("enforce-retry-stateful", test_enforce_retry_stateful);
     subtest("enforce-retry-stateless", test_enforce_retry_stateless);
@@ -1450,8 +2788,12 @@ static void test_all_handshakes(void)
     subtest("stateless-hrr-aad-change", test_stateless_hrr_aad_change);
 
     subtest("key-update", test_key_update);
+    subtest("coalesced-records", test_coalesced_records);
+    subtest("parallel-records", test_parallel_records);
+    subtest("record-size-limit", test_record_size_limit);
 
     subtest("handshake-api", test_handshake_api);
+    subtest("handshake-api-per-epoch", test_handshake_api_per_epoch);
 
     ctx_peer->sign_certificate = sc_orig;
 
@@ -1616,6 +2958,228 @@ static void test_tls12_hello(void)
     ctx->on_client_hello = orig;
 }
 
+#if PICOTLS_USE_CERTIFICATE_COMPRESSION
+
+static int decompress_certificate_call(ptls_decompress_certificate_t *d, uint16_t algo, ptls_iovec_t output, ptls_iovec_t input)
+{
+    return d->cb(d, NULL, algo, output, input);
+}
+
+/**
+ * builds a Certificate message that compresses well, by repeating the certificate of the server
+ */
+static void build_compressible_certificate_message(ptls_buffer_t *message)
+{
+    ptls_iovec_t certs[] = {ctx_peer->certificates.list[0], ctx_peer->certificates.list[0], ctx_peer->certificates.list[0]};
+    int ret = ptls_build_certificate_message(message, ptls_iovec_init(NULL, 0), certs, PTLS_ELEMENTSOF(certs),
+                                             ptls_iovec_init(NULL, 0));
+    ok(ret == 0);
+}
+
+/**
+ * Checks that a message compressed using `algo` (and optionally a dictionary) can be decompressed by `d`, then that malformed
+ * input, as well as an incorrect `uncompressed_length` are rejected.
+ */
+static void test_certificate_compression_round_trip(ptls_decompress_certificate_t *d, uint16_t algo,
+                                                    const ptls_certificate_compression_dictionary_t *dictionary,
+                                                    ptls_iovec_t message)
+{
+    uint8_t compressed[16384], decompressed[16384 + 1], malformed[sizeof(compressed) + 1];
+    ptls_iovec_t output = ptls_iovec_init(compressed, message.len - 1);
+    size_t i;
+
+    assert(message.len < sizeof(compressed));
+
+    ok(ptls_compress_certificate_message(&output, algo, dictionary, message) == 0);
+    ok(output.len < message.len);
+    ok(decompress_certificate_call(d, algo, ptls_iovec_init(decompressed, message.len), output) == 0);
+    ok(memcmp(decompressed, message.base, message.len) == 0);
+
+    /* truncated input */
+    ok(decompress_certificate_call(d, algo, ptls_iovec_init(decompressed, message.len), ptls_iovec_init(output.base, 1)) != 0);
+    ok(decompress_certificate_call(d, algo, ptls_iovec_init(decompressed, message.len),
+                                   ptls_iovec_init(output.base, output.len - 1)) != 0);
+    /* trailing garbage */
+    memcpy(malformed, output.base, output.len);
+    malformed[output.len] = 0x55;
+    ok(decompress_certificate_call(d, algo, ptls_iovec_init(decompressed, message.len),
+                                   ptls_iovec_init(malformed, output.len + 1)) != 0);
+    /* corrupted input */
+    for (i = 0; i != output.len; ++i)
+        malformed[i] = (uint8_t)(output.base[i] ^ 0xa5);
+    ok(decompress_certificate_call(d, algo, ptls_iovec_init(decompressed, message.len), ptls_iovec_init(malformed, output.len)) !=
+       0);
+    /* the message is longer (i.e. the input is oversized), or shorter than `uncompressed_length` */
+    ok(decompress_certificate_call(d, algo, ptls_iovec_init(decompressed, message.len - 1), output) != 0);
+    ok(decompress_certificate_call(d, algo, ptls_iovec_init(decompressed, message.len + 1), output) != 0);
+    /* unexpected algorithm */
+    ok(decompress_certificate_call(d, PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_EXPERIMENTAL_MIN + 0x1234,
+                                   ptls_iovec_init(decompressed, message.len), output) != 0);
+}
+
+/**
+ * records the algorithm being used by the peer
+ */
+struct st_recording_decompress_certificate_t {
+    ptls_decompress_certificate_t super;
+    ptls_decompress_certificate_t *inner;
+    size_t num_calls;
+    uint16_t last_algorithm;
+};
+
+static int recording_decompress_certificate(ptls_decompress_certificate_t *_self, ptls_t *tls, uint16_t algorithm,
+                                            ptls_iovec_t output, ptls_iovec_t input)
+{
+    struct st_recording_decompress_certificate_t *self = (void *)_self;
+
+    ++self->num_calls;
+    self->last_algorithm = algorithm;
+    return self->inner->cb(self->inner, tls, algorithm, output, input);
+}
+
+/**
+ * runs a handshake with the server sending the given precompressed certificate, returning the algorithm being used
+ */
+static uint16_t compressed_certificate_handshake(ptls_emit_compressed_certificate_t *ecc, ptls_decompress_certificate_t *d)
+{
+    struct st_recording_decompress_certificate_t recording = {{d->supported_algorithms, recording_decompress_certificate}, d};
+    ptls_emit_certificate_t *orig_emit_certificate = ctx_peer->emit_certificate;
+
+    ctx->decompress_certificate = &recording.super;
+    ctx_peer->emit_certificate = &ecc->super;
+    test_handshake(ptls_iovec_init(NULL, 0), TEST_HANDSHAKE_1RTT, 0, 0, 0);
+    ok(recording.num_calls == 1);
+    ctx->decompress_certificate = NULL;
+    ctx_peer->emit_certificate = orig_emit_certificate;
+
+    return recording.last_algorithm;
+}
+
+static void test_certificate_compression(void)
+{
+    ptls_buffer_t message;
+    const uint16_t *algo;
+    ptls_emit_compressed_certificate_t ecc;
+    size_t i;
+
+    ptls_buffer_init(&message, "", 0);
+    build_compressible_certificate_message(&message);
+
+    for (algo = ptls_decompress_certificate.supported_algorithms; *algo != UINT16_MAX; ++algo) {
+        note("algorithm %" PRIu16, *algo);
+        test_certificate_compression_round_trip(&ptls_decompress_certificate, *algo, NULL,
+                                                ptls_iovec_init(message.base, message.off));
+    }
+
+    /* the emitter builds one message for each algorithm; the fields of the previous API refer to the first */
+    ok(ptls_init_compressed_certificate(&ecc, ctx_peer->certificates.list, ctx_peer->certificates.count,
+                                        ptls_iovec_init(NULL, 0)) == 0);
+    ok(ecc.num_compressed != 0);
+    for (i = 0; i != ecc.num_compressed; ++i)
+        ok(ecc.compressed[i].algo == ptls_decompress_certificate.supported_algorithms[i]);
+    ok(ecc.algo == ecc.compressed[0].algo);
+    ok(ecc.without_ocsp_status.bytes.base == ecc.compressed[0].without_ocsp_status.bytes.base);
+    ok(ecc.without_ocsp_status.uncompressed_length == ecc.compressed[0].without_ocsp_status.uncompressed_length);
+
+    /* handshake using the compressed certificate */
+    compressed_certificate_handshake(&ecc, &ptls_decompress_certificate);
+
+    ptls_dispose_compressed_certificate(&ecc);
+    ptls_buffer_dispose(&message);
+}
+
+/**
+ * the compression algorithm being used by the dictionary tests
+ */
+static uint16_t dictionary_base_algo;
+
+static void test_certificate_compression_dictionary_algo(void)
+{
+    uint16_t base_algo = dictionary_base_algo;
+    ptls_certificate_compression_dictionary_t dictionary = {PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_EXPERIMENTAL_MIN, base_algo,
+                                                            ctx_peer->certificates.list[0]},
+                                              other = dictionary, wrong = dictionary;
+    ptls_decompress_certificate_with_dictionary_t d, d_other, d_wrong;
+    ptls_emit_compressed_certificate_t ecc;
+    ptls_buffer_t message;
+    uint8_t compressed[16384], plain_compressed[16384], decompressed[16384], wrong_bytes[4096];
+    ptls_iovec_t output, plain_output;
+    size_t i;
+
+    ptls_buffer_init(&message, "", 0);
+    ok(ptls_build_certificate_message(&message, ptls_iovec_init(NULL, 0), ctx_peer->certificates.list,
+                                      ctx_peer->certificates.count, ptls_iovec_init(NULL, 0)) == 0);
+    assert(message.off < sizeof(decompressed));
+
+    ok(ptls_init_decompress_certificate_with_dictionary(&d, &dictionary) == 0);
+    ok(d.super.supported_algorithms[0] == dictionary.algo);
+    for (i = 0; ptls_decompress_certificate.supported_algorithms[i] != UINT16_MAX; ++i)
+        ok(d.super.supported_algorithms[i + 1] == ptls_decompress_certificate.supported_algorithms[i]);
+    ok(d.super.supported_algorithms[i + 1] == UINT16_MAX);
+
+    /* round trip, along with malformed input and incorrect lengths */
+    test_certificate_compression_round_trip(&d.super, dictionary.algo, &dictionary, ptls_iovec_init(message.base, message.off));
+
+    /* the dictionary shrinks the message well beyond what the base algorithm achieves */
+    output = ptls_iovec_init(compressed, sizeof(compressed));
+    ok(ptls_compress_certificate_message(&output, dictionary.algo, &dictionary, ptls_iovec_init(message.base, message.off)) == 0);
+    plain_output = ptls_iovec_init(plain_compressed, sizeof(plain_compressed));
+    ok(ptls_compress_certificate_message(&plain_output, base_algo, NULL, ptls_iovec_init(message.base, message.off)) == 0);
+    ok(output.len * 2 < plain_output.len);
+    ok(ptls_compress_certificate_message(&plain_output, base_algo, &dictionary, ptls_iovec_init(message.base, message.off)) ==
+       PTLS_ERROR_COMPRESSION_FAILURE);
+
+    /* decompressors that do not know the dictionary reject the message */
+    ok(decompress_certificate_call(&ptls_decompress_certificate, dictionary.algo, ptls_iovec_init(decompressed, message.off),
+                                   output) != 0);
+    other.algo = dictionary.algo + 1;
+    ok(ptls_init_decompress_certificate_with_dictionary(&d_other, &other) == 0);
+    ok(decompress_certificate_call(&d_other.super, dictionary.algo, ptls_iovec_init(decompressed, message.off), output) != 0);
+
+    /* a different dictionary using the same codepoint does not yield the message */
+    assert(dictionary.bytes.len <= sizeof(wrong_bytes));
+    for (i = 0; i != dictionary.bytes.len; ++i)
+        wrong_bytes[i] = (uint8_t)(dictionary.bytes.base[i] ^ 0x5a);
+    wrong.bytes = ptls_iovec_init(wrong_bytes, dictionary.bytes.len);
+    ok(ptls_init_decompress_certificate_with_dictionary(&d_wrong, &wrong) == 0);
+    memset(decompressed, 0, sizeof(decompressed));
+    ok(decompress_certificate_call(&d_wrong.super, dictionary.algo, ptls_iovec_init(decompressed, message.off), output) != 0 ||
+       memcmp(decompressed, message.base, message.off) != 0);
+
+    /* messages compressed using the dictionary are preferred by the emitter, and used in the handshake */
+    ok(ptls_init_compressed_certificate_with_dictionary(&ecc, ctx_peer->certificates.list, ctx_peer->certificates.count,
+                                                        ptls_iovec_init(NULL, 0), &dictionary) == 0);
+    ok(ecc.compressed[0].algo == dictionary.algo);
+    ok(compressed_certificate_handshake(&ecc, &d.super) == dictionary.algo);
+    /* clients that do not have the dictionary receive a message compressed without it */
+    ok(compressed_certificate_handshake(&ecc, &ptls_decompress_certificate) != dictionary.algo);
+    ptls_dispose_compressed_certificate(&ecc);
+
+    ptls_buffer_dispose(&message);
+}
+
+static void test_certificate_compression_dictionary(void)
+{
+    ptls_certificate_compression_dictionary_t brotli = {PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_EXPERIMENTAL_MIN,
+                                                        PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_BROTLI,
+                                                        ctx_peer->certificates.list[0]};
+    ptls_decompress_certificate_with_dictionary_t d;
+
+#if PICOTLS_USE_ZLIB
+    dictionary_base_algo = PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_ZLIB;
+    subtest("zlib", test_certificate_compression_dictionary_algo);
+#endif
+#if PICOTLS_USE_ZSTD
+    dictionary_base_algo = PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_ZSTD;
+    subtest("zstd", test_certificate_compression_dictionary_algo);
+#endif
+
+    /* dictionaries are not supported for brotli */
+    ok(ptls_init_decompress_certificate_with_dictionary(&d, &brotli) == PTLS_ERROR_NOT_AVAILABLE);
+}
+
+#endif
+
 void test_picotls(void)
 {
     subtest("is_ipaddr", test_is_ipaddr);
@@ -1626,27 +3190,242 @@ void test_picotls(void)
     subtest("aes128gcm", test_aes128gcm);
     subtest("aes256gcm", test_aes256gcm);
     subtest("chacha20poly1305", test_chacha20poly1305);
+    subtest("aead-pool", test_aead_pool);
+    subtest("chacha20-random", test_chacha20_random);
     subtest("aes128ecb", test_aes128ecb);
     subtest("aes256ecb", test_aes256ecb);
     subtest("aes128ctr", test_aes128ctr);
     subtest("chacha20", test_chacha20);
     subtest("ffx", test_ffx);
     subtest("base64-decode", test_base64_decode);
+    subtest("buffer-nonsensitive", test_buffer_nonsensitive);
     subtest("fragmented-message", test_fragmented_message);
     subtest("handshake", test_all_handshakes);
     subtest("quic", test_quic);
     subtest("tls12-hello", test_tls12_hello);
+#if PICOTLS_USE_CERTIFICATE_COMPRESSION
+    subtest("certificate-compression", test_certificate_compression);
+    subtest("certificate-compression-dictionary", test_certificate_compression_dictionary);
+#endif
+}
+
+static void test_ech_rejection(void)
+{
+    uint8_t config_list[sizeof(ECH_CONFIG_LIST) - 1];
+    ptls_iovec_t retry_configs = {NULL};
+    ptls_handshake_properties_t client_hs_prop = {{{{NULL}}}};
+    ptls_t *client, *server;
+    ptls_buffer_t cbuf, sbuf;
+    size_t consumed;
+    int ret;
+
+    /* the client uses a config_id that the server does not know */
+    memcpy(config_list, ECH_CONFIG_LIST, sizeof(config_list));
+    ++config_list[6];
+    client_hs_prop.client.ech.configs = ptls_iovec_init(config_list, sizeof(config_list));
+    client_hs_prop.client.ech.retry_configs = &retry_configs;
+
+    client = ptls_new(ctx, 0);
+    server = ptls_new(ctx_peer, 1);
+    ptls_set_server_name(client, "test.example.com", 0);
+    ptls_buffer_init(&cbuf, "", 0);
+    ptls_buffer_init(&sbuf, "", 0);
+
+    ret = ptls_handshake(client, &cbuf, NULL, NULL, &client_hs_prop);
+    ok(ret == PTLS_ERROR_IN_PROGRESS);
+    consumed = cbuf.off;
+    ret = ptls_handshake(server, &sbuf, cbuf.base, &consumed, NULL);
+    ok(ret == 0);
+    ok(consumed == cbuf.off);
+    ok(!ptls_is_ech_handshake(server, NULL, NULL, NULL));
+    cbuf.off = 0;
+
+    /* client completes the outer handshake then aborts, handing out the configs that the server sent */
+    consumed = sbuf.off;
+    ret = ptls_handshake(client, &cbuf, sbuf.base, &consumed, &client_hs_prop);
+    ok(ret == PTLS_ALERT_ECH_REQUIRED);
+    ok(!ptls_is_ech_handshake(client, NULL, NULL, NULL));
+    ok(retry_configs.len == sizeof(ECH_CONFIG_LIST) - 1);
+    ok(retry_configs.base != NULL && memcmp(retry_configs.base, ECH_CONFIG_LIST, retry_configs.len) == 0);
+
+    free(retry_configs.base);
+    ptls_buffer_dispose(&cbuf);
+    ptls_buffer_dispose(&sbuf);
+    ptls_free(client);
+    ptls_free(server);
+}
+
+void test_picotls_ech(ptls_key_exchange_context_t *key, ptls_hpke_kem_t **kems, ptls_hpke_cipher_suite_t **ciphers)
+{
+    ptls_iovec_t config_list = ptls_iovec_init(ECH_CONFIG_LIST, sizeof(ECH_CONFIG_LIST) - 1);
+    ptls_ech_server_config_t config, *configs[] = {&config, NULL};
+    int ret;
+
+    /* the list contains exactly one ECHConfig */
+    ret = ptls_ech_init_server_config(&config, ptls_iovec_init(config_list.base + 2, config_list.len - 2), key, kems, ciphers);
+    assert(ret == 0);
+    ctx->ech.client.ciphers = ciphers;
+    ctx->ech.client.kems = kems;
+    ctx_peer->ech.server.configs = configs;
+    ctx_peer->ech.server.retry_configs = config_list;
+
+    ptls_sign_certificate_t server_sc = {sign_certificate};
+    sc_orig = ctx_peer->sign_certificate;
+    ctx_peer->sign_certificate = &server_sc;
+
+    /* stateless retry is not covered, as the server does not process ECH when retry_uses_cookie is set */
+    subtest("ech-full-handshake", test_full_handshake);
+    subtest("ech-hrr-handshake", test_hrr_handshake);
+    subtest("ech-resumption", test_resumption);
+    subtest("ech-rejection", test_ech_rejection);
+
+    ctx_peer->sign_certificate = sc_orig;
+    ctx_peer->ech.server.configs = NULL;
+    ctx_peer->ech.server.retry_configs = ptls_iovec_init(NULL, 0);
+    ctx->ech.client.ciphers = NULL;
+    ctx->ech.client.kems = NULL;
+    ptls_ech_dispose_server_config(&config);
+}
+
+static ptls_cipher_suite_t *integrity_only_cs, *integrity_only_cs_peer;
+
+static void test_integrity_only_aead(void)
+{
+    ptls_aead_algorithm_t *aead = integrity_only_cs->aead;
+    ptls_hash_algorithm_t *hash = integrity_only_cs->hash;
+    const char *src = "hello world", *aad = "my true aad";
+    uint8_t key[PTLS_MAX_DIGEST_SIZE], iv[PTLS_MAX_DIGEST_SIZE], enc[256], expected_tag[PTLS_MAX_DIGEST_SIZE];
+    ptls_aead_context_t *c;
+    ptls_hash_context_t *hmac;
+    size_t enclen;
+
+    ok(aead->key_size == hash->digest_size);
+    ok(aead->iv_size == hash->digest_size);
+    ok(aead->key_size <= PTLS_MAX_SECRET_SIZE);
+    ok(aead->iv_size <= PTLS_MAX_IV_SIZE);
+    ok(aead->tag_size == hash->digest_size);
+
+    memset(key, 'k', sizeof(key));
+    memset(iv, 'i', sizeof(iv));
+    c = ptls_aead_new_direct(aead, 1, key, iv);
+    assert(c != NULL);
+    enclen = ptls_aead_encrypt(c, enc, src, strlen(src), 0x1234, aad, strlen(aad));
+    ptls_aead_free(c);
+
+    /* the payload is emitted as-is, followed by HMAC(key, nonce || aad || payload) */
+    ok(enclen == strlen(src) + aead->tag_size);
+    ok(memcmp(enc, src, strlen(src)) == 0);
+    iv[aead->iv_size - 2] ^= 0x12;
+    iv[aead->iv_size - 1] ^= 0x34;
+    hmac = ptls_hmac_create(hash, key, hash->digest_size);
+    hmac->update(hmac, iv, aead->iv_size);
+    hmac->update(hmac, aad, strlen(aad));
+    hmac->update(hmac, src, strlen(src));
+    hmac->final(hmac, expected_tag, PTLS_HASH_FINAL_MODE_FREE);
+    ok(memcmp(enc + strlen(src), expected_tag, hash->digest_size) == 0);
+
+    test_ciphersuite(integrity_only_cs, integrity_only_cs_peer);
+    test_aad_ciphersuite(integrity_only_cs, integrity_only_cs_peer);
+}
+
+static void test_integrity_only_handshake(void)
+{
+    ptls_t *client, *server;
+    ptls_buffer_t cbuf, sbuf, decbuf;
+    size_t consumed;
+    int ret;
+
+    client = ptls_new(ctx, 0);
+    server = ptls_new(ctx_peer, 1);
+    ptls_buffer_init(&cbuf, "", 0);
+    ptls_buffer_init(&sbuf, "", 0);
+    ptls_buffer_init(&decbuf, "", 0);
+
+    ret = ptls_handshake(client, &cbuf, NULL, NULL, NULL);
+    ok(ret == PTLS_ERROR_IN_PROGRESS);
+    consumed = cbuf.off;
+    ret = ptls_handshake(server, &sbuf, cbuf.base, &consumed, NULL);
+    ok(ret == 0);
+    cbuf.off = 0;
+    consumed = sbuf.off;
+    ret = ptls_handshake(client, &cbuf, sbuf.base, &consumed, NULL);
+    ok(ret == 0);
+    sbuf.off = 0;
+    consumed = cbuf.off;
+    ret = ptls_handshake(server, &sbuf, cbuf.base, &consumed, NULL);
+    ok(ret == 0);
+    cbuf.off = 0;
+    ok(ptls_get_cipher(client) == integrity_only_cs);
+    ok(ptls_get_cipher(server) == integrity_only_cs_peer);
+
+    /* application data is sent in the clear, yet is authenticated */
+    ret = ptls_send(client, &cbuf, "hello world", 11);
+    ok(ret == 0);
+    ok(cbuf.off == 5 + 11 + 1 + integrity_only_cs->aead->tag_size);
+    ok(memcmp(cbuf.base + 5, "hello world", 11) == 0);
+    consumed = cbuf.off;
+    ret = ptls_receive(server, &decbuf, cbuf.base, &consumed);
+    ok(ret == 0);
+    ok(decbuf.off == 11 && memcmp(decbuf.base, "hello world", 11) == 0);
+    cbuf.base[5] ^= 1;
+    decbuf.off = 0;
+    consumed = cbuf.off;
+    ret = ptls_receive(server, &decbuf, cbuf.base, &consumed);
+    ok(ret == PTLS_ALERT_BAD_RECORD_MAC);
+
+    ptls_buffer_dispose(&cbuf);
+    ptls_buffer_dispose(&sbuf);
+    ptls_buffer_dispose(&decbuf);
+    ptls_free(client);
+    ptls_free(server);
 }
 
-void test_picotls_esni(ptls_key_exchange_context_t **keys)
+static void test_integrity_only_not_enabled(void)
 {
-    ptls_esni_context_t esni, *esni_list[] = {&esni, NULL};
-    ptls_esni_init_context(ctx_peer, &esni, ptls_iovec_init(ESNIKEYS, sizeof(ESNIKEYS) - 1), keys);
-    ctx_peer->esni = esni_list;
+    ptls_context_t server_ctx = *ctx_peer; /* copied before modifying ctx, as ctx and ctx_peer might be the same */
+    ptls_cipher_suite_t *cipher_suites[] = {integrity_only_cs, NULL}, **orig_cipher_suites = ctx->cipher_suites;
+    ptls_t *client, *server;
+    ptls_buffer_t cbuf, sbuf;
+    size_t consumed;
+    int ret;
+
+    ctx->cipher_suites = cipher_suites;
+    client = ptls_new(ctx, 0);
+    server = ptls_new(&server_ctx, 1);
+    ptls_buffer_init(&cbuf, "", 0);
+    ptls_buffer_init(&sbuf, "", 0);
+
+    ret = ptls_handshake(client, &cbuf, NULL, NULL, NULL);
+    ok(ret == PTLS_ERROR_IN_PROGRESS);
+    consumed = cbuf.off;
+    ret = ptls_handshake(server, &sbuf, cbuf.base, &consumed, NULL);
+    ok(ret == PTLS_ALERT_HANDSHAKE_FAILURE);
 
-    subtest("esni-handshake", test_picotls);
+    ptls_buffer_dispose(&cbuf);
+    ptls_buffer_dispose(&sbuf);
+    ptls_free(client);
+    ptls_free(server);
+    ctx->cipher_suites = orig_cipher_suites;
+}
 
-    ctx_peer->esni = NULL;
+void test_picotls_integrity_only(ptls_cipher_suite_t *cs, ptls_cipher_suite_t *cs_peer)
+{
+    ptls_cipher_suite_t *cipher_suites[] = {cs, NULL}, *cipher_suites_peer[] = {cs_peer, NULL},
+                        **orig_cipher_suites = ctx->cipher_suites, **orig_cipher_suites_peer = ctx_peer->cipher_suites;
+
+    integrity_only_cs = cs;
+    integrity_only_cs_peer = cs_peer;
+    subtest("integrity-only-aead", test_integrity_only_aead);
+
+    /* the cipher suites are used only when the server lists them */
+    subtest("integrity-only-not-enabled", test_integrity_only_not_enabled);
+    ctx->cipher_suites = cipher_suites;
+    ctx_peer->cipher_suites = cipher_suites_peer;
+    subtest("integrity-only-handshake", test_integrity_only_handshake);
+    subtest("integrity-only-key-update", test_key_update);
+
+    ctx->cipher_suites = orig_cipher_suites;
+    ctx_peer->cipher_suites = orig_cipher_suites_peer;
 }
 
 void test_key_exchange(ptls_key_exchange_algorithm_t *client, ptls_key_exchange_algorithm_t *server)
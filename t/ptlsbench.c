@@ -24,8 +24,11 @@
 #include "wincompat.h"
 #else
 #include <arpa/inet.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 #include <sys/utsname.h>
+#include <sys/wait.h>
 #include <time.h>
 #endif
 #include <assert.h>
@@ -35,7 +38,15 @@
 #include "picotls/ffx.h"
 #include "picotls/minicrypto.h"
 #include "picotls/openssl.h"
+#include "picotls/session_cache.h"
+#if PTLS_RECORD_AEAD_FUSION
+#include "picotls/fusion.h"
+#endif
+#include "sha2.h"
 #include <openssl/opensslv.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+#include "test.h"
 
 #ifdef _WINDOWS
 #include <bcrypt.h>
@@ -71,6 +82,14 @@ static uint64_t bench_time()
     return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
 }
 
+/* Wall-clock time in microseconds, for measuring work that is spread across multiple threads */
+static uint64_t bench_wallclock_time(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
 /* Single measurement.
  */
 
@@ -183,7 +202,7 @@ static int bench_run_aead(char  * OS, char * HW, int basic_ref, uint64_t s0, con
 {
     int ret = 0;
 
-    uint8_t secret[PTLS_MAX_SECRET_SIZE];
+    uint8_t secret[PTLS_MAX_DIGEST_SIZE];
     ptls_aead_context_t *e;
     ptls_aead_context_t *d;
     uint64_t t_e = 0;
@@ -253,6 +272,18 @@ static ptls_bench_entry_t aead_list[] = {
     {"minicrypto", "aes128gcm", &ptls_minicrypto_aes128gcm, &ptls_minicrypto_sha256, 0},
     {"minicrypto", "aes256gcm", &ptls_minicrypto_aes256gcm, &ptls_minicrypto_sha384, 0},
     {"minicrypto", "chacha20poly1305", &ptls_minicrypto_chacha20poly1305, &ptls_minicrypto_sha256, 1},
+    {"minicrypto", "aegis128l", &ptls_minicrypto_aegis128l, &ptls_minicrypto_sha256, 0},
+    {"minicrypto", "aegis256", &ptls_minicrypto_aegis256, &ptls_minicrypto_sha384, 0},
+    {"minicrypto", "hmacsha256", &ptls_minicrypto_integrity_sha256, &ptls_minicrypto_sha256, 0},
+    {"minicrypto", "hmacsha384", &ptls_minicrypto_integrity_sha384, &ptls_minicrypto_sha384, 0},
+#if PTLS_RECORD_AEAD_FUSION
+    {"fusion", "aes128gcm", &ptls_fusion_aes128gcm, &ptls_minicrypto_sha256, 1},
+    {"fusion", "aes256gcm", &ptls_fusion_aes256gcm, &ptls_minicrypto_sha384, 1},
+    {"fusion", "aegis128l", &ptls_fusion_aegis128l, &ptls_minicrypto_sha256, 1},
+    {"fusion", "aegis256", &ptls_fusion_aegis256, &ptls_minicrypto_sha384, 1},
+    {"fusion", "aes128gmac", &ptls_fusion_aes128gmac, &ptls_minicrypto_sha256, 1},
+    {"fusion", "aes256gmac", &ptls_fusion_aes256gmac, &ptls_minicrypto_sha384, 1},
+#endif
 #ifdef _WINDOWS
     {"ptlsbcrypt", "aes128gcm", &ptls_bcrypt_aes128gcm, &ptls_bcrypt_sha256, 1},
     {"ptlsbcrypt", "aes256gcm", &ptls_bcrypt_aes256gcm, &ptls_bcrypt_sha384, 1},
@@ -261,10 +292,822 @@ static ptls_bench_entry_t aead_list[] = {
     {"openssl", "chacha20poly1305", &ptls_openssl_chacha20poly1305, &ptls_minicrypto_sha256, 1},
 #endif
     {"openssl", "aes128gcm", &ptls_openssl_aes128gcm, &ptls_minicrypto_sha256, 1},
-    {"openssl", "aes256gcm", &ptls_openssl_aes256gcm, &ptls_minicrypto_sha384, 1}};
+    {"openssl", "aes256gcm", &ptls_openssl_aes256gcm, &ptls_minicrypto_sha384, 1},
+    {"openssl", "hmacsha256", &ptls_openssl_integrity_sha256, &ptls_minicrypto_sha256, 1},
+    {"openssl", "hmacsha384", &ptls_openssl_integrity_sha384, &ptls_minicrypto_sha384, 1}};
 
 static size_t nb_aead_list = sizeof(aead_list) / sizeof(ptls_bench_entry_t);
 
+static int bench_handshake(ptls_t *client, ptls_t *server, ptls_buffer_t *cbuf, ptls_buffer_t *sbuf, ptls_buffer_t *decbuf)
+{
+    size_t consumed;
+    int ret;
+
+    if ((ret = ptls_handshake(client, cbuf, NULL, NULL, NULL)) != PTLS_ERROR_IN_PROGRESS)
+        return ret == 0 ? PTLS_ERROR_LIBRARY : ret;
+    consumed = cbuf->off;
+    if ((ret = ptls_handshake(server, sbuf, cbuf->base, &consumed, NULL)) != 0)
+        return ret;
+    cbuf->off = 0;
+    consumed = sbuf->off;
+    if ((ret = ptls_handshake(client, cbuf, sbuf->base, &consumed, NULL)) != 0)
+        return ret;
+    consumed = cbuf->off;
+    return ptls_receive(server, decbuf, cbuf->base, &consumed);
+}
+
+/* Measure the record layer (ptls_send and ptls_receive) of a connection using the given cipher suite. When built with
+ * PTLS_RECORD_AEAD_FUSION, fusion AES-GCM is measured both through the specialized path and through the generic path, so that the
+ * two rows show the effect of the compile-time specialization.
+ */
+static int bench_run_record(char *OS, char *HW, int basic_ref, uint64_t s0, const char *provider, const char *algo_name,
+                            ptls_cipher_suite_t *cs, size_t n, size_t l, uint64_t *s)
+{
+    ptls_minicrypto_secp256r1sha256_sign_certificate_t sign_certificate;
+    ptls_iovec_t certificate = ptls_iovec_init(SECP256R1_CERTIFICATE, sizeof(SECP256R1_CERTIFICATE) - 1);
+    ptls_cipher_suite_t *cipher_suites[] = {cs, NULL};
+    ptls_context_t ctx = {ptls_openssl_random_bytes, &ptls_get_time, ptls_openssl_key_exchanges, cipher_suites, {&certificate, 1}};
+    ptls_t *client = NULL, *server = NULL;
+    ptls_buffer_t cbuf, sbuf, decbuf;
+    uint8_t *v_in = NULL;
+    uint64_t t_e = 0, t_d = 0;
+    size_t consumed;
+    int ret;
+
+    *s += s0;
+
+    ptls_minicrypto_init_secp256r1sha256_sign_certificate(
+        &sign_certificate, ptls_iovec_init(SECP256R1_PRIVATE_KEY, sizeof(SECP256R1_PRIVATE_KEY) - 1));
+    ctx.sign_certificate = &sign_certificate.super;
+    ptls_buffer_init(&cbuf, "", 0);
+    ptls_buffer_init(&sbuf, "", 0);
+    ptls_buffer_init(&decbuf, "", 0);
+
+    /* handshake */
+    if ((client = ptls_new(&ctx, 0)) == NULL || (server = ptls_new(&ctx, 1)) == NULL || (v_in = malloc(l)) == NULL) {
+        ret = PTLS_ERROR_NO_MEMORY;
+        goto Exit;
+    }
+    if ((ret = bench_handshake(client, server, &cbuf, &sbuf, &decbuf)) != 0)
+        goto Exit;
+    memset(v_in, 0, l);
+    /* allocate and touch space for one batch of records upfront so that the measurement does not include reallocs or page faults */
+    cbuf.off = 0;
+    if ((ret = ptls_buffer_reserve(&cbuf, BENCH_BATCH * (5 + l + 1 + PTLS_MAX_DIGEST_SIZE))) != 0)
+        goto Exit;
+    memset(cbuf.base, 0, cbuf.capacity);
+
+    for (size_t k = 0; k < n;) {
+        size_t i_max = ((n - k) > BENCH_BATCH) ? BENCH_BATCH : n - k;
+        uint64_t t_start, t_medium, t_end;
+
+        cbuf.off = 0;
+        decbuf.off = 0;
+        t_start = bench_time();
+        for (size_t i = 0; i < i_max; i++) {
+            if ((ret = ptls_send(client, &cbuf, v_in, l)) != 0)
+                goto Exit;
+        }
+        t_medium = bench_time();
+        for (size_t off = 0; off < cbuf.off;) {
+            decbuf.off = 0;
+            consumed = cbuf.off - off;
+            if ((ret = ptls_receive(server, &decbuf, cbuf.base + off, &consumed)) != 0)
+                goto Exit;
+            if (decbuf.off != l) {
+                ret = PTLS_ALERT_DECRYPT_ERROR;
+                goto Exit;
+            }
+            *s += decbuf.base[0] + 1;
+            off += consumed;
+        }
+        t_end = bench_time();
+
+        t_e += t_medium - t_start;
+        t_d += t_end - t_medium;
+        k += i_max;
+    }
+
+    printf("%s, %s, %d, %s, %d, %s, %s, %s, %d, %d, %d, %d, %.2f, %.2f\n", OS, HW, (int)(8 * sizeof(size_t)), BENCH_MODE, basic_ref,
+           provider, "", algo_name, (int)n, (int)l, (int)t_e, (int)t_d, bench_mbps(t_e, l, n), bench_mbps(t_d, l, n));
+
+Exit:
+    if (client != NULL)
+        ptls_free(client);
+    if (server != NULL)
+        ptls_free(server);
+    ptls_buffer_dispose(&cbuf);
+    ptls_buffer_dispose(&sbuf);
+    ptls_buffer_dispose(&decbuf);
+    free(v_in);
+    return ret;
+}
+
+/* Measure the transfer of a large amount of data, sent by one call to ptls_send and received by as many calls to ptls_receive as
+ * there are records. Both sides start from empty buffers that grow as the data is transferred, and the decrypt time includes
+ * disposing the buffers. Comparing the entries shows the cost of zero-clearing the memory of buffers that are not marked as
+ * non-sensitive.
+ * If `run_parallel` is non-NULL, ptls_send_parallel and ptls_receive_parallel are used instead, and the elapsed time becomes
+ * wall-clock time, so that the numbers show how one connection scales with the number of cores.
+ */
+static int bench_run_transfer(char *OS, char *HW, int basic_ref, uint64_t s0, const char *provider, const char *algo_name,
+                              ptls_cipher_suite_t *cs, int is_nonsensitive, ptls_run_parallel_t *run_parallel, size_t n, size_t l,
+                              uint64_t *s)
+{
+    ptls_minicrypto_secp256r1sha256_sign_certificate_t sign_certificate;
+    ptls_iovec_t certificate = ptls_iovec_init(SECP256R1_CERTIFICATE, sizeof(SECP256R1_CERTIFICATE) - 1);
+    ptls_cipher_suite_t *cipher_suites[] = {cs, NULL};
+    ptls_context_t ctx = {ptls_openssl_random_bytes, &ptls_get_time, ptls_openssl_key_exchanges, cipher_suites, {&certificate, 1}};
+    ptls_t *client = NULL, *server = NULL;
+    ptls_buffer_t cbuf, sbuf, decbuf;
+    uint8_t *v_in = NULL;
+    uint64_t t_e = 0, t_d = 0;
+    int ret;
+
+    *s += s0;
+
+    ptls_minicrypto_init_secp256r1sha256_sign_certificate(
+        &sign_certificate, ptls_iovec_init(SECP256R1_PRIVATE_KEY, sizeof(SECP256R1_PRIVATE_KEY) - 1));
+    ctx.sign_certificate = &sign_certificate.super;
+    ptls_buffer_init(&cbuf, "", 0);
+    ptls_buffer_init(&sbuf, "", 0);
+    ptls_buffer_init(&decbuf, "", 0);
+
+    if ((client = ptls_new(&ctx, 0)) == NULL || (server = ptls_new(&ctx, 1)) == NULL || (v_in = malloc(l)) == NULL) {
+        ret = PTLS_ERROR_NO_MEMORY;
+        goto Exit;
+    }
+    if ((ret = bench_handshake(client, server, &cbuf, &sbuf, &decbuf)) != 0)
+        goto Exit;
+    memset(v_in, 0, l);
+
+    for (size_t i = 0; i < n; ++i) {
+        ptls_buffer_t encbuf, plainbuf;
+        uint64_t t_start, t_medium, t_end;
+        size_t off = 0, consumed;
+
+        ptls_buffer_init(&encbuf, "", 0);
+        ptls_buffer_init(&plainbuf, "", 0);
+        encbuf.is_nonsensitive = is_nonsensitive;
+        plainbuf.is_nonsensitive = is_nonsensitive;
+        t_start = run_parallel != NULL ? bench_wallclock_time() : bench_time();
+        ret = run_parallel != NULL ? ptls_send_parallel(client, &encbuf, v_in, l, run_parallel)
+                                   : ptls_send(client, &encbuf, v_in, l);
+        t_medium = run_parallel != NULL ? bench_wallclock_time() : bench_time();
+        while (ret == 0 && off < encbuf.off) {
+            consumed = encbuf.off - off;
+            ret = run_parallel != NULL ? ptls_receive_parallel(server, &plainbuf, encbuf.base + off, &consumed, run_parallel)
+                                       : ptls_receive(server, &plainbuf, encbuf.base + off, &consumed);
+            off += consumed;
+        }
+        if (ret == 0 && plainbuf.off != l)
+            ret = PTLS_ALERT_DECRYPT_ERROR;
+        if (ret == 0)
+            *s += plainbuf.base[0] + 1;
+        ptls_buffer_dispose(&encbuf);
+        ptls_buffer_dispose(&plainbuf);
+        t_end = run_parallel != NULL ? bench_wallclock_time() : bench_time();
+        if (ret != 0)
+            goto Exit;
+
+        t_e += t_medium - t_start;
+        t_d += t_end - t_medium;
+    }
+
+    printf("%s, %s, %d, %s, %d, %s, %s, %s, %d, %d, %d, %d, %.2f, %.2f\n", OS, HW, (int)(8 * sizeof(size_t)), BENCH_MODE, basic_ref,
+           provider, "", algo_name, (int)n, (int)l, (int)t_e, (int)t_d, bench_mbps(t_e, l, n), bench_mbps(t_d, l, n));
+
+Exit:
+    if (client != NULL)
+        ptls_free(client);
+    if (server != NULL)
+        ptls_free(server);
+    ptls_buffer_dispose(&cbuf);
+    ptls_buffer_dispose(&sbuf);
+    ptls_buffer_dispose(&decbuf);
+    free(v_in);
+    return ret;
+}
+
+/* cifra used as-is, for comparing against the accelerated minicrypto hashes */
+ptls_define_hash(cifra_sha256, cf_sha256_context, cf_sha256_init, cf_sha256_update, cf_sha256_digest_final);
+ptls_define_hash(cifra_sha384, cf_sha512_context, cf_sha384_init, cf_sha384_update, cf_sha384_digest_final);
+static ptls_hash_algorithm_t cifra_sha256 = {PTLS_SHA256_BLOCK_SIZE, PTLS_SHA256_DIGEST_SIZE, cifra_sha256_create,
+                                             PTLS_ZERO_DIGEST_SHA256};
+static ptls_hash_algorithm_t cifra_sha384 = {PTLS_SHA384_BLOCK_SIZE, PTLS_SHA384_DIGEST_SIZE, cifra_sha384_create,
+                                             PTLS_ZERO_DIGEST_SHA384};
+
+/* Measure the time spent for hashing `n` messages of `l` bytes, reusing one hash context.
+ */
+static int bench_run_hash(char *OS, char *HW, int basic_ref, uint64_t s0, const char *provider, const char *algo_name,
+                          ptls_hash_algorithm_t *algo, size_t n, size_t l, uint64_t *s)
+{
+    ptls_hash_context_t *ctx;
+    uint8_t *msg, md[PTLS_MAX_DIGEST_SIZE];
+    uint64_t t0, t;
+
+    if ((msg = malloc(l)) == NULL)
+        return PTLS_ERROR_NO_MEMORY;
+    memset(msg, 0x5a, l);
+    if ((ctx = algo->create()) == NULL) {
+        free(msg);
+        return PTLS_ERROR_NO_MEMORY;
+    }
+
+    *s += s0;
+    t0 = bench_time();
+    for (size_t i = 0; i < n; ++i) {
+        msg[0] = (uint8_t)i;
+        ctx->update(ctx, msg, l);
+        ctx->final(ctx, md, PTLS_HASH_FINAL_MODE_RESET);
+        *s += md[0];
+    }
+    t = bench_time() - t0;
+
+    printf("%s, %s, %d, %s, %d, %s, %s, %s, %d, %d, %d, %.2f,\n", OS, HW, (int)(8 * sizeof(size_t)), BENCH_MODE, basic_ref,
+           provider, "", algo_name, (int)n, (int)l, (int)t, bench_mbps(t, l, n));
+
+    ctx->final(ctx, NULL, PTLS_HASH_FINAL_MODE_FREE);
+    free(msg);
+    return 0;
+}
+
+#ifndef _WINDOWS
+struct bench_random_thread_t {
+    void (*random_bytes)(void *buf, size_t len);
+    size_t n;
+    uint64_t sum;
+};
+
+static void *bench_random_thread(void *_arg)
+{
+    struct bench_random_thread_t *arg = _arg;
+    uint8_t buf[32];
+
+    for (size_t i = 0; i < arg->n; ++i) {
+        arg->random_bytes(buf, sizeof(buf));
+        arg->sum += buf[0];
+    }
+    return NULL;
+}
+
+/* Measure the number of 32-byte randoms (e.g., client_random) generated per second when `nb_threads` threads use the generator
+ * concurrently. Unlike other benchmarks, elapsed time is wall-clock time, so that contention between the threads is accounted for.
+ */
+static int bench_run_random(char *OS, char *HW, int basic_ref, uint64_t s0, const char *provider, const char *algo_name,
+                            void (*random_bytes)(void *buf, size_t len), size_t nb_threads, size_t n, uint64_t *s)
+{
+    pthread_t threads[64];
+    struct bench_random_thread_t args[64];
+    struct timeval start, end;
+    uint64_t t;
+
+    assert(nb_threads <= sizeof(threads) / sizeof(threads[0]));
+    *s += s0;
+
+    gettimeofday(&start, NULL);
+    for (size_t i = 0; i < nb_threads; ++i) {
+        args[i] = (struct bench_random_thread_t){random_bytes, n};
+        if (pthread_create(threads + i, NULL, bench_random_thread, args + i) != 0)
+            return PTLS_ERROR_LIBRARY;
+    }
+    for (size_t i = 0; i < nb_threads; ++i) {
+        pthread_join(threads[i], NULL);
+        *s += args[i].sum;
+    }
+    gettimeofday(&end, NULL);
+    t = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000 + end.tv_usec - start.tv_usec;
+
+    printf("%s, %s, %d, %s, %d, %s, %s, %s, %d, %d, %d, %.0f,\n", OS, HW, (int)(8 * sizeof(size_t)), BENCH_MODE, basic_ref,
+           provider, "", algo_name, (int)nb_threads, (int)n, (int)t, (double)nb_threads * n * 1000000 / t);
+
+    return 0;
+}
+
+struct bench_session_cache_result_t {
+    size_t hits;
+    uint64_t lookup_ns;
+};
+
+static int bench_session_cache_worker(ptls_session_cache_t *cache, ptls_context_t *ctx, int do_lookup, size_t worker,
+                                      size_t nb_procs, size_t n, uint8_t (*ids)[PTLS_SESSION_CACHE_ID_SIZE],
+                                      struct bench_session_cache_result_t *result)
+{
+    ptls_t *tls;
+    ptls_buffer_t buf;
+    uint8_t session[200];
+    int ret = 0;
+
+    if ((tls = ptls_new(ctx, 1)) == NULL)
+        return PTLS_ERROR_NO_MEMORY;
+    ptls_buffer_init(&buf, "", 0);
+    memset(session, (int)worker, sizeof(session));
+
+    for (size_t i = 0; i < n; ++i) {
+        /* issue a session */
+        buf.off = 0;
+        if ((ret = cache->super.cb(&cache->super, tls, 1, &buf, ptls_iovec_init(session, sizeof(session)))) != 0)
+            goto Exit;
+        if (!do_lookup) {
+            memcpy(ids[worker * n + i], buf.base, PTLS_SESSION_CACHE_ID_SIZE);
+            continue;
+        }
+        /* resume one of the sessions issued by the next worker */
+        struct timespec t0, t1;
+        ptls_iovec_t id = ptls_iovec_init(ids[(worker + 1) % nb_procs * n + i], PTLS_SESSION_CACHE_ID_SIZE);
+        buf.off = 0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        if (cache->super.cb(&cache->super, tls, 0, &buf, id) == 0)
+            ++result->hits;
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        result->lookup_ns += (uint64_t)(t1.tv_sec - t0.tv_sec) * 1000000000 + t1.tv_nsec - t0.tv_nsec;
+    }
+
+Exit:
+    ptls_buffer_dispose(&buf);
+    ptls_free(tls);
+    return ret;
+}
+
+/* Measure the hit rate and the latency of lookups when `nb_procs` worker processes of a pre-forking server share a session cache.
+ * Each worker first issues `n` sessions. Then, each worker resumes the sessions issued by the next one, while issuing as many new
+ * sessions. The cache has room for twice the number of sessions being issued in the first phase, therefore the misses are due
+ * to collisions and to the sessions being evicted by those issued concurrently.
+ */
+static int bench_run_session_cache(char *OS, char *HW, int basic_ref, uint64_t s0, size_t nb_procs, size_t n, uint64_t *s)
+{
+    ptls_context_t ctx = {ptls_openssl_random_bytes, &ptls_get_time};
+    ptls_session_cache_t cache = {{NULL}};
+    FILE *fp = NULL;
+    size_t ids_size = nb_procs * n * PTLS_SESSION_CACHE_ID_SIZE, hits = 0;
+    void *shared = MAP_FAILED;
+    uint8_t(*ids)[PTLS_SESSION_CACHE_ID_SIZE];
+    struct bench_session_cache_result_t *results;
+    uint64_t lookup_ns = 0;
+    int ret;
+
+    *s += s0;
+    ctx.ticket_lifetime = 86400;
+
+    if ((fp = tmpfile()) == NULL) {
+        ret = PTLS_ERROR_LIBRARY;
+        goto Exit;
+    }
+    if ((ret = ptls_session_cache_init(&cache, fileno(fp), nb_procs * n / 2, 256)) != 0)
+        goto Exit;
+    if ((shared = mmap(NULL, ids_size + sizeof(*results) * nb_procs, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1,
+                       0)) == MAP_FAILED) {
+        ret = PTLS_ERROR_NO_MEMORY;
+        goto Exit;
+    }
+    ids = shared;
+    results = (void *)((uint8_t *)shared + ids_size);
+
+    for (int do_lookup = 0; do_lookup <= 1; ++do_lookup) {
+        for (size_t i = 0; i < nb_procs; ++i) {
+            pid_t pid;
+            if ((pid = fork()) == 0)
+                _exit(bench_session_cache_worker(&cache, &ctx, do_lookup, i, nb_procs, n, ids, results + i) == 0 ? 0 : 1);
+            if (pid == -1)
+                ret = PTLS_ERROR_LIBRARY;
+        }
+        for (size_t i = 0; i < nb_procs; ++i) {
+            int status;
+            if (wait(&status) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                ret = PTLS_ERROR_LIBRARY;
+        }
+        if (ret != 0)
+            goto Exit;
+    }
+
+    for (size_t i = 0; i < nb_procs; ++i) {
+        hits += results[i].hits;
+        lookup_ns += results[i].lookup_ns;
+    }
+    *s += hits;
+
+    printf("%s, %s, %d, %s, %d, %s, %s, %s, %d, %d, %.2f, %.0f,\n", OS, HW, (int)(8 * sizeof(size_t)), BENCH_MODE, basic_ref,
+           "picotls", "", "session-cache", (int)nb_procs, (int)n, (double)hits * 100 / (nb_procs * n),
+           (double)lookup_ns / (nb_procs * n));
+
+Exit:
+    if (shared != MAP_FAILED)
+        munmap(shared, ids_size + sizeof(*results) * nb_procs);
+    ptls_session_cache_dispose(&cache);
+    if (fp != NULL)
+        fclose(fp);
+    return ret;
+}
+#endif
+
+static ptls_key_exchange_context_t *bench_load_ech_key(void)
+{
+    BIO *bio = BIO_new_mem_buf(ECH_SECP256R1KEY, (int)strlen(ECH_SECP256R1KEY));
+    EVP_PKEY *pkey = PEM_read_bio_PrivateKey(bio, NULL, NULL, NULL);
+    ptls_key_exchange_context_t *keyex = NULL;
+
+    BIO_free(bio);
+    if (pkey != NULL) {
+        ptls_openssl_create_key_exchange(&keyex, pkey);
+        EVP_PKEY_free(pkey);
+    }
+    return keyex;
+}
+
+/* Tickets are issued in clear, so that the resumption entry measures the handshake rather than the cost of protecting tickets.
+ */
+static int bench_encrypt_ticket_cb(ptls_encrypt_ticket_t *self, ptls_t *tls, int is_encrypt, ptls_buffer_t *dst, ptls_iovec_t src)
+{
+    return ptls_buffer__do_pushv(dst, src.base, src.len);
+}
+
+struct st_bench_save_ticket_t {
+    ptls_save_ticket_t super;
+    ptls_buffer_t buf;
+};
+
+static int bench_save_ticket_cb(ptls_save_ticket_t *_self, ptls_t *tls, ptls_iovec_t src)
+{
+    struct st_bench_save_ticket_t *self = (void *)_self;
+
+    self->buf.off = 0;
+    return ptls_buffer__do_pushv(&self->buf, src.base, src.len);
+}
+
+/* Measure handshakes using the given key exchange, reporting the time spent by the client and by the server separately.
+ * Everything but the key exchange, the use of ECH and the use of resumption is the same for all the entries, so the difference
+ * between the entries is the cost of the key exchange, that of ECH compared to sending the server name in clear, or the saving
+ * of resuming (i.e., no Certificate or CertificateVerify, but a PSK binder being calculated and verified).
+ */
+static int bench_run_handshake(char *OS, char *HW, int basic_ref, uint64_t s0, const char *provider, const char *algo_name,
+                               ptls_key_exchange_algorithm_t *keyex, int use_ech, int use_resumption, size_t n, uint64_t *s)
+{
+    ptls_minicrypto_secp256r1sha256_sign_certificate_t sign_certificate;
+    ptls_iovec_t certificate = ptls_iovec_init(SECP256R1_CERTIFICATE, sizeof(SECP256R1_CERTIFICATE) - 1);
+    ptls_key_exchange_algorithm_t *key_exchanges[] = {keyex, NULL};
+    ptls_cipher_suite_t *cipher_suites[] = {&ptls_openssl_aes128gcmsha256, NULL};
+    ptls_context_t ctx = {ptls_openssl_random_bytes, &ptls_get_time, key_exchanges, cipher_suites, {&certificate, 1}};
+    ptls_ech_server_config_t ech_config, *ech_configs[] = {&ech_config, NULL};
+    ptls_handshake_properties_t client_hsprop = {{{{NULL}}}};
+    ptls_encrypt_ticket_t encrypt_ticket = {bench_encrypt_ticket_cb};
+    struct st_bench_save_ticket_t save_ticket = {{bench_save_ticket_cb}};
+    ptls_t *client = NULL, *server = NULL;
+    ptls_buffer_t cbuf, sbuf, decbuf;
+    uint64_t t_c = 0, t_s = 0;
+    size_t consumed, server_flight_consumed, client_hello_size = 0;
+    int ret = 0;
+
+    *s += s0;
+    ptls_buffer_init(&save_ticket.buf, "", 0);
+
+    ptls_minicrypto_init_secp256r1sha256_sign_certificate(
+        &sign_certificate, ptls_iovec_init(SECP256R1_PRIVATE_KEY, sizeof(SECP256R1_PRIVATE_KEY) - 1));
+    ctx.sign_certificate = &sign_certificate.super;
+    ptls_buffer_init(&cbuf, "", 0);
+    ptls_buffer_init(&sbuf, "", 0);
+    ptls_buffer_init(&decbuf, "", 0);
+
+    if (use_ech) {
+        ptls_iovec_t config_list = ptls_iovec_init(ECH_CONFIG_LIST, sizeof(ECH_CONFIG_LIST) - 1);
+        ptls_key_exchange_context_t *ech_key;
+        if ((ech_key = bench_load_ech_key()) == NULL) {
+            ret = PTLS_ERROR_LIBRARY;
+            goto Exit;
+        }
+        if ((ret = ptls_ech_init_server_config(&ech_config, ptls_iovec_init(config_list.base + 2, config_list.len - 2), ech_key,
+                                               ptls_openssl_hpke_kems, ptls_openssl_hpke_cipher_suites)) != 0) {
+            ech_key->on_exchange(&ech_key, 1, NULL, ptls_iovec_init(NULL, 0));
+            goto Exit;
+        }
+        ctx.ech.client.ciphers = ptls_openssl_hpke_cipher_suites;
+        ctx.ech.client.kems = ptls_openssl_hpke_kems;
+        ctx.ech.server.configs = ech_configs;
+        client_hsprop.client.ech.configs = config_list;
+    }
+
+    if (use_resumption) {
+        ctx.ticket_lifetime = 86400;
+        ctx.encrypt_ticket = &encrypt_ticket;
+        ctx.save_ticket = &save_ticket.super;
+    }
+
+    /* when resuming, the first (full) handshake obtains the ticket and is not measured */
+    for (size_t i = 0; i < n + (use_resumption ? 1 : 0); ++i) {
+        uint64_t t0, t1, t2, t3, t4;
+        cbuf.off = 0;
+        sbuf.off = 0;
+        decbuf.off = 0;
+        if ((client = ptls_new(&ctx, 0)) == NULL || (server = ptls_new(&ctx, 1)) == NULL) {
+            ret = PTLS_ERROR_NO_MEMORY;
+            goto Exit;
+        }
+        ptls_set_server_name(client, "test.example.com", 0);
+        t0 = bench_time();
+        if ((ret = ptls_handshake(client, &cbuf, NULL, NULL, &client_hsprop)) != PTLS_ERROR_IN_PROGRESS)
+            goto Exit;
+        client_hello_size = cbuf.off;
+        t1 = bench_time();
+        consumed = cbuf.off;
+        if ((ret = ptls_handshake(server, &sbuf, cbuf.base, &consumed, NULL)) != 0)
+            goto Exit;
+        cbuf.off = 0;
+        t2 = bench_time();
+        consumed = sbuf.off;
+        if ((ret = ptls_handshake(client, &cbuf, sbuf.base, &consumed, NULL)) != 0)
+            goto Exit;
+        t3 = bench_time();
+        server_flight_consumed = consumed;
+        consumed = cbuf.off;
+        if ((ret = ptls_receive(server, &decbuf, cbuf.base, &consumed)) != 0)
+            goto Exit;
+        t4 = bench_time();
+        if (use_ech && !ptls_is_ech_handshake(server, NULL, NULL, NULL)) {
+            ret = PTLS_ALERT_ECH_REQUIRED;
+            goto Exit;
+        }
+        if (use_resumption && client_hsprop.client.session_ticket.base == NULL) {
+            /* pass the NewSessionTicket that follows the server Finished to the client, and resume from now on */
+            size_t nst_size = sbuf.off - server_flight_consumed;
+            decbuf.off = 0;
+            if ((ret = ptls_receive(client, &decbuf, sbuf.base + server_flight_consumed, &nst_size)) != 0)
+                goto Exit;
+            if (save_ticket.buf.off == 0) {
+                ret = PTLS_ERROR_LIBRARY;
+                goto Exit;
+            }
+            client_hsprop.client.session_ticket = ptls_iovec_init(save_ticket.buf.base, save_ticket.buf.off);
+            ptls_free(client);
+            client = NULL;
+            ptls_free(server);
+            server = NULL;
+            continue;
+        }
+        if (use_resumption && !ptls_is_psk_handshake(server)) {
+            ret = PTLS_ERROR_LIBRARY;
+            goto Exit;
+        }
+        t_c += (t1 - t0) + (t3 - t2);
+        t_s += (t2 - t1) + (t4 - t3);
+        *s += sbuf.base[sbuf.off - 1];
+        ptls_free(client);
+        client = NULL;
+        ptls_free(server);
+        server = NULL;
+    }
+
+    printf("%s, %s, %d, %s, %d, %s, %s, %s, %d, %d, %d, %d, %.2f, %.2f\n", OS, HW, (int)(8 * sizeof(size_t)), BENCH_MODE, basic_ref,
+           provider, "", algo_name, (int)n, (int)client_hello_size, (int)t_c, (int)t_s, (double)n * 1000000 / t_c,
+           (double)n * 1000000 / t_s);
+
+Exit:
+    if (client != NULL)
+        ptls_free(client);
+    if (server != NULL)
+        ptls_free(server);
+    if (ctx.ech.server.configs != NULL)
+        ptls_ech_dispose_server_config(&ech_config);
+    ptls_buffer_dispose(&cbuf);
+    ptls_buffer_dispose(&sbuf);
+    ptls_buffer_dispose(&decbuf);
+    ptls_buffer_dispose(&save_ticket.buf);
+    return ret;
+}
+
+#ifndef _WINDOWS
+struct bench_handshake_thread_t {
+    ptls_context_t *ctx;
+    size_t n;
+    int ret;
+    uint64_t sum;
+};
+
+static void *bench_handshake_thread(void *_arg)
+{
+    struct bench_handshake_thread_t *arg = _arg;
+    ptls_t *client = NULL, *server = NULL;
+    ptls_buffer_t cbuf, sbuf, decbuf;
+
+    ptls_buffer_init(&cbuf, "", 0);
+    ptls_buffer_init(&sbuf, "", 0);
+    ptls_buffer_init(&decbuf, "", 0);
+
+    for (size_t i = 0; arg->ret == 0 && i < arg->n; ++i) {
+        cbuf.off = 0;
+        sbuf.off = 0;
+        decbuf.off = 0;
+        if ((client = ptls_new(arg->ctx, 0)) == NULL || (server = ptls_new(arg->ctx, 1)) == NULL) {
+            arg->ret = PTLS_ERROR_NO_MEMORY;
+            break;
+        }
+        ptls_set_server_name(client, "test.example.com", 0);
+        if ((arg->ret = bench_handshake(client, server, &cbuf, &sbuf, &decbuf)) == 0)
+            arg->sum += sbuf.base[sbuf.off - 1];
+        ptls_free(client);
+        client = NULL;
+        ptls_free(server);
+        server = NULL;
+    }
+
+    if (client != NULL)
+        ptls_free(client);
+    ptls_buffer_dispose(&cbuf);
+    ptls_buffer_dispose(&sbuf);
+    ptls_buffer_dispose(&decbuf);
+    return NULL;
+}
+
+/**
+ * issues a certificate for `cn` signed by `issuer` using `key` (or a self-signed CA certificate if `issuer` is NULL)
+ */
+static X509 *bench_issue_certificate(const char *cn, X509 *issuer, EVP_PKEY *key)
+{
+    X509 *cert = X509_new();
+    X509_NAME *name = X509_NAME_new();
+
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), issuer == NULL ? 1 : 2);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)cn, -1, -1, 0);
+    X509_set_subject_name(cert, name);
+    X509_set_issuer_name(cert, issuer != NULL ? X509_get_subject_name(issuer) : name);
+    X509_gmtime_adj(X509_get_notBefore(cert), -86400);
+    X509_gmtime_adj(X509_get_notAfter(cert), 86400);
+    X509_set_pubkey(cert, key);
+    if (issuer == NULL) {
+        X509_EXTENSION *ext = X509V3_EXT_conf_nid(NULL, NULL, NID_basic_constraints, "critical,CA:TRUE");
+        X509_add_ext(cert, ext, -1);
+        X509_EXTENSION_free(ext);
+    }
+    X509_sign(cert, key, EVP_sha256());
+
+    X509_NAME_free(name);
+    return cert;
+}
+
+/* Measure the number of full handshakes per second when `nb_threads` threads run handshakes concurrently, either using one context
+ * shared by all the threads, or using one replica of the context per thread (see `ptls_openssl_init_context_replica`). The server
+ * signs using an OpenSSL key; therefore, the difference between the two shows the cost of the threads writing to the same key
+ * object. The replicas are created before the measurement starts.
+ * If `verify` is set, the client verifies the certificate using an X509_STORE holding the issuer. The replicas either share that
+ * store or use their own copies, depending on `clone_verifier`; comparing the two shows the contention on the store. Otherwise, the
+ * client does not verify the certificate, and the key does not need to match the certificate.
+ */
+static int bench_run_handshake_scaling(char *OS, char *HW, int basic_ref, uint64_t s0, int use_replica, int verify,
+                                       int clone_verifier, size_t nb_threads, size_t n, uint64_t *s)
+{
+    pthread_t threads[64];
+    struct bench_handshake_thread_t args[64];
+    ptls_openssl_context_replica_t replicas[64];
+    ptls_openssl_sign_certificate_t sign_certificate;
+    ptls_openssl_verify_certificate_t verify_certificate;
+    ptls_iovec_t certificate = ptls_iovec_init(SECP256R1_CERTIFICATE, sizeof(SECP256R1_CERTIFICATE) - 1);
+    ptls_key_exchange_algorithm_t *key_exchanges[] = {&ptls_openssl_secp256r1, NULL};
+    ptls_cipher_suite_t *cipher_suites[] = {&ptls_openssl_aes128gcmsha256, NULL};
+    ptls_context_t ctx = {ptls_openssl_random_bytes, &ptls_get_time, key_exchanges, cipher_suites, {&certificate, 1}};
+    BIO *bio = BIO_new_mem_buf(ECH_SECP256R1KEY, (int)strlen(ECH_SECP256R1KEY));
+    EVP_PKEY *pkey = PEM_read_bio_PrivateKey(bio, NULL, NULL, NULL);
+    unsigned char *leaf_der = NULL;
+    char context_name[64];
+    struct timeval start, end;
+    size_t nb_replicas = 0, nb_started = 0;
+    uint64_t t;
+    int ret = 0;
+
+    assert(nb_threads <= sizeof(threads) / sizeof(threads[0]));
+    *s += s0;
+
+    BIO_free(bio);
+    if (pkey == NULL)
+        return PTLS_ERROR_LIBRARY;
+    if (verify) {
+        /* issue a certificate chain that the client can verify; the store only holds the CA */
+        X509 *ca = bench_issue_certificate("bench CA", NULL, pkey), *leaf = bench_issue_certificate("test.example.com", ca, pkey);
+        X509_STORE *store = X509_STORE_new();
+        int len;
+        if ((len = i2d_X509(leaf, &leaf_der)) > 0 && X509_STORE_add_cert(store, ca)) {
+            certificate = ptls_iovec_init(leaf_der, len);
+            ret = ptls_openssl_init_verify_certificate(&verify_certificate, store);
+        } else {
+            ret = PTLS_ERROR_LIBRARY;
+        }
+        X509_STORE_free(store);
+        X509_free(leaf);
+        X509_free(ca);
+        if (ret != 0) {
+            EVP_PKEY_free(pkey);
+            OPENSSL_free(leaf_der);
+            return ret;
+        }
+        ctx.verify_certificate = &verify_certificate.super;
+    }
+    ret = ptls_openssl_init_sign_certificate(&sign_certificate, pkey);
+    EVP_PKEY_free(pkey);
+    if (ret != 0)
+        goto Exit;
+    ctx.sign_certificate = &sign_certificate.super;
+
+    for (size_t i = 0; i < nb_threads; ++i) {
+        args[i] = (struct bench_handshake_thread_t){&ctx, n};
+        if (use_replica) {
+            if ((ret = ptls_openssl_init_context_replica(replicas + i, &ctx, clone_verifier)) != 0)
+                goto Exit;
+            ++nb_replicas;
+            args[i].ctx = &replicas[i].ctx;
+        }
+    }
+
+    gettimeofday(&start, NULL);
+    for (; nb_started < nb_threads; ++nb_started) {
+        if (pthread_create(threads + nb_started, NULL, bench_handshake_thread, args + nb_started) != 0) {
+            ret = PTLS_ERROR_LIBRARY;
+            break;
+        }
+    }
+    for (size_t i = 0; i < nb_started; ++i) {
+        pthread_join(threads[i], NULL);
+        if (ret == 0)
+            ret = args[i].ret;
+        *s += args[i].sum;
+    }
+    gettimeofday(&end, NULL);
+    if (ret != 0)
+        goto Exit;
+    t = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000 + end.tv_usec - start.tv_usec;
+
+    snprintf(context_name, sizeof(context_name), "%s%s", use_replica ? "replicated" : "shared",
+             !verify ? "" : !use_replica ? "/verify" : clone_verifier ? "/verify-cloned-store" : "/verify-shared-store");
+    printf("%s, %s, %d, %s, %d, %s, %s, %s, %d, %d, %d, %.0f,\n", OS, HW, (int)(8 * sizeof(size_t)), BENCH_MODE, basic_ref,
+           "openssl", "", context_name, (int)nb_threads, (int)n, (int)t, (double)nb_threads * n * 1000000 / t);
+
+Exit:
+    for (size_t i = 0; i < nb_replicas; ++i)
+        ptls_openssl_dispose_context_replica(replicas + i);
+    if (ctx.sign_certificate != NULL)
+        ptls_openssl_dispose_sign_certificate(&sign_certificate);
+    if (ctx.verify_certificate != NULL)
+        ptls_openssl_dispose_verify_certificate(&verify_certificate);
+    OPENSSL_free(leaf_der);
+    return ret;
+}
+#endif
+
+typedef struct st_ptls_bench_handshake_entry_t {
+    const char *provider;
+    const char *algo_name;
+    ptls_key_exchange_algorithm_t *key_exchange;
+    int use_ech;
+    int use_resumption;
+} ptls_bench_handshake_entry_t;
+
+static ptls_bench_handshake_entry_t handshake_list[] = {
+    {"minicrypto", "x25519", &ptls_minicrypto_x25519},
+    {"minicrypto", "x25519mlkem768", &ptls_minicrypto_x25519mlkem768},
+#if PTLS_OPENSSL_HAVE_X25519
+    {"openssl", "x25519", &ptls_openssl_x25519},
+#endif
+#if PTLS_OPENSSL_HAVE_X25519MLKEM768
+    {"openssl", "x25519mlkem768", &ptls_openssl_x25519mlkem768},
+#endif
+    {"openssl", "secp256r1", &ptls_openssl_secp256r1},
+    {"openssl", "secp256r1+ech", &ptls_openssl_secp256r1, 1},
+    {"openssl", "secp256r1+resumption", &ptls_openssl_secp256r1, 0, 1},
+};
+
+static size_t nb_handshake_list = sizeof(handshake_list) / sizeof(ptls_bench_handshake_entry_t);
+
+#if PTLS_RECORD_AEAD_FUSION
+static ptls_cipher_suite_t fusion_aes128gcmsha256 = {PTLS_CIPHER_SUITE_AES_128_GCM_SHA256, &ptls_fusion_aes128gcm,
+                                                     &ptls_openssl_sha256};
+static ptls_cipher_suite_t fusion_aes256gcmsha384 = {PTLS_CIPHER_SUITE_AES_256_GCM_SHA384, &ptls_fusion_aes256gcm,
+                                                     &ptls_openssl_sha384};
+static ptls_cipher_suite_t fusion_aes128gmacsha256 = {PTLS_CIPHER_SUITE_AES_128_GMAC_SHA256, &ptls_fusion_aes128gmac,
+                                                      &ptls_openssl_sha256};
+/* A copy of ptls_fusion_aes128gcm, filled in by main. The record layer recognizes the specialized AEAD by its address, therefore
+ * records protected by the copy are encrypted and decrypted through the ptls_aead_* functions, as the other AEADs are. */
+static struct st_ptls_aead_algorithm_t fusion_aes128gcm_generic;
+static ptls_cipher_suite_t fusion_aes128gcmsha256_generic = {PTLS_CIPHER_SUITE_AES_128_GCM_SHA256, &fusion_aes128gcm_generic,
+                                                             &ptls_openssl_sha256};
+#endif
+
+typedef struct st_ptls_bench_record_entry_t {
+    const char *provider;
+    const char *algo_name;
+    ptls_cipher_suite_t *cipher_suite;
+} ptls_bench_record_entry_t;
+
+static ptls_bench_record_entry_t record_list[] = {
+#if PTLS_RECORD_AEAD_FUSION
+    {"fusion", "record-aes128gcm", &fusion_aes128gcmsha256},
+    {"fusion", "record-aes128gcm-generic", &fusion_aes128gcmsha256_generic},
+    {"fusion", "record-aes256gcm", &fusion_aes256gcmsha384},
+    {"fusion", "record-aes128gmac", &fusion_aes128gmacsha256},
+#endif
+    {"openssl", "record-aes128gcm", &ptls_openssl_aes128gcmsha256},
+    {"openssl", "record-aes256gcm", &ptls_openssl_aes256gcmsha384},
+    {"openssl", "record-sha256sha256", &ptls_openssl_sha256sha256},
+    {"openssl", "record-sha384sha384", &ptls_openssl_sha384sha384}};
+
+static size_t nb_record_list = sizeof(record_list) / sizeof(ptls_bench_record_entry_t);
+
 static int bench_basic(uint64_t *x)
 {
     uint64_t t_start = bench_time();
@@ -325,12 +1168,120 @@ int main(int argc, char **argv)
     printf("OS, HW, bits, mode, 10M ops, provider, version, algorithm, N, L, encrypt us, decrypt us, encrypt mbps, decrypt mbps,\n");
  
     for (size_t i = 0; ret == 0 && i < nb_aead_list; i++) {
+#if PTLS_RECORD_AEAD_FUSION
+        if (strcmp(aead_list[i].provider, "fusion") == 0 && !ptls_fusion_is_supported_by_cpu())
+            continue;
+#endif
         if (aead_list[i].enabled_by_defaut || force_all_tests) {
             ret = bench_run_aead(OS, HW, basic_ref, x, aead_list[i].provider, aead_list[i].algo_name, aead_list[i].aead,
                                  aead_list[i].hash, 1000, 1500, &s);
         }
     }
 
+#if PTLS_RECORD_AEAD_FUSION
+    fusion_aes128gcm_generic = ptls_fusion_aes128gcm;
+#endif
+    for (size_t i = 0; ret == 0 && i < nb_record_list; i++) {
+#if PTLS_RECORD_AEAD_FUSION
+        if (strcmp(record_list[i].provider, "fusion") == 0 && !ptls_fusion_is_supported_by_cpu())
+            continue;
+#endif
+        ret = bench_run_record(OS, HW, basic_ref, x, record_list[i].provider, record_list[i].algo_name, record_list[i].cipher_suite,
+                               1000, 16384, &s);
+    }
+
+    for (int is_nonsensitive = 0; ret == 0 && is_nonsensitive <= 1; ++is_nonsensitive) {
+        ret = bench_run_transfer(OS, HW, basic_ref, x, "openssl", is_nonsensitive ? "transfer-nonsensitive" : "transfer",
+                                 &ptls_openssl_aes128gcmsha256, is_nonsensitive, NULL, 20, 16 * 1024 * 1024, &s);
+    }
+
+#ifndef _WINDOWS
+    for (size_t cores = 1; ret == 0 && cores <= 8; cores *= 2) {
+        const char *provider = "openssl";
+        ptls_cipher_suite_t *cs = &ptls_openssl_aes128gcmsha256;
+        ptls_run_parallel_t *pool;
+        char algo_name[64];
+#if PTLS_RECORD_AEAD_FUSION
+        if (ptls_fusion_is_supported_by_cpu()) {
+            provider = "fusion";
+            cs = &fusion_aes128gcmsha256;
+        }
+#endif
+        if ((pool = ptls_thread_pool_new(cores - 1)) == NULL) {
+            ret = PTLS_ERROR_LIBRARY;
+            break;
+        }
+        sprintf(algo_name, "transfer-parallel-%zu-cores", cores);
+        ret = bench_run_transfer(OS, HW, basic_ref, x, provider, algo_name, cs, 1, pool, 20, 16 * 1024 * 1024, &s);
+        ptls_thread_pool_free(pool);
+    }
+#endif
+
+    printf("OS, HW, bits, mode, 10M ops, provider, version, hash, N, L, us, mbps,\n");
+
+    static const struct {
+        const char *provider;
+        const char *algo_name;
+        ptls_hash_algorithm_t *algo;
+    } hash_list[] = {{"openssl", "sha256", &ptls_openssl_sha256},       {"minicrypto", "sha256", &ptls_minicrypto_sha256},
+                     {"cifra", "sha256", &cifra_sha256},                {"openssl", "sha384", &ptls_openssl_sha384},
+                     {"minicrypto", "sha384", &ptls_minicrypto_sha384}, {"cifra", "sha384", &cifra_sha384}};
+    static const size_t hash_lengths[] = {64, 1500, 16384};
+    for (size_t i = 0; ret == 0 && i < sizeof(hash_list) / sizeof(hash_list[0]); i++) {
+        for (size_t j = 0; ret == 0 && j < sizeof(hash_lengths) / sizeof(hash_lengths[0]); j++)
+            ret = bench_run_hash(OS, HW, basic_ref, x, hash_list[i].provider, hash_list[i].algo_name, hash_list[i].algo,
+                                 16 * 1024 * 1024 / hash_lengths[j], hash_lengths[j], &s);
+    }
+
+#ifndef _WINDOWS
+    printf("OS, HW, bits, mode, 10M ops, provider, version, generator, threads, randoms per thread, wall-clock us, randoms/s,\n");
+
+    static const struct {
+        const char *provider;
+        const char *algo_name;
+        void (*random_bytes)(void *buf, size_t len);
+    } random_list[] = {{"openssl", "RAND_bytes", ptls_openssl_random_bytes},
+#if PTLS_OPENSSL_HAVE_CHACHA20_POLY1305
+                       {"openssl", "chacha20", ptls_openssl_chacha20_random_bytes},
+#endif
+                       {"minicrypto", "hash_drbg", ptls_minicrypto_random_bytes},
+                       {"minicrypto", "chacha20", ptls_minicrypto_chacha20_random_bytes}};
+    for (size_t i = 0; ret == 0 && i < sizeof(random_list) / sizeof(random_list[0]); i++) {
+        ret = bench_run_random(OS, HW, basic_ref, x, random_list[i].provider, random_list[i].algo_name, random_list[i].random_bytes,
+                               32, 100000, &s);
+    }
+#endif
+
+#ifndef _WINDOWS
+    printf("OS, HW, bits, mode, 10M ops, provider, version, cache, processes, lookups per process, hit rate %%, ns per lookup,\n");
+
+    for (size_t nb_procs = 1; ret == 0 && nb_procs <= 8; nb_procs *= 2)
+        ret = bench_run_session_cache(OS, HW, basic_ref, x, nb_procs, 5000, &s);
+#endif
+
+    printf("OS, HW, bits, mode, 10M ops, provider, version, key exchange, N, ClientHello bytes, client us, server us, client hs/s, "
+           "server hs/s,\n");
+
+    for (size_t i = 0; ret == 0 && i < nb_handshake_list; i++) {
+        ret = bench_run_handshake(OS, HW, basic_ref, x, handshake_list[i].provider, handshake_list[i].algo_name,
+                                  handshake_list[i].key_exchange, handshake_list[i].use_ech,
+                                  handshake_list[i].use_resumption, 1000, &s);
+    }
+
+#ifndef _WINDOWS
+    printf("OS, HW, bits, mode, 10M ops, provider, version, context, threads, handshakes per thread, wall-clock us, hs/s,\n");
+
+    for (size_t nb_threads = 1; ret == 0 && nb_threads <= 8; nb_threads *= 2) {
+        for (int use_replica = 0; ret == 0 && use_replica <= 1; ++use_replica)
+            ret = bench_run_handshake_scaling(OS, HW, basic_ref, x, use_replica, 0, 0, nb_threads, 500, &s);
+        /* the client verifies the certificate; the replicas either share the X509_STORE or use their own copies */
+        if (ret == 0)
+            ret = bench_run_handshake_scaling(OS, HW, basic_ref, x, 0, 1, 0, nb_threads, 500, &s);
+        for (int clone_verifier = 0; ret == 0 && clone_verifier <= 1; ++clone_verifier)
+            ret = bench_run_handshake_scaling(OS, HW, basic_ref, x, 1, 1, clone_verifier, nb_threads, 500, &s);
+    }
+#endif
+
     /* Gratuitous test, designed to ensure that the initial computation
      * of the basic reference benchmark is not optimized away. */
     if (s == 0){
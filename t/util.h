@@ -34,8 +34,6 @@
 #include <sys/param.h>
 #include <sys/socket.h>
 #include <sys/types.h>
-#include <arpa/nameser.h>
-#include <resolv.h>
 #include <openssl/pem.h>
 #include "picotls/pembase64.h"
 #include "picotls/openssl.h"
@@ -122,35 +120,51 @@ static inline void setup_verify_certificate(ptls_context_t *ctx)
     ctx->verify_certificate = &vc.super;
 }
 
-static inline void setup_esni(ptls_context_t *ctx, const char *esni_fn, ptls_key_exchange_context_t **key_exchanges)
+/**
+ * loads an ECHConfigList generated by picotls-ech
+ */
+static inline ptls_iovec_t load_ech_configs(const char *fn)
 {
-    uint8_t esnikeys[65536];
-    size_t esnikeys_len;
-    int ret = 0;
-
-    { /* read esnikeys */
-        FILE *fp;
-        if ((fp = fopen(esni_fn, "rb")) == NULL) {
-            fprintf(stderr, "failed to open file:%s:%s\n", esni_fn, strerror(errno));
-            exit(1);
-        }
-        esnikeys_len = fread(esnikeys, 1, sizeof(esnikeys), fp);
-        if (esnikeys_len == 0 || !feof(fp)) {
-            fprintf(stderr, "failed to load ESNI data from file:%s\n", esni_fn);
-            exit(1);
-        }
-        fclose(fp);
-    }
+    static uint8_t configs[65536];
+    size_t configs_len;
+    FILE *fp;
 
-    if ((ctx->esni = malloc(sizeof(*ctx->esni) * 2)) == NULL || (*ctx->esni = malloc(sizeof(**ctx->esni))) == NULL) {
-        fprintf(stderr, "no memory\n");
+    if ((fp = fopen(fn, "rb")) == NULL) {
+        fprintf(stderr, "failed to open file:%s:%s\n", fn, strerror(errno));
         exit(1);
     }
+    configs_len = fread(configs, 1, sizeof(configs), fp);
+    if (configs_len == 0 || !feof(fp)) {
+        fprintf(stderr, "failed to load ECH data from file:%s\n", fn);
+        exit(1);
+    }
+    fclose(fp);
 
-    if ((ret = ptls_esni_init_context(ctx, ctx->esni[0], ptls_iovec_init(esnikeys, esnikeys_len), key_exchanges)) != 0) {
-        fprintf(stderr, "failed to parse ESNI data of file:%s:error=%d\n", esni_fn, ret);
+    return ptls_iovec_init(configs, configs_len);
+}
+
+/**
+ * sets up the server to accept ECH using the first ECHConfig of the list stored in the file, while sending the entire list as
+ * retry_configs
+ */
+static inline void setup_ech(ptls_context_t *ctx, const char *fn, ptls_key_exchange_context_t *keyex)
+{
+    static ptls_ech_server_config_t config, *configs[] = {&config, NULL};
+    ptls_iovec_t list = load_ech_configs(fn);
+    size_t config_len;
+    int ret;
+
+    if (list.len < 6 || (config_len = 4 + (list.base[4] << 8 | list.base[5])) > list.len - 2) {
+        fprintf(stderr, "broken ECHConfigList in file:%s\n", fn);
+        exit(1);
+    }
+    if ((ret = ptls_ech_init_server_config(&config, ptls_iovec_init(list.base + 2, config_len), keyex, ptls_openssl_hpke_kems,
+                                           ptls_openssl_hpke_cipher_suites)) != 0) {
+        fprintf(stderr, "failed to setup ECH using file:%s:error=%d\n", fn, ret);
         exit(1);
     }
+    ctx->ech.server.configs = configs;
+    ctx->ech.server.retry_configs = list;
 }
 
 struct st_util_log_event_t {
@@ -269,61 +283,4 @@ static inline int resolve_address(struct sockaddr *sa, socklen_t *salen, const c
     return 0;
 }
 
-static inline int normalize_txt(uint8_t *p, size_t len)
-{
-    uint8_t *const end = p + len, *dst = p;
-
-    if (p == end)
-        return 0;
-
-    do {
-        size_t block_len = *p++;
-        if (end - p < block_len)
-            return 0;
-        memmove(dst, p, block_len);
-        dst += block_len;
-        p += block_len;
-    } while (p != end);
-    *dst = '\0';
-
-    return 1;
-}
-
-static inline ptls_iovec_t resolve_esni_keys(const char *server_name)
-{
-    char esni_name[256], *base64;
-    uint8_t answer[1024];
-    ns_msg msg;
-    ns_rr rr;
-    ptls_buffer_t decode_buf;
-    ptls_base64_decode_state_t ds;
-    int answer_len;
-
-    ptls_buffer_init(&decode_buf, "", 0);
-
-    if (snprintf(esni_name, sizeof(esni_name), "_esni.%s", server_name) > sizeof(esni_name) - 1)
-        goto Error;
-    if ((answer_len = res_query(esni_name, ns_c_in, ns_t_txt, answer, sizeof(answer))) <= 0)
-        goto Error;
-    if (ns_initparse(answer, answer_len, &msg) != 0)
-        goto Error;
-    if (ns_msg_count(msg, ns_s_an) < 1)
-        goto Error;
-    if (ns_parserr(&msg, ns_s_an, 0, &rr) != 0)
-        goto Error;
-    base64 = (void *)ns_rr_rdata(rr);
-    if (!normalize_txt((void *)base64, ns_rr_rdlen(rr)))
-        goto Error;
-
-    ptls_base64_decode_init(&ds);
-    if (ptls_base64_decode(base64, &ds, &decode_buf) != 0)
-        goto Error;
-    assert(decode_buf.is_allocated);
-
-    return ptls_iovec_init(decode_buf.base, decode_buf.off);
-Error:
-    ptls_buffer_dispose(&decode_buf);
-    return ptls_iovec_init(NULL, 0);
-}
-
 #endif